@@ -0,0 +1,3182 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of openfx-io <https://github.com/NatronGitHub/openfx-io>,
+ * (C) 2018-2021 The Natron Developers
+ * (C) 2013-2018 INRIA
+ *
+ * openfx-io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * openfx-io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openfx-io.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+/*
+ * iobench: a headless OpenFX host that benchmarks the reader and writer plugins.
+ *
+ * The plugin binaries (e.g. IO.ofx.bundle/Contents/Linux-x86-64/IO.ofx) are loaded directly, and for each
+ * known format whose writer and reader are found, test media is first generated by the writer, then read
+ * back by the reader using several scenarios:
+ * - write: encode all frames in order (this also generates the media for the other scenarios)
+ * - sequential: decode all frames in order, as during playback
+ * - seek: decode all frames in a pseudo-random order
+ * - parallel: decode several frames concurrently, one per host thread
+ * - tiled: decode each frame as tiles rendered concurrently (only for readers that support tiles)
+ * - proxy: decode all frames in order at a reduced render scale
+ *
+ * The thread count is the number of threads of the OFX multi-thread suite, and also the
+ * number of host render threads in the parallel and tiled scenarios.
+ * Each run executes in a separate process, so that caches and the peak resident set size
+ * are not shared between runs. One JSON object per run is printed on the standard output.
+ *
+ * This host only implements what the IO plugins need: there is no interact, no animation,
+ * no OpenGL and no multi-plane support. Image sequences are resolved by replacing the
+ * sequence of '#' characters in the file name by the frame number, as Natron does.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ofxCore.h"
+#include "ofxProperty.h"
+#include "ofxImageEffect.h"
+#include "ofxParam.h"
+#include "ofxMemory.h"
+#include "ofxMultiThread.h"
+#include "ofxMessage.h"
+#include "ofxProgress.h"
+#include "ofxTimeLine.h"
+
+// extension contexts and properties, see tuttle/ofxReadWrite.h and ofxNatron.h
+#define kIOBenchContextReader "OfxImageEffectContextReader"
+#define kIOBenchContextWriter "OfxImageEffectContextWriter"
+#define kIOBenchClipPropFormat "OfxImageClipPropFormat"
+#define kIOBenchParamFilename "filename"
+
+#define kIOBenchHostName "fr.inria.openfx.iobench"
+#define kIOBenchMediaBaseName "iobench"
+#define kIOBenchFrameRate 24.
+
+using std::string;
+using std::vector;
+
+namespace {
+unsigned int gNumThreads = 1;
+double gCurrentTime = 1.;
+OfxRangeD gTimeBounds = { 1., 1. };
+int gFormatWidth = 1920;
+int gFormatHeight = 1080;
+std::atomic<long long> gSourceGenerationMicroseconds(0); // subtracted from the encoding time
+
+thread_local unsigned int gThreadIndex = 0;
+thread_local bool gIsSpawnedThread = false;
+
+////////////////////////////////////////////////////////////////////////////////
+// properties
+
+struct Property
+{
+    enum TypeEnum
+    {
+        eTypeInt,
+        eTypeDouble,
+        eTypeString,
+        eTypePointer
+    };
+
+    TypeEnum type;
+    vector<int> ints;
+    vector<double> doubles;
+    vector<string> strings;
+    vector<void*> pointers;
+
+    Property() : type(eTypeInt) {}
+
+    int dimension() const
+    {
+        switch (type) {
+        case eTypeInt:
+            return (int)ints.size();
+        case eTypeDouble:
+            return (int)doubles.size();
+        case eTypeString:
+            return (int)strings.size();
+        case eTypePointer:
+            return (int)pointers.size();
+        }
+
+        return 0;
+    }
+};
+
+inline Property::TypeEnum propertyType(const int*) { return Property::eTypeInt; }
+inline Property::TypeEnum propertyType(const double*) { return Property::eTypeDouble; }
+inline Property::TypeEnum propertyType(const string*) { return Property::eTypeString; }
+inline Property::TypeEnum propertyType(void* const*) { return Property::eTypePointer; }
+inline vector<int>& propertyValues(Property& p, const int*) { return p.ints; }
+inline vector<double>& propertyValues(Property& p, const double*) { return p.doubles; }
+inline vector<string>& propertyValues(Property& p, const string*) { return p.strings; }
+inline vector<void*>& propertyValues(Property& p, void* const*) { return p.pointers; }
+
+/**
+ * @brief A property set, as seen by the plugin through the property suite.
+ *
+ * Getting a property that was never set returns a zero value and kOfxStatOK: the Support library
+ * asks for many optional host properties, and this host does not try to list them all.
+ */
+class PropertySet
+{
+public:
+    PropertySet() {}
+
+    PropertySet(const PropertySet& other)
+    {
+        std::lock_guard<std::mutex> guard(other._mutex);
+        _props = other._props;
+    }
+
+    virtual ~PropertySet() {}
+
+    OfxPropertySetHandle handle() { return reinterpret_cast<OfxPropertySetHandle>(this); }
+
+    static PropertySet* fromHandle(OfxPropertySetHandle h) { return reinterpret_cast<PropertySet*>(h); }
+
+    template<typename T>
+    void set(const char* name,
+             int index,
+             const T& value)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        vector<T>& values = propertyValues(slot(name, propertyType( (const T*)0 )), (const T*)0);
+
+        if ( (int)values.size() <= index ) {
+            values.resize(index + 1);
+        }
+        values[index] = value;
+    }
+
+    template<typename T>
+    void setN(const char* name,
+              int count,
+              const T* values)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        propertyValues(slot(name, propertyType( (const T*)0 )), (const T*)0).assign(values, values + count);
+    }
+
+    void setInt(const char* name, int value) { set(name, 0, value); }
+
+    void setDouble(const char* name, double value) { set(name, 0, value); }
+
+    void setString(const char* name, const string& value) { set(name, 0, value); }
+
+    void setPointer(const char* name, void* value) { set(name, 0, value); }
+
+    int getInt(const char* name, int index = 0) const
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        std::map<string, Property>::const_iterator it = _props.find(name);
+
+        if ( it == _props.end() ) {
+            return 0;
+        }
+        const Property& p = it->second;
+        if ( (p.type == Property::eTypeInt) && ( index < (int)p.ints.size() ) ) {
+            return p.ints[index];
+        }
+        if ( (p.type == Property::eTypeDouble) && ( index < (int)p.doubles.size() ) ) {
+            return (int)p.doubles[index];
+        }
+
+        return 0;
+    }
+
+    double getDouble(const char* name, int index = 0) const
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        std::map<string, Property>::const_iterator it = _props.find(name);
+
+        if ( it == _props.end() ) {
+            return 0.;
+        }
+        const Property& p = it->second;
+        if ( (p.type == Property::eTypeDouble) && ( index < (int)p.doubles.size() ) ) {
+            return p.doubles[index];
+        }
+        if ( (p.type == Property::eTypeInt) && ( index < (int)p.ints.size() ) ) {
+            return p.ints[index];
+        }
+
+        return 0.;
+    }
+
+    /** @brief the returned pointer stays valid until the property is set again */
+    const char* getString(const char* name, int index = 0) const
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        std::map<string, Property>::const_iterator it = _props.find(name);
+
+        if ( ( it != _props.end() ) && (it->second.type == Property::eTypeString) && ( index < (int)it->second.strings.size() ) ) {
+            return it->second.strings[index].c_str();
+        }
+
+        return "";
+    }
+
+    void* getPointer(const char* name, int index = 0) const
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        std::map<string, Property>::const_iterator it = _props.find(name);
+
+        if ( ( it != _props.end() ) && (it->second.type == Property::eTypePointer) && ( index < (int)it->second.pointers.size() ) ) {
+            return it->second.pointers[index];
+        }
+
+        return NULL;
+    }
+
+    int getDimension(const char* name) const
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        std::map<string, Property>::const_iterator it = _props.find(name);
+
+        return ( it == _props.end() ) ? 0 : it->second.dimension();
+    }
+
+    bool hasProperty(const char* name) const
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        return _props.find(name) != _props.end();
+    }
+
+    void reset(const char* name)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        _props.erase(name);
+    }
+
+private:
+    PropertySet& operator=(const PropertySet&); // not implemented
+
+    Property& slot(const char* name,
+                   Property::TypeEnum type)
+    {
+        Property& p = _props[name];
+
+        if (p.type != type) {
+            p = Property();
+            p.type = type;
+        }
+
+        return p;
+    }
+
+    mutable std::mutex _mutex;
+    std::map<string, Property> _props;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// parameters
+
+/** @brief replace the last sequence of '#' in the file name by the zero-padded frame number */
+string
+resolveFramePattern(const string& pattern,
+                    int frame)
+{
+    std::size_t last = pattern.find_last_of('#');
+
+    if (last == string::npos) {
+        return pattern;
+    }
+    std::size_t first = last;
+    while ( (first > 0) && (pattern[first - 1] == '#') ) {
+        --first;
+    }
+    char number[32];
+    std::snprintf(number, sizeof(number), "%0*d", (int)(last - first + 1), frame);
+
+    return pattern.substr(0, first) + number + pattern.substr(last + 1);
+}
+
+/**
+ * @brief A parameter. Animation is not supported: getting the value at any time returns the
+ * current value, except for string parameters where '#' is replaced by the frame number.
+ */
+class Param
+{
+public:
+    enum KindEnum
+    {
+        eKindNone,
+        eKindInt,
+        eKindDouble,
+        eKindString
+    };
+
+    Param(const string& name,
+          const string& type)
+        : _name(name)
+        , _kind(eKindNone)
+        , _dimension(0)
+    {
+        _props.setString(kOfxPropType, kOfxTypeParameter);
+        _props.setString(kOfxParamPropType, type);
+        _props.setString(kOfxPropName, name);
+        if ( (type == kOfxParamTypeInteger) || (type == kOfxParamTypeBoolean) || (type == kOfxParamTypeChoice) ) {
+            _kind = eKindInt;
+            _dimension = 1;
+        } else if (type == kOfxParamTypeInteger2D) {
+            _kind = eKindInt;
+            _dimension = 2;
+        } else if (type == kOfxParamTypeInteger3D) {
+            _kind = eKindInt;
+            _dimension = 3;
+        } else if (type == kOfxParamTypeDouble) {
+            _kind = eKindDouble;
+            _dimension = 1;
+        } else if (type == kOfxParamTypeDouble2D) {
+            _kind = eKindDouble;
+            _dimension = 2;
+        } else if ( (type == kOfxParamTypeDouble3D) || (type == kOfxParamTypeRGB) ) {
+            _kind = eKindDouble;
+            _dimension = 3;
+        } else if (type == kOfxParamTypeRGBA) {
+            _kind = eKindDouble;
+            _dimension = 4;
+        } else if ( (type == kOfxParamTypeString) || (type == kOfxParamTypeCustom) ) {
+            _kind = eKindString;
+            _dimension = 1;
+        }
+#ifdef kOfxParamTypeStrChoice
+        else if (type == kOfxParamTypeStrChoice) {
+            _kind = eKindString;
+            _dimension = 1;
+        }
+#endif
+    }
+
+    /** @brief instance parameter, created from a descriptor */
+    explicit Param(const Param& desc)
+        : _name(desc._name)
+        , _kind(desc._kind)
+        , _dimension(desc._dimension)
+        , _props(desc._props)
+    {
+        _props.setString(kOfxPropType, kOfxTypeParameterInstance);
+        _ints.resize(_kind == eKindInt ? _dimension : 0);
+        _doubles.resize(_kind == eKindDouble ? _dimension : 0);
+        for (int i = 0; i < (int)_ints.size(); ++i) {
+            _ints[i] = _props.getInt(kOfxParamPropDefault, i);
+        }
+        for (int i = 0; i < (int)_doubles.size(); ++i) {
+            _doubles[i] = _props.getDouble(kOfxParamPropDefault, i);
+        }
+        if (_kind == eKindString) {
+            _string = _props.getString(kOfxParamPropDefault);
+        }
+    }
+
+    OfxParamHandle handle() { return reinterpret_cast<OfxParamHandle>(this); }
+
+    static Param* fromHandle(OfxParamHandle h) { return reinterpret_cast<Param*>(h); }
+
+    const string& name() const { return _name; }
+
+    PropertySet& props() { return _props; }
+
+    OfxStatus getValue(double time,
+                       va_list ap)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        switch (_kind) {
+        case eKindInt:
+            for (int i = 0; i < _dimension; ++i) {
+                *va_arg(ap, int*) = _ints[i];
+            }
+            break;
+        case eKindDouble:
+            for (int i = 0; i < _dimension; ++i) {
+                *va_arg(ap, double*) = _doubles[i];
+            }
+            break;
+        case eKindString:
+            *va_arg(ap, char**) = const_cast<char*>( stringAt(time) );
+            break;
+        case eKindNone:
+
+            return kOfxStatErrUnsupported;
+        }
+
+        return kOfxStatOK;
+    }
+
+    OfxStatus getZero(va_list ap)
+    {
+        switch (_kind) {
+        case eKindInt:
+            for (int i = 0; i < _dimension; ++i) {
+                *va_arg(ap, int*) = 0;
+            }
+            break;
+        case eKindDouble:
+            for (int i = 0; i < _dimension; ++i) {
+                *va_arg(ap, double*) = 0.;
+            }
+            break;
+        default:
+
+            return kOfxStatErrUnsupported;
+        }
+
+        return kOfxStatOK;
+    }
+
+    OfxStatus getIntegral(double time1,
+                          double time2,
+                          va_list ap)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        if (_kind != eKindDouble) {
+            return kOfxStatErrUnsupported;
+        }
+        for (int i = 0; i < _dimension; ++i) {
+            *va_arg(ap, double*) = _doubles[i] * (time2 - time1);
+        }
+
+        return kOfxStatOK;
+    }
+
+    OfxStatus setValue(va_list ap)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        switch (_kind) {
+        case eKindInt:
+            for (int i = 0; i < _dimension; ++i) {
+                _ints[i] = va_arg(ap, int);
+            }
+            break;
+        case eKindDouble:
+            for (int i = 0; i < _dimension; ++i) {
+                _doubles[i] = va_arg(ap, double);
+            }
+            break;
+        case eKindString: {
+            const char* value = va_arg(ap, const char*);
+            setStringLocked(value ? value : "");
+            break;
+        }
+        case eKindNone:
+
+            return kOfxStatErrUnsupported;
+        }
+
+        return kOfxStatOK;
+    }
+
+    void setString(const string& value)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        setStringLocked(value);
+    }
+
+    void copyValue(Param& other)
+    {
+        if (&other == this) {
+            return;
+        }
+        std::lock(_mutex, other._mutex);
+        std::lock_guard<std::mutex> guard(_mutex, std::adopt_lock);
+        std::lock_guard<std::mutex> otherGuard(other._mutex, std::adopt_lock);
+        if ( (_kind != other._kind) || (_dimension != other._dimension) ) {
+            return;
+        }
+        _ints = other._ints;
+        _doubles = other._doubles;
+        setStringLocked(other._string);
+    }
+
+private:
+    Param& operator=(const Param&); // not implemented
+
+    void setStringLocked(const string& value)
+    {
+        // strings returned by getValue() must stay valid: keep the previous values
+        _retired.push_back(_string);
+        for (std::map<int, string>::iterator it = _resolved.begin(); it != _resolved.end(); ++it) {
+            _retired.push_back(it->second);
+        }
+        _resolved.clear();
+        _string = value;
+    }
+
+    const char* stringAt(double time)
+    {
+        if (_string.find('#') == string::npos) {
+            return _string.c_str();
+        }
+        int frame = (int)std::floor(time + 0.5);
+        std::map<int, string>::iterator it = _resolved.find(frame);
+        if ( it == _resolved.end() ) {
+            it = _resolved.insert( std::make_pair( frame, resolveFramePattern(_string, frame) ) ).first;
+        }
+
+        return it->second.c_str();
+    }
+
+    string _name;
+    KindEnum _kind;
+    int _dimension;
+    PropertySet _props;
+    std::mutex _mutex;
+    vector<int> _ints;
+    vector<double> _doubles;
+    string _string;
+    std::map<int, string> _resolved; // frame -> file name
+    std::list<string> _retired;
+};
+
+class ParamSet
+{
+public:
+    ParamSet() {}
+
+    OfxParamSetHandle handle() { return reinterpret_cast<OfxParamSetHandle>(this); }
+
+    static ParamSet* fromHandle(OfxParamSetHandle h) { return reinterpret_cast<ParamSet*>(h); }
+
+    PropertySet& props() { return _props; }
+
+    void instantiate(const ParamSet& desc)
+    {
+        for (std::size_t i = 0; i < desc._params.size(); ++i) {
+            add( new Param(*desc._params[i]) );
+        }
+    }
+
+    Param* define(const char* type,
+                  const char* name)
+    {
+        if ( find(name) ) {
+            return NULL;
+        }
+
+        return add( new Param(name, type) );
+    }
+
+    Param* find(const string& name) const
+    {
+        std::map<string, Param*>::const_iterator it = _byName.find(name);
+
+        return ( it == _byName.end() ) ? NULL : it->second;
+    }
+
+private:
+    ParamSet(const ParamSet&); // not implemented
+    ParamSet& operator=(const ParamSet&); // not implemented
+
+    Param* add(Param* param)
+    {
+        _params.push_back( std::unique_ptr<Param>(param) );
+        _byName[param->name()] = param;
+
+        return param;
+    }
+
+    PropertySet _props;
+    vector<std::unique_ptr<Param> > _params;
+    std::map<string, Param*> _byName;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// effects, clips and images
+
+class Effect;
+
+class Clip
+{
+public:
+    Clip(Effect* effect,
+         const string& name)
+        : _effect(effect)
+        , _name(name)
+    {
+    }
+
+    Clip(Effect* effect,
+         const Clip& desc)
+        : _effect(effect)
+        , _name(desc._name)
+        , _props(desc._props)
+    {
+    }
+
+    OfxImageClipHandle handle() { return reinterpret_cast<OfxImageClipHandle>(this); }
+
+    static Clip* fromHandle(OfxImageClipHandle h) { return reinterpret_cast<Clip*>(h); }
+
+    Effect* effect() const { return _effect; }
+
+    const string& name() const { return _name; }
+
+    PropertySet& props() { return _props; }
+
+private:
+    Effect* _effect;
+    string _name;
+    PropertySet _props;
+};
+
+class Effect
+{
+public:
+    explicit Effect(const string& pluginId)
+        : _pluginId(pluginId)
+    {
+        _rod.x1 = _rod.y1 = 0.;
+        _rod.x2 = gFormatWidth;
+        _rod.y2 = gFormatHeight;
+    }
+
+    /** @brief context descriptor or instance, created from a descriptor */
+    Effect(const Effect& desc,
+           bool instance)
+        : _pluginId(desc._pluginId)
+        , _props(desc._props)
+        , _rod(desc._rod)
+    {
+        if (instance) {
+            _params.instantiate(desc._params);
+            for (std::size_t i = 0; i < desc._clips.size(); ++i) {
+                _clips.push_back( std::unique_ptr<Clip>( new Clip(this, *desc._clips[i]) ) );
+            }
+        }
+    }
+
+    OfxImageEffectHandle handle() { return reinterpret_cast<OfxImageEffectHandle>(this); }
+
+    static Effect* fromHandle(OfxImageEffectHandle h) { return reinterpret_cast<Effect*>(h); }
+
+    const string& pluginId() const { return _pluginId; }
+
+    PropertySet& props() { return _props; }
+
+    ParamSet& params() { return _params; }
+
+    const vector<std::unique_ptr<Clip> >& clips() const { return _clips; }
+
+    Clip* defineClip(const char* name)
+    {
+        if ( findClip(name) ) {
+            return NULL;
+        }
+        _clips.push_back( std::unique_ptr<Clip>( new Clip(this, name) ) );
+
+        return _clips.back().get();
+    }
+
+    Clip* findClip(const string& name) const
+    {
+        for (std::size_t i = 0; i < _clips.size(); ++i) {
+            if (_clips[i]->name() == name) {
+                return _clips[i].get();
+            }
+        }
+
+        return NULL;
+    }
+
+    OfxRectD regionOfDefinition() const
+    {
+        std::lock_guard<std::mutex> guard(_rodMutex);
+
+        return _rod;
+    }
+
+    void setRegionOfDefinition(const OfxRectD& rod)
+    {
+        std::lock_guard<std::mutex> guard(_rodMutex);
+
+        _rod = rod;
+    }
+
+private:
+    Effect(const Effect&); // not implemented
+    Effect& operator=(const Effect&); // not implemented
+
+    string _pluginId;
+    PropertySet _props;
+    ParamSet _params;
+    vector<std::unique_ptr<Clip> > _clips;
+    mutable std::mutex _rodMutex;
+    OfxRectD _rod; // returned by clipGetRegionOfDefinition() on the output clip
+};
+
+/** @brief an image given to the plugin by clipGetImage(), deleted by clipReleaseImage() */
+class Image
+    : public PropertySet
+{
+public:
+    vector<float> pixels; // only used for generated source images
+};
+
+/** @brief the output image of the current render action, set on each render thread */
+struct RenderTarget
+{
+    OfxRectI bounds;
+    string components;
+    int nComps;
+    string premult;
+    double par;
+    OfxPointD renderScale;
+    vector<float> pixels;
+
+    RenderTarget()
+        : nComps(4)
+        , par(1.)
+    {
+        bounds.x1 = bounds.y1 = bounds.x2 = bounds.y2 = 0;
+        renderScale.x = renderScale.y = 1.;
+    }
+};
+
+thread_local RenderTarget* gTarget = NULL;
+
+struct ImageMemory
+{
+    void* data;
+};
+
+int
+componentsCount(const string& components)
+{
+    if (components == kOfxImageComponentRGBA) {
+        return 4;
+    } else if (components == kOfxImageComponentRGB) {
+        return 3;
+    } else if (components == kOfxImageComponentAlpha) {
+        return 1;
+    }
+
+    return 0;
+}
+
+/** @brief fill a source image with gradients and a bit of noise, so that it does not compress too well */
+void
+generateSourcePixels(int frame,
+                     int width,
+                     int height,
+                     int nComps,
+                     float* pixels)
+{
+    for (int y = 0; y < height; ++y) {
+        const float fy = (y + 0.5f) / height;
+        float* pix = pixels + (std::size_t)y * width * nComps;
+        for (int x = 0; x < width; ++x, pix += nComps) {
+            unsigned int h = ( (unsigned int)x * 73856093u ) ^ ( (unsigned int)y * 19349663u ) ^ ( (unsigned int)frame * 83492791u );
+            h ^= h >> 13;
+            h *= 0x5bd1e995u;
+            h ^= h >> 15;
+            const float noise = (h & 0xffff) * (0.02f / 65535.f);
+            const float fx = (x + 0.5f) / width;
+            const float wave = fx * 4.f + fy + frame * 0.05f;
+            const float r = fx + noise;
+            const float g = fy + noise;
+            const float b = wave - std::floor(wave);
+            switch (nComps) {
+            case 4:
+                pix[0] = r;
+                pix[1] = g;
+                pix[2] = b;
+                pix[3] = 1.f;
+                break;
+            case 3:
+                pix[0] = r;
+                pix[1] = g;
+                pix[2] = b;
+                break;
+            default:
+                pix[0] = r;
+                break;
+            }
+        }
+    }
+}
+
+void
+setImageProps(PropertySet& image,
+              void* data,
+              const OfxRectI& bounds,
+              int rowBytes,
+              const string& components,
+              const string& premult,
+              const OfxPointD& renderScale,
+              double par,
+              double time)
+{
+    image.setString(kOfxPropType, kOfxTypeImage);
+    image.setPointer(kOfxImagePropData, data);
+    int b[4] = { bounds.x1, bounds.y1, bounds.x2, bounds.y2 };
+    image.setN(kOfxImagePropBounds, 4, b);
+    image.setN(kOfxImagePropRegionOfDefinition, 4, b);
+    image.setInt(kOfxImagePropRowBytes, rowBytes);
+    image.setString(kOfxImageEffectPropComponents, components);
+    image.setString(kOfxImageEffectPropPixelDepth, kOfxBitDepthFloat);
+    image.setString(kOfxImageEffectPropPreMultiplication, premult);
+    double s[2] = { renderScale.x, renderScale.y };
+    image.setN(kOfxImageEffectPropRenderScale, 2, s);
+    image.setDouble(kOfxImagePropPixelAspectRatio, par);
+    image.setString(kOfxImagePropField, kOfxImageFieldNone);
+    char id[64];
+    std::snprintf(id, sizeof(id), "%p.%g", data, time);
+    image.setString(kOfxImagePropUniqueIdentifier, id);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// property suite
+
+OfxStatus
+propSetPointer(OfxPropertySetHandle h,
+               const char* property,
+               int index,
+               void* value)
+{
+    if (!h || !property || (index < 0) ) {
+        return kOfxStatErrBadHandle;
+    }
+    PropertySet::fromHandle(h)->set(property, index, value);
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+propSetString(OfxPropertySetHandle h,
+              const char* property,
+              int index,
+              const char* value)
+{
+    if (!h || !property || (index < 0) ) {
+        return kOfxStatErrBadHandle;
+    }
+    PropertySet::fromHandle(h)->set( property, index, string(value ? value : "") );
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+propSetDouble(OfxPropertySetHandle h,
+              const char* property,
+              int index,
+              double value)
+{
+    if (!h || !property || (index < 0) ) {
+        return kOfxStatErrBadHandle;
+    }
+    PropertySet::fromHandle(h)->set(property, index, value);
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+propSetInt(OfxPropertySetHandle h,
+           const char* property,
+           int index,
+           int value)
+{
+    if (!h || !property || (index < 0) ) {
+        return kOfxStatErrBadHandle;
+    }
+    PropertySet::fromHandle(h)->set(property, index, value);
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+propSetPointerN(OfxPropertySetHandle h,
+                const char* property,
+                int count,
+                void* const* value)
+{
+    if (!h || !property || (count < 0) ) {
+        return kOfxStatErrBadHandle;
+    }
+    PropertySet::fromHandle(h)->setN(property, count, value);
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+propSetStringN(OfxPropertySetHandle h,
+               const char* property,
+               int count,
+               const char* const* value)
+{
+    if (!h || !property || (count < 0) ) {
+        return kOfxStatErrBadHandle;
+    }
+    vector<string> values(count);
+    for (int i = 0; i < count; ++i) {
+        values[i] = value[i] ? value[i] : "";
+    }
+    PropertySet::fromHandle(h)->setN( property, count, values.empty() ? NULL : &values[0] );
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+propSetDoubleN(OfxPropertySetHandle h,
+               const char* property,
+               int count,
+               const double* value)
+{
+    if (!h || !property || (count < 0) ) {
+        return kOfxStatErrBadHandle;
+    }
+    PropertySet::fromHandle(h)->setN(property, count, value);
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+propSetIntN(OfxPropertySetHandle h,
+            const char* property,
+            int count,
+            const int* value)
+{
+    if (!h || !property || (count < 0) ) {
+        return kOfxStatErrBadHandle;
+    }
+    PropertySet::fromHandle(h)->setN(property, count, value);
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+propGetPointer(OfxPropertySetHandle h,
+               const char* property,
+               int index,
+               void** value)
+{
+    if (!h || !property || !value) {
+        return kOfxStatErrBadHandle;
+    }
+    *value = PropertySet::fromHandle(h)->getPointer(property, index);
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+propGetString(OfxPropertySetHandle h,
+              const char* property,
+              int index,
+              char** value)
+{
+    if (!h || !property || !value) {
+        return kOfxStatErrBadHandle;
+    }
+    *value = const_cast<char*>( PropertySet::fromHandle(h)->getString(property, index) );
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+propGetDouble(OfxPropertySetHandle h,
+              const char* property,
+              int index,
+              double* value)
+{
+    if (!h || !property || !value) {
+        return kOfxStatErrBadHandle;
+    }
+    *value = PropertySet::fromHandle(h)->getDouble(property, index);
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+propGetInt(OfxPropertySetHandle h,
+           const char* property,
+           int index,
+           int* value)
+{
+    if (!h || !property || !value) {
+        return kOfxStatErrBadHandle;
+    }
+    *value = PropertySet::fromHandle(h)->getInt(property, index);
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+propGetPointerN(OfxPropertySetHandle h,
+                const char* property,
+                int count,
+                void** value)
+{
+    for (int i = 0; i < count; ++i) {
+        OfxStatus status = propGetPointer(h, property, i, &value[i]);
+        if (status != kOfxStatOK) {
+            return status;
+        }
+    }
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+propGetStringN(OfxPropertySetHandle h,
+               const char* property,
+               int count,
+               char** value)
+{
+    for (int i = 0; i < count; ++i) {
+        OfxStatus status = propGetString(h, property, i, &value[i]);
+        if (status != kOfxStatOK) {
+            return status;
+        }
+    }
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+propGetDoubleN(OfxPropertySetHandle h,
+               const char* property,
+               int count,
+               double* value)
+{
+    for (int i = 0; i < count; ++i) {
+        OfxStatus status = propGetDouble(h, property, i, &value[i]);
+        if (status != kOfxStatOK) {
+            return status;
+        }
+    }
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+propGetIntN(OfxPropertySetHandle h,
+            const char* property,
+            int count,
+            int* value)
+{
+    for (int i = 0; i < count; ++i) {
+        OfxStatus status = propGetInt(h, property, i, &value[i]);
+        if (status != kOfxStatOK) {
+            return status;
+        }
+    }
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+propReset(OfxPropertySetHandle h,
+          const char* property)
+{
+    if (!h || !property) {
+        return kOfxStatErrBadHandle;
+    }
+    PropertySet::fromHandle(h)->reset(property);
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+propGetDimension(OfxPropertySetHandle h,
+                 const char* property,
+                 int* count)
+{
+    if (!h || !property || !count) {
+        return kOfxStatErrBadHandle;
+    }
+    *count = PropertySet::fromHandle(h)->getDimension(property);
+
+    return kOfxStatOK;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// image effect suite
+
+OfxStatus
+getPropertySet(OfxImageEffectHandle h,
+               OfxPropertySetHandle* propHandle)
+{
+    if (!h || !propHandle) {
+        return kOfxStatErrBadHandle;
+    }
+    *propHandle = Effect::fromHandle(h)->props().handle();
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+getParamSet(OfxImageEffectHandle h,
+            OfxParamSetHandle* paramSet)
+{
+    if (!h || !paramSet) {
+        return kOfxStatErrBadHandle;
+    }
+    *paramSet = Effect::fromHandle(h)->params().handle();
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+clipDefine(OfxImageEffectHandle h,
+           const char* name,
+           OfxPropertySetHandle* propertySet)
+{
+    if (!h || !name) {
+        return kOfxStatErrBadHandle;
+    }
+    Clip* clip = Effect::fromHandle(h)->defineClip(name);
+    if (!clip) {
+        return kOfxStatErrExists;
+    }
+    clip->props().setString(kOfxPropType, kOfxTypeClip);
+    clip->props().setString(kOfxPropName, name);
+    if (propertySet) {
+        *propertySet = clip->props().handle();
+    }
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+clipGetHandle(OfxImageEffectHandle h,
+              const char* name,
+              OfxImageClipHandle* clipHandle,
+              OfxPropertySetHandle* propertySet)
+{
+    if (!h || !name || !clipHandle) {
+        return kOfxStatErrBadHandle;
+    }
+    Clip* clip = Effect::fromHandle(h)->findClip(name);
+    if (!clip) {
+        return kOfxStatErrUnknown;
+    }
+    *clipHandle = clip->handle();
+    if (propertySet) {
+        *propertySet = clip->props().handle();
+    }
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+clipGetPropertySet(OfxImageClipHandle clip,
+                   OfxPropertySetHandle* propHandle)
+{
+    if (!clip || !propHandle) {
+        return kOfxStatErrBadHandle;
+    }
+    *propHandle = Clip::fromHandle(clip)->props().handle();
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+clipGetImage(OfxImageClipHandle h,
+             OfxTime time,
+             const OfxRectD* /*region*/,
+             OfxPropertySetHandle* imageHandle)
+{
+    if (!h || !imageHandle) {
+        return kOfxStatErrBadHandle;
+    }
+    Clip* clip = Clip::fromHandle(h);
+    if ( !clip->props().getInt(kOfxImageClipPropConnected) ) {
+        return kOfxStatFailed;
+    }
+    std::unique_ptr<Image> image(new Image);
+    if (clip->name() == kOfxImageEffectOutputClipName) {
+        RenderTarget* target = gTarget;
+        if (!target) {
+            return kOfxStatFailed;
+        }
+        const int rowBytes = (target->bounds.x2 - target->bounds.x1) * target->nComps * (int)sizeof(float);
+        setImageProps(*image, target->pixels.empty() ? NULL : &target->pixels[0], target->bounds, rowBytes,
+                      target->components, target->premult, target->renderScale, target->par, time);
+    } else {
+        // source images are generated on the fly, at full resolution
+        const string components = clip->props().getString(kOfxImageEffectPropComponents);
+        const int nComps = componentsCount(components);
+        if (nComps == 0) {
+            return kOfxStatErrFormat;
+        }
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        image->pixels.resize( (std::size_t)gFormatWidth * gFormatHeight * nComps );
+        generateSourcePixels( (int)std::floor(time + 0.5), gFormatWidth, gFormatHeight, nComps, &image->pixels[0] );
+        gSourceGenerationMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        OfxRectI bounds = { 0, 0, gFormatWidth, gFormatHeight };
+        OfxPointD scale = { 1., 1. };
+        setImageProps(*image, &image->pixels[0], bounds, gFormatWidth * nComps * (int)sizeof(float),
+                      components, clip->props().getString(kOfxImageEffectPropPreMultiplication), scale, 1., time);
+    }
+    *imageHandle = image.release()->handle();
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+clipReleaseImage(OfxPropertySetHandle imageHandle)
+{
+    if (!imageHandle) {
+        return kOfxStatErrBadHandle;
+    }
+    delete PropertySet::fromHandle(imageHandle);
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+clipGetRegionOfDefinition(OfxImageClipHandle h,
+                          OfxTime /*time*/,
+                          OfxRectD* bounds)
+{
+    if (!h || !bounds) {
+        return kOfxStatErrBadHandle;
+    }
+    Clip* clip = Clip::fromHandle(h);
+    if (clip->name() == kOfxImageEffectOutputClipName) {
+        *bounds = clip->effect()->regionOfDefinition();
+    } else {
+        bounds->x1 = bounds->y1 = 0.;
+        bounds->x2 = gFormatWidth;
+        bounds->y2 = gFormatHeight;
+    }
+
+    return kOfxStatOK;
+}
+
+int
+abortEffect(OfxImageEffectHandle /*imageEffect*/)
+{
+    return 0;
+}
+
+OfxStatus
+imageMemoryAlloc(OfxImageEffectHandle /*instanceHandle*/,
+                 size_t nBytes,
+                 OfxImageMemoryHandle* memoryHandle)
+{
+    if (!memoryHandle) {
+        return kOfxStatErrBadHandle;
+    }
+    ImageMemory* mem = new ImageMemory;
+    mem->data = std::malloc(nBytes ? nBytes : 1);
+    if (!mem->data) {
+        delete mem;
+
+        return kOfxStatErrMemory;
+    }
+    *memoryHandle = reinterpret_cast<OfxImageMemoryHandle>(mem);
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+imageMemoryFree(OfxImageMemoryHandle memoryHandle)
+{
+    if (!memoryHandle) {
+        return kOfxStatErrBadHandle;
+    }
+    ImageMemory* mem = reinterpret_cast<ImageMemory*>(memoryHandle);
+    std::free(mem->data);
+    delete mem;
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+imageMemoryLock(OfxImageMemoryHandle memoryHandle,
+                void** returnedPtr)
+{
+    if (!memoryHandle || !returnedPtr) {
+        return kOfxStatErrBadHandle;
+    }
+    *returnedPtr = reinterpret_cast<ImageMemory*>(memoryHandle)->data;
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+imageMemoryUnlock(OfxImageMemoryHandle memoryHandle)
+{
+    return memoryHandle ? kOfxStatOK : kOfxStatErrBadHandle;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// parameter suite
+
+OfxStatus
+paramDefine(OfxParamSetHandle paramSet,
+            const char* paramType,
+            const char* name,
+            OfxPropertySetHandle* propertySet)
+{
+    if (!paramSet || !paramType || !name) {
+        return kOfxStatErrBadHandle;
+    }
+    Param* param = ParamSet::fromHandle(paramSet)->define(paramType, name);
+    if (!param) {
+        return kOfxStatErrExists;
+    }
+    if (propertySet) {
+        *propertySet = param->props().handle();
+    }
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+paramGetHandle(OfxParamSetHandle paramSet,
+               const char* name,
+               OfxParamHandle* paramHandle,
+               OfxPropertySetHandle* propertySet)
+{
+    if (!paramSet || !name || !paramHandle) {
+        return kOfxStatErrBadHandle;
+    }
+    Param* param = ParamSet::fromHandle(paramSet)->find(name);
+    if (!param) {
+        return kOfxStatErrUnknown;
+    }
+    *paramHandle = param->handle();
+    if (propertySet) {
+        *propertySet = param->props().handle();
+    }
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+paramSetGetPropertySet(OfxParamSetHandle paramSet,
+                       OfxPropertySetHandle* propHandle)
+{
+    if (!paramSet || !propHandle) {
+        return kOfxStatErrBadHandle;
+    }
+    *propHandle = ParamSet::fromHandle(paramSet)->props().handle();
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+paramGetPropertySet(OfxParamHandle param,
+                    OfxPropertySetHandle* propHandle)
+{
+    if (!param || !propHandle) {
+        return kOfxStatErrBadHandle;
+    }
+    *propHandle = Param::fromHandle(param)->props().handle();
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+paramGetValue(OfxParamHandle paramHandle,
+              ...)
+{
+    if (!paramHandle) {
+        return kOfxStatErrBadHandle;
+    }
+    va_list ap;
+    va_start(ap, paramHandle);
+    OfxStatus status = Param::fromHandle(paramHandle)->getValue(gCurrentTime, ap);
+    va_end(ap);
+
+    return status;
+}
+
+OfxStatus
+paramGetValueAtTime(OfxParamHandle paramHandle,
+                    OfxTime time,
+                    ...)
+{
+    if (!paramHandle) {
+        return kOfxStatErrBadHandle;
+    }
+    va_list ap;
+    va_start(ap, time);
+    OfxStatus status = Param::fromHandle(paramHandle)->getValue(time, ap);
+    va_end(ap);
+
+    return status;
+}
+
+OfxStatus
+paramGetDerivative(OfxParamHandle paramHandle,
+                   OfxTime time,
+                   ...)
+{
+    if (!paramHandle) {
+        return kOfxStatErrBadHandle;
+    }
+    va_list ap;
+    va_start(ap, time);
+    OfxStatus status = Param::fromHandle(paramHandle)->getZero(ap);
+    va_end(ap);
+
+    return status;
+}
+
+OfxStatus
+paramGetIntegral(OfxParamHandle paramHandle,
+                 OfxTime time1,
+                 OfxTime time2,
+                 ...)
+{
+    if (!paramHandle) {
+        return kOfxStatErrBadHandle;
+    }
+    va_list ap;
+    va_start(ap, time2);
+    OfxStatus status = Param::fromHandle(paramHandle)->getIntegral(time1, time2, ap);
+    va_end(ap);
+
+    return status;
+}
+
+OfxStatus
+paramSetValue(OfxParamHandle paramHandle,
+              ...)
+{
+    if (!paramHandle) {
+        return kOfxStatErrBadHandle;
+    }
+    va_list ap;
+    va_start(ap, paramHandle);
+    OfxStatus status = Param::fromHandle(paramHandle)->setValue(ap);
+    va_end(ap);
+
+    return status;
+}
+
+OfxStatus
+paramSetValueAtTime(OfxParamHandle paramHandle,
+                    OfxTime time,
+                    ...)
+{
+    if (!paramHandle) {
+        return kOfxStatErrBadHandle;
+    }
+    va_list ap;
+    va_start(ap, time);
+    OfxStatus status = Param::fromHandle(paramHandle)->setValue(ap);
+    va_end(ap);
+
+    return status;
+}
+
+OfxStatus
+paramGetNumKeys(OfxParamHandle paramHandle,
+                unsigned int* numberOfKeys)
+{
+    if (!paramHandle || !numberOfKeys) {
+        return kOfxStatErrBadHandle;
+    }
+    *numberOfKeys = 0;
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+paramGetKeyTime(OfxParamHandle /*paramHandle*/,
+                unsigned int /*nthKey*/,
+                OfxTime* /*time*/)
+{
+    return kOfxStatErrBadIndex;
+}
+
+OfxStatus
+paramGetKeyIndex(OfxParamHandle /*paramHandle*/,
+                 OfxTime /*time*/,
+                 int /*direction*/,
+                 int* /*index*/)
+{
+    return kOfxStatFailed;
+}
+
+OfxStatus
+paramDeleteKey(OfxParamHandle /*paramHandle*/,
+               OfxTime /*time*/)
+{
+    return kOfxStatOK;
+}
+
+OfxStatus
+paramDeleteAllKeys(OfxParamHandle /*paramHandle*/)
+{
+    return kOfxStatOK;
+}
+
+OfxStatus
+paramCopy(OfxParamHandle paramTo,
+          OfxParamHandle paramFrom,
+          OfxTime /*dstOffset*/,
+          const OfxRangeD* /*frameRange*/)
+{
+    if (!paramTo || !paramFrom) {
+        return kOfxStatErrBadHandle;
+    }
+    Param::fromHandle(paramTo)->copyValue( *Param::fromHandle(paramFrom) );
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+paramEditBegin(OfxParamSetHandle /*paramSet*/,
+               const char* /*name*/)
+{
+    return kOfxStatOK;
+}
+
+OfxStatus
+paramEditEnd(OfxParamSetHandle /*paramSet*/)
+{
+    return kOfxStatOK;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// memory, multi-thread, message, progress and timeline suites
+
+OfxStatus
+memoryAlloc(void* /*handle*/,
+            size_t nBytes,
+            void** allocatedData)
+{
+    if (!allocatedData) {
+        return kOfxStatErrBadHandle;
+    }
+    *allocatedData = std::malloc(nBytes ? nBytes : 1);
+
+    return *allocatedData ? kOfxStatOK : kOfxStatErrMemory;
+}
+
+OfxStatus
+memoryFree(void* allocatedData)
+{
+    std::free(allocatedData);
+
+    return kOfxStatOK;
+}
+
+/**
+ * @brief The threads of the multi-thread suite. The calling thread takes part in the work,
+ * and only one multiThread() call runs at a time: the others wait.
+ */
+class ThreadPool
+{
+public:
+    ThreadPool()
+        : _func(NULL)
+        , _nThreads(0)
+        , _arg(NULL)
+        , _next(0)
+        , _generation(0)
+        , _busy(0)
+        , _stop(false)
+    {
+    }
+
+    ~ThreadPool()
+    {
+        stop();
+    }
+
+    void start(unsigned int nWorkers)
+    {
+        for (unsigned int i = 0; i < nWorkers; ++i) {
+            _workers.push_back( std::thread(&ThreadPool::workerLoop, this) );
+        }
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            _stop = true;
+        }
+        _wake.notify_all();
+        for (std::size_t i = 0; i < _workers.size(); ++i) {
+            _workers[i].join();
+        }
+        _workers.clear();
+    }
+
+    bool empty() const { return _workers.empty(); }
+
+    void run(OfxThreadFunctionV1* func,
+                  unsigned int nThreads,
+                  void* arg)
+    {
+        std::lock_guard<std::mutex> runGuard(_runMutex);
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            _func = func;
+            _nThreads = nThreads;
+            _arg = arg;
+            _next = 0;
+            _busy = _workers.size();
+            ++_generation;
+        }
+        _wake.notify_all();
+        process();
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done.wait(lock, [this] { return _busy == 0; });
+    }
+
+private:
+    void process()
+    {
+        const bool wasSpawned = gIsSpawnedThread;
+        const unsigned int threadIndex = gThreadIndex;
+
+        gIsSpawnedThread = true;
+        for (unsigned int i = _next++; i < _nThreads; i = _next++) {
+            gThreadIndex = i;
+            _func(i, _nThreads, _arg);
+        }
+        gIsSpawnedThread = wasSpawned;
+        gThreadIndex = threadIndex;
+    }
+
+    void workerLoop()
+    {
+        unsigned long long seen = 0;
+
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _wake.wait(lock, [&] { return _stop || (_generation != seen); });
+                if (_stop) {
+                    return;
+                }
+                seen = _generation;
+            }
+            process();
+            {
+                std::lock_guard<std::mutex> guard(_mutex);
+                --_busy;
+            }
+            _done.notify_all();
+        }
+    }
+
+    vector<std::thread> _workers;
+    std::mutex _runMutex;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    OfxThreadFunctionV1* _func;
+    unsigned int _nThreads;
+    void* _arg;
+    std::atomic<unsigned int> _next;
+    unsigned long long _generation;
+    std::size_t _busy;
+    bool _stop;
+};
+
+ThreadPool gThreadPool;
+
+OfxStatus
+multiThread(OfxThreadFunctionV1* func,
+            unsigned int nThreads,
+            void* customArg)
+{
+    if (!func) {
+        return kOfxStatFailed;
+    }
+    if ( (nThreads <= 1) || gIsSpawnedThread || gThreadPool.empty() ) {
+        // run in the calling thread (this is always the case for the host render threads)
+        const bool wasSpawned = gIsSpawnedThread;
+        const unsigned int threadIndex = gThreadIndex;
+        gIsSpawnedThread = true;
+        for (unsigned int i = 0; i < nThreads; ++i) {
+            gThreadIndex = i;
+            func(i, nThreads, customArg);
+        }
+        gIsSpawnedThread = wasSpawned;
+        gThreadIndex = threadIndex;
+
+        return kOfxStatOK;
+    }
+    gThreadPool.run(func, nThreads, customArg);
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+multiThreadNumCPUs(unsigned int* nCPUs)
+{
+    if (!nCPUs) {
+        return kOfxStatErrBadHandle;
+    }
+    *nCPUs = gNumThreads;
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+multiThreadIndex(unsigned int* threadIndex)
+{
+    if (!threadIndex) {
+        return kOfxStatErrBadHandle;
+    }
+    *threadIndex = gThreadIndex;
+
+    return kOfxStatOK;
+}
+
+int
+multiThreadIsSpawnedThread()
+{
+    return gIsSpawnedThread;
+}
+
+OfxStatus
+mutexCreate(OfxMutexHandle* mutex,
+            int lockCount)
+{
+    if (!mutex) {
+        return kOfxStatErrBadHandle;
+    }
+    std::recursive_mutex* m = new std::recursive_mutex;
+    for (int i = 0; i < lockCount; ++i) {
+        m->lock();
+    }
+    *mutex = reinterpret_cast<OfxMutexHandle>(m);
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+mutexDestroy(const OfxMutexHandle mutex)
+{
+    if (!mutex) {
+        return kOfxStatErrBadHandle;
+    }
+    delete reinterpret_cast<std::recursive_mutex*>(mutex);
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+mutexLock(const OfxMutexHandle mutex)
+{
+    if (!mutex) {
+        return kOfxStatErrBadHandle;
+    }
+    reinterpret_cast<std::recursive_mutex*>(mutex)->lock();
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+mutexUnLock(const OfxMutexHandle mutex)
+{
+    if (!mutex) {
+        return kOfxStatErrBadHandle;
+    }
+    reinterpret_cast<std::recursive_mutex*>(mutex)->unlock();
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+mutexTryLock(const OfxMutexHandle mutex)
+{
+    if (!mutex) {
+        return kOfxStatErrBadHandle;
+    }
+
+    return reinterpret_cast<std::recursive_mutex*>(mutex)->try_lock() ? kOfxStatOK : kOfxStatFailed;
+}
+
+OfxStatus
+vmessage(void* handle,
+         const char* messageType,
+         const char* format,
+         va_list ap)
+{
+    const string type = messageType ? messageType : kOfxMessageMessage;
+    const bool isQuestion = (type == kOfxMessageQuestion);
+
+    if ( (type == kOfxMessageError) || (type == kOfxMessageFatal) || (type == kOfxMessageWarning) || isQuestion ) {
+        // handle is the effect instance for all the messages posted by the Support library
+        const char* pluginId = handle ? Effect::fromHandle( (OfxImageEffectHandle)handle )->pluginId().c_str() : "host";
+        const char* label = (type == kOfxMessageWarning) ? "warning" : isQuestion ? "question" : "error";
+        std::fprintf(stderr, "iobench: %s: %s: ", pluginId, label);
+        std::vfprintf(stderr, format ? format : "", ap);
+        std::fprintf(stderr, isQuestion ? " (answering yes)\n" : "\n");
+    }
+
+    return isQuestion ? kOfxStatReplyYes : kOfxStatOK;
+}
+
+OfxStatus
+message(void* handle,
+        const char* messageType,
+        const char* /*messageId*/,
+        const char* format,
+        ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    OfxStatus status = vmessage(handle, messageType, format, ap);
+    va_end(ap);
+
+    return status;
+}
+
+OfxStatus
+setPersistentMessage(void* handle,
+                     const char* messageType,
+                     const char* /*messageId*/,
+                     const char* format,
+                     ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    OfxStatus status = vmessage(handle, messageType, format, ap);
+    va_end(ap);
+
+    return status;
+}
+
+OfxStatus
+clearPersistentMessage(void* /*handle*/)
+{
+    return kOfxStatOK;
+}
+
+OfxStatus
+progressStart(void* /*effectInstance*/,
+              const char* /*label*/)
+{
+    return kOfxStatOK;
+}
+
+OfxStatus
+progressUpdate(void* /*effectInstance*/,
+               double /*progress*/)
+{
+    return kOfxStatOK;
+}
+
+OfxStatus
+progressEnd(void* /*effectInstance*/)
+{
+    return kOfxStatOK;
+}
+
+OfxStatus
+timeLineGetTime(void* /*instance*/,
+                double* time)
+{
+    if (!time) {
+        return kOfxStatErrBadHandle;
+    }
+    *time = gCurrentTime;
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+timeLineGotoTime(void* /*instance*/,
+                 double time)
+{
+    gCurrentTime = time;
+
+    return kOfxStatOK;
+}
+
+OfxStatus
+timeLineGetTimeBounds(void* /*instance*/,
+                      double* firstTime,
+                      double* lastTime)
+{
+    if (!firstTime || !lastTime) {
+        return kOfxStatErrBadHandle;
+    }
+    *firstTime = gTimeBounds.min;
+    *lastTime = gTimeBounds.max;
+
+    return kOfxStatOK;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// host
+
+OfxPropertySuiteV1 gPropertySuite;
+OfxImageEffectSuiteV1 gImageEffectSuite;
+OfxParameterSuiteV1 gParameterSuite;
+OfxMemorySuiteV1 gMemorySuite;
+OfxMultiThreadSuiteV1 gMultiThreadSuite;
+OfxMessageSuiteV1 gMessageSuiteV1;
+OfxMessageSuiteV2 gMessageSuiteV2;
+OfxProgressSuiteV1 gProgressSuite;
+OfxTimeLineSuiteV1 gTimeLineSuite;
+PropertySet gHostProps;
+OfxHost gHost;
+
+const void*
+fetchSuite(OfxPropertySetHandle /*host*/,
+           const char* suiteName,
+           int suiteVersion)
+{
+    if (!suiteName) {
+        return NULL;
+    }
+    const string name(suiteName);
+    if ( (name == kOfxPropertySuite) && (suiteVersion == 1) ) {
+        return &gPropertySuite;
+    } else if ( (name == kOfxImageEffectSuite) && (suiteVersion == 1) ) {
+        return &gImageEffectSuite;
+    } else if ( (name == kOfxParameterSuite) && (suiteVersion == 1) ) {
+        return &gParameterSuite;
+    } else if ( (name == kOfxMemorySuite) && (suiteVersion == 1) ) {
+        return &gMemorySuite;
+    } else if ( (name == kOfxMultiThreadSuite) && (suiteVersion == 1) ) {
+        return &gMultiThreadSuite;
+    } else if ( (name == kOfxMessageSuite) && (suiteVersion == 1) ) {
+        return &gMessageSuiteV1;
+    } else if ( (name == kOfxMessageSuite) && (suiteVersion == 2) ) {
+        return &gMessageSuiteV2;
+    } else if ( (name == kOfxProgressSuite) && (suiteVersion == 1) ) {
+        return &gProgressSuite;
+    } else if ( (name == kOfxTimeLineSuite) && (suiteVersion == 1) ) {
+        return &gTimeLineSuite;
+    }
+
+    return NULL;
+}
+
+void
+initHost()
+{
+    gPropertySuite.propSetPointer = propSetPointer;
+    gPropertySuite.propSetString = propSetString;
+    gPropertySuite.propSetDouble = propSetDouble;
+    gPropertySuite.propSetInt = propSetInt;
+    gPropertySuite.propSetPointerN = propSetPointerN;
+    gPropertySuite.propSetStringN = propSetStringN;
+    gPropertySuite.propSetDoubleN = propSetDoubleN;
+    gPropertySuite.propSetIntN = propSetIntN;
+    gPropertySuite.propGetPointer = propGetPointer;
+    gPropertySuite.propGetString = propGetString;
+    gPropertySuite.propGetDouble = propGetDouble;
+    gPropertySuite.propGetInt = propGetInt;
+    gPropertySuite.propGetPointerN = propGetPointerN;
+    gPropertySuite.propGetStringN = propGetStringN;
+    gPropertySuite.propGetDoubleN = propGetDoubleN;
+    gPropertySuite.propGetIntN = propGetIntN;
+    gPropertySuite.propReset = propReset;
+    gPropertySuite.propGetDimension = propGetDimension;
+
+    gImageEffectSuite.getPropertySet = getPropertySet;
+    gImageEffectSuite.getParamSet = getParamSet;
+    gImageEffectSuite.clipDefine = clipDefine;
+    gImageEffectSuite.clipGetHandle = clipGetHandle;
+    gImageEffectSuite.clipGetPropertySet = clipGetPropertySet;
+    gImageEffectSuite.clipGetImage = clipGetImage;
+    gImageEffectSuite.clipReleaseImage = clipReleaseImage;
+    gImageEffectSuite.clipGetRegionOfDefinition = clipGetRegionOfDefinition;
+    gImageEffectSuite.abort = abortEffect;
+    gImageEffectSuite.imageMemoryAlloc = imageMemoryAlloc;
+    gImageEffectSuite.imageMemoryFree = imageMemoryFree;
+    gImageEffectSuite.imageMemoryLock = imageMemoryLock;
+    gImageEffectSuite.imageMemoryUnlock = imageMemoryUnlock;
+
+    gParameterSuite.paramDefine = paramDefine;
+    gParameterSuite.paramGetHandle = paramGetHandle;
+    gParameterSuite.paramSetGetPropertySet = paramSetGetPropertySet;
+    gParameterSuite.paramGetPropertySet = paramGetPropertySet;
+    gParameterSuite.paramGetValue = paramGetValue;
+    gParameterSuite.paramGetValueAtTime = paramGetValueAtTime;
+    gParameterSuite.paramGetDerivative = paramGetDerivative;
+    gParameterSuite.paramGetIntegral = paramGetIntegral;
+    gParameterSuite.paramSetValue = paramSetValue;
+    gParameterSuite.paramSetValueAtTime = paramSetValueAtTime;
+    gParameterSuite.paramGetNumKeys = paramGetNumKeys;
+    gParameterSuite.paramGetKeyTime = paramGetKeyTime;
+    gParameterSuite.paramGetKeyIndex = paramGetKeyIndex;
+    gParameterSuite.paramDeleteKey = paramDeleteKey;
+    gParameterSuite.paramDeleteAllKeys = paramDeleteAllKeys;
+    gParameterSuite.paramCopy = paramCopy;
+    gParameterSuite.paramEditBegin = paramEditBegin;
+    gParameterSuite.paramEditEnd = paramEditEnd;
+
+    gMemorySuite.memoryAlloc = memoryAlloc;
+    gMemorySuite.memoryFree = memoryFree;
+
+    gMultiThreadSuite.multiThread = multiThread;
+    gMultiThreadSuite.multiThreadNumCPUs = multiThreadNumCPUs;
+    gMultiThreadSuite.multiThreadIndex = multiThreadIndex;
+    gMultiThreadSuite.multiThreadIsSpawnedThread = multiThreadIsSpawnedThread;
+    gMultiThreadSuite.mutexCreate = mutexCreate;
+    gMultiThreadSuite.mutexDestroy = mutexDestroy;
+    gMultiThreadSuite.mutexLock = mutexLock;
+    gMultiThreadSuite.mutexUnLock = mutexUnLock;
+    gMultiThreadSuite.mutexTryLock = mutexTryLock;
+
+    gMessageSuiteV1.message = message;
+    gMessageSuiteV2.message = message;
+    gMessageSuiteV2.setPersistentMessage = setPersistentMessage;
+    gMessageSuiteV2.clearPersistentMessage = clearPersistentMessage;
+
+    gProgressSuite.progressStart = progressStart;
+    gProgressSuite.progressUpdate = progressUpdate;
+    gProgressSuite.progressEnd = progressEnd;
+
+    gTimeLineSuite.getTime = timeLineGetTime;
+    gTimeLineSuite.gotoTime = timeLineGotoTime;
+    gTimeLineSuite.getTimeBounds = timeLineGetTimeBounds;
+
+    PropertySet& p = gHostProps;
+    p.setString(kOfxPropType, kOfxTypeImageEffectHost);
+    p.setString(kOfxPropName, kIOBenchHostName);
+    p.setString(kOfxPropLabel, "OpenFX IO benchmark");
+    int apiVersion[2] = { 1, 4 };
+    p.setN(kOfxPropAPIVersion, 2, apiVersion);
+    int version[3] = { 1, 0, 0 };
+    p.setN(kOfxPropVersion, 3, version);
+    p.setString(kOfxPropVersionLabel, "1.0");
+    p.setInt(kOfxImageEffectHostPropIsBackground, 1);
+    p.setInt(kOfxImageEffectPropSupportsOverlays, 0);
+    p.setInt(kOfxImageEffectPropSupportsMultiResolution, 1);
+    p.setInt(kOfxImageEffectPropSupportsTiles, 1);
+    p.setInt(kOfxImageEffectPropTemporalClipAccess, 1);
+    const string components[3] = { kOfxImageComponentRGBA, kOfxImageComponentRGB, kOfxImageComponentAlpha };
+    p.setN(kOfxImageEffectPropSupportedComponents, 3, components);
+    const string depths[1] = { kOfxBitDepthFloat };
+    p.setN(kOfxImageEffectPropSupportedPixelDepths, 1, depths);
+    const string contexts[5] = { kIOBenchContextReader, kIOBenchContextWriter, kOfxImageEffectContextGenerator, kOfxImageEffectContextGeneral, kOfxImageEffectContextFilter };
+    p.setN(kOfxImageEffectPropSupportedContexts, 5, contexts);
+    p.setInt(kOfxImageEffectPropSupportsMultipleClipDepths, 0);
+    p.setInt(kOfxImageEffectPropSupportsMultipleClipPARs, 0);
+    p.setInt(kOfxImageEffectPropSetableFrameRate, 0);
+    p.setInt(kOfxImageEffectPropSetableFielding, 0);
+    p.setInt(kOfxImageEffectInstancePropSequentialRender, 1);
+    p.setInt(kOfxParamHostPropSupportsCustomInteract, 0);
+    p.setInt(kOfxParamHostPropSupportsStringAnimation, 0);
+    p.setInt(kOfxParamHostPropSupportsChoiceAnimation, 0);
+    p.setInt(kOfxParamHostPropSupportsBooleanAnimation, 0);
+    p.setInt(kOfxParamHostPropSupportsCustomAnimation, 0);
+    p.setInt(kOfxParamHostPropMaxParameters, -1);
+    p.setInt(kOfxParamHostPropMaxPages, 0);
+    int rowColumn[2] = { 0, 0 };
+    p.setN(kOfxParamHostPropPageRowColumnCount, 2, rowColumn);
+#ifdef kOfxImageEffectHostPropNativeOrigin
+    p.setString(kOfxImageEffectHostPropNativeOrigin, kOfxHostNativeOriginBottomLeft);
+#endif
+
+    gHost.host = gHostProps.handle();
+    gHost.fetchSuite = fetchSuite;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// plugins
+
+typedef int (*OfxGetNumberOfPluginsFunc)(void);
+typedef OfxPlugin* (*OfxGetPluginFunc)(int);
+typedef OfxStatus (*OfxSetHostFunc)(const OfxHost*);
+
+/** @brief load the binaries and find the plugin. The binaries stay loaded. */
+OfxPlugin*
+findPlugin(const vector<string>& binaries,
+           const string& pluginId)
+{
+    for (std::size_t b = 0; b < binaries.size(); ++b) {
+        void* lib = dlopen(binaries[b].c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (!lib) {
+            std::fprintf( stderr, "iobench: cannot load %s: %s\n", binaries[b].c_str(), dlerror() );
+            continue;
+        }
+        OfxGetNumberOfPluginsFunc getNumberOfPlugins = (OfxGetNumberOfPluginsFunc)dlsym(lib, "OfxGetNumberOfPlugins");
+        OfxGetPluginFunc getPlugin = (OfxGetPluginFunc)dlsym(lib, "OfxGetPlugin");
+        if (!getNumberOfPlugins || !getPlugin) {
+            continue;
+        }
+        OfxSetHostFunc setHost = (OfxSetHostFunc)dlsym(lib, "OfxSetHost");
+        if (setHost) {
+            setHost(&gHost);
+        }
+        const int n = getNumberOfPlugins();
+        for (int i = 0; i < n; ++i) {
+            OfxPlugin* plugin = getPlugin(i);
+            if ( plugin && plugin->pluginIdentifier && (pluginId == plugin->pluginIdentifier) &&
+                 plugin->pluginApi && (string(plugin->pluginApi) == kOfxImageEffectPluginApi) ) {
+                return plugin;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+inline bool
+succeeded(OfxStatus status)
+{
+    return (status == kOfxStatOK) || (status == kOfxStatReplyDefault);
+}
+
+/** @brief a plugin with a single instance */
+class PluginInstance
+{
+public:
+    explicit PluginInstance(OfxPlugin* plugin)
+        : _plugin(plugin)
+        , _descriptor(plugin->pluginIdentifier)
+        , _loaded(false)
+        , _created(false)
+        , _fullySafe(false)
+    {
+    }
+
+    ~PluginInstance()
+    {
+        if (_created) {
+            action(kOfxActionDestroyInstance, _instance.get(), NULL, NULL);
+        }
+        if (_loaded) {
+            action(kOfxActionUnload, NULL, NULL, NULL);
+        }
+    }
+
+    /** @brief load and describe the plugin in the first supported context */
+    bool load(const char* const* contexts,
+              int contextsCount,
+              string* error)
+    {
+        _plugin->setHost(&gHost);
+        if ( !succeeded( action(kOfxActionLoad, NULL, NULL, NULL) ) ) {
+            *error = "load action failed";
+
+            return false;
+        }
+        _loaded = true;
+        _descriptor.props().setString(kOfxPropType, kOfxTypeImageEffect);
+        if ( !succeeded( action(kOfxActionDescribe, &_descriptor, NULL, NULL) ) ) {
+            *error = "describe action failed";
+
+            return false;
+        }
+        const int supportedCount = _descriptor.props().getDimension(kOfxImageEffectPropSupportedContexts);
+        for (int c = 0; c < contextsCount && _context.empty(); ++c) {
+            for (int i = 0; i < supportedCount; ++i) {
+                if (_descriptor.props().getString(kOfxImageEffectPropSupportedContexts, i) == string(contexts[c])) {
+                    _context = contexts[c];
+                    break;
+                }
+            }
+        }
+        if ( _context.empty() ) {
+            *error = "no supported context";
+
+            return false;
+        }
+        _contextDescriptor.reset( new Effect(_descriptor, false) );
+        _contextDescriptor->props().setString(kOfxImageEffectPropContext, _context);
+        PropertySet inArgs;
+        inArgs.setString(kOfxImageEffectPropContext, _context);
+        if ( !succeeded( action(kOfxImageEffectActionDescribeInContext, _contextDescriptor.get(), &inArgs, NULL) ) ) {
+            *error = "describe in context action failed";
+
+            return false;
+        }
+        _fullySafe = ( string( _contextDescriptor->props().getString(kOfxImageEffectPluginRenderThreadSafety) ) == kOfxImageEffectRenderFullySafe );
+
+        return true;
+    }
+
+    /** @brief create the instance, with the given clips connected */
+    bool createInstance(const OfxRangeD& frameRange,
+                        bool sourceConnected,
+                        bool outputConnected,
+                        string* error)
+    {
+        _instance.reset( new Effect(*_contextDescriptor, true) );
+        PropertySet& p = _instance->props();
+        p.setString(kOfxPropType, kOfxTypeImageEffectInstance);
+        p.setString(kOfxImageEffectPropContext, _context);
+        p.setInt(kOfxPropIsInteractive, 0);
+        double size[2] = { (double)gFormatWidth, (double)gFormatHeight };
+        double offset[2] = { 0., 0. };
+        p.setN(kOfxImageEffectPropProjectSize, 2, size);
+        p.setN(kOfxImageEffectPropProjectExtent, 2, size);
+        p.setN(kOfxImageEffectPropProjectOffset, 2, offset);
+        p.setDouble(kOfxImageEffectPropProjectPixelAspectRatio, 1.);
+        p.setDouble(kOfxImageEffectInstancePropEffectDuration, frameRange.max - frameRange.min + 1);
+        p.setDouble(kOfxImageEffectPropFrameRate, kIOBenchFrameRate);
+        for (std::size_t i = 0; i < _instance->clips().size(); ++i) {
+            Clip* clip = _instance->clips()[i].get();
+            const bool isOutput = (clip->name() == kOfxImageEffectOutputClipName);
+            setupClip(clip, isOutput ? outputConnected : sourceConnected, frameRange);
+        }
+        if ( !succeeded( action(kOfxActionCreateInstance, _instance.get(), NULL, NULL) ) ) {
+            *error = "create instance action failed";
+
+            return false;
+        }
+        _created = true;
+
+        return true;
+    }
+
+    Effect* instance() const { return _instance.get(); }
+
+    bool supportsTiles() const
+    {
+        const PropertySet& p = _contextDescriptor->props();
+
+        return !p.hasProperty(kOfxImageEffectPropSupportsTiles) || p.getInt(kOfxImageEffectPropSupportsTiles);
+    }
+
+    /** @brief set a string parameter, as if the user had edited it */
+    bool setStringParam(const char* name,
+                        const string& value,
+                        string* error)
+    {
+        Param* param = _instance->params().find(name);
+
+        if (!param) {
+            *error = string("no parameter named ") + name;
+
+            return false;
+        }
+        param->setString(value);
+
+        PropertySet reasonArgs;
+        reasonArgs.setString(kOfxPropChangeReason, kOfxChangeUserEdited);
+        PropertySet inArgs;
+        inArgs.setString(kOfxPropType, kOfxTypeParameter);
+        inArgs.setString(kOfxPropName, name);
+        inArgs.setString(kOfxPropChangeReason, kOfxChangeUserEdited);
+        inArgs.setDouble(kOfxPropTime, gCurrentTime);
+        double scale[2] = { 1., 1. };
+        inArgs.setN(kOfxImageEffectPropRenderScale, 2, scale);
+        action(kOfxActionBeginInstanceChanged, _instance.get(), &reasonArgs, NULL);
+        OfxStatus status = action(kOfxActionInstanceChanged, _instance.get(), &inArgs, NULL);
+        action(kOfxActionEndInstanceChanged, _instance.get(), &reasonArgs, NULL);
+        if ( !succeeded(status) ) {
+            *error = string("instance changed action failed for parameter ") + name;
+
+            return false;
+        }
+
+        return true;
+    }
+
+    /** @brief get the clip preferences and apply them to the clips */
+    void getClipPreferences()
+    {
+        PropertySet outArgs;
+
+        if ( !succeeded( action(kOfxImageEffectActionGetClipPreferences, _instance.get(), NULL, &outArgs) ) ) {
+            return;
+        }
+        for (std::size_t i = 0; i < _instance->clips().size(); ++i) {
+            Clip* clip = _instance->clips()[i].get();
+            const string components = outArgs.getString( ("OfxImageClipPropComponents_" + clip->name()).c_str() );
+            if ( componentsCount(components) > 0 ) {
+                clip->props().setString(kOfxImageEffectPropComponents, components);
+            }
+            const string par = "OfxImageClipPropPAR_" + clip->name();
+            if ( outArgs.hasProperty( par.c_str() ) && (outArgs.getDouble( par.c_str() ) > 0.) ) {
+                clip->props().setDouble( kOfxImagePropPixelAspectRatio, outArgs.getDouble( par.c_str() ) );
+            }
+        }
+        const string premult = outArgs.getString(kOfxImageEffectPropPreMultiplication);
+        if ( !premult.empty() ) {
+            Clip* output = _instance->findClip(kOfxImageEffectOutputClipName);
+            if (output) {
+                output->props().setString(kOfxImageEffectPropPreMultiplication, premult);
+            }
+        }
+    }
+
+    bool getTimeDomain(OfxRangeD* range)
+    {
+        PropertySet outArgs;
+        OfxStatus status = action(kOfxImageEffectActionGetTimeDomain, _instance.get(), NULL, &outArgs);
+
+        if ( (status != kOfxStatOK) || (outArgs.getDimension(kOfxImageEffectPropFrameRange) != 2) ) {
+            return false;
+        }
+        range->min = outArgs.getDouble(kOfxImageEffectPropFrameRange, 0);
+        range->max = outArgs.getDouble(kOfxImageEffectPropFrameRange, 1);
+
+        return true;
+    }
+
+    bool getRegionOfDefinition(double time,
+                               const OfxPointD& renderScale,
+                               OfxRectD* rod)
+    {
+        PropertySet inArgs;
+
+        inArgs.setDouble(kOfxPropTime, time);
+        double scale[2] = { renderScale.x, renderScale.y };
+        inArgs.setN(kOfxImageEffectPropRenderScale, 2, scale);
+        PropertySet outArgs;
+        OfxStatus status = action(kOfxImageEffectActionGetRegionOfDefinition, _instance.get(), &inArgs, &outArgs);
+        if (status == kOfxStatOK) {
+            rod->x1 = outArgs.getDouble(kOfxImageEffectPropRegionOfDefinition, 0);
+            rod->y1 = outArgs.getDouble(kOfxImageEffectPropRegionOfDefinition, 1);
+            rod->x2 = outArgs.getDouble(kOfxImageEffectPropRegionOfDefinition, 2);
+            rod->y2 = outArgs.getDouble(kOfxImageEffectPropRegionOfDefinition, 3);
+        } else if (status == kOfxStatReplyDefault) {
+            rod->x1 = rod->y1 = 0.;
+            rod->x2 = gFormatWidth;
+            rod->y2 = gFormatHeight;
+        } else {
+            return false;
+        }
+        _instance->setRegionOfDefinition(*rod);
+
+        return true;
+    }
+
+    bool beginSequenceRender(const OfxRangeD& range,
+                             const OfxPointD& renderScale,
+                             bool sequential)
+    {
+        PropertySet inArgs;
+
+        setSequenceArgs(inArgs, range, renderScale, sequential);
+
+        return succeeded( action(kOfxImageEffectActionBeginSequenceRender, _instance.get(), &inArgs, NULL) );
+    }
+
+    bool endSequenceRender(const OfxRangeD& range,
+                           const OfxPointD& renderScale,
+                           bool sequential)
+    {
+        PropertySet inArgs;
+
+        setSequenceArgs(inArgs, range, renderScale, sequential);
+
+        return succeeded( action(kOfxImageEffectActionEndSequenceRender, _instance.get(), &inArgs, NULL) );
+    }
+
+    /** @brief render into gTarget. Render actions are serialized unless the plugin is fully thread-safe. */
+    bool render(double time,
+                const OfxRectI& renderWindow,
+                const OfxPointD& renderScale,
+                bool sequential)
+    {
+        PropertySet inArgs;
+
+        inArgs.setDouble(kOfxPropTime, time);
+        inArgs.setString(kOfxImageEffectPropFieldToRender, kOfxImageFieldNone);
+        int window[4] = { renderWindow.x1, renderWindow.y1, renderWindow.x2, renderWindow.y2 };
+        inArgs.setN(kOfxImageEffectPropRenderWindow, 4, window);
+        double scale[2] = { renderScale.x, renderScale.y };
+        inArgs.setN(kOfxImageEffectPropRenderScale, 2, scale);
+        inArgs.setInt(kOfxImageEffectPropSequentialRenderStatus, sequential);
+        inArgs.setInt(kOfxImageEffectPropInteractiveRenderStatus, 0);
+        inArgs.setInt(kOfxImageEffectPropRenderQualityDraft, 0);
+        if (_fullySafe) {
+            return succeeded( action(kOfxImageEffectActionRender, _instance.get(), &inArgs, NULL) );
+        }
+        std::lock_guard<std::mutex> guard(_renderMutex);
+
+        return succeeded( action(kOfxImageEffectActionRender, _instance.get(), &inArgs, NULL) );
+    }
+
+private:
+    OfxStatus action(const char* name,
+                     Effect* effect,
+                     PropertySet* inArgs,
+                     PropertySet* outArgs)
+    {
+        try {
+            return _plugin->mainEntry(name, effect ? effect->handle() : NULL, inArgs ? inArgs->handle() : NULL, outArgs ? outArgs->handle() : NULL);
+        } catch (...) {
+            std::fprintf(stderr, "iobench: %s: exception in %s\n", _plugin->pluginIdentifier, name);
+
+            return kOfxStatFailed;
+        }
+    }
+
+    static void setupClip(Clip* clip,
+                          bool connected,
+                          const OfxRangeD& frameRange)
+    {
+        PropertySet& p = clip->props();
+
+        p.setString(kOfxPropType, kOfxTypeClip);
+        p.setString(kOfxPropName, clip->name());
+        p.setInt(kOfxImageClipPropConnected, connected);
+        p.setString(kOfxImageEffectPropComponents, kOfxImageComponentRGBA);
+        p.setString(kOfxImageClipPropUnmappedComponents, kOfxImageComponentRGBA);
+        p.setString(kOfxImageEffectPropPixelDepth, kOfxBitDepthFloat);
+        p.setString(kOfxImageClipPropUnmappedPixelDepth, kOfxBitDepthFloat);
+        p.setString(kOfxImageEffectPropPreMultiplication, kOfxImagePreMultiplied);
+        p.setDouble(kOfxImagePropPixelAspectRatio, 1.);
+        p.setDouble(kOfxImageEffectPropFrameRate, kIOBenchFrameRate);
+        p.setDouble(kOfxImageEffectPropUnmappedFrameRate, kIOBenchFrameRate);
+        double range[2] = { frameRange.min, frameRange.max };
+        p.setN(kOfxImageEffectPropFrameRange, 2, range);
+        p.setN(kOfxImageEffectPropUnmappedFrameRange, 2, range);
+        p.setString(kOfxImageClipPropFieldOrder, kOfxImageFieldNone);
+        p.setInt(kOfxImageClipPropContinuousSamples, 0);
+        int format[4] = { 0, 0, gFormatWidth, gFormatHeight };
+        p.setN(kIOBenchClipPropFormat, 4, format);
+    }
+
+    static void setSequenceArgs(PropertySet& inArgs,
+                                const OfxRangeD& range,
+                                const OfxPointD& renderScale,
+                                bool sequential)
+    {
+        double frameRange[2] = { range.min, range.max };
+
+        inArgs.setN(kOfxImageEffectPropFrameRange, 2, frameRange);
+        inArgs.setDouble(kOfxImageEffectPropFrameStep, 1.);
+        inArgs.setInt(kOfxPropIsInteractive, 0);
+        double scale[2] = { renderScale.x, renderScale.y };
+        inArgs.setN(kOfxImageEffectPropRenderScale, 2, scale);
+        inArgs.setInt(kOfxImageEffectPropSequentialRenderStatus, sequential);
+        inArgs.setInt(kOfxImageEffectPropInteractiveRenderStatus, 0);
+    }
+
+    OfxPlugin* _plugin;
+    Effect _descriptor;
+    std::unique_ptr<Effect> _contextDescriptor;
+    std::unique_ptr<Effect> _instance;
+    string _context;
+    bool _loaded;
+    bool _created;
+    bool _fullySafe;
+    std::mutex _renderMutex;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// benchmarks
+
+struct FormatDesc
+{
+    const char* ext;
+    const char* writerId;
+    const char* readerId;
+    bool isMovie;
+};
+
+const FormatDesc kFormats[] = {
+    { "exr", "fr.inria.openfx.WriteEXR", "fr.inria.openfx.ReadEXR", false },
+    { "tif", "fr.inria.openfx.WriteOIIO", "fr.inria.openfx.ReadOIIO", false },
+    { "png", "fr.inria.openfx.WritePNG", "fr.inria.openfx.ReadPNG", false },
+    { "pfm", "fr.inria.openfx.WritePFM", "fr.inria.openfx.ReadPFM", false },
+    { "mov", "fr.inria.openfx.WriteFFmpeg", "fr.inria.openfx.ReadFFmpeg", true },
+};
+
+struct Options
+{
+    vector<string> binaries;
+    vector<string> formats;
+    vector<string> scenarios;
+    vector<unsigned int> threads;
+    vector<double> scales;
+    int frames;
+    int tileSize;
+    string mediaDir;
+    bool keepMedia;
+
+    Options()
+        : frames(24)
+        , tileSize(256)
+        , keepMedia(false)
+    {
+    }
+};
+
+struct Result
+{
+    string status;
+    string message;
+    int frames;
+    double seconds;
+    double pixelBytes;
+    double fileBytes;
+
+    Result()
+        : status("ok")
+        , frames(0)
+        , seconds(0.)
+        , pixelBytes(0.)
+        , fileBytes(0.)
+    {
+    }
+
+    Result& fail(const string& msg)
+    {
+        status = "failed";
+        message = msg;
+
+        return *this;
+    }
+};
+
+string
+mediaFileName(const Options& opt,
+              const FormatDesc& fmt)
+{
+    return opt.mediaDir + "/" kIOBenchMediaBaseName + (fmt.isMovie ? "." : ".####.") + fmt.ext;
+}
+
+double
+fileSize(const string& fileName)
+{
+    struct stat st;
+
+    return (stat(fileName.c_str(), &st) == 0) ? (double)st.st_size : 0.;
+}
+
+OfxRectI
+toPixelEnclosing(const OfxRectD& rect,
+                 const OfxPointD& scale,
+                 double par)
+{
+    OfxRectI r;
+
+    r.x1 = (int)std::floor(rect.x1 * scale.x / par);
+    r.y1 = (int)std::floor(rect.y1 * scale.y);
+    r.x2 = (int)std::ceil(rect.x2 * scale.x / par);
+    r.y2 = (int)std::ceil(rect.y2 * scale.y);
+
+    return r;
+}
+
+void
+setupTarget(RenderTarget& target,
+            Clip* output,
+            const OfxRectI& bounds,
+            const OfxPointD& scale)
+{
+    target.components = output->props().getString(kOfxImageEffectPropComponents);
+    target.nComps = componentsCount(target.components);
+    if (target.nComps == 0) {
+        target.components = kOfxImageComponentRGBA;
+        target.nComps = 4;
+    }
+    target.premult = output->props().getString(kOfxImageEffectPropPreMultiplication);
+    target.par = output->props().getDouble(kOfxImagePropPixelAspectRatio);
+    if (target.par <= 0.) {
+        target.par = 1.;
+    }
+    target.bounds = bounds;
+    target.renderScale = scale;
+    target.pixels.resize( (std::size_t)(bounds.x2 - bounds.x1) * (bounds.y2 - bounds.y1) * target.nComps );
+}
+
+double
+secondsSince(const std::chrono::steady_clock::time_point& start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/** @brief encode all frames, which also generates the media for the read scenarios */
+Result
+runWrite(const Options& opt,
+         const FormatDesc& fmt)
+{
+    Result result;
+    OfxPlugin* plugin = findPlugin(opt.binaries, fmt.writerId);
+
+    if (!plugin) {
+        return result.fail("plugin not found");
+    }
+    PluginInstance writer(plugin);
+    const char* contexts[] = { kIOBenchContextWriter };
+    const OfxRangeD range = { 1., (double)opt.frames };
+    const OfxPointD scale = { 1., 1. };
+    const string fileName = mediaFileName(opt, fmt);
+    string error;
+    gTimeBounds = range;
+    gCurrentTime = range.min;
+    if ( !writer.load(contexts, 1, &error) ||
+         !writer.createInstance(range, /*sourceConnected=*/true, /*outputConnected=*/false, &error) ||
+         !writer.setStringParam(kIOBenchParamFilename, fileName, &error) ) {
+        return result.fail(error);
+    }
+    writer.getClipPreferences();
+    Clip* source = writer.instance()->findClip(kOfxImageEffectSimpleSourceClipName);
+    if (!source) {
+        return result.fail("no source clip");
+    }
+    const int nComps = componentsCount( source->props().getString(kOfxImageEffectPropComponents) );
+    const OfxRectI window = { 0, 0, gFormatWidth, gFormatHeight };
+
+    gSourceGenerationMicroseconds = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if ( !writer.beginSequenceRender(range, scale, /*sequential=*/true) ) {
+        return result.fail("begin sequence render failed");
+    }
+    for (int frame = (int)range.min; frame <= (int)range.max; ++frame) {
+        if ( !writer.render(frame, window, scale, /*sequential=*/true) ) {
+            char msg[64];
+            std::snprintf(msg, sizeof(msg), "render failed at frame %d", frame);
+
+            return result.fail(msg);
+        }
+        ++result.frames;
+        result.pixelBytes += (double)gFormatWidth * gFormatHeight * nComps * sizeof(float);
+    }
+    if ( !writer.endSequenceRender(range, scale, /*sequential=*/true) ) {
+        return result.fail("end sequence render failed");
+    }
+    result.seconds = secondsSince(start) - gSourceGenerationMicroseconds * 1e-6;
+
+    if (fmt.isMovie) {
+        result.fileBytes = fileSize(fileName);
+    } else {
+        for (int frame = (int)range.min; frame <= (int)range.max; ++frame) {
+            result.fileBytes += fileSize( resolveFramePattern(fileName, frame) );
+        }
+    }
+    if (result.fileBytes == 0.) {
+        return result.fail("no file was written");
+    }
+
+    return result;
+}
+
+/** @brief decode the media written by runWrite(), using the given scenario */
+Result
+runRead(const Options& opt,
+        const FormatDesc& fmt,
+        const string& scenario,
+        unsigned int threads,
+        double proxyScale)
+{
+    Result result;
+    OfxPlugin* plugin = findPlugin(opt.binaries, fmt.readerId);
+
+    if (!plugin) {
+        return result.fail("plugin not found");
+    }
+    PluginInstance reader(plugin);
+    const char* contexts[] = { kIOBenchContextReader, kOfxImageEffectContextGenerator, kOfxImageEffectContextGeneral };
+    OfxRangeD range = { 1., (double)opt.frames };
+    const string fileName = mediaFileName(opt, fmt);
+    string error;
+    gTimeBounds = range;
+    gCurrentTime = range.min;
+    if ( !reader.load(contexts, 3, &error) ||
+         !reader.createInstance(range, /*sourceConnected=*/false, /*outputConnected=*/true, &error) ||
+         !reader.setStringParam(kIOBenchParamFilename, fileName, &error) ) {
+        return result.fail(error);
+    }
+    reader.getClipPreferences();
+    if ( reader.getTimeDomain(&range) ) {
+        gTimeBounds = range;
+    }
+    if ( (scenario == "tiled") && !reader.supportsTiles() ) {
+        result.status = "skipped";
+        result.message = "the reader does not support tiles";
+
+        return result;
+    }
+    Clip* output = reader.instance()->findClip(kOfxImageEffectOutputClipName);
+    if (!output) {
+        return result.fail("no output clip");
+    }
+
+    vector<int> frames;
+    for (int frame = (int)range.min; frame <= (int)range.max; ++frame) {
+        frames.push_back(frame);
+    }
+    if (scenario == "seek") {
+        std::mt19937 generator(1); // the same order for every run
+        std::shuffle(frames.begin(), frames.end(), generator);
+    }
+    const bool sequential = (scenario == "sequential") || (scenario == "proxy");
+    const bool parallelFrames = (scenario == "parallel");
+    const bool tiled = (scenario == "tiled");
+    const OfxPointD scale = { proxyScale, proxyScale };
+    const double totalFileBytes = fmt.isMovie ? fileSize(fileName) : 0.;
+
+    std::mutex resultMutex;
+    std::atomic<bool> failed(false);
+    int failedFrame = 0;
+    // render one frame, possibly as tiles distributed over the host render threads
+    auto renderFrame = [&](int frame,
+                           RenderTarget& target,
+                           unsigned int tileThreads) -> bool {
+        OfxRectD rod;
+        if ( !reader.getRegionOfDefinition(frame, scale, &rod) ) {
+            return false;
+        }
+        const OfxRectI bounds = toPixelEnclosing( rod, scale, output->props().getDouble(kOfxImagePropPixelAspectRatio) );
+        setupTarget(target, output, bounds, scale);
+        if (tileThreads <= 1) {
+            gTarget = &target;
+            bool ok = reader.render(frame, bounds, scale, sequential);
+            gTarget = NULL;
+
+            return ok;
+        }
+        vector<OfxRectI> tiles;
+        for (int y = bounds.y1; y < bounds.y2; y += opt.tileSize) {
+            for (int x = bounds.x1; x < bounds.x2; x += opt.tileSize) {
+                OfxRectI tile = { x, y, (std::min)(x + opt.tileSize, bounds.x2), (std::min)(y + opt.tileSize, bounds.y2) };
+                tiles.push_back(tile);
+            }
+        }
+        std::atomic<std::size_t> next(0);
+        std::atomic<bool> ok(true);
+        auto renderTiles = [&]() {
+            gIsSpawnedThread = true;
+            gTarget = &target;
+            for (std::size_t i = next++; i < tiles.size() && ok; i = next++) {
+                if ( !reader.render(frame, tiles[i], scale, false) ) {
+                    ok = false;
+                }
+            }
+            gTarget = NULL;
+        };
+        vector<std::thread> workers;
+        for (unsigned int t = 0; t < tileThreads; ++t) {
+            workers.push_back( std::thread(renderTiles) );
+        }
+        for (std::size_t t = 0; t < workers.size(); ++t) {
+            workers[t].join();
+        }
+
+        return (bool)ok;
+    };
+    auto accountFrame = [&](int frame,
+                            const RenderTarget& target) {
+        std::lock_guard<std::mutex> guard(resultMutex);
+        ++result.frames;
+        result.pixelBytes += (double)target.pixels.size() * sizeof(float);
+        if (fmt.isMovie) {
+            result.fileBytes += totalFileBytes / (range.max - range.min + 1);
+        } else {
+            result.fileBytes += fileSize( resolveFramePattern(fileName, frame) );
+        }
+    };
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if ( !reader.beginSequenceRender(range, scale, sequential) ) {
+        return result.fail("begin sequence render failed");
+    }
+    if (parallelFrames) {
+        std::atomic<std::size_t> next(0);
+        auto renderFrames = [&]() {
+            RenderTarget target;
+            gIsSpawnedThread = true;
+            for (std::size_t i = next++; i < frames.size() && !failed; i = next++) {
+                if ( !renderFrame(frames[i], target, 1) ) {
+                    std::lock_guard<std::mutex> guard(resultMutex);
+                    failed = true;
+                    failedFrame = frames[i];
+                } else {
+                    accountFrame(frames[i], target);
+                }
+            }
+        };
+        vector<std::thread> workers;
+        for (unsigned int t = 0; t < threads; ++t) {
+            workers.push_back( std::thread(renderFrames) );
+        }
+        for (std::size_t t = 0; t < workers.size(); ++t) {
+            workers[t].join();
+        }
+    } else {
+        RenderTarget target;
+        for (std::size_t i = 0; i < frames.size() && !failed; ++i) {
+            if ( !renderFrame(frames[i], target, tiled ? threads : 1) ) {
+                failed = true;
+                failedFrame = frames[i];
+            } else {
+                accountFrame(frames[i], target);
+            }
+        }
+    }
+    reader.endSequenceRender(range, scale, sequential);
+    result.seconds = secondsSince(start);
+    if (failed) {
+        char msg[64];
+        std::snprintf(msg, sizeof(msg), "render failed at frame %d", failedFrame);
+
+        return result.fail(msg);
+    }
+
+    return result;
+}
+
+long
+peakRSSKiB()
+{
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; // bytes on macOS
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+string
+jsonString(const string& s)
+{
+    string ret = "\"";
+
+    for (std::size_t i = 0; i < s.size(); ++i) {
+        const unsigned char c = s[i];
+        if ( (c == '"') || (c == '\\') ) {
+            ret += '\\';
+            ret += c;
+        } else if (c < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            ret += escaped;
+        } else {
+            ret += c;
+        }
+    }
+    ret += '"';
+
+    return ret;
+}
+
+void
+printRecord(const FormatDesc& fmt,
+            const string& scenario,
+            unsigned int threads,
+            double scale,
+            const Result& r,
+            long rss)
+{
+    const bool write = (scenario == "write");
+    const double seconds = (r.seconds > 0.) ? r.seconds : 0.;
+
+    std::printf("{\"format\":%s,\"plugin\":%s,\"scenario\":%s,\"threads\":%u,\"width\":%d,\"height\":%d,\"scale\":%g,"
+                "\"frames\":%d,\"seconds\":%.6f,\"fps\":%.3f,\"pixelMBps\":%.3f,\"fileMBps\":%.3f,\"peakRSSKiB\":%ld,\"status\":%s",
+                jsonString(fmt.ext).c_str(), jsonString(write ? fmt.writerId : fmt.readerId).c_str(), jsonString(scenario).c_str(),
+                threads, gFormatWidth, gFormatHeight, scale, r.frames, seconds,
+                seconds > 0. ? r.frames / seconds : 0.,
+                seconds > 0. ? r.pixelBytes / seconds * 1e-6 : 0.,
+                seconds > 0. ? r.fileBytes / seconds * 1e-6 : 0.,
+                rss, jsonString(r.status).c_str() );
+    if ( !r.message.empty() ) {
+        std::printf( ",\"message\":%s", jsonString(r.message).c_str() );
+    }
+    std::printf("}\n");
+}
+
+/** @brief run one benchmark in a child process. Returns false if it failed. */
+bool
+runInChild(const Options& opt,
+           const FormatDesc& fmt,
+           const string& scenario,
+           unsigned int threads,
+           double scale,
+           bool report)
+{
+    std::fflush(stdout);
+    std::fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::perror("iobench: fork");
+
+        return false;
+    }
+    if (pid == 0) {
+        gNumThreads = threads;
+        gThreadPool.start(threads - 1);
+        Result r = (scenario == "write") ? runWrite(opt, fmt) : runRead(opt, fmt, scenario, threads, scale);
+        gThreadPool.stop();
+        if (report) {
+            printRecord( fmt, scenario, threads, scale, r, peakRSSKiB() );
+        } else if (r.status == "failed") {
+            std::fprintf(stderr, "iobench: %s: %s\n", fmt.ext, r.message.c_str());
+        }
+        std::fflush(stdout);
+        // exit() rather than _exit(), so that the plugins can write their instrumentation files
+        std::exit(r.status == "failed" ? 1 : 0);
+    }
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            std::perror("iobench: waitpid");
+
+            return false;
+        }
+    }
+    if ( WIFSIGNALED(status) ) {
+        if (report) {
+            Result r;
+            char msg[64];
+            std::snprintf( msg, sizeof(msg), "killed by signal %d", WTERMSIG(status) );
+            printRecord( fmt, scenario, threads, scale, r.fail(msg), 0 );
+        }
+
+        return false;
+    }
+
+    return WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+}
+
+vector<string>
+splitList(const char* arg)
+{
+    vector<string> list;
+    string s(arg);
+    std::size_t begin = 0;
+
+    while ( begin <= s.size() ) {
+        std::size_t end = s.find(',', begin);
+        if (end == string::npos) {
+            end = s.size();
+        }
+        if (end > begin) {
+            list.push_back( s.substr(begin, end - begin) );
+        }
+        begin = end + 1;
+    }
+
+    return list;
+}
+
+bool
+contains(const vector<string>& list,
+         const string& s)
+{
+    return std::find(list.begin(), list.end(), s) != list.end();
+}
+
+void
+removeMedia(const string& dir)
+{
+    DIR* d = opendir( dir.c_str() );
+
+    if (d) {
+        const string prefix = kIOBenchMediaBaseName ".";
+        struct dirent* entry;
+        while ( ( entry = readdir(d) ) ) {
+            if (std::strncmp( entry->d_name, prefix.c_str(), prefix.size() ) == 0) {
+                std::remove( (dir + "/" + entry->d_name).c_str() );
+            }
+        }
+        closedir(d);
+    }
+    rmdir( dir.c_str() );
+}
+
+void
+usage(const char* argv0)
+{
+    std::fprintf(stderr,
+                 "Usage: %s [options] plugin.ofx...\n"
+                 "Benchmark the OpenFX IO readers and writers found in the given plugin binaries.\n"
+                 "Options:\n"
+                 "  -f ext,...     formats (default: exr,tif,png,pfm,mov, if the plugins are found)\n"
+                 "  -s name,...    scenarios (default: write,sequential,seek,parallel,tiled,proxy)\n"
+                 "  -t n,...       thread counts (default: 1 and the number of CPUs)\n"
+                 "  -n frames      number of frames (default: 24)\n"
+                 "  -W width       image width (default: 1920)\n"
+                 "  -H height      image height (default: 1080)\n"
+                 "  -T size        tile size for the tiled scenario (default: 256)\n"
+                 "  -p scale,...   render scales for the proxy scenario (default: 0.5,0.25)\n"
+                 "  -o dir         directory for the generated media, which is kept (default: a temporary directory)\n"
+                 "One JSON object per run is printed on the standard output.\n",
+                 argv0);
+}
+} // anonymous namespace
+
+int
+main(int argc,
+     char* argv[])
+{
+    Options opt;
+    int c;
+
+    while ( ( c = getopt(argc, argv, "f:s:t:n:W:H:T:p:o:h") ) != -1 ) {
+        switch (c) {
+        case 'f':
+            opt.formats = splitList(optarg);
+            break;
+        case 's':
+            opt.scenarios = splitList(optarg);
+            break;
+        case 't': {
+            vector<string> list = splitList(optarg);
+            for (std::size_t i = 0; i < list.size(); ++i) {
+                int n = std::atoi( list[i].c_str() );
+                if (n > 0) {
+                    opt.threads.push_back(n);
+                }
+            }
+            break;
+        }
+        case 'n':
+            opt.frames = (std::max)(1, std::atoi(optarg));
+            break;
+        case 'W':
+            gFormatWidth = (std::max)(1, std::atoi(optarg));
+            break;
+        case 'H':
+            gFormatHeight = (std::max)(1, std::atoi(optarg));
+            break;
+        case 'T':
+            opt.tileSize = (std::max)(16, std::atoi(optarg));
+            break;
+        case 'p': {
+            vector<string> list = splitList(optarg);
+            for (std::size_t i = 0; i < list.size(); ++i) {
+                double s = std::atof( list[i].c_str() );
+                if ( (s > 0.) && (s <= 1.) ) {
+                    opt.scales.push_back(s);
+                }
+            }
+            break;
+        }
+        case 'o':
+            opt.mediaDir = optarg;
+            opt.keepMedia = true;
+            break;
+        default:
+            usage(argv[0]);
+
+            return (c == 'h') ? 0 : 1;
+        }
+    }
+    for (int i = optind; i < argc; ++i) {
+        opt.binaries.push_back(argv[i]);
+    }
+    if ( opt.binaries.empty() ) {
+        usage(argv[0]);
+
+        return 1;
+    }
+    if ( opt.scenarios.empty() ) {
+        opt.scenarios = splitList("write,sequential,seek,parallel,tiled,proxy");
+    }
+    if ( opt.threads.empty() ) {
+        opt.threads.push_back(1);
+        unsigned int n = std::thread::hardware_concurrency();
+        if (n > 1) {
+            opt.threads.push_back(n);
+        }
+    }
+    if ( opt.scales.empty() ) {
+        opt.scales.push_back(0.5);
+        opt.scales.push_back(0.25);
+    }
+    if ( opt.mediaDir.empty() ) {
+        const char* tmp = std::getenv("TMPDIR");
+        string dirTemplate = string( (tmp && *tmp) ? tmp : "/tmp" ) + "/iobench.XXXXXX";
+        vector<char> buf( dirTemplate.begin(), dirTemplate.end() );
+        buf.push_back('\0');
+        if ( !mkdtemp(&buf[0]) ) {
+            std::perror("iobench: mkdtemp");
+
+            return 1;
+        }
+        opt.mediaDir = &buf[0];
+    } else {
+        mkdir(opt.mediaDir.c_str(), 0777);
+    }
+
+    initHost();
+
+    bool ok = true;
+    const int formatsCount = (int)( sizeof(kFormats) / sizeof(kFormats[0]) );
+    for (int f = 0; f < formatsCount; ++f) {
+        const FormatDesc& fmt = kFormats[f];
+        if ( !opt.formats.empty() && !contains(opt.formats, fmt.ext) ) {
+            continue;
+        }
+        if ( !findPlugin(opt.binaries, fmt.writerId) || !findPlugin(opt.binaries, fmt.readerId) ) {
+            if ( !opt.formats.empty() ) {
+                std::fprintf(stderr, "iobench: %s: %s or %s not found\n", fmt.ext, fmt.writerId, fmt.readerId);
+                ok = false;
+            }
+            continue;
+        }
+        if ( contains(opt.scenarios, "write") ) {
+            for (std::size_t t = 0; t < opt.threads.size(); ++t) {
+                ok = runInChild(opt, fmt, "write", opt.threads[t], 1., true) && ok;
+            }
+        }
+        const string firstFile = fmt.isMovie ? mediaFileName(opt, fmt) : resolveFramePattern(mediaFileName(opt, fmt), 1);
+        bool hasMedia = ( fileSize(firstFile) > 0. );
+        const char* readScenarios[] = { "sequential", "seek", "parallel", "tiled", "proxy" };
+        for (int s = 0; s < 5; ++s) {
+            if ( !contains(opt.scenarios, readScenarios[s]) ) {
+                continue;
+            }
+            if (!hasMedia) {
+                hasMedia = runInChild(opt, fmt, "write", opt.threads.back(), 1., false);
+                if (!hasMedia) {
+                    std::fprintf(stderr, "iobench: %s: cannot generate the test media\n", fmt.ext);
+                    ok = false;
+                    break;
+                }
+            }
+            for (std::size_t t = 0; t < opt.threads.size(); ++t) {
+                if (string(readScenarios[s]) == "proxy") {
+                    for (std::size_t i = 0; i < opt.scales.size(); ++i) {
+                        ok = runInChild(opt, fmt, readScenarios[s], opt.threads[t], opt.scales[i], true) && ok;
+                    }
+                } else {
+                    ok = runInChild(opt, fmt, readScenarios[s], opt.threads[t], 1., true) && ok;
+                }
+            }
+        }
+    }
+
+    if (!opt.keepMedia) {
+        removeMedia(opt.mediaDir);
+    }
+
+    return ok ? 0 : 1;
+} // main
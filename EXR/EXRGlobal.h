@@ -0,0 +1,89 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of openfx-io <https://github.com/NatronGitHub/openfx-io>,
+ * (C) 2018-2021 The Natron Developers
+ * (C) 2013-2018 INRIA
+ *
+ * openfx-io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * openfx-io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openfx-io.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef IO_GLOBAL_EXR_H
+#define IO_GLOBAL_EXR_H
+
+#include <atomic>
+
+#include "ofxsMacros.h"
+
+GCC_DIAG_OFF(deprecated)
+#include <ImfCompression.h>
+#include <ImfThreading.h>
+GCC_DIAG_ON(deprecated)
+
+#include <ofxsMultiThread.h>
+
+#ifndef OPENEXR_IMF_NAMESPACE
+#define OPENEXR_IMF_NAMESPACE Imf
+#endif
+
+/*
+ * Set the size of the OpenEXR thread pool, which is shared by all the readers and writers of the process.
+ * A thread count of 0 or less means the number of CPUs.
+ * The first ReadEXR or WriteEXR instance sets it from its parameter, and later instances leave it alone
+ * (pass force=false), so that loading a project with several of them does not resize it each time.
+ * An explicit change of the parameter by the user resizes it (pass force=true).
+ */
+inline void
+setExrGlobalThreadCount(int threadCount,
+                        bool force)
+{
+    static std::atomic<bool> initialized(false);
+
+    if ( initialized.exchange(true) && !force ) {
+        return;
+    }
+    if (threadCount <= 0) {
+        threadCount = (int)OFX::MultiThread::getNumCPUs();
+    }
+    if (OPENEXR_IMF_NAMESPACE::globalThreadCount() != threadCount) {
+        OPENEXR_IMF_NAMESPACE::setGlobalThreadCount(threadCount);
+    }
+}
+
+/*
+ * Number of scanlines in each chunk of a scanline file compressed with the given compression,
+ * which is the unit of parallel compression and decompression.
+ */
+inline int
+exrCompressionScanlines(OPENEXR_IMF_NAMESPACE::Compression compression)
+{
+    switch (compression) {
+    case OPENEXR_IMF_NAMESPACE::ZIP_COMPRESSION:
+    case OPENEXR_IMF_NAMESPACE::PXR24_COMPRESSION:
+
+        return 16;
+    case OPENEXR_IMF_NAMESPACE::PIZ_COMPRESSION:
+    case OPENEXR_IMF_NAMESPACE::B44_COMPRESSION:
+    case OPENEXR_IMF_NAMESPACE::B44A_COMPRESSION:
+    case OPENEXR_IMF_NAMESPACE::DWAA_COMPRESSION:
+
+        return 32;
+    case OPENEXR_IMF_NAMESPACE::DWAB_COMPRESSION:
+
+        return 256;
+    default:
+
+        return 1;
+    }
+}
+
+#endif /* IO_GLOBAL_EXR_H*/
@@ -23,6 +23,7 @@
  */
 
 #include <algorithm>
+#include <cstddef>
 #ifdef DEBUG
 #include <iostream>
 #endif
@@ -45,16 +46,20 @@ GCC_DIAG_OFF(deprecated)
 #include <ImfHeader.h>
 #include <ImfCompression.h>
 #include <ImfFrameBuffer.h>
+#include <ImfTileDescription.h>
+#include <ImfChromaticities.h>
+#include <ImfStandardAttributes.h>
+#include <ImfRgbaYca.h>
 #include <ImathBox.h>
+#include <ImfThreading.h>
 #include <IlmThreadPool.h>
 GCC_DIAG_ON(deprecated)
 
-#ifdef OFX_IO_MT_EXR
 #include <ofxsMultiThread.h>
-#endif
 
 #include "GenericOCIO.h"
 #include "GenericReader.h"
+#include "EXRGlobal.h"
 
 
 using namespace OFX;
@@ -91,6 +96,17 @@ namespace Imf_ = OPENEXR_IMF_NAMESPACE;
 #define kSupportsAlpha false
 #define kSupportsTiles false
 
+#define kParamThreadCount "threadCount"
+#define kParamThreadCountLabel "Decoding Threads", "Number of threads in the OpenEXR thread pool, used to decompress the scanlines of a frame in parallel. " \
+    "0 means the number of CPUs. This setting is global: it affects all OpenEXR readers and writers. " \
+    "It is applied by the first OpenEXR reader or writer created, and whenever it is edited."
+#define kParamThreadCountDefault 0
+
+#define kParamFileHandles "fileHandles"
+#define kParamFileHandlesLabel "Handles per File", "Maximum number of handles kept open on each file. " \
+    "With more than one handle, several render threads can read the same file concurrently, at the expense of more open files and memory."
+#define kParamFileHandlesDefault 1
+
 class ReadEXRPlugin
     : public GenericReaderPlugin
 {
@@ -104,6 +120,9 @@ public:
 
 private:
 
+    // set the size of the global OpenEXR thread pool from the parameter, see setExrGlobalThreadCount()
+    void setThreadCount(bool force);
+
     virtual bool isVideoStream(const string& /*filename*/) OVERRIDE FINAL { return false; }
 
     virtual void decode(const string& filename, OfxTime time, int /*view*/, bool isPlayback, const OfxRectI& renderWindow, const OfxPointD& renderScale, float *pixelData, const OfxRectI& bounds, PixelComponentEnum pixelComponents, int pixelComponentCount, int rowBytes) OVERRIDE FINAL;
@@ -129,6 +148,9 @@ private:
      * When reading an image sequence, this is called only for the first image when the user actually selects the new sequence.
      **/
     virtual bool guessParamsFromFilename(const string& newFile, string *colorspace, PreMultiplicationEnum *filePremult, PixelComponentEnum *components, int *componentCount) OVERRIDE FINAL;
+
+    IntParam* _threadCount;
+    IntParam* _fileHandles;
 };
 
 namespace Exr {
@@ -322,55 +344,54 @@ private:
     }
 };
 
-struct File
+// number of scanlines in each chunk of the file, which is the unit of parallel decompression
+static int
+scanlinesPerChunk(const Imf_::Header& header)
 {
-    File(const string& filename);
+    if ( header.hasTileDescription() ) {
+        return (std::max)(1, (int)header.tileDescription().ySize);
+    }
 
+    return exrCompressionScanlines( header.compression() );
+}
 
-    ~File();
+// An open handle on an EXR file, used to read pixels.
+struct InputFileHandle
+{
+    InputFileHandle(const string& filename);
 
-    Imf::InputFile* inputfile;
+    ~InputFileHandle();
 
-    typedef map<Channel, string> ChannelsMap;
-    ChannelsMap channel_map;
-    int dataOffset;
-    vector<string> views;
-    OfxRectI displayWindow;
-    OfxRectI dataWindow;
-    float pixelAspectRatio;
+    Imf::InputFile* inputfile;
 #if (defined(_WIN32) || defined(__WIN32__) || defined(WIN32)) && !defined(__MINGW32__)
     std::ifstream* inputStr;
     Imf::StdIFStream* inputStdStream;
 #endif
 #ifdef OFX_IO_MT_EXR
-    MultiThread::Mutex lock;
+    MultiThread::Mutex lock; // held while the frame buffer is set and pixels are read
 #endif
+};
+
 #if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
-    inline wstring s2ws(const string& s)
-    {
-        int len;
-        int slength = (int)s.length() + 1;
+static inline wstring
+s2ws(const string& s)
+{
+    int len;
+    int slength = (int)s.length() + 1;
 
-        len = MultiByteToWideChar(CP_ACP, 0, s.c_str(), slength, 0, 0);
-        wchar_t* buf = new wchar_t[len];
-        MultiByteToWideChar(CP_ACP, 0, s.c_str(), slength, buf, len);
-        wstring r(buf);
-        delete[] buf;
+    len = MultiByteToWideChar(CP_ACP, 0, s.c_str(), slength, 0, 0);
+    wchar_t* buf = new wchar_t[len];
+    MultiByteToWideChar(CP_ACP, 0, s.c_str(), slength, buf, len);
+    wstring r(buf);
+    delete[] buf;
 
-        return r;
-    }
+    return r;
+}
 
 #endif
-};
 
-File::File(const string& filename)
+InputFileHandle::InputFileHandle(const string& filename)
     : inputfile(NULL)
-    , channel_map()
-    , dataOffset(0)
-    , views()
-    , displayWindow()
-    , dataWindow()
-    , pixelAspectRatio(1.)
 #if (defined(_WIN32) || defined(__WIN32__) || defined(WIN32)) && !defined(__MINGW32__)
     , inputStr(NULL)
     , inputStdStream(NULL)
@@ -379,16 +400,115 @@ File::File(const string& filename)
     , lock()
 #endif
 {
-    try{
+    try {
 #if (defined(_WIN32) || defined(__WIN32__) || defined(WIN32)) && !defined(__MINGW32__)
         inputStr = new std::ifstream(s2ws(filename), std::ios_base::binary);
         inputStdStream = new Imf_::StdIFStream( *inputStr, filename.c_str() );
         inputfile = new Imf_::InputFile(*inputStdStream);
 #else
-
         inputfile = new Imf_::InputFile( filename.c_str() );
 #endif
+    } catch (const std::exception& e) {
+#if (defined(_WIN32) || defined(__WIN32__) || defined(WIN32)) && !defined(__MINGW32__)
+        delete inputStdStream;
+        delete inputStr;
+#endif
+        throw e;
+    }
+}
 
+InputFileHandle::~InputFileHandle()
+{
+    delete inputfile;
+#if (defined(_WIN32) || defined(__WIN32__) || defined(WIN32)) && !defined(__MINGW32__)
+    delete inputStdStream;
+    delete inputStr;
+#endif
+}
+
+struct File
+{
+    File(const string& filename);
+
+
+    ~File();
+
+    // Get a handle for reading pixels, and lock it.
+    // An idle handle is used if there is one, else a new handle is opened if there are less than maxHandles.
+    InputFileHandle* lockHandle(unsigned int maxHandles);
+
+    void unlockHandle(InputFileHandle* handle);
+
+    // RAII wrapper for lockHandle()/unlockHandle()
+    class HandleLocker
+    {
+    public:
+        HandleLocker(File& file,
+                     unsigned int maxHandles)
+            : _file(file)
+            , _handle( file.lockHandle(maxHandles) )
+        {
+        }
+
+        ~HandleLocker()
+        {
+            _file.unlockHandle(_handle);
+        }
+
+        Imf::InputFile* inputfile() const { return _handle->inputfile; }
+
+    private:
+        File& _file;
+        InputFileHandle* _handle;
+    };
+
+    string filename;
+    vector<InputFileHandle*> handles; // handles[0] is always open
+    Imf::InputFile* inputfile; // handles[0]->inputfile, used to read the header
+
+    typedef map<Channel, string> ChannelsMap;
+    ChannelsMap channel_map;
+    int dataOffset;
+    vector<string> views;
+    OfxRectI displayWindow;
+    OfxRectI dataWindow;
+    float pixelAspectRatio;
+    bool lumaChroma; // Y, RY and BY channels, converted to RGB while reading (RY and BY may be subsampled)
+    bool luma; // Y channel only, copied to the green and blue channels
+    int chromaXSampling;
+    int chromaYSampling;
+    Imath::V3f yw; // luminance weights, computed from the chromaticities of the file
+    int chunkLines; // number of scanlines in each chunk of the file
+#ifdef OFX_IO_MT_EXR
+    MultiThread::Mutex handlesLock; // protects handles and nextHandle
+    unsigned int nextHandle; // the handle to wait for when all handles are busy
+#endif
+};
+
+File::File(const string& filename_)
+    : filename(filename_)
+    , handles()
+    , inputfile(NULL)
+    , channel_map()
+    , dataOffset(0)
+    , views()
+    , displayWindow()
+    , dataWindow()
+    , pixelAspectRatio(1.)
+    , lumaChroma(false)
+    , luma(false)
+    , chromaXSampling(1)
+    , chromaYSampling(1)
+    , yw()
+    , chunkLines(1)
+#ifdef OFX_IO_MT_EXR
+    , handlesLock()
+    , nextHandle(0)
+#endif
+{
+    handles.push_back( new InputFileHandle(filename) );
+    inputfile = handles[0]->inputfile;
+    try{
 
         // convert exr channels to our channels
         const Imf_::ChannelList& imfchannels = inputfile->header().channels();
@@ -451,12 +571,33 @@ File::File(const string& filename)
         dataWindow.y2 = top + 1;
 
         pixelAspectRatio = inputfile->header().pixelAspectRatio();
+
+        // luminance/chroma files
+        ChannelsMap::const_iterator y = channel_map.find(Channel_red);
+        if ( ( y != channel_map.end() ) && ( (y->second == "Y") || (y->second == "y") ) ) {
+            ChannelsMap::const_iterator ry = channel_map.find(Channel_green);
+            ChannelsMap::const_iterator by = channel_map.find(Channel_blue);
+            const bool hasRY = ( ry != channel_map.end() ) && ( (ry->second == "RY") || (ry->second == "ry") );
+            const bool hasBY = ( by != channel_map.end() ) && ( (by->second == "BY") || (by->second == "by") );
+            if (hasRY && hasBY) {
+                const Imf_::Channel* ryChannel = imfchannels.findChannel( ry->second.c_str() );
+                const Imf_::Channel* byChannel = imfchannels.findChannel( by->second.c_str() );
+                if ( ryChannel && byChannel &&
+                     ( ryChannel->xSampling == byChannel->xSampling) &&
+                     ( ryChannel->ySampling == byChannel->ySampling) ) {
+                    lumaChroma = true;
+                    chromaXSampling = ryChannel->xSampling;
+                    chromaYSampling = ryChannel->ySampling;
+                }
+            } else if ( ( ry == channel_map.end() ) && ( by == channel_map.end() ) ) {
+                luma = true;
+            }
+        }
+        yw = Imf_::RgbaYca::computeYw( Imf_::hasChromaticities( inputfile->header() ) ? Imf_::chromaticities( inputfile->header() ) : Imf_::Chromaticities() );
+        chunkLines = scanlinesPerChunk( inputfile->header() );
     }catch (const std::exception& e) {
-#if (defined(_WIN32) || defined(__WIN32__) || defined(WIN32)) && !defined(__MINGW32__)
-        delete inputStr;
-        delete inputStdStream;
-#endif
-        delete inputfile;
+        delete handles[0];
+        handles.clear();
         inputfile = 0;
         throw e;
     }
@@ -464,11 +605,53 @@ File::File(const string& filename)
 
 File::~File()
 {
-#if (defined(_WIN32) || defined(__WIN32__) || defined(WIN32)) && !defined(__MINGW32__)
-    delete inputStr;
-    delete inputStdStream;
+    for (std::size_t i = 0; i < handles.size(); ++i) {
+        delete handles[i];
+    }
+}
+
+InputFileHandle*
+File::lockHandle(unsigned int maxHandles)
+{
+#ifdef OFX_IO_MT_EXR
+    InputFileHandle* handle = NULL;
+    {
+        MultiThread::AutoMutex g(handlesLock);
+        for (std::size_t i = 0; i < handles.size(); ++i) {
+            if ( handles[i]->lock.tryLock() ) {
+                return handles[i];
+            }
+        }
+        if (handles.size() < maxHandles) {
+            // all handles are busy, open a new one
+            handle = new InputFileHandle(filename);
+            handle->lock.lock();
+            handles.push_back(handle);
+
+            return handle;
+        }
+        handle = handles[nextHandle % handles.size()];
+        ++nextHandle;
+    }
+    // wait for a busy handle (outside of handlesLock, so that other handles can be used meanwhile)
+    handle->lock.lock();
+
+    return handle;
+#else
+    unused(maxHandles);
+
+    return handles[0];
+#endif
+}
+
+void
+File::unlockHandle(InputFileHandle* handle)
+{
+#ifdef OFX_IO_MT_EXR
+    handle->lock.unlock();
+#else
+    unused(handle);
 #endif
-    delete inputfile;
 }
 
 // Keeps track of all Exr::File mapped against file name.
@@ -558,8 +741,14 @@ FileManager::get(const string& filename)
 ReadEXRPlugin::ReadEXRPlugin(OfxImageEffectHandle handle,
                              const vector<string>& extensions)
     : GenericReaderPlugin(handle, extensions, kSupportsRGBA, kSupportsRGB, kSupportsXY, kSupportsAlpha, kSupportsTiles, false)
+    , _threadCount(NULL)
+    , _fileHandles(NULL)
 {
     Exr::FileManager::s_readerManager.initialize();
+    _threadCount = fetchIntParam(kParamThreadCount);
+    _fileHandles = fetchIntParam(kParamFileHandles);
+    assert(_threadCount && _fileHandles);
+    setThreadCount(false);
 }
 
 ReadEXRPlugin::~ReadEXRPlugin()
@@ -570,15 +759,189 @@ void
 ReadEXRPlugin::changedParam(const InstanceChangedArgs &args,
                             const string &paramName)
 {
-    GenericReaderPlugin::changedParam(args, paramName);
+    if (paramName == kParamThreadCount) {
+        setThreadCount(args.reason == eChangeUserEdit);
+    } else {
+        GenericReaderPlugin::changedParam(args, paramName);
+    }
+}
+
+void
+ReadEXRPlugin::setThreadCount(bool force)
+{
+    setExrGlobalThreadCount(_threadCount->getValue(), force);
 }
 
-struct DecodingChannelsMap
+// floor(a / b), for b > 0
+static inline int
+divFloor(int a,
+         int b)
 {
-    float* buf;
-    bool subsampled;
-    string channelName;
-};
+    return (a >= 0) ? (a / b) : -( (b - 1 - a) / b );
+}
+
+// Upsample a row of chroma samples with linear interpolation. Sample c is at x = c * xSampling.
+static void
+upsampleChromaRow(const float* samples,
+                  int cxMin,
+                  int cWidth,
+                  int xSampling,
+                  int xMin,
+                  int width,
+                  float* out)
+{
+    const int offset = xMin - cxMin * xSampling; // 0 if the data window is aligned on the samples, as required by OpenEXR
+
+    if ( (xSampling == 1) && (offset == 0) ) {
+        std::copy(samples, samples + width, out);
+
+        return;
+    }
+    if ( (xSampling == 2) && (offset == 0) ) {
+        const int n = width / 2;
+        for (int c = 0; c < n; ++c) {
+            const float a = samples[c];
+            const float b = samples[(std::min)(c + 1, cWidth - 1)];
+            out[2 * c] = a;
+            out[2 * c + 1] = 0.5f * (a + b);
+        }
+        if (width & 1) {
+            out[width - 1] = samples[n];
+        }
+
+        return;
+    }
+    const float invXSampling = 1.f / xSampling;
+    for (int i = 0; i < width; ++i) {
+        const int c = (i + offset) / xSampling;
+        const int k = (i + offset) - c * xSampling;
+        const float a = samples[c];
+        const float b = samples[(std::min)(c + 1, cWidth - 1)];
+        out[i] = a + (b - a) * (k * invXSampling);
+    }
+}
+
+/*
+ * Read a luminance/chroma file (Y, RY, BY) and convert it to RGB.
+ *
+ * The scanlines are read by blocks of a few chunks (one chunk per OpenEXR thread), so that only the
+ * chroma samples of one block are kept in memory. Luminance and alpha are read directly into the
+ * destination, and the chroma samples are linearly interpolated.
+ * Each line is converted once both chroma rows around it are read: the last chroma row of a block is
+ * kept for the next block.
+ */
+static void
+readLumaChroma(const Exr::File& file,
+               Imf_::InputFile& inputfile,
+               char* exrLine0,
+               int rowBytes,
+               int exrYBegin,
+               int exrYEnd)
+{
+    const Imath::Box2i& datawin = file.inputfile->header().dataWindow();
+    const int xSampling = file.chromaXSampling;
+    const int ySampling = file.chromaYSampling;
+    const int xMin = datawin.min.x;
+    const int width = datawin.max.x - datawin.min.x + 1;
+    const int cxMin = divFloor(datawin.min.x, xSampling);
+    const int cWidth = divFloor(datawin.max.x, xSampling) - cxMin + 1;
+    // lines of a block: a whole number of chunks, and a multiple of the chroma sampling
+    const int chunks = (std::max)(1, Imf_::globalThreadCount());
+    int blockLines = file.chunkLines * chunks;
+    blockLines = ( (blockLines + ySampling - 1) / ySampling ) * ySampling;
+    // slot 0 holds the last chroma row of the previous block
+    const int slots = blockLines / ySampling + 2;
+    vector<float> ry(cWidth * slots);
+    vector<float> by(cWidth * slots);
+    vector<float> vRY(cWidth), vBY(cWidth); // vertically interpolated chroma samples
+    vector<float> hRY(width), hBY(width); // upsampled chroma
+    const std::size_t yStride = (std::size_t)( -(std::ptrdiff_t)rowBytes );
+    const string& yName = file.channel_map.find(Exr::Channel_red)->second;
+    const string& ryName = file.channel_map.find(Exr::Channel_green)->second;
+    const string& byName = file.channel_map.find(Exr::Channel_blue)->second;
+    Exr::File::ChannelsMap::const_iterator alpha = file.channel_map.find(Exr::Channel_alpha);
+    bool hasPrev = false;
+    int prevRow = 0; // the chroma row in slot 0, if hasPrev
+    int pending = exrYBegin; // the first line which is not converted yet
+
+    for (int b0 = exrYBegin; b0 <= exrYEnd;) {
+        // blocks are aligned on chunks
+        const int b1 = (std::min)(exrYEnd, datawin.min.y + ( (b0 - datawin.min.y) / blockLines + 1 ) * blockLines - 1);
+        const int c0 = divFloor(b0 + ySampling - 1, ySampling); // the first chroma row of the block
+        const int c1 = divFloor(b1, ySampling); // the last chroma row of the block, if c1 >= c0
+        Imf_::FrameBuffer fbuf;
+        fbuf.insert( yName.c_str(),
+                     Imf_::Slice(Imf_::FLOAT, exrLine0 + sizeof(float) * Exr::Channel_red, sizeof(float) * 4, yStride) );
+        if ( alpha != file.channel_map.end() ) {
+            fbuf.insert( alpha->second.c_str(),
+                         Imf_::Slice(Imf_::FLOAT, exrLine0 + sizeof(float) * Exr::Channel_alpha, sizeof(float) * 4, yStride) );
+        }
+        // chroma row c goes to slot 1 + c - c0
+        const std::ptrdiff_t origin = (std::ptrdiff_t)cWidth * (1 - c0) - cxMin;
+        fbuf.insert( ryName.c_str(),
+                     Imf_::Slice(Imf_::FLOAT, (char*)&ry[0] + sizeof(float) * origin, sizeof(float), sizeof(float) * cWidth, xSampling, ySampling) );
+        fbuf.insert( byName.c_str(),
+                     Imf_::Slice(Imf_::FLOAT, (char*)&by[0] + sizeof(float) * origin, sizeof(float), sizeof(float) * cWidth, xSampling, ySampling) );
+        inputfile.setFrameBuffer(fbuf);
+        inputfile.readPixels(b0, b1);
+
+        // the chroma rows available
+        const int rowLo = hasPrev ? prevRow : c0;
+        const int rowHi = (c1 >= c0) ? c1 : prevRow;
+        const bool hasRows = hasPrev || (c1 >= c0);
+        // the lines after the last chroma row wait for the next block, except at the end
+        const int last = (b1 == exrYEnd) ? b1 : ( (c1 >= c0) ? c1 * ySampling : pending - 1 );
+        for (int y = pending; y <= last; ++y) {
+            if (hasRows) {
+                const int r = divFloor(y, ySampling);
+                const float t = (float)(y - r * ySampling) / ySampling;
+                const int r0 = (std::max)( rowLo, (std::min)(r, rowHi) );
+                const int r1 = (std::max)( rowLo, (std::min)(r + 1, rowHi) );
+                const float* ry0 = &ry[cWidth * ( (hasPrev && r0 == prevRow) ? 0 : 1 + r0 - c0 )];
+                const float* by0 = &by[cWidth * ( (hasPrev && r0 == prevRow) ? 0 : 1 + r0 - c0 )];
+                if ( (r0 == r1) || (t == 0.f) ) {
+                    upsampleChromaRow(ry0, cxMin, cWidth, xSampling, xMin, width, &hRY[0]);
+                    upsampleChromaRow(by0, cxMin, cWidth, xSampling, xMin, width, &hBY[0]);
+                } else {
+                    const float* ry1 = &ry[cWidth * ( (hasPrev && r1 == prevRow) ? 0 : 1 + r1 - c0 )];
+                    const float* by1 = &by[cWidth * ( (hasPrev && r1 == prevRow) ? 0 : 1 + r1 - c0 )];
+                    for (int c = 0; c < cWidth; ++c) {
+                        vRY[c] = ry0[c] + t * (ry1[c] - ry0[c]);
+                        vBY[c] = by0[c] + t * (by1[c] - by0[c]);
+                    }
+                    upsampleChromaRow(&vRY[0], cxMin, cWidth, xSampling, xMin, width, &hRY[0]);
+                    upsampleChromaRow(&vBY[0], cxMin, cWidth, xSampling, xMin, width, &hBY[0]);
+                }
+            } else {
+                std::fill(hRY.begin(), hRY.end(), 0.f);
+                std::fill(hBY.begin(), hBY.end(), 0.f);
+            }
+            // same as Imf::RgbaYca::YCAtoRGB()
+            float* pix = (float*)(exrLine0 - (std::ptrdiff_t)y * rowBytes) + 4 * xMin;
+            const float ywx = file.yw.x;
+            const float ywz = file.yw.z;
+            const float invYwy = 1.f / file.yw.y;
+            for (int i = 0; i < width; ++i) {
+                const float Y = pix[4 * i];
+                const float r = (hRY[i] + 1.f) * Y;
+                const float b = (hBY[i] + 1.f) * Y;
+                pix[4 * i] = r;
+                pix[4 * i + 1] = (Y - r * ywx - b * ywz) * invYwy;
+                pix[4 * i + 2] = b;
+            }
+        }
+        pending = last + 1;
+
+        // keep the last chroma row for the next block
+        if (c1 >= c0) {
+            std::copy(&ry[cWidth * (1 + c1 - c0)], &ry[cWidth * (1 + c1 - c0)] + cWidth, &ry[0]);
+            std::copy(&by[cWidth * (1 + c1 - c0)], &by[cWidth * (1 + c1 - c0)] + cWidth, &by[0]);
+            prevRow = c1;
+            hasPrev = true;
+        }
+        b0 = b1 + 1;
+    }
+} // readLumaChroma
 
 void
 ReadEXRPlugin::decode(const string& filename,
@@ -606,54 +969,61 @@ ReadEXRPlugin::decode(const string& filename,
     OfxRectI roi = bounds; // used to be dstImg->getRegionOfDefinition(); why?
     assert( kSupportsTiles || (renderWindow.x1 == file->dataWindow.x1 && renderWindow.x2 == file->dataWindow.x2 && renderWindow.y1 == file->dataWindow.y1 && renderWindow.y2 == file->dataWindow.y2) );
 
-    for (int y = roi.y1; y < roi.y2; ++y) {
-        map<Exr::Channel, DecodingChannelsMap > channels;
-        for (Exr::File::ChannelsMap::const_iterator it = file->channel_map.begin(); it != file->channel_map.end(); ++it) {
-            DecodingChannelsMap d;
-
-            ///This line means we only support FLOAT dst images with the RGBA format.
-            d.buf = (float*)( (char*)pixelData + (y - roi.y1) * rowBytes ) + (int)it->first;
-
-            d.subsampled = it->second == "BY" || it->second == "RY";
-            d.channelName = it->second;
-            channels.insert( make_pair(it->first, d) );
-        }
-
-        const Imath::Box2i& dispwin = file->inputfile->header().displayWindow();
-        const Imath::Box2i& datawin = file->inputfile->header().dataWindow();
-        int exrY = dispwin.max.y - y;
-        //int r = roi.x2;
-        //int x = roi.x1;
+    const Imath::Box2i& dispwin = file->inputfile->header().displayWindow();
+    const Imath::Box2i& datawin = file->inputfile->header().dataWindow();
 
-        //const int X = (std::max)(x, datawin.min.x + file->dataOffset);
-        //const int R = (std::min)(r, datawin.max.x + file->dataOffset + 1);
+    // The EXR scanlines covering roi, clamped to the data window.
+    // Line exrY goes to line y = dispwin.max.y - exrY of pixelData.
+    const int exrYBegin = (std::max)(dispwin.max.y - (roi.y2 - 1), datawin.min.y);
+    const int exrYEnd = (std::min)(dispwin.max.y - roi.y1, datawin.max.y); // inclusive
+    if (exrYBegin > exrYEnd) {
+        // we're below or above the data window
+        return;
+    }
 
-        // if we're below or above the data window
-        if ( (exrY < datawin.min.y) || (exrY > datawin.max.y) /* || R <= X*/ ) {
-            continue;
+    // Read all the scanlines with a single readPixels() call, so that the OpenEXR thread pool can decompress
+    // them in parallel. The slices point to line exrY = 0, and Y is inverted using a negative y stride.
+    char* exrLine0 = (char*)pixelData + (std::ptrdiff_t)(dispwin.max.y - roi.y1) * rowBytes;
+    const std::size_t yStride = (std::size_t)( -(std::ptrdiff_t)rowBytes );
+    if (file->lumaChroma) {
+        try {
+            Exr::File::HandleLocker locker( *file, (unsigned int)(std::max)(1, _fileHandles->getValue()) );
+            readLumaChroma(*file, *locker.inputfile(), exrLine0, rowBytes, exrYBegin, exrYEnd);
+        } catch (const std::exception& e) {
+            setPersistentMessage( Message::eMessageError, "", string("OpenEXR error") + ": " + e.what() );
         }
 
-        Imf_::FrameBuffer fbuf;
-        for (map<Exr::Channel, DecodingChannelsMap >::const_iterator z = channels.begin(); z != channels.end(); ++z) {
-            if (!z->second.subsampled) {
-                fbuf.insert( z->second.channelName.c_str(),
-                             Imf_::Slice(Imf_::FLOAT, (char*)(z->second.buf /*+ file->dataOffset*/), sizeof(float) * 4, 0) );
-            } else {
-                fbuf.insert( z->second.channelName.c_str(),
-                             Imf_::Slice(Imf_::FLOAT, (char*)(z->second.buf /*+ file->dataOffset*/), sizeof(float) * 4, 0, 2, 2) );
-            }
+        return;
+    }
+    Imf_::FrameBuffer fbuf;
+    for (Exr::File::ChannelsMap::const_iterator it = file->channel_map.begin(); it != file->channel_map.end(); ++it) {
+        ///This line means we only support FLOAT dst images with the RGBA format.
+        char* buf = (char*)( (float*)exrLine0 + (int)it->first );
+        bool subsampled = it->second == "BY" || it->second == "RY";
+
+        if (!subsampled) {
+            fbuf.insert( it->second.c_str(),
+                         Imf_::Slice(Imf_::FLOAT, buf /*+ file->dataOffset*/, sizeof(float) * 4, yStride) );
+        } else {
+            fbuf.insert( it->second.c_str(),
+                         Imf_::Slice(Imf_::FLOAT, buf /*+ file->dataOffset*/, sizeof(float) * 4, yStride, 2, 2) );
         }
-        {
-#ifdef OFX_IO_MT_EXR
-            MultiThread::AutoMutex locker(file->lock);
-#endif
-            try {
-                file->inputfile->setFrameBuffer(fbuf);
-                file->inputfile->readPixels(exrY);
-            } catch (const std::exception& e) {
-                setPersistentMessage( Message::eMessageError, "", string("OpenEXR error") + ": " + e.what() );
+    }
+    try {
+        Exr::File::HandleLocker locker( *file, (unsigned int)(std::max)(1, _fileHandles->getValue()) );
+        locker.inputfile()->setFrameBuffer(fbuf);
+        locker.inputfile()->readPixels(exrYBegin, exrYEnd);
+    } catch (const std::exception& e) {
+        setPersistentMessage( Message::eMessageError, "", string("OpenEXR error") + ": " + e.what() );
 
-                return;
+        return;
+    }
+    if (file->luma) {
+        // grey image
+        for (int y = exrYBegin; y <= exrYEnd; ++y) {
+            float* pix = (float*)(exrLine0 - (std::ptrdiff_t)y * rowBytes) + 4 * datawin.min.x;
+            for (int x = datawin.min.x; x <= datawin.max.x; ++x, pix += 4) {
+                pix[1] = pix[2] = pix[0];
             }
         }
     }
@@ -812,6 +1182,34 @@ ReadEXRPluginFactory::describeInContext(ImageEffectDescriptor &desc,
     PageParamDescriptor *page = GenericReaderDescribeInContextBegin(desc, context, isVideoStreamPlugin(),
                                                                     kSupportsRGBA, kSupportsRGB, kSupportsXY, kSupportsAlpha, kSupportsTiles, true);
 
+    {
+        IntParamDescriptor* param = desc.defineIntParam(kParamThreadCount);
+        param->setLabelAndHint(kParamThreadCountLabel);
+        param->setRange(0, 256);
+        param->setDisplayRange(0, 64);
+        param->setDefault(kParamThreadCountDefault);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        IntParamDescriptor* param = desc.defineIntParam(kParamFileHandles);
+        param->setLabelAndHint(kParamFileHandlesLabel);
+        param->setRange(1, 64);
+        param->setDisplayRange(1, 16);
+        param->setDefault(kParamFileHandlesDefault);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+#ifndef OFX_IO_MT_EXR
+        param->setIsSecretAndDisabled(true); // the plugin is not thread-safe, a single handle is used
+#endif
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
     GenericReaderDescribeInContextEnd(desc, context, page, "scene_linear", "scene_linear");
 }
 
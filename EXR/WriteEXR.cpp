@@ -23,6 +23,9 @@
  */
 
 #include <memory>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
 
 #include "ofxsMacros.h"
 #include "ofxsFileOpen.h"
@@ -33,6 +36,9 @@ GCC_DIAG_OFF(deprecated)
 #include <ImfArray.h>
 #include <ImfCompression.h>
 #include <ImfOutputFile.h>
+#include <ImfTiledOutputFile.h>
+#include <ImfTileDescription.h>
+#include <ImfThreading.h>
 #include <ImfHeader.h>
 #include <ImfCompression.h>
 #include <ImfFrameBuffer.h>
@@ -40,8 +46,11 @@ GCC_DIAG_OFF(deprecated)
 #include <half.h>
 GCC_DIAG_ON(deprecated)
 
+#include <ofxsMultiThread.h>
+
 #include "GenericOCIO.h"
 #include "GenericWriter.h"
+#include "EXRGlobal.h"
 
 using namespace OFX;
 using namespace OFX::IO;
@@ -65,6 +74,20 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
 #define kParamWriteEXRCompression "compression"
 #define kParamWriteEXRDataType "dataType"
 
+#define kParamWriteEXRThreadCount "threadCount"
+#define kParamWriteEXRThreadCountLabel "Encoding Threads", "Number of threads in the OpenEXR thread pool, used to compress the chunks of a frame in parallel. " \
+    "0 means the number of CPUs. This setting is global: it affects all OpenEXR readers and writers. " \
+    "It is applied by the first OpenEXR reader or writer created, and whenever it is edited."
+#define kParamWriteEXRThreadCountDefault 0
+
+#define kParamWriteEXRTiled "tiled"
+#define kParamWriteEXRTiledLabel "Tiled", "Write a tiled file instead of a scanline file. All the tiles of a frame are compressed in parallel."
+#define kParamWriteEXRTiledDefault false
+
+#define kParamWriteEXRTileSize "tileSize"
+#define kParamWriteEXRTileSizeLabel "Tile Size", "Width and height of the tiles, in pixels."
+#define kParamWriteEXRTileSizeDefault 64
+
 #ifndef OPENEXR_IMF_NAMESPACE
 #define OPENEXR_IMF_NAMESPACE Imf
 #endif
@@ -139,9 +162,11 @@ public:
 
     virtual ~WriteEXRPlugin();
 
-    //virtual void changedParam(const InstanceChangedArgs &args, const string &paramName);
+    virtual void changedParam(const InstanceChangedArgs &args, const string &paramName) OVERRIDE FINAL;
 
 private:
+    // set the size of the global OpenEXR thread pool from the parameter, see setExrGlobalThreadCount()
+    void setThreadCount(bool force);
 
     virtual void encode(const string& filename,
                         const OfxTime time,
@@ -165,6 +190,9 @@ private:
 
     ChoiceParam* _compression;
     ChoiceParam* _bitDepth;
+    IntParam* _threadCount;
+    BooleanParam* _tiled;
+    IntParam* _tileSize;
 };
 
 WriteEXRPlugin::WriteEXRPlugin(OfxImageEffectHandle handle,
@@ -172,18 +200,42 @@ WriteEXRPlugin::WriteEXRPlugin(OfxImageEffectHandle handle,
     : GenericWriterPlugin(handle, extensions, kSupportsRGBA, kSupportsRGB, kSupportsXY, kSupportsAlpha)
     , _compression(NULL)
     , _bitDepth(NULL)
+    , _threadCount(NULL)
+    , _tiled(NULL)
+    , _tileSize(NULL)
 {
     _compression = fetchChoiceParam(kParamWriteEXRCompression);
     _bitDepth = fetchChoiceParam(kParamWriteEXRDataType);
+    _threadCount = fetchIntParam(kParamWriteEXRThreadCount);
+    _tiled = fetchBooleanParam(kParamWriteEXRTiled);
+    _tileSize = fetchIntParam(kParamWriteEXRTileSize);
+    assert(_threadCount && _tiled && _tileSize);
+    setThreadCount(false);
+    _tileSize->setEnabled( _tiled->getValue() );
 }
 
 WriteEXRPlugin::~WriteEXRPlugin()
 {
 }
 
-//void WriteEXRPlugin::changedParam(const InstanceChangedArgs &/*args*/, const string &paramName)
-//{
-//}
+void
+WriteEXRPlugin::changedParam(const InstanceChangedArgs &args,
+                             const string &paramName)
+{
+    if (paramName == kParamWriteEXRThreadCount) {
+        setThreadCount(args.reason == eChangeUserEdit);
+    } else if (paramName == kParamWriteEXRTiled) {
+        _tileSize->setEnabled( _tiled->getValue() );
+    } else {
+        GenericWriterPlugin::changedParam(args, paramName);
+    }
+}
+
+void
+WriteEXRPlugin::setThreadCount(bool force)
+{
+    setExrGlobalThreadCount(_threadCount->getValue(), force);
+}
 
 
 void
@@ -257,36 +309,75 @@ WriteEXRPlugin::encode(const string& filename,
             exrheader.channels().insert( chanNames[chan], Imf_::Channel(pixelType) );
         }
 
-        Imf_::OutputFile outputFile(filename.c_str(), exrheader);
+        const bool tiled = _tiled->getValue();
+        if (tiled) {
+            const int tileSize = _tileSize->getValue();
+            exrheader.setTileDescription( Imf_::TileDescription(tileSize, tileSize, Imf_::ONE_LEVEL) );
+        }
 
-        for (int y = bounds.y1; y < bounds.y2; ++y) {
-            /*First we create a row that will serve as the output buffer.
-               We copy the scan-line (with y inverted) in the inputImage to the row.*/
-            int exrY = bounds.y2 - y - 1;
-            float* src_pixels = (float*)( (char*)pixelData + (exrY - bounds.y1) * rowBytes );
+        const int width = bounds.x2 - bounds.x1;
+        const int height = bounds.y2 - bounds.y1;
+
+        // The OFX image is bottom-up and the EXR image is top-down: the EXR rows are at decreasing
+        // addresses in pixelData, starting from its last row, hence the negative y stride.
+        const std::ptrdiff_t floatXStride = sizeof(float) * pixelDataNComps;
+        const std::ptrdiff_t floatYStride = -(std::ptrdiff_t)rowBytes;
+        const char* floatBase = (const char*)pixelData + (std::ptrdiff_t)(height - 1) * rowBytes
+                                - exrDataW.min.x * floatXStride - exrDataW.min.y * floatYStride;
+
+        // half data is converted to an interleaved top-down buffer, one group of rows at a time
+        const std::ptrdiff_t halfXStride = sizeof(half) * pixelDataNComps;
+        const std::ptrdiff_t halfYStride = halfXStride * width;
+        int rowsPerGroup;
+        if (tiled) {
+            // all the tiles are written with a single call, so that they are all compressed in parallel
+            rowsPerGroup = height;
+        } else {
+            // OpenEXR compresses up to twice as many chunks as there are threads concurrently
+            rowsPerGroup = exrCompressionScanlines(compression) * (std::max)(1, 2 * Imf_::globalThreadCount());
+        }
+        vector<half> halfRows;
+        if (depth != 32) {
+            halfRows.resize( (std::size_t)(std::min)(rowsPerGroup, height) * width * pixelDataNComps );
+        }
 
+        auto_ptr<Imf_::OutputFile> outputFile;
+        auto_ptr<Imf_::TiledOutputFile> tiledOutputFile;
+        if (tiled) {
+            tiledOutputFile.reset( new Imf_::TiledOutputFile(filename.c_str(), exrheader) );
+        } else {
+            outputFile.reset( new Imf_::OutputFile(filename.c_str(), exrheader) );
+        }
+
+        for (int row = 0; row < height; row += rowsPerGroup) {
+            const int nRows = (std::min)(rowsPerGroup, height - row);
             /*we create the frame buffer*/
             Imf_::FrameBuffer fbuf;
             if (depth == 32) {
                 for (int chan = 0; chan < pixelDataNComps; ++chan) {
-                    fbuf.insert( chanNames[chan], Imf_::Slice(Imf_::FLOAT, (char*)src_pixels + chan, sizeof(float) * pixelDataNComps, 0) );
+                    fbuf.insert( chanNames[chan], Imf_::Slice(Imf_::FLOAT, (char*)floatBase + chan * sizeof(float), (std::size_t)floatXStride, (std::size_t)floatYStride) );
                 }
             } else {
-                Imf_::Array2D<half> halfwriterow(pixelDataNComps, bounds.x2 - bounds.x1);
-
-                for (int chan = 0; chan < pixelDataNComps; ++chan) {
-                    fbuf.insert( chanNames[chan],
-                                 Imf_::Slice(Imf_::HALF,
-                                             (char*)(&halfwriterow[chan][0] - exrDataW.min.x),
-                                             sizeof(halfwriterow[chan][0]), 0) );
-                    const float* from = src_pixels + chan;
-                    for (int i = exrDataW.min.x, f = exrDataW.min.x; i < exrDataW.max.x; ++i, f += pixelDataNComps) {
-                        halfwriterow[chan][i - exrDataW.min.x] = from[f];
+                // the buffer holds EXR rows row to row + nRows - 1
+                half* dst = &halfRows[0];
+                for (int y = row; y < row + nRows; ++y) {
+                    const float* src_pixels = (const float*)( (const char*)pixelData + (std::ptrdiff_t)(height - 1 - y) * rowBytes );
+                    for (int i = 0; i < width * pixelDataNComps; ++i) {
+                        *dst++ = src_pixels[i];
                     }
                 }
+                const char* halfBase = (const char*)&halfRows[0] - exrDataW.min.x * halfXStride - (exrDataW.min.y + row) * halfYStride;
+                for (int chan = 0; chan < pixelDataNComps; ++chan) {
+                    fbuf.insert( chanNames[chan], Imf_::Slice(Imf_::HALF, (char*)halfBase + chan * sizeof(half), (std::size_t)halfXStride, (std::size_t)halfYStride) );
+                }
+            }
+            if (tiled) {
+                tiledOutputFile->setFrameBuffer(fbuf);
+                tiledOutputFile->writeTiles(0, tiledOutputFile->numXTiles() - 1, 0, tiledOutputFile->numYTiles() - 1);
+            } else {
+                outputFile->setFrameBuffer(fbuf);
+                outputFile->writePixels(nRows);
             }
-            outputFile.setFrameBuffer(fbuf);
-            outputFile.writePixels(1);
         }
     } catch (const std::exception& e) {
         setPersistentMessage( Message::eMessageError, "", string("OpenEXR error") + ": " + e.what() );
@@ -349,7 +440,7 @@ WriteEXRPluginFactory::describeInContext(ImageEffectDescriptor &desc,
     // make some pages and to things in
     PageParamDescriptor *page = GenericWriterDescribeInContextBegin(desc, context,
                                                                     kSupportsRGBA, kSupportsRGB, kSupportsXY, kSupportsAlpha,
-                                                                    "scene_linear", "scene_linear", false);
+                                                                    "scene_linear", "scene_linear", false, false);
 
     /////////Compression
     {
@@ -377,6 +468,42 @@ WriteEXRPluginFactory::describeInContext(ImageEffectDescriptor &desc,
         }
     }
 
+    {
+        IntParamDescriptor* param = desc.defineIntParam(kParamWriteEXRThreadCount);
+        param->setLabelAndHint(kParamWriteEXRThreadCountLabel);
+        param->setRange(0, 256);
+        param->setDisplayRange(0, 64);
+        param->setDefault(kParamWriteEXRThreadCountDefault);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
+    {
+        BooleanParamDescriptor* param = desc.defineBooleanParam(kParamWriteEXRTiled);
+        param->setLabelAndHint(kParamWriteEXRTiledLabel);
+        param->setDefault(kParamWriteEXRTiledDefault);
+        param->setAnimates(false);
+        param->setLayoutHint(eLayoutHintNoNewLine, 1);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
+    {
+        IntParamDescriptor* param = desc.defineIntParam(kParamWriteEXRTileSize);
+        param->setLabelAndHint(kParamWriteEXRTileSizeLabel);
+        param->setRange(16, 1024);
+        param->setDisplayRange(16, 256);
+        param->setDefault(kParamWriteEXRTileSizeDefault);
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
     GenericWriterDescribeInContextEnd(desc, context, page);
 }
 
@@ -44,9 +44,15 @@
 #include <cmath>
 #include <iostream>
 #include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h> // stat
 
 #include <ofxsImageEffect.h>
 #include <ofxsMacros.h>
+#include <ofxsProcessing.H>
+
+#include "IOInstrumentation.h"
+#include "PixelFormat.h"
 
 #if defined(_WIN32) || defined(__WIN32__) || defined(WIN32) || defined(WIN64)
 #  include <windows.h> // for GetSystemInfo()
@@ -359,7 +365,8 @@ FFmpegFile::Stream::getConvertCtx(AVPixelFormat srcPixelFormat,
     // Reset is flagged when the UI colour matrix selection is
     // modified. This causes a new convert context to be created
     // that reflects the UI selection.
-    if (_resetConvertCtx) {
+    // The source format may also change, e.g. when the hardware decoder falls back to software.
+    if ( _resetConvertCtx || (_convertCtx && (srcPixelFormat != _convertCtxSrcPixelFormat)) ) {
         _resetConvertCtx = false;
         if (_convertCtx) {
             sws_freeContext(_convertCtx);
@@ -368,6 +375,7 @@ FFmpegFile::Stream::getConvertCtx(AVPixelFormat srcPixelFormat,
     }
 
     if (!_convertCtx) {
+        _convertCtxSrcPixelFormat = srcPixelFormat;
         //Preventing deprecated pixel format used error messages, see:
         //https://libav.org/doxygen/master/pixfmt_8h.html#a9a8e335cf3be472042bc9f0cf80cd4c5
         //This manually sets them to the new versions of equivalent types.
@@ -404,8 +412,10 @@ FFmpegFile::Stream::getConvertCtx(AVPixelFormat srcPixelFormat,
                                      SWS_BICUBIC, nullptr, nullptr, nullptr);
 
         // Set up the SoftWareScaler to convert colorspaces correctly.
-        // Colorspace conversion makes no sense for RGB->RGB conversions
-        if ( !isYUV() ) {
+        // Colorspace conversion makes no sense for RGB->RGB conversions.
+        // The source is the decoded (or downloaded) frame format, so use the capability table.
+        const bool srcIsYUV = FFmpeg::pixelFormatIsYUV(srcPixelFormat);
+        if (!srcIsYUV) {
             return _convertCtx;
         }
 
@@ -435,7 +445,7 @@ FFmpegFile::Stream::getConvertCtx(AVPixelFormat srcPixelFormat,
         default:
             // If the colour range wasn't specified, set the flag according to
             // whether the data is YUV or not.
-            srcRange = isYUV() ? 0 : 1;
+            srcRange = srcIsYUV ? 0 : 1;
             break;
         }
 
@@ -697,6 +707,107 @@ FFmpegFile::getStreamFrames(Stream & stream)
     return frames;
 } // FFmpegFile::getStreamFrames
 
+void
+FFmpegFile::buildKeyframeIndex(Stream & stream)
+{
+    ///Private should not lock
+    OFX_IO_SCOPED_TIMER("ffmpeg.keyframeIndex");
+
+#if TRACE_FILE_OPEN
+    std::cout << "FFmpeg Reader=" << this << "::buildKeyframeIndex(): stream->_idx=" << stream._idx << std::endl;
+#endif
+
+    stream._keyframes.clear();
+    stream._keyframeIndexBuilt = true;
+
+    // Use the index built by the demuxer if there is one (e.g. mov/mp4 sample tables, Matroska cues).
+    // Its timestamps are the ones expected by av_seek_frame(). They may be DTS rather than PTS, in which
+    // case a keyframe may be selected a few frames too late, and decode() retries from the previous one.
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 78, 100)
+    int nbEntries = avformat_index_get_entries_count(stream._avstream);
+#else
+    int nbEntries = stream._avstream->nb_index_entries;
+#endif
+    for (int i = 0; i < nbEntries; ++i) {
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 78, 100)
+        const AVIndexEntry* indexEntry = avformat_index_get_entry(stream._avstream, i);
+#else
+        const AVIndexEntry* indexEntry = &stream._avstream->index_entries[i];
+#endif
+        if ( indexEntry && (indexEntry->flags & AVINDEX_KEYFRAME) && (indexEntry->timestamp != int64_t(AV_NOPTS_VALUE)) ) {
+            Stream::KeyframeIndexEntry entry;
+            entry.pts = indexEntry->timestamp;
+            entry.timestamp = indexEntry->timestamp;
+            stream._keyframes.push_back(entry);
+        }
+    }
+
+    std::sort( stream._keyframes.begin(), stream._keyframes.end() );
+    stream._keyframeIndexFromDemuxer = !stream._keyframes.empty();
+
+#if TRACE_FILE_OPEN
+    std::cout << "      " << stream._keyframes.size() << " keyframes indexed" << std::endl;
+#endif
+} // FFmpegFile::buildKeyframeIndex
+
+// No usable demuxer index (e.g. MPEG-TS, raw elementary streams): read the packets of the stream
+// preceding pts, without decoding them, until the last two keyframes presented at or before pts
+// are found (the previous one is used by decodeFrame() to retry an open GOP). The window starts
+// one second before pts and is doubled until they are found or the start of the stream is reached,
+// so that a random access reads about one GOP of packets while the decoder lock is held, instead
+// of the whole file.
+void
+FFmpegFile::scanKeyframes(Stream & stream,
+                          int64_t pts)
+{
+    ///Private should not lock
+    OFX_IO_SCOPED_TIMER("ffmpeg.keyframeScan");
+
+    int64_t window = (std::max)( (int64_t)1, av_rescale_q(AV_TIME_BASE, AV_TIME_BASE_Q, stream._avstream->time_base) );
+    for (;;) {
+        const int64_t start = (std::max)(stream._startDTS, pts - window);
+        int keyframesBefore = 0;
+
+        stream._keyframes.clear();
+        avcodec_flush_buffers(stream._codecContext);
+        if (av_seek_frame(_context, stream._idx, start, AVSEEK_FLAG_BACKWARD) < 0) {
+            break;
+        }
+        MyAVPacket avPacket;
+        while (av_read_frame(_context, avPacket.pkt()) >= 0) {
+            if (avPacket->stream_index == stream._idx) {
+                // the packets are in decode order, and a frame is never presented before it is decoded
+                const int64_t dts = (avPacket->dts != int64_t(AV_NOPTS_VALUE)) ? avPacket->dts : avPacket->pts;
+                if ( (dts != int64_t(AV_NOPTS_VALUE)) && (dts > pts) ) {
+                    break;
+                }
+                if (avPacket->flags & AV_PKT_FLAG_KEY) {
+                    Stream::KeyframeIndexEntry entry;
+                    entry.pts = (avPacket->pts != int64_t(AV_NOPTS_VALUE)) ? avPacket->pts : avPacket->dts;
+                    entry.timestamp = dts;
+                    if (entry.pts != int64_t(AV_NOPTS_VALUE)) {
+                        stream._keyframes.push_back(entry);
+                        if (entry.pts <= pts) {
+                            ++keyframesBefore;
+                        }
+                    }
+                }
+            }
+            av_packet_unref( avPacket.pkt() );
+        }
+        if ( (keyframesBefore >= 2) || (start <= stream._startDTS) ) {
+            break;
+        }
+        window *= 2;
+    }
+
+    std::sort( stream._keyframes.begin(), stream._keyframes.end() );
+
+#if TRACE_DECODE_PROCESS
+    std::cout << "FFmpeg Reader=" << this << "::scanKeyframes(): pts=" << pts << ", " << stream._keyframes.size() << " keyframes found" << std::endl;
+#endif
+} // FFmpegFile::scanKeyframes
+
 // Returns true if the properties of the two streams are considered to match in terms of
 // codec, resolution, frame rate, time base, etc. The motivation for this is that streams
 // that match in this way are more likely to contain multiple views rather then unrelated
@@ -755,9 +866,90 @@ CheckStreamPropertiesMatch(const AVStream* streamA,
     (streamA->r_frame_rate.den  == streamB->r_frame_rate.den);
 }
 
+// AVCodecContext::get_format callback used for hardware decoding.
+// The hardware pixel format is stored in AVCodecContext::opaque by setupHardwareDecoder().
+static enum AVPixelFormat
+getHardwarePixelFormat(AVCodecContext* codecCtx,
+                       const enum AVPixelFormat* pixFmts)
+{
+    const AVPixelFormat hwPixFmt = (AVPixelFormat)(intptr_t)codecCtx->opaque;
+
+    for (const enum AVPixelFormat* p = pixFmts; *p != AV_PIX_FMT_NONE; ++p) {
+        if (*p == hwPixFmt) {
+            return *p;
+        }
+    }
+
+    // the device cannot decode this stream (e.g. unsupported profile or size): fall back to software decoding
+#if TRACE_DECODE_PROCESS
+    std::cout << "FFmpeg Reader: hardware pixel format not offered by the decoder, falling back to software" << std::endl;
+#endif
+    for (const enum AVPixelFormat* p = pixFmts; *p != AV_PIX_FMT_NONE; ++p) {
+        const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(*p);
+        if ( desc && !(desc->flags & AV_PIX_FMT_FLAG_HWACCEL) ) {
+            return *p;
+        }
+    }
+
+    return AV_PIX_FMT_NONE;
+}
+
+// Attach a hardware device of the requested type ("auto" for the first one that works) to the codec context,
+// before it is opened. Returns the pixel format of the hardware frames, or AV_PIX_FMT_NONE if the codec is to
+// be used in software.
+static AVPixelFormat
+setupHardwareDecoder(AVCodecContext* codecCtx,
+                     const AVCodec* codec,
+                     const string& hwDevice,
+                     AVBufferRef** hwDeviceCtx)
+{
+    assert(hwDeviceCtx && !*hwDeviceCtx);
+    if ( hwDevice.empty() ) {
+        return AV_PIX_FMT_NONE;
+    }
+    const bool autoSelect = (hwDevice == "auto");
+    AVHWDeviceType wantedType = AV_HWDEVICE_TYPE_NONE;
+    if (!autoSelect) {
+        wantedType = av_hwdevice_find_type_by_name( hwDevice.c_str() );
+        if (wantedType == AV_HWDEVICE_TYPE_NONE) {
+            return AV_PIX_FMT_NONE;
+        }
+    }
+    for (int i = 0;; ++i) {
+        const AVCodecHWConfig* config = avcodec_get_hw_config(codec, i);
+        if (!config) {
+            break;
+        }
+        if ( !(config->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX) ||
+             ( !autoSelect && (config->device_type != wantedType) ) ) {
+            continue;
+        }
+        if (av_hwdevice_ctx_create(hwDeviceCtx, config->device_type, nullptr, nullptr, 0) < 0) {
+            // device not available on this machine
+            *hwDeviceCtx = nullptr;
+            continue;
+        }
+#if TRACE_FILE_OPEN
+        std::cout << "      Hardware decoding with " << av_hwdevice_get_type_name(config->device_type) << std::endl;
+#endif
+        codecCtx->hw_device_ctx = av_buffer_ref(*hwDeviceCtx);
+        codecCtx->opaque = (void*)(intptr_t)config->pix_fmt;
+        codecCtx->get_format = getHardwarePixelFormat;
+
+        return config->pix_fmt;
+    }
+#if TRACE_FILE_OPEN
+    std::cout << "      No hardware device for decoder \"" << codec->name << "\", using software decoding" << std::endl;
+#endif
+
+    return AV_PIX_FMT_NONE;
+}
+
 // constructor
-FFmpegFile::FFmpegFile(const string & filename)
+FFmpegFile::FFmpegFile(const string & filename,
+                       const string & hwDevice)
     : _filename(filename)
+    , _hwDevice(hwDevice)
     , _context(nullptr)
     , _streams()
     , _selectedStream(nullptr)
@@ -766,6 +958,15 @@ FFmpegFile::FFmpegFile(const string & filename)
 #ifdef OFX_IO_MT_FFMPEG
     , _lock()
     , _invalidStateLock()
+    , _readAheadSlots()
+    , _readAheadThread(nullptr)
+    , _readAheadMutex()
+    , _readAheadCond()
+    , _readAheadStream(nullptr)
+    , _readAheadLastFrame(-1)
+    , _readAheadNextFrame(-1)
+    , _readAheadGeneration(0)
+    , _readAheadQuit(false)
 #endif
 {
 #ifdef OFX_IO_MT_FFMPEG
@@ -917,8 +1118,15 @@ FFmpegFile::FFmpegFile(const string & filename)
 #endif
         }
 
+        // Hardware decoding is opt-in. If the device cannot be created, the software decoder is used.
+        AVBufferRef* hwDeviceCtx = nullptr;
+        AVPixelFormat hwPixelFormat = setupHardwareDecoder(codecCtx, videoCodec, _hwDevice, &hwDeviceCtx);
+
         // skip if the codec can't be open
         if (avcodec_open2(codecCtx, videoCodec, nullptr) < 0) {
+            if (hwDeviceCtx) {
+                av_buffer_unref(&hwDeviceCtx);
+            }
 #if TRACE_FILE_OPEN
             std::cout << "Decoder \"" << videoCodec->name << "\" failed to open, skipping..." << std::endl;
 #endif
@@ -939,6 +1147,9 @@ FFmpegFile::FFmpegFile(const string & filename)
 #if TRACE_FILE_OPEN
                 std::cout << "Stream properties do not match those of first video stream, ignoring this stream." << std::endl;
 #endif
+                if (hwDeviceCtx) {
+                    av_buffer_unref(&hwDeviceCtx);
+                }
                 continue;
             }
         }
@@ -949,6 +1160,11 @@ FFmpegFile::FFmpegFile(const string & filename)
         stream->_videoCodec = videoCodec;
         stream->_avFrame = av_frame_alloc(); // avcodec_alloc_frame();
         stream->_avIntermediateFrame = av_frame_alloc();
+        stream->_hwDeviceCtx = hwDeviceCtx;
+        stream->_hwPixelFormat = hwPixelFormat;
+        if (hwDeviceCtx) {
+            stream->_avHwTransferFrame = av_frame_alloc();
+        }
 
         {
             // In |engine| the output bit depth was hard coded to 16-bits.
@@ -1053,6 +1269,9 @@ FFmpegFile::FFmpegFile(const string & filename)
 FFmpegFile::~FFmpegFile()
 {
 #ifdef OFX_IO_MT_FFMPEG
+    // the worker thread needs _lock to decode: stop it before locking
+    stopReadAhead();
+
     AutoMutex guard(_lock);
 #endif
 
@@ -1069,15 +1288,15 @@ FFmpegFile::~FFmpegFile()
     _errorMsg.clear();
 }
 
-void FFmpegFile::setSelectedStream(int streamIndex)
+FFmpegFile::Stream*
+FFmpegFile::getStream(int streamIndex) const
 {
+    // _streams is not modified after the constructor: no lock is needed
     if ((streamIndex >= 0) && (streamIndex < static_cast<int>(_streams.size()))) {
-        _selectedStream = _streams[streamIndex];
-    }
-    else {
-        assert(false && "setSelectedStream: Invalid streamIndex");
-        _selectedStream = !_streams.empty() ? _streams[0] : nullptr;
+        return _streams[streamIndex];
     }
+
+    return !_streams.empty() ? _streams[0] : nullptr;
 }
 
 const char*
@@ -1209,6 +1428,7 @@ FFmpegFile::seekFrame(int frame,
                       Stream* stream)
 {
     ///Private should not lock
+    OFX_IO_SCOPED_TIMER("ffmpeg.seek");
 
     avcodec_flush_buffers(stream->_codecContext);
     int64_t timestamp = stream->frameToDts(frame);
@@ -1226,24 +1446,59 @@ FFmpegFile::seekFrame(int frame,
 // decode a single frame into the buffer thread safe
 bool
 FFmpegFile::decode(const ImageEffect* /*plugin*/,
+                   int streamIndex,
                    int frame,
                    bool loadNearest,
+                   bool isPlayback,
                    unsigned char* buffer)
 {
 #ifdef OFX_IO_MT_FFMPEG
+    if (isPlayback) {
+        // 1-based to 0-based, see below
+        if ( decodeFromReadAhead(getStream(streamIndex), frame - 1, buffer) ) {
+            return true;
+        }
+    } else {
+        // scrubbing or rendering: do not waste CPU decoding frames that may never be requested
+        tthread::lock_guard<tthread::mutex> guard(_readAheadMutex);
+        invalidateReadAhead();
+    }
+
     AutoMutex guard(_lock);
+#else
+    unused(isPlayback);
 #endif
 
     if (_streams.empty()) {
         return false;
     }
 
-    assert(_selectedStream && "Null _selectedStream");
-    if (!_selectedStream) {
-        return false;
-    }
+    // the decoder may be shared by instances reading different views: select the stream and decode under the same lock
+    _selectedStream = getStream(streamIndex);
     Stream* stream = _selectedStream;
 
+    frame = getDecodeFrameIndex(stream, frame, loadNearest);
+
+#if TRACE_DECODE_PROCESS
+    std::cout << "FFmpeg Reader=" << this << "::decode(): frame=" << frame << /*", _viewIndex = " << _viewIndex <<*/ ", stream->_idx=" << stream->_idx << std::endl;
+#endif
+
+    bool hasPicture = decodeFrame(frame, buffer);
+
+#ifdef OFX_IO_MT_FFMPEG
+    if (isPlayback && hasPicture) {
+        startReadAhead(frame);
+    }
+#endif
+
+    return hasPicture;
+} // FFmpegFile::decode
+
+int
+FFmpegFile::getDecodeFrameIndex(const Stream* stream,
+                                int frame,
+                                bool loadNearest) const
+{
     // Translate from the 1-based frames expected to 0-based frame offsets for use in the rest of this code.
     frame = frame - 1;
 
@@ -1262,10 +1517,49 @@ FFmpegFile::decode(const ImageEffect* /*plugin*/,
         }
     }
 
+    return frame;
+}
+
+bool
+FFmpegFile::decodeFloat(int streamIndex,
+                        int frame,
+                        bool loadNearest,
+                        const FloatTarget& target)
+{
+#ifdef OFX_IO_MT_FFMPEG
+    {
+        // the frames in the read-ahead ring are not used here, and the decoder is about to move
+        tthread::lock_guard<tthread::mutex> guard(_readAheadMutex);
+        invalidateReadAhead();
+    }
+
+    AutoMutex guard(_lock);
+#endif
+
+    if (_streams.empty()) {
+        return false;
+    }
+
+    _selectedStream = getStream(streamIndex);
+    frame = getDecodeFrameIndex(_selectedStream, frame, loadNearest);
+
 #if TRACE_DECODE_PROCESS
-    std::cout << "FFmpeg Reader=" << this << "::decode(): frame=" << frame << /*", _viewIndex = " << _viewIndex <<*/ ", stream->_idx=" << stream->_idx << std::endl;
+    std::cout << "FFmpeg Reader=" << this << "::decodeFloat(): frame=" << frame << ", stream->_idx=" << _selectedStream->_idx << std::endl;
 #endif
 
+    // the output frame only carries the timestamps: the pixels go to the float target
+    return decodeFrame(frame, nullptr, &target);
+}
+
+bool
+FFmpegFile::decodeFrame(int frame,
+                        unsigned char* buffer,
+                        const FloatTarget* floatTarget)
+{
+    ///Private should not lock
+    OFX_IO_SCOPED_TIMER("ffmpeg.decodeFrame");
+
+    Stream* stream = _selectedStream;
     bool hasPicture = false;
     AVFrame* avFrameOut = stream->_avFrame;
 
@@ -1292,8 +1586,23 @@ FFmpegFile::decode(const ImageEffect* /*plugin*/,
     // This may come back to haunt us one day.
 
     // Only seek and reset for non-sequential frames as this can be very costly.
+    // Seek straight to the last keyframe presented at or before the requested frame,
+    // so that random access costs at most one GOP of decoding.
+    int keyframe = -1;
     if (stream->ptsToFrame(avFrameOut->pts) + 1 != frame) {
-        seekToFrame(stream->frameToPts(frame), AVSEEK_FLAG_BACKWARD);
+        const int64_t pts = stream->frameToPts(frame);
+        if (!stream->_keyframeIndexBuilt) {
+            buildKeyframeIndex(*stream);
+        }
+        if (!stream->_keyframeIndexFromDemuxer) {
+            scanKeyframes(*stream, pts);
+        }
+        keyframe = stream->findKeyframe(pts);
+        if (keyframe >= 0) {
+            seekToFrame(stream->_keyframes[keyframe].timestamp, AVSEEK_FLAG_BACKWARD);
+        } else {
+            seekToFrame(stream->frameToPts(frame), AVSEEK_FLAG_BACKWARD);
+        }
     }
 
     // Setup the output frame struct with the buffer passed in
@@ -1308,49 +1617,258 @@ FFmpegFile::decode(const ImageEffect* /*plugin*/,
         return false;
     }
 
-    res = av_image_fill_pointers(
-                                 avFrameOut->data,
-                                 stream->_outputPixelFormat,
-                                 stream->_height,
-                                 buffer,
-                                 avFrameOut->linesize
-                                 );
+    if (buffer) {
+        res = av_image_fill_pointers(
+                                     avFrameOut->data,
+                                     stream->_outputPixelFormat,
+                                     stream->_height,
+                                     buffer,
+                                     avFrameOut->linesize
+                                     );
+
+        if (res < 0) {
+            setInternalError(res, "FFmpeg Reader Failed to fill image pointers: ");
+            return false;
+        }
+    } else {
+        assert(floatTarget);
+        for (int i = 0; i < AV_NUM_DATA_POINTERS; ++i) {
+            avFrameOut->data[i] = nullptr;
+        }
+    }
+
+
+    bool retriedKeyframe = (keyframe <= 0);
+    bool retriedSeek = false;
+
+    for (;;) {
+        hasPicture = demuxAndDecode(avFrameOut, frame, floatTarget);
+        if (hasPicture || isIntraOnly) {
+            break;
+        }
+        if (!retriedKeyframe) {
+            // The frame may be a leading picture of an open GOP, or the index may hold
+            // DTS instead of PTS: try again from the previous keyframe.
+            retriedKeyframe = true;
+            seekToFrame(stream->_keyframes[keyframe - 1].timestamp, AVSEEK_FLAG_BACKWARD);
+        } else if (!retriedSeek) {
+            // A last ditch effot to get a frame out for non-intra codecs.
+            // This will perform a seek to the start of the file. which is
+            // the only reliable way to get frame accurate seeking in a
+            // stream with B-frames.
+            retriedSeek = true;
+            seekToFrame(0, AVSEEK_FLAG_FRAME | AVSEEK_FLAG_BACKWARD);
+        } else {
+            break;
+        }
+    }
+
+    return hasPicture;
+} // FFmpegFile::decodeFrame
+
+#ifdef OFX_IO_MT_FFMPEG
+bool
+FFmpegFile::decodeFromReadAhead(const Stream* stream,
+                                int frame,
+                                unsigned char* buffer)
+{
+    tthread::lock_guard<tthread::mutex> guard(_readAheadMutex);
+
+    if ( !_readAheadThread || (_readAheadStream != stream) ) {
+        invalidateReadAhead();
 
-    if (res < 0) {
-        setInternalError(res, "FFmpeg Reader Failed to fill image pointers: ");
         return false;
     }
 
+    for (;;) {
+        bool decoding = false;
+        for (std::size_t i = 0; i < _readAheadSlots.size(); ++i) {
+            ReadAheadSlot& slot = _readAheadSlots[i];
+            if (slot.frame != frame) {
+                continue;
+            }
+            if (slot.state == ReadAheadSlot::eStateReady) {
+                std::copy(slot.data.begin(), slot.data.end(), buffer);
+                // release this frame and all the frames that were skipped
+                for (std::size_t j = 0; j < _readAheadSlots.size(); ++j) {
+                    ReadAheadSlot& other = _readAheadSlots[j];
+                    if ( (other.state == ReadAheadSlot::eStateReady) && (other.frame <= frame) ) {
+                        other.state = ReadAheadSlot::eStateFree;
+                        other.frame = -1;
+                    }
+                }
+                _readAheadLastFrame = frame;
+                _readAheadCond.notify_all();
 
-    bool retriedSeek = false;
-    bool retriedDecode = false;
+                return true;
+            }
+            if (slot.state == ReadAheadSlot::eStateDecoding) {
+                decoding = true;
+            }
+        }
+        if (!decoding) {
+            // not read ahead: decode() will decode it synchronously and restart from there
+            invalidateReadAhead();
 
-    while (!retriedDecode) {
+            return false;
+        }
+        // the worker is decoding this frame, wait for it rather than decoding it twice
+        _readAheadCond.wait(guard);
+    }
+}
 
-        retriedDecode = retriedSeek ? true: false;
+void
+FFmpegFile::startReadAhead(int frame)
+{
+    tthread::lock_guard<tthread::mutex> guard(_readAheadMutex);
 
-        hasPicture = demuxAndDecode(avFrameOut, frame);
+    if (!_readAheadThread) {
+        _readAheadSlots.resize(OFX_FFMPEG_READAHEAD_FRAMES);
+        _readAheadQuit = false;
+        _readAheadThread = new tthread::thread(readAheadThreadFunction, this);
+    }
+    invalidateReadAhead();
+    _readAheadStream = _selectedStream;
+    _readAheadLastFrame = frame;
+    _readAheadNextFrame = frame + 1;
+    _readAheadCond.notify_all();
+}
 
-        // A last ditch effot to get a frame out for non-intra codecs.
-        // This will perform a seek to the start of the file. which is
-        // the only reliable way to get frame accurate seeking in a
-        // stream with B-frames.
-        if (!hasPicture && !isIntraOnly && !retriedSeek) {
-            retriedSeek = true;
-            seekToFrame(0, AVSEEK_FLAG_FRAME | AVSEEK_FLAG_BACKWARD);
+void
+FFmpegFile::invalidateReadAhead()
+{
+    ++_readAheadGeneration;
+    _readAheadLastFrame = -1;
+    _readAheadNextFrame = -1;
+    for (std::size_t i = 0; i < _readAheadSlots.size(); ++i) {
+        ReadAheadSlot& slot = _readAheadSlots[i];
+        // slots being decoded are released by the worker when it notices the generation change
+        if (slot.state == ReadAheadSlot::eStateReady) {
+            slot.state = ReadAheadSlot::eStateFree;
+            slot.frame = -1;
         }
-        else {
-            break;
+    }
+    _readAheadCond.notify_all();
+}
+
+void
+FFmpegFile::stopReadAhead()
+{
+    {
+        tthread::lock_guard<tthread::mutex> guard(_readAheadMutex);
+        _readAheadQuit = true;
+        _readAheadCond.notify_all();
+    }
+    if (_readAheadThread) {
+        _readAheadThread->join();
+        delete _readAheadThread;
+        _readAheadThread = nullptr;
+    }
+    _readAheadSlots.clear();
+}
+
+FFmpegFile::ReadAheadSlot*
+FFmpegFile::getFreeReadAheadSlot()
+{
+    if ( (_readAheadNextFrame < 0) || !_readAheadStream ||
+         (_readAheadNextFrame >= _readAheadStream->_frames) ||
+         ( _readAheadNextFrame > _readAheadLastFrame + (int)_readAheadSlots.size() ) ) {
+        return nullptr;
+    }
+    for (std::size_t i = 0; i < _readAheadSlots.size(); ++i) {
+        if (_readAheadSlots[i].state == ReadAheadSlot::eStateFree) {
+            return &_readAheadSlots[i];
         }
     }
 
-    return hasPicture;
-} // FFmpegFile::decode
+    return nullptr;
+}
+
+void
+FFmpegFile::readAheadLoop()
+{
+    for (;;) {
+        ReadAheadSlot* slot = nullptr;
+        Stream* stream = nullptr;
+        int frame = -1;
+        int generation = 0;
+        {
+            tthread::lock_guard<tthread::mutex> guard(_readAheadMutex);
+            while ( !_readAheadQuit && !(slot = getFreeReadAheadSlot()) ) {
+                _readAheadCond.wait(guard);
+            }
+            if (_readAheadQuit) {
+                return;
+            }
+            frame = _readAheadNextFrame++;
+            generation = _readAheadGeneration;
+            stream = _readAheadStream;
+            slot->state = ReadAheadSlot::eStateDecoding;
+            slot->frame = frame;
+        }
+
+        // the slot belongs to this thread until its state changes, its buffer can be used without _readAheadMutex
+        bool hasPicture = false;
+        {
+            AutoMutex guard(_lock);
+            // the ring may have been invalidated or the stream switched while waiting for the lock
+            bool stillNeeded;
+            {
+                tthread::lock_guard<tthread::mutex> readAheadGuard(_readAheadMutex);
+                stillNeeded = !_readAheadQuit && (generation == _readAheadGeneration);
+            }
+            if (stillNeeded) {
+                _selectedStream = stream;
+                slot->data.resize( getBufferBytesCount() );
+                // errors are not reported from here: if the host asks for that frame,
+                // decode() will decode it again and set the error
+                std::string errorMsg;
+                bool invalidState;
+                {
+                    AutoMutex invalidStateGuard(_invalidStateLock);
+                    errorMsg = _errorMsg;
+                    invalidState = _invalidState;
+                }
+                hasPicture = decodeFrame(frame, &slot->data[0]);
+                if (!hasPicture) {
+                    AutoMutex invalidStateGuard(_invalidStateLock);
+                    _errorMsg = errorMsg;
+                    _invalidState = invalidState;
+                }
+            }
+        }
+
+        {
+            tthread::lock_guard<tthread::mutex> guard(_readAheadMutex);
+            if ( hasPicture && (generation == _readAheadGeneration) ) {
+                slot->state = ReadAheadSlot::eStateReady;
+            } else {
+                slot->state = ReadAheadSlot::eStateFree;
+                slot->frame = -1;
+                if (generation == _readAheadGeneration) {
+                    // do not try to read past a frame that cannot be decoded
+                    _readAheadNextFrame = -1;
+                }
+            }
+            _readAheadCond.notify_all();
+        }
+    }
+} // FFmpegFile::readAheadLoop
+
+void
+FFmpegFile::readAheadThreadFunction(void* arg)
+{
+    FFmpegFile* file = static_cast<FFmpegFile*>(arg);
+
+    file->readAheadLoop();
+}
+#endif // OFX_IO_MT_FFMPEG
 
 
 bool
 FFmpegFile::seekToFrame(int64_t frame, int seekFlags)
 {
+    OFX_IO_SCOPED_TIMER("ffmpeg.seek");
     Stream* stream = _selectedStream;
 
     avcodec_flush_buffers(stream->_codecContext);
@@ -1393,8 +1911,9 @@ mov64_av_decode(AVCodecContext *avctx, AVFrame *frame,
     return 0;
 }
 
-bool FFmpegFile::demuxAndDecode(AVFrame* avFrameOut, int64_t frame)
+bool FFmpegFile::demuxAndDecode(AVFrame* avFrameOut, int64_t frame, const FloatTarget* floatTarget)
 {
+    OFX_IO_SCOPED_TIMER("ffmpeg.demuxAndDecode");
     Stream* stream = _selectedStream;
     MyAVPacket avPacket;
 
@@ -1439,6 +1958,7 @@ bool FFmpegFile::demuxAndDecode(AVFrame* avFrameOut, int64_t frame)
     while ((res = av_read_frame(_context, avPacket.pkt())) >= 0) {
 
         if (avPacket->stream_index == stream->_idx) {
+            OFX_IO_COUNT("ffmpeg.packetBytes", avPacket->size);
 
             if ((res = mov64_av_decode(stream->_codecContext, avFrameDecodeDst, &frameDecoded, avPacket.pkt())) < 0) {
                 setInternalError(res, "FFmpeg Reader Failed to decode packet: ");
@@ -1447,7 +1967,7 @@ bool FFmpegFile::demuxAndDecode(AVFrame* avFrameOut, int64_t frame)
 
             if (frameDecoded) {
                 if (foundCorrectFrame(avFrameDecodeDst, frame)) {
-                    hasPicture = imageConvert(avFrameDecodeDst, avFrameOut);
+                    hasPicture = downloadAndConvert(avFrameDecodeDst, avFrameOut, floatTarget);
                     return hasPicture;
                 }
             }
@@ -1473,7 +1993,7 @@ bool FFmpegFile::demuxAndDecode(AVFrame* avFrameOut, int64_t frame)
 
             if (frameDecoded) {
                 if (foundCorrectFrame(avFrameDecodeDst, frame)) {
-                    return imageConvert(avFrameDecodeDst, avFrameOut);
+                    return downloadAndConvert(avFrameDecodeDst, avFrameOut, floatTarget);
                 }
             }
             else {
@@ -1485,6 +2005,355 @@ bool FFmpegFile::demuxAndDecode(AVFrame* avFrameOut, int64_t frame)
     return hasPicture;
 }
 
+bool
+FFmpegFile::downloadAndConvert(AVFrame* avFrameDecoded,
+                               AVFrame* avFrameOut,
+                               const FloatTarget* floatTarget)
+{
+    OFX_IO_SCOPED_TIMER("ffmpeg.convert");
+    Stream* stream = _selectedStream;
+    AVFrame* avFrameIn = avFrameDecoded;
+
+    if ( (stream->_hwPixelFormat != AV_PIX_FMT_NONE) && (avFrameDecoded->format == stream->_hwPixelFormat) ) {
+        // the frame is in GPU memory: download it to the software format chosen by the device,
+        // which is then converted by imageConvert() like any other decoded frame
+        av_frame_unref(stream->_avHwTransferFrame);
+        int res = av_hwframe_transfer_data(stream->_avHwTransferFrame, avFrameDecoded, 0);
+        if (res < 0) {
+            setInternalError(res, "FFmpeg Reader Failed to download the frame from the hardware device: ");
+            return false;
+        }
+        av_frame_copy_props(stream->_avHwTransferFrame, avFrameDecoded);
+        avFrameIn = stream->_avHwTransferFrame;
+        ++stream->_hwFrames;
+        OFX_IO_COUNT("ffmpeg.hwDecodedFrames", 1);
+    } else {
+        ++stream->_swFrames;
+        OFX_IO_COUNT("ffmpeg.swDecodedFrames", 1);
+    }
+#if TRACE_DECODE_PROCESS
+    std::cout << "FFmpeg Reader=" << this << "::downloadAndConvert(): pts=" << avFrameDecoded->pts
+              << ( (avFrameIn != avFrameDecoded) ? " decoded by hardware" : " decoded by software" ) << std::endl;
+#endif
+
+    if (floatTarget) {
+        return floatConvert(avFrameIn, avFrameOut, *floatTarget);
+    }
+
+    return imageConvert(avFrameIn, avFrameOut);
+}
+
+void
+FFmpegFile::getDecodedFramesCount(int streamIndex,
+                                  int64_t* hwFrames,
+                                  int64_t* swFrames) const
+{
+    const Stream* stream = getStream(streamIndex);
+
+#ifdef OFX_IO_MT_FFMPEG
+    // the counters are updated while decoding, under _lock
+    AutoMutex guard(_lock);
+#endif
+    *hwFrames = stream ? stream->_hwFrames : 0;
+    *swFrames = stream ? stream->_swFrames : 0;
+}
+
+// Return true if floatConvert() can read frames of this pixel format: YUV without alpha, planar,
+// semi-planar or packed, with little-endian samples of 8 to 16 bits (e.g. yuv420p, yuv422p10, yuv444p12, nv12, p010).
+static bool
+isFloatConvertible(AVPixelFormat pixFmt)
+{
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(pixFmt);
+
+    if ( !desc || (desc->nb_components != 3) ) {
+        return false;
+    }
+    // Subsampled chroma is interpolated by sws_scale() in the other decoding paths (playback and proxy):
+    // only 4:4:4 formats give the same image whichever path is used.
+    if ( (desc->log2_chroma_w != 0) || (desc->log2_chroma_h != 0) ) {
+        return false;
+    }
+    int unsupportedFlags = AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BE | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM;
+#ifdef AV_PIX_FMT_FLAG_FLOAT
+    unsupportedFlags |= AV_PIX_FMT_FLAG_FLOAT;
+#endif
+    if (desc->flags & unsupportedFlags) {
+        return false;
+    }
+    for (int c = 0; c < 3; ++c) {
+        const AVComponentDescriptor& comp = desc->comp[c];
+        // each sample must be read from a single aligned 8 or 16-bit word
+        const int wordBytes = (comp.depth > 8) ? 2 : 1;
+        if ( (comp.depth > 16) || (comp.offset % wordBytes) || (comp.step % wordBytes) ||
+             (comp.shift + comp.depth > 8 * wordBytes) ) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Coefficients of the YUV to RGB conversion: y = sample * yMul + yAdd, and likewise for chroma, then
+// r = y + crR * cr, g = y + cbG * cb + crG * cr, b = y + cbB * cb
+struct YUVToRGBCoefficients
+{
+    float yMul, yAdd;
+    float cMul, cAdd;
+    float crR, cbG, crG, cbB;
+};
+
+static void
+getYUVToRGBCoefficients(bool rec709,
+                        bool fullRange,
+                        int depth,
+                        YUVToRGBCoefficients* coefs)
+{
+    const double kr = rec709 ? 0.2126 : 0.299;
+    const double kb = rec709 ? 0.0722 : 0.114;
+    const double kg = 1. - kr - kb;
+    const double scale = double(1 << depth) / 256.;
+
+    if (fullRange) {
+        const double maxValue = (1 << depth) - 1;
+        coefs->yMul = float(1. / maxValue);
+        coefs->yAdd = 0.f;
+        coefs->cMul = float(1. / maxValue);
+        coefs->cAdd = float( -(1 << (depth - 1)) / maxValue );
+    } else {
+        // video range: 16..235 for luma, 16..240 for chroma (at 8 bits)
+        coefs->yMul = float( 1. / (219. * scale) );
+        coefs->yAdd = float(-16. / 219.);
+        coefs->cMul = float( 1. / (224. * scale) );
+        coefs->cAdd = float(-128. / 224.);
+    }
+    coefs->crR = float( 2. * (1. - kr) );
+    coefs->cbB = float( 2. * (1. - kb) );
+    coefs->cbG = float( -2. * (1. - kb) * kb / kg );
+    coefs->crG = float( -2. * (1. - kr) * kr / kg );
+}
+
+// Read a row of samples of one component, and normalize them.
+// The loop has no dependencies between iterations, so that the compiler can vectorize it.
+template<typename WORD>
+static inline void
+loadComponentRow(const uint8_t* srcRow,
+                 int step,
+                 int shift,
+                 int x1,
+                 int width,
+                 float mul,
+                 float add,
+                 float* dst)
+{
+    for (int i = 0; i < width; ++i) {
+        const WORD v = *reinterpret_cast<const WORD*>( srcRow + (std::size_t)(x1 + i) * step );
+        dst[i] = float(v >> shift) * mul + add;
+    }
+}
+
+template<int nComps>
+class YUVToFloatProcessor
+    : public ImageProcessor
+{
+    const AVFrame* _srcFrame;
+    const AVPixFmtDescriptor* _srcDesc;
+    YUVToRGBCoefficients _coefs;
+    float* _dstPixelData;
+    OfxRectI _dstBounds;
+    int _dstRowBytes;
+
+public:
+    YUVToFloatProcessor(ImageEffect &instance)
+        : ImageProcessor(instance)
+        , _srcFrame(nullptr)
+        , _srcDesc(nullptr)
+        , _dstPixelData(nullptr)
+        , _dstRowBytes(0)
+    {
+        _dstBounds.x1 = _dstBounds.y1 = _dstBounds.x2 = _dstBounds.y2 = 0;
+    }
+
+    void setValues(const AVFrame* srcFrame,
+                   const YUVToRGBCoefficients& coefs,
+                   float* dstPixelData,
+                   const OfxRectI& dstBounds,
+                   int dstRowBytes)
+    {
+        _srcFrame = srcFrame;
+        _srcDesc = av_pix_fmt_desc_get( (AVPixelFormat)srcFrame->format );
+        _coefs = coefs;
+        _dstPixelData = dstPixelData;
+        _dstBounds = dstBounds;
+        _dstRowBytes = dstRowBytes;
+    }
+
+private:
+    void loadRow(int c,
+                 int srcY,
+                 int x1,
+                 int width,
+                 float mul,
+                 float add,
+                 float* dst)
+    {
+        const AVComponentDescriptor& comp = _srcDesc->comp[c];
+        const uint8_t* srcRow = _srcFrame->data[comp.plane] + (std::size_t)_srcFrame->linesize[comp.plane] * srcY + comp.offset;
+
+        if (comp.depth > 8) {
+            loadComponentRow<uint16_t>(srcRow, comp.step, comp.shift, x1, width, mul, add, dst);
+        } else {
+            loadComponentRow<uint8_t>(srcRow, comp.step, comp.shift, x1, width, mul, add, dst);
+        }
+    }
+
+    // and do some processing
+    virtual void multiThreadProcessImages(const OfxRectI& procWindow, const OfxPointD& rs) OVERRIDE FINAL
+    {
+        unused(rs);
+        const int width = procWindow.x2 - procWindow.x1;
+        if (width <= 0) {
+            return;
+        }
+        std::vector<float> yRow(width), cbRow(width), crRow(width);
+
+        for (int dsty = procWindow.y1; dsty < procWindow.y2; ++dsty) {
+            if ( _effect.abort() ) {
+                break;
+            }
+
+            float* dstPix = (float*)( (char*)_dstPixelData + (std::size_t)_dstRowBytes * (dsty - _dstBounds.y1) )
+                            + (procWindow.x1 - _dstBounds.x1) * nComps;
+            if (nComps == 1) {
+                // the video has no alpha: same as convertDepthAndComponents() from RGB
+                std::fill(dstPix, dstPix + width, 0.f);
+                continue;
+            }
+
+            // FFmpeg frames are top-down, OFX images are bottom-up
+            const int srcY = _srcFrame->height - 1 - dsty;
+            loadRow(0, srcY, procWindow.x1, width, _coefs.yMul, _coefs.yAdd, &yRow[0]);
+            loadRow(1, srcY, procWindow.x1, width, _coefs.cMul, _coefs.cAdd, &cbRow[0]);
+            loadRow(2, srcY, procWindow.x1, width, _coefs.cMul, _coefs.cAdd, &crRow[0]);
+
+            const float* y = &yRow[0];
+            const float* cb = &cbRow[0];
+            const float* cr = &crRow[0];
+            for (int i = 0; i < width; ++i, dstPix += nComps) {
+                // clamp like the 8/16-bit integer conversion does
+                dstPix[0] = (std::max)( 0.f, (std::min)(y[i] + _coefs.crR * cr[i], 1.f) );
+                dstPix[1] = (std::max)( 0.f, (std::min)(y[i] + _coefs.cbG * cb[i] + _coefs.crG * cr[i], 1.f) );
+                dstPix[2] = (std::max)( 0.f, (std::min)(y[i] + _coefs.cbB * cb[i], 1.f) );
+                if (nComps == 4) {
+                    dstPix[3] = 1.f;
+                }
+            }
+        }
+    }
+};
+
+template<int nComps>
+static void
+processYUVToFloat(ImageEffect* effect,
+                  const AVFrame* srcFrame,
+                  const YUVToRGBCoefficients& coefs,
+                  const FFmpegFile::FloatTarget& target,
+                  const OfxRectI& renderWindow)
+{
+    YUVToFloatProcessor<nComps> p(*effect);
+    OfxPointD renderScale = {1., 1.};
+
+    p.setValues(srcFrame, coefs, target.pixelData, target.bounds, target.rowBytes);
+    p.setRenderWindow(renderWindow, renderScale);
+    p.process();
+}
+
+bool
+FFmpegFile::canDecodeFloat(int streamIndex) const
+{
+    const Stream* stream = getStream(streamIndex);
+
+    if (!stream) {
+        return false;
+    }
+
+    // frames decoded by a hardware device are downloaded to a format that is only known after decoding
+    if (stream->_hwDeviceCtx) {
+        return false;
+    }
+
+    return isFloatConvertible(stream->_codecContext->pix_fmt);
+}
+
+bool
+FFmpegFile::floatConvert(AVFrame* avFrameIn,
+                         AVFrame* avFrameOut,
+                         const FloatTarget& target)
+{
+    Stream* stream = _selectedStream;
+    AVPixelFormat srcPixFmt = (AVPixelFormat)avFrameIn->format;
+
+    // the output frame is only used to track the decoding position
+    avFrameOut->pts          = avFrameIn->pts;
+    avFrameOut->pkt_dts      = avFrameIn->pkt_dts;
+    avFrameOut->pkt_duration = avFrameIn->pkt_duration;
+
+    if ( !isFloatConvertible(srcPixFmt) ) {
+        setError("FFmpeg Reader the pixel format of the decoded frame changed");
+        return false;
+    }
+    assert(target.effect && target.pixelData);
+
+    // same color matrix and range as Stream::getConvertCtx()
+    bool rec709 = stream->isRec709Format();
+    if (stream->_colorMatrixTypeOverride > 0) {
+        rec709 = (stream->_colorMatrixTypeOverride == 1);
+    }
+    bool fullRange;
+    switch (avFrameIn->color_range) {
+    case AVCOL_RANGE_MPEG:
+        fullRange = false;
+        break;
+    case AVCOL_RANGE_JPEG:
+        fullRange = true;
+        break;
+    case AVCOL_RANGE_UNSPECIFIED:
+    default:
+        fullRange = (srcPixFmt == AV_PIX_FMT_YUVJ420P) || (srcPixFmt == AV_PIX_FMT_YUVJ422P) ||
+                    (srcPixFmt == AV_PIX_FMT_YUVJ444P) || (srcPixFmt == AV_PIX_FMT_YUVJ440P);
+        break;
+    }
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(srcPixFmt);
+    YUVToRGBCoefficients coefs;
+    getYUVToRGBCoefficients(rec709, fullRange, desc->comp[0].depth, &coefs);
+
+    OfxRectI renderWindow = target.renderWindow;
+    renderWindow.x1 = (std::max)(renderWindow.x1, 0);
+    renderWindow.y1 = (std::max)(renderWindow.y1, 0);
+    renderWindow.x2 = (std::min)(renderWindow.x2, avFrameIn->width);
+    renderWindow.y2 = (std::min)(renderWindow.y2, avFrameIn->height);
+    if ( (renderWindow.x1 >= renderWindow.x2) || (renderWindow.y1 >= renderWindow.y2) ) {
+        return true;
+    }
+
+    switch (target.nComps) {
+    case 1:
+        processYUVToFloat<1>(target.effect, avFrameIn, coefs, target, renderWindow);
+        break;
+    case 3:
+        processYUVToFloat<3>(target.effect, avFrameIn, coefs, target, renderWindow);
+        break;
+    case 4:
+        processYUVToFloat<4>(target.effect, avFrameIn, coefs, target, renderWindow);
+        break;
+    default:
+        assert(false);
+
+        return false;
+    }
+
+    return true;
+} // FFmpegFile::floatConvert
+
 bool
 FFmpegFile::imageConvert(AVFrame* avFrameIn, AVFrame* avFrameOut)
 {
@@ -1562,24 +2431,19 @@ bool
 FFmpegFile::getInfo(int & width,
                     int & height,
                     double & aspect,
-                    int & frames)
+                    int & frames,
+                    int streamIndex)
 {
-#ifdef OFX_IO_MT_FFMPEG
-    AutoMutex guard(_lock);
-#endif
-
-    if (_streams.empty()) {
-        return false;
-    }
+    // the stream information is set by the constructor and never changes: no lock is needed
+    const Stream* stream = getStream(streamIndex);
 
-    assert(_selectedStream && "Null _selectedStream");
-    if (!_selectedStream) {
+    if (!stream) {
         return false;
     }
-    width  = _selectedStream->_width;
-    height = _selectedStream->_height;
-    aspect = _selectedStream->_aspect;
-    frames = (int)_selectedStream->_frames;
+    width  = stream->_width;
+    height = stream->_height;
+    aspect = stream->_aspect;
+    frames = (int)stream->_frames;
 
     return true;
 }
@@ -1600,6 +2464,7 @@ FFmpegFile::getBufferBytesCount() const
 
 FFmpegFileManager::FFmpegFileManager()
     : _files()
+    , _useCounter(0)
     , _lock(nullptr)
 {
 }
@@ -1607,8 +2472,9 @@ FFmpegFileManager::FFmpegFileManager()
 FFmpegFileManager::~FFmpegFileManager()
 {
     for (FilesMap::iterator it = _files.begin(); it != _files.end(); ++it) {
-        for (std::list<FFmpegFile*>::iterator it2 = it->second.begin(); it2 != it->second.end(); ++it2) {
-            delete *it2;
+        for (std::list<Decoder>::iterator it2 = it->second.begin(); it2 != it->second.end(); ++it2) {
+            assert(it2->users == 0);
+            delete it2->file;
         }
     }
     _files.clear();
@@ -1622,78 +2488,193 @@ FFmpegFileManager::init()
 }
 
 void
-FFmpegFileManager::clear(void const * plugin)
+FFmpegFileManager::clear()
 {
     assert(_lock);
     FFmpegFile::AutoMutex guard(*_lock);
-    FilesMap::iterator found = _files.find(plugin);
-    if ( found != _files.end() ) {
-        for (std::list<FFmpegFile*>::iterator it = found->second.begin(); it != found->second.end(); ++it) {
-            delete *it;
+    for (FilesMap::iterator it = _files.begin(); it != _files.end(); ) {
+        for (std::list<Decoder>::iterator it2 = it->second.begin(); it2 != it->second.end(); ) {
+            if (it2->users == 0) {
+                delete it2->file;
+                it2 = it->second.erase(it2);
+            } else {
+                ++it2;
+            }
+        }
+        if ( it->second.empty() ) {
+            _files.erase(it++);
+        } else {
+            ++it;
         }
-        _files.erase(found);
     }
 }
 
-FFmpegFile*
-FFmpegFileManager::get(void const * plugin,
-                       const string &filename) const
+// get the size and modification time of a file, or an invalid stamp if it can not be read
+static FFmpegFileManager::FileStamp
+getFileStamp(const string& filename)
 {
-    if (filename.empty() || !plugin) {
-        return 0;
+    FFmpegFileManager::FileStamp stamp;
+
+#if defined(_WIN32) || defined(__WIN32__) || defined(WIN32) || defined(WIN64)
+    struct _stat64 st;
+    if (_stat64(filename.c_str(), &st) == 0) {
+        stamp.size = (long long)st.st_size;
+        stamp.mtimeSec = (long long)st.st_mtime;
+        stamp.mtimeNSec = 0;
     }
-    assert(_lock);
-    FFmpegFile::AutoMutex guard(*_lock);
-    FilesMap::iterator found = _files.find(plugin);
-    if ( found != _files.end() ) {
-        for (std::list<FFmpegFile*>::iterator it = found->second.begin(); it != found->second.end(); ++it) {
-            if ( (*it)->getFilename() == filename ) {
-                if ( (*it)->isInvalid() ) {
-                    delete *it;
-                    found->second.erase(it);
-                    break;
-                } else {
-                    return *it;
-                }
-            }
-        }
+#else
+    struct stat st;
+    if (stat(filename.c_str(), &st) == 0) {
+        stamp.size = (long long)st.st_size;
+#if defined(__APPLE__)
+        stamp.mtimeSec = (long long)st.st_mtimespec.tv_sec;
+        stamp.mtimeNSec = (long long)st.st_mtimespec.tv_nsec;
+#else
+        stamp.mtimeSec = (long long)st.st_mtim.tv_sec;
+        stamp.mtimeNSec = (long long)st.st_mtim.tv_nsec;
+#endif
     }
+#endif
 
-    return nullptr;
+    return stamp;
 }
 
 FFmpegFile*
-FFmpegFileManager::getOrCreate(void const * plugin,
-                               const string &filename) const
+FFmpegFileManager::acquire(const string &filename,
+                           const string &hwDevice,
+                           int frame) const
 {
-    if (filename.empty() || !plugin) {
-        return 0;
+    if ( filename.empty() ) {
+        return nullptr;
     }
+    const FileStamp stamp = getFileStamp(filename);
     assert(_lock);
     FFmpegFile::AutoMutex guard(*_lock);
-    FilesMap::iterator found = _files.find(plugin);
-    if ( found != _files.end() ) {
-        for (std::list<FFmpegFile*>::iterator it = found->second.begin(); it != found->second.end(); ++it) {
-            if ( (*it)->getFilename() == filename ) {
-                if ( (*it)->isInvalid() ) {
-                    delete *it;
-                    found->second.erase(it);
-                    break;
-                } else {
-                    return *it;
-                }
+    std::list<Decoder>& decoders = _files[filename];
+
+    // forget about the decoders that failed or were opened before the file was rewritten, unless someone is still using them
+    for (std::list<Decoder>::iterator it = decoders.begin(); it != decoders.end(); ) {
+        if ( (it->users == 0) && ( it->file->isInvalid() || !(it->stamp == stamp) ) ) {
+            delete it->file;
+            it = decoders.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // Pick, in order of preference:
+    // - an idle decoder positioned just before the frame, so that it can decode without seeking
+    //   (or that has it in its read-ahead ring)
+    // - a busy decoder positioned just before the frame: waiting for it is cheaper than seeking
+    // - the least recently used idle decoder
+    // - a new decoder, if there are not too many decoders on this file
+    // - the least busy decoder
+    const int sequentialDistance = OFX_FFMPEG_READAHEAD_FRAMES + 1;
+    Decoder* idleSequential = nullptr;
+    Decoder* busySequential = nullptr;
+    Decoder* idle = nullptr;
+    Decoder* leastBusy = nullptr;
+    for (std::list<Decoder>::iterator it = decoders.begin(); it != decoders.end(); ++it) {
+        if ( it->file->isInvalid() || !(it->stamp == stamp) || (it->file->getHardwareDevice() != hwDevice) ) {
+            continue;
+        }
+        bool sequential = (frame == INT_MIN) ||
+                          ( (it->lastFrame != INT_MIN) && (it->lastFrame <= frame) && (frame <= it->lastFrame + sequentialDistance) );
+        if (it->users == 0) {
+            if ( sequential && (!idleSequential || (idleSequential->lastUse < it->lastUse)) ) {
+                idleSequential = &*it;
             }
+            if ( !idle || (it->lastUse < idle->lastUse) ) {
+                idle = &*it;
+            }
+        } else if ( sequential && (frame != INT_MIN) && !busySequential ) {
+            busySequential = &*it;
+        }
+        if ( !leastBusy || (it->users < leastBusy->users) ) {
+            leastBusy = &*it;
         }
     }
 
-    FFmpegFile* file = new FFmpegFile(filename);
-    if ( found == _files.end() ) {
-        std::list<FFmpegFile*> fileList;
-        fileList.push_back(file);
-        _files.insert( make_pair(plugin, fileList) );
-    } else {
-        found->second.push_back(file);
+    // metadata queries (frame == INT_MIN) never need a decoder of their own
+    Decoder* decoder = idleSequential ? idleSequential : busySequential ? busySequential : idle;
+    if (!decoder && frame == INT_MIN) {
+        decoder = leastBusy;
+    }
+    if ( !decoder && ( !leastBusy || (decoders.size() < OFX_FFMPEG_POOL_MAX_DECODERS_PER_FILE) ) ) {
+        decoders.push_back( Decoder() );
+        decoders.back().file = new FFmpegFile(filename, hwDevice);
+        decoders.back().stamp = stamp;
+        decoder = &decoders.back();
+    }
+    if (!decoder) {
+        decoder = leastBusy;
     }
+    assert(decoder);
+
+    ++decoder->users;
+    if (frame != INT_MIN) {
+        decoder->lastFrame = frame;
+    }
+    decoder->lastUse = ++_useCounter;
+    FFmpegFile* file = decoder->file;
+
+    evict();
 
     return file;
+} // FFmpegFileManager::acquire
+
+void
+FFmpegFileManager::release(FFmpegFile* file) const
+{
+    assert(_lock);
+    FFmpegFile::AutoMutex guard(*_lock);
+    FilesMap::iterator found = _files.find( file->getFilename() );
+    assert( found != _files.end() );
+    if ( found == _files.end() ) {
+        return;
+    }
+    for (std::list<Decoder>::iterator it = found->second.begin(); it != found->second.end(); ++it) {
+        if (it->file == file) {
+            assert(it->users > 0);
+            --it->users;
+            break;
+        }
+    }
+    evict();
 }
+
+void
+FFmpegFileManager::evict() const
+{
+    ///Private should not lock
+
+    for (;;) {
+        std::size_t count = 0;
+        std::size_t memory = 0;
+        FilesMap::iterator lruFile = _files.end();
+        std::list<Decoder>::iterator lru;
+        for (FilesMap::iterator it = _files.begin(); it != _files.end(); ++it) {
+            for (std::list<Decoder>::iterator it2 = it->second.begin(); it2 != it->second.end(); ++it2) {
+                ++count;
+                // the output frame, the intermediate frame and the read-ahead ring
+                memory += it2->file->getBufferBytesCount() * (OFX_FFMPEG_READAHEAD_FRAMES + 2);
+                if ( (it2->users == 0) && ( ( lruFile == _files.end() ) || (it2->lastUse < lru->lastUse) ) ) {
+                    lruFile = it;
+                    lru = it2;
+                }
+            }
+        }
+        if ( ( lruFile == _files.end() ) ||
+             ( (count <= OFX_FFMPEG_POOL_MAX_DECODERS) && ( memory <= std::size_t(OFX_FFMPEG_POOL_MAX_MEMORY_MB) * 1024 * 1024 ) ) ) {
+            break;
+        }
+#if TRACE_FILE_OPEN
+        std::cout << "FFmpegFileManager::evict(): closing " << lru->file->getFilename() << std::endl;
+#endif
+        delete lru->file;
+        lruFile->second.erase(lru);
+        if ( lruFile->second.empty() ) {
+            _files.erase(lruFile);
+        }
+    }
+} // FFmpegFileManager::evict
@@ -39,6 +39,7 @@
 #include <algorithm>
 #include <locale>
 #include <cstdio>
+#include <climits>
 extern "C" {
 #include <errno.h>
 #include <libavformat/avformat.h>
@@ -49,6 +50,7 @@ extern "C" {
 #include <libswscale/swscale.h>
 #include <libavutil/avutil.h>
 #include <libavutil/error.h>
+#include <libavutil/hwcontext.h>
 }
 
 #include "ofxsMultiThread.h"
@@ -57,6 +59,9 @@ extern "C" {
 // prefer using the fast mutex by Marcus Geelnard http://tinythreadpp.bitsnbites.eu/
 #include "fast_mutex.h"
 #endif
+#ifdef OFX_IO_MT_FFMPEG
+#include "tinythread.h" // for tthread::thread and tthread::condition_variable
+#endif
 
 #define CHECKMSG(x, msg) \
     { \
@@ -88,6 +93,7 @@ extern "C" {
 #define kMetaValueWriter64         "mov64"
 
 #define OFX_FFMPEG_MAX_THREADS 16 // MAX_AUTO_THREADS in libavcodec/pthread_internal.h. 32 in libavcodec/mpegvideo.h, 16 in libavcodec/hevcdec.h, 8 in libavcodec/vp8.h
+#define OFX_FFMPEG_READAHEAD_FRAMES 4 // number of converted frames decoded ahead of the current frame during playback
 
 ////////////////////////////////////////////////////////////////////////////////
 // Chunksize static names.
@@ -125,6 +131,17 @@ private:
 class FFmpegFile
 {
 public:
+    // Destination of decodeFloat(): a float RGB, RGBA or Alpha host image.
+    struct FloatTarget
+    {
+        OFX::ImageEffect* effect; // effect used to run the conversion threads
+        float* pixelData;
+        OfxRectI bounds;       // bounds of pixelData
+        OfxRectI renderWindow; // part of pixelData to fill
+        int nComps;            // 1, 3 or 4
+        int rowBytes;
+    };
+
 #ifdef OFX_USE_MULTITHREAD_MUTEX
     typedef OFX::MultiThread::Mutex Mutex;
     typedef OFX::MultiThread::AutoMutex AutoMutex;
@@ -144,6 +161,12 @@ private:
         AVFrame* _avIntermediateFrame; // decode into this if an image conversion is required
         SwsContext* _convertCtx;
         bool _resetConvertCtx;
+        AVPixelFormat _convertCtxSrcPixelFormat; // source pixel format _convertCtx was created for
+        AVBufferRef* _hwDeviceCtx;     // hardware device used for decoding, or NULL for software decoding
+        AVPixelFormat _hwPixelFormat;  // pixel format of the frames decoded by the hardware device
+        AVFrame* _avHwTransferFrame;   // hardware frames are downloaded into this before conversion
+        int64_t _hwFrames;             // number of frames decoded by the hardware device
+        int64_t _swFrames;             // number of frames decoded in software
 
         int _fpsNum;
         int _fpsDen;
@@ -176,6 +199,21 @@ private:
         // since the last seek. This is part of a guard mechanism to detect when decode appears to have
         // stalled and ensure that FFmpegFile::decode() does not loop indefinitely.
 
+        struct KeyframeIndexEntry
+        {
+            int64_t pts;       // presentation timestamp of the keyframe
+            int64_t timestamp; // timestamp to pass to av_seek_frame() to reach that keyframe
+
+            bool operator<(const KeyframeIndexEntry& other) const
+            {
+                return pts < other.pts;
+            }
+        };
+
+        std::vector<KeyframeIndexEntry> _keyframes; // keyframes sorted by PTS, from the demuxer index or from the last packet scan
+        bool _keyframeIndexBuilt; // the demuxer index was read
+        bool _keyframeIndexFromDemuxer; // _keyframes holds the whole demuxer index, else it is scanned on each random access
+
         Stream()
             : _idx(0)
             , _avstream(nullptr)
@@ -185,6 +223,12 @@ private:
             , _avIntermediateFrame(nullptr)
             , _convertCtx(nullptr)
             , _resetConvertCtx(true)
+            , _convertCtxSrcPixelFormat(AV_PIX_FMT_NONE)
+            , _hwDeviceCtx(nullptr)
+            , _hwPixelFormat(AV_PIX_FMT_NONE)
+            , _avHwTransferFrame(nullptr)
+            , _hwFrames(0)
+            , _swFrames(0)
             , _fpsNum(1)
             , _fpsDen(1)
             , _startPTS(0)
@@ -203,6 +247,9 @@ private:
             , _decodeNextFrameIn(-1)
             , _decodeNextFrameOut(-1)
             , _accumDecodeLatency(0)
+            , _keyframes()
+            , _keyframeIndexBuilt(false)
+            , _keyframeIndexFromDemuxer(false)
         {
             // The purpose of this is to avoid an RGB->RGB conversion.
             // This saves memory and improves performance. For example
@@ -231,6 +278,14 @@ private:
             if (_convertCtx) {
                 sws_freeContext(_convertCtx);
             }
+
+            if (_avHwTransferFrame) {
+                av_frame_free(&_avHwTransferFrame);
+            }
+
+            if (_hwDeviceCtx) {
+                av_buffer_unref(&_hwDeviceCtx);
+            }
         }
 
         static void destroy(Stream* s)
@@ -257,7 +312,7 @@ private:
             // guard against division by zero
             assert(denominator);
 
-            return _startPTS + denominator ? (numerator / denominator) : numerator;
+            return _startPTS + (denominator ? (numerator / denominator) : numerator);
         }
 
         int ptsToFrame(int64_t pts) const
@@ -289,11 +344,27 @@ private:
         bool isYUV() const
         {
             // from swscale_internal.h
-            const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(_codecContext->pix_fmt);
+            // with hardware decoding, pix_fmt is the hardware surface format: use the format of the downloaded frames
+            AVPixelFormat pixFmt = _codecContext->pix_fmt;
+            if ( (_hwPixelFormat != AV_PIX_FMT_NONE) && (pixFmt == _hwPixelFormat) && (_codecContext->sw_pix_fmt != AV_PIX_FMT_NONE) ) {
+                pixFmt = _codecContext->sw_pix_fmt;
+            }
+            const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(pixFmt);
 
             return !(desc->flags & AV_PIX_FMT_FLAG_RGB) && desc->nb_components >= 2;
         }
 
+        // Return the index in _keyframes of the last keyframe presented at or before pts, or -1 if there is none.
+        int findKeyframe(int64_t pts) const
+        {
+            KeyframeIndexEntry entry;
+            entry.pts = pts;
+            entry.timestamp = pts;
+            std::vector<KeyframeIndexEntry>::const_iterator it = std::upper_bound(_keyframes.begin(), _keyframes.end(), entry);
+
+            return static_cast<int>(it - _keyframes.begin()) - 1;
+        }
+
         static double GetStreamAspectRatio(Stream* stream);
 
         // Generate the conversion context used by SoftWareScaler if not already set.
@@ -314,14 +385,19 @@ private:
 
     std::string _filename;
 
+    // name of the FFmpeg hardware device type requested for decoding ("auto" for the first available one),
+    // empty for software decoding
+    std::string _hwDevice;
+
     // AV structure
     AVFormatContext* _context;
 
     // store all video streams available in the file
     std::vector<Stream*> _streams;
 
-    // The stream selected as the one from which data will be read. The constructor sets this to the
-    // viewIndex^th stream if there is one, otherwise the first (i.e. zeroth) stream.
+    // The stream from which data is being read. The file may be shared by instances reading different
+    // views, so decode(), decodeFloat() and the read-ahead thread set it under _lock before decoding,
+    // and it is only valid while _lock is held.
     Stream* _selectedStream;
 
     // reader error state
@@ -332,6 +408,40 @@ private:
     // internal lock for multithread access
     mutable Mutex _lock;
     mutable Mutex _invalidStateLock;
+
+    // Playback read-ahead: when decode() is called with isPlayback=true, a worker thread decodes
+    // the frames following the last requested one into a small ring of converted frames, so that
+    // sequential playback does not wait on demuxing, decoding and conversion.
+    struct ReadAheadSlot
+    {
+        enum StateEnum
+        {
+            eStateFree = 0,
+            eStateDecoding,
+            eStateReady
+        };
+
+        StateEnum state;
+        int frame;                       // 0-based index of the frame held (or being decoded) in this slot
+        std::vector<unsigned char> data; // converted frame, getBufferBytesCount() bytes
+
+        ReadAheadSlot()
+            : state(eStateFree)
+            , frame(-1)
+            , data()
+        {
+        }
+    };
+
+    std::vector<ReadAheadSlot> _readAheadSlots;
+    tthread::thread* _readAheadThread;
+    tthread::mutex _readAheadMutex; // protects the _readAhead* members, never held while waiting for _lock
+    tthread::condition_variable _readAheadCond;
+    Stream* _readAheadStream;  // stream the frames in the ring were decoded from
+    int _readAheadLastFrame;   // 0-based index of the last frame requested during playback
+    int _readAheadNextFrame;   // 0-based index of the next frame to decode ahead, negative if read-ahead is paused
+    int _readAheadGeneration;  // incremented each time the ring is invalidated
+    bool _readAheadQuit;       // set to stop the worker thread
 #endif
 
     // set reader error
@@ -355,12 +465,20 @@ private:
 
     bool seekFrame(int frame, Stream* stream);
 
+    // Build the keyframe index of the stream from the demuxer index, if there is one.
+    void buildKeyframeIndex(Stream& stream);
+
+    // Without a demuxer index, find the keyframes preceding pts by reading the packets before it.
+    void scanKeyframes(Stream& stream, int64_t pts);
+
 public:
 
     //FFmpegFile();
 
     // constructor
-    FFmpegFile(const std::string& filename);
+    // hwDevice is the name of the FFmpeg hardware device type to decode with (e.g. "vaapi", "cuda", "videotoolbox"),
+    // "auto" to pick the first one available, or empty to decode in software.
+    FFmpegFile(const std::string& filename, const std::string& hwDevice = std::string());
 
     // destructor
     ~FFmpegFile();
@@ -370,6 +488,22 @@ public:
         return _filename;
     }
 
+    const std::string& getHardwareDevice() const
+    {
+        return _hwDevice;
+    }
+
+    // return true if the stream is decoded by a hardware device
+    bool isHardwareDecoding(int streamIndex) const
+    {
+        const Stream* stream = getStream(streamIndex);
+
+        return stream && stream->_hwDeviceCtx;
+    }
+
+    // get the number of frames of the stream that were decoded by this file's hardware device and in software
+    void getDecodedFramesCount(int streamIndex, int64_t* hwFrames, int64_t* swFrames) const;
+
     // get the internal error string
     const std::string& getError() const;
 
@@ -382,8 +516,6 @@ public:
         return _streams.size();
     }
 
-    void setSelectedStream(int streamIndex);
-
     void setColorMatrixTypeOverride(int colorMatrixType) const
     {
         if ( _streams.empty() ) {
@@ -504,8 +636,17 @@ public:
         return _streams[0]->_bitDepth > 8 ? sizeof(unsigned short) : sizeof(unsigned char);
     }
 
-    // decode a single frame into the buffer. Thread safe
-    bool decode(const OFX::ImageEffect* plugin, int frame, bool loadNearest, unsigned char* buffer);
+    // decode a single frame into the buffer. Thread safe.
+    // If isPlayback is true, the following frames are decoded ahead in a background thread.
+    // streamIndex is the stream to decode (the view index), or the first stream if there is no such stream.
+    bool decode(const OFX::ImageEffect* plugin, int streamIndex, int frame, bool loadNearest, bool isPlayback, unsigned char* buffer);
+
+    // return true if the frames of the stream can be converted by decodeFloat() (4:4:4 YUV formats only)
+    bool canDecodeFloat(int streamIndex) const;
+
+    // decode a single frame, and convert it from YUV to float directly into the host image,
+    // in a single multithreaded pass. Thread safe.
+    bool decodeFloat(int streamIndex, int frame, bool loadNearest, const FloatTarget& target);
 
     // get stream information
     bool getFPS(double& fps,
@@ -515,7 +656,8 @@ public:
     bool getInfo(int& width,
                  int& height,
                  double& aspect,
-                 int& frames);
+                 int& frames,
+                 int streamIndex = 0);
 
     const char* getColorspace() const;
 
@@ -533,33 +675,169 @@ public:
 
 private:
 
+  // the stream at streamIndex, or the first stream if there is no such stream, or NULL if there is no stream
+  Stream* getStream(int streamIndex) const;
+
   bool seekToFrame(int64_t frame, int seekFlags);
 
-  bool demuxAndDecode(AVFrame* avFrameOut, int64_t frame);
+  bool demuxAndDecode(AVFrame* avFrameOut, int64_t frame, const FloatTarget* floatTarget);
 
   bool imageConvert(AVFrame* avFrameIn, AVFrame* avFrameOut);
+
+  // convert a YUV frame to float RGB(A), see decodeFloat()
+  bool floatConvert(AVFrame* avFrameIn, AVFrame* avFrameOut, const FloatTarget& floatTarget);
+
+  // download the decoded frame from the hardware device if necessary, and convert it,
+  // either to avFrameOut or, if floatTarget is not NULL, to the float host image
+  bool downloadAndConvert(AVFrame* avFrameDecoded, AVFrame* avFrameOut, const FloatTarget* floatTarget);
+
+  // decode the 0-based frame of the selected stream into the buffer, or into floatTarget if it is not NULL.
+  // _lock must be held.
+  bool decodeFrame(int frame, unsigned char* buffer, const FloatTarget* floatTarget = nullptr);
+
+  // clamp the 1-based frame to the stream range, and return it 0-based. Throws if the frame
+  // is out of range and loadNearest is false.
+  int getDecodeFrameIndex(const Stream* stream, int frame, bool loadNearest) const;
+
+#ifdef OFX_IO_MT_FFMPEG
+  // copy the 0-based frame of stream from the read-ahead ring to the buffer, if it is available.
+  // _lock must not be held.
+  bool decodeFromReadAhead(const Stream* stream, int frame, unsigned char* buffer);
+
+  // (re)start reading ahead after the given 0-based frame. _lock must be held.
+  void startReadAhead(int frame);
+
+  // drop all frames from the ring and pause the worker. _readAheadMutex must be held.
+  void invalidateReadAhead();
+
+  // stop and join the worker thread.
+  void stopReadAhead();
+
+  // return a free slot if the worker may decode _readAheadNextFrame. _readAheadMutex must be held.
+  ReadAheadSlot* getFreeReadAheadSlot();
+
+  void readAheadLoop();
+
+  static void readAheadThreadFunction(void* arg);
+#endif
 };
 
 
+// Decoders are shared by all the plug-in instances reading the same file. Several decoders may be
+// opened on the same file, so that renders of distant frames do not serialize on the same decoder.
+// Decoders that are not used by any instance are kept for later use, and the least recently used
+// ones are closed when there are more than OFX_FFMPEG_POOL_MAX_DECODERS of them, or when they use
+// more than OFX_FFMPEG_POOL_MAX_MEMORY_MB.
+#define OFX_FFMPEG_POOL_MAX_DECODERS 16
+#define OFX_FFMPEG_POOL_MAX_DECODERS_PER_FILE 4
+#define OFX_FFMPEG_POOL_MAX_MEMORY_MB 2048
+
 class FFmpegFileManager
 {
-    ///For each plug-in instance, a list of opened files
-    typedef std::map<void const *, std::list<FFmpegFile*> > FilesMap;
+public:
+    // identifies the contents of a file: decoders opened on a file which was since rewritten are not reused
+    struct FileStamp
+    {
+        long long size;
+        long long mtimeSec;
+        long long mtimeNSec;
+
+        FileStamp()
+            : size(-1)
+            , mtimeSec(-1)
+            , mtimeNSec(-1)
+        {
+        }
+
+        bool operator==(const FileStamp& other) const
+        {
+            return size == other.size && mtimeSec == other.mtimeSec && mtimeNSec == other.mtimeNSec;
+        }
+    };
+
+private:
+    struct Decoder
+    {
+        FFmpegFile* file;
+        FileStamp stamp;   // the stamp of the file when the decoder was opened
+        int users;         // number of FileRef currently holding this decoder
+        int lastFrame;     // last frame requested from this decoder, INT_MIN if none
+        uint64_t lastUse;  // value of _useCounter when this decoder was last acquired
+
+        Decoder()
+            : file(nullptr)
+            , stamp()
+            , users(0)
+            , lastFrame(INT_MIN)
+            , lastUse(0)
+        {
+        }
+    };
+
+    ///For each file, the list of opened decoders
+    typedef std::map<std::string, std::list<Decoder> > FilesMap;
     mutable FilesMap _files;
+    mutable uint64_t _useCounter;
     mutable FFmpegFile::Mutex* _lock;
 
 public:
 
+    // Holds a decoder from the pool: the decoder is not closed while it is held.
+    class FileRef
+    {
+public:
+        // Get a decoder for the given file (frame is the frame that will be decoded, or INT_MIN if unknown).
+        // hwDevice is the hardware device the decoder should use, see the FFmpegFile constructor.
+        FileRef(const FFmpegFileManager& manager,
+                const std::string& filename,
+                const std::string& hwDevice,
+                int frame = INT_MIN)
+            : _manager(manager)
+            , _file( manager.acquire(filename, hwDevice, frame) )
+        {
+        }
+
+        ~FileRef()
+        {
+            if (_file) {
+                _manager.release(_file);
+            }
+        }
+
+        FFmpegFile* get() const
+        {
+            return _file;
+        }
+
+        FFmpegFile* operator->() const
+        {
+            return _file;
+        }
+
+private:
+        FileRef(const FileRef&);
+        FileRef& operator=(const FileRef&);
+
+        const FFmpegFileManager& _manager;
+        FFmpegFile* _file;
+    };
+
     FFmpegFileManager();
 
     ~FFmpegFileManager();
 
     void init();
 
-    void clear(void const * plugin);
+    // close all the decoders that are not currently held
+    void clear();
+
+private:
+
+    FFmpegFile* acquire(const std::string &filename, const std::string &hwDevice, int frame) const;
+    void release(FFmpegFile* file) const;
 
-    FFmpegFile* get(void const * plugin, const std::string &filename) const;
-    FFmpegFile* getOrCreate(void const * plugin, const std::string &filename) const;
+    // close the least recently used decoders that are not held, until the pool fits its limits. _lock must be held.
+    void evict() const;
 };
 
 
@@ -26,8 +26,8 @@ extern "C" {
 namespace OFX {
 namespace FFmpeg {
 
-bool
-pixelFormatIsYUV(AVPixelFormat pix_fmt)
+static bool
+computePixelFormatIsYUV(AVPixelFormat pix_fmt)
 {
     // from swscale_internal.h
     const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(pix_fmt);
@@ -35,21 +35,21 @@ pixelFormatIsYUV(AVPixelFormat pix_fmt)
     return desc && !(desc->flags & AV_PIX_FMT_FLAG_RGB) && desc->nb_components >= 2;
 }
 
-bool
-pixelFormatAlpha(AVPixelFormat pix_fmt)
+static bool
+computePixelFormatAlpha(AVPixelFormat pix_fmt)
 {
     const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(pix_fmt);
 
     return desc && (desc->flags & AV_PIX_FMT_FLAG_ALPHA);
 }
 
-int
-pixelFormatBPP(const AVPixelFormat pixelFormat)
+static int
+computePixelFormatBPP(const AVPixelFormat pixelFormat)
 {
 #if 1
     const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(pixelFormat);
 
-    return av_get_bits_per_pixel(desc);
+    return desc ? av_get_bits_per_pixel(desc) : 0;
 #else
     switch (pixelFormat) {
         case AV_PIX_FMT_NONE:
@@ -555,14 +555,13 @@ pixelFormatBPP(const AVPixelFormat pixelFormat)
             break;
     } // switch
 #endif
-} // WriteFFmpegPlugin::pixelFormatBPP
+} // computePixelFormatBPP
 
 
 // av_get_bits_per_sample knows about surprisingly few codecs.
 // We have to do this manually.
-/*static*/
-int
-pixelFormatBitDepth(const AVPixelFormat pixelFormat)
+static int
+computePixelFormatBitDepth(const AVPixelFormat pixelFormat)
 {
     switch (pixelFormat) {
         case AV_PIX_FMT_NONE:
@@ -1100,12 +1099,12 @@ pixelFormatBitDepth(const AVPixelFormat pixelFormat)
             return 0;
     } // switch
     
-} // WriteFFmpegPlugin::pixelFormatBitDepth
+} // computePixelFormatBitDepth
 
 
 
-PixelCodingEnum
-pixelFormatCoding(const AVPixelFormat pixelFormat)
+static PixelCodingEnum
+computePixelFormatCoding(const AVPixelFormat pixelFormat)
 {
     switch (pixelFormat) {
         case AV_PIX_FMT_NONE:
@@ -1644,7 +1643,82 @@ pixelFormatCoding(const AVPixelFormat pixelFormat)
             return ePixelCodingNone;
     } // switch
     
-} // pixelFormatCoding
+} // computePixelFormatCoding
+
+static void
+computePixelFormatInfo(AVPixelFormat pixelFormat,
+                       PixelFormatInfo* info)
+{
+    info->isYUV = computePixelFormatIsYUV(pixelFormat);
+    info->alpha = computePixelFormatAlpha(pixelFormat);
+    info->bitDepth = computePixelFormatBitDepth(pixelFormat);
+    info->bpp = computePixelFormatBPP(pixelFormat);
+    info->coding = computePixelFormatCoding(pixelFormat);
+}
+
+namespace {
+// The capabilities of all the pixel formats known at compile time.
+// WriteFFmpeg queries them for every format supported by the codec each time a param changes,
+// and the switches above are too slow for that.
+struct PixelFormatInfoTable
+{
+    PixelFormatInfoTable()
+    {
+        for (int i = 0; i < AV_PIX_FMT_NB; ++i) {
+            computePixelFormatInfo( (AVPixelFormat)i, &info[i] );
+        }
+    }
+
+    PixelFormatInfo info[AV_PIX_FMT_NB];
+};
+}
+
+PixelFormatInfo
+pixelFormatInfo(AVPixelFormat pixelFormat)
+{
+    static const PixelFormatInfoTable table; // initialization is thread-safe in C++11
+
+    if ( (0 <= pixelFormat) && (pixelFormat < AV_PIX_FMT_NB) ) {
+        return table.info[pixelFormat];
+    }
+    // AV_PIX_FMT_NONE, or a format added in a more recent libavutil
+    PixelFormatInfo info = { false, false, 0, 0, ePixelCodingNone };
+    if (pixelFormat != AV_PIX_FMT_NONE) {
+        computePixelFormatInfo(pixelFormat, &info);
+    }
+
+    return info;
+}
+
+bool
+pixelFormatIsYUV(AVPixelFormat pixelFormat)
+{
+    return pixelFormatInfo(pixelFormat).isYUV;
+}
+
+bool
+pixelFormatAlpha(AVPixelFormat pixelFormat)
+{
+    return pixelFormatInfo(pixelFormat).alpha;
+}
+
+int
+pixelFormatBPP(AVPixelFormat pixelFormat)
+{
+    return pixelFormatInfo(pixelFormat).bpp;
+}
+
+int
+pixelFormatBitDepth(AVPixelFormat pixelFormat)
+{
+    return pixelFormatInfo(pixelFormat).bitDepth;
+}
+
+PixelCodingEnum
+pixelFormatCoding(AVPixelFormat pixelFormat)
+{
+    return pixelFormatInfo(pixelFormat).coding;
+}
 
 int
 pixelFormatBPPFromSpec(PixelCodingEnum coding, int bitdepth, bool alpha)
@@ -44,6 +44,19 @@ enum PixelCodingEnum
     ePixelCodingXYZ, // XYZ
 };
 
+// the capabilities of a pixel format, as returned by the functions below
+struct PixelFormatInfo
+{
+    bool isYUV;
+    bool alpha;
+    int bitDepth;
+    int bpp;
+    PixelCodingEnum coding;
+};
+
+// O(1) lookup in a table, which is built on first use
+PixelFormatInfo pixelFormatInfo(AVPixelFormat pixelFormat);
+
 bool pixelFormatIsYUV(AVPixelFormat pixelFormat);
 int pixelFormatBitDepth(AVPixelFormat pixelFormat);
 int pixelFormatBPP(AVPixelFormat pixelFormat);
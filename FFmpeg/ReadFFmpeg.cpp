@@ -93,6 +93,29 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
 #define kParamFirstTrackOnly "firstTrackOnly"
 #define kParamFirstTrackOnlyLabelAndHint "First Track Only", "Causes the reader to ignore all but the first video track it finds in the file. This should be selected in a multiview project if the file happens to contain multiple video tracks that don't correspond to different views."
 
+#define kParamHardwareDecode "hardwareDecode"
+#define kParamHardwareDecodeLabel "Hardware Decoding"
+#define kParamHardwareDecodeHint "Decode the video on the GPU, using an FFmpeg hardware device, and download the decoded frames. " \
+    "Reading falls back to software decoding if the device is not available or cannot decode the video stream."
+#define kParamHardwareDecodeOptionNone "None", "Decode in software.", "none"
+#define kParamHardwareDecodeOptionAuto "Auto", "Use the first hardware device available for this codec.", "auto"
+#define kParamHardwareDecodeOptionVAAPI "VAAPI", "Video Acceleration API (Linux).", "vaapi"
+#define kParamHardwareDecodeOptionCUDA "NVDEC", "NVIDIA video decoder, through CUDA.", "cuda"
+#define kParamHardwareDecodeOptionVideoToolbox "VideoToolbox", "Apple VideoToolbox (macOS).", "videotoolbox"
+#define kParamHardwareDecodeOptionD3D11VA "D3D11VA", "Direct3D 11 Video Acceleration (Windows).", "d3d11va"
+#define kParamHardwareDecodeOptionDXVA2 "DXVA2", "DirectX Video Acceleration 2 (Windows).", "dxva2"
+
+enum HardwareDecodeEnum
+{
+    eHardwareDecodeNone = 0,
+    eHardwareDecodeAuto,
+    eHardwareDecodeVAAPI,
+    eHardwareDecodeCUDA,
+    eHardwareDecodeVideoToolbox,
+    eHardwareDecodeD3D11VA,
+    eHardwareDecodeDXVA2,
+};
+
 #define kParamLibraryInfo "libraryInfo"
 #define kParamLibraryInfoLabel "FFmpeg Info...", "Display information about the underlying library."
 
@@ -109,6 +132,7 @@ class ReadFFmpegPlugin
 {
     FFmpegFileManager& _manager;
     BooleanParam *_firstTrackOnly;
+    ChoiceParam *_hardwareDecode;
 
 public:
 
@@ -120,6 +144,9 @@ public:
 
     bool loadNearestFrame() const;
 
+    // name of the FFmpeg hardware device type selected by the user, empty for software decoding
+    string getHardwareDevice() const;
+
     /**
      * @brief Restore any state from the parameters set
      * Called from createInstance() and changedParam() (via changedFilename()), must restore the
@@ -133,6 +160,8 @@ private:
 
     virtual bool isVideoStream(const string& filename) OVERRIDE FINAL;
 
+    virtual void clearAnyCache() OVERRIDE FINAL;
+
     /**
      * @brief Called when the input image/video file changed.
      *
@@ -165,9 +194,11 @@ ReadFFmpegPlugin::ReadFFmpegPlugin(FFmpegFileManager& manager,
     : GenericReaderPlugin(handle, extensions, kSupportsRGBA, kSupportsRGB, kSupportsXY, kSupportsAlpha, kSupportsTiles, false)
     , _manager(manager)
     , _firstTrackOnly(NULL)
+    , _hardwareDecode(NULL)
 {
     _firstTrackOnly = fetchBooleanParam(kParamFirstTrackOnly);
-    assert(_firstTrackOnly);
+    _hardwareDecode = fetchChoiceParam(kParamHardwareDecode);
+    assert(_firstTrackOnly && _hardwareDecode);
     int originalFrameRangeMin, originalFrameRangeMax;
     _originalFrameRange->getValue(originalFrameRangeMin, originalFrameRangeMax);
     if (originalFrameRangeMin == 0) {
@@ -194,7 +225,13 @@ void
 ReadFFmpegPlugin::restoreStateFromParams()
 {
     GenericReaderPlugin::restoreStateFromParams();
-    //_manager.getOrCreate(this, filename);
+}
+
+void
+ReadFFmpegPlugin::clearAnyCache()
+{
+    // close the decoders which are not used by any instance
+    _manager.clear();
 }
 
 bool
@@ -207,6 +244,31 @@ ReadFFmpegPlugin::loadNearestFrame() const
     return v == 0;
 }
 
+string
+ReadFFmpegPlugin::getHardwareDevice() const
+{
+    HardwareDecodeEnum hardwareDecode = (HardwareDecodeEnum)_hardwareDecode->getValue();
+
+    switch (hardwareDecode) {
+    case eHardwareDecodeNone:
+        return string();
+    case eHardwareDecodeAuto:
+        return "auto";
+    case eHardwareDecodeVAAPI:
+        return "vaapi";
+    case eHardwareDecodeCUDA:
+        return "cuda";
+    case eHardwareDecodeVideoToolbox:
+        return "videotoolbox";
+    case eHardwareDecodeD3D11VA:
+        return "d3d11va";
+    case eHardwareDecodeDXVA2:
+        return "dxva2";
+    }
+
+    return string();
+}
+
 
 static string
 ffmpeg_versions()
@@ -239,7 +301,31 @@ ReadFFmpegPlugin::changedParam(const InstanceChangedArgs &args,
                                const string &paramName)
 {
     if (paramName == kParamLibraryInfo) {
-        sendMessage(Message::eMessageMessage, "", ffmpeg_versions());
+        string msg = ffmpeg_versions();
+        string filename;
+        OfxStatus st = getFilenameAtTime(args.time, &filename);
+        if ( (st == kOfxStatOK) && !filename.empty() ) {
+            FFmpegFileManager::FileRef file(_manager, filename, getHardwareDevice());
+            if ( file.get() && !file->isInvalid() ) {
+                // the first stream, and only the frames decoded by this decoder of the pool
+                int64_t hwFrames, swFrames;
+                file->getDecodedFramesCount(0, &hwFrames, &swFrames);
+                std::ostringstream oss;
+                oss << std::endl;
+                if ( file->isHardwareDecoding(0) ) {
+                    oss << "Hardware decoding: " << file->getHardwareDevice() << std::endl;
+                } else {
+                    oss << "Hardware decoding: none" << std::endl;
+                }
+                oss << "Frames decoded by the hardware device: " << hwFrames << ", in software: " << swFrames << std::endl;
+                msg += oss.str();
+            }
+        }
+        sendMessage(Message::eMessageMessage, "", msg);
+    } else if (paramName == kParamFirstTrackOnly) {
+        // this changes the frame bounds
+        clearHeaderCache();
+        GenericReaderPlugin::changedParam(args, paramName);
     } else {
         GenericReaderPlugin::changedParam(args, paramName);
     }
@@ -272,15 +358,10 @@ ReadFFmpegPlugin::guessParamsFromFilename(const string& filename,
                                           int *componentCount)
 {
     assert(colorspace && filePremult && components && componentCount);
-    FFmpegFile* file = _manager.get(this, filename);
-    if (!file) {
-        //Clear all opened files by this plug-in since the user changed the selected file/sequence
-        _manager.clear(this);
-        file = _manager.getOrCreate(this, filename);
-    }
+    FFmpegFileManager::FileRef file(_manager, filename, getHardwareDevice());
 
-    if ( !file || file->isInvalid() ) {
-        if (file) {
+    if ( !file.get() || file->isInvalid() ) {
+        if ( file.get() ) {
             //setPersistentMessage(Message::eMessageError, "", file->getError());
         } else {
             //setPersistentMessage(Message::eMessageError, "", "Cannot open file.");
@@ -333,7 +414,7 @@ void
 ReadFFmpegPlugin::decode(const string& filename,
                          OfxTime time,
                          int view,
-                         bool /*isPlayback*/,
+                         bool isPlayback,
                          const OfxRectI& renderWindow,
                          const OfxPointD& renderScale,
                          float *pixelData,
@@ -342,9 +423,9 @@ ReadFFmpegPlugin::decode(const string& filename,
                          int pixelComponentCount,
                          int rowBytes)
 {
-    FFmpegFile* file = _manager.getOrCreate(this, filename);
+    FFmpegFileManager::FileRef file(_manager, filename, getHardwareDevice(), (int)time);
 
-    if ( file && file->isInvalid() ) {
+    if ( file.get() && file->isInvalid() ) {
         setPersistentMessage( Message::eMessageError, "", file->getError() );
 
         return;
@@ -362,7 +443,7 @@ ReadFFmpegPlugin::decode(const string& filename,
     assert( (pixelComponents == ePixelComponentRGB && pixelComponentCount == 3) || (pixelComponents == ePixelComponentRGBA && pixelComponentCount == 4) || (pixelComponents == ePixelComponentAlpha && pixelComponentCount == 1) );
 
     ///blindly ignore the filename, we suppose that the file is the same than the file loaded in the changedParam
-    if (!file) {
+    if ( !file.get() ) {
         setPersistentMessage(Message::eMessageError, "", filename +  ": Missing frame");
         throwSuiteStatusException(kOfxStatFailed);
 
@@ -373,11 +454,10 @@ ReadFFmpegPlugin::decode(const string& filename,
     if (firstTrackOnly) {
         view = 0;
     }
-    file->setSelectedStream(view);
-
+    // the file may be shared with instances reading other views: the stream is passed to each call
     int width, height, frames;
     double ap;
-    file->getInfo(width, height, ap, frames);
+    file->getInfo(width, height, ap, frames, view);
 
     // wrong assert:
     // http://openfx.sourceforge.net/Documentation/1.3/ofxProgrammingReference.html#kOfxImageEffectPropSupportsTiles
@@ -404,9 +484,12 @@ ReadFFmpegPlugin::decode(const string& filename,
     int srcRowBytes = width * numComponents * sizeOfData;
     std::size_t bufferSize =  height * srcRowBytes;
 
-    RamBuffer bufferRaii(bufferSize);
+    // outside of playback (where the read-ahead frames are used), convert 4:4:4 YUV frames straight to the float output image
+    bool directFloat = !isPlayback && renderScale.x == 1. && renderScale.y == 1. && file->canDecodeFloat(view);
+
+    RamBuffer bufferRaii(directFloat ? 0 : bufferSize);
     unsigned char* buffer = bufferRaii.getData();
-    if (!buffer) {
+    if (!directFloat && !buffer) {
         throwSuiteStatusException(kOfxStatErrMemory);
 
         return;
@@ -414,7 +497,20 @@ ReadFFmpegPlugin::decode(const string& filename,
     // this is the first stream (in fact the only one we consider for now), allocate the output buffer according to the bitdepth
 
     try {
-        if ( !file->decode(this, (int)time, loadNearestFrame(), buffer) ) {
+        bool decoded;
+        if (directFloat) {
+            FFmpegFile::FloatTarget target;
+            target.effect = this;
+            target.pixelData = pixelData;
+            target.bounds = imgBounds;
+            target.renderWindow = renderWindow;
+            target.nComps = pixelComponentCount;
+            target.rowBytes = rowBytes;
+            decoded = file->decodeFloat( view, (int)time, loadNearestFrame(), target );
+        } else {
+            decoded = file->decode( this, view, (int)time, loadNearestFrame(), isPlayback, buffer );
+        }
+        if (!decoded) {
             if ( abort() ) {
                 // decode() probably existed because plugin was aborted
                 return;
@@ -437,7 +533,9 @@ ReadFFmpegPlugin::decode(const string& filename,
         return;
     }
 
-
+    if (directFloat) {
+        return;
+    }
     convertDepthAndComponents(buffer, renderWindow, renderScale, imgBounds, numComponents == 3 ? ePixelComponentRGB : ePixelComponentRGBA, sizeOfData == sizeof(unsigned char) ? eBitDepthUByte : eBitDepthUShort, srcRowBytes, pixelData, imgBounds, pixelComponents, rowBytes);
 } // ReadFFmpegPlugin::decode
 
@@ -453,8 +551,8 @@ ReadFFmpegPlugin::getSequenceTimeDomain(const string& filename,
 
     int width, height, frames;
     double ap;
-    FFmpegFile* file = _manager.getOrCreate(this, filename);
-    if ( !file || file->isInvalid() ) {
+    FFmpegFileManager::FileRef file(_manager, filename, getHardwareDevice());
+    if ( !file.get() || file->isInvalid() ) {
         range.min = range.max = 0.;
 
         return false;
@@ -473,8 +571,8 @@ ReadFFmpegPlugin::getFrameRate(const string& filename,
 {
     assert(fps);
 
-    FFmpegFile* file = _manager.getOrCreate(this, filename);
-    if ( !file || file->isInvalid() ) {
+    FFmpegFileManager::FileRef file(_manager, filename, getHardwareDevice());
+    if ( !file.get() || file->isInvalid() ) {
         return false;
     }
 
@@ -495,9 +593,9 @@ ReadFFmpegPlugin::getFrameBounds(const string& filename,
                                  int* tile_height)
 {
     assert(bounds && par);
-    FFmpegFile* file = _manager.getOrCreate(this, filename);
-    if ( !file || file->isInvalid() ) {
-        if (error && file) {
+    FFmpegFileManager::FileRef file(_manager, filename, getHardwareDevice());
+    if ( !file.get() || file->isInvalid() ) {
+        if ( error && file.get() ) {
             *error = file->getError();
         }
 
@@ -508,10 +606,9 @@ ReadFFmpegPlugin::getFrameBounds(const string& filename,
     if (firstTrackOnly) {
         view = 0;
     }
-    file->setSelectedStream(view);
     int width, height, frames;
     double ap;
-    if ( !file->getInfo(width, height, ap, frames) ) {
+    if ( !file->getInfo(width, height, ap, frames, view) ) {
         width = 0;
         height = 0;
         ap = 1.;
@@ -962,6 +1059,30 @@ ReadFFmpegPluginFactory::describeInContext(ImageEffectDescriptor &desc,
             page->addChild(*param);
         }
     }
+    {
+        ChoiceParamDescriptor *param = desc.defineChoiceParam(kParamHardwareDecode);
+        param->setLabelAndHint(kParamHardwareDecodeLabel, kParamHardwareDecodeHint);
+        assert(param->getNOptions() == eHardwareDecodeNone);
+        param->appendOption(kParamHardwareDecodeOptionNone);
+        assert(param->getNOptions() == eHardwareDecodeAuto);
+        param->appendOption(kParamHardwareDecodeOptionAuto);
+        assert(param->getNOptions() == eHardwareDecodeVAAPI);
+        param->appendOption(kParamHardwareDecodeOptionVAAPI);
+        assert(param->getNOptions() == eHardwareDecodeCUDA);
+        param->appendOption(kParamHardwareDecodeOptionCUDA);
+        assert(param->getNOptions() == eHardwareDecodeVideoToolbox);
+        param->appendOption(kParamHardwareDecodeOptionVideoToolbox);
+        assert(param->getNOptions() == eHardwareDecodeD3D11VA);
+        param->appendOption(kParamHardwareDecodeOptionD3D11VA);
+        assert(param->getNOptions() == eHardwareDecodeDXVA2);
+        param->appendOption(kParamHardwareDecodeOptionDXVA2);
+        param->setDefault(eHardwareDecodeNone);
+        param->setAnimates(false);
+        desc.addClipPreferencesSlaveParam(*param);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
     {
         PushButtonParamDescriptor* param = desc.definePushButtonParam(kParamLibraryInfo);
         param->setLabelAndHint(kParamLibraryInfoLabel);
@@ -43,6 +43,7 @@
 #include <sstream>
 #include <algorithm>
 #include <string>
+#include <list>
 #include <cctype> // ::tolower
 #ifdef DEBUG
 #include <cstdio>
@@ -68,6 +69,7 @@ extern "C" {
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/buffer.h>
 #include <libavformat/avio.h>
 #include <libavutil/opt.h>
 #include <libswscale/swscale.h>
@@ -95,8 +97,11 @@ extern "C" {
 #define OFX_FFMPEG_TIMECODE 0     // timecode support
 #define OFX_FFMPEG_AUDIO 0        // audio support
 #define OFX_FFMPEG_MBDECISION 0   // add the macroblock decision parameter
+#define OFX_FFMPEG_ENCODE_THREAD 1 // encode and mux the converted frames in a separate thread
+#define OFX_FFMPEG_ENCODE_QUEUE_SIZE 3 // maximum number of converted frames waiting for the encoder thread
+#define OFX_FFMPEG_TRACE_ALLOCATIONS 0 // print the number of frame allocations, which should not grow after the first frames
 
-#if OFX_FFMPEG_PRINT_CODECS
+#if OFX_FFMPEG_PRINT_CODECS || OFX_FFMPEG_TRACE_ALLOCATIONS
 #include <iostream>
 #endif
 
@@ -888,9 +893,195 @@ private:
     MyAVFrame& operator=(const MyAVFrame& /* rhs*/) { return *this; }
 };
 
+////////////////////////////////////////////////////////////////////////////////
+// MyAVFramePool
+// A pool of refcounted video frames which all have the same size and pixel
+// format. The frame buffers come from an AVBufferPool: a buffer goes back to
+// the pool when its last reference is released, which may be long after the
+// frame was released if the encoder keeps a reference on it (e.g. frames
+// waiting for B-frame decision or lookahead). New buffers are thus only
+// allocated while more frames are in flight than ever before, and are then
+// reused for the whole sequence. The AVFrame structures are also reused.
+// Frames may be released by another thread than the one that got them, but
+// must all be released before the pool is destroyed.
+//
+class MyAVFramePool
+{
+public:
+    MyAVFramePool(int width, int height, enum AVPixelFormat avPixelFormat, int align);
+
+    ~MyAVFramePool();
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // reserve
+    // Allocate frames and buffers until |count| of each are free in the pool.
+    //
+    // @return 0 if successful.
+    //         <0 otherwise.
+    //
+    int reserve(int count);
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // get
+    // Get a writable frame from the pool, allocating one if no frame is free.
+    //
+    // @return the frame, or an empty pointer if allocation failed.
+    //
+    std::shared_ptr<AVFrame> get();
+
+    // The number of frame buffers allocated by the pool since it was created.
+    int getAllocationsCount() const;
+
+    enum AVPixelFormat getPixelFormat() const { return _pixelFormat; }
+
+private:
+#if LIBAVUTIL_VERSION_MAJOR >= 57
+    typedef size_t BufferSize;
+#else
+    typedef int BufferSize;
+#endif
+    static AVBufferRef* allocBuffer(void* opaque, BufferSize size);
+    void release(AVFrame* avFrame);
+
+    const int _width;
+    const int _height;
+    const enum AVPixelFormat _pixelFormat;
+    const int _align;
+    AVBufferPool* _bufferPool; // thread-safe
+    mutable tthread::mutex _lock; // protects the following members
+    std::list<AVFrame*> _freeFrames;
+    int _allocationsCount;
+
+    // Hide the copy constructor and the assignment operator. Who would manage memory?
+    MyAVFramePool(const MyAVFramePool&);
+    MyAVFramePool& operator=(const MyAVFramePool&);
+};
+
+MyAVFramePool::MyAVFramePool(int width,
+                             int height,
+                             enum AVPixelFormat avPixelFormat,
+                             int align)
+    : _width(width)
+    , _height(height)
+    , _pixelFormat(avPixelFormat)
+    , _align(align)
+    , _bufferPool(nullptr)
+    , _lock()
+    , _freeFrames()
+    , _allocationsCount(0)
+{
+    int size = av_image_get_buffer_size(avPixelFormat, width, height, align);
+
+    if (size >= 0) {
+        // same padding as av_frame_get_buffer(), some encoders read past the end of the image
+        _bufferPool = av_buffer_pool_init2(size + AV_INPUT_BUFFER_PADDING_SIZE, this, allocBuffer, nullptr);
+    }
+}
+
+MyAVFramePool::~MyAVFramePool()
+{
+    for (std::list<AVFrame*>::iterator it = _freeFrames.begin(); it != _freeFrames.end(); ++it) {
+        av_frame_free(&*it);
+    }
+    // the pool is actually freed when the encoder releases its last buffer
+    av_buffer_pool_uninit(&_bufferPool);
+}
+
+AVBufferRef*
+MyAVFramePool::allocBuffer(void* opaque,
+                           BufferSize size)
+{
+    MyAVFramePool* pool = static_cast<MyAVFramePool*>(opaque);
+    AVBufferRef* buffer = av_buffer_alloc(size);
+
+    if (buffer) {
+        tthread::lock_guard<tthread::mutex> guard(pool->_lock);
+        ++pool->_allocationsCount;
+    }
+
+    return buffer;
+}
+
+int
+MyAVFramePool::reserve(int count)
+{
+    // getting count frames at once allocates the missing frames and buffers, which go back to the pool when released
+    std::list<std::shared_ptr<AVFrame> > frames;
+
+    for (int i = 0; i < count; ++i) {
+        std::shared_ptr<AVFrame> avFrame = get();
+        if (!avFrame) {
+            return -1;
+        }
+        frames.push_back(avFrame);
+    }
+
+    return 0;
+}
+
+std::shared_ptr<AVFrame>
+MyAVFramePool::get()
+{
+    if (!_bufferPool) {
+        return std::shared_ptr<AVFrame>();
+    }
+    AVFrame* avFrame = nullptr;
+    {
+        tthread::lock_guard<tthread::mutex> guard(_lock);
+        if ( !_freeFrames.empty() ) {
+            avFrame = _freeFrames.front();
+            _freeFrames.pop_front();
+        }
+    }
+    if (!avFrame) {
+        avFrame = av_frame_alloc();
+        if (!avFrame) {
+            return std::shared_ptr<AVFrame>();
+        }
+    }
+    // a buffer which is not referenced by the encoder anymore, so the frame is writable
+    avFrame->buf[0] = av_buffer_pool_get(_bufferPool);
+    if ( !avFrame->buf[0] ||
+         (av_image_fill_arrays(avFrame->data, avFrame->linesize, avFrame->buf[0]->data, _pixelFormat, _width, _height, _align) < 0) ) {
+        av_frame_free(&avFrame);
+
+        return std::shared_ptr<AVFrame>();
+    }
+    // Set the frame fields for a video buffer as some
+    // encoders rely on them, e.g. Lossless JPEG.
+    avFrame->width = _width;
+    avFrame->height = _height;
+    avFrame->format = (int)_pixelFormat;
+
+    return std::shared_ptr<AVFrame>(avFrame, [this](AVFrame* frame) { release(frame); });
+}
+
+int
+MyAVFramePool::getAllocationsCount() const
+{
+    tthread::lock_guard<tthread::mutex> guard(_lock);
+
+    return _allocationsCount;
+}
+
+void
+MyAVFramePool::release(AVFrame* avFrame)
+{
+    // drop this reference on the buffer and the frame properties: the buffer goes back to the pool when the encoder releases it too
+    av_frame_unref(avFrame);
+
+    tthread::lock_guard<tthread::mutex> guard(_lock);
+    _freeFrames.push_back(avFrame);
+}
+
 typedef struct MyAVStream {
   AVStream* stream;
   AVCodecContext* codecContext;
+  // The following are only used by video streams, and are created by openCodec()
+  // from the negotiated codec parameters, to be reused by every frame.
+  MyAVFramePool* rgbFramePool; // frames converted from the float image
+  MyAVFramePool* codecFramePool; // frames in the pixel format of the encoder
+  AVPacket* packet;
 } MyAVStream;
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1077,6 +1268,7 @@ private:
     void updateVisibility();
     void checkCodec();
     void freeFormat();
+    void failEncode();
     void getColorInfo(AVColorPrimaries *color_primaries, AVColorTransferCharacteristic *color_trc) const;
     AVOutputFormat*               initFormat(bool reportErrors) const;
     bool                          initCodec(AVOutputFormat* fmt, AVCodecID& outCodecId, AVCodec*& outCodec) const;
@@ -1102,10 +1294,23 @@ private:
     void addStream(AVFormatContext* avFormatContext, enum AVCodecID avCodecId, AVCodec** pavCodec, MyAVStream* myStreamOut);
     int openCodec(AVFormatContext* avFormatContext, AVCodec* avCodec, MyAVStream* myAVStream);
     int writeAudio(AVFormatContext* avFormatContext, AVStream* avStream, bool flush);
-    int writeVideo(AVFormatContext* avFormatContext, MyAVStream* myAVStream, bool flush, double time, const float *pixelData = nullptr, const OfxRectI* bounds = nullptr, int pixelDataNComps = 0, int dstNComps = 0, int rowBytes = 0);
+    static AVPixelFormat getRGBBufferPixelFormat(const AVCodecContext* avCodecContext, bool hasAlpha);
+    int convertVideo(MyAVStream* myAVStream, const float *pixelData, const OfxRectI* bounds, int pixelDataNComps, int dstNComps, int rowBytes, std::shared_ptr<AVFrame>* avFrameOut);
+    int writeVideo(AVFormatContext* avFormatContext, MyAVStream* myAVStream, bool flush, AVFrame* avFrame);
     int encodeVideo(AVCodecContext* avCodecContext, const AVFrame* avFrame, AVPacket* avPacketOut);
 
-    int writeToFile(AVFormatContext* avFormatContext, bool finalise, double time, const float *pixelData = nullptr, const OfxRectI* bounds = nullptr, int pixelDataNComps = 0, int dstNComps = 0, int rowBytes = 0);
+    int writeToFile(AVFormatContext* avFormatContext, bool finalise, AVFrame* avFrame = nullptr);
+
+#if OFX_FFMPEG_ENCODE_THREAD
+    // The encoder thread encodes and muxes the frames converted by encode(), in order.
+    void startEncodeThread();
+    // wait until all queued frames are written, and stop the encoder thread
+    void stopEncodeThread();
+    // queue a converted frame, waiting if the queue is full. Return the encoder thread error, if any.
+    int queueFrame(const std::shared_ptr<AVFrame>& avFrame);
+    void encodeLoop();
+    static void encodeThreadFunction(void* userData);
+#endif
 
     int colourSpaceConvert(AVFrame* avFrameIn, AVFrame* avFrameOut, AVPixelFormat srcPixelFormat, AVPixelFormat dstPixelFormat, AVCodecContext* avCodecContext);
 
@@ -1182,9 +1387,16 @@ private:
     uint8_t* _scratchBuffer;
     std::size_t _scratchBufferSize;
 #endif
-    //we use shared_ptr here as both frames can point to the same AVFrame (ProRes, DNxHD case)
-    std::shared_ptr<AVFrame> inputFrame_;
-    std::shared_ptr<AVFrame> outputFrame_;
+    // error message of the last failed writeVideo(), only accessed by the thread that encodes
+    string _encodeErrorMessage;
+#if OFX_FFMPEG_ENCODE_THREAD
+    tthread::thread* _encodeThread;
+    tthread::mutex _encodeQueueMutex; // protects the following members
+    tthread::condition_variable _encodeQueueCond;
+    std::list<std::shared_ptr<AVFrame> > _encodeQueue; // the front frame is being encoded
+    bool _encodeQueueFinish; // no more frames will be queued
+    int _encodeQueueError; // error returned by writeToFile() in the encoder thread, 0 if none
+#endif
 };
 
 
@@ -1411,8 +1623,8 @@ WriteFFmpegPlugin::WriteFFmpegPlugin(OfxImageEffectHandle handle,
     , _error(IGNORE_FINISH)
     , _formatContext(nullptr)
     , _convertCtx(nullptr)
-    , _streamVideo({nullptr,nullptr})
-    , _streamAudio({nullptr,nullptr})
+    , _streamVideo({nullptr, nullptr, nullptr, nullptr, nullptr})
+    , _streamAudio({nullptr, nullptr, nullptr, nullptr, nullptr})
     , _streamTimecode(nullptr)
     , _nextFrameToEncodeMutex()
     , _nextFrameToEncodeCond()
@@ -1451,6 +1663,15 @@ WriteFFmpegPlugin::WriteFFmpegPlugin(OfxImageEffectHandle handle,
 #if OFX_FFMPEG_SCRATCHBUFFER
     , _scratchBuffer(nullptr)
     , _scratchBufferSize(0)
+#endif
+    , _encodeErrorMessage()
+#if OFX_FFMPEG_ENCODE_THREAD
+    , _encodeThread(nullptr)
+    , _encodeQueueMutex()
+    , _encodeQueueCond()
+    , _encodeQueue()
+    , _encodeQueueFinish(false)
+    , _encodeQueueError(0)
 #endif
 {
     _rodPixel.x1 = _rodPixel.y1 = 0;
@@ -1494,6 +1715,9 @@ WriteFFmpegPlugin::WriteFFmpegPlugin(OfxImageEffectHandle handle,
 
 WriteFFmpegPlugin::~WriteFFmpegPlugin()
 {
+#if OFX_FFMPEG_ENCODE_THREAD
+    stopEncodeThread();
+#endif
 #if OFX_FFMPEG_SCRATCHBUFFER
     delete [] _scratchBuffer;
     _scratchBufferSize = 0;
@@ -1746,6 +1970,68 @@ WriteFFmpegPlugin::initCodec(AVOutputFormat* fmt,
     return true;
 }
 
+// the target pixel format selected from the codec pixel formats, for given preferences
+struct TargetPixelFormatKey
+{
+    const AVCodec* codec;
+    FFmpeg::PixelCodingEnum coding;
+    int bitDepth;
+    bool alpha;
+
+    bool operator<(const TargetPixelFormatKey& other) const
+    {
+        if (codec != other.codec) {
+            return codec < other.codec;
+        }
+        if (coding != other.coding) {
+            return coding < other.coding;
+        }
+        if (bitDepth != other.bitDepth) {
+            return bitDepth < other.bitDepth;
+        }
+
+        return alpha < other.alpha;
+    }
+};
+
+typedef map<TargetPixelFormatKey, AVPixelFormat> TargetPixelFormatCache;
+
+// codecs are static in libavcodec, so the cache is shared by all instances
+static TargetPixelFormatCache gTargetPixelFormatCache;
+static Mutex gTargetPixelFormatCacheMutex;
+
+static bool
+getCachedTargetPixelFormat(const AVCodec* videoCodec,
+                           FFmpeg::PixelCodingEnum prefPixelCoding,
+                           int prefBitDepth,
+                           bool prefAlpha,
+                           AVPixelFormat* targetPixelFormat)
+{
+    const TargetPixelFormatKey key = { videoCodec, prefPixelCoding, prefBitDepth, prefAlpha };
+    AutoMutex lock(gTargetPixelFormatCacheMutex);
+    TargetPixelFormatCache::const_iterator it = gTargetPixelFormatCache.find(key);
+
+    if ( it == gTargetPixelFormatCache.end() ) {
+        return false;
+    }
+    *targetPixelFormat = it->second;
+
+    return true;
+}
+
+static void
+setCachedTargetPixelFormat(const AVCodec* videoCodec,
+                           FFmpeg::PixelCodingEnum prefPixelCoding,
+                           int prefBitDepth,
+                           bool prefAlpha,
+                           AVPixelFormat targetPixelFormat)
+{
+    const TargetPixelFormatKey key = { videoCodec, prefPixelCoding, prefBitDepth, prefAlpha };
+    AutoMutex lock(gTargetPixelFormatCacheMutex);
+
+    gTargetPixelFormatCache[key] = targetPixelFormat;
+}
+
 void
 WriteFFmpegPlugin::getPixelFormats(AVCodec* videoCodec,
                                    FFmpeg::PixelCodingEnum prefPixelCoding,
@@ -1796,6 +2082,8 @@ WriteFFmpegPlugin::getPixelFormats(AVCodec* videoCodec,
         } else {
             outTargetPixelFormat = AV_PIX_FMT_YUV422P;
         }
+    } else if ( (videoCodec->pix_fmts != nullptr) && getCachedTargetPixelFormat(videoCodec, prefPixelCoding, prefBitDepth, prefAlpha, &outTargetPixelFormat) ) {
+        // the format was already selected for these preferences
     } else if (videoCodec->pix_fmts != nullptr) {
         //This is the most frequent path, where we can guess best pix format using ffmpeg.
         //find highest bit depth pix fmt.
@@ -1821,10 +2109,11 @@ WriteFFmpegPlugin::getPixelFormats(AVCodec* videoCodec,
         AVPixelFormat highestBPPFormat = AV_PIX_FMT_NONE;
 
         while (*currPixFormat != -1) {
-            FFmpeg::PixelCodingEnum currCoding = FFmpeg::pixelFormatCoding(*currPixFormat);
-            int currBitDepth = FFmpeg::pixelFormatBitDepth(*currPixFormat);
-            int currBPP = FFmpeg::pixelFormatBPP(*currPixFormat);
-            bool currAlpha = FFmpeg::pixelFormatAlpha(*currPixFormat);
+            const FFmpeg::PixelFormatInfo currInfo = FFmpeg::pixelFormatInfo(*currPixFormat);
+            FFmpeg::PixelCodingEnum currCoding = currInfo.coding;
+            int currBitDepth = currInfo.bitDepth;
+            int currBPP = currInfo.bpp;
+            bool currAlpha = currInfo.alpha;
 
             // First, try to find the format with the smallest BPP that fits into the preferences
             if ((int)currCoding >= (int)prefPixelCoding &&
@@ -1966,6 +2255,8 @@ WriteFFmpegPlugin::getPixelFormats(AVCodec* videoCodec,
             }
         }
 
+        setCachedTargetPixelFormat(videoCodec, prefPixelCoding, prefBitDepth, prefAlpha, outTargetPixelFormat);
+
         //Unlike the other cases, we're now done figuring out all aspects, so return.
         //return; // don't return, avcodec_find_best_pix_fmt_of_list may have returned a lower bitdepth than infoBitDepth
     } else {
@@ -3158,6 +3449,23 @@ WriteFFmpegPlugin::openCodec(AVFormatContext* avFormatContext,
 
             return -4;
         }
+
+        // Preallocate the frames and the packet used to encode every frame,
+        // now that the encoder parameters are known.
+        assert(!myAVStream->rgbFramePool && !myAVStream->codecFramePool && !myAVStream->packet);
+        const int width = _rodPixel.x2 - _rodPixel.x1;
+        const int height = _rodPixel.y2 - _rodPixel.y1;
+        myAVStream->rgbFramePool = new MyAVFramePool(width, height, getRGBBufferPixelFormat( avCodecContext, alphaEnabled() ), 32);
+        myAVStream->codecFramePool = new MyAVFramePool(avCodecContext->width, avCodecContext->height, avCodecContext->pix_fmt, 32);
+        myAVStream->packet = av_packet_alloc();
+        // one frame being converted, and the frames waiting for the encoder thread
+        if ( (myAVStream->rgbFramePool->reserve(1) < 0) ||
+             (myAVStream->codecFramePool->reserve(1 + OFX_FFMPEG_ENCODE_QUEUE_SIZE) < 0) ||
+             !myAVStream->packet ) {
+            setPersistentMessage(Message::eMessageError, "", "Could not allocate video frames");
+
+            return -4;
+        }
     } else if (AVMEDIA_TYPE_DATA == avCodecContext->codec_type) {
         // Timecode codecs.
     }
@@ -3353,45 +3661,52 @@ WriteFFmpegPlugin::numberOfDestChannels() const
     return alphaEnabled() ? 4 : 3;
 }
 
+// The pixel format of the intermediate buffer converted from the float image,
+// which is then converted to the pixel format of the encoder.
+AVPixelFormat
+WriteFFmpegPlugin::getRGBBufferPixelFormat(const AVCodecContext* avCodecContext,
+                                           bool hasAlpha)
+{
+    if (hasAlpha) {
+        return (avCodecContext->bits_per_raw_sample > 8) ? AV_PIX_FMT_RGBA64 : AV_PIX_FMT_RGBA;
+    } else {
+        return (avCodecContext->bits_per_raw_sample > 8) ? AV_PIX_FMT_RGB48 : AV_PIX_FMT_RGB24;
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
-// writeVideo
+// convertVideo
 //
 // * Convert Nuke float RGB values to the ffmpeg pixel format of the encoder.
-// * Encode.
-// * Write to file.
 //
-// @param avFormatContext A reference to an AVFormatContext of the file.
-// @param avStream A reference to an AVStream of a video stream.
-// @param flush A boolean value to flag that any remaining frames in the internal
-//              queue of the encoder should be written to the file. No new
-//              frames will be queued for encoding.
+// @param myAVStream A reference to the video stream.
+// @param avFrameOut Receives a frame from the frame pool of the stream, in the
+//                   pixel format of the encoder, which can be encoded by
+//                   writeVideo() from any thread.
 //
 // @return 0 if successful,
-//         <0 otherwise for any failure to convert the pixel format, encode the
-//         video or write to the file.
+//         <0 otherwise for any failure to convert the pixel format.
 //
 int
-WriteFFmpegPlugin::writeVideo(AVFormatContext* avFormatContext,
-                              MyAVStream* myAVStream,
-                              bool flush,
-                              double /*time*/,
-                              const float *pixelData,
-                              const OfxRectI* bounds,
-                              int pixelDataNComps,
-                              int dstNComps,
-                              int rowBytes)
+WriteFFmpegPlugin::convertVideo(MyAVStream* myAVStream,
+                                const float *pixelData,
+                                const OfxRectI* bounds,
+                                int pixelDataNComps,
+                                int dstNComps,
+                                int rowBytes,
+                                std::shared_ptr<AVFrame>* avFrameOut)
 {
-    assert(dstNComps == 3 || dstNComps == 4 || dstNComps == 0);
+    assert(dstNComps == 3 || dstNComps == 4);
+    assert(avFrameOut);
+    avFrameOut->reset();
     // FIXME enum needed for error codes.
     if (!_isOpen) {
         return -5; //writer is not open!
     }
-    AVStream* avStream = myAVStream->stream;
-    if (!avStream) {
+    if (!myAVStream->stream || !myAVStream->rgbFramePool || !myAVStream->codecFramePool) {
         return -6;
     }
-    assert(avFormatContext);
-    if ( !avFormatContext || ( !flush && (!pixelData || !bounds) ) ) {
+    if (!pixelData || !bounds) {
         return -7;
     }
     int ret = 0;
@@ -3408,117 +3723,148 @@ WriteFFmpegPlugin::writeVideo(AVFormatContext* avFormatContext,
     int width = _rodPixel.x2 - _rodPixel.x1;
     int height = _rodPixel.y2 - _rodPixel.y1;
 
-    if (!flush) {
-        assert(pixelData && bounds);
-        assert(bounds->x1 == _rodPixel.x1 && bounds->x2 == _rodPixel.x2 &&
-               bounds->y1 == _rodPixel.y1 && bounds->y2 == _rodPixel.y2);
-
-        const bool hasAlpha = alphaEnabled();
-        AVPixelFormat pixelFormatNuke;
-        if (hasAlpha) {
-            pixelFormatNuke = (avCodecContext->bits_per_raw_sample > 8) ? AV_PIX_FMT_RGBA64 : AV_PIX_FMT_RGBA;
-        } else {
-            pixelFormatNuke = (avCodecContext->bits_per_raw_sample > 8) ? AV_PIX_FMT_RGB48 : AV_PIX_FMT_RGB24;
-        }
+    assert(bounds->x1 == _rodPixel.x1 && bounds->x2 == _rodPixel.x2 &&
+           bounds->y1 == _rodPixel.y1 && bounds->y2 == _rodPixel.y2);
 
-        inputFrame_.reset(av_frame_alloc(), [](AVFrame * frame) { av_freep(&frame->data[0]); av_frame_free(&frame); });
-        ret = av_image_alloc(inputFrame_->data, inputFrame_->linesize, width, height, pixelFormatNuke, 32);
+    // the pools were created by openCodec() with the format given by getRGBBufferPixelFormat()
+    AVPixelFormat pixelFormatNuke = myAVStream->rgbFramePool->getPixelFormat();
+    const bool hasAlpha = (pixelFormatNuke == AV_PIX_FMT_RGBA64 || pixelFormatNuke == AV_PIX_FMT_RGBA);
 
-        if (ret < 0) {
-          inputFrame_.reset();
-        }
-        if (inputFrame_) {
-            ret = 0;
-            // Convert floating point values to unsigned values.
-            assert(rowBytes && rowBytes >= (int)sizeof(float) * width * pixelDataNComps);
-            const int numDestChannels = hasAlpha ? 4 : 3;
-
-            for (int y = 0; y < height; ++y) {
-                int srcY = height - 1 - y;
-                const float* src_pixels = (float*)( (char*)pixelData + srcY * rowBytes );
-
-                if (avCodecContext->bits_per_raw_sample > 8) {
-                    assert(pixelFormatNuke == AV_PIX_FMT_RGBA64 || pixelFormatNuke == AV_PIX_FMT_RGB48);
-
-                    // avPicture.linesize is in bytes, but stride is U16 (2 bytes), so divide linesize by 2
-                    assert(inputFrame_->linesize[0] / 2 >= width * numDestChannels);
-                    unsigned short* dst_pixels = reinterpret_cast<unsigned short*>(inputFrame_->data[0]) + y * (inputFrame_->linesize[0] / 2);
-
-                    for (int x = 0; x < width; ++x) {
-                        int srcCol = x * pixelDataNComps;
-                        int dstCol = x * numDestChannels;
-                        dst_pixels[dstCol + 0] = floatToInt<65536>(src_pixels[srcCol + 0]);
-                        dst_pixels[dstCol + 1] = floatToInt<65536>(src_pixels[srcCol + 1]);
-                        dst_pixels[dstCol + 2] = floatToInt<65536>(src_pixels[srcCol + 2]);
-                        if (hasAlpha) {
-                            dst_pixels[dstCol + 3] = floatToInt<65536>( (pixelDataNComps == 4) ? src_pixels[srcCol + 3] : 1. );
-                        }
+    std::shared_ptr<AVFrame> inputFrame = myAVStream->rgbFramePool->get();
+    if (!inputFrame) {
+        ret = -1;
+    } else {
+        // Convert floating point values to unsigned values.
+        assert(rowBytes && rowBytes >= (int)sizeof(float) * width * pixelDataNComps);
+        const int numDestChannels = hasAlpha ? 4 : 3;
+
+        for (int y = 0; y < height; ++y) {
+            int srcY = height - 1 - y;
+            const float* src_pixels = (float*)( (char*)pixelData + srcY * rowBytes );
+
+            if (avCodecContext->bits_per_raw_sample > 8) {
+                assert(pixelFormatNuke == AV_PIX_FMT_RGBA64 || pixelFormatNuke == AV_PIX_FMT_RGB48);
+
+                // avPicture.linesize is in bytes, but stride is U16 (2 bytes), so divide linesize by 2
+                assert(inputFrame->linesize[0] / 2 >= width * numDestChannels);
+                unsigned short* dst_pixels = reinterpret_cast<unsigned short*>(inputFrame->data[0]) + y * (inputFrame->linesize[0] / 2);
+
+                for (int x = 0; x < width; ++x) {
+                    int srcCol = x * pixelDataNComps;
+                    int dstCol = x * numDestChannels;
+                    dst_pixels[dstCol + 0] = floatToInt<65536>(src_pixels[srcCol + 0]);
+                    dst_pixels[dstCol + 1] = floatToInt<65536>(src_pixels[srcCol + 1]);
+                    dst_pixels[dstCol + 2] = floatToInt<65536>(src_pixels[srcCol + 2]);
+                    if (hasAlpha) {
+                        dst_pixels[dstCol + 3] = floatToInt<65536>( (pixelDataNComps == 4) ? src_pixels[srcCol + 3] : 1. );
                     }
-                } else {
-                    assert(pixelFormatNuke == AV_PIX_FMT_RGBA || pixelFormatNuke == AV_PIX_FMT_RGB24);
-
-                    assert(inputFrame_->linesize[0] >= width * numDestChannels);
-                    unsigned char* dst_pixels = inputFrame_->data[0] + y * inputFrame_->linesize[0];
-
-                    for (int x = 0; x < width; ++x) {
-                        int srcCol = x * pixelDataNComps;
-                        int dstCol = x * numDestChannels;
-                        dst_pixels[dstCol + 0] = floatToInt<256>(src_pixels[srcCol + 0]);
-                        dst_pixels[dstCol + 1] = floatToInt<256>(src_pixels[srcCol + 1]);
-                        dst_pixels[dstCol + 2] = floatToInt<256>(src_pixels[srcCol + 2]);
-                        if (hasAlpha) {
-                            dst_pixels[dstCol + 3] = floatToInt<256>( (pixelDataNComps == 4) ? src_pixels[srcCol + 3] : 1. );
-                        }
+                }
+            } else {
+                assert(pixelFormatNuke == AV_PIX_FMT_RGBA || pixelFormatNuke == AV_PIX_FMT_RGB24);
+
+                assert(inputFrame->linesize[0] >= width * numDestChannels);
+                unsigned char* dst_pixels = inputFrame->data[0] + y * inputFrame->linesize[0];
+
+                for (int x = 0; x < width; ++x) {
+                    int srcCol = x * pixelDataNComps;
+                    int dstCol = x * numDestChannels;
+                    dst_pixels[dstCol + 0] = floatToInt<256>(src_pixels[srcCol + 0]);
+                    dst_pixels[dstCol + 1] = floatToInt<256>(src_pixels[srcCol + 1]);
+                    dst_pixels[dstCol + 2] = floatToInt<256>(src_pixels[srcCol + 2]);
+                    if (hasAlpha) {
+                        dst_pixels[dstCol + 3] = floatToInt<256>( (pixelDataNComps == 4) ? src_pixels[srcCol + 3] : 1. );
                     }
                 }
             }
+        }
 
-            assert(inputFrame_);
-            if (!inputFrame_) {
-                ret = -1;
+        {
+            // For any codec an
+            // intermediate buffer is used for the
+            // colour space conversion.
+
+            // Each frame gets its own buffer from the pool, since it may still
+            // be waiting for the encoder when the next frame is converted.
+            std::shared_ptr<AVFrame> outputFrame = myAVStream->codecFramePool->get();
+            assert( !outputFrame || outputFrame->format == (int)pixelFormatCodec );
+
+            if (outputFrame) {
+                colourSpaceConvert(inputFrame.get(), outputFrame.get(), pixelFormatNuke, pixelFormatCodec, avCodecContext);
+
+                // see ffmpeg.c:1199 from ffmpeg 3.2.2
+                // MJPEG ignores global_quality, and only uses the quality setting in the pictures.
+                // The pts is set by writeVideo().
+                outputFrame->quality = avCodecContext->global_quality;
+                outputFrame->pict_type = AV_PICTURE_TYPE_NONE;
+                *avFrameOut = outputFrame;
             } else {
-                // For any codec an
-                // intermediate buffer is allocated for the
-                // colour space conversion.
-
-                if (!outputFrame_) {
-                    outputFrame_.reset(av_frame_alloc(), [](AVFrame * frame) { av_freep(&frame->data[0]); av_frame_free(&frame); });
-
-                    outputFrame_->width = avCodecContext->width;
-                    outputFrame_->height = avCodecContext->height;
-                    outputFrame_->format = avCodecContext->pix_fmt;
-
-                    int bufferSize = av_image_alloc(outputFrame_->data, outputFrame_->linesize, outputFrame_->width, outputFrame_->height, pixelFormatCodec, 32);
+                // av_frame_get_buffer failed.
+                ret = -1;
+            }
+        }
+    }
 
-                    if (bufferSize < 0) {
-                        outputFrame_.reset();
-                    }
-                }
+#if OFX_FFMPEG_TRACE_ALLOCATIONS
+    std::cout << "WriteFFmpeg: frame " << _pts_counter << ", " << myAVStream->rgbFramePool->getAllocationsCount() + myAVStream->codecFramePool->getAllocationsCount() << " frame allocations" << std::endl;
+#endif
 
+    return ret;
+} // WriteFFmpegPlugin::convertVideo
 
-                if (outputFrame_) {
-                    colourSpaceConvert(inputFrame_.get(), outputFrame_.get(), pixelFormatNuke, pixelFormatCodec, avCodecContext);
+////////////////////////////////////////////////////////////////////////////////
+// writeVideo
+//
+// * Encode a frame converted by convertVideo().
+// * Write to file.
+//
+// This does not call any OFX suite function, and may be called from the
+// encoder thread. Errors are reported in _encodeErrorMessage.
+//
+// @param avFormatContext A reference to an AVFormatContext of the file.
+// @param avStream A reference to an AVStream of a video stream.
+// @param flush A boolean value to flag that any remaining frames in the internal
+//              queue of the encoder should be written to the file. No new
+//              frames will be queued for encoding.
+// @param avFrame The frame to encode, in the pixel format of the encoder, or
+//                NULL if flush is true.
+//
+// @return 0 if successful,
+//         <0 otherwise for any failure to encode the video or write to the file.
+//
+int
+WriteFFmpegPlugin::writeVideo(AVFormatContext* avFormatContext,
+                              MyAVStream* myAVStream,
+                              bool flush,
+                              AVFrame* avFrame)
+{
+    // FIXME enum needed for error codes.
+    if (!_isOpen) {
+        return -5; //writer is not open!
+    }
+    AVStream* avStream = myAVStream->stream;
+    if (!avStream) {
+        return -6;
+    }
+    assert(avFormatContext);
+    if ( !avFormatContext || (!flush && !avFrame) ) {
+        return -7;
+    }
+    int ret = 0;
+    AVCodecContext* avCodecContext = myAVStream->codecContext;
+    assert(avCodecContext);
+    if (!avCodecContext) {
+        return -8;
+    }
 
-                    // see ffmpeg.c:1199 from ffmpeg 3.2.2
-                    // MJPEG ignores global_quality, and only uses the quality setting in the pictures.
-                    outputFrame_->quality = avCodecContext->global_quality;
-                    outputFrame_->pict_type = AV_PICTURE_TYPE_NONE;
-                    outputFrame_->pts = _pts_counter;
-                } else {
-                    // av_image_alloc failed.
-                    ret = -1;
-                }
-            }
-        }
-    } else {
-        inputFrame_.reset();
-        outputFrame_.reset();
+    if (!myAVStream->packet) {
+        return -9;
     }
 
     if (!ret) {
         bool error = false;
 
-        MyAVPacket pkt;
+        // the packet is reused for every frame: it only holds a reference on the encoded data until it is written
+        AVPacket* pkt = myAVStream->packet;
 
 #if OFX_FFMPEG_SCRATCHBUFFER
         // Use a contiguous block of memory. This is to scope the
@@ -3532,8 +3878,11 @@ WriteFFmpegPlugin::writeVideo(AVFormatContext* avFormatContext,
         // NOTE: If |flush| is true, then avFrameOut will be NULL at this point as
         //       alloc will not have been called.
 
+        if (avFrame) {
+            avFrame->pts = _pts_counter;
+        }
         _pts_counter++;
-        const int bytesEncoded = encodeVideo(avCodecContext, outputFrame_.get(), pkt.pkt());
+        const int bytesEncoded = encodeVideo(avCodecContext, avFrame, pkt);
         const bool encodeSucceeded = (bytesEncoded > 0);
         if (encodeSucceeded) {
             // Each of these packets should consist of a single frame therefore each one
@@ -3557,14 +3906,14 @@ WriteFFmpegPlugin::writeVideo(AVFormatContext* avFormatContext,
 
             pkt->stream_index = avStream->index;
 
-            const int writeResult = av_write_frame(avFormatContext, pkt.pkt());
+            const int writeResult = av_write_frame(avFormatContext, pkt);
 
             const bool writeSucceeded = (writeResult == 0);
             if (!writeSucceeded) {
                 // Report the error.
                 char szError[1024];
                 av_strerror(bytesEncoded, szError, 1024);
-                setPersistentMessage(Message::eMessageError, "", string("Cannot write frame: ") + szError);
+                _encodeErrorMessage = string("Cannot write frame: ") + szError;
                 error = true;
             }
         } else {
@@ -3576,13 +3925,14 @@ WriteFFmpegPlugin::writeVideo(AVFormatContext* avFormatContext,
                 // Report the error.
                 char szError[1024];
                 av_strerror(bytesEncoded, szError, 1024);
-                setPersistentMessage(Message::eMessageError, "", string("Cannot encode frame: ") + szError);
+                _encodeErrorMessage = string("Cannot encode frame: ") + szError;
                 error = true;
             } else if (flush) {
                 // Flag that the flush is complete.
                 ret = -10;
             }
         }
+        av_packet_unref(pkt);
         if (error) {
             av_log(avCodecContext, AV_LOG_ERROR, "error writing frame to file\n");
             ret = -2;
@@ -3635,6 +3985,8 @@ WriteFFmpegPlugin::encodeVideo(AVCodecContext* avCodecContext, const AVFrame* av
 //                        write.
 // @param finalise A flag to indicate that the streams should be flushed as
 //                 no further frames are to be encoded.
+// @param avFrame The video frame to write, as converted by convertVideo(),
+//                NULL if finalise is true.
 //
 // @return 0 if successful.
 //         <0 otherwise.
@@ -3642,12 +3994,7 @@ WriteFFmpegPlugin::encodeVideo(AVCodecContext* avCodecContext, const AVFrame* av
 int
 WriteFFmpegPlugin::writeToFile(AVFormatContext* avFormatContext,
                                bool finalise,
-                               double time,
-                               const float *pixelData,
-                               const OfxRectI* bounds,
-                               int pixelDataNComps,
-                               int dstNComps,
-                               int rowBytes)
+                               AVFrame* avFrame)
 {
 #if OFX_FFMPEG_AUDIO
     // Write interleaved audio and video if an audio file has
@@ -3681,13 +4028,116 @@ WriteFFmpegPlugin::writeToFile(AVFormatContext* avFormatContext,
         return -6;
     }
     assert(avFormatContext);
-    if ( !avFormatContext || ( !finalise && (!pixelData || !bounds) ) ) {
+    if ( !avFormatContext || (!finalise && !avFrame) ) {
         return -7;
     }
 
-    return writeVideo(avFormatContext, &_streamVideo, finalise, time, pixelData, bounds, pixelDataNComps, dstNComps, rowBytes);
+    return writeVideo(avFormatContext, &_streamVideo, finalise, avFrame);
+}
+
+#if OFX_FFMPEG_ENCODE_THREAD
+////////////////////////////////////////////////////////////////////////////////
+// Encoder thread
+// encode() converts the frames on the render thread, in sequential order, and
+// hands them over to the encoder thread, which encodes and muxes them. This way,
+// the host can render the next frame while the previous one is being encoded.
+// The queue is bounded to OFX_FFMPEG_ENCODE_QUEUE_SIZE frames to limit memory usage.
+//
+void
+WriteFFmpegPlugin::startEncodeThread()
+{
+    assert(!_encodeThread);
+    {
+        tthread::lock_guard<tthread::mutex> guard(_encodeQueueMutex);
+        _encodeQueue.clear();
+        _encodeQueueFinish = false;
+        _encodeQueueError = 0;
+    }
+    _encodeErrorMessage.clear();
+    _encodeThread = new tthread::thread(encodeThreadFunction, this);
+}
+
+void
+WriteFFmpegPlugin::stopEncodeThread()
+{
+    if (!_encodeThread) {
+        return;
+    }
+    {
+        tthread::lock_guard<tthread::mutex> guard(_encodeQueueMutex);
+        _encodeQueueFinish = true;
+        _encodeQueueCond.notify_all();
+    }
+    // the encoder thread writes the remaining frames before exiting
+    _encodeThread->join();
+    delete _encodeThread;
+    _encodeThread = nullptr;
+}
+
+int
+WriteFFmpegPlugin::queueFrame(const std::shared_ptr<AVFrame>& avFrame)
+{
+    assert(_encodeThread);
+    tthread::lock_guard<tthread::mutex> guard(_encodeQueueMutex);
+    while ( (_encodeQueue.size() >= OFX_FFMPEG_ENCODE_QUEUE_SIZE) && !_encodeQueueError ) {
+        _encodeQueueCond.wait(guard);
+    }
+    if (_encodeQueueError) {
+        return _encodeQueueError;
+    }
+    _encodeQueue.push_back(avFrame);
+    _encodeQueueCond.notify_all();
+
+    return 0;
+}
+
+void
+WriteFFmpegPlugin::encodeLoop()
+{
+    for (;;) {
+        std::shared_ptr<AVFrame> avFrame;
+        {
+            tthread::lock_guard<tthread::mutex> guard(_encodeQueueMutex);
+            while ( _encodeQueue.empty() && !_encodeQueueFinish ) {
+                _encodeQueueCond.wait(guard);
+            }
+            if ( _encodeQueue.empty() ) {
+                // finished, and all frames were written
+                return;
+            }
+            // leave the frame in the queue while it is encoded, so that it counts in the queue size
+            avFrame = _encodeQueue.front();
+        }
+
+        int ret = writeToFile(_formatContext, false, avFrame.get());
+        avFrame.reset();
+
+        {
+            tthread::lock_guard<tthread::mutex> guard(_encodeQueueMutex);
+            _encodeQueue.pop_front();
+            if (ret) {
+                // give up on the remaining frames, encode() reports the error
+                _encodeQueueError = ret;
+                _encodeQueue.clear();
+            }
+            _encodeQueueCond.notify_all();
+            if (ret) {
+                return;
+            }
+        }
+    }
+}
+
+void
+WriteFFmpegPlugin::encodeThreadFunction(void* userData)
+{
+    WriteFFmpegPlugin* plugin = static_cast<WriteFFmpegPlugin*>(userData);
+
+    plugin->encodeLoop();
 }
 
+#endif // OFX_FFMPEG_ENCODE_THREAD
+
 ////////////////////////////////////////////////////////////////////////////////
 // open
 // Internal function to create all the required streams for writing a QuickTime
@@ -4190,6 +4640,10 @@ WriteFFmpegPlugin::beginEncode(const string& filename,
 
     _isOpen = true;
     _error = CLEANUP;
+    _encodeErrorMessage.clear();
+#if OFX_FFMPEG_ENCODE_THREAD
+    startEncodeThread();
+#endif
 } // WriteFFmpegPlugin::beginEncode
 
 #define checkAvError() if (error < 0) { \
@@ -4278,13 +4732,29 @@ WriteFFmpegPlugin::encode(const string& filename,
                     return;
                 }
                 assert(_formatContext);
-                if ( !writeToFile(_formatContext, false, time, pixelData, &bounds, pixelDataNComps, dstNComps, rowBytes) ) {
+                // Conversion is done here, in sequential order, since it uses _convertCtx.
+                std::shared_ptr<AVFrame> avFrame;
+                int ret = convertVideo(&_streamVideo, pixelData, &bounds, pixelDataNComps, dstNComps, rowBytes, &avFrame);
+                if (!ret) {
+#if OFX_FFMPEG_ENCODE_THREAD
+                    ret = queueFrame(avFrame);
+#else
+                    ret = writeToFile(_formatContext, false, avFrame.get());
+#endif
+                }
+                if (!ret) {
                     _error = SUCCESS;
                     _nextFrameToEncode = (int)time + _frameStep;
                     if ( abort() ) {
                         _nextFrameToEncode = INT_MIN;
                     }
                 } else {
+                    // the encoder thread does not write any more frame after an error
+                    if ( !_encodeErrorMessage.empty() ) {
+                        setPersistentMessage(Message::eMessageError, "", _encodeErrorMessage);
+                    }
+                    _nextFrameToEncode = INT_MIN;
+                    _nextFrameToEncodeCond.notify_all();
                     throwSuiteStatusException(kOfxStatFailed);
 
                     return;
@@ -4317,18 +4787,35 @@ WriteFFmpegPlugin::endEncode(const EndSequenceRenderArguments & /*args*/)
     }
 
 
+#if OFX_FFMPEG_ENCODE_THREAD
+    // write the frames that are still in the queue before flushing the encoder
+    stopEncodeThread();
+#endif
+
     if (_error == IGNORE_FINISH) {
         freeFormat();
 
         return;
     }
+    if ( !_encodeErrorMessage.empty() ) {
+        // the encoder failed: do not flush it or finalise a movie which is missing frames
+        failEncode();
+
+        return;
+    }
 
     bool flushFrames = true;
     while (flushFrames) {
         // Continue to write the audio/video interleave while there are still
         // frames in the video and/or audio encoder queues, without queuing any
         // new data to encode. This is ffmpeg specific.
-        flushFrames = !writeToFile(_formatContext, true, -1) ? true : false;
+        flushFrames = !writeToFile(_formatContext, true) ? true : false;
+    }
+    if ( !_encodeErrorMessage.empty() ) {
+        // flushing the encoder failed
+        failEncode();
+
+        return;
     }
 #if OFX_FFMPEG_AUDIO
     // The audio is written in ~0.5s chunks only when the video stream position
@@ -4356,11 +4843,27 @@ WriteFFmpegPlugin::endEncode(const EndSequenceRenderArguments & /*args*/)
     // Finalise the movie.
     av_write_trailer(_formatContext);
 
+#if OFX_FFMPEG_TRACE_ALLOCATIONS
+    if (_streamVideo.rgbFramePool && _streamVideo.codecFramePool) {
+        std::cout << "WriteFFmpeg: " << _pts_counter << " frames encoded with " << _streamVideo.rgbFramePool->getAllocationsCount() + _streamVideo.codecFramePool->getAllocationsCount() << " frame allocations" << std::endl;
+    }
+#endif
+
     freeFormat();
 
     _pts_counter = 0;
 }
 
+// Report the encoder error and close the file without writing the trailer.
+void
+WriteFFmpegPlugin::failEncode()
+{
+    setPersistentMessage(Message::eMessageError, "", _encodeErrorMessage);
+    freeFormat();
+    _pts_counter = 0;
+    throwSuiteStatusException(kOfxStatFailed);
+}
+
 void
 WriteFFmpegPlugin::setOutputFrameRate(double fps)
 {
@@ -4975,6 +5478,15 @@ WriteFFmpegPlugin::changedClip(const InstanceChangedArgs &/*args*/,
 void
 WriteFFmpegPlugin::freeFormat()
 {
+#if OFX_FFMPEG_ENCODE_THREAD
+    stopEncodeThread();
+#endif
+    // all the frames were released by the encoder thread
+    delete _streamVideo.rgbFramePool;
+    _streamVideo.rgbFramePool = nullptr;
+    delete _streamVideo.codecFramePool;
+    _streamVideo.codecFramePool = nullptr;
+    av_packet_free(&_streamVideo.packet);
     if (_streamVideo.stream) {
         avcodec_free_context(&_streamVideo.codecContext);
         _streamVideo.codecContext = nullptr;
@@ -5364,7 +5876,7 @@ WriteFFmpegPluginFactory::describeInContext(ImageEffectDescriptor &desc,
     // make some pages and to things in
     PageParamDescriptor *page = GenericWriterDescribeInContextBegin(desc, context,
                                                                     kSupportsRGBA, kSupportsRGB, kSupportsAlpha, kSupportsXY,
-                                                                    "scene_linear", "rec709", false);
+                                                                    "scene_linear", "rec709", false, false);
 
     ///If the host doesn't support sequential render, fail.
     int hostSequentialRender = getImageEffectHostDescription()->sequentialRender;
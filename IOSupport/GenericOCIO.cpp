@@ -48,7 +48,15 @@
 #else
 #define DBG(x) (void)0
 #endif
+#include <cmath>
 #include <string>
+#include <sstream>
+#include <list>
+#include <vector>
+#include <algorithm>
+#ifdef OFX_OCIO_ATOMIC_SNAPSHOT
+#include <memory> // std::atomic_load, std::atomic_store
+#endif
 #include <stdexcept>
 #include <ofxsParam.h>
 #include <ofxsImageEffect.h>
@@ -59,6 +67,7 @@
 #ifdef OFX_IO_USING_OCIO
 #include <OpenColorIO/OpenColorIO.h>
 namespace OCIO = OCIO_NAMESPACE;
+#include "fast_mutex.h" // the process-wide caches are static, and can't use the OFX MT-Suite mutex
 #endif
 
 using std::string;
@@ -602,7 +611,7 @@ GenericOCIO::isIdentity(double time) const
     try {
         // maybe the names are not the same, but it's still a no-op (e.g. "scene_linear" and "linear")
         OCIO::ConstContextRcPtr context = getLocalContext(time);//_config->getCurrentContext();
-        OCIO::ConstProcessorRcPtr proc = _config->getProcessor( context, inputSpace.c_str(), outputSpace.c_str() );
+        OCIO::ConstProcessorRcPtr proc = getProcessorSnapshot(context, inputSpace, outputSpace);
 
         return proc->isNoOp();
     } catch (const std::exception& e) {
@@ -739,12 +748,164 @@ GenericOCIO::apply(double time,
 }
 
 #ifdef OFX_IO_USING_OCIO
+#define kOCIOProcessorCacheMax 256 // maximum number of processors in the process-wide cache
+
+// the most recently used processors first, keyed by the config cache ID (which depends on the context) and a processor key.
+static std::list<std::pair<string, OCIO::ConstProcessorRcPtr> > gProcessorCache;
+static tthread::fast_mutex gProcessorCacheMutex;
+
+static string
+processorCacheKey(const OCIO::ConstConfigRcPtr& config,
+                  const OCIO::ConstContextRcPtr& context,
+                  const string& key)
+{
+    return string( config->getCacheID( context ? context : config->getCurrentContext() ) ) + '\n' + key;
+}
+
+OCIO::ConstProcessorRcPtr
+GenericOCIO::findProcessorCached(const OCIO::ConstConfigRcPtr& config,
+                                 const OCIO::ConstContextRcPtr& context,
+                                 const string& key)
+{
+    const string cacheKey = processorCacheKey(config, context, key);
+    OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gProcessorCacheMutex);
+
+    for (std::list<std::pair<string, OCIO::ConstProcessorRcPtr> >::iterator it = gProcessorCache.begin(); it != gProcessorCache.end(); ++it) {
+        if (it->first == cacheKey) {
+            gProcessorCache.splice( gProcessorCache.begin(), gProcessorCache, it );
+
+            return gProcessorCache.front().second;
+        }
+    }
+
+    return OCIO::ConstProcessorRcPtr();
+}
+
+void
+GenericOCIO::insertProcessorCached(const OCIO::ConstConfigRcPtr& config,
+                                   const OCIO::ConstContextRcPtr& context,
+                                   const string& key,
+                                   const OCIO::ConstProcessorRcPtr& proc)
+{
+    const string cacheKey = processorCacheKey(config, context, key);
+    OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gProcessorCacheMutex);
+
+    // another thread may have inserted the same processor meanwhile
+    for (std::list<std::pair<string, OCIO::ConstProcessorRcPtr> >::iterator it = gProcessorCache.begin(); it != gProcessorCache.end(); ++it) {
+        if (it->first == cacheKey) {
+            gProcessorCache.erase(it);
+            break;
+        }
+    }
+    gProcessorCache.push_front( std::make_pair(cacheKey, proc) );
+    if (gProcessorCache.size() > kOCIOProcessorCacheMax) {
+        gProcessorCache.pop_back();
+    }
+}
+
+OCIO::ConstProcessorRcPtr
+GenericOCIO::getProcessorCached(const OCIO::ConstConfigRcPtr& config,
+                                const OCIO::ConstContextRcPtr& context,
+                                const char* srcName,
+                                const char* dstName)
+{
+    const string key = string("colorspaces\n") + srcName + '\n' + dstName;
+    OCIO::ConstProcessorRcPtr proc = findProcessorCached(config, context, key);
+
+    if (!proc) {
+        // build the processor without holding the lock: it may parse LUT files
+        proc = context ? config->getProcessor(context, srcName, dstName) : config->getProcessor(srcName, dstName);
+        insertProcessorCached(config, context, key, proc);
+    }
+
+    return proc;
+}
+
+OCIO::ConstProcessorRcPtr
+GenericOCIO::getProcessorCached(const OCIO::ConstConfigRcPtr& config,
+                                const OCIO::ConstContextRcPtr& context,
+                                const OCIO::ConstTransformRcPtr& transform,
+                                OCIO::TransformDirection direction)
+{
+    // the serialized transform lists all its parameters
+    std::ostringstream os;
+    os.precision(17);
+    os << "transform\n" << *transform << '\n' << (int)direction;
+    const string key = os.str();
+    OCIO::ConstProcessorRcPtr proc = findProcessorCached(config, context, key);
+
+    if (!proc) {
+        // build the processor without holding the lock: it may parse LUT files
+        proc = context ? config->getProcessor(context, transform, direction) : config->getProcessor(transform, direction);
+        insertProcessorCached(config, context, key, proc);
+    }
+
+    return proc;
+}
+
+GenericOCIO::ProcessorSnapshotPtr
+GenericOCIO::loadProcessorSnapshot() const
+{
+#ifdef OFX_OCIO_ATOMIC_SNAPSHOT
+    return std::atomic_load(&_procSnapshot);
+#else
+    AutoMutex guard(_procMutex);
+
+    return _procSnapshot;
+#endif
+}
+
+void
+GenericOCIO::storeProcessorSnapshot(const ProcessorSnapshotPtr& snapshot) const
+{
+#ifdef OFX_OCIO_ATOMIC_SNAPSHOT
+    std::atomic_store(&_procSnapshot, snapshot);
+#else
+    AutoMutex guard(_procMutex);
+
+    _procSnapshot = snapshot;
+#endif
+}
+
+// Returns the processor of the current snapshot if it was built from the same values, else builds
+// (or fetches from the process-wide cache) a new processor and publishes it as the new snapshot.
+// Several threads may build the same processor concurrently, in which case the last one wins.
+OCIO::ConstProcessorRcPtr
+GenericOCIO::getProcessorSnapshot(const OCIO::ConstContextRcPtr &context,
+                                  const string& inputSpace,
+                                  const string& outputSpace) const
+{
+    ProcessorSnapshotPtr snapshot = loadProcessorSnapshot();
+
+    if ( snapshot &&
+         ( snapshot->config == _config) &&
+         ( snapshot->inputSpace == inputSpace) &&
+         ( snapshot->outputSpace == outputSpace) ) {
+        // getLocalContext() returns a new context each time context variables are set, so compare
+        // the contents (and not only the pointers)
+        if ( (snapshot->context == context) || (snapshot->contextCacheID == context->getCacheID()) ) {
+            return snapshot->proc;
+        }
+    }
+
+    OCIO_SHARED_PTR<ProcessorSnapshot> newSnapshot(new ProcessorSnapshot);
+    newSnapshot->config = _config;
+    newSnapshot->context = context;
+    newSnapshot->contextCacheID = context->getCacheID();
+    newSnapshot->inputSpace = inputSpace;
+    newSnapshot->outputSpace = outputSpace;
+    newSnapshot->proc = getProcessorCached( _config, context, inputSpace.c_str(), outputSpace.c_str() );
+    storeProcessorSnapshot(newSnapshot);
+
+    return newSnapshot->proc;
+}
+
 OCIO_NAMESPACE::ConstProcessorRcPtr
 GenericOCIO::getProcessor() const
 {
-    AutoMutex guard(_procMutex);
+    ProcessorSnapshotPtr snapshot = loadProcessorSnapshot();
 
-    return _proc;
+    return snapshot ? snapshot->proc : OCIO::ConstProcessorRcPtr();
 };
 void
 GenericOCIO::setValues(const string& inputSpace,
@@ -758,16 +919,383 @@ GenericOCIO::setValues(const OCIO::ConstContextRcPtr &context,
                        const string& inputSpace,
                        const string& outputSpace)
 {
-    AutoMutex guard(_procMutex);
+    getProcessorSnapshot(context, inputSpace, outputSpace);
+}
+
+#define kOCIOBakedLUTEdgeSize 33 // one more than LUT3D_EDGE_SIZE in GenericOCIOOpenGL.cpp, so that the shaper maps 1 to a node
+#define kOCIOBakedLUTShaperMax 64.f // the LUT covers [0, kOCIOBakedLUTShaperMax]
+#define kOCIOBakedLUTShaperOffset (1.f / 64.f) // the shaper is log(x + offset), which is almost linear below the offset
+#define kOCIOBakedLUTCacheMax 8 // maximum number of baked LUTs kept in the cache
+
+/**
+ * @brief A 3D LUT sampled from an OCIO processor, with a logarithmic 1D shaper on each input channel.
+ *
+ * It is applied with tetrahedral interpolation, which only requires four LUT entries per pixel, and
+ * preserves the neutral axis (grey inputs only interpolate along the cube diagonal).
+ **/
+class OCIOBakedLUT
+{
+public:
+    explicit OCIOBakedLUT(const OCIO::ConstProcessorRcPtr& proc)
+        : _lut(3 * kOCIOBakedLUTEdgeSize * kOCIOBakedLUTEdgeSize * kOCIOBakedLUTEdgeSize)
+        , _logOffset( std::log(kOCIOBakedLUTShaperOffset) )
+        , _shaperScale( (kOCIOBakedLUTEdgeSize - 1) / ( std::log(kOCIOBakedLUTShaperMax + kOCIOBakedLUTShaperOffset) - std::log(kOCIOBakedLUTShaperOffset) ) )
+    {
+        const int n = kOCIOBakedLUTEdgeSize;
+        // the input value of each node along an axis, i.e. the inverse of the shaper
+        std::vector<float> nodes(n);
+
+        for (int i = 0; i < n; ++i) {
+            nodes[i] = std::exp(i / _shaperScale + _logOffset) - kOCIOBakedLUTShaperOffset;
+        }
+        nodes[0] = 0.f;
+        nodes[n - 1] = kOCIOBakedLUTShaperMax;
+        // red varies fastest
+        float* p = &_lut[0];
+        for (int b = 0; b < n; ++b) {
+            for (int g = 0; g < n; ++g) {
+                for (int r = 0; r < n; ++r, p += 3) {
+                    p[0] = nodes[r];
+                    p[1] = nodes[g];
+                    p[2] = nodes[b];
+                }
+            }
+        }
+        // process the nodes as a n x (n * n) RGB image
+        AutoSetAndRestoreThreadLocale locale;
+#     if OCIO_VERSION_HEX >= 0x02000000
+        OCIO::PackedImageDesc img(&_lut[0], n, n * n, 3);
+        OCIO::ConstCPUProcessorRcPtr cpuproc = proc->getOptimizedCPUProcessor(OCIO::BIT_DEPTH_F32, OCIO::BIT_DEPTH_F32,
+                                                                              OCIO::OPTIMIZATION_DEFAULT);
+        cpuproc->apply(img);
+#     else
+        OCIO::PackedImageDesc img(&_lut[0], n, n * n, 3);
+        proc->apply(img);
+#     endif
+    }
+
+    // apply the LUT to a row of RGB or RGBA pixels, in place (alpha is left unchanged)
+    void apply(float* pix,
+               int width,
+               int numChannels) const
+    {
+        const int n = kOCIOBakedLUTEdgeSize;
+        const int dr = 3;
+        const int dg = 3 * n;
+        const int db = 3 * n * n;
+        const float* lut = &_lut[0];
+
+        for (int x = 0; x < width; ++x, pix += numChannels) {
+            float fr = shaper(pix[0]);
+            float fg = shaper(pix[1]);
+            float fb = shaper(pix[2]);
+            // the node below, so that the node above always exists
+            int ir = (std::min)( (int)fr, n - 2 );
+            int ig = (std::min)( (int)fg, n - 2 );
+            int ib = (std::min)( (int)fb, n - 2 );
+            fr -= ir;
+            fg -= ig;
+            fb -= ib;
+
+            // select the tetrahedron containing the point: it is given by the order of the
+            // fractional parts, and goes from the c000 node to the c111 node
+            const float* c000 = lut + ir * dr + ig * dg + ib * db;
+            const float* c111 = c000 + dr + dg + db;
+            const float* c1;
+            const float* c2;
+            float w0, w1, w2, w3;
+            if (fr > fg) {
+                if (fg > fb) {
+                    // r > g > b
+                    c1 = c000 + dr; c2 = c000 + dr + dg;
+                    w0 = 1.f - fr; w1 = fr - fg; w2 = fg - fb; w3 = fb;
+                } else if (fr > fb) {
+                    // r > b >= g
+                    c1 = c000 + dr; c2 = c000 + dr + db;
+                    w0 = 1.f - fr; w1 = fr - fb; w2 = fb - fg; w3 = fg;
+                } else {
+                    // b >= r > g
+                    c1 = c000 + db; c2 = c000 + dr + db;
+                    w0 = 1.f - fb; w1 = fb - fr; w2 = fr - fg; w3 = fg;
+                }
+            } else {
+                if (fb > fg) {
+                    // b > g >= r
+                    c1 = c000 + db; c2 = c000 + dg + db;
+                    w0 = 1.f - fb; w1 = fb - fg; w2 = fg - fr; w3 = fr;
+                } else if (fb > fr) {
+                    // g >= b > r
+                    c1 = c000 + dg; c2 = c000 + dg + db;
+                    w0 = 1.f - fg; w1 = fg - fb; w2 = fb - fr; w3 = fr;
+                } else {
+                    // g >= r >= b
+                    c1 = c000 + dg; c2 = c000 + dr + dg;
+                    w0 = 1.f - fg; w1 = fg - fr; w2 = fr - fb; w3 = fb;
+                }
+            }
+            for (int c = 0; c < 3; ++c) {
+                pix[c] = w0 * c000[c] + w1 * c1[c] + w2 * c2[c] + w3 * c111[c];
+            }
+        }
+    }
+
+private:
+    // map a value to the LUT coordinates, in [0, kOCIOBakedLUTEdgeSize - 1]
+    float shaper(float v) const
+    {
+        if ( !(v > 0.f) ) { // also catches NaN
+            return 0.f;
+        }
+        if (v >= kOCIOBakedLUTShaperMax) {
+            return (float)(kOCIOBakedLUTEdgeSize - 1);
+        }
+
+        return (std::log(v + kOCIOBakedLUTShaperOffset) - _logOffset) * _shaperScale;
+    }
+
+    std::vector<float> _lut; // RGB nodes, red varies fastest
+    float _logOffset;
+    float _shaperScale;
+};
+
+typedef OCIO_SHARED_PTR<const OCIOBakedLUT> OCIOBakedLUTPtr;
 
-    if ( !_proc ||
-         ( context != _procContext) ||
-         ( inputSpace != _procInputSpace) ||
-         ( outputSpace != _procOutputSpace) ) {
-        _procContext = context;
-        _procInputSpace = inputSpace;
-        _procOutputSpace = outputSpace;
-        _proc = _config->getProcessor( context, inputSpace.c_str(), outputSpace.c_str() );
+// the most recently used baked LUTs, used first, keyed by the processor cache ID
+static std::list<std::pair<string, OCIOBakedLUTPtr> > gBakedLUTs;
+static tthread::fast_mutex gBakedLUTsMutex;
+
+static OCIOBakedLUTPtr
+getBakedLUT(const OCIO::ConstProcessorRcPtr& proc)
+{
+#if OCIO_VERSION_HEX >= 0x02000000
+    const string cacheID = proc->getCacheID();
+#else
+    const string cacheID = proc->getCpuCacheID();
+#endif
+    {
+        OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gBakedLUTsMutex);
+        for (std::list<std::pair<string, OCIOBakedLUTPtr> >::iterator it = gBakedLUTs.begin(); it != gBakedLUTs.end(); ++it) {
+            if (it->first == cacheID) {
+                gBakedLUTs.splice( gBakedLUTs.begin(), gBakedLUTs, it );
+
+                return gBakedLUTs.front().second;
+            }
+        }
+    }
+    // bake without holding the lock: the same LUT may be baked twice, but this is harmless
+    OCIOBakedLUTPtr lut( new OCIOBakedLUT(proc) );
+    {
+        OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gBakedLUTsMutex);
+        gBakedLUTs.push_front( std::make_pair(cacheID, lut) );
+        if (gBakedLUTs.size() > kOCIOBakedLUTCacheMax) {
+            gBakedLUTs.pop_back();
+        }
+    }
+
+    return lut;
+}
+
+#define kOCIOChannelLUTIndexShift 13 // the LUT is indexed by the sign, the exponent and the 10 upper bits of the mantissa
+#define kOCIOChannelLUTSize (1 << (32 - kOCIOChannelLUTIndexShift))
+#define kOCIOChannelLUTTolerance 1e-4f // maximum error, relative to max(1, |value|)
+#define kOCIOChannelLUTCheckMax 65504.f // the results are only checked up to the largest half float
+#define kOCIOChannelLUTCacheMax 4 // maximum number of channel LUTs kept in the cache (each takes 6MB)
+
+/**
+ * @brief A 1D LUT per channel sampled from an OCIO processor, indexed by the upper bits of the IEEE float.
+ *
+ * The nodes have the precision of half floats over the whole float range, and the mantissa bits that are
+ * dropped interpolate linearly between two nodes, so that this is close to exact for smooth curves
+ * such as log/lin conversions. The LUT is only valid if the processor has no channel crosstalk, and it
+ * is checked against the processor on values between the nodes.
+ **/
+class OCIOChannelLUT
+{
+public:
+    explicit OCIOChannelLUT(const OCIO::ConstProcessorRcPtr& proc)
+        : _lut()
+        , _valid(false)
+    {
+        if ( proc->hasChannelCrosstalk() ) {
+            return;
+        }
+        // the last node is repeated, so that the node above always exists
+        _lut.resize(3 * (kOCIOChannelLUTSize + 1));
+        for (unsigned int i = 0; i < kOCIOChannelLUTSize; ++i) {
+            const unsigned int bits = i << kOCIOChannelLUTIndexShift;
+            float v;
+            std::memcpy( &v, &bits, sizeof(v) );
+            _lut[3 * i] = _lut[3 * i + 1] = _lut[3 * i + 2] = v;
+        }
+        // process the nodes as a 4096 x (kOCIOChannelLUTSize / 4096) RGB image, which includes NaNs and infinities
+        applyProcessor(proc, &_lut[0], 4096, kOCIOChannelLUTSize / 4096);
+        for (int c = 0; c < 3; ++c) {
+            _lut[3 * kOCIOChannelLUTSize + c] = _lut[3 * (kOCIOChannelLUTSize - 1) + c];
+        }
+
+        // check values that are between the nodes, in the usual range of images, using different values on each channel
+        const int n = 3000;
+        std::vector<float> probes(3 * n);
+        for (int i = 0; i < n; ++i) {
+            float v;
+            if (i < n / 3) {
+                v = -1.f + 3.f * (i + 0.37f) / (n / 3); // [-1, 2]
+            } else {
+                v = std::pow( 10.f, -6.f + 11.f * (i - n / 3 + 0.37f) / (n - n / 3) ); // [1e-6, 1e5]
+                if (i & 1) {
+                    v = -v;
+                }
+            }
+            probes[3 * i] = v;
+            probes[3 * ( (i + 1) % n ) + 1] = v;
+            probes[3 * ( (i + 2) % n ) + 2] = v;
+        }
+        std::vector<float> expected(probes);
+        applyProcessor(proc, &expected[0], n, 1);
+        apply(&probes[0], n, 3);
+        for (int i = 0; i < 3 * n; ++i) {
+            const float a = probes[i];
+            const float b = expected[i];
+            if ( std::fabs(b) > kOCIOChannelLUTCheckMax ) {
+                // e.g. exponential curves far above the usual range
+                continue;
+            }
+            if ( (a != a) || (b != b) ) {
+                // both must be NaN
+                if ( (a == a) || (b == b) ) {
+                    _lut.clear();
+
+                    return;
+                }
+            } else if ( (a != b) && !( std::fabs(a - b) <= kOCIOChannelLUTTolerance * (std::max)(1.f, std::fabs(b)) ) ) { // a == b if both are infinite
+                _lut.clear();
+
+                return;
+            }
+        }
+        _valid = true;
+    }
+
+    bool valid() const
+    {
+        return _valid;
+    }
+
+    // apply the LUT to a row of RGB or RGBA pixels, in place (alpha is left unchanged)
+    void apply(float* pix,
+               int width,
+               int numChannels) const
+    {
+        const float* lut = &_lut[0];
+        const float fracScale = 1.f / (1 << kOCIOChannelLUTIndexShift);
+
+        for (int x = 0; x < width; ++x, pix += numChannels) {
+            for (int c = 0; c < 3; ++c) {
+                unsigned int bits;
+                std::memcpy( &bits, &pix[c], sizeof(bits) );
+                const unsigned int i = bits >> kOCIOChannelLUTIndexShift;
+                // do not interpolate with NaN or infinity
+                const bool special = ( (bits & 0x7f800000) == 0x7f800000 ) ||
+                                     ( ( ( bits + (1 << kOCIOChannelLUTIndexShift) ) & 0x7f800000 ) == 0x7f800000 );
+                const float frac = special ? 0.f : ( bits & ( (1 << kOCIOChannelLUTIndexShift) - 1 ) ) * fracScale;
+                const float v0 = lut[3 * i + c];
+                pix[c] = special ? v0 : ( v0 + frac * (lut[3 * (i + 1) + c] - v0) );
+            }
+        }
+    }
+
+private:
+    static void applyProcessor(const OCIO::ConstProcessorRcPtr& proc,
+                               float* pix,
+                               int width,
+                               int height)
+    {
+        AutoSetAndRestoreThreadLocale locale;
+#     if OCIO_VERSION_HEX >= 0x02000000
+        OCIO::PackedImageDesc img(pix, width, height, 3);
+        OCIO::ConstCPUProcessorRcPtr cpuproc = proc->getOptimizedCPUProcessor(OCIO::BIT_DEPTH_F32, OCIO::BIT_DEPTH_F32,
+                                                                              OCIO::OPTIMIZATION_DEFAULT);
+        cpuproc->apply(img);
+#     else
+        OCIO::PackedImageDesc img(pix, width, height, 3);
+        proc->apply(img);
+#     endif
+    }
+
+    std::vector<float> _lut; // RGB nodes
+    bool _valid;
+};
+
+typedef OCIO_SHARED_PTR<const OCIOChannelLUT> OCIOChannelLUTPtr;
+
+// the most recently used channel LUTs, used first, keyed by the processor cache ID.
+// Invalid LUTs are kept too (without their data), so that they are not sampled again.
+static std::list<std::pair<string, OCIOChannelLUTPtr> > gChannelLUTs;
+static tthread::fast_mutex gChannelLUTsMutex;
+
+static OCIOChannelLUTPtr
+getChannelLUT(const OCIO::ConstProcessorRcPtr& proc)
+{
+#if OCIO_VERSION_HEX >= 0x02000000
+    const string cacheID = proc->getCacheID();
+#else
+    const string cacheID = proc->getCpuCacheID();
+#endif
+    OCIOChannelLUTPtr lut;
+    {
+        OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gChannelLUTsMutex);
+        for (std::list<std::pair<string, OCIOChannelLUTPtr> >::iterator it = gChannelLUTs.begin(); it != gChannelLUTs.end(); ++it) {
+            if (it->first == cacheID) {
+                gChannelLUTs.splice( gChannelLUTs.begin(), gChannelLUTs, it );
+                lut = gChannelLUTs.front().second;
+                break;
+            }
+        }
+    }
+    if (!lut) {
+        // sample without holding the lock: the same LUT may be sampled twice, but this is harmless
+        lut.reset( new OCIOChannelLUT(proc) );
+        OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gChannelLUTsMutex);
+        gChannelLUTs.push_front( std::make_pair(cacheID, lut) );
+        if (gChannelLUTs.size() > kOCIOChannelLUTCacheMax) {
+            gChannelLUTs.pop_back();
+        }
+    }
+
+    return lut->valid() ? lut : OCIOChannelLUTPtr();
+}
+
+void
+OCIOProcessor::purgeBakedLUTs()
+{
+    {
+        OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gBakedLUTsMutex);
+        gBakedLUTs.clear();
+    }
+    {
+        OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gChannelLUTsMutex);
+        gChannelLUTs.clear();
+    }
+}
+
+void
+OCIOProcessor::preProcess()
+{
+    _lut.reset();
+    _channelLUT.reset();
+    if ( (!_bakeLUT && !_useChannelLUT) || !_proc ) {
+        return;
+    }
+    try {
+        if (_useChannelLUT) {
+            _channelLUT = getChannelLUT(_proc);
+        }
+        if (_bakeLUT && !_channelLUT) {
+            _lut = getBakedLUT(_proc);
+        }
+    } catch (OCIO::Exception &e) {
+        _instance->setPersistentMessage( Message::eMessageError, "", string("OpenColorIO error: ") + e.what() );
+        throw std::runtime_error( string("OpenColorIO error: ") + e.what() );
     }
 }
 
@@ -804,6 +1332,28 @@ OCIOProcessor::multiThreadProcessImages(const OfxRectI& renderWindow, const OfxP
     pixelBytes = numChannels * sizeof(float);
     size_t pixelDataOffset = (size_t)(renderWindow.y1 - _dstBounds.y1) * _dstRowBytes + (size_t)(renderWindow.x1 - _dstBounds.x1) * pixelBytes;
     float *pix = (float *) ( ( (char *) _dstPixelData ) + pixelDataOffset ); // (char*)dstImg->getPixelAddress(renderWindow.x1, renderWindow.y1);
+    if (_channelLUT) {
+        for (int y = renderWindow.y1; y < renderWindow.y2; ++y) {
+            if ( _effect.abort() ) {
+                break;
+            }
+            _channelLUT->apply(pix, renderWindow.x2 - renderWindow.x1, numChannels);
+            pix = (float *) ( (char *) pix + _dstRowBytes );
+        }
+
+        return;
+    }
+    if (_lut) {
+        for (int y = renderWindow.y1; y < renderWindow.y2; ++y) {
+            if ( _effect.abort() ) {
+                break;
+            }
+            _lut->apply(pix, renderWindow.x2 - renderWindow.x1, numChannels);
+            pix = (float *) ( (char *) pix + _dstRowBytes );
+        }
+
+        return;
+    }
     try {
         AutoSetAndRestoreThreadLocale locale;
         if (_proc) {
@@ -840,9 +1390,9 @@ GenericOCIO::getOrCreateProcessor(double time)
     string outputSpace;
     getOutputColorspaceAtTime(time, outputSpace);
     OCIO::ConstContextRcPtr context = getLocalContext(time);//_config->getCurrentContext();
-    setValues(context, inputSpace, outputSpace);
 
-    return getProcessor();
+    // don't call getProcessor() after setValues(): another thread may have published another snapshot meanwhile
+    return getProcessorSnapshot(context, inputSpace, outputSpace);
 }
 
 #endif // OFX_IO_USING_OCIO
@@ -1305,6 +1855,11 @@ GenericOCIO::purgeCaches()
 {
 #ifdef OFX_IO_USING_OCIO
     OCIO::ClearAllCaches();
+    OCIOProcessor::purgeBakedLUTs();
+    {
+        OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gProcessorCacheMutex);
+        gProcessorCache.clear();
+    }
 #endif
 }
 
@@ -35,10 +35,12 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 
 #include "ofxsImageEffect.h"
 #include "ofxsPixelProcessor.h"
 #include "ofxsMultiThread.h"
+#include "ofxsMacros.h"
 #ifndef OFX_USE_MULTITHREAD_MUTEX
 // some OFX hosts do not have mutex handling in the MT-Suite (e.g. Sony Catalyst Edit)
 // prefer using the fast mutex by Marcus Geelnard http://tinythreadpp.bitsnbites.eu/
@@ -58,6 +60,12 @@ class OpenGLBuilder;
 typedef OCIO_SHARED_PTR<OpenGLBuilder> OpenGLBuilderRcPtr;
 }
 #endif
+
+// OCIO 2 uses std::shared_ptr, which can be loaded and stored atomically in C++11.
+// Otherwise, the processor snapshot is swapped under a mutex.
+#if OCIO_VERSION_HEX >= 0x02000000 && ( __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900) )
+#define OFX_OCIO_ATOMIC_SNAPSHOT
+#endif
 #endif
 
 #include "IOUtility.h"
@@ -107,19 +115,23 @@ NAMESPACE_OFX_ENTER
 #define kOCIOParamContextValue4 "value4"
 
 #if defined(OFX_IO_USING_OCIO)
+#if OCIO_VERSION_HEX < 0x02000000
+struct OCIOGLProgram; // a compiled shader program, shared by all instances rendering in the same OpenGL context
+#endif
+
 class OCIOOpenGLContextData
 {
 public:
 #if OCIO_VERSION_HEX >= 0x02000000
     std::string processorCacheID;
-    OCIO_NAMESPACE::OpenGLBuilderRcPtr glBuilder;
+    OCIO_NAMESPACE::OpenGLBuilderRcPtr glBuilder; //!< shared by all instances using the same shader in the same OpenGL context
 #else
     std::vector<float> procLut3D;  //!< storage for the LUT3D so that the allocation of the LUT only occurs once.
     std::string procShaderCacheID;  //!< pass a string that will be used as a key to cache the shader so that internally the function may determine if generating and compiling the shader again is required. If the shader cache ID did not change, the shader passed by shaderProgramIDParam will be used as-is.
     std::string procLut3DCacheID;  //!< a string that will be used as a key to cache the LUT3D so that internally the function may determine if computing the LUT again is required. If the cache ID did not change, no call to glTexSubImage3D will be made
     unsigned int procLut3DID;  //!< ID of the texture 3D that will contain the LUT3D so that its allocation occurs only once, and subsequent calls only have to call glTexSubImage3D
-    unsigned int procShaderProgramID;  //!< the ID of the shader program that will be used to do the processing so that it is only compiled once. Note that to cache the shaderProgramID, you also need to set the procShaderCacheID parameter.
-    unsigned int procFragmentShaderID;  //!< the ID of the fragment shader program that will be used by the OCIO shader program
+    unsigned int procLut3DPBO;  //!< ID of the pixel buffer object used to upload the LUT3D asynchronously, or 0 if PBOs are not available
+    std::shared_ptr<OCIOGLProgram> procProgram;  //!< the shader program that will be used to do the processing, shared with other instances. Note that to cache the program, you also need to set the procShaderCacheID parameter.
 #endif
 
 public:
@@ -163,6 +175,25 @@ public:
     OCIO_NAMESPACE::ConstProcessorRcPtr getProcessor() const;
     OCIO_NAMESPACE::ConstProcessorRcPtr getOrCreateProcessor(double time);
 
+    // Process-wide processor cache, shared by all instances and plugins, bounded in size.
+    // A null context means the current context of the config.
+    static OCIO_NAMESPACE::ConstProcessorRcPtr getProcessorCached(const OCIO_NAMESPACE::ConstConfigRcPtr& config,
+                                                                  const OCIO_NAMESPACE::ConstContextRcPtr& context,
+                                                                  const char* srcName,
+                                                                  const char* dstName);
+    static OCIO_NAMESPACE::ConstProcessorRcPtr getProcessorCached(const OCIO_NAMESPACE::ConstConfigRcPtr& config,
+                                                                  const OCIO_NAMESPACE::ConstContextRcPtr& context,
+                                                                  const OCIO_NAMESPACE::ConstTransformRcPtr& transform,
+                                                                  OCIO_NAMESPACE::TransformDirection direction);
+    // For processors which are not built from a single transform: the key must identify the processor
+    // given the config and context, e.g. by listing all the parameters used to build it.
+    static OCIO_NAMESPACE::ConstProcessorRcPtr findProcessorCached(const OCIO_NAMESPACE::ConstConfigRcPtr& config,
+                                                                   const OCIO_NAMESPACE::ConstContextRcPtr& context,
+                                                                   const std::string& key);
+    static void insertProcessorCached(const OCIO_NAMESPACE::ConstConfigRcPtr& config,
+                                      const OCIO_NAMESPACE::ConstContextRcPtr& context,
+                                      const std::string& key,
+                                      const OCIO_NAMESPACE::ConstProcessorRcPtr& proc);
 #endif
     bool configIsDefault() const;
 
@@ -221,16 +252,44 @@ private:
 
     OCIO_NAMESPACE::ConstConfigRcPtr _config;
 
-    mutable Mutex _procMutex;
-    OCIO_NAMESPACE::ConstProcessorRcPtr _proc;
-    OCIO_NAMESPACE::ConstContextRcPtr _procContext;
-    std::string _procInputSpace;
-    std::string _procOutputSpace;
+    // The processor used for rendering, with the values it was built from.
+    // A snapshot is never modified once published: it is replaced when the config, the context
+    // or the colorspaces change, so that render threads can read it without locking.
+    struct ProcessorSnapshot
+    {
+        OCIO_NAMESPACE::ConstConfigRcPtr config;
+        OCIO_NAMESPACE::ConstContextRcPtr context;
+        std::string contextCacheID;
+        std::string inputSpace;
+        std::string outputSpace;
+        OCIO_NAMESPACE::ConstProcessorRcPtr proc;
+    };
+    typedef OCIO_SHARED_PTR<const ProcessorSnapshot> ProcessorSnapshotPtr;
+
+    ProcessorSnapshotPtr loadProcessorSnapshot() const;
+    void storeProcessorSnapshot(const ProcessorSnapshotPtr& snapshot) const;
+    OCIO_NAMESPACE::ConstProcessorRcPtr getProcessorSnapshot(const OCIO_NAMESPACE::ConstContextRcPtr &context, const std::string& inputSpace, const std::string& outputSpace) const;
+
+#ifndef OFX_OCIO_ATOMIC_SNAPSHOT
+    mutable Mutex _procMutex; //< only held while copying the snapshot pointer
+#endif
+    mutable ProcessorSnapshotPtr _procSnapshot;
     //OCIO_NAMESPACE::ConstTransformRcPtr _procTransform;
 #endif
 };
 
 #ifdef OFX_IO_USING_OCIO
+#define kOCIOParamBakeLUT "bakeLUT"
+#define kOCIOParamBakeLUTLabel "Bake to LUT"
+#define kOCIOParamBakeLUTHint \
+    "Apply the transform on the CPU using a 3D LUT sampled from the OCIO processor, instead of the OCIO processor itself. " \
+    "The LUT has a logarithmic shaper covering the values from 0 to 64, and values outside of this range are clamped. " \
+    "This is faster, especially for complex transforms, but less accurate (the GPU render uses a similar approximation). " \
+    "The LUT is computed once for each transform."
+
+class OCIOBakedLUT;
+class OCIOChannelLUT;
+
 class OCIOProcessor
     : public OFX::PixelProcessor
 {
@@ -240,6 +299,10 @@ public:
         : OFX::PixelProcessor(instance)
         , _proc()
         , _instance(&instance)
+        , _bakeLUT(false)
+        , _lut()
+        , _useChannelLUT(false)
+        , _channelLUT()
     {}
 
     // and do some processing
@@ -250,9 +313,32 @@ public:
         _proc = proc;
     }
 
+    // apply a 3D LUT baked from the processor (and cached), rather than the processor itself
+    void setBakeLUT(bool bakeLUT)
+    {
+        _bakeLUT = bakeLUT;
+    }
+
+    // apply a 1D LUT per channel sampled from the processor (and cached), if the processor has no channel crosstalk
+    // and the LUT gives the same result as the processor within tolerance. This is exact enough for log/lin conversions.
+    void setUseChannelLUT(bool useChannelLUT)
+    {
+        _useChannelLUT = useChannelLUT;
+    }
+
+    // clear the baked LUTs
+    static void purgeBakedLUTs();
+
 private:
+    // bake or fetch the LUT, before the processing threads are launched
+    virtual void preProcess() OVERRIDE FINAL;
+
     OCIO_NAMESPACE::ConstProcessorRcPtr _proc;
     OFX::ImageEffect* _instance;
+    bool _bakeLUT;
+    OCIO_SHARED_PTR<const OCIOBakedLUT> _lut;
+    bool _useChannelLUT;
+    OCIO_SHARED_PTR<const OCIOChannelLUT> _channelLUT;
 };
 #endif
 
@@ -33,6 +33,8 @@
 #define DBG(x) (void)0
 #endif
 #include <string>
+#include <list>
+#include <memory>
 #include <stdexcept>
 #include <ofxsParam.h>
 #include <ofxsImageEffect.h>
@@ -43,6 +45,17 @@
 // Use OpenGL function directly, no need to use ofxsOGLFunctions.h directly because we don't use OSMesa
 #include "glad.h"
 
+#if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
+// wglGetCurrentContext() is declared in windows.h, which is included by GenericOCIO.h
+#elif defined(__APPLE__)
+#include <OpenGL/OpenGL.h> // CGLGetCurrentContext
+#else
+// declared here rather than including GL/glx.h, which conflicts with glad.h
+extern "C" void* glXGetCurrentContext(void);
+#endif
+
+#include "fast_mutex.h" // the program cache is static, and can't use the OFX MT-Suite mutex
+
 #ifdef OFX_IO_USING_OCIO
 
 #if OCIO_VERSION_HEX >= 0x02000000
@@ -78,14 +91,112 @@ static const char * g_fragShaderText = ""
                                        "}\n";
 
 
+/*
+   Shader programs are shared by all the instances rendering in the same OpenGL context: each
+   OCIOOpenGLContextData holds a reference on the program it uses, and the process-wide cache only
+   holds weak references, keyed by OpenGL context and shader cache ID. The last contextData holding
+   a program deletes it, from contextDetached(), when that OpenGL context is current.
+ */
+
+// the OpenGL context which is current on this thread, or NULL if it can not be determined (no sharing is done in that case)
+static const void*
+currentGLContext()
+{
+#if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
+    return (const void*)wglGetCurrentContext();
+#elif defined(__APPLE__)
+    return (const void*)CGLGetCurrentContext();
+#else
+    return (const void*)glXGetCurrentContext();
+#endif
+}
+
+#if OCIO_VERSION_HEX >= 0x02000000
+typedef OCIO::OpenGLBuilder GLProgramObject;
+#else
+struct OCIOGLProgram
+{
+    GLuint programID;
+    GLuint fragShaderID;
+
+    OCIOGLProgram(GLuint programID_,
+                  GLuint fragShaderID_)
+        : programID(programID_)
+        , fragShaderID(fragShaderID_)
+    {
+    }
+
+    ~OCIOGLProgram()
+    {
+        if (fragShaderID != 0) {
+            glDeleteShader(fragShaderID);
+        }
+        if (programID != 0) {
+            glDeleteProgram(programID);
+        }
+    }
+};
+
+typedef OCIOGLProgram GLProgramObject;
+#endif
+
+struct GLProgramCacheEntry
+{
+    const void* glContext;
+    string shaderCacheID;
+    std::weak_ptr<GLProgramObject> program;
+};
+
+static std::list<GLProgramCacheEntry> gGLProgramCache;
+static tthread::fast_mutex gGLProgramCacheMutex;
+
+static std::shared_ptr<GLProgramObject>
+findGLProgramCached(const void* glContext,
+                    const string& shaderCacheID)
+{
+    if (!glContext) {
+        return std::shared_ptr<GLProgramObject>();
+    }
+    OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gGLProgramCacheMutex);
+    std::list<GLProgramCacheEntry>::iterator it = gGLProgramCache.begin();
+    while ( it != gGLProgramCache.end() ) {
+        if ( it->program.expired() ) {
+            // the program was deleted with the last contextData using it
+            it = gGLProgramCache.erase(it);
+        } else if ( (it->glContext == glContext) && (it->shaderCacheID == shaderCacheID) ) {
+            return it->program.lock();
+        } else {
+            ++it;
+        }
+    }
+
+    return std::shared_ptr<GLProgramObject>();
+}
+
+static void
+insertGLProgramCached(const void* glContext,
+                      const string& shaderCacheID,
+                      const std::shared_ptr<GLProgramObject>& program)
+{
+    if (!glContext) {
+        return;
+    }
+    OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gGLProgramCacheMutex);
+    GLProgramCacheEntry entry;
+    entry.glContext = glContext;
+    entry.shaderCacheID = shaderCacheID;
+    entry.program = program;
+    gGLProgramCache.push_front(entry);
+}
+
 OCIOOpenGLContextData::OCIOOpenGLContextData()
 #if OCIO_VERSION_HEX < 0x02000000
     : procLut3D()
     , procShaderCacheID()
     , procLut3DCacheID()
     , procLut3DID(0)
-    , procShaderProgramID(0)
-    , procFragmentShaderID(0)
+    , procLut3DPBO(0)
+    , procProgram()
 #endif
 {
     if ( !ofxsLoadOpenGLOnce() ) {
@@ -102,12 +213,10 @@ OCIOOpenGLContextData::~OCIOOpenGLContextData()
     if (procLut3DID != 0) {
         glDeleteTextures(1, &procLut3DID);
     }
-    if (procFragmentShaderID != 0) {
-        glDeleteShader(procFragmentShaderID);
-    }
-    if (procShaderProgramID != 0) {
-        glDeleteProgram(procShaderProgramID);
+    if (procLut3DPBO != 0) {
+        glDeleteBuffers(1, &procLut3DPBO);
     }
+    procProgram.reset();
 #endif
 }
 
@@ -191,6 +300,50 @@ allocateLut3D(GLuint* lut3dTexID,
                  LUT3D_EDGE_SIZE, LUT3D_EDGE_SIZE, LUT3D_EDGE_SIZE,
                  0, GL_RGB, GL_FLOAT, &(*lut3D)[0]);
 }
+
+// Compute the LUT3D and upload it to the texture. If pbo is not 0, the LUT is computed directly
+// into the pixel buffer object, and the transfer to the texture is done asynchronously by the driver.
+static void
+uploadLut3D(const OCIO::ConstProcessorRcPtr& processor,
+            const OCIO::GpuShaderDesc& shaderDesc,
+            GLuint lut3dTexID,
+            GLuint pbo,
+            std::vector<float>* lut3D)
+{
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_3D, lut3dTexID);
+    if (pbo != 0) {
+        const GLsizeiptr lut3DSize = sizeof(float) * 3 * LUT3D_EDGE_SIZE * LUT3D_EDGE_SIZE * LUT3D_EDGE_SIZE;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        // orphan the previous buffer storage, so that mapping does not wait for a pending transfer
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, lut3DSize, NULL, GL_STREAM_DRAW);
+        float* mapped = (float*)glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+        if (mapped) {
+            processor->getGpuLut3D(mapped, shaderDesc);
+            if ( glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) ) {
+                glTexSubImage3D(GL_TEXTURE_3D, 0,
+                                0, 0, 0,
+                                LUT3D_EDGE_SIZE, LUT3D_EDGE_SIZE, LUT3D_EDGE_SIZE,
+                                GL_RGB, GL_FLOAT, 0);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+                return;
+            }
+        }
+        // the buffer could not be mapped or its content was lost, use a synchronous upload
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    processor->getGpuLut3D(&(*lut3D)[0], shaderDesc);
+
+    /*for (std::size_t i = 0; i < lut3D->size(); ++i) {
+        assert((*lut3D)[i] == (*lut3D)[i] && (*lut3D)[i] != std::numeric_limits<float>::infinity());
+       }*/
+
+    glTexSubImage3D(GL_TEXTURE_3D, 0,
+                    0, 0, 0,
+                    LUT3D_EDGE_SIZE, LUT3D_EDGE_SIZE, LUT3D_EDGE_SIZE,
+                    GL_RGB, GL_FLOAT, &(*lut3D)[0]);
+}
 #endif
 
 #if defined(OFX_IO_USING_OCIO)
@@ -229,22 +382,30 @@ GenericOCIO::applyGL(const Texture* srcImg,
         // Step 2: Collect the shader program information for a specific processor
         gpuProc->extractGpuShaderInfo(shaderDesc);
 
-        // Step 3: Use the helper OpenGL builder
-        glBuilder = OCIO::OpenGLBuilder::Create(shaderDesc);
+        // Another instance may have already built the same program in this OpenGL context
+        const void* glContext = currentGLContext();
+        const string shaderCacheID = shaderDesc->getCacheID();
+        glBuilder = findGLProgramCached(glContext, shaderCacheID);
+        if (!glBuilder) {
+            // Step 3: Use the helper OpenGL builder
+            glBuilder = OCIO::OpenGLBuilder::Create(shaderDesc);
+
+            // Step 4: Allocate & upload all the LUTs
+            //
+            // NB: The start index for the texture indices is 1 as one texture
+            //     was already created for the input image.
+            //
+            glBuilder->allocateAllTextures(1);
+
+            // Step 5: Build the fragment shader program
+            glBuilder->buildProgram(g_fragShaderText, false);
+
+            insertGLProgramCached(glContext, shaderCacheID, glBuilder);
+        }
         if (contextData) {
             contextData->processorCacheID = processor->getCacheID();
             contextData->glBuilder = glBuilder;
         }
-
-        // Step 4: Allocate & upload all the LUTs
-        //
-        // NB: The start index for the texture indices is 1 as one texture
-        //     was already created for the input image.
-        //
-        glBuilder->allocateAllTextures(1);
-
-        // Step 5: Build the fragment shader program
-        glBuilder->buildProgram(g_fragShaderText, false);
     }
 
     glEnable(GL_TEXTURE_2D);
@@ -300,14 +461,22 @@ GenericOCIO::applyGL(const Texture* srcImg,
     if (contextData) {
         lut3dTexID = contextData->procLut3DID;
     }
+    GLuint lut3dPBO = 0;
     if (lut3D->size() == 0) {
         // The LUT was not allocated yet or the caller does not want to cache the lut
         // allocating at all
         allocateLut3D(&lut3dTexID, lut3D);
         if (contextData) {
-            contextData->procLut3DCacheID = lut3dTexID;
+            contextData->procLut3DID = lut3dTexID;
+            // pixel buffer objects are core since OpenGL 2.1
+            if (GLAD_GL_VERSION_2_1) {
+                glGenBuffers(1, &contextData->procLut3DPBO);
+            }
         }
     }
+    if (contextData) {
+        lut3dPBO = contextData->procLut3DPBO;
+    }
 
     glEnable(GL_TEXTURE_3D);
 
@@ -318,18 +487,7 @@ GenericOCIO::applyGL(const Texture* srcImg,
 
     if ( !contextData || (contextData->procLut3DCacheID != lut3dCacheID) ) {
         // Unfortunately the LUT3D is not cached yet, or caller does not want caching
-        processor->getGpuLut3D(&(*lut3D)[0], shaderDesc);
-
-        /*for (std::size_t i = 0; i < lut3D->size(); ++i) {
-            assert((*lut3D)[i] == (*lut3D)[i] && (*lut3D)[i] != std::numeric_limits<float>::infinity());
-           }*/
-
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_3D, lut3dTexID);
-        glTexSubImage3D(GL_TEXTURE_3D, 0,
-                        0, 0, 0,
-                        LUT3D_EDGE_SIZE, LUT3D_EDGE_SIZE, LUT3D_EDGE_SIZE,
-                        GL_RGB, GL_FLOAT, &(*lut3D)[0]);
+        uploadLut3D(processor, shaderDesc, lut3dTexID, lut3dPBO, lut3D);
 
         // update the cache ID
         if (contextData) {
@@ -348,27 +506,33 @@ GenericOCIO::applyGL(const Texture* srcImg,
     // The shader should be cached, to avoid generating it again
     string shaderCacheID = processor->getGpuShaderTextCacheID(shaderDesc);
 
-    GLuint programID;
-    GLuint fragShaderID;
-    if ( !contextData || (contextData->procShaderCacheID != shaderCacheID) ) {
-        // Unfortunately the shader is not cached yet, or caller does not want caching
-        string shaderString;
-        shaderString += processor->getGpuShaderText(shaderDesc);
-        shaderString += "\n";
-        shaderString += g_fragShaderText;
-
-        fragShaderID = compileShaderText( GL_FRAGMENT_SHADER, shaderString.c_str() );
-        programID = linkShaders(fragShaderID);
+    std::shared_ptr<OCIOGLProgram> program;
+    if ( !contextData || (contextData->procShaderCacheID != shaderCacheID) || !contextData->procProgram ) {
+        // The shader is not cached by this instance, maybe another instance compiled it in this OpenGL context
+        const void* glContext = currentGLContext();
+        program = findGLProgramCached(glContext, shaderCacheID);
+        if (!program) {
+            string shaderString;
+            shaderString += processor->getGpuShaderText(shaderDesc);
+            shaderString += "\n";
+            shaderString += g_fragShaderText;
+
+            GLuint fragShaderID = compileShaderText( GL_FRAGMENT_SHADER, shaderString.c_str() );
+            GLuint programID = linkShaders(fragShaderID);
+            program = std::make_shared<OCIOGLProgram>(programID, fragShaderID);
+            if (programID != 0) {
+                insertGLProgramCached(glContext, shaderCacheID, program);
+            }
+        }
         if (contextData) {
-            contextData->procShaderProgramID = programID;
-            contextData->procFragmentShaderID = fragShaderID;
+            contextData->procProgram = program;
             // update the cache ID
             contextData->procShaderCacheID = shaderCacheID;
         }
     } else {
-        programID = contextData->procShaderProgramID;
-        fragShaderID = contextData->procFragmentShaderID;
+        program = contextData->procProgram;
     }
+    GLuint programID = program->programID;
 
     // https://github.com/imageworks/OpenColorIO/blame/RB-1.1/src/apps/ociodisplay/main.cpp#L603
     glUseProgram(programID);
@@ -410,8 +574,7 @@ GenericOCIO::applyGL(const Texture* srcImg,
 
     if (!contextData) {
         glDeleteTextures(1, &lut3dTexID);
-        glDeleteProgram(programID);
-        glDeleteShader(fragShaderID);
+        // the program is deleted with the last reference to it
     }
 #endif // OCIO_VERSION_HEX >= 0x02000000
 } // GenericOCIO::applyGL
@@ -24,12 +24,24 @@
 
 #include "GenericReader.h"
 
+#include <atomic>
 #include <climits>
+#include <cstdio> // fread
+#include <cstring> // memcpy
 #include <cmath>
 #include <cfloat> // DBL_MAX
 #include <memory>
 #include <algorithm>
 #include <fstream>
+#include <map>
+#include <sys/types.h>
+#include <sys/stat.h> // stat
+#include <deque>
+#include <typeinfo>
+#if defined(__linux__) || defined(__FreeBSD__)
+#include <fcntl.h> // posix_fadvise
+#include <unistd.h> // close
+#endif
 #if defined(DEBUG) && defined(DEBUG_READER)
 #include <cstdio>
 #define DBG(x) x
@@ -45,6 +57,9 @@
 #include "ofxsCopier.h"
 #include "ofxsCoords.h"
 #include "ofxsMacros.h"
+#include "ofxsMultiThread.h"
+#include "ofxsFileOpen.h"
+#include "tinythread.h" // for tthread::thread and tthread::condition_variable
 
 #ifdef OFX_EXTENSIONS_TUTTLE
 #include <tuttle/ofxReadWrite.h>
@@ -57,6 +72,8 @@
 #include "GenericOCIO.h"
 #endif
 #include "IOUtility.h"
+#include "IOInstrumentation.h"
+#include "SequenceIndex.h"
 
 #ifdef OFX_IO_USING_OCIO
 namespace OCIO = OCIO_NAMESPACE;
@@ -105,6 +122,14 @@ NAMESPACE_OFX_IO_ENTER
 #define kParamOnMissingFrameHint \
     "What to do when a frame is missing from the sequence/stream."
 
+#define kParamPrefetchFrames "prefetchFrames"
+#define kParamPrefetchFramesLabel "Prefetch Frames"
+#define kParamPrefetchFramesHint \
+    "During playback, number of upcoming frames of the sequence which are read ahead in the background, " \
+    "so that they are already in the system cache when they are decoded. This is useful when reading from network storage. " \
+    "0 disables prefetching."
+#define kParamPrefetchFramesDefault 0
+
 #define kParamFrameMode "frameMode"
 #define kParamFrameModeLabel "Frame Mode"
 enum FrameModeEnum
@@ -257,6 +282,561 @@ premultString(PreMultiplicationEnum e)
     return "Unknown";
 }
 
+/**
+ * @brief The header cache, shared by all readers.
+ *
+ * It holds the result of getFrameBounds() and getFrameRate(), so that the actions which need them
+ * (getRegionOfDefinition, getClipPreferences, render...) don't reopen and parse the file every time.
+ * Since the result may depend on the reader parameters, entries belong to a reader instance.
+ * It also holds the format-specific file headers stored by the readers (see GenericReaderPlugin::getCachedFileHeader()),
+ * which only depend on the file and are shared by all instances of a reader.
+ * An entry is only valid as long as the file size and modification time don't change.
+ * Only successful results are cached.
+ **/
+class HeaderCache
+{
+public:
+    HeaderCache()
+        : _lock(NULL)
+        , _bounds()
+        , _fps()
+        , _fileHeaders()
+    {
+    }
+
+    ~HeaderCache()
+    {
+        delete _lock;
+    }
+
+    // Must be called before the cache is used (the mutex can't be created at static initialization time)
+    void initialize()
+    {
+        if (!_lock) {
+            _lock = new MultiThread::Mutex();
+        }
+    }
+
+    struct FrameBounds
+    {
+        OfxRectI bounds;
+        OfxRectI format;
+        double par;
+        int tileWidth;
+        int tileHeight;
+    };
+
+    bool getFrameBounds(const void* owner,
+                        const string& filename,
+                        OfxTime time,
+                        int view,
+                        FrameBounds* value)
+    {
+        FileStamp stamp;
+        if ( !getFileStamp(filename, &stamp) ) {
+            return false;
+        }
+        MultiThread::AutoMutex l(*_lock);
+        BoundsMap::const_iterator it = _bounds.find( BoundsKey(owner, filename, time, view) );
+        if ( ( it != _bounds.end() ) && (it->second.first == stamp) ) {
+            OFX_IO_COUNT("reader.headerCacheHits", 1);
+            *value = it->second.second;
+
+            return true;
+        }
+        OFX_IO_COUNT("reader.headerCacheMisses", 1);
+
+        return false;
+    }
+
+    void setFrameBounds(const void* owner,
+                        const string& filename,
+                        OfxTime time,
+                        int view,
+                        const FrameBounds& value)
+    {
+        FileStamp stamp;
+        if ( !getFileStamp(filename, &stamp) ) {
+            return;
+        }
+        MultiThread::AutoMutex l(*_lock);
+        if (_bounds.size() >= kHeaderCacheMaxEntries) {
+            _bounds.clear();
+        }
+        _bounds[BoundsKey(owner, filename, time, view)] = std::make_pair(stamp, value);
+    }
+
+    bool getFrameRate(const void* owner,
+                      const string& filename,
+                      double* fps)
+    {
+        FileStamp stamp;
+        if ( !getFileStamp(filename, &stamp) ) {
+            return false;
+        }
+        MultiThread::AutoMutex l(*_lock);
+        FpsMap::const_iterator it = _fps.find( std::make_pair(owner, filename) );
+        if ( ( it != _fps.end() ) && (it->second.first == stamp) ) {
+            OFX_IO_COUNT("reader.headerCacheHits", 1);
+            *fps = it->second.second;
+
+            return true;
+        }
+        OFX_IO_COUNT("reader.headerCacheMisses", 1);
+
+        return false;
+    }
+
+    void setFrameRate(const void* owner,
+                      const string& filename,
+                      double fps)
+    {
+        FileStamp stamp;
+        if ( !getFileStamp(filename, &stamp) ) {
+            return;
+        }
+        MultiThread::AutoMutex l(*_lock);
+        if (_fps.size() >= kHeaderCacheMaxEntries) {
+            _fps.clear();
+        }
+        _fps[std::make_pair(owner, filename)] = std::make_pair(stamp, fps);
+    }
+
+    bool getFileHeader(const string& reader,
+                       const string& filename,
+                       string* data)
+    {
+        FileStamp stamp;
+        if ( !getFileStamp(filename, &stamp) ) {
+            return false;
+        }
+        MultiThread::AutoMutex l(*_lock);
+        FileHeadersMap::const_iterator it = _fileHeaders.find( std::make_pair(reader, filename) );
+        if ( ( it != _fileHeaders.end() ) && (it->second.first == stamp) ) {
+            OFX_IO_COUNT("reader.headerCacheHits", 1);
+            *data = it->second.second;
+
+            return true;
+        }
+        OFX_IO_COUNT("reader.headerCacheMisses", 1);
+
+        return false;
+    }
+
+    void setFileHeader(const string& reader,
+                       const string& filename,
+                       const string& data)
+    {
+        FileStamp stamp;
+        if ( !getFileStamp(filename, &stamp) ) {
+            return;
+        }
+        MultiThread::AutoMutex l(*_lock);
+        if (_fileHeaders.size() >= kHeaderCacheMaxEntries) {
+            _fileHeaders.clear();
+        }
+        _fileHeaders[std::make_pair(reader, filename)] = std::make_pair(stamp, data);
+    }
+
+    /// remove all file headers stored by reader
+    void clearFileHeaders(const string& reader)
+    {
+        if (!_lock) {
+            return;
+        }
+        MultiThread::AutoMutex l(*_lock);
+        for (FileHeadersMap::iterator it = _fileHeaders.begin(); it != _fileHeaders.end(); ) {
+            if (it->first.first == reader) {
+                _fileHeaders.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    /// remove all entries belonging to owner
+    void clear(const void* owner)
+    {
+        if (!_lock) {
+            return;
+        }
+        MultiThread::AutoMutex l(*_lock);
+        for (BoundsMap::iterator it = _bounds.begin(); it != _bounds.end(); ) {
+            if (it->first.owner == owner) {
+                _bounds.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+        for (FpsMap::iterator it = _fps.begin(); it != _fps.end(); ) {
+            if (it->first.first == owner) {
+                _fps.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+private:
+    // no more than this many entries of each kind are kept, the cache is flushed when it's full
+    static const std::size_t kHeaderCacheMaxEntries = 100000;
+
+    struct FileStamp
+    {
+        long long size;
+        long long mtimeSec;
+        long long mtimeNSec; // 0 where the file system or the platform only has seconds
+
+        bool operator==(const FileStamp& other) const
+        {
+            return size == other.size && mtimeSec == other.mtimeSec && mtimeNSec == other.mtimeNSec;
+        }
+    };
+
+    static bool getFileStamp(const string& filename,
+                             FileStamp* stamp)
+    {
+#if defined(_WIN32)
+        struct _stat64 st;
+        if (_stat64(filename.c_str(), &st) != 0) {
+            return false;
+        }
+        stamp->size = (long long)st.st_size;
+        stamp->mtimeSec = (long long)st.st_mtime;
+        stamp->mtimeNSec = 0;
+#else
+        struct stat st;
+        if (stat(filename.c_str(), &st) != 0) {
+            return false;
+        }
+        stamp->size = (long long)st.st_size;
+#if defined(__APPLE__)
+        stamp->mtimeSec = (long long)st.st_mtimespec.tv_sec;
+        stamp->mtimeNSec = (long long)st.st_mtimespec.tv_nsec;
+#else
+        stamp->mtimeSec = (long long)st.st_mtim.tv_sec;
+        stamp->mtimeNSec = (long long)st.st_mtim.tv_nsec;
+#endif
+#endif
+
+        return true;
+    }
+
+    struct BoundsKey
+    {
+        BoundsKey(const void* owner_,
+                  const string& filename_,
+                  OfxTime time_,
+                  int view_)
+            : owner(owner_)
+            , filename(filename_)
+            , time(time_)
+            , view(view_)
+        {
+        }
+
+        bool operator<(const BoundsKey& other) const
+        {
+            if (owner != other.owner) {
+                return owner < other.owner;
+            }
+            if (time != other.time) {
+                return time < other.time;
+            }
+            if (view != other.view) {
+                return view < other.view;
+            }
+
+            return filename < other.filename;
+        }
+
+        const void* owner;
+        string filename;
+        OfxTime time;
+        int view;
+    };
+
+    typedef std::map<BoundsKey, std::pair<FileStamp, FrameBounds> > BoundsMap;
+    typedef std::map<std::pair<const void*, string>, std::pair<FileStamp, double> > FpsMap;
+    typedef std::map<std::pair<string, string>, std::pair<FileStamp, string> > FileHeadersMap;
+
+    MultiThread::Mutex* _lock;
+    BoundsMap _bounds;
+    FpsMap _fps;
+    FileHeadersMap _fileHeaders;
+};
+
+static HeaderCache gHeaderCache;
+
+#define kScratchPoolMaxBytes ( (std::size_t)512 * 1024 * 1024 ) // total size of the buffers kept by all the ScratchPools
+
+// total size of the buffers kept by all the ScratchPools of the process
+static std::atomic<std::size_t> gScratchPoolBytes(0);
+
+/**
+ * @brief A pool of temporary images, used by render() when the image can't be decoded directly to the output.
+ *
+ * Buffers are released to the pool instead of being freed, so that rendering a sequence doesn't allocate
+ * and free a frame-sized buffer for each plane of each frame. They are freed by purgeCaches().
+ * The buffers kept by all the instances may not exceed kScratchPoolMaxBytes: above that, released buffers are freed.
+ **/
+class GenericReaderPlugin::ScratchPool
+{
+public:
+    ScratchPool(ImageEffect* effect)
+        : _effect(effect)
+        , _mutex()
+        , _free()
+    {
+    }
+
+    ~ScratchPool()
+    {
+        clear();
+    }
+
+    /// Get a buffer of at least size bytes, which must be given back using release().
+    ImageMemory* acquire(size_t size,
+                         size_t* capacity)
+    {
+        {
+            MultiThread::AutoMutex l(_mutex);
+            // take the smallest buffer which is large enough, but not much larger
+            std::vector<Buffer>::iterator best = _free.end();
+            for (std::vector<Buffer>::iterator it = _free.begin(); it != _free.end(); ++it) {
+                if ( (it->size >= size) && (it->size <= 2 * size) && ( ( best == _free.end() ) || (it->size < best->size) ) ) {
+                    best = it;
+                }
+            }
+            if ( best != _free.end() ) {
+                ImageMemory* mem = best->mem;
+                *capacity = best->size;
+                gScratchPoolBytes -= best->size;
+                _free.erase(best);
+
+                return mem;
+            }
+        }
+        *capacity = size;
+
+        return new ImageMemory(size, _effect);
+    }
+
+    void release(ImageMemory* mem,
+                 size_t capacity)
+    {
+        MultiThread::AutoMutex l(_mutex);
+
+        // drop the smaller buffers of this pool while the limit would be exceeded
+        while ( !_free.empty() && (gScratchPoolBytes + capacity > kScratchPoolMaxBytes) ) {
+            std::vector<Buffer>::iterator smallest = _free.begin();
+            for (std::vector<Buffer>::iterator it = _free.begin(); it != _free.end(); ++it) {
+                if (it->size < smallest->size) {
+                    smallest = it;
+                }
+            }
+            if (smallest->size >= capacity) {
+                break;
+            }
+            gScratchPoolBytes -= smallest->size;
+            delete smallest->mem;
+            _free.erase(smallest);
+        }
+        if (gScratchPoolBytes.fetch_add(capacity) + capacity > kScratchPoolMaxBytes) {
+            gScratchPoolBytes -= capacity;
+            delete mem;
+
+            return;
+        }
+        Buffer b = { mem, capacity };
+        _free.push_back(b);
+    }
+
+    void clear()
+    {
+        MultiThread::AutoMutex l(_mutex);
+
+        for (std::vector<Buffer>::iterator it = _free.begin(); it != _free.end(); ++it) {
+            gScratchPoolBytes -= it->size;
+            delete it->mem;
+        }
+        _free.clear();
+    }
+
+private:
+    struct Buffer
+    {
+        ImageMemory* mem;
+        size_t size;
+    };
+
+    ImageEffect* _effect;
+    MultiThread::Mutex _mutex;
+    std::vector<Buffer> _free;
+};
+
+/// A buffer from the ScratchPool, locked and given back to the pool on destruction.
+class GenericReaderPlugin::ScratchBuffer
+{
+public:
+    ScratchBuffer(GenericReaderPlugin::ScratchPool& pool,
+                  size_t size)
+        : _pool(pool)
+        , _capacity(0)
+        , _mem( pool.acquire(size, &_capacity) )
+        , _data( _mem->lock() )
+    {
+    }
+
+    ~ScratchBuffer()
+    {
+        _mem->unlock();
+        _pool.release(_mem, _capacity);
+    }
+
+    void* data() const { return _data; }
+
+private:
+    GenericReaderPlugin::ScratchPool& _pool;
+    size_t _capacity;
+    ImageMemory* _mem;
+    void* _data;
+};
+
+/**
+ * @brief Reads files ahead in a background thread, so that they are in the system cache when they are decoded.
+ *
+ * Where posix_fadvise() is available, the system is only advised that the file will be needed (POSIX_FADV_WILLNEED),
+ * and reads it asynchronously. Elsewhere, the file is read and the data is discarded.
+ **/
+class GenericReaderPlugin::Prefetcher
+{
+public:
+    Prefetcher()
+        : _thread(NULL)
+        , _mutex()
+        , _cond()
+        , _queue()
+        , _recent()
+        , _quit(false)
+        , _lastTime(0.)
+        , _direction(1)
+    {
+    }
+
+    ~Prefetcher()
+    {
+        if (!_thread) {
+            return;
+        }
+        {
+            tthread::lock_guard<tthread::mutex> guard(_mutex);
+            _quit = true;
+            _cond.notify_all();
+        }
+        _thread->join();
+        delete _thread;
+    }
+
+    /// Return the playback direction (1 or -1), given by the time of the previous call.
+    int getDirection(OfxTime time)
+    {
+        tthread::lock_guard<tthread::mutex> guard(_mutex);
+
+        if (_thread) {
+            if (time < _lastTime) {
+                _direction = -1;
+            } else if (time > _lastTime) {
+                _direction = 1;
+            }
+        }
+        _lastTime = time;
+
+        return _direction;
+    }
+
+    /// Queue the given files, in order, skipping those that were recently prefetched.
+    void prefetch(const std::vector<string>& filenames)
+    {
+        tthread::lock_guard<tthread::mutex> guard(_mutex);
+
+        if (!_thread) {
+            _thread = new tthread::thread(threadFunction, this);
+        }
+
+        // the previous requests are obsolete
+        _queue.clear();
+        for (std::vector<string>::const_iterator it = filenames.begin(); it != filenames.end(); ++it) {
+            if ( std::find(_recent.begin(), _recent.end(), *it) != _recent.end() ) {
+                continue;
+            }
+            _recent.push_back(*it);
+            _queue.push_back(*it);
+        }
+        // only remember a bounded number of files
+        while (_recent.size() > kPrefetchRecentMax) {
+            _recent.pop_front();
+        }
+        if ( !_queue.empty() ) {
+            _cond.notify_all();
+        }
+    }
+
+private:
+    static const std::size_t kPrefetchRecentMax = 256;
+
+    static void threadFunction(void* arg)
+    {
+        Prefetcher* self = (Prefetcher*)arg;
+
+        for (;;) {
+            string filename;
+            {
+                tthread::lock_guard<tthread::mutex> guard(self->_mutex);
+                while ( !self->_quit && self->_queue.empty() ) {
+                    self->_cond.wait(self->_mutex);
+                }
+                if (self->_quit) {
+                    return;
+                }
+                filename = self->_queue.front();
+                self->_queue.pop_front();
+            }
+            readAhead(filename);
+        }
+    }
+
+    static void readAhead(const string& filename)
+    {
+#if defined(__linux__) || defined(__FreeBSD__)
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+#else
+        std::FILE* file = fopen_utf8(filename.c_str(), "rb");
+        if (!file) {
+            return;
+        }
+        std::vector<char> buf(1024 * 1024);
+        while (std::fread(&buf[0], 1, buf.size(), file) == buf.size()) {
+        }
+        std::fclose(file);
+#endif
+    }
+
+    tthread::thread* _thread; // started by the first call to prefetch()
+    tthread::mutex _mutex; // protects all members
+    tthread::condition_variable _cond;
+    std::deque<string> _queue; // files to prefetch
+    std::deque<string> _recent; // files recently queued, which need not be prefetched again
+    bool _quit;
+    OfxTime _lastTime;
+    int _direction;
+};
+
 GenericReaderPlugin::GenericReaderPlugin(OfxImageEffectHandle handle,
                                          const std::vector<string>& extensions,
                                          bool supportsRGBA,
@@ -293,6 +873,7 @@ GenericReaderPlugin::GenericReaderPlugin(OfxImageEffectHandle handle,
     , _customFPS(NULL)
     , _fps(NULL)
     , _sublabel(NULL)
+    , _prefetchFrames(NULL)
     , _guessedParams(NULL)
     , _extensions(extensions)
     , _supportsRGBA(supportsRGBA)
@@ -301,6 +882,8 @@ GenericReaderPlugin::GenericReaderPlugin(OfxImageEffectHandle handle,
     , _supportsAlpha(supportsAlpha)
     , _supportsTiles(supportsTiles)
     , _isMultiPlanar(isMultiPlanar)
+    , _prefetcher(NULL)
+    , _scratchPool(NULL)
 {
     _syncClip = fetchClip(kOfxImageEffectSimpleSourceClipName);
     _outputClip = fetchClip(kOfxImageEffectOutputClipName);
@@ -329,7 +912,10 @@ GenericReaderPlugin::GenericReaderPlugin(OfxImageEffectHandle handle,
         _sublabel = fetchStringParam(kNatronOfxParamStringSublabelName);
         assert(_sublabel);
     }
+    _prefetchFrames = fetchIntParam(kParamPrefetchFrames);
     _guessedParams = fetchBooleanParam(kParamGuessedParams);
+    _prefetcher = new Prefetcher();
+    _scratchPool = new ScratchPool(this);
 
 #ifdef OFX_IO_USING_OCIO
     _inputSpaceSet = fetchBooleanParam(kParamInputSpaceSet);
@@ -356,10 +942,113 @@ GenericReaderPlugin::GenericReaderPlugin(OfxImageEffectHandle handle,
         ++i;
     }
     _outputComponentsTable[i] = ePixelComponentNone;
+
+    gHeaderCache.initialize();
 }
 
 GenericReaderPlugin::~GenericReaderPlugin()
 {
+    delete _prefetcher;
+    delete _scratchPool;
+    gHeaderCache.clear(this);
+}
+
+void
+GenericReaderPlugin::prefetchFiles(OfxTime time,
+                                   const string& filename)
+{
+    int prefetchFrames = _prefetchFrames->getValue();
+
+    if (prefetchFrames <= 0) {
+        return;
+    }
+    const int direction = _prefetcher->getDirection(time);
+    std::vector<string> filenames;
+    for (int i = 1; i <= prefetchFrames; ++i) {
+        string nextFilename;
+        OfxStatus st = getFilenameAtTime(time + i * direction, &nextFilename);
+        // video files are a single file, which the reader handles by itself
+        if ( (st == kOfxStatOK) && !nextFilename.empty() && (nextFilename != filename) &&
+             ( std::find(filenames.begin(), filenames.end(), nextFilename) == filenames.end() ) ) {
+            filenames.push_back(nextFilename);
+        }
+    }
+    if ( filenames.empty() ) {
+        return;
+    }
+    _prefetcher->prefetch(filenames);
+}
+
+void
+GenericReaderPlugin::clearHeaderCache()
+{
+    gHeaderCache.clear(this);
+}
+
+bool
+GenericReaderPlugin::getCachedFileHeaderData(const string& filename,
+                                             string* data) const
+{
+    return gHeaderCache.getFileHeader(typeid(*this).name(), filename, data);
+}
+
+void
+GenericReaderPlugin::setCachedFileHeaderData(const string& filename,
+                                             const string& data) const
+{
+    gHeaderCache.setFileHeader(typeid(*this).name(), filename, data);
+}
+
+bool
+GenericReaderPlugin::getFrameBoundsCached(const string& filename,
+                                          OfxTime time,
+                                          int view,
+                                          OfxRectI *bounds,
+                                          OfxRectI *format,
+                                          double *par,
+                                          string *error,
+                                          int* tile_width,
+                                          int* tile_height)
+{
+    HeaderCache::FrameBounds value;
+
+    if ( gHeaderCache.getFrameBounds(this, filename, time, view, &value) ) {
+        *bounds = value.bounds;
+        *format = value.format;
+        *par = value.par;
+        *tile_width = value.tileWidth;
+        *tile_height = value.tileHeight;
+
+        return true;
+    }
+    value.par = 1.;
+    value.tileWidth = value.tileHeight = 0;
+    if ( !getFrameBounds(filename, time, view, &value.bounds, &value.format, &value.par, error, &value.tileWidth, &value.tileHeight) ) {
+        return false;
+    }
+    gHeaderCache.setFrameBounds(this, filename, time, view, value);
+    *bounds = value.bounds;
+    *format = value.format;
+    *par = value.par;
+    *tile_width = value.tileWidth;
+    *tile_height = value.tileHeight;
+
+    return true;
+}
+
+bool
+GenericReaderPlugin::getFrameRateCached(const string& filename,
+                                        double* fps) const
+{
+    if ( gHeaderCache.getFrameRate(this, filename, fps) ) {
+        return true;
+    }
+    if ( !getFrameRate(filename, fps) ) {
+        return false;
+    }
+    gHeaderCache.setFrameRate(this, filename, *fps);
+
+    return true;
 }
 
 void
@@ -504,13 +1193,22 @@ GenericReaderPlugin::getSequenceTimeDomainInternal(OfxRangeI& range,
                                                       &pattern);
 
 
-        SequenceParsing::SequenceFromPattern sequenceFromFiles;
-        SequenceParsing::filesListFromPattern_slow(pattern, &sequenceFromFiles);
-
         range.min = range.max = 1;
-        if (sequenceFromFiles.size() > 1) {
-            range.min = sequenceFromFiles.begin()->first;
-            range.max = sequenceFromFiles.rbegin()->first;
+        // the cached index avoids listing the directory each time
+        SequenceIndex::SequenceConstPtr sequence = SequenceIndex::getSequence(pattern);
+        if (sequence) {
+            if (sequence->size() > 1) {
+                range.min = sequence->firstFrame();
+                range.max = sequence->lastFrame();
+            }
+        } else {
+            SequenceParsing::SequenceFromPattern sequenceFromFiles;
+            SequenceParsing::filesListFromPattern_slow(pattern, &sequenceFromFiles);
+
+            if (sequenceFromFiles.size() > 1) {
+                range.min = sequenceFromFiles.begin()->first;
+                range.max = sequenceFromFiles.rbegin()->first;
+            }
         }
     }
 
@@ -760,6 +1458,23 @@ checkIfFileExists (const string& path)
 #endif
 }
 
+/**
+ * @brief check if a frame file exists, using the cached listing of its directory if possible.
+ * Missing frames are checked for each rendered frame, and probing the file itself is slow
+ * on network filesystems.
+ */
+static bool
+checkIfFrameFileExists(const string& path)
+{
+    bool exists;
+
+    if ( SequenceIndex::fileExists(path, &exists) ) {
+        return exists;
+    }
+
+    return checkIfFileExists(path);
+}
+
 GenericReaderPlugin::GetFilenameRetCodeEnum
 GenericReaderPlugin::getFilenameAtSequenceTime(double sequenceTime,
                                                bool proxyFiles,
@@ -788,7 +1503,7 @@ GenericReaderPlugin::getFilenameAtSequenceTime(double sequenceTime,
             return eGetFileNameBlack; // if filename is empty, just return a black frame. this happens eg when the plugin is created
         } else {
             if (checkForExistingFile) {
-                filenameGood = checkIfFileExists(*filename);
+                filenameGood = checkIfFrameFileExists(*filename);
             }
         }
         if (filenameGood) {
@@ -802,7 +1517,7 @@ GenericReaderPlugin::getFilenameAtSequenceTime(double sequenceTime,
                     proxyGood = false;
                 } else {
                     if (checkForExistingFile) {
-                        proxyGood = checkIfFileExists(proxyFileName);
+                        proxyGood = checkIfFrameFileExists(proxyFileName);
                     }
                 }
                 if (proxyGood) {
@@ -936,132 +1651,109 @@ GenericReaderPlugin::copyPixelData(const OfxRectI& renderWindow,
 #endif
 }
 
-// update the window of dst defined by nextRenderWindow by halving the corresponding area in src.
-// proofread and fixed by F. Devernay on 3/10/2014
-template <typename PIX>
-static void
-halveWindow(const OfxRectI& nextRenderWindow,
-            const PIX* srcPixels,
-            const OfxRectI& srcBounds,
-            int srcRowBytes,
-            PIX* dstPixels,
-            const OfxRectI& dstBounds,
-            int dstRowBytes,
-            int nComponents)
-{
-    int srcRowSize = srcRowBytes / sizeof(PIX);
-    int dstRowSize = dstRowBytes / sizeof(PIX);
-    const PIX* srcData =  srcPixels - (srcBounds.x1 * nComponents + srcRowSize * srcBounds.y1);
-    PIX* dstData = dstPixels - (dstBounds.x1 * nComponents + dstRowSize * dstBounds.y1);
-
-    assert(nextRenderWindow.x1 * 2 >= (srcBounds.x1 - 1) && (nextRenderWindow.x2 - 1) * 2 < srcBounds.x2 &&
-           nextRenderWindow.y1 * 2 >= (srcBounds.y1 - 1) && (nextRenderWindow.y2 - 1) * 2 < srcBounds.y2);
-    for (int y = nextRenderWindow.y1; y < nextRenderWindow.y2; ++y) {
-        const PIX* srcLineStart = srcData + y * 2 * srcRowSize;
-        PIX* dstLineStart = dstData + y * dstRowSize;
-        bool pickNextRow = (y * 2) < (srcBounds.y2 - 1);
-        bool pickThisRow = (y * 2) >= (srcBounds.y1);
-        int sumH = (int)pickNextRow + (int)pickThisRow;
-        assert(sumH == 1 || sumH == 2);
-        for (int x = nextRenderWindow.x1; x < nextRenderWindow.x2; ++x) {
-            bool pickNextCol = (x * 2) < (srcBounds.x2 - 1);
-            bool pickThisCol = (x * 2) >= (srcBounds.x1);
-            int sumW = (int)pickThisCol + (int)pickNextCol;
-            assert(sumW == 1 || sumW == 2);
-            for (int k = 0; k < nComponents; ++k) {
-                ///a b
-                ///c d
-
-                PIX a = (pickThisCol && pickThisRow) ? srcLineStart[x * 2 * nComponents + k] : 0;
-                PIX b = (pickNextCol && pickThisRow) ? srcLineStart[(x * 2 + 1) * nComponents + k] : 0;
-                PIX c = (pickThisCol && pickNextRow) ? srcLineStart[(x * 2 * nComponents) + srcRowSize + k] : 0;
-                PIX d = (pickNextCol && pickNextRow) ? srcLineStart[(x * 2 + 1) * nComponents + srcRowSize + k] : 0;
-
-                assert( sumW == 2 || ( sumW == 1 && ( (a == 0 && c == 0) || (b == 0 && d == 0) ) ) );
-                assert( sumH == 2 || ( sumH == 1 && ( (a == 0 && b == 0) || (c == 0 && d == 0) ) ) );
-                int sum = sumH * sumW;
-                // guard against division by zero
-                assert(sum);
-                dstLineStart[x * nComponents + k] = sum ? ( (a + b + c + d) / sum ) : 0;
-            }
-        }
+/**
+ * @brief Update the window of dst by a box filter of size 2^level over the corresponding area in src.
+ *
+ * This is done in a single pass, without building the intermediate mipmap levels.
+ * Each destination pixel is the average of the source pixels of its 2^level x 2^level block which are within the source bounds.
+ * Rows are processed by the host threads, and the inner loops are specialized for 1 to 4 components
+ * (nComponents = 0 means the number of components is only known at runtime).
+ **/
+template <typename PIX, int nComponents>
+class BoxReducerProcessor
+    : public PixelProcessor
+{
+public:
+    BoxReducerProcessor(ImageEffect &instance)
+        : PixelProcessor(instance)
+        , _srcPixelData(NULL)
+        , _srcBounds()
+        , _srcRowBytes(0)
+        , _nComps(nComponents)
+        , _level(0)
+    {
+        _srcBounds.x1 = _srcBounds.y1 = _srcBounds.x2 = _srcBounds.y2 = 0;
     }
-}
 
-template <typename PIX>
-static void
-buildMipMapLevelGeneric(ImageEffect* instance,
-                        const OfxRectI& originalRenderWindow,
-                        const OfxRectI& renderWindowFullRes,
-                        unsigned int level,
-                        const PIX* srcPixels,
-                        const OfxRectI& srcBounds,
-                        int srcRowBytes,
-                        PIX* dstPixels,
-                        const OfxRectI& dstBounds,
-                        int dstRowBytes,
-                        int nComponents)
-{
-    assert(level > 0);
+    void setValues(const PIX* srcPixelData,
+                   const OfxRectI& srcBounds,
+                   int srcRowBytes,
+                   int nComps,
+                   unsigned int level)
+    {
+        assert(nComponents == 0 || nComponents == nComps);
+        _srcPixelData = srcPixelData;
+        _srcBounds = srcBounds;
+        _srcRowBytes = srcRowBytes;
+        _nComps = nComps;
+        _level = level;
+    }
 
-    auto_ptr<ImageMemory> tmpMem;
-    size_t tmpMemSize = 0;
-    PIX* nextImg = NULL;
-    const PIX* previousImg = srcPixels;
-    OfxRectI previousBounds = srcBounds;
-    int previousRowBytes = srcRowBytes;
-    OfxRectI nextRenderWindow = renderWindowFullRes;
-
-    ///Build all the mipmap levels until we reach the one we are interested in
-    for (unsigned int i = 1; i < level; ++i) {
-        // loop invariant:
-        // - previousImg, previousBounds, previousRowBytes describe the data ate the level before i
-        // - nextRenderWindow contains the renderWindow at the level before i
-        //
-        ///Halve the smallest enclosing po2 rect as we need to render a minimum of the renderWindow
-        nextRenderWindow = downscalePowerOfTwoSmallestEnclosing(nextRenderWindow, 1);
-#     ifdef DEBUG
-        {
-            // check that doing i times 1 level is the same as doing i levels
-            OfxRectI nrw = downscalePowerOfTwoSmallestEnclosing(renderWindowFullRes, i);
-            assert(nrw.x1 == nextRenderWindow.x1 && nrw.x2 == nextRenderWindow.x2 && nrw.y1 == nextRenderWindow.y1 && nrw.y2 == nextRenderWindow.y2);
+private:
+    void multiThreadProcessImages(const OfxRectI& procWindow, const OfxPointD& rs) OVERRIDE FINAL
+    {
+        unused(rs);
+        const int nComps = nComponents ? nComponents : _nComps;
+        const int width = procWindow.x2 - procWindow.x1;
+        if ( (width <= 0) || (procWindow.y2 <= procWindow.y1) ) {
+            return;
         }
-#     endif
-        ///Allocate a temporary image if necessary, or reuse the previously allocated buffer
-        int nextRowBytes =  (nextRenderWindow.x2 - nextRenderWindow.x1)  * nComponents * sizeof(PIX);
-        size_t newMemSize =  (size_t)(nextRenderWindow.y2 - nextRenderWindow.y1) * (size_t)nextRowBytes;
-        if ( !tmpMem.get() ) {
-            // there should be enough memory: no need to reallocate
-            assert(tmpMemSize >= newMemSize);
-        } else {
-            tmpMem.reset( new ImageMemory(newMemSize, instance) );
-            tmpMemSize = newMemSize;
+        const int factor = 1 << _level; // coordinates may be negative, so don't shift them
+        assert(procWindow.x1 * factor < _srcBounds.x2 && procWindow.x2 * factor > _srcBounds.x1 &&
+               procWindow.y1 * factor < _srcBounds.y2 && procWindow.y2 * factor > _srcBounds.y1);
+
+        // the source columns of each destination pixel
+        std::vector<int> colBegin(width), colEnd(width);
+        for (int i = 0; i < width; ++i) {
+            const int x = procWindow.x1 + i;
+            colBegin[i] = (std::max)(x * factor, _srcBounds.x1);
+            colEnd[i] = (std::min)( (x + 1) * factor, _srcBounds.x2 );
+            assert(colBegin[i] < colEnd[i]);
         }
-        nextImg = (float*)tmpMem->lock();
+        std::vector<float> acc( (size_t)width * nComps );
 
-        halveWindow<PIX>(nextRenderWindow, previousImg, previousBounds, previousRowBytes, nextImg, nextRenderWindow, nextRowBytes, nComponents);
+        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
+            if ( _effect.abort() ) {
+                break;
+            }
+            const int rowBegin = (std::max)(y * factor, _srcBounds.y1);
+            const int rowEnd = (std::min)( (y + 1) * factor, _srcBounds.y2 );
+            assert(rowBegin < rowEnd);
+
+            std::fill(acc.begin(), acc.end(), 0.f);
+            for (int sy = rowBegin; sy < rowEnd; ++sy) {
+                const PIX* srcRow = (const PIX*)( (const char*)_srcPixelData + (size_t)(sy - _srcBounds.y1) * _srcRowBytes ) - (size_t)_srcBounds.x1 * nComps;
+                float* accPix = &acc[0];
+                for (int i = 0; i < width; ++i, accPix += nComps) {
+                    const PIX* srcPix = srcRow + (size_t)colBegin[i] * nComps;
+                    const PIX* srcEnd = srcRow + (size_t)colEnd[i] * nComps;
+                    for (; srcPix < srcEnd; srcPix += nComps) {
+                        for (int c = 0; c < nComps; ++c) {
+                            accPix[c] += srcPix[c];
+                        }
+                    }
+                }
+            }
 
-        ///Switch for next pass
-        previousBounds = nextRenderWindow;
-        previousRowBytes = nextRowBytes;
-        previousImg = nextImg;
+            PIX* dstPix = (PIX*)( (char*)_dstPixelData + (size_t)(y - _dstBounds.y1) * _dstRowBytes ) + (size_t)(procWindow.x1 - _dstBounds.x1) * nComps;
+            const float* accPix = &acc[0];
+            for (int i = 0; i < width; ++i, accPix += nComps, dstPix += nComps) {
+                const float norm = 1.f / ( (rowEnd - rowBegin) * (colEnd[i] - colBegin[i]) );
+                for (int c = 0; c < nComps; ++c) {
+                    dstPix[c] = (PIX)(accPix[c] * norm);
+                }
+            }
+        }
     }
-    // here:
-    // - previousImg, previousBounds, previousRowBytes describe the data ate the level before 'level'
-    // - nextRenderWindow contains the renderWindow at the level before 'level'
-
-    ///On the last iteration halve directly into the dstPixels
-    ///The nextRenderWindow should be equal to the original render window.
-    nextRenderWindow = downscalePowerOfTwoSmallestEnclosing(nextRenderWindow, 1);
-    assert(originalRenderWindow.x1 == nextRenderWindow.x1 && originalRenderWindow.x2 == nextRenderWindow.x2 &&
-           originalRenderWindow.y1 == nextRenderWindow.y1 && originalRenderWindow.y2 == nextRenderWindow.y2);
 
-    halveWindow<PIX>(nextRenderWindow, previousImg, previousBounds, previousRowBytes, dstPixels, dstBounds, dstRowBytes, nComponents);
-    // mem and tmpMem are freed at destruction
-} // buildMipMapLevelGeneric
+    const PIX* _srcPixelData;
+    OfxRectI _srcBounds;
+    int _srcRowBytes;
+    int _nComps;
+    unsigned int _level;
+};
 
 // update the window of dst defined by originalRenderWindow by mipmapping the windows of src defined by renderWindowFullRes
-// proofread and fixed by F. Devernay on 3/10/2014
 template <typename PIX, int nComponents>
 static void
 buildMipMapLevel(ImageEffect* instance,
@@ -1072,11 +1764,27 @@ buildMipMapLevel(ImageEffect* instance,
                  const OfxRectI& srcBounds,
                  int srcRowBytes,
                  PIX* dstPixels,
+                 const OfxPointD& renderScale,
+                 PixelComponentEnum dstPixelComponents,
+                 int dstPixelComponentCount,
                  const OfxRectI& dstBounds,
                  int dstRowBytes)
 {
-    buildMipMapLevelGeneric<PIX>(instance, originalRenderWindow, renderWindowFullRes, level, srcPixels, srcBounds, srcRowBytes
-                                 , dstPixels, dstBounds, dstRowBytes, nComponents);
+    assert(level > 0);
+    unused(renderWindowFullRes);
+#ifdef DEBUG
+    {
+        // the render window at full resolution should downscale to the original render window
+        OfxRectI nrw = downscalePowerOfTwoSmallestEnclosing(renderWindowFullRes, level);
+        assert(originalRenderWindow.x1 == nrw.x1 && originalRenderWindow.x2 == nrw.x2 &&
+               originalRenderWindow.y1 == nrw.y1 && originalRenderWindow.y2 == nrw.y2);
+    }
+#endif
+    BoxReducerProcessor<PIX, nComponents> processor(*instance);
+    processor.setDstImg(dstPixels, dstBounds, dstPixelComponents, dstPixelComponentCount, eBitDepthFloat, dstRowBytes);
+    processor.setValues(srcPixels, srcBounds, srcRowBytes, dstPixelComponentCount, level);
+    processor.setRenderWindow(originalRenderWindow, renderScale);
+    processor.process();
 }
 
 void
@@ -1097,7 +1805,7 @@ GenericReaderPlugin::scalePixelData(const OfxRectI& originalRenderWindow,
                                     const OfxRectI& dstBounds,
                                     int dstRowBytes)
 {
-    unused(renderScale);
+    OFX_IO_SCOPED_TIMER("reader.downscale");
     assert(srcPixelData && dstPixelData);
 
     // do the rendering
@@ -1122,7 +1830,7 @@ GenericReaderPlugin::scalePixelData(const OfxRectI& originalRenderWindow,
             return;
         }
         buildMipMapLevel<float, 4>(this, originalRenderWindow, renderWindow, levels, (const float*)srcPixelData,
-                                   srcBounds, srcRowBytes, (float*)dstPixelData, dstBounds, dstRowBytes);
+                                   srcBounds, srcRowBytes, (float*)dstPixelData, renderScale, dstPixelComponents, dstPixelComponentCount, dstBounds, dstRowBytes);
     } else if (dstPixelComponents == ePixelComponentRGB) {
         if (!_supportsRGB) {
             throwSuiteStatusException(kOfxStatErrFormat);
@@ -1130,7 +1838,7 @@ GenericReaderPlugin::scalePixelData(const OfxRectI& originalRenderWindow,
             return;
         }
         buildMipMapLevel<float, 3>(this, originalRenderWindow, renderWindow, levels, (const float*)srcPixelData,
-                                   srcBounds, srcRowBytes, (float*)dstPixelData, dstBounds, dstRowBytes);
+                                   srcBounds, srcRowBytes, (float*)dstPixelData, renderScale, dstPixelComponents, dstPixelComponentCount, dstBounds, dstRowBytes);
     } else if (dstPixelComponents == ePixelComponentXY) {
         if (!_supportsXY) {
             throwSuiteStatusException(kOfxStatErrFormat);
@@ -1138,7 +1846,7 @@ GenericReaderPlugin::scalePixelData(const OfxRectI& originalRenderWindow,
             return;
         }
         buildMipMapLevel<float, 2>(this, originalRenderWindow, renderWindow, levels, (const float*)srcPixelData,
-                                   srcBounds, srcRowBytes, (float*)dstPixelData, dstBounds, dstRowBytes);
+                                   srcBounds, srcRowBytes, (float*)dstPixelData, renderScale, dstPixelComponents, dstPixelComponentCount, dstBounds, dstRowBytes);
     }  else if (dstPixelComponents == ePixelComponentAlpha) {
         if (!_supportsAlpha) {
             throwSuiteStatusException(kOfxStatErrFormat);
@@ -1146,12 +1854,12 @@ GenericReaderPlugin::scalePixelData(const OfxRectI& originalRenderWindow,
             return;
         }
         buildMipMapLevel<float, 1>(this, originalRenderWindow, renderWindow, levels, (const float*)srcPixelData,
-                                   srcBounds, srcRowBytes, (float*)dstPixelData, dstBounds, dstRowBytes);
+                                   srcBounds, srcRowBytes, (float*)dstPixelData, renderScale, dstPixelComponents, dstPixelComponentCount, dstBounds, dstRowBytes);
     } else {
         assert(dstPixelComponents == ePixelComponentCustom);
 
-        buildMipMapLevelGeneric<float>(this, originalRenderWindow, renderWindow, levels, (const float*)srcPixelData,
-                                       srcBounds, srcRowBytes, (float*)dstPixelData, dstBounds, dstRowBytes, dstPixelComponentCount);
+        buildMipMapLevel<float, 0>(this, originalRenderWindow, renderWindow, levels, (const float*)srcPixelData,
+                                   srcBounds, srcRowBytes, (float*)dstPixelData, renderScale, dstPixelComponents, dstPixelComponentCount, dstBounds, dstRowBytes);
     }
 } // GenericReaderPlugin::scalePixelData
 
@@ -1285,6 +1993,7 @@ GenericReaderPlugin::premultPixelData(const OfxRectI &renderWindow,
                                       BitDepthEnum dstBitDepth,
                                       int dstRowBytes)
 {
+    OFX_IO_SCOPED_TIMER("reader.premult");
     assert(srcPixelData && dstPixelData);
 
     // do the rendering
@@ -1366,7 +2075,7 @@ GenericReaderPlugin::getRegionOfDefinition(const RegionOfDefinitionArguments &ar
     OfxRectI bounds, format;
     double par = 1.;
     int tile_width, tile_height;
-    bool success = getFrameBounds(filename, sequenceTime, args.view, &bounds, &format, &par, &error, &tile_width, &tile_height);
+    bool success = getFrameBoundsCached(filename, sequenceTime, args.view, &bounds, &format, &par, &error, &tile_width, &tile_height);
     if (!success) {
         setPersistentMessage(Message::eMessageError, "", error);
         throwSuiteStatusException(kOfxStatFailed);
@@ -1418,9 +2127,279 @@ public:
     }
 };
 
+// number of rows processed at once by PostDecodeProcessor, so that a block stays in cache between the steps
+#define kPostDecodeBlockRows 8
+
+/**
+ * @brief The processing applied to the decoded image, fused in a single pass.
+ *
+ * Each block of a few rows is unpremultiplied, color-converted and then premultiplied or copied
+ * to the destination image, before going to the next block, instead of doing a full pass over
+ * the image for each step.
+ * If the destination is the source image, the processing is done in place and the last step is skipped
+ * (this is used before downscaling).
+ **/
+class PostDecodeProcessor
+    : public PixelProcessor
+{
+public:
+    PostDecodeProcessor(ImageEffect &instance)
+        : PixelProcessor(instance)
+        , _srcPixelData(NULL)
+        , _srcBounds()
+        , _srcRowBytes(0)
+        , _nComps(0)
+        , _unpremult(false)
+        , _premult(false)
+#ifdef OFX_IO_USING_OCIO
+        , _proc()
+#endif
+    {
+        _srcBounds.x1 = _srcBounds.y1 = _srcBounds.x2 = _srcBounds.y2 = 0;
+    }
+
+    void setValues(float* srcPixelData,
+                   const OfxRectI& srcBounds,
+                   int srcRowBytes,
+                   int nComps,
+                   bool unpremult,
+                   bool premult)
+    {
+        _srcPixelData = srcPixelData;
+        _srcBounds = srcBounds;
+        _srcRowBytes = srcRowBytes;
+        _nComps = nComps;
+        _unpremult = unpremult;
+        _premult = premult;
+        assert( (!unpremult && !premult) || (nComps == 4) );
+    }
+
+#ifdef OFX_IO_USING_OCIO
+    void setProcessor(const OCIO::ConstProcessorRcPtr& proc)
+    {
+        _proc = proc;
+    }
+
+#endif
+
+private:
+    float* getSrcRow(int y) const
+    {
+        return (float*)( (char*)_srcPixelData + (size_t)(y - _srcBounds.y1) * _srcRowBytes ) + (size_t)(-_srcBounds.x1) * _nComps;
+    }
+
+    float* getDstRow(int y) const
+    {
+        return (float*)( (char*)_dstPixelData + (size_t)(y - _dstBounds.y1) * _dstRowBytes ) + (size_t)(-_dstBounds.x1) * _nComps;
+    }
+
+    void multiThreadProcessImages(const OfxRectI& procWindow, const OfxPointD& rs) OVERRIDE FINAL
+    {
+        unused(rs);
+        assert(_srcBounds.x1 <= procWindow.x1 && procWindow.x2 <= _srcBounds.x2 && _srcBounds.y1 <= procWindow.y1 && procWindow.y2 <= _srcBounds.y2);
+        if ( (procWindow.x2 <= procWindow.x1) || (procWindow.y2 <= procWindow.y1) ) {
+            return;
+        }
+        const bool inPlace = (_dstPixelData == _srcPixelData);
+#ifdef OFX_IO_USING_OCIO
+        auto_ptr<AutoSetAndRestoreThreadLocale> locale;
+#     if OCIO_VERSION_HEX >= 0x02000000
+        OCIO::ConstCPUProcessorRcPtr cpuproc;
+#     endif
+        if (_proc) {
+            locale.reset(new AutoSetAndRestoreThreadLocale);
+#     if OCIO_VERSION_HEX >= 0x02000000
+            cpuproc = _proc->getOptimizedCPUProcessor(OCIO::BIT_DEPTH_F32, OCIO::BIT_DEPTH_F32,
+                                                      OCIO::OPTIMIZATION_DEFAULT);
+#     endif
+        }
+#endif
+
+        for (int y1 = procWindow.y1; y1 < procWindow.y2; y1 += kPostDecodeBlockRows) {
+            if ( _effect.abort() ) {
+                break;
+            }
+            const int y2 = (std::min)(y1 + kPostDecodeBlockRows, procWindow.y2);
+
+            if (_unpremult) {
+                for (int y = y1; y < y2; ++y) {
+                    float* pix = getSrcRow(y) + (size_t)procWindow.x1 * 4;
+                    for (int x = procWindow.x1; x < procWindow.x2; ++x, pix += 4) {
+                        const float alpha = pix[3];
+                        if (alpha > 0.f) {
+                            pix[0] /= alpha;
+                            pix[1] /= alpha;
+                            pix[2] /= alpha;
+                        }
+                    }
+                }
+            }
+
+#ifdef OFX_IO_USING_OCIO
+            if (_proc) {
+                float* pix = getSrcRow(y1) + (size_t)procWindow.x1 * _nComps;
+                const int pixelBytes = _nComps * sizeof(float);
+                try {
+#                 if OCIO_VERSION_HEX >= 0x02000000
+                    OCIO::PackedImageDesc img(pix, procWindow.x2 - procWindow.x1, y2 - y1, _nComps,
+                                              OCIO::BIT_DEPTH_F32,  // For now, only float
+                                              sizeof(float), pixelBytes, _srcRowBytes);
+                    cpuproc->apply(img);
+#                 else
+                    OCIO::PackedImageDesc img(pix, procWindow.x2 - procWindow.x1, y2 - y1, _nComps, sizeof(float), pixelBytes, _srcRowBytes);
+                    _proc->apply(img);
+#                 endif
+                } catch (OCIO::Exception &e) {
+                    _effect.setPersistentMessage( Message::eMessageError, "", string("OpenColorIO error: ") + e.what() );
+                    throw std::runtime_error( string("OpenColorIO error: ") + e.what() );
+                }
+            }
+#endif
+
+            if (inPlace) {
+                continue;
+            }
+            for (int y = y1; y < y2; ++y) {
+                const float* srcPix = getSrcRow(y) + (size_t)procWindow.x1 * _nComps;
+                float* dstPix = getDstRow(y) + (size_t)procWindow.x1 * _nComps;
+                if (_premult) {
+                    for (int x = procWindow.x1; x < procWindow.x2; ++x, srcPix += 4, dstPix += 4) {
+                        const float alpha = srcPix[3];
+                        dstPix[0] = srcPix[0] * alpha;
+                        dstPix[1] = srcPix[1] * alpha;
+                        dstPix[2] = srcPix[2] * alpha;
+                        dstPix[3] = alpha;
+                    }
+                } else {
+                    std::memcpy( dstPix, srcPix, (size_t)(procWindow.x2 - procWindow.x1) * _nComps * sizeof(float) );
+                }
+            }
+        }
+    }
+
+    float* _srcPixelData;
+    OfxRectI _srcBounds;
+    int _srcRowBytes;
+    int _nComps;
+    bool _unpremult;
+    bool _premult;
+#ifdef OFX_IO_USING_OCIO
+    OCIO::ConstProcessorRcPtr _proc;
+#endif
+};
+
+// When the current thread decodes planes for a DecodePlanesProcessor, where messages can not be set,
+// setDecodeError() stores the error message here.
+static thread_local string* tDecodeErrorMessage = NULL;
+
+void
+GenericReaderPlugin::setDecodeError(const string& message)
+{
+    if (tDecodeErrorMessage) {
+        *tDecodeErrorMessage = message;
+
+        return;
+    }
+    setPersistentMessage(Message::eMessageError, "", message);
+}
+
+/**
+ * @brief Decodes several planes of the same frame directly to the output image, using the host threads.
+ * Each thread decodes whole planes, so that decodePlane() is never called concurrently on the same plane.
+ * The OFX API can not be used from these threads to set messages: the first error is recorded and
+ * reported by process() once all threads are done.
+ **/
+class GenericReaderPlugin::DecodePlanesProcessor
+    : public OFX::MultiThread::Processor
+{
+public:
+    DecodePlanesProcessor(GenericReaderPlugin& reader,
+                          const string& filename,
+                          OfxTime sequenceTime,
+                          const RenderArguments& args,
+                          const OfxPointD& decodeScale,
+                          const OfxRectI& bounds,
+                          const std::vector<std::pair<const PlaneToRender*, PixelComponentEnum> >& planes)
+        : _reader(reader)
+        , _filename(filename)
+        , _sequenceTime(sequenceTime)
+        , _args(args)
+        , _decodeScale(decodeScale)
+        , _bounds(bounds)
+        , _planes(planes)
+        , _statusMutex()
+        , _status(kOfxStatOK)
+        , _errorMessage()
+    {
+    }
+
+    void process()
+    {
+        unsigned int nThreads = (std::min)( (unsigned int)_planes.size(), OFX::MultiThread::getNumCPUs() );
+
+        multiThread(nThreads);
+        if (_status != kOfxStatOK) {
+            if ( !_errorMessage.empty() ) {
+                _reader.setPersistentMessage(Message::eMessageError, "", _errorMessage);
+            }
+            throwSuiteStatusException(_status);
+        }
+    }
+
+private:
+    virtual void multiThreadFunction(unsigned int threadID,
+                                     unsigned int nThreads) OVERRIDE FINAL
+    {
+        for (std::size_t i = threadID; i < _planes.size(); i += nThreads) {
+            {
+                OFX::MultiThread::AutoMutex lock(_statusMutex);
+                if (_status != kOfxStatOK) {
+                    return;
+                }
+            }
+            if ( _reader.abort() ) {
+                return;
+            }
+            const PlaneToRender& plane = *_planes[i].first;
+            string errorMessage;
+            OfxStatus status = kOfxStatOK;
+            tDecodeErrorMessage = &errorMessage;
+            try {
+                OFX_IO_SCOPED_TIMER("reader.decode");
+                _reader.decodePlane(_filename, _sequenceTime, _args.renderView, _args.sequentialRenderStatus, _args.renderWindow, _decodeScale, plane.pixelData, _bounds, plane.comps, _planes[i].second, plane.numChans, plane.rawComps, plane.rowBytes);
+            } catch (const OFX::Exception::Suite& e) {
+                status = e.status();
+            } catch (...) {
+                status = kOfxStatFailed;
+            }
+            tDecodeErrorMessage = NULL;
+            if (status != kOfxStatOK) {
+                OFX::MultiThread::AutoMutex lock(_statusMutex);
+                if (_status == kOfxStatOK) {
+                    _status = status;
+                    _errorMessage = errorMessage;
+                }
+            }
+        }
+    }
+
+    GenericReaderPlugin& _reader;
+    const string& _filename;
+    OfxTime _sequenceTime;
+    const RenderArguments& _args;
+    const OfxPointD _decodeScale;
+    const OfxRectI _bounds;
+    const std::vector<std::pair<const PlaneToRender*, PixelComponentEnum> >& _planes;
+    OFX::MultiThread::Mutex _statusMutex;
+    OfxStatus _status;
+    string _errorMessage; // the message of the first error
+};
+
 void
 GenericReaderPlugin::render(const RenderArguments &args)
 {
+    OFX_IO_SCOPED_TIMER("reader.render");
+
     if (!_outputClip) {
         throwSuiteStatusException(kOfxStatFailed);
 
@@ -1622,6 +2601,10 @@ GenericReaderPlugin::render(const RenderArguments &args)
         return;
     }
 
+    if (args.sequentialRenderStatus) {
+        prefetchFiles(args.time, filename);
+    }
+
     string proxyFile;
     if (useProxy) {
         ///Use the proxy only if getFilenameAtSequenceTime returned a valid proxy filename different from the original file
@@ -1669,7 +2652,7 @@ GenericReaderPlugin::render(const RenderArguments &args)
     }
     assert(downscaleLevels >= 0);
 
-    if ( filename.empty() || !checkIfFileExists(filename) ) {
+    if ( filename.empty() || !checkIfFrameFileExists(filename) ) {
         for (std::list<PlaneToRender>::iterator it = planes.begin(); it != planes.end(); ++it) {
             fillWithBlack(args.renderWindow, args.renderScale, it->pixelData, firstBounds, it->comps, it->numChans, firstDepth, it->rowBytes);
         }
@@ -1677,6 +2660,17 @@ GenericReaderPlugin::render(const RenderArguments &args)
         return;
     }
 
+    // If the file contains reduced resolution images, read the closest one to the render scale,
+    // so that only the remaining levels have to be downscaled.
+    unsigned int fileMipmapLevel = 0;
+    if ( kSupportsRenderScale && (downscaleLevels > 0) ) {
+        fileMipmapLevel = (std::min)( (unsigned int)downscaleLevels, getFileMipmapLevels(filename) );
+        downscaleLevels -= fileMipmapLevel;
+    }
+    OfxPointD decodeScale;
+    decodeScale.x = decodeScale.y = getScaleFromMipMapLevel(fileMipmapLevel);
+
+    // renderWindowFullRes is at the resolution of the decoded image (the file mipmap level)
     OfxRectI renderWindowFullRes, renderWindowNotRounded;
     OfxRectI frameBounds, format;
     double par = 1.;
@@ -1684,7 +2678,11 @@ GenericReaderPlugin::render(const RenderArguments &args)
     string error;
 
     ///if the plug-in doesn't support tiles, just render the full rod
-    bool success = getFrameBounds(filename, sequenceTime, args.renderView, &frameBounds, &format, &par, &error, &tile_width, &tile_height);
+    bool success;
+    {
+        OFX_IO_SCOPED_TIMER("reader.frameBounds");
+        success = getFrameBoundsCached(filename, sequenceTime, args.renderView, &frameBounds, &format, &par, &error, &tile_width, &tile_height);
+    }
     ///We shouldve checked above for any failure, now this is too late.
     if (!success) {
         setPersistentMessage(Message::eMessageError, "", error);
@@ -1692,6 +2690,7 @@ GenericReaderPlugin::render(const RenderArguments &args)
 
         return;
     }
+    frameBounds = downscalePowerOfTwoSmallestEnclosing(frameBounds, fileMipmapLevel);
 
     renderWindowFullRes = upscalePowerOfTwo(args.renderWindow, downscaleLevels); // works even if downscaleLevels == 0
 
@@ -1706,6 +2705,17 @@ GenericReaderPlugin::render(const RenderArguments &args)
     //See below: we round the render window to the tile size
     renderWindowNotRounded = renderWindowFullRes;
 
+    // At a lower render scale, the output image can also be decoded directly if the proxy file or the file mipmap level
+    // has the right scale, and the render window is within the decoded image (the proxy bounds may be rounded differently).
+    const bool canDecodeToDst = ( !kSupportsRenderScale || (renderMipmapLevel == 0) ||
+                                  ( (downscaleLevels == 0) &&
+                                    (frameBounds.x1 <= args.renderWindow.x1) && (args.renderWindow.x2 <= frameBounds.x2) &&
+                                    (frameBounds.y1 <= args.renderWindow.y1) && (args.renderWindow.y2 <= frameBounds.y2) ) );
+
+    // If the reader supports it, the planes that can be decoded directly to the output image are decoded in parallel
+    const bool concurrentDecode = _isMultiPlanar && (planes.size() > 1) && isDecodePlaneThreadSafe();
+    std::vector<std::pair<const PlaneToRender*, PixelComponentEnum> > directPlanes;
+
     for (std::list<PlaneToRender>::iterator it = planes.begin(); it != planes.end(); ++it) {
         // Read into a temporary image, apply colorspace conversion, then copy
         bool isOCIOIdentity = true;
@@ -1773,14 +2783,20 @@ GenericReaderPlugin::render(const RenderArguments &args)
                              ( (filePremult == eImageUnPreMultiplied || !isOCIOIdentity) && outputPremult == eImagePreMultiplied ) );
 
 
-        if ( !mustPremult && isOCIOIdentity && ( !kSupportsRenderScale || (renderMipmapLevel == 0) ) ) {
-            // no colorspace conversion, no premultiplication, no proxy, just read file
+        if ( !mustPremult && isOCIOIdentity && canDecodeToDst ) {
+            // no colorspace conversion, no premultiplication, no downscaling, just read the file
+            // (which may be a proxy or a reduced resolution level of the file) to the output image
             DBG( std::printf("decode (to dst)\n") );
 
-            if (!_isMultiPlanar) {
-                decode(filename, sequenceTime, args.renderView, args.sequentialRenderStatus, args.renderWindow, args.renderScale, it->pixelData, firstBounds, it->comps, it->numChans, it->rowBytes);
+            if (concurrentDecode) {
+                // decoded after the loop, together with the other planes
+                directPlanes.push_back( std::make_pair(&*it, remappedComponents) );
+            } else if (!_isMultiPlanar) {
+                OFX_IO_SCOPED_TIMER("reader.decode");
+                decode(filename, sequenceTime, args.renderView, args.sequentialRenderStatus, args.renderWindow, decodeScale, it->pixelData, firstBounds, it->comps, it->numChans, it->rowBytes);
             } else {
-                decodePlane(filename, sequenceTime, args.renderView, args.sequentialRenderStatus, args.renderWindow, args.renderScale, it->pixelData, firstBounds, it->comps, remappedComponents, it->numChans, it->rawComps, it->rowBytes);
+                OFX_IO_SCOPED_TIMER("reader.decode");
+                decodePlane(filename, sequenceTime, args.renderView, args.sequentialRenderStatus, args.renderWindow, decodeScale, it->pixelData, firstBounds, it->comps, remappedComponents, it->numChans, it->rawComps, it->rowBytes);
             }
         } else {
             int pixelBytes;
@@ -1827,43 +2843,79 @@ GenericReaderPlugin::render(const RenderArguments &args)
 
             int tmpRowBytes = (renderWindowFullRes.x2 - renderWindowFullRes.x1) * pixelBytes;
             size_t memSize = (size_t)(renderWindowFullRes.y2 - renderWindowFullRes.y1) * (size_t)tmpRowBytes;
-            ImageMemory mem(memSize, this);
-            float *tmpPixelData = (float*)mem.lock();
+            ScratchBuffer mem(*_scratchPool, memSize);
+            float *tmpPixelData = (float*)mem.data();
 
             // read file
             DBG( std::printf("decode (to tmp)\n") );
 
-            if (!_isMultiPlanar) {
-                decode(filename, sequenceTime, args.renderView, args.sequentialRenderStatus, renderWindowFullRes, args.renderScale, tmpPixelData, renderWindowFullRes, it->comps, it->numChans, tmpRowBytes);
-            } else {
-                decodePlane(filename, sequenceTime, args.renderView, args.sequentialRenderStatus, renderWindowFullRes, args.renderScale, tmpPixelData, renderWindowFullRes, it->comps, remappedComponents, it->numChans, it->rawComps, tmpRowBytes);
+            {
+                OFX_IO_SCOPED_TIMER("reader.decode");
+                if (!_isMultiPlanar) {
+                    decode(filename, sequenceTime, args.renderView, args.sequentialRenderStatus, renderWindowFullRes, decodeScale, tmpPixelData, renderWindowFullRes, it->comps, it->numChans, tmpRowBytes);
+                } else {
+                    decodePlane(filename, sequenceTime, args.renderView, args.sequentialRenderStatus, renderWindowFullRes, decodeScale, tmpPixelData, renderWindowFullRes, it->comps, remappedComponents, it->numChans, it->rawComps, tmpRowBytes);
+                }
             }
+            OFX_IO_COUNT("reader.decodedBytes", memSize);
 
             if ( abort() ) {
                 return;
             }
 
-            ///do the color-space conversion
+            // unpremult, color-space conversion and premult/copy are done in a single pass
+            const bool mustUnPremult = ( !isOCIOIdentity && isColor && (filePremult == eImagePreMultiplied) );
+            assert( !mustUnPremult || (remappedComponents == ePixelComponentRGBA) );
+            const bool mustScale = ( kSupportsRenderScale && (downscaleLevels > 0) );
+            if ( (firstDepth != eBitDepthFloat) || ( (mustUnPremult || mustPremult) && (it->numChans != 4) ) ) {
+                throwSuiteStatusException(kOfxStatErrFormat);
+
+                return;
+            }
+            PostDecodeProcessor processor(*this);
+#ifdef OFX_IO_USING_OCIO
             if ( !isOCIOIdentity && isColor ) {
-                if (filePremult == eImagePreMultiplied) {
-                    assert(remappedComponents == ePixelComponentRGBA);
-                    DBG( std::printf("unpremult (tmp in-place)\n") );
-                    //tmpPixelData[0] = tmpPixelData[1] = tmpPixelData[2] = tmpPixelData[3] = 0.5;
-                    unPremultPixelData(renderWindowNotRounded, args.renderScale, tmpPixelData, renderWindowFullRes, remappedComponents, it->numChans, firstDepth, tmpRowBytes, tmpPixelData, renderWindowFullRes, remappedComponents, it->numChans, firstDepth, tmpRowBytes);
+                if ( (remappedComponents != ePixelComponentRGBA) && (remappedComponents != ePixelComponentRGB) ) {
+                    setPersistentMessage(Message::eMessageError, "", "OCIO: invalid components (only RGB and RGBA are supported)");
+                    throwSuiteStatusException(kOfxStatFailed);
 
-                    if ( abort() ) {
-                        return;
-                    }
+                    return;
+                }
+                OCIO::ConstProcessorRcPtr proc = _ocio->getOrCreateProcessor(args.time);
+                if (!proc) {
+                    setPersistentMessage( Message::eMessageError, "", "Cannot create OCIO processor" );
+                    throwSuiteStatusException(kOfxStatFailed);
 
-                    //assert(tmpPixelData[0] == 1. && tmpPixelData[1] == 1. && tmpPixelData[2] == 1. && tmpPixelData[3] == 0.5);
+                    return;
                 }
-#ifdef OFX_IO_USING_OCIO
-                DBG( std::printf("OCIO (tmp in-place)\n") );
-                _ocio->apply(args.time, renderWindowFullRes, args.renderScale, tmpPixelData, renderWindowFullRes, remappedComponents, it->numChans, tmpRowBytes);
+                processor.setProcessor(proc);
+            }
 #endif
+            if (mustScale) {
+                // process in place, the downscaling is done afterwards
+                DBG( std::printf("unpremult+OCIO (tmp in-place)\n") );
+                if ( mustUnPremult || !isOCIOIdentity ) {
+                    processor.setDstImg(tmpPixelData, renderWindowFullRes, remappedComponents, it->numChans, firstDepth, tmpRowBytes);
+                    processor.setValues(tmpPixelData, renderWindowFullRes, tmpRowBytes, it->numChans, mustUnPremult, false);
+                    // the box filter reads the whole decoded image, which may be larger than the render window if it was rounded to tiles
+                    processor.setRenderWindow(renderWindowFullRes, args.renderScale);
+                    OFX_IO_SCOPED_TIMER("reader.colorConvert");
+                    processor.process();
+                }
+            } else {
+                DBG( std::printf("unpremult+OCIO+premult/copy (no scale, tmp to dst)\n") );
+                processor.setDstImg(it->pixelData, firstBounds, remappedComponents, it->numChans, firstDepth, it->rowBytes);
+                processor.setValues(tmpPixelData, renderWindowFullRes, tmpRowBytes, it->numChans, mustUnPremult, mustPremult);
+                processor.setRenderWindow(args.renderWindow, args.renderScale);
+                OFX_IO_SCOPED_TIMER("reader.colorConvert");
+                processor.process();
             }
 
-            if ( kSupportsRenderScale && (downscaleLevels > 0) ) {
+            if ( abort() ) {
+                return;
+            }
+
+            if (mustScale) {
                 if (!mustPremult) {
                     // we can write directly to dstPixelData
                     /// adjust the scale to match the given output image
@@ -1875,8 +2927,8 @@ GenericReaderPlugin::render(const RenderArguments &args)
                     // allocate a temporary image (we must avoid reading from dstPixelData, in case several threads are rendering the same area)
                     int mem2RowBytes = (firstBounds.x2 - firstBounds.x1) * pixelBytes;
                     size_t mem2Size = (size_t)(firstBounds.y2 - firstBounds.y1) * (size_t)mem2RowBytes;
-                    ImageMemory mem2(mem2Size, this);
-                    float *scaledPixelData = (float*)mem2.lock();
+                    ScratchBuffer mem2(*_scratchPool, mem2Size);
+                    float *scaledPixelData = (float*)mem2.data();
 
                     /// adjust the scale to match the given output image
                     DBG( std::printf("scale (tmp to scaled)\n") );
@@ -1892,25 +2944,17 @@ GenericReaderPlugin::render(const RenderArguments &args)
 
                     // apply premult
                     DBG( std::printf("premult (scaled to dst)\n") );
-                    //scaledPixelData[0] = scaledPixelData[1] = scaledPixelData[2] = 1.; scaledPixelData[3] = 0.5;
                     premultPixelData(args.renderWindow, args.renderScale, scaledPixelData, firstBounds, remappedComponents,  it->numChans, firstDepth, mem2RowBytes, it->pixelData, firstBounds, remappedComponents, it->numChans, firstDepth, it->rowBytes);
-                    //assert(dstPixelDataF[0] == 0.5 && dstPixelDataF[1] == 0.5 && dstPixelDataF[2] == 0.5 && dstPixelDataF[3] == 0.5);
-                }
-            } else {
-                // copy
-                if (mustPremult) {
-                    DBG( std::printf("premult (no scale, tmp to dst)\n") );
-                    //tmpPixelData[0] = tmpPixelData[1] = tmpPixelData[2] = 1.; tmpPixelData[3] = 0.5;
-                    premultPixelData(args.renderWindow, args.renderScale, tmpPixelData, renderWindowFullRes, remappedComponents, it->numChans, firstDepth, tmpRowBytes, it->pixelData, firstBounds, remappedComponents, it->numChans, firstDepth, it->rowBytes);
-                    //assert(dstPixelDataF[0] == 0.5 && dstPixelDataF[1] == 0.5 && dstPixelDataF[2] == 0.5 && dstPixelDataF[3] == 0.5);
-                } else {
-                    DBG( std::printf("copy (no premult no scale, tmp to dst)\n") );
-                    copyPixelData(args.renderWindow, args.renderScale, tmpPixelData, renderWindowFullRes, remappedComponents, it->numChans, firstDepth, tmpRowBytes, it->pixelData, firstBounds, remappedComponents, it->numChans, firstDepth, it->rowBytes);
                 }
             }
-            mem.unlock();
         }
     } // for (std::list<PlaneToRender>::iterator it = planes.begin(); it!=planes.end(); ++it) {
+
+    if ( !directPlanes.empty() ) {
+        DecodePlanesProcessor processor(*this, filename, sequenceTime, args, decodeScale, firstBounds, directPlanes);
+        processor.process();
+    }
+    OFX_IO_COUNT("reader.frames", 1);
 }
 
 void
@@ -1995,7 +3039,7 @@ GenericReaderPlugin::changedFilename(const InstanceChangedArgs &args)
     _customFPS->getValue(customFps);
     if (!customFps) {
         double fps;
-        bool gotFps = getFrameRate(filename, &fps);
+        bool gotFps = getFrameRateCached(filename, &fps);
         if (gotFps) {
             _fps->setValue(fps);
         }
@@ -2306,7 +3350,7 @@ GenericReaderPlugin::changedParam(const InstanceChangedArgs &args,
                 _fileParam->getValueAtTime(_firstFrame->getValue(), filename); // the time in _fileParam is the *file* time
 
                 double fps;
-                bool gotFps = getFrameRate(filename, &fps);
+                bool gotFps = getFrameRateCached(filename, &fps);
                 if  (gotFps) {
                     _fps->setValue(fps);
                 }
@@ -2418,7 +3462,7 @@ GenericReaderPlugin::getClipPreferences(ClipPreferencesSetter &clipPreferences)
             double par = 1.;
             string error;
             int tile_width, tile_height;
-            bool success = getFrameBounds(filename, timeDomain.min, /*view=*/0, &bounds, &format, &par, &error, &tile_width, &tile_height);
+            bool success = getFrameBoundsCached(filename, timeDomain.min, /*view=*/0, &bounds, &format, &par, &error, &tile_width, &tile_height);
             if (success) {
                 clipPreferences.setPixelAspectRatio(*_outputClip, par);
                 clipPreferences.setOutputFormat(format);
@@ -2432,7 +3476,7 @@ GenericReaderPlugin::getClipPreferences(ClipPreferencesSetter &clipPreferences)
                 _fps->getValue(fps);
                 clipPreferences.setOutputFrameRate(fps);
             } else {
-                success = getFrameRate(filename, &fps);
+                success = getFrameRateCached(filename, &fps);
                 if (success) {
                     clipPreferences.setOutputFrameRate(fps);
                 }
@@ -2444,6 +3488,9 @@ GenericReaderPlugin::getClipPreferences(ClipPreferencesSetter &clipPreferences)
 void
 GenericReaderPlugin::purgeCaches()
 {
+    clearHeaderCache();
+    gHeaderCache.clearFileHeaders( typeid(*this).name() );
+    _scratchPool->clear();
     clearAnyCache();
 #ifdef OFX_IO_USING_OCIO
     _ocio->purgeCaches();
@@ -2517,10 +3564,10 @@ GenericReaderPlugin::detectProxyScale(const string& originalFileName,
     string error;
     double originalPAR = 1., proxyPAR = 1.;
     int tile_width, tile_height;
-    bool success = getFrameBounds(originalFileName, time, /*view=*/0, &originalBounds, &originalFormat, &originalPAR, &error, &tile_width, &tile_height);
+    bool success = getFrameBoundsCached(originalFileName, time, /*view=*/0, &originalBounds, &originalFormat, &originalPAR, &error, &tile_width, &tile_height);
 
     proxyBounds.x1 = proxyBounds.x2 = proxyBounds.y1 = proxyBounds.y2 = 0.f;
-    success = success && getFrameBounds(proxyFileName, time, /*view=*/0, &proxyBounds, &proxyFormat, &proxyPAR, &error, &tile_width, &tile_height);
+    success = success && getFrameBoundsCached(proxyFileName, time, /*view=*/0, &proxyBounds, &proxyFormat, &proxyPAR, &error, &tile_width, &tile_height);
     OfxPointD ret;
     if ( !success ||
          (originalBounds.x1 == originalBounds.x2) ||
@@ -2834,6 +3881,7 @@ GenericReaderPlugin::convertDepthAndComponents(const void* srcPixelData,
                                                PixelComponentEnum dstPixelComponents,
                                                int dstRowBytes)
 {
+    OFX_IO_SCOPED_TIMER("reader.convert");
     switch (srcBitDepth) {
     case eBitDepthFloat:
         convertForDepth<float, 1>(this, (const float*)srcPixelData, renderWindow, renderScale, srcBounds, srcPixelComponents, srcRowBytes, dstPixelData, dstBounds, dstPixelComponents, dstRowBytes);
@@ -3079,6 +4127,20 @@ GenericReaderDescribeInContextBegin(ImageEffectDescriptor &desc,
         }
     }
 
+    {
+        IntParamDescriptor* param = desc.defineIntParam(kParamPrefetchFrames);
+        param->setLabel(kParamPrefetchFramesLabel);
+        param->setHint(kParamPrefetchFramesHint);
+        param->setRange(0, 100);
+        param->setDisplayRange(0, 10);
+        param->setDefault(kParamPrefetchFramesDefault);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
     ///////////Frame-mode
     {
         ChoiceParamDescriptor* param = desc.defineChoiceParam(kParamFrameMode);
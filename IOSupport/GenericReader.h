@@ -25,7 +25,9 @@
 #ifndef Io_GenericReader_h
 #define Io_GenericReader_h
 
+#include <cstring> // memcpy
 #include <memory>
+#include <string>
 #include <ofxsImageEffect.h>
 #include <ofxsMacros.h>
 #include "IOUtility.h"
@@ -186,6 +188,47 @@ protected:
                                    OFX::PixelComponentEnum dstPixelComponents,
                                    int dstRowBytes);
 
+    /**
+     * @brief Remove the header information cached for this instance (bounds, format, PAR, tile size and frame rate).
+     * Entries are already invalidated when the file size or modification time changes, so this only needs to be
+     * called when a parameter which affects the result of getFrameBounds() or getFrameRate() changes.
+     * This is also done by purgeCaches().
+     **/
+    void clearHeaderCache();
+
+    /**
+     * @brief Set the error message of a failed decode() or decodePlane(), before throwing.
+     * When planes are decoded concurrently (see isDecodePlaneThreadSafe()), decodePlane() runs on threads
+     * which can not set messages: the message is then set by render() once all planes are decoded.
+     **/
+    void setDecodeError(const std::string& message);
+
+    /**
+     * @brief Get or store a format-specific file header in the header cache, so that it is not parsed
+     * again by getFrameBounds() and decode(). HEADER must be trivially copyable.
+     * Headers are shared by all instances of the reader, and are only returned while the file size
+     * and modification time are unchanged. purgeCaches() removes them.
+     **/
+    template <class HEADER>
+    bool getCachedFileHeader(const std::string& filename,
+                             HEADER* header) const
+    {
+        std::string data;
+        if ( !getCachedFileHeaderData(filename, &data) || (data.size() != sizeof(HEADER)) ) {
+            return false;
+        }
+        std::memcpy( header, data.data(), sizeof(HEADER) );
+
+        return true;
+    }
+
+    template <class HEADER>
+    void setCachedFileHeader(const std::string& filename,
+                             const HEADER& header) const
+    {
+        setCachedFileHeaderData( filename, std::string(reinterpret_cast<const char*>(&header), sizeof(HEADER)) );
+    }
+
 private:
     /**
      * @brief Called when the input image/video file changed.
@@ -239,6 +282,23 @@ private:
      */
     virtual bool isTileOrientationTopDown() const { return true; }
 
+    /**
+     * @brief Override to return the number of reduced resolution levels (mipmaps) stored in the file,
+     * not counting the full resolution image, that decode() and decodePlane() can read directly.
+     * When rendering at a lower scale, the closest level that is not smaller than the render scale
+     * is then decoded, and the renderScale passed to decode() is the scale of that level
+     * (renderWindow and bounds are in the pixel coordinates of that level).
+     **/
+    virtual unsigned int getFileMipmapLevels(const std::string& /*filename*/) { return 0; }
+
+    /**
+     * @brief Override to return true if decodePlane() may be called concurrently for different planes
+     * of the same frame, e.g. because each call opens its own file handle.
+     * The planes that are decoded directly to the output image (no color-space conversion, premultiplication
+     * or scaling) are then decoded in parallel.
+     **/
+    virtual bool isDecodePlaneThreadSafe() const { return false; }
+
     virtual bool getFrameRate(const std::string& /*filename*/,
                               double* /*fps*/) const { return false; }
 
@@ -250,6 +310,7 @@ private:
      * You can always skip the color-space conversion, but for all linear hosts it would produce either
      * false colors or sub-par performances in the case the end-user has to append a color-space conversion
      * effect her/himself.
+     * The renderScale is 1, unless getFileMipmapLevels() returned a non-zero value.
      **/
     virtual void decode(const std::string& filename, OfxTime time, int view, bool isPlayback, const OfxRectI& renderWindow, const OfxPointD& renderScale, float *pixelData, const OfxRectI& bounds, OFX::PixelComponentEnum pixelComponents, int pixelComponentCount, int rowBytes);
     virtual void decodePlane(const std::string& filename, OfxTime time, int view, bool isPlayback, const OfxRectI& renderWindow, const OfxPointD& renderScale, float *pixelData, const OfxRectI& bounds,
@@ -435,6 +496,7 @@ private:
     OFX::DoubleParam* _fps;
 
     OFX::StringParam* _sublabel;
+    OFX::IntParam* _prefetchFrames;
     OFX::BooleanParam* _guessedParams;//!< was guessParamsFromFilename already successfully called once on this instance
 
     const std::vector<std::string>& _extensions;
@@ -448,6 +510,34 @@ private:
     const bool _isMultiPlanar;
 
     OFX::PixelComponentEnum _outputComponentsTable[5];
+
+    /// getFrameBounds() and getFrameRate(), through the header cache
+    bool getFrameBoundsCached(const std::string& filename,
+                              OfxTime time,
+                              int view,
+                              OfxRectI *bounds,
+                              OfxRectI *format,
+                              double *par,
+                              std::string *error,
+                              int* tile_width,
+                              int* tile_height);
+    bool getFrameRateCached(const std::string& filename,
+                            double* fps) const;
+    bool getCachedFileHeaderData(const std::string& filename,
+                                 std::string* data) const;
+    void setCachedFileHeaderData(const std::string& filename,
+                                 const std::string& data) const;
+
+    /// During playback, ask the system to read ahead the files of the next frames
+    void prefetchFiles(OfxTime time, const std::string& filename);
+
+    class DecodePlanesProcessor;
+    class Prefetcher;
+    Prefetcher* _prefetcher; //< its thread is started on the first playback render, if prefetching is enabled
+
+    class ScratchPool;
+    class ScratchBuffer;
+    ScratchPool* _scratchPool; //< temporary images used by render()
 };
 
 
@@ -25,10 +25,14 @@
 #include "GenericWriter.h"
 
 #include <cfloat> // DBL_MAX
+#include <cstddef> // ptrdiff_t
+#include <cstdio> // fwrite, rename
 #include <cstring> // memset
 #include <locale>
 #include <sstream>
 #include <algorithm>
+#include <deque>
+#include <set>
 
 #include "ofxsLog.h"
 #include "ofxsCopier.h"
@@ -43,10 +47,13 @@
 #include "ofxsFormatResolution.h"
 
 #include "SequenceParsing/SequenceParsing.h"
+#include "IOInstrumentation.h"
 #ifdef OFX_IO_USING_OCIO
 #include "GenericOCIO.h"
 #endif
 
+#include "tinythread.h" // for tthread::thread and tthread::condition_variable
+
 #ifdef OFX_IO_USING_OCIO
 namespace OCIO = OCIO_NAMESPACE;
 #endif
@@ -150,6 +157,16 @@ enum FormatTypeEnum
 #define kParamOutputComponentsLabel "Output Components"
 #define kParamOutputComponentsHint "Map the input layer to this type of components before writing it to the output file."
 
+#define kParamWriteBehind "writeBehind"
+#define kParamWriteBehindLabel "Write Behind"
+#define kParamWriteBehindHint "When checked, each file is encoded in memory and written to disk by a background thread, so that the next frame " \
+    "can be rendered while the previous ones are being written. This is useful when writing to a slow or networked storage. " \
+    "Each file is first written to a temporary file, which is then renamed, so that the final file is always complete. " \
+    "Rendering waits when too much data is waiting to be written. Write errors are reported at the end of the render."
+
+#define kWriteBehindThreads 4 // number of background threads writing files
+#define kWriteBehindMaxBytes ( (std::size_t)512 * 1024 * 1024 ) // total size of the files waiting to be written, above which encoding waits
+
 #define kParamGuessedParams "ParamExistingInstance" // was guessParamsFromFilename already successfully called once on this instance
 
 #ifdef OFX_IO_USING_OCIO
@@ -165,6 +182,241 @@ template<typename T>
 static inline void
 unused(const T&) {}
 
+/**
+ * @brief The queue of files encoded in memory, which are written to disk asynchronously
+ * by a bounded pool of threads. It is shared by all writer instances.
+ *
+ * Each file is written to a temporary file in the same directory, which is then renamed to
+ * the final filename, so that the final file is never seen incomplete. Write errors are
+ * accumulated per instance, and reported by GenericWriterPlugin::checkWriteBehindErrors().
+ * The files with the same name are written one at a time, in order, and a queued file which is
+ * not being written yet is replaced by a newer version of the same file.
+ * The threads exit when the queue is empty, and are joined by the next write() or by the destructor,
+ * so that no thread runs plugin code once the plugin is unloaded.
+ **/
+class WriteBehindQueue
+{
+public:
+    WriteBehindQueue()
+        : _nThreads(0)
+        , _mutex()
+        , _doneCond()
+        , _queue()
+        , _pendingBytes(0)
+        , _pending()
+        , _errors()
+        , _writing()
+        , _workers()
+    {
+    }
+
+    ~WriteBehindQueue()
+    {
+        tthread::lock_guard<tthread::mutex> guard(_mutex);
+
+        while (_nThreads > 0) {
+            _doneCond.wait(_mutex);
+        }
+        joinWorkers();
+    }
+
+    /// Queue the file, taking the content of buffer. Blocks while too much data is pending.
+    void write(const void* owner,
+               const string& filename,
+               vector<unsigned char>& buffer)
+    {
+        tthread::lock_guard<tthread::mutex> guard(_mutex);
+
+        // a previous version of the file which is not being written yet is replaced
+        for (std::deque<Job*>::iterator it = _queue.begin(); it != _queue.end(); ++it) {
+            if ( (*it)->filename == filename ) {
+                Job* previous = *it;
+                _queue.erase(it);
+                jobDone( previous, string() );
+                break;
+            }
+        }
+        // backpressure: wait for the previous files to be written, but always accept at least one file
+        while ( (_pendingBytes > 0) && (_pendingBytes + buffer.size() > kWriteBehindMaxBytes) ) {
+            _doneCond.wait(_mutex);
+        }
+        Job* job = new Job;
+        job->owner = owner;
+        job->filename = filename;
+        job->buffer.swap(buffer);
+        _pendingBytes += job->buffer.size();
+        ++_pending[owner];
+        _queue.push_back(job);
+        joinWorkers();
+        if (_nThreads < kWriteBehindThreads) {
+            ++_nThreads;
+            Worker* worker = new Worker;
+            worker->queue = this;
+            worker->done = false;
+            worker->thread = new tthread::thread(threadFunction, worker);
+            _workers.push_back(worker);
+        }
+    }
+
+    /// Get (and forget) the errors of the files written for owner. If wait is true, wait for all its files first.
+    bool getErrors(const void* owner,
+                   bool wait,
+                   string* errors)
+    {
+        tthread::lock_guard<tthread::mutex> guard(_mutex);
+
+        while ( wait && _pending.find(owner) != _pending.end() ) {
+            _doneCond.wait(_mutex);
+        }
+        std::map<const void*, string>::iterator it = _errors.find(owner);
+        if ( it == _errors.end() ) {
+            return false;
+        }
+        *errors = it->second;
+        _errors.erase(it);
+
+        return true;
+    }
+
+private:
+    struct Job
+    {
+        const void* owner;
+        string filename;
+        vector<unsigned char> buffer;
+    };
+
+    struct Worker
+    {
+        WriteBehindQueue* queue;
+        tthread::thread* thread;
+        bool done; // the thread function returned, or is returning
+    };
+
+    /// Account for a job which was written or dropped, and delete it. _mutex must be locked.
+    void jobDone(Job* job,
+                 const string& error)
+    {
+        _pendingBytes -= job->buffer.size();
+        std::map<const void*, int>::iterator it = _pending.find(job->owner);
+        assert( it != _pending.end() );
+        if (--it->second == 0) {
+            _pending.erase(it);
+        }
+        if ( !error.empty() ) {
+            string& errors = _errors[job->owner];
+            if ( !errors.empty() ) {
+                errors += '\n';
+            }
+            errors += error;
+        }
+        _doneCond.notify_all();
+        delete job;
+    }
+
+    /// Join and delete the threads which exited. _mutex must be locked.
+    void joinWorkers()
+    {
+        for (std::size_t i = 0; i < _workers.size();) {
+            Worker* worker = _workers[i];
+            if (worker->done) {
+                worker->thread->join();
+                delete worker->thread;
+                delete worker;
+                _workers.erase(_workers.begin() + i);
+            } else {
+                ++i;
+            }
+        }
+    }
+
+    static void threadFunction(void* arg)
+    {
+        Worker* worker = (Worker*)arg;
+        WriteBehindQueue* self = worker->queue;
+
+        for (;;) {
+            Job* job = NULL;
+            {
+                tthread::lock_guard<tthread::mutex> guard(self->_mutex);
+                // skip the files which are being written by another thread: that thread writes them next
+                for (std::deque<Job*>::iterator it = self->_queue.begin(); it != self->_queue.end(); ++it) {
+                    if ( self->_writing.find( (*it)->filename ) == self->_writing.end() ) {
+                        job = *it;
+                        self->_queue.erase(it);
+                        break;
+                    }
+                }
+                if (!job) {
+                    --self->_nThreads;
+                    worker->done = true;
+                    self->_doneCond.notify_all();
+
+                    return;
+                }
+                self->_writing.insert(job->filename);
+            }
+            string error;
+            writeFile(job->filename, job->buffer, &error);
+            {
+                tthread::lock_guard<tthread::mutex> guard(self->_mutex);
+                self->_writing.erase(job->filename);
+                self->jobDone(job, error);
+            }
+        }
+    }
+
+    static bool writeFile(const string& filename,
+                          const vector<unsigned char>& buffer,
+                          string* error)
+    {
+#if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
+        // rename() does not take UTF-8 filenames on Windows: write the final file directly
+        const string& tmpFilename = filename;
+#else
+        const string tmpFilename = filename + ".tmp";
+#endif
+        OFX_IO_SCOPED_TIMER("writer.writeFile");
+        std::FILE* file = fopen_utf8(tmpFilename.c_str(), "wb");
+        if (!file) {
+            *error = "Could not open file: " + tmpFilename;
+
+            return false;
+        }
+        bool ok = buffer.empty() || (std::fwrite(&buffer[0], 1, buffer.size(), file) == buffer.size());
+        ok = (std::fclose(file) == 0) && ok;
+        OFX_IO_COUNT("writer.writtenBytes", buffer.size());
+        if (!ok) {
+            *error = "Could not write file: " + tmpFilename;
+            OFX::remove_utf8( tmpFilename.c_str() );
+
+            return false;
+        }
+#if !(defined(_WIN32) || defined(__WIN32__) || defined(WIN32))
+        if (std::rename( tmpFilename.c_str(), filename.c_str() ) != 0) {
+            *error = "Could not rename " + tmpFilename + " to " + filename;
+            OFX::remove_utf8( tmpFilename.c_str() );
+
+            return false;
+        }
+#endif
+
+        return true;
+    }
+
+    int _nThreads; // number of running threads, started by write()
+    tthread::mutex _mutex; // protects all members
+    tthread::condition_variable _doneCond; // signaled when a job is done
+    std::deque<Job*> _queue; // files waiting to be written
+    std::size_t _pendingBytes; // size of the files queued or being written
+    std::map<const void*, int> _pending; // number of files queued or being written, per instance
+    std::map<const void*, string> _errors; // write errors, per instance
+    std::set<string> _writing; // files being written
+    vector<Worker*> _workers; // threads started by write(), joined once done
+};
+
+static WriteBehindQueue gWriteBehindQueue;
+
 
 GenericWriterPlugin::GenericWriterPlugin(OfxImageEffectHandle handle,
                                          const vector<string>& extensions,
@@ -186,6 +438,7 @@ GenericWriterPlugin::GenericWriterPlugin(OfxImageEffectHandle handle,
     , _outputFormatPar(NULL)
     , _premult(NULL)
     , _clipToRoD(NULL)
+    , _writeBehind(NULL)
     , _sublabel(NULL)
     , _processChannels()
     , _outputComponents(NULL)
@@ -222,6 +475,9 @@ GenericWriterPlugin::GenericWriterPlugin(OfxImageEffectHandle handle,
     if ( paramExists(kParamClipToRoD) ) {
         _clipToRoD = fetchBooleanParam(kParamClipToRoD);
     }
+    if ( paramExists(kParamWriteBehind) ) {
+        _writeBehind = fetchBooleanParam(kParamWriteBehind);
+    }
 
     if (gHostIsNatron) {
         _sublabel = fetchStringParam(kNatronOfxParamStringSublabelName);
@@ -279,6 +535,32 @@ GenericWriterPlugin::GenericWriterPlugin(OfxImageEffectHandle handle,
 
 GenericWriterPlugin::~GenericWriterPlugin()
 {
+    // the queued files must be written before the instance goes away, but errors can't be reported anymore
+    string errors;
+    gWriteBehindQueue.getErrors(this, /*wait=*/true, &errors);
+}
+
+bool
+GenericWriterPlugin::isWriteBehind(OfxTime time) const
+{
+    return _writeBehind && _writeBehind->getValueAtTime(time);
+}
+
+void
+GenericWriterPlugin::writeFileBehind(const string& filename,
+                                     vector<unsigned char>& buffer)
+{
+    gWriteBehindQueue.write(this, filename, buffer);
+}
+
+void
+GenericWriterPlugin::checkWriteBehindErrors(bool wait)
+{
+    string errors;
+    if ( gWriteBehindQueue.getErrors(this, wait, &errors) ) {
+        setPersistentMessage(Message::eMessageError, "", errors);
+        throwSuiteStatusException(kOfxStatFailed);
+    }
 }
 
 /**
@@ -409,6 +691,7 @@ GenericWriterPlugin::fetchPlaneConvertAndCopy(const string& plane,
                                               PixelComponentEnum* mappedComponents,
                                               int* mappedComponentsCount)
 {
+    OFX_IO_SCOPED_TIMER("writer.fetchAndConvert");
     *inputImage = 0;
     *tmpMem = 0;
     *tmpMemPtr = 0;
@@ -480,16 +763,29 @@ GenericWriterPlugin::fetchPlaneConvertAndCopy(const string& plane,
                                 renderWindow.y1 == bounds->y1 &&
                                 renderWindow.x2 == bounds->x2 &&
                                 renderWindow.y2 == bounds->y2;
+    bool renderWindowInBounds = renderWindow.x1 >= bounds->x1 &&
+                                renderWindow.y1 >= bounds->y1 &&
+                                renderWindow.x2 <= bounds->x2 &&
+                                renderWindow.y2 <= bounds->y2;
+
 
+    // forcing alpha to 1 requires a copy, unless the render window is the whole image (as before)
+    bool forceOpaque = (userPremult == eImageOpaque) && ( (srcMappedComponents == ePixelComponentRGBA) ||
+                                                          (srcMappedComponents == ePixelComponentAlpha) );
 
-    if ( renderWindowIsBounds &&
+    if ( renderWindowInBounds &&
+         ( renderWindowIsBounds || !forceOpaque ) &&
          isOCIOIdentity &&
          ( noPremult || ( userPremult == pluginExpectedPremult) ) ) {
-        // Render window is of the same size as the input image and we don't need to apply colorspace conversion
-        // or premultiplication operations.
+        // Render window is contained in the input image and we don't need to apply colorspace conversion
+        // or premultiplication operations: hand the host buffer directly to the encoder (zero-copy),
+        // starting at the bottom-left corner of the render window.
 
-        *tmpMemPtr = (float*)srcPixelData;
+        *tmpMemPtr = (float*)( (char*)srcPixelData +
+                               (ptrdiff_t)(renderWindow.y1 - bounds->y1) * srcRowBytes +
+                               (ptrdiff_t)(renderWindow.x1 - bounds->x1) * srcMappedComponentsCount * getComponentBytes(bitDepth) );
         *rowBytes = srcRowBytes;
+        *bounds = renderWindow;
 
         // copy to dstImg if necessary
         if ( (renderRequestedView == view) && _outputClip && _outputClip->isConnected() ) {
@@ -520,7 +816,7 @@ GenericWriterPlugin::fetchPlaneConvertAndCopy(const string& plane,
 
             // copy the source image (the writer is a no-op)
             copyPixelData( renderWindow, renderScale,
-                           srcPixelData,
+                           *tmpMemPtr,
                            renderWindow,
                            pixelComponents /* could also be srcMappedComponents */,
                            srcMappedComponentsCount,
@@ -647,6 +943,7 @@ GenericWriterPlugin::fetchPlaneConvertAndCopy(const string& plane,
 #         ifdef OFX_IO_USING_OCIO
             // do the color-space conversion
             if ( (srcMappedComponents == ePixelComponentRGB) || (srcMappedComponents == ePixelComponentRGBA) ) {
+                OFX_IO_SCOPED_TIMER("writer.colorConvert");
                 _ocio->apply(time, renderWindowClipped, renderScale, tmpPixelData, renderWindow, srcMappedComponents, srcMappedComponentsCount, tmpRowBytes);
             }
 #         endif
@@ -768,6 +1065,41 @@ struct ImageData
     int pixelComponentsCount;
 };
 
+// Returns true if the buffer of each plane covers the whole render window, in which case
+// the interleaved buffer doesn't need to be cleared before interleaving.
+static bool
+planesDataCoverRenderWindow(const std::list<ImageData>& planesData,
+                            const OfxRectI& renderWindow)
+{
+    for (std::list<ImageData>::const_iterator it = planesData.begin(); it != planesData.end(); ++it) {
+        if ( (it->bounds.x1 > renderWindow.x1) || (it->bounds.y1 > renderWindow.y1) ||
+             (it->bounds.x2 < renderWindow.x2) || (it->bounds.y2 < renderWindow.y2) ) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Returns true if the planes data consist of a single buffer which is already laid out as
+// the interleaved buffer would be, so that it can be passed directly to encodePart().
+static bool
+planesDataAreInterleaved(const std::list<ImageData>& planesData,
+                         const OfxRectI& renderWindow,
+                         int nChannels,
+                         int srcNCompsStartIndex)
+{
+    if (planesData.size() != 1) {
+        return false;
+    }
+    const ImageData& data = planesData.front();
+
+    return srcNCompsStartIndex == 0 &&
+           data.pixelComponentsCount == nChannels &&
+           data.bounds.x1 == renderWindow.x1 && data.bounds.y1 == renderWindow.y1 &&
+           data.bounds.x2 == renderWindow.x2 && data.bounds.y2 == renderWindow.y2;
+}
+
 void
 GenericWriterPlugin::getPackingOptions(bool *allCheckboxHidden,
                                        vector<int>* packingMapping) const
@@ -799,6 +1131,7 @@ GenericWriterPlugin::getPackingOptions(bool *allCheckboxHidden,
 void
 GenericWriterPlugin::render(const RenderArguments &args)
 {
+    OFX_IO_SCOPED_TIMER("writer.render");
     const double time = args.time;
 
     if ( !kSupportsRenderScale && ( (args.renderScale.x != 1.) || (args.renderScale.y != 1.) ) ) {
@@ -818,6 +1151,9 @@ GenericWriterPlugin::render(const RenderArguments &args)
         throwSuiteStatusException(kOfxStatFailed);
     }
 
+    // report the errors of the files previously written in the background
+    checkWriteBehindErrors(/*wait=*/false);
+
     string filename;
     _fileParam->getValueAtTime(time, filename);
     // filename = filenameFromPattern(filename, time);
@@ -1025,7 +1361,10 @@ GenericWriterPlugin::render(const RenderArguments &args)
         int dstNComps = doAnyPacking ? packingMapping.size() : data.pixelComponentsCount;
         int dstNCompsStartIndex = doAnyPacking ? packingMapping[0] : 0;
 
-        encode(filename, time, viewNames[0], data.srcPixelData, args.renderWindow, pixelAspectRatio, data.pixelComponentsCount, dstNCompsStartIndex, dstNComps, data.rowBytes);
+        {
+            OFX_IO_SCOPED_TIMER("writer.encode");
+            encode(filename, time, viewNames[0], data.srcPixelData, args.renderWindow, pixelAspectRatio, data.pixelComponentsCount, dstNCompsStartIndex, dstNComps, data.rowBytes);
+        }
     } else {
         /*
            Use the beginEncodeParts/encodePart/endEncodeParts API when there are multiple views/planes to render
@@ -1089,6 +1428,16 @@ GenericWriterPlugin::render(const RenderArguments &args)
 
                 return;
             }
+            if ( planesDataAreInterleaved(planesData, args.renderWindow, nChannels, doAnyPacking ? packingMapping[0] : 0) ) {
+                // a single plane with the right layout: no need to interleave, encode it directly
+                {
+                    OFX_IO_SCOPED_TIMER("writer.encode");
+                    beginEncodeParts(encodeData.getData(), filename, time, pixelAspectRatio, partsSplit, viewNames, actualPlanes, doAnyPacking && !packingContiguous, packingMapping, args.renderWindow);
+                    encodePart(encodeData.getData(), filename, planesData.front().srcPixelData, nChannels, 0, planesData.front().rowBytes);
+                }
+
+                break;
+            }
             int pixelBytes = nChannels * getComponentBytes(eBitDepthFloat);
             int tmpRowBytes = (args.renderWindow.x2 - args.renderWindow.x1) * pixelBytes;
             size_t memSize = (size_t)(args.renderWindow.y2 - args.renderWindow.y1) * (size_t)tmpRowBytes;
@@ -1100,8 +1449,10 @@ GenericWriterPlugin::render(const RenderArguments &args)
                 return;
             }
 
-            ///Set to 0 everywhere since the render window might be bigger than the src img bounds
-            std::memset(tmpMemPtr, 0, memSize);
+            ///Set to 0 everywhere if the render window is bigger than the src img bounds
+            if ( !planesDataCoverRenderWindow(planesData, args.renderWindow) ) {
+                std::memset(tmpMemPtr, 0, memSize);
+            }
 
             int interleaveIndex = 0;
             for (std::list<ImageData>::iterator it = planesData.begin(); it != planesData.end(); ++it) {
@@ -1132,8 +1483,11 @@ GenericWriterPlugin::render(const RenderArguments &args)
                 interleaveIndex += dstNComps;
             }
 
-            beginEncodeParts(encodeData.getData(), filename, time, pixelAspectRatio, partsSplit, viewNames, actualPlanes, doAnyPacking && !packingContiguous, packingMapping, args.renderWindow);
-            encodePart(encodeData.getData(), filename, tmpMemPtr, nChannels, 0, tmpRowBytes);
+            {
+                OFX_IO_SCOPED_TIMER("writer.encode");
+                beginEncodeParts(encodeData.getData(), filename, time, pixelAspectRatio, partsSplit, viewNames, actualPlanes, doAnyPacking && !packingContiguous, packingMapping, args.renderWindow);
+                encodePart(encodeData.getData(), filename, tmpMemPtr, nChannels, 0, tmpRowBytes);
+            }
 
             break;
         }
@@ -1185,6 +1539,21 @@ GenericWriterPlugin::render(const RenderArguments &args)
 
                     return;
                 }
+                if ( view == viewNames.begin() ) {
+                    {
+                        OFX_IO_SCOPED_TIMER("writer.encode");
+                        beginEncodeParts(encodeData.getData(), filename, time, pixelAspectRatio, partsSplit, viewNames, actualPlanes, doAnyPacking && !packingContiguous, packingMapping, args.renderWindow);
+                    }
+                }
+                if ( planesDataAreInterleaved(planesData, args.renderWindow, nChannels, doAnyPacking ? packingMapping[0] : 0) ) {
+                    // a single plane with the right layout: no need to interleave, encode it directly
+                    {
+                        OFX_IO_SCOPED_TIMER("writer.encode");
+                        encodePart(encodeData.getData(), filename, planesData.front().srcPixelData, nChannels, partIndex, planesData.front().rowBytes);
+                    }
+                    ++partIndex;
+                    continue;
+                }
                 int pixelBytes = nChannels * getComponentBytes(eBitDepthFloat);
                 int tmpRowBytes = (args.renderWindow.x2 - args.renderWindow.x1) * pixelBytes;
                 size_t memSize = (size_t)(args.renderWindow.y2 - args.renderWindow.y1) * (size_t)tmpRowBytes;
@@ -1196,8 +1565,10 @@ GenericWriterPlugin::render(const RenderArguments &args)
                     return;
                 }
 
-                ///Set to 0 everywhere since the render window might be bigger than the src img bounds
-                std::memset(tmpMemPtr, 0, memSize);
+                ///Set to 0 everywhere if the render window is bigger than the src img bounds
+                if ( !planesDataCoverRenderWindow(planesData, args.renderWindow) ) {
+                    std::memset(tmpMemPtr, 0, memSize);
+                }
 
                 int interleaveIndex = 0;
                 for (std::list<ImageData>::iterator it = planesData.begin(); it != planesData.end(); ++it) {
@@ -1228,12 +1599,11 @@ GenericWriterPlugin::render(const RenderArguments &args)
                     interleaveIndex += dstNComps;
                 }
 
-                if ( view == viewNames.begin() ) {
-                    beginEncodeParts(encodeData.getData(), filename, time, pixelAspectRatio, partsSplit, viewNames, actualPlanes, doAnyPacking && !packingContiguous, packingMapping, args.renderWindow);
+                {
+                    OFX_IO_SCOPED_TIMER("writer.encode");
+                    encodePart(encodeData.getData(), filename, tmpMemPtr, nChannels, partIndex, tmpRowBytes);
                 }
 
-                encodePart(encodeData.getData(), filename, tmpMemPtr, nChannels, partIndex, tmpRowBytes);
-
                 ++partIndex;
             }     // for each view
 
@@ -1274,10 +1644,16 @@ GenericWriterPlugin::render(const RenderArguments &args)
                 }     // for each plane
 
                 if ( view == viewNames.begin() ) {
-                    beginEncodeParts(encodeData.getData(), filename, time, pixelAspectRatio, partsSplit, viewNames, actualPlanes, doAnyPacking && !packingContiguous, packingMapping, args.renderWindow);
+                    {
+                        OFX_IO_SCOPED_TIMER("writer.encode");
+                        beginEncodeParts(encodeData.getData(), filename, time, pixelAspectRatio, partsSplit, viewNames, actualPlanes, doAnyPacking && !packingContiguous, packingMapping, args.renderWindow);
+                    }
                 }
                 for (vector<ImageData>::iterator it = datas.begin(); it != datas.end(); ++it) {
-                    encodePart(encodeData.getData(), filename, it->srcPixelData, it->pixelComponentsCount, partIndex, it->rowBytes);
+                    {
+                        OFX_IO_SCOPED_TIMER("writer.encode");
+                        encodePart(encodeData.getData(), filename, it->srcPixelData, it->pixelComponentsCount, partIndex, it->rowBytes);
+                    }
                     ++partIndex;
                 }
             }     // for each view
@@ -1287,9 +1663,18 @@ GenericWriterPlugin::render(const RenderArguments &args)
         } // switch
         ;
 
-        endEncodeParts( encodeData.getData() );
+        {
+            OFX_IO_SCOPED_TIMER("writer.encode");
+            endEncodeParts( encodeData.getData() );
+        }
     }
 
+    if (!args.sequentialRenderStatus) {
+        // not rendering a sequence: endSequenceRender may not be called, so wait for the file now
+        checkWriteBehindErrors(/*wait=*/true);
+    }
+
+    OFX_IO_COUNT("writer.frames", 1);
     clearPersistentMessage();
 } // GenericWriterPlugin::render
 
@@ -1670,6 +2055,9 @@ GenericWriterPlugin::endSequenceRender(const EndSequenceRenderArguments &args)
     }
 
     endEncode(args);
+
+    // wait for all the files written in the background
+    checkWriteBehindErrors(/*wait=*/true);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1767,6 +2155,7 @@ GenericWriterPlugin::premultPixelData(const OfxRectI &renderWindow,
                                       BitDepthEnum dstBitDepth,
                                       int dstRowBytes)
 {
+    OFX_IO_SCOPED_TIMER("writer.premult");
     assert(srcPixelData && dstPixelData);
 
     // do the rendering
@@ -2490,7 +2879,8 @@ GenericWriterDescribeInContextBegin(ImageEffectDescriptor &desc,
                                     bool supportsAlpha,
                                     const char* inputSpaceNameDefault,
                                     const char* outputSpaceNameDefault,
-                                    bool supportsDisplayWindow)
+                                    bool supportsDisplayWindow,
+                                    bool supportsWriteBehind)
 {
     gHostIsNatron = (getImageEffectHostDescription()->isNatron);
     if (gHostIsNatron) {
@@ -2839,6 +3229,19 @@ GenericWriterDescribeInContextBegin(ImageEffectDescriptor &desc,
         }
     }
 
+    /////////// Write behind
+    if (supportsWriteBehind) {
+        BooleanParamDescriptor* param = desc.defineBooleanParam(kParamWriteBehind);
+        param->setLabel(kParamWriteBehindLabel);
+        param->setHint(kParamWriteBehindHint);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        param->setDefault(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
     {
         BooleanParamDescriptor* param  = desc.defineBooleanParam(kParamGuessedParams);
         param->setEvaluateOnChange(false);
@@ -2861,5 +3264,134 @@ GenericWriterDescribeInContextEnd(ImageEffectDescriptor & /*desc*/,
 {
 }
 
+// band b is converted to buffers[b % buffers.size()]
+struct BandedWriter::Implementation
+{
+    Implementation(unsigned int nBuffers)
+        : mutex()
+        , cond()
+        , buffers(nBuffers)
+        , converted(nBuffers, -1)
+        , failed(nBuffers, 0)
+        , nextBand(0)
+        , writtenBands(0)
+        , stop(false)
+        , threads()
+    {
+    }
+
+    tthread::mutex mutex;
+    tthread::condition_variable cond;
+    vector<vector<unsigned char> > buffers;
+    vector<int> converted; // the band held by each buffer, or -1
+    vector<char> failed; // non-zero if converting the band held by the buffer threw an exception
+    int nextBand; // the next band to convert
+    int writtenBands; // the number of bands written
+    bool stop;
+    vector<tthread::thread*> threads;
+};
+
+BandedWriter::BandedWriter(int nRows,
+                           int rowsPerBand,
+                           unsigned int nThreads)
+    : _nRows(nRows)
+    , _rowsPerBand( (std::max)(rowsPerBand, 1) )
+    , _nBands( (nRows + _rowsPerBand - 1) / _rowsPerBand )
+    , _nThreads( (std::max)(1u, (std::min)( nThreads, (unsigned int)(std::max)(_nBands, 1) ) ) )
+    , _conversionFailed(false)
+    , _imp( new Implementation(_nThreads + 1) )
+{
+}
+
+BandedWriter::~BandedWriter()
+{
+    delete _imp;
+}
+
+void
+BandedWriter::workerFunction(void* arg)
+{
+    ( (BandedWriter*)arg )->work();
+}
+
+void
+BandedWriter::work()
+{
+    const int nBuffers = (int)_imp->buffers.size();
+
+    for (;;) {
+        int band;
+        {
+            tthread::lock_guard<tthread::mutex> guard(_imp->mutex);
+            // wait until the buffer of the next band was written
+            while ( !_imp->stop && (_imp->nextBand < _nBands) && (_imp->nextBand >= _imp->writtenBands + nBuffers) ) {
+                _imp->cond.wait(_imp->mutex);
+            }
+            if ( _imp->stop || (_imp->nextBand >= _nBands) ) {
+                return;
+            }
+            band = _imp->nextBand++;
+        }
+        // the buffer is not used by anyone else until it is marked as converted
+        vector<unsigned char>& buffer = _imp->buffers[band % nBuffers];
+        // an exception must not escape the thread (e.g. std::bad_alloc): the band is marked as failed instead
+        bool failed = false;
+        try {
+            convertBand( band, band * _rowsPerBand, (std::min)( (band + 1) * _rowsPerBand, _nRows ), buffer );
+        } catch (...) {
+            failed = true;
+        }
+        {
+            tthread::lock_guard<tthread::mutex> guard(_imp->mutex);
+            _imp->converted[band % nBuffers] = band;
+            _imp->failed[band % nBuffers] = failed;
+            _imp->cond.notify_all();
+        }
+    }
+}
+
+bool
+BandedWriter::process()
+{
+    const int nBuffers = (int)_imp->buffers.size();
+
+    for (unsigned int i = 0; i < _nThreads; ++i) {
+        _imp->threads.push_back( new tthread::thread(workerFunction, this) );
+    }
+    bool ok = true;
+    for (int band = 0; band < _nBands && ok; ++band) {
+        {
+            tthread::lock_guard<tthread::mutex> guard(_imp->mutex);
+            while (_imp->converted[band % nBuffers] != band) {
+                _imp->cond.wait(_imp->mutex);
+            }
+        }
+        if (_imp->failed[band % nBuffers]) {
+            _conversionFailed = true;
+            ok = false;
+        } else {
+            // the worker threads must be joined before returning, so exceptions are not propagated
+            try {
+                ok = writeBand( band, band * _rowsPerBand, (std::min)( (band + 1) * _rowsPerBand, _nRows ), _imp->buffers[band % nBuffers] );
+            } catch (...) {
+                ok = false;
+            }
+        }
+        {
+            tthread::lock_guard<tthread::mutex> guard(_imp->mutex);
+            _imp->writtenBands = band + 1;
+            _imp->stop = !ok;
+            _imp->cond.notify_all();
+        }
+    }
+    for (std::size_t i = 0; i < _imp->threads.size(); ++i) {
+        _imp->threads[i]->join();
+        delete _imp->threads[i];
+    }
+    _imp->threads.clear();
+
+    return ok;
+}
+
 NAMESPACE_OFX_IO_EXIT
 NAMESPACE_OFX_EXIT
@@ -26,6 +26,7 @@
 #define Io_GenericWriter_h
 
 #include <memory>
+#include <vector>
 #include <ofxsImageEffect.h>
 #include <ofxsMultiPlane.h>
 #include "IOUtility.h"
@@ -173,9 +174,10 @@ protected:
      * @param pixelDataNComps The number of components per pixel in pixelData
      * @param dstNCompsStartIndex The start index where the first component of dstNComps is to be read (in the range of pixelDataNComps)
      * @param dstNComps The desired number of components in the written file
-     * @param rowBytes The number of bytes in a row of pixelData.
-     * The following assert should hold true:
-     * assert(((bounds.x2 - bounds.x1) * pixelDataNComps * sizeof(float)) == rowBytes);
+     * @param rowBytes The number of bytes between two rows of pixelData.
+     * pixelData may point into the host image, whose rows can be longer than the bounds, so rows
+     * must always be addressed using rowBytes. The following assert should hold true:
+     * assert(((bounds.x2 - bounds.x1) * pixelDataNComps * sizeof(float)) <= rowBytes);
      *
      * @pre The filename has been validated against the supported file extensions.
      * You don't need to check this yourself.
@@ -251,6 +253,20 @@ protected:
      **/
     virtual bool displayWindowSupportedByFormat(const std::string& /*filename*/) const { return false; }
 
+    /**
+     * @brief Returns true if the files should be written asynchronously (see supportsWriteBehind in
+     * GenericWriterDescribeInContextBegin()). In that case, encode() should serialize the file into memory
+     * and pass it to writeFileBehind() instead of writing it to disk.
+     **/
+    bool isWriteBehind(OfxTime time) const;
+
+    /**
+     * @brief Queue a file that was encoded in memory, to be written to filename by a background thread.
+     * The content of buffer is taken (buffer is empty on return).
+     * This blocks if too much data is already waiting to be written.
+     **/
+    void writeFileBehind(const std::string& filename, std::vector<unsigned char>& buffer);
+
 
     OFX::Clip* _inputClip; //< Mantated input clip
     OFX::Clip *_outputClip; //< Mandated output clip
@@ -265,6 +281,7 @@ protected:
     OFX::DoubleParam* _outputFormatPar;
     OFX::ChoiceParam* _premult;
     OFX::BooleanParam* _clipToRoD;
+    OFX::BooleanParam* _writeBehind;
 
     OFX::StringParam* _sublabel;
     OFX::BooleanParam* _processChannels[4];
@@ -369,6 +386,12 @@ protected:
 
     void getSelectedOutputFormat(OfxRectI* format, double* par);
 
+    /**
+     * @brief Report the errors of the files written asynchronously by this instance, if any.
+     * If wait is true, wait until all pending files are written.
+     **/
+    void checkWriteBehindErrors(bool wait);
+
     void refreshRGBAParamsFromOutputComponents();
 
 private:
@@ -532,6 +555,57 @@ public:
     void* getData() const { return data; }
 };
 
+/**
+ * @brief A pipeline which converts an image by horizontal bands of rows and writes them in order,
+ * so that the converted image never needs to be held in memory.
+ *
+ * Bands are converted by worker threads while the previous bands are written by the thread calling
+ * process(). Each worker converts a whole band, and at most nThreads + 1 band buffers are allocated.
+ * writeBand() is always called from the thread calling process(), so that it may use setjmp/longjmp
+ * (e.g. with libpng).
+ **/
+class BandedWriter
+{
+public:
+    BandedWriter(int nRows,
+                 int rowsPerBand,
+                 unsigned int nThreads);
+
+    virtual ~BandedWriter();
+
+    /// Convert and write all the bands. Returns false if a band could not be converted or writeBand() failed.
+    bool process();
+
+    int getNBands() const { return _nBands; }
+
+    /// true if process() failed because convertBand() threw an exception (e.g. std::bad_alloc)
+    bool isConversionError() const { return _conversionFailed; }
+
+protected:
+    /// Convert rows [rowBegin, rowEnd) of band to buffer, which may be resized. Called from a worker thread.
+    /// If it throws, the band is not written and process() returns false.
+    virtual void convertBand(int band, int rowBegin, int rowEnd, std::vector<unsigned char>& buffer) = 0;
+
+    /// Write a converted band. Bands are written in order. Returns false to stop writing.
+    virtual bool writeBand(int band, int rowBegin, int rowEnd, const std::vector<unsigned char>& buffer) = 0;
+
+private:
+    struct Implementation;
+
+    static void workerFunction(void* arg);
+    void work();
+
+    const int _nRows;
+    const int _rowsPerBand;
+    const int _nBands;
+    const unsigned int _nThreads;
+    bool _conversionFailed;
+    Implementation* _imp;
+
+    BandedWriter(const BandedWriter&); // non-copyable
+    BandedWriter& operator=(const BandedWriter&);
+};
+
 void GenericWriterDescribe(OFX::ImageEffectDescriptor &desc,
                            OFX::RenderSafetyEnum safety,
                            const std::vector<std::string>& extensions,
@@ -547,7 +621,8 @@ OFX::PageParamDescriptor* GenericWriterDescribeInContextBegin(OFX::ImageEffectDe
                                                               bool supportsAlpha,
                                                               const char* inputSpaceNameDefault,
                                                               const char* outputSpaceNameDefault,
-                                                              bool supportsDisplayWindow);
+                                                              bool supportsDisplayWindow,
+                                                              bool supportsWriteBehind);
 
 void GenericWriterDescribeInContextEnd(OFX::ImageEffectDescriptor &desc,
                                        OFX::ContextEnum context,
@@ -0,0 +1,333 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of openfx-io <https://github.com/NatronGitHub/openfx-io>,
+ * (C) 2018-2021 The Natron Developers
+ * (C) 2013-2018 INRIA
+ *
+ * openfx-io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * openfx-io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openfx-io.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+/*
+ * OFX IO instrumentation.
+ * Scoped timers and counters around the stages of the reader and writer pipelines.
+ */
+
+#include "IOInstrumentation.h"
+
+#ifdef OFX_IO_INSTRUMENTATION
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
+#include <process.h> // _getpid
+#else
+#include <unistd.h> // getpid
+#endif
+
+#include "ofxsMultiThread.h"
+
+#include "fast_mutex.h" // the instrumentation state is static, and can't use the OFX MT-Suite mutex
+
+#define kInstrumentationTraceFileEnv "OFX_IO_TRACE_FILE"
+#define kInstrumentationStatsFileEnv "OFX_IO_STATS_FILE"
+#define kInstrumentationMaxTraceEvents (1 << 20) // per thread, about 24MB
+
+using std::string;
+
+NAMESPACE_OFX_ENTER
+NAMESPACE_OFX_IO_ENTER
+
+namespace Instrumentation {
+namespace {
+struct TraceEvent
+{
+    const char* name;
+    unsigned long long begin;
+    unsigned long long duration;
+};
+
+struct TimerStats
+{
+    unsigned long long count;
+    unsigned long long total;
+    unsigned long long min;
+    unsigned long long max;
+
+    TimerStats() : count(0), total(0), min(0), max(0) {}
+
+    void add(unsigned long long duration)
+    {
+        if ( (count == 0) || (duration < min) ) {
+            min = duration;
+        }
+        if (duration > max) {
+            max = duration;
+        }
+        ++count;
+        total += duration;
+    }
+
+    void merge(const TimerStats& other)
+    {
+        if (other.count == 0) {
+            return;
+        }
+        if ( (count == 0) || (other.min < min) ) {
+            min = other.min;
+        }
+        if (other.max > max) {
+            max = other.max;
+        }
+        count += other.count;
+        total += other.total;
+    }
+};
+
+struct CounterStats
+{
+    unsigned long long count;
+    double total;
+
+    CounterStats() : count(0), total(0.) {}
+};
+
+// Each thread records into its own ThreadData. The mutex is only contended while the results are written.
+struct ThreadData
+{
+    int index;
+    tthread::fast_mutex mutex;
+    std::vector<TraceEvent> events;
+    std::map<const char*, TimerStats> timers; // keyed by string literal address, merged by name on output
+    std::map<const char*, CounterStats> counters;
+};
+
+typedef std::shared_ptr<ThreadData> ThreadDataPtr;
+
+string
+expandFileName(const char* fileName)
+{
+    string s(fileName);
+    std::size_t pos = s.find("%p");
+    if (pos != string::npos) {
+        char pid[32];
+#if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
+        std::snprintf( pid, sizeof(pid), "%d", (int)_getpid() );
+#else
+        std::snprintf( pid, sizeof(pid), "%d", (int)getpid() );
+#endif
+        s.replace(pos, 2, pid);
+    }
+
+    return s;
+}
+
+string
+jsonString(const string& s)
+{
+    string ret = "\"";
+    for (std::size_t i = 0; i < s.size(); ++i) {
+        if ( (s[i] == '"') || (s[i] == '\\') ) {
+            ret += '\\';
+        }
+        ret += s[i];
+    }
+    ret += '"';
+
+    return ret;
+}
+
+class State
+{
+public:
+    State()
+        : _start( std::chrono::steady_clock::now() )
+        , _enabled(false)
+        , _trace(false)
+    {
+        const char* traceFile = std::getenv(kInstrumentationTraceFileEnv);
+        const char* statsFile = std::getenv(kInstrumentationStatsFileEnv);
+        if (traceFile && *traceFile) {
+            _traceFileName = expandFileName(traceFile);
+            _trace = true;
+        }
+        if (statsFile && *statsFile) {
+            _statsFileName = expandFileName(statsFile);
+        }
+        _enabled = !_traceFileName.empty() || !_statsFileName.empty();
+    }
+
+    ~State()
+    {
+        if (!_traceFileName.empty()) {
+            writeTrace();
+        }
+        if (!_statsFileName.empty()) {
+            writeStats();
+        }
+    }
+
+    bool enabled() const { return _enabled; }
+
+    bool trace() const { return _trace; }
+
+    unsigned long long now() const
+    {
+        return (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _start).count();
+    }
+
+    ThreadData& threadData()
+    {
+        static thread_local ThreadData* data = NULL;
+
+        if (!data) {
+            ThreadDataPtr newData = std::make_shared<ThreadData>();
+            OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(_mutex);
+            newData->index = (int)_threads.size();
+            _threads.push_back(newData); // keeps the data alive after the thread exits
+            data = newData.get();
+        }
+
+        return *data;
+    }
+
+private:
+    void writeTrace();
+    void writeStats();
+
+    std::chrono::steady_clock::time_point _start;
+    bool _enabled;
+    bool _trace;
+    string _traceFileName;
+    string _statsFileName;
+    tthread::fast_mutex _mutex;
+    std::list<ThreadDataPtr> _threads;
+};
+
+void
+State::writeTrace()
+{
+    std::FILE* f = std::fopen(_traceFileName.c_str(), "w");
+
+    if (!f) {
+        return;
+    }
+    std::fprintf(f, "{\"traceEvents\":[\n");
+    bool first = true;
+    OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(_mutex);
+    for (std::list<ThreadDataPtr>::const_iterator it = _threads.begin(); it != _threads.end(); ++it) {
+        OFX::MultiThread::AutoMutexT<tthread::fast_mutex> threadGuard( (*it)->mutex );
+        for (std::vector<TraceEvent>::const_iterator e = (*it)->events.begin(); e != (*it)->events.end(); ++e) {
+            std::fprintf(f, "%s{\"name\":%s,\"cat\":\"io\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":0,\"tid\":%d}",
+                         first ? "" : ",\n", jsonString(e->name).c_str(), e->begin, e->duration, (*it)->index);
+            first = false;
+        }
+    }
+    std::fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    std::fclose(f);
+}
+
+void
+State::writeStats()
+{
+    std::map<string, TimerStats> timers;
+    std::map<string, CounterStats> counters;
+    {
+        OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(_mutex);
+        for (std::list<ThreadDataPtr>::const_iterator it = _threads.begin(); it != _threads.end(); ++it) {
+            OFX::MultiThread::AutoMutexT<tthread::fast_mutex> threadGuard( (*it)->mutex );
+            for (std::map<const char*, TimerStats>::const_iterator t = (*it)->timers.begin(); t != (*it)->timers.end(); ++t) {
+                timers[t->first].merge(t->second);
+            }
+            for (std::map<const char*, CounterStats>::const_iterator c = (*it)->counters.begin(); c != (*it)->counters.end(); ++c) {
+                CounterStats& stats = counters[c->first];
+                stats.count += c->second.count;
+                stats.total += c->second.total;
+            }
+        }
+    }
+
+    std::FILE* f = std::fopen(_statsFileName.c_str(), "w");
+    if (!f) {
+        return;
+    }
+    std::fprintf(f, "{\n  \"timers\": {");
+    for (std::map<string, TimerStats>::const_iterator t = timers.begin(); t != timers.end(); ++t) {
+        std::fprintf(f, "%s\n    %s: {\"count\": %llu, \"total_us\": %llu, \"min_us\": %llu, \"max_us\": %llu}",
+                     t == timers.begin() ? "" : ",", jsonString(t->first).c_str(), t->second.count, t->second.total, t->second.min, t->second.max);
+    }
+    std::fprintf(f, "\n  },\n  \"counters\": {");
+    for (std::map<string, CounterStats>::const_iterator c = counters.begin(); c != counters.end(); ++c) {
+        std::fprintf(f, "%s\n    %s: {\"count\": %llu, \"total\": %.17g}",
+                     c == counters.begin() ? "" : ",", jsonString(c->first).c_str(), c->second.count, c->second.total);
+    }
+    std::fprintf(f, "\n  }\n}\n");
+    std::fclose(f);
+}
+
+State gState;
+} // anonymous namespace
+
+bool
+enabled()
+{
+    return gState.enabled();
+}
+
+unsigned long long
+now()
+{
+    return gState.now();
+}
+
+void
+addEvent(const char* name,
+         unsigned long long begin,
+         unsigned long long duration)
+{
+    if ( !gState.enabled() ) {
+        return;
+    }
+    ThreadData& data = gState.threadData();
+    OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(data.mutex);
+    data.timers[name].add(duration);
+    if ( gState.trace() && (data.events.size() < kInstrumentationMaxTraceEvents) ) {
+        TraceEvent e = { name, begin, duration };
+        data.events.push_back(e);
+    }
+}
+
+void
+addCount(const char* name,
+         double value)
+{
+    if ( !gState.enabled() ) {
+        return;
+    }
+    ThreadData& data = gState.threadData();
+    OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(data.mutex);
+    CounterStats& stats = data.counters[name];
+    ++stats.count;
+    stats.total += value;
+}
+} // namespace Instrumentation
+
+NAMESPACE_OFX_IO_EXIT
+NAMESPACE_OFX_EXIT
+
+#endif // OFX_IO_INSTRUMENTATION
@@ -0,0 +1,105 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of openfx-io <https://github.com/NatronGitHub/openfx-io>,
+ * (C) 2018-2021 The Natron Developers
+ * (C) 2013-2018 INRIA
+ *
+ * openfx-io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * openfx-io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openfx-io.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+/*
+ * OFX IO instrumentation.
+ * Scoped timers and counters around the stages of the reader and writer pipelines.
+ *
+ * Instrumentation is compiled in only if OFX_IO_INSTRUMENTATION is defined, and the macros below
+ * expand to nothing otherwise. When compiled in, nothing is recorded unless one of these environment
+ * variables is set when the plugin is loaded (in the file names, "%p" is replaced by the process ID):
+ * - OFX_IO_TRACE_FILE: write all timed events in the Chrome trace event format (chrome://tracing, Perfetto)
+ * - OFX_IO_STATS_FILE: write a JSON summary with, for each timer, the number of calls and the total,
+ *   minimum and maximum durations, and for each counter, the number of increments and the total.
+ * The files are written when the plugin is unloaded. Events are stored per thread, so that recording
+ * does not require any shared lock.
+ */
+
+#ifndef IO_IOInstrumentation_h
+#define IO_IOInstrumentation_h
+
+#ifdef OFX_IO_INSTRUMENTATION
+
+#include "IOUtility.h"
+
+NAMESPACE_OFX_ENTER
+NAMESPACE_OFX_IO_ENTER
+
+namespace Instrumentation {
+/** @brief true if an output file was given in the environment */
+bool enabled();
+
+/** @brief microseconds since the plugin was loaded */
+unsigned long long now();
+
+/** @brief record a timed event. name must be a string literal. */
+void addEvent(const char* name, unsigned long long begin, unsigned long long duration);
+
+/** @brief add value to a counter. name must be a string literal. */
+void addCount(const char* name, double value);
+
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(const char* name)
+        : _name(name)
+        , _enabled( enabled() )
+        , _begin(_enabled ? now() : 0)
+    {
+    }
+
+    ~ScopedTimer()
+    {
+        if (_enabled) {
+            addEvent(_name, _begin, now() - _begin);
+        }
+    }
+
+private:
+    const char* _name;
+    bool _enabled;
+    unsigned long long _begin;
+};
+} // namespace Instrumentation
+
+NAMESPACE_OFX_IO_EXIT
+NAMESPACE_OFX_EXIT
+
+#define OFX_IO_INSTRUMENTATION_CONCAT_(a, b) a ## b
+#define OFX_IO_INSTRUMENTATION_CONCAT(a, b) OFX_IO_INSTRUMENTATION_CONCAT_(a, b)
+
+/** @brief time the enclosing scope */
+#define OFX_IO_SCOPED_TIMER(name) OFX::IO::Instrumentation::ScopedTimer OFX_IO_INSTRUMENTATION_CONCAT(ofxIOScopedTimer, __LINE__)(name)
+
+/** @brief add value (a number of bytes, of frames...) to a counter */
+#define OFX_IO_COUNT(name, value) \
+    do { \
+        if ( OFX::IO::Instrumentation::enabled() ) { \
+            OFX::IO::Instrumentation::addCount( (name), (double)(value) ); \
+        } \
+    } while (0)
+
+#else // !OFX_IO_INSTRUMENTATION
+
+#define OFX_IO_SCOPED_TIMER(name) (void)0
+#define OFX_IO_COUNT(name, value) (void)0
+
+#endif // OFX_IO_INSTRUMENTATION
+
+#endif // IO_IOInstrumentation_h
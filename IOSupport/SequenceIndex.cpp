@@ -0,0 +1,561 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of openfx-io <https://github.com/NatronGitHub/openfx-io>,
+ * (C) 2018-2021 The Natron Developers
+ * (C) 2013-2018 INRIA
+ *
+ * openfx-io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * openfx-io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openfx-io.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+/*
+ * OFX IO sequence index.
+ * A process-wide cache of directory listings, used by the readers to find frame files.
+ */
+
+#include "SequenceIndex.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <unordered_set>
+#if !(defined(_WIN32) || defined(__WIN32__) || defined(WIN32))
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#if defined(__linux__)
+#include <fcntl.h> // open
+#include <unistd.h> // close
+#include <sys/syscall.h> // SYS_getdents64
+#endif
+#define SEQUENCE_INDEX_SUPPORTED
+#endif
+
+#include "ofxsMacros.h"
+#include "ofxsMultiThread.h"
+
+#include "fast_mutex.h" // the index is static, and can't use the OFX MT-Suite mutex
+
+#define kSequenceIndexMaxDirectories 64 // number of directory listings kept in the cache
+#define kSequenceIndexMaxSequences 16 // number of sequences kept per directory
+#define kSequenceIndexMinRescanInterval 1. // in seconds, see fileExists()
+#define kSequenceIndexMinNamesPerThread 8192 // smaller directories are matched in the calling thread
+#define kSequenceIndexGetdentsBufferSize (1 << 20)
+
+using std::string;
+
+NAMESPACE_OFX_ENTER
+NAMESPACE_OFX_IO_ENTER
+
+namespace SequenceIndex {
+/** @brief matches file names against a pattern with a single sequence of '#' */
+class SequenceBuilder
+{
+public:
+    SequenceBuilder()
+        : _padding(0)
+    {
+    }
+
+    /** @brief returns false if the pattern is not supported */
+    bool setPattern(const string& pattern)
+    {
+        std::size_t slash = pattern.find_last_of('/');
+        string name;
+
+        if (slash == string::npos) {
+            _dirname = ".";
+            name = pattern;
+        } else {
+            _dirname = (slash == 0) ? "/" : pattern.substr(0, slash);
+            _pathPrefix = pattern.substr(0, slash + 1);
+            name = pattern.substr(slash + 1);
+        }
+        // '%' may be a printf-style frame number or a view
+        if ( name.empty() || (name.find('%') != string::npos) ) {
+            return false;
+        }
+        std::size_t first = name.find('#');
+        if (first == string::npos) {
+            return false;
+        }
+        std::size_t last = name.find_first_not_of('#', first);
+        if (last == string::npos) {
+            last = name.size();
+        }
+        if (name.find('#', last) != string::npos) {
+            return false;
+        }
+        _prefix = name.substr(0, first);
+        _suffix = name.substr(last);
+        _padding = last - first;
+        _name = name;
+
+        return true;
+    }
+
+    const string& dirname() const { return _dirname; }
+
+    /** @brief the pattern without the directory */
+    const string& name() const { return _name; }
+
+    bool match(const string& name,
+               int* frame) const
+    {
+        if ( ( name.size() < _prefix.size() + _suffix.size() + 1 ) ||
+             (name.compare(0, _prefix.size(), _prefix) != 0) ||
+             (name.compare(name.size() - _suffix.size(), _suffix.size(), _suffix) != 0) ) {
+            return false;
+        }
+        std::size_t i = _prefix.size();
+        const std::size_t end = name.size() - _suffix.size();
+        const bool negative = (name[i] == '-');
+        if (negative) {
+            ++i;
+        }
+        const std::size_t digits = end - i;
+        // at least _padding digits, and no leading zeroes if there are more
+        if ( (digits == 0) || (digits < _padding) || ( (digits > _padding) && (name[i] == '0') ) || (digits > 9) ) {
+            return false;
+        }
+        int value = 0;
+        for (; i < end; ++i) {
+            const char c = name[i];
+            if ( (c < '0') || (c > '9') ) {
+                return false;
+            }
+            value = value * 10 + (c - '0');
+        }
+        *frame = negative ? -value : value;
+
+        return true;
+    }
+
+    /** @brief build the sequence from the matches of each thread */
+    SequenceConstPtr build(const std::vector<std::vector<std::pair<int, const string*> > >& matches) const
+    {
+        std::shared_ptr<Sequence> sequence = std::make_shared<Sequence>();
+        std::size_t count = 0;
+
+        for (std::size_t t = 0; t < matches.size(); ++t) {
+            count += matches[t].size();
+        }
+        sequence->_frames.reserve(count);
+        sequence->_files.reserve(count);
+        for (std::size_t t = 0; t < matches.size(); ++t) {
+            for (std::size_t i = 0; i < matches[t].size(); ++i) {
+                const std::pair<int, const string*>& m = matches[t][i];
+                // "-0" and "0" are the same frame: keep the first one
+                if ( sequence->_files.insert( std::make_pair(m.first, _pathPrefix + *m.second) ).second ) {
+                    sequence->_frames.push_back(m.first);
+                }
+            }
+        }
+        std::sort( sequence->_frames.begin(), sequence->_frames.end() );
+
+        return sequence;
+    }
+
+private:
+    string _dirname;
+    string _pathPrefix;
+    string _name;
+    string _prefix;
+    string _suffix;
+    std::size_t _padding;
+};
+
+#ifdef SEQUENCE_INDEX_SUPPORTED
+namespace {
+struct DirectoryStamp
+{
+    dev_t dev;
+    ino_t ino;
+    time_t mtimeSec;
+    long mtimeNSec;
+
+    bool operator==(const DirectoryStamp& other) const
+    {
+        return dev == other.dev && ino == other.ino && mtimeSec == other.mtimeSec && mtimeNSec == other.mtimeNSec;
+    }
+};
+
+struct DirectoryListing
+{
+    DirectoryStamp stamp;
+    bool racy; // the directory may have been modified during the second it was listed
+    std::chrono::steady_clock::time_point scanTime;
+    std::unordered_set<string> files; // regular files, or of unknown type
+    std::unordered_set<string> links; // symbolic links, which may be broken
+    unsigned long long lastUse;
+    tthread::fast_mutex sequencesMutex;
+    std::map<string, SequenceConstPtr> sequences; // pattern without the directory -> sequence
+
+    DirectoryListing()
+        : racy(false)
+        , lastUse(0)
+    {
+    }
+};
+
+typedef std::shared_ptr<DirectoryListing> DirectoryListingPtr;
+
+tthread::fast_mutex gListingsMutex;
+std::map<string, DirectoryListingPtr> gListings;
+unsigned long long gUseCount = 0;
+
+bool
+statDirectory(const string& dirname,
+              DirectoryStamp* stamp)
+{
+    struct stat st;
+
+    if ( (stat(dirname.c_str(), &st) != 0) || !S_ISDIR(st.st_mode) ) {
+        return false;
+    }
+    stamp->dev = st.st_dev;
+    stamp->ino = st.st_ino;
+#if defined(__APPLE__)
+    stamp->mtimeSec = st.st_mtimespec.tv_sec;
+    stamp->mtimeNSec = st.st_mtimespec.tv_nsec;
+#else
+    stamp->mtimeSec = st.st_mtim.tv_sec;
+    stamp->mtimeNSec = st.st_mtim.tv_nsec;
+#endif
+
+    return true;
+}
+
+#if defined(DT_DIR) && defined(DT_LNK)
+void
+addEntry(DirectoryListing& listing,
+         const char* name,
+         unsigned char type)
+{
+    if ( (type == DT_REG) || (type == DT_UNKNOWN) ) {
+        listing.files.insert(name);
+    } else if (type == DT_LNK) {
+        listing.links.insert(name);
+    }
+    // directories (including "." and ".."), pipes, sockets and devices are not frame files
+}
+
+#else
+void
+addEntry(DirectoryListing& listing,
+         const char* name,
+         unsigned char /*type*/)
+{
+    if ( std::strcmp(name, ".") && std::strcmp(name, "..") ) {
+        listing.files.insert(name);
+    }
+}
+
+#endif
+
+#if defined(__linux__)
+// the layout of the records returned by getdents64, which glibc does not declare before version 2.30
+struct LinuxDirent64
+{
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+/** @brief list the directory with large requests, which is much faster than readdir() on network filesystems */
+bool
+listDirectory(const string& dirname,
+              DirectoryListing& listing)
+{
+    int fd = open(dirname.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return false;
+    }
+    std::vector<char> buffer(kSequenceIndexGetdentsBufferSize);
+    for (;;) {
+        long n = syscall( SYS_getdents64, fd, &buffer[0], buffer.size() );
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            close(fd);
+
+            return false;
+        }
+        if (n == 0) {
+            break;
+        }
+        for (long pos = 0; pos < n;) {
+            const LinuxDirent64* entry = reinterpret_cast<const LinuxDirent64*>(&buffer[pos]);
+            addEntry(listing, entry->d_name, entry->d_type);
+            pos += entry->d_reclen;
+        }
+    }
+    close(fd);
+
+    return true;
+}
+
+#else
+bool
+listDirectory(const string& dirname,
+              DirectoryListing& listing)
+{
+    DIR* dir = opendir( dirname.c_str() );
+
+    if (!dir) {
+        return false;
+    }
+    errno = 0;
+    while (struct dirent* entry = readdir(dir)) {
+#if defined(DT_DIR) && defined(DT_LNK)
+        addEntry(listing, entry->d_name, entry->d_type);
+#else
+        addEntry(listing, entry->d_name, 0);
+#endif
+    }
+    const bool ok = (errno == 0);
+    closedir(dir);
+
+    return ok;
+}
+
+#endif // if defined(__linux__)
+
+double
+secondsSince(const std::chrono::steady_clock::time_point& t)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+}
+
+/**
+ * @brief get the listing of a directory, listing it again if it was modified.
+ * If canRescan is false and the cached listing is stale, return an empty pointer.
+ */
+DirectoryListingPtr
+getListing(const string& dirname,
+           bool canRescan)
+{
+    DirectoryStamp stamp;
+
+    if ( !statDirectory(dirname, &stamp) ) {
+        return DirectoryListingPtr();
+    }
+    {
+        OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gListingsMutex);
+        std::map<string, DirectoryListingPtr>::iterator it = gListings.find(dirname);
+        if ( it != gListings.end() ) {
+            DirectoryListingPtr& listing = it->second;
+            if ( !listing->racy && (listing->stamp == stamp) ) {
+                listing->lastUse = ++gUseCount;
+
+                return listing;
+            }
+            if (!canRescan) {
+                return DirectoryListingPtr();
+            }
+        }
+    }
+
+    // list the directory without holding the lock. If several threads do it, the last one wins.
+    DirectoryListingPtr listing = std::make_shared<DirectoryListing>();
+    listing->stamp = stamp;
+    listing->scanTime = std::chrono::steady_clock::now();
+    const time_t now = std::time(NULL);
+    if ( !listDirectory(dirname, *listing) ) {
+        return DirectoryListingPtr();
+    }
+    // with a coarse mtime resolution, files created in the same second would not change the stamp
+    listing->racy = (stamp.mtimeSec + 1 >= now);
+
+    OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gListingsMutex);
+    listing->lastUse = ++gUseCount;
+    gListings[dirname] = listing;
+    if (gListings.size() > kSequenceIndexMaxDirectories) {
+        std::map<string, DirectoryListingPtr>::iterator oldest = gListings.begin();
+        for (std::map<string, DirectoryListingPtr>::iterator it = gListings.begin(); it != gListings.end(); ++it) {
+            if (it->second->lastUse < oldest->second->lastUse) {
+                oldest = it;
+            }
+        }
+        gListings.erase(oldest);
+    }
+
+    return listing;
+} // getListing
+
+/** @brief match the names of a directory against a pattern, using the host threads */
+class MatchProcessor
+    : public OFX::MultiThread::Processor
+{
+public:
+    MatchProcessor(const SequenceBuilder& builder,
+                   const std::vector<const string*>& names,
+                   unsigned int nThreads)
+        : _builder(builder)
+        , _names(names)
+        , _matches(nThreads)
+    {
+    }
+
+    const std::vector<std::vector<std::pair<int, const string*> > >& matches() const { return _matches; }
+
+    void process()
+    {
+        const unsigned int nThreads = (unsigned int)_matches.size();
+
+        if (nThreads > 1) {
+            try {
+                multiThread(nThreads);
+
+                return;
+            } catch (...) {
+                // the threads could not be launched, match in the calling thread
+                for (std::size_t t = 0; t < _matches.size(); ++t) {
+                    _matches[t].clear();
+                }
+            }
+        }
+        for (unsigned int t = 0; t < nThreads; ++t) {
+            multiThreadFunction(t, nThreads);
+        }
+    }
+
+private:
+    virtual void multiThreadFunction(unsigned int threadID,
+                                     unsigned int nThreads) OVERRIDE FINAL
+    {
+        const std::size_t begin = _names.size() * threadID / nThreads;
+        const std::size_t end = _names.size() * (threadID + 1) / nThreads;
+        std::vector<std::pair<int, const string*> >& matches = _matches[threadID];
+        int frame;
+
+        for (std::size_t i = begin; i < end; ++i) {
+            if ( _builder.match(*_names[i], &frame) ) {
+                matches.push_back( std::make_pair(frame, _names[i]) );
+            }
+        }
+    }
+
+    const SequenceBuilder& _builder;
+    const std::vector<const string*>& _names;
+    std::vector<std::vector<std::pair<int, const string*> > > _matches;
+};
+} // anonymous namespace
+
+bool
+fileExists(const string& path,
+           bool* exists)
+{
+    std::size_t slash = path.find_last_of('/');
+    const string dirname = (slash == string::npos) ? "." : (slash == 0) ? "/" : path.substr(0, slash);
+    const string name = (slash == string::npos) ? path : path.substr(slash + 1);
+
+    if ( name.empty() ) {
+        return false;
+    }
+    // when the directory is being written to, do not list it again on each check
+    bool canRescan = true;
+    {
+        OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gListingsMutex);
+        std::map<string, DirectoryListingPtr>::const_iterator it = gListings.find(dirname);
+        if ( ( it != gListings.end() ) && (secondsSince(it->second->scanTime) < kSequenceIndexMinRescanInterval) ) {
+            canRescan = false;
+        }
+    }
+    DirectoryListingPtr listing = getListing(dirname, canRescan);
+    if ( !listing || ( listing->links.find(name) != listing->links.end() ) ) {
+        // the caller checks symbolic links itself, since they may be broken
+        return false;
+    }
+    *exists = ( listing->files.find(name) != listing->files.end() );
+
+    return true;
+}
+
+SequenceConstPtr
+getSequence(const string& pattern)
+{
+    SequenceBuilder builder;
+
+    if ( !builder.setPattern(pattern) ) {
+        return SequenceConstPtr();
+    }
+    DirectoryListingPtr listing = getListing(builder.dirname(), true);
+    if (!listing) {
+        return SequenceConstPtr();
+    }
+
+    OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(listing->sequencesMutex);
+    std::map<string, SequenceConstPtr>::const_iterator it = listing->sequences.find( builder.name() );
+    if ( it != listing->sequences.end() ) {
+        return it->second;
+    }
+    std::vector<const string*> names;
+    names.reserve( listing->files.size() + listing->links.size() );
+    for (std::unordered_set<string>::const_iterator f = listing->files.begin(); f != listing->files.end(); ++f) {
+        names.push_back(&*f);
+    }
+    for (std::unordered_set<string>::const_iterator l = listing->links.begin(); l != listing->links.end(); ++l) {
+        names.push_back(&*l);
+    }
+    const unsigned int nThreads = (std::max)( 1u, (std::min)( OFX::MultiThread::getNumCPUs(), (unsigned int)(names.size() / kSequenceIndexMinNamesPerThread) ) );
+    MatchProcessor processor(builder, names, nThreads);
+    processor.process();
+    SequenceConstPtr sequence = builder.build( processor.matches() );
+    if (listing->sequences.size() >= kSequenceIndexMaxSequences) {
+        listing->sequences.clear();
+    }
+    listing->sequences[builder.name()] = sequence;
+
+    return sequence;
+}
+
+void
+clear()
+{
+    OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gListingsMutex);
+
+    gListings.clear();
+}
+
+#else // !SEQUENCE_INDEX_SUPPORTED
+
+bool
+fileExists(const string& /*path*/,
+           bool* /*exists*/)
+{
+    return false;
+}
+
+SequenceConstPtr
+getSequence(const string& /*pattern*/)
+{
+    return SequenceConstPtr();
+}
+
+void
+clear()
+{
+}
+
+#endif // SEQUENCE_INDEX_SUPPORTED
+} // namespace SequenceIndex
+
+NAMESPACE_OFX_IO_EXIT
+NAMESPACE_OFX_EXIT
@@ -0,0 +1,113 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of openfx-io <https://github.com/NatronGitHub/openfx-io>,
+ * (C) 2018-2021 The Natron Developers
+ * (C) 2013-2018 INRIA
+ *
+ * openfx-io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * openfx-io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openfx-io.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+/*
+ * OFX IO sequence index.
+ * A process-wide cache of directory listings, used by the readers to check which frame files
+ * exist and to find the frame range of image sequences without listing the directory each time.
+ *
+ * The listing of a directory is kept until the modification time of the directory changes.
+ * Since that time may have a coarse resolution, a listing taken less than a second after
+ * the last modification is considered as possibly incomplete and is refreshed on next access.
+ * Directories are read with large getdents64 requests on Linux (readdir on other Unix
+ * platforms), and matching the names of large directories against a pattern is spread over
+ * the OFX MT-Suite threads. On Windows, nothing is indexed and the callers must fall back to
+ * their own file checks.
+ */
+
+#ifndef IO_SequenceIndex_h
+#define IO_SequenceIndex_h
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "IOUtility.h"
+
+NAMESPACE_OFX_ENTER
+NAMESPACE_OFX_IO_ENTER
+
+namespace SequenceIndex {
+/**
+ * @brief The files of a directory that match a sequence pattern.
+ *
+ * The pattern contains a single sequence of '#', which is replaced by the frame number padded
+ * with zeroes to the number of '#' (numbers with more digits must not have leading zeroes).
+ */
+class Sequence
+{
+public:
+    Sequence() {}
+
+    bool empty() const { return _frames.empty(); }
+
+    std::size_t size() const { return _frames.size(); }
+
+    int firstFrame() const { return _frames.empty() ? 0 : _frames.front(); }
+
+    int lastFrame() const { return _frames.empty() ? 0 : _frames.back(); }
+
+    /** @brief the existing frames, sorted */
+    const std::vector<int>& frames() const { return _frames; }
+
+    bool hasFrame(int frame) const { return _files.find(frame) != _files.end(); }
+
+    /** @brief the full path of the file for that frame, or NULL if it is missing */
+    const std::string* fileAtFrame(int frame) const
+    {
+        std::unordered_map<int, std::string>::const_iterator it = _files.find(frame);
+
+        return ( it == _files.end() ) ? NULL : &it->second;
+    }
+
+    /** @brief the number of missing frames between the first and the last frame */
+    int missingFramesCount() const { return _frames.empty() ? 0 : (lastFrame() - firstFrame() + 1 - (int)_frames.size()); }
+
+private:
+    friend class SequenceBuilder;
+
+    std::unordered_map<int, std::string> _files; // frame -> full path
+    std::vector<int> _frames;
+};
+
+typedef std::shared_ptr<const Sequence> SequenceConstPtr;
+
+/**
+ * @brief check if a file exists, using the listing of its directory.
+ * Returns false if the directory could not be indexed, in which case exists is not set and the
+ * caller should check the file itself.
+ */
+bool fileExists(const std::string& path, bool* exists);
+
+/**
+ * @brief get the frames matching a pattern (see Sequence).
+ * Returns an empty pointer if the pattern is not supported (it has no '#', or several sequences
+ * of '#') or if the directory could not be indexed.
+ */
+SequenceConstPtr getSequence(const std::string& pattern);
+
+/** @brief forget all cached listings */
+void clear();
+} // namespace SequenceIndex
+
+NAMESPACE_OFX_IO_EXIT
+NAMESPACE_OFX_EXIT
+
+#endif // IO_SequenceIndex_h
@@ -25,6 +25,10 @@
 #ifdef OFX_IO_USING_OCIO
 
 #include <cstdio> // fopen...
+#include <cstring> // memcpy
+#include <cmath>
+#include <algorithm>
+#include <vector>
 #include <fstream> // std::ofstream
 
 #include "ofxsProcessing.H"
@@ -36,6 +40,7 @@
 #include "ofxsMacros.h"
 
 #include "GenericOCIO.h"
+#include "fast_mutex.h"
 
 
 namespace OCIO = OCIO_NAMESPACE;
@@ -145,8 +150,436 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
     "If the checkbox is not checked and is not enabled (i.e. it cannot be checked), GPU render is not available on this host."
 #endif
 
+#define kParamFastPower "fastPower"
+#define kParamFastPowerLabel "Fast Power"
+#define kParamFastPowerHint \
+    "Use a fast approximation of the power function (relative error below 4e-6) when the grade is applied by the native CDL kernel.\n" \
+    "The native kernel is used on the CPU instead of the OCIO processor when it was checked to give the same result as the OCIO library, " \
+    "so that the grade can be animated without building an OCIO processor for each frame."
+
+#define kCDLChunkSize 256 // pixels are processed by chunks, with a contiguous array per channel
+#define kCDLCheckTolerance 1e-4f // maximum difference with OCIO, relative to max(1, |value|)
+
 static bool gHostIsNatron = false; // TODO: generate a CCCId choice param kParamCCCIDChoice from available IDs
 
+// The ways of applying the CDL that the native kernel implements. The one used by the OCIO library is detected at run time.
+enum CDLStyleEnum
+{
+    eCDLStyleNone = 0, // the native kernel does not match OCIO: use the OCIO processor
+    eCDLStyleNoClamp, // OCIO 2 default: no clamping, the power is only applied to positive values
+    eCDLStyleASC, // ASC CDL v1.2: values are clamped to [0,1] before the power and after the saturation
+    eCDLStyleClampNegative, // OCIO 1: negative values are clamped to 0 by the power, unless all powers are 1
+};
+
+struct CDLValues
+{
+    float slope[3];
+    float offset[3];
+    float power[3];
+    float saturation;
+    bool inverse;
+};
+
+// The float comparisons are done on the integer representation, so that the loops are vectorized without -ffast-math.
+static inline int
+floatToOrderedInt(float v)
+{
+    int bits;
+
+    std::memcpy( &bits, &v, sizeof(bits) );
+
+    return bits ^ ( (bits >> 31) & 0x7fffffff ); // negative values are ordered too
+}
+
+static inline float
+orderedIntToFloat(int key)
+{
+    const int bits = key ^ ( (key >> 31) & 0x7fffffff );
+    float v;
+
+    std::memcpy( &v, &bits, sizeof(v) );
+
+    return v;
+}
+
+static inline float
+clamp01(float v)
+{
+    int key = floatToOrderedInt(v);
+
+    key = key < 0 ? 0 : key; // floatToOrderedInt(0.f) == 0
+    key = key > 0x3f800000 ? 0x3f800000 : key; // floatToOrderedInt(1.f)
+
+    return orderedIntToFloat(key);
+}
+
+// x if x > 0, else y
+static inline float
+selectPositive(float x,
+               float ifPositive,
+               float otherwise)
+{
+    int xbits, a, b;
+
+    std::memcpy( &xbits, &x, sizeof(xbits) );
+    std::memcpy( &a, &ifPositive, sizeof(a) );
+    std::memcpy( &b, &otherwise, sizeof(b) );
+    const int mask = -(int)(xbits > 0);
+    const int bits = (a & mask) | (b & ~mask);
+    float v;
+    std::memcpy( &v, &bits, sizeof(v) );
+
+    return v;
+}
+
+static inline float
+fastLog2(float x)
+{
+    int bits;
+
+    std::memcpy( &bits, &x, sizeof(bits) );
+    // x = m * 2^e, with m in [sqrt(1/2), sqrt(2))
+    const int e = (bits - 0x3f3504f3) >> 23;
+    bits -= e << 23;
+    float m;
+    std::memcpy( &m, &bits, sizeof(m) );
+    const float t = (m - 1.f) / (m + 1.f);
+    const float t2 = t * t;
+
+    // log2(m) = 2 / ln(2) * atanh(t)
+    return (float)e + t * ( 2.88539008f + t2 * ( 0.961796694f + t2 * ( 0.577078016f + t2 * 0.412198583f ) ) );
+}
+
+static inline float
+fastExp2(float y)
+{
+    int key = floatToOrderedInt(y);
+
+    key = key < -1123811329 ? -1123811329 : key; // floatToOrderedInt(-126.f)
+    key = key > 0x42fe0000 ? 0x42fe0000 : key; // floatToOrderedInt(127.f)
+    y = orderedIntToFloat(key);
+    const int n = (int)(y + 126.5f) - 126; // round to nearest
+    const float f = (y - (float)n) * 0.693147181f; // in [-ln(2)/2, ln(2)/2]
+    const float p = 1.f + f * ( 1.f + f * ( 0.5f + f * ( 0.166666667f + f * ( 0.0416666667f + f * ( 0.00833333333f + f * 0.00138888889f ) ) ) ) );
+    const int bits = (n + 127) << 23;
+    float s;
+    std::memcpy( &s, &bits, sizeof(s) );
+
+    return p * s;
+}
+
+// pow(x, p) for x > 0, 0 for x <= 0. For the fast version, see the error bound in kParamFastPowerHint.
+template <bool fastPower>
+static inline float
+cdlPow(float x,
+       float p)
+{
+    if (fastPower) {
+        return selectPositive(x, fastExp2( p * fastLog2(x) ), 0.f);
+    }
+
+    return x > 0.f ? std::pow(x, p) : 0.f;
+}
+
+template <CDLStyleEnum style, bool fastPower>
+static void
+cdlPowerChannel(float* v,
+                int n,
+                float p)
+{
+    switch (style) {
+    case eCDLStyleNoClamp:
+        if (p != 1.f) {
+            for (int i = 0; i < n; ++i) {
+                v[i] = selectPositive( v[i], cdlPow<fastPower>(v[i], p), v[i] );
+            }
+        }
+        break;
+    case eCDLStyleASC: // the values are in [0,1]
+    case eCDLStyleClampNegative:
+        for (int i = 0; i < n; ++i) {
+            v[i] = cdlPow<fastPower>(v[i], p);
+        }
+        break;
+    case eCDLStyleNone:
+        break;
+    }
+}
+
+template <CDLStyleEnum style>
+static void
+cdlClampChannels(float* const v[3],
+                 int n)
+{
+    if (style == eCDLStyleASC) {
+        for (int c = 0; c < 3; ++c) {
+            float* vc = v[c];
+            for (int i = 0; i < n; ++i) {
+                vc[i] = clamp01(vc[i]);
+            }
+        }
+    }
+}
+
+// the rec709 luma is preserved by the saturation
+static void
+cdlSaturation(float* const v[3],
+              int n,
+              float sat)
+{
+    if (sat == 1.f) {
+        return;
+    }
+    float* r = v[0];
+    float* g = v[1];
+    float* b = v[2];
+    for (int i = 0; i < n; ++i) {
+        const float luma = 0.2126f * r[i] + 0.7152f * g[i] + 0.0722f * b[i];
+        r[i] = luma + sat * (r[i] - luma);
+        g[i] = luma + sat * (g[i] - luma);
+        b[i] = luma + sat * (b[i] - luma);
+    }
+}
+
+// apply the CDL to a row of RGB or RGBA pixels, in place (alpha is left unchanged)
+template <CDLStyleEnum style, bool inverse, bool fastPower>
+static void
+applyCDLRow(const CDLValues& values,
+            float* pix,
+            int width,
+            int numChannels)
+{
+    float r[kCDLChunkSize];
+    float g[kCDLChunkSize];
+    float b[kCDLChunkSize];
+    float* const v[3] = { r, g, b };
+
+    for (int x = 0; x < width; x += kCDLChunkSize, pix += kCDLChunkSize * numChannels) {
+        const int n = (std::min)(kCDLChunkSize, width - x);
+        for (int i = 0; i < n; ++i) {
+            r[i] = pix[i * numChannels];
+            g[i] = pix[i * numChannels + 1];
+            b[i] = pix[i * numChannels + 2];
+        }
+        if (!inverse) {
+            for (int c = 0; c < 3; ++c) {
+                float* vc = v[c];
+                const float slope = values.slope[c];
+                const float offset = values.offset[c];
+                for (int i = 0; i < n; ++i) {
+                    vc[i] = vc[i] * slope + offset;
+                }
+            }
+            cdlClampChannels<style>(v, n);
+            for (int c = 0; c < 3; ++c) {
+                cdlPowerChannel<style, fastPower>(v[c], n, values.power[c]);
+            }
+            cdlSaturation(v, n, values.saturation);
+            cdlClampChannels<style>(v, n);
+        } else {
+            cdlClampChannels<style>(v, n);
+            cdlSaturation(v, n, 1.f / values.saturation);
+            cdlClampChannels<style>(v, n);
+            for (int c = 0; c < 3; ++c) {
+                cdlPowerChannel<style, fastPower>(v[c], n, 1.f / values.power[c]);
+            }
+            for (int c = 0; c < 3; ++c) {
+                float* vc = v[c];
+                const float invSlope = 1.f / values.slope[c];
+                const float offset = values.offset[c];
+                for (int i = 0; i < n; ++i) {
+                    vc[i] = (vc[i] - offset) * invSlope;
+                }
+            }
+            cdlClampChannels<style>(v, n);
+        }
+        for (int i = 0; i < n; ++i) {
+            pix[i * numChannels] = r[i];
+            pix[i * numChannels + 1] = g[i];
+            pix[i * numChannels + 2] = b[i];
+        }
+    }
+} // applyCDLRow
+
+typedef void (*CDLRowFunction)(const CDLValues& values, float* pix, int width, int numChannels);
+
+template <CDLStyleEnum style>
+static CDLRowFunction
+getCDLRowFunction(bool inverse,
+                  bool fastPower)
+{
+    if (inverse) {
+        return fastPower ? &applyCDLRow<style, true, true> : &applyCDLRow<style, true, false>;
+    }
+
+    return fastPower ? &applyCDLRow<style, false, true> : &applyCDLRow<style, false, false>;
+}
+
+static CDLRowFunction
+getCDLRowFunction(CDLStyleEnum style,
+                  bool inverse,
+                  bool fastPower)
+{
+    switch (style) {
+    case eCDLStyleNoClamp:
+
+        return getCDLRowFunction<eCDLStyleNoClamp>(inverse, fastPower);
+    case eCDLStyleASC:
+
+        return getCDLRowFunction<eCDLStyleASC>(inverse, fastPower);
+    case eCDLStyleClampNegative:
+
+        return getCDLRowFunction<eCDLStyleClampNegative>(inverse, fastPower);
+    case eCDLStyleNone:
+        break;
+    }
+
+    return NULL;
+}
+
+static OCIO::ConstProcessorRcPtr
+getCDLProcessor(const CDLValues& values)
+{
+    OCIO::ConstConfigRcPtr config = OCIO::GetCurrentConfig();
+    OCIO::CDLTransformRcPtr cc = OCIO::CDLTransform::Create();
+#if OCIO_VERSION_HEX >= 0x02000000
+    double sop[9];
+#else
+    float sop[9];
+#endif
+    for (int c = 0; c < 3; ++c) {
+        sop[c] = values.slope[c];
+        sop[3 + c] = values.offset[c];
+        sop[6 + c] = values.power[c];
+    }
+    cc->setSOP(sop);
+    cc->setSat(values.saturation);
+    cc->setDirection(values.inverse ? OCIO::TRANSFORM_DIR_INVERSE : OCIO::TRANSFORM_DIR_FORWARD);
+
+    return GenericOCIO::getProcessorCached(config, OCIO::ConstContextRcPtr(), cc, OCIO::TRANSFORM_DIR_FORWARD);
+}
+
+// the style of the native kernel which gives the same result as the OCIO library
+static CDLStyleEnum
+checkNativeCDLStyle(bool inverse)
+{
+    // two grades, the second one has unit powers (OCIO 1 removes the clamping power in that case)
+    const CDLValues grades[2] = {
+        { { 1.2f, 0.9f, 1.05f }, { 0.03f, -0.05f, 0.f }, { 1.4f, 0.8f, 1.f }, 1.3f, inverse },
+        { { 0.8f, 1.1f, 1.f }, { -0.1f, 0.02f, 0.05f }, { 1.f, 1.f, 1.f }, 0.7f, inverse },
+    };
+    const float probeValues[10] = { -0.3f, -0.01f, 0.f, 0.02f, 0.18f, 0.5f, 0.83f, 1.f, 1.3f, 3.f };
+    const int n = 10 * 10 * 10;
+    std::vector<float> probes(3 * n);
+
+    for (int i = 0; i < n; ++i) {
+        probes[3 * i] = probeValues[i % 10];
+        probes[3 * i + 1] = probeValues[(i / 10) % 10];
+        probes[3 * i + 2] = probeValues[i / 100];
+    }
+    std::vector<float> expected[2];
+    try {
+        AutoSetAndRestoreThreadLocale locale;
+        for (int k = 0; k < 2; ++k) {
+            expected[k] = probes;
+            OCIO::ConstProcessorRcPtr proc = getCDLProcessor(grades[k]);
+            OCIO::PackedImageDesc img(&expected[k][0], n, 1, 3);
+#         if OCIO_VERSION_HEX >= 0x02000000
+            OCIO::ConstCPUProcessorRcPtr cpuproc = proc->getOptimizedCPUProcessor(OCIO::BIT_DEPTH_F32, OCIO::BIT_DEPTH_F32,
+                                                                                  OCIO::OPTIMIZATION_DEFAULT);
+            cpuproc->apply(img);
+#         else
+            proc->apply(img);
+#         endif
+        }
+    } catch (const std::exception &) {
+        return eCDLStyleNone;
+    }
+
+    const CDLStyleEnum styles[3] = { eCDLStyleNoClamp, eCDLStyleASC, eCDLStyleClampNegative };
+    for (int s = 0; s < 3; ++s) {
+        bool matches = true;
+        for (int k = 0; k < 2 && matches; ++k) {
+            CDLStyleEnum style = styles[s];
+            if ( (style == eCDLStyleClampNegative) && (grades[k].power[0] == 1.f) && (grades[k].power[1] == 1.f) && (grades[k].power[2] == 1.f) ) {
+                style = eCDLStyleNoClamp;
+            }
+            std::vector<float> result(probes);
+            getCDLRowFunction(style, inverse, false)(grades[k], &result[0], n, 3);
+            for (int i = 0; i < 3 * n && matches; ++i) {
+                const float a = result[i];
+                const float b = expected[k][i];
+                matches = (a == b) || ( std::fabs(a - b) <= kCDLCheckTolerance * (std::max)( 1.f, std::fabs(b) ) );
+            }
+        }
+        if (matches) {
+            return styles[s];
+        }
+    }
+
+    return eCDLStyleNone;
+} // checkNativeCDLStyle
+
+static int gNativeCDLStyle[2] = { -1, -1 }; // forward, inverse. -1 if not checked yet
+static tthread::fast_mutex gNativeCDLStyleMutex; // can't use the OFX MT-Suite mutex
+
+static CDLStyleEnum
+getNativeCDLStyle(bool inverse)
+{
+    OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gNativeCDLStyleMutex);
+
+    if (gNativeCDLStyle[inverse] < 0) {
+        gNativeCDLStyle[inverse] = (int)checkNativeCDLStyle(inverse);
+    }
+
+    return (CDLStyleEnum)gNativeCDLStyle[inverse];
+}
+
+/**
+ * @brief Apply the CDL in place, without an OCIO processor.
+ **/
+class CDLProcessor
+    : public PixelProcessor
+{
+public:
+    CDLProcessor(ImageEffect &instance)
+        : PixelProcessor(instance)
+        , _values()
+        , _rowFunction(NULL)
+    {
+    }
+
+    void setValues(const CDLValues& values,
+                   CDLStyleEnum style,
+                   bool fastPower)
+    {
+        _values = values;
+        if ( (style == eCDLStyleClampNegative) && (values.power[0] == 1.f) && (values.power[1] == 1.f) && (values.power[2] == 1.f) ) {
+            style = eCDLStyleNoClamp;
+        }
+        _rowFunction = getCDLRowFunction(style, values.inverse, fastPower);
+    }
+
+private:
+    virtual void multiThreadProcessImages(const OfxRectI& procWindow, const OfxPointD& rs) OVERRIDE FINAL
+    {
+        unused(rs);
+        assert(_rowFunction);
+        assert(_dstPixelComponents == ePixelComponentRGBA || _dstPixelComponents == ePixelComponentRGB);
+        const int numChannels = (_dstPixelComponents == ePixelComponentRGBA) ? 4 : 3;
+        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
+            if ( _effect.abort() ) {
+                break;
+            }
+            float* pix = (float*)getDstPixelAddress(procWindow.x1, y);
+            _rowFunction(_values, pix, procWindow.x2 - procWindow.x1, numChannels);
+        }
+    }
+
+    CDLValues _values;
+    CDLRowFunction _rowFunction;
+};
+
 class OCIOCDLTransformPlugin
     : public ImageEffect
 {
@@ -194,6 +627,13 @@ private:
 
     void refreshKnobEnabledState(bool readFromFile);
 
+    // read the CDL from the file, setting an error message and throwing on failure
+    OCIO::CDLTransformRcPtr readCDLFile();
+
+    // the grade at the given time, from the file or from the parameters (which are not modified)
+    void getCDLValues(OfxTime time, double slope[3], double offset[3], double power[3], double* saturation);
+
+    // set the parameters from the file: this must not be called from render
     void loadCDLFromFile();
 
     void copyPixelData(bool unpremult,
@@ -340,6 +780,7 @@ private:
     RGBParam *_power;
     DoubleParam *_saturation;
     ChoiceParam *_direction;
+    BooleanParam* _fastPower;
     BooleanParam* _readFromFile;
     StringParam *_file;
     IntParam *_version;
@@ -382,6 +823,7 @@ OCIOCDLTransformPlugin::OCIOCDLTransformPlugin(OfxImageEffectHandle handle)
     , _power(NULL)
     , _saturation(NULL)
     , _direction(NULL)
+    , _fastPower(NULL)
     , _readFromFile(NULL)
     , _file(NULL)
     , _version(NULL)
@@ -422,12 +864,13 @@ OCIOCDLTransformPlugin::OCIOCDLTransformPlugin(OfxImageEffectHandle handle)
     _power = fetchRGBParam(kParamPower);
     _saturation = fetchDoubleParam(kParamSaturation);
     _direction = fetchChoiceParam(kParamDirection);
+    _fastPower = fetchBooleanParam(kParamFastPower);
     _readFromFile = fetchBooleanParam(kParamReadFromFile);
     _file = fetchStringParam(kParamFile);
     _version = fetchIntParam(kParamVersion);
     _cccid = fetchStringParam(kParamCCCID);
     _export = fetchStringParam(kParamExport);
-    assert(_slope && _offset && _power && _saturation && _direction && _readFromFile && _file && _version && _cccid && _export);
+    assert(_slope && _offset && _power && _saturation && _direction && _fastPower && _readFromFile && _file && _version && _cccid && _export);
     _premult = fetchBooleanParam(kParamPremult);
     _premultChannel = fetchChoiceParam(kParamPremultChannel);
     assert(_premult && _premultChannel);
@@ -611,22 +1054,11 @@ OCIOCDLTransformPlugin::copyPixelData(bool unpremult,
 OCIO::ConstProcessorRcPtr
 OCIOCDLTransformPlugin::getProcessor(OfxTime time)
 {
-    if (_firstLoad) {
-        _firstLoad = false;
-        bool readFromFile;
-        _readFromFile->getValue(readFromFile);
-        if (readFromFile) {
-            loadCDLFromFile();
-        }
-    }
-
-    double slope_r, slope_g, slope_b;
-    _slope->getValueAtTime(time, slope_r, slope_g, slope_b);
-    double offset_r, offset_g, offset_b;
-    _offset->getValueAtTime(time, offset_r, offset_g, offset_b);
-    double power_r, power_g, power_b;
-    _power->getValueAtTime(time, power_r, power_g, power_b);
-    double saturation = _saturation->getValueAtTime(time);
+    double slope[3], offset[3], power[3], saturation;
+    getCDLValues(time, slope, offset, power, &saturation);
+    const double slope_r = slope[0], slope_g = slope[1], slope_b = slope[2];
+    const double offset_r = offset[0], offset_g = offset[1], offset_b = offset[2];
+    const double power_r = power[0], power_g = power[1], power_b = power[2];
     int directioni = _direction->getValueAtTime(time);
 
     try {
@@ -681,7 +1113,7 @@ OCIOCDLTransformPlugin::getProcessor(OfxTime time)
                 cc->setDirection(OCIO::TRANSFORM_DIR_INVERSE);
             }
 
-            _proc = config->getProcessor(cc);
+            _proc = GenericOCIO::getProcessorCached(config, OCIO::ConstContextRcPtr(), cc, OCIO::TRANSFORM_DIR_FORWARD);
             _procSlope_r = slope_r;
             _procSlope_g = slope_g;
             _procSlope_b = slope_b;
@@ -721,6 +1153,34 @@ OCIOCDLTransformPlugin::apply(double time,
         throw std::runtime_error("OCIO: invalid components (only RGB and RGBA are supported)");
     }
 
+    CDLValues values;
+    double slope[3], offset[3], power[3], saturation;
+    getCDLValues(time, slope, offset, power, &saturation);
+    for (int c = 0; c < 3; ++c) {
+        values.slope[c] = (float)slope[c];
+        values.offset[c] = (float)offset[c];
+        values.power[c] = (float)power[c];
+    }
+    values.saturation = (float)saturation;
+    values.inverse = (_direction->getValueAtTime(time) != 0);
+    bool fastPower = _fastPower->getValueAtTime(time);
+
+    // the native kernel does not handle the singular cases of the inverse
+    bool invertible = !values.inverse || values.saturation != 0.f;
+    for (int c = 0; c < 3 && invertible; ++c) {
+        invertible = (values.slope[c] != 0.f) && (values.power[c] != 0.f);
+    }
+    CDLStyleEnum style = invertible ? getNativeCDLStyle(values.inverse) : eCDLStyleNone;
+    if (style != eCDLStyleNone) {
+        CDLProcessor processor(*this);
+        processor.setDstImg(pixelData, bounds, pixelComponents, pixelComponentCount, eBitDepthFloat, rowBytes);
+        processor.setValues(values, style, fastPower);
+        processor.setRenderWindow(renderWindow, renderScale);
+        processor.process();
+
+        return;
+    }
+
     OCIOProcessor processor(*this);
     // set the images
     processor.setDstImg(pixelData, bounds, pixelComponents, pixelComponentCount, eBitDepthFloat, rowBytes);
@@ -959,6 +1419,26 @@ OCIOCDLTransformPlugin::render(const RenderArguments &args)
     int srcRowBytes;
     getImageData(srcImg.get(), &srcPixelData, &bounds, &pixelComponents, &bitDepth, &srcRowBytes);
     int pixelComponentCount = srcImg->getPixelComponentCount();
+    bool premult;
+    _premult->getValueAtTime(args.time, premult);
+
+    double mix;
+    _mix->getValueAtTime(args.time, mix);
+    bool doMasking = ( ( !_maskApply || _maskApply->getValueAtTime(args.time) ) && _maskClip && _maskClip->isConnected() );
+    if ( !premult && !doMasking && (mix == 1.) &&
+         ( (pixelComponents == ePixelComponentRGBA) || (pixelComponents == ePixelComponentRGB) ) ) {
+        // nothing to do after the conversion: convert the host image in place, without a temporary image
+        copyPixelData( false, false, false, args.time, args.renderWindow, args.renderScale, srcPixelData, bounds, pixelComponents, pixelComponentCount, bitDepth, srcRowBytes, dstImg.get() );
+
+        void* dstPixelData = NULL;
+        PixelComponentEnum dstPixelComponents;
+        BitDepthEnum dstPixelDepth;
+        int dstRowBytes;
+        getImageData(dstImg.get(), &dstPixelData, &dstBounds, &dstPixelComponents, &dstPixelDepth, &dstRowBytes);
+        apply(args.time, args.renderWindow, args.renderScale, (float*)dstPixelData, dstBounds, dstPixelComponents, dstImg->getPixelComponentCount(), dstRowBytes);
+
+        return;
+    }
 
     // allocate temporary image
     int pixelBytes = pixelComponentCount * getComponentBytes(srcBitDepth);
@@ -966,8 +1446,6 @@ OCIOCDLTransformPlugin::render(const RenderArguments &args)
     size_t memSize = (args.renderWindow.y2 - args.renderWindow.y1) * tmpRowBytes;
     ImageMemory mem(memSize, this);
     float *tmpPixelData = (float*)mem.lock();
-    bool premult;
-    _premult->getValueAtTime(args.time, premult);
 
     // copy renderWindow to the temporary image
     copyPixelData(premult, false, false, args.time, args.renderWindow, args.renderScale, srcPixelData, bounds, pixelComponents, pixelComponentCount, bitDepth, srcRowBytes, tmpPixelData, args.renderWindow, pixelComponents, pixelComponentCount, bitDepth, tmpRowBytes);
@@ -986,14 +1464,11 @@ OCIOCDLTransformPlugin::isIdentity(const IsIdentityArguments &args,
                                    , int& /*view*/, std::string& /*plane*/)
 {
     const double time = args.time;
-    double saturation;
-    double slope_r, slope_g, slope_b;
-    _slope->getValueAtTime(time, slope_r, slope_g, slope_b);
-    double offset_r, offset_g, offset_b;
-    _offset->getValueAtTime(time, offset_r, offset_g, offset_b);
-    double power_r, power_g, power_b;
-    _power->getValueAtTime(time, power_r, power_g, power_b);
-    _saturation->getValueAtTime(time, saturation);
+    double slope[3], offset[3], power[3], saturation;
+    getCDLValues(time, slope, offset, power, &saturation);
+    const double slope_r = slope[0], slope_g = slope[1], slope_b = slope[2];
+    const double offset_r = offset[0], offset_g = offset[1], offset_b = offset[2];
+    const double power_r = power[0], power_g = power[1], power_b = power[2];
     int _directioni;
     _direction->getValueAtTime(time, _directioni);
     string file;
@@ -1001,56 +1476,64 @@ OCIOCDLTransformPlugin::isIdentity(const IsIdentityArguments &args,
     string cccid;
     _cccid->getValueAtTime(time, cccid);
 
-    try {
-        AutoSetAndRestoreThreadLocale locale;
-        OCIO::ConstConfigRcPtr config = OCIO::GetCurrentConfig();
-        if (!config) {
-            throw std::runtime_error("OCIO: no current config");
-        }
-        OCIO::CDLTransformRcPtr cc = OCIO::CDLTransform::Create();
+    // the CDL can only be a no-op with the default values, don't build a processor for each animated value
+    bool defaultValues = ( slope_r == 1. && slope_g == 1. && slope_b == 1. &&
+                           offset_r == 0. && offset_g == 0. && offset_b == 0. &&
+                           power_r == 1. && power_g == 1. && power_b == 1. &&
+                           saturation == 1. );
+
+    if (defaultValues) {
+        try {
+            AutoSetAndRestoreThreadLocale locale;
+            OCIO::ConstConfigRcPtr config = OCIO::GetCurrentConfig();
+            if (!config) {
+                throw std::runtime_error("OCIO: no current config");
+            }
+            OCIO::CDLTransformRcPtr cc = OCIO::CDLTransform::Create();
 #if OCIO_VERSION_HEX >= 0x02000000
-        double sop[9] = {
-            slope_r,
-            slope_g,
-            slope_b,
-            offset_r,
-            offset_g,
-            offset_b,
-            power_r,
-            power_g,
-            power_b
-        };
+            double sop[9] = {
+                slope_r,
+                slope_g,
+                slope_b,
+                offset_r,
+                offset_g,
+                offset_b,
+                power_r,
+                power_g,
+                power_b
+            };
 #else
-        float sop[9] = {
-            (float)slope_r,
-            (float)slope_g,
-            (float)slope_b,
-            (float)offset_r,
-            (float)offset_g,
-            (float)offset_b,
-            (float)power_r,
-            (float)power_g,
-            (float)power_b
-        };
+            float sop[9] = {
+                (float)slope_r,
+                (float)slope_g,
+                (float)slope_b,
+                (float)offset_r,
+                (float)offset_g,
+                (float)offset_b,
+                (float)power_r,
+                (float)power_g,
+                (float)power_b
+            };
 #endif
-        cc->setSOP(sop);
-        cc->setSat( (float)saturation );
+            cc->setSOP(sop);
+            cc->setSat( (float)saturation );
 
-        if (_directioni == 0) {
-            cc->setDirection(OCIO::TRANSFORM_DIR_FORWARD);
-        } else {
-            cc->setDirection(OCIO::TRANSFORM_DIR_INVERSE);
-        }
+            if (_directioni == 0) {
+                cc->setDirection(OCIO::TRANSFORM_DIR_FORWARD);
+            } else {
+                cc->setDirection(OCIO::TRANSFORM_DIR_INVERSE);
+            }
 
-        OCIO::ConstProcessorRcPtr proc = config->getProcessor(cc);
-        if ( proc->isNoOp() ) {
-            identityClip = _srcClip;
+            OCIO::ConstProcessorRcPtr proc = GenericOCIO::getProcessorCached(config, OCIO::ConstContextRcPtr(), cc, OCIO::TRANSFORM_DIR_FORWARD);
+            if ( proc->isNoOp() ) {
+                identityClip = _srcClip;
 
-            return true;
+                return true;
+            }
+        } catch (const std::exception &e) {
+            setPersistentMessage( Message::eMessageError, "", e.what() );
+            throwSuiteStatusException(kOfxStatFailed);
         }
-    } catch (const std::exception &e) {
-        setPersistentMessage( Message::eMessageError, "", e.what() );
-        throwSuiteStatusException(kOfxStatFailed);
     }
 
     double mix;
@@ -1108,11 +1591,9 @@ OCIOCDLTransformPlugin::refreshKnobEnabledState(bool readFromFile)
     }
 }
 
-void
-OCIOCDLTransformPlugin::loadCDLFromFile()
+OCIO::CDLTransformRcPtr
+OCIOCDLTransformPlugin::readCDLFile()
 {
-    OCIO::CDLTransformRcPtr transform;
-
     try {
         // This is inexpensive to call multiple times, as OCIO caches results
         // internally.
@@ -1120,14 +1601,54 @@ OCIOCDLTransformPlugin::loadCDLFromFile()
         _file->getValue(file);
         string cccid;
         _cccid->getValue(cccid);
-        transform = OCIO::CDLTransform::CreateFromFile( file.c_str(), cccid.c_str() );
+
+        return OCIO::CDLTransform::CreateFromFile( file.c_str(), cccid.c_str() );
     } catch (const OCIO::Exception &e) {
         setPersistentMessage( Message::eMessageError, "", e.what() );
         throwSuiteStatusException(kOfxStatFailed);
+    }
+
+    return OCIO::CDLTransformRcPtr();
+}
+
+// When the grade is read from a file, the parameters are only set from it on the main thread (by loadCDLFromFile()),
+// and may not be loaded yet when rendering: the values are then taken from the file itself.
+void
+OCIOCDLTransformPlugin::getCDLValues(OfxTime time,
+                                     double slope[3],
+                                     double offset[3],
+                                     double power[3],
+                                     double* saturation)
+{
+    bool readFromFile;
+    _readFromFile->getValueAtTime(time, readFromFile);
+    if (readFromFile) {
+        OCIO::CDLTransformRcPtr transform = readCDLFile();
+#if OCIO_VERSION_HEX >= 0x02000000
+        double sop[9];
+#else
+        float sop[9];
+#endif
+        transform->getSOP(sop);
+        for (int c = 0; c < 3; ++c) {
+            slope[c] = sop[c];
+            offset[c] = sop[3 + c];
+            power[c] = sop[6 + c];
+        }
+        *saturation = transform->getSat();
 
         return;
     }
+    _slope->getValueAtTime(time, slope[0], slope[1], slope[2]);
+    _offset->getValueAtTime(time, offset[0], offset[1], offset[2]);
+    _power->getValueAtTime(time, power[0], power[1], power[2]);
+    *saturation = _saturation->getValueAtTime(time);
+}
 
+void
+OCIOCDLTransformPlugin::loadCDLFromFile()
+{
+    OCIO::CDLTransformRcPtr transform = readCDLFile();
 
 #if OCIO_VERSION_HEX >= 0x02000000
     double sop[9];
@@ -1433,6 +1954,16 @@ OCIOCDLTransformPluginFactory::describeInContext(ImageEffectDescriptor &desc,
             page->addChild(*param);
         }
     }
+    {
+        BooleanParamDescriptor *param = desc.defineBooleanParam(kParamFastPower);
+        param->setLabel(kParamFastPowerLabel);
+        param->setHint(kParamFastPowerHint);
+        param->setAnimates(false);
+        param->setDefault(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
     {
         BooleanParamDescriptor *param = desc.defineBooleanParam(kParamReadFromFile);
         param->setLabel(kParamReadFromFileLabel);
@@ -26,6 +26,7 @@
 //#include <iostream>
 #include <memory>
 #include <algorithm>
+#include <sstream>
 #ifdef DEBUG
 #include <cstdio> // printf
 #endif
@@ -365,6 +366,7 @@ private:
     DoubleParam* _gain;
     DoubleParam* _gamma;
     ChoiceParam* _channel;
+    BooleanParam* _bakeLUT;
 
     auto_ptr<GenericOCIO> _ocio;
 
@@ -394,6 +396,7 @@ OCIODisplayPlugin::OCIODisplayPlugin(OfxImageEffectHandle handle)
     , _gain(NULL)
     , _gamma(NULL)
     , _channel(NULL)
+    , _bakeLUT(NULL)
     , _ocio( new GenericOCIO(this) )
     , _procChannel(eChannelSelectorRGB)
     , _procGain(-1)
@@ -420,6 +423,8 @@ OCIODisplayPlugin::OCIODisplayPlugin(OfxImageEffectHandle handle)
     _gamma = fetchDoubleParam(kParamGamma);
     _channel = fetchChoiceParam(kParamChannelSelector);
     assert(_display && _view && _gain && _gamma && _channel);
+    _bakeLUT = fetchBooleanParam(kOCIOParamBakeLUT);
+    assert(_bakeLUT);
     _display = fetchStringParam(kParamDisplay);
     _view = fetchStringParam(kParamView);
 
@@ -671,172 +676,179 @@ OCIODisplayPlugin::getProcessor(OfxTime time)
              ( _procView != view) ||
              ( _procGain != gain) ||
              ( _procGamma != gamma) ) {
+            OCIO::ConstContextRcPtr context = _ocio->getLocalContext(time);
+            // the processor only depends on these parameters, given the config and context
+            std::ostringstream key;
+            key.precision(17);
+            key << "OCIODisplay\n" << inputSpace << '\n' << display << '\n' << view << '\n' << gain << '\n' << gamma << '\n' << (int)channel;
+            _proc = GenericOCIO::findProcessorCached( config, context, key.str() );
+            if (!_proc) {
 #         if OCIO_VERSION_HEX >= 0x02000000
-            auto displayViewTransform = OCIO::DisplayViewTransform::Create();
-            displayViewTransform->setSrc( inputSpace.c_str() );
-
-            displayViewTransform->setDisplay( display.c_str() );
+                auto displayViewTransform = OCIO::DisplayViewTransform::Create();
+                displayViewTransform->setSrc( inputSpace.c_str() );
 
-            displayViewTransform->setView( view.c_str() );
+                displayViewTransform->setDisplay( display.c_str() );
 
-            auto transform = OCIO::LegacyViewingPipeline::Create();
-            transform->setDisplayViewTransform(displayViewTransform);
+                displayViewTransform->setView( view.c_str() );
 
-            // Specify an (optional) linear color correction
-            if (gain != 1.) {
-                double m44[16];
-                double offset4[4];
-                const double slope4d[] = { gain, gain, gain, gain };
-                OCIO::MatrixTransform::Scale(m44, offset4, slope4d);
+                auto transform = OCIO::LegacyViewingPipeline::Create();
+                transform->setDisplayViewTransform(displayViewTransform);
 
-                OCIO::MatrixTransformRcPtr mtx =  OCIO::MatrixTransform::Create();
-                mtx->setMatrix(m44);
-                mtx->setOffset(offset4);
+                // Specify an (optional) linear color correction
+                if (gain != 1.) {
+                    double m44[16];
+                    double offset4[4];
+                    const double slope4d[] = { gain, gain, gain, gain };
+                    OCIO::MatrixTransform::Scale(m44, offset4, slope4d);
 
-                transform->setLinearCC(mtx);
-            }
+                    OCIO::MatrixTransformRcPtr mtx =  OCIO::MatrixTransform::Create();
+                    mtx->setMatrix(m44);
+                    mtx->setOffset(offset4);
 
-            // Specify an (optional) post-display transform.
-            if (gamma != 1.) {
-                double exponent = 1.0 / (std::max)(1e-8, gamma);
-                const double exponent4d[] = { exponent, exponent, exponent, exponent };
-                OCIO::ExponentTransformRcPtr cc =  OCIO::ExponentTransform::Create();
-                cc->setValue(exponent4d);
-                transform->setDisplayCC(cc);
-            }
+                    transform->setLinearCC(mtx);
+                }
 
-            // Add Channel swizzling
-            if (channel != eChannelSelectorRGB) {
-                int channelHot[4] = { 0, 0, 0, 0};
-
-                switch (channel) {
-                case eChannelSelectorLuminance:     // Luma
-                    channelHot[0] = 1;
-                    channelHot[1] = 1;
-                    channelHot[2] = 1;
-                    break;
-                //case eChannelSelectorMatteOverlay: //  Channel overlay mode. Do rgb, and then swizzle later
-                //    channelHot[0] = 1;
-                //    channelHot[1] = 1;
-                //    channelHot[2] = 1;
-                //    channelHot[3] = 1;
-                //    break;
-                case eChannelSelectorRGB:     // RGB
-                    channelHot[0] = 1;
-                    channelHot[1] = 1;
-                    channelHot[2] = 1;
-                    channelHot[3] = 1;
-                    break;
-                case eChannelSelectorR:     // R
-                    channelHot[0] = 1;
-                    break;
-                case eChannelSelectorG:     // G
-                    channelHot[1] = 1;
-                    break;
-                case eChannelSelectorB:     // B
-                    channelHot[2] = 1;
-                    break;
-                case eChannelSelectorA:     // A
-                    channelHot[3] = 1;
-                    break;
-                default:
-                    break;
+                // Specify an (optional) post-display transform.
+                if (gamma != 1.) {
+                    double exponent = 1.0 / (std::max)(1e-8, gamma);
+                    const double exponent4d[] = { exponent, exponent, exponent, exponent };
+                    OCIO::ExponentTransformRcPtr cc =  OCIO::ExponentTransform::Create();
+                    cc->setValue(exponent4d);
+                    transform->setDisplayCC(cc);
                 }
 
-                double lumacoef[3];
-                config->getDefaultLumaCoefs(lumacoef);
-                double m44[16];
-                double offset[4];
-                OCIO::MatrixTransform::View(m44, offset, channelHot, lumacoef);
-                OCIO::MatrixTransformRcPtr swizzle = OCIO::MatrixTransform::Create();
-                swizzle->setMatrix(m44);
-                swizzle->setOffset(offset);
-                transform->setChannelView(swizzle);
-            }
+                // Add Channel swizzling
+                if (channel != eChannelSelectorRGB) {
+                    int channelHot[4] = { 0, 0, 0, 0};
+
+                    switch (channel) {
+                    case eChannelSelectorLuminance:     // Luma
+                        channelHot[0] = 1;
+                        channelHot[1] = 1;
+                        channelHot[2] = 1;
+                        break;
+                    //case eChannelSelectorMatteOverlay: //  Channel overlay mode. Do rgb, and then swizzle later
+                    //    channelHot[0] = 1;
+                    //    channelHot[1] = 1;
+                    //    channelHot[2] = 1;
+                    //    channelHot[3] = 1;
+                    //    break;
+                    case eChannelSelectorRGB:     // RGB
+                        channelHot[0] = 1;
+                        channelHot[1] = 1;
+                        channelHot[2] = 1;
+                        channelHot[3] = 1;
+                        break;
+                    case eChannelSelectorR:     // R
+                        channelHot[0] = 1;
+                        break;
+                    case eChannelSelectorG:     // G
+                        channelHot[1] = 1;
+                        break;
+                    case eChannelSelectorB:     // B
+                        channelHot[2] = 1;
+                        break;
+                    case eChannelSelectorA:     // A
+                        channelHot[3] = 1;
+                        break;
+                    default:
+                        break;
+                    }
+
+                    double lumacoef[3];
+                    config->getDefaultLumaCoefs(lumacoef);
+                    double m44[16];
+                    double offset[4];
+                    OCIO::MatrixTransform::View(m44, offset, channelHot, lumacoef);
+                    OCIO::MatrixTransformRcPtr swizzle = OCIO::MatrixTransform::Create();
+                    swizzle->setMatrix(m44);
+                    swizzle->setOffset(offset);
+                    transform->setChannelView(swizzle);
+                }
 
-            OCIO::ConstContextRcPtr context = _ocio->getLocalContext(time);
-            _proc = transform->getProcessor(config, context);
+                _proc = transform->getProcessor(config, context);
 #         else // OCIO_VERSION_HEX < 0x02000000
-            OCIO::DisplayTransformRcPtr transform = OCIO::DisplayTransform::Create();
-            transform->setInputColorSpaceName( inputSpace.c_str() );
-
-            transform->setDisplay( display.c_str() );
+                OCIO::DisplayTransformRcPtr transform = OCIO::DisplayTransform::Create();
+                transform->setInputColorSpaceName( inputSpace.c_str() );
 
-            transform->setView( view.c_str() );
+                transform->setDisplay( display.c_str() );
 
-            // Specify an (optional) linear color correction
-            if (gain != 1.) {
-                float m44[16];
-                float offset4[4];
-                const float slope4f[] = { (float)gain, (float)gain, (float)gain, (float)gain };
-                OCIO::MatrixTransform::Scale(m44, offset4, slope4f);
+                transform->setView( view.c_str() );
 
-                OCIO::MatrixTransformRcPtr mtx =  OCIO::MatrixTransform::Create();
-                mtx->setValue(m44, offset4);
+                // Specify an (optional) linear color correction
+                if (gain != 1.) {
+                    float m44[16];
+                    float offset4[4];
+                    const float slope4f[] = { (float)gain, (float)gain, (float)gain, (float)gain };
+                    OCIO::MatrixTransform::Scale(m44, offset4, slope4f);
 
-                transform->setLinearCC(mtx);
-            }
+                    OCIO::MatrixTransformRcPtr mtx =  OCIO::MatrixTransform::Create();
+                    mtx->setValue(m44, offset4);
 
-            // Specify an (optional) post-display transform.
-            if (gamma != 1.) {
-                float exponent = 1.0f / (std::max)(1e-6f, (float)gamma);
-                const float exponent4f[] = { exponent, exponent, exponent, exponent };
-                OCIO::ExponentTransformRcPtr cc =  OCIO::ExponentTransform::Create();
-                cc->setValue(exponent4f);
-                transform->setDisplayCC(cc);
-            }
+                    transform->setLinearCC(mtx);
+                }
 
-            // Add Channel swizzling
-            if (channel != eChannelSelectorRGB) {
-                int channelHot[4] = { 0, 0, 0, 0};
-
-                switch (channel) {
-                case eChannelSelectorLuminance:     // Luma
-                    channelHot[0] = 1;
-                    channelHot[1] = 1;
-                    channelHot[2] = 1;
-                    break;
-                //case eChannelSelectorMatteOverlay: //  Channel overlay mode. Do rgb, and then swizzle later
-                //    channelHot[0] = 1;
-                //    channelHot[1] = 1;
-                //    channelHot[2] = 1;
-                //    channelHot[3] = 1;
-                //    break;
-                case eChannelSelectorRGB:     // RGB
-                    channelHot[0] = 1;
-                    channelHot[1] = 1;
-                    channelHot[2] = 1;
-                    channelHot[3] = 1;
-                    break;
-                case eChannelSelectorR:     // R
-                    channelHot[0] = 1;
-                    break;
-                case eChannelSelectorG:     // G
-                    channelHot[1] = 1;
-                    break;
-                case eChannelSelectorB:     // B
-                    channelHot[2] = 1;
-                    break;
-                case eChannelSelectorA:     // A
-                    channelHot[3] = 1;
-                    break;
-                default:
-                    break;
+                // Specify an (optional) post-display transform.
+                if (gamma != 1.) {
+                    float exponent = 1.0f / (std::max)(1e-6f, (float)gamma);
+                    const float exponent4f[] = { exponent, exponent, exponent, exponent };
+                    OCIO::ExponentTransformRcPtr cc =  OCIO::ExponentTransform::Create();
+                    cc->setValue(exponent4f);
+                    transform->setDisplayCC(cc);
                 }
 
-                float lumacoef[3];
-                config->getDefaultLumaCoefs(lumacoef);
-                float m44[16];
-                float offset[4];
-                OCIO::MatrixTransform::View(m44, offset, channelHot, lumacoef);
-                OCIO::MatrixTransformRcPtr swizzle = OCIO::MatrixTransform::Create();
-                swizzle->setValue(m44, offset);
-                transform->setChannelView(swizzle);
-            }
+                // Add Channel swizzling
+                if (channel != eChannelSelectorRGB) {
+                    int channelHot[4] = { 0, 0, 0, 0};
+
+                    switch (channel) {
+                    case eChannelSelectorLuminance:     // Luma
+                        channelHot[0] = 1;
+                        channelHot[1] = 1;
+                        channelHot[2] = 1;
+                        break;
+                    //case eChannelSelectorMatteOverlay: //  Channel overlay mode. Do rgb, and then swizzle later
+                    //    channelHot[0] = 1;
+                    //    channelHot[1] = 1;
+                    //    channelHot[2] = 1;
+                    //    channelHot[3] = 1;
+                    //    break;
+                    case eChannelSelectorRGB:     // RGB
+                        channelHot[0] = 1;
+                        channelHot[1] = 1;
+                        channelHot[2] = 1;
+                        channelHot[3] = 1;
+                        break;
+                    case eChannelSelectorR:     // R
+                        channelHot[0] = 1;
+                        break;
+                    case eChannelSelectorG:     // G
+                        channelHot[1] = 1;
+                        break;
+                    case eChannelSelectorB:     // B
+                        channelHot[2] = 1;
+                        break;
+                    case eChannelSelectorA:     // A
+                        channelHot[3] = 1;
+                        break;
+                    default:
+                        break;
+                    }
+
+                    float lumacoef[3];
+                    config->getDefaultLumaCoefs(lumacoef);
+                    float m44[16];
+                    float offset[4];
+                    OCIO::MatrixTransform::View(m44, offset, channelHot, lumacoef);
+                    OCIO::MatrixTransformRcPtr swizzle = OCIO::MatrixTransform::Create();
+                    swizzle->setValue(m44, offset);
+                    transform->setChannelView(swizzle);
+                }
 
-            OCIO::ConstContextRcPtr context = _ocio->getLocalContext(time);
-            _proc = config->getProcessor(context, transform, OCIO::TRANSFORM_DIR_FORWARD);
+                _proc = config->getProcessor(context, transform, OCIO::TRANSFORM_DIR_FORWARD);
 #         endif // OCIO_VERSION_HEX < 0x02000000
+                GenericOCIO::insertProcessorCached(config, context, key.str(), _proc);
+            }
             _procInputSpace = inputSpace;
             _procChannel = channel;
             _procDisplay = display;
@@ -876,6 +888,9 @@ OCIODisplayPlugin::apply(double time,
     processor.setDstImg(pixelData, bounds, pixelComponents, pixelComponentCount, eBitDepthFloat, rowBytes);
 
     processor.setProcessor( getProcessor(time) );
+    // the alpha channel view copies alpha to RGB, which a 3D LUT can't do
+    processor.setBakeLUT( _bakeLUT->getValueAtTime(time) &&
+                          ( (ChannelSelectorEnum)_channel->getValueAtTime(time) != eChannelSelectorA ) );
 
     // set the render window
     processor.setRenderWindow(renderWindow, renderScale);
@@ -1392,6 +1407,17 @@ OCIODisplayPluginFactory::describeInContext(ImageEffectDescriptor &desc,
         }
     }
 
+    {
+        BooleanParamDescriptor* param = desc.defineBooleanParam(kOCIOParamBakeLUT);
+        param->setLabel(kOCIOParamBakeLUTLabel);
+        param->setHint(kOCIOParamBakeLUTHint);
+        param->setDefault(false);
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
     {
         BooleanParamDescriptor* param = desc.defineBooleanParam(kParamEnableGPU);
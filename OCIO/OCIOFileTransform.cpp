@@ -35,6 +35,23 @@
 #ifdef DEBUG
 #include <cstdio>
 #endif
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <list>
+#include <sstream>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if !defined(_WIN32)
+#include <dirent.h>
+#include <fcntl.h> // open
+#include <unistd.h> // close
+#include <sys/mman.h> // mmap
+#endif
 
 #include "ofxsProcessing.H"
 #include "ofxsThreadSuite.h"
@@ -44,6 +61,7 @@
 #include "ofxsMacros.h"
 #include "ofxsCoords.h"
 #include "GenericOCIO.h"
+#include "fast_mutex.h"
 
 namespace OCIO = OCIO_NAMESPACE;
 
@@ -122,8 +140,541 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
     "If the checkbox is not checked and is not enabled (i.e. it cannot be checked), GPU render is not available on this host."
 #endif
 
+#define kParamPreloadDirectory "preloadDirectory"
+#define kParamPreloadDirectoryLabel "Preload Directory"
+#define kParamPreloadDirectoryHint \
+    "Directory containing LUT files which are loaded when the node is created, or when this parameter is changed, " \
+    "so that the first render does not have to parse them.\n" \
+    "LUT files are shared by all OCIOFileTransform nodes, and are only loaded again if they were modified."
+
+#define kLUTFileRegistryMax 256 // number of LUT files kept in the registry
+
 static bool gHostIsNatron = false; // TODO: generate a CCCId choice param kParamCCCIDChoice from available IDs
 
+/**
+ * @brief The LUT file registry, shared by all instances.
+ *
+ * Each file is loaded once, and identified by its path, size and modification time.
+ * With OCIO 2, .cube files are mapped in memory and parsed by the plugin, and the registry keeps the
+ * resulting LUT transform, so that the file is not parsed again when processors are rebuilt.
+ * Other files are parsed by OCIO, which keeps them in its own file cache: since clearing that cache
+ * affects the whole process, it is only done by the Reload button, and a modified file is re-read by OCIO
+ * only after Reload.
+ **/
+struct LUTFileStamp
+{
+    long long size;
+    long long mtimeSec;
+    long long mtimeNSec; // 0 where the file system or the platform only has seconds
+
+    bool operator==(const LUTFileStamp& other) const
+    {
+        return size == other.size && mtimeSec == other.mtimeSec && mtimeNSec == other.mtimeNSec;
+    }
+};
+
+struct LUTFileEntry
+{
+    LUTFileStamp stamp;
+    unsigned long long loadId; // a different value each time a file is registered, used in the processor cache key
+    OCIO::ConstTransformRcPtr transform; // the LUT parsed by the plugin, or NULL if the file is parsed by OCIO
+};
+
+static std::list<std::pair<string, LUTFileEntry> > gLUTFiles; // most recently used first
+static tthread::fast_mutex gLUTFilesMutex; // the registry is static, and can't use the OFX MT-Suite mutex
+static unsigned long long gLUTFilesLoads = 0; // the number of files registered, protected by gLUTFilesMutex
+
+static bool
+getLUTFileStamp(const string& filename,
+                LUTFileStamp* stamp)
+{
+#if defined(_WIN32)
+    struct _stat64 st;
+    if (_stat64(filename.c_str(), &st) != 0) {
+        return false;
+    }
+    stamp->size = (long long)st.st_size;
+    stamp->mtimeSec = (long long)st.st_mtime;
+    stamp->mtimeNSec = 0;
+#else
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) {
+        return false;
+    }
+    stamp->size = (long long)st.st_size;
+#if defined(__APPLE__)
+    stamp->mtimeSec = (long long)st.st_mtimespec.tv_sec;
+    stamp->mtimeNSec = (long long)st.st_mtimespec.tv_nsec;
+#else
+    stamp->mtimeSec = (long long)st.st_mtim.tv_sec;
+    stamp->mtimeNSec = (long long)st.st_mtim.tv_nsec;
+#endif
+#endif
+
+    return true;
+}
+
+/**
+ * @brief The read-only contents of a file, mapped in memory where possible.
+ **/
+class MappedLUTFile
+{
+public:
+    explicit MappedLUTFile(const string& filename)
+        : _data(NULL)
+        , _size(0)
+#if !defined(_WIN32)
+        , _mapped(false)
+#endif
+    {
+#if !defined(_WIN32)
+        int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if ( (fstat(fd, &st) == 0) && (st.st_size > 0) ) {
+            void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                _data = (const char*)data;
+                _size = (size_t)st.st_size;
+                _mapped = true;
+            }
+        }
+        close(fd); // the mapping stays valid
+#else
+        std::ifstream ifs(filename.c_str(), std::ios::in | std::ios::binary);
+        if (ifs) {
+            _buffer.assign( std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>() );
+            if ( !_buffer.empty() ) {
+                _data = &_buffer[0];
+                _size = _buffer.size();
+            }
+        }
+#endif
+    }
+
+    ~MappedLUTFile()
+    {
+#if !defined(_WIN32)
+        if (_mapped) {
+            munmap( (void*)_data, _size );
+        }
+#endif
+    }
+
+    const char* data() const { return _data; }
+
+    std::size_t size() const { return _size; }
+
+private:
+    const char* _data;
+    std::size_t _size;
+#if !defined(_WIN32)
+    bool _mapped;
+#else
+    std::vector<char> _buffer;
+#endif
+};
+
+#if OCIO_VERSION_HEX >= 0x02000000
+static inline bool
+isCubeSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Locale-independent parsing of a decimal number, p is moved after the number.
+static bool
+parseCubeFloat(const char*& p,
+               const char* end,
+               float* v)
+{
+    while ( p < end && isCubeSpace(*p) ) {
+        ++p;
+    }
+    bool negative = false;
+    if ( (p < end) && ( (*p == '-') || (*p == '+') ) ) {
+        negative = (*p == '-');
+        ++p;
+    }
+    double mantissa = 0.;
+    int exponent = 0;
+    int digits = 0;
+    int significant = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p, ++digits) {
+        if (significant < 18) {
+            mantissa = mantissa * 10. + (*p - '0');
+            significant += (mantissa != 0.);
+        } else {
+            ++exponent;
+        }
+    }
+    if ( (p < end) && (*p == '.') ) {
+        for (++p; p < end && *p >= '0' && *p <= '9'; ++p, ++digits) {
+            if (significant < 18) {
+                mantissa = mantissa * 10. + (*p - '0');
+                significant += (mantissa != 0.);
+                --exponent;
+            }
+        }
+    }
+    if (digits == 0) {
+        return false;
+    }
+    if ( (p < end) && ( (*p == 'e') || (*p == 'E') ) ) {
+        ++p;
+        bool negativeExponent = false;
+        if ( (p < end) && ( (*p == '-') || (*p == '+') ) ) {
+            negativeExponent = (*p == '-');
+            ++p;
+        }
+        if ( (p >= end) || (*p < '0') || (*p > '9') ) {
+            return false;
+        }
+        int e = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+            e = (std::min)(e * 10 + (*p - '0'), 10000);
+        }
+        exponent += negativeExponent ? -e : e;
+    }
+    double value = (exponent == 0) ? mantissa : mantissa * std::pow(10., exponent);
+    *v = (float)(negative ? -value : value);
+
+    return true;
+} // parseCubeFloat
+
+// parse n numbers and check that the line ends after them
+static bool
+parseCubeFloats(const char* p,
+                const char* eol,
+                int n,
+                float* v)
+{
+    for (int i = 0; i < n; ++i) {
+        if ( !parseCubeFloat(p, eol, &v[i]) ) {
+            return false;
+        }
+    }
+    while ( p < eol && isCubeSpace(*p) ) {
+        ++p;
+    }
+
+    return p == eol;
+}
+
+/**
+ * @brief Parse an Iridas or Resolve .cube file containing a single 1D or 3D LUT on the default domain.
+ *
+ * Returns NULL if the file uses anything else (shaper LUTs, custom domains...), which is left to the OCIO reader.
+ **/
+static OCIO::TransformRcPtr
+parseCubeFile(const char* data,
+              std::size_t size)
+{
+    const char* p = data;
+    const char* const end = data + size;
+    int size1D = 0;
+    int size3D = 0;
+    std::vector<float> values;
+
+    while (p < end) {
+        const char* eol = std::find(p, end, '\n');
+        while ( p < eol && isCubeSpace(*p) ) {
+            ++p;
+        }
+        if ( (p == eol) || (*p == '#') ) {
+            // empty line or comment
+        } else if ( ( (*p >= '0') && (*p <= '9') ) || (*p == '-') || (*p == '+') || (*p == '.') ) {
+            if ( (size1D == 0) && (size3D == 0) ) {
+                return OCIO::TransformRcPtr(); // the size must come first
+            }
+            float rgb[3];
+            if ( !parseCubeFloats(p, eol, 3, rgb) ) {
+                return OCIO::TransformRcPtr();
+            }
+            values.insert(values.end(), rgb, rgb + 3);
+        } else {
+            const char* kw = p;
+            while ( p < eol && !isCubeSpace(*p) ) {
+                ++p;
+            }
+            const string keyword(kw, p);
+            float v[3];
+            if (keyword == "TITLE") {
+                // ignored
+            } else if ( (keyword == "LUT_1D_SIZE") || (keyword == "LUT_3D_SIZE") ) {
+                if ( !parseCubeFloats(p, eol, 1, v) || (v[0] < 2) || (v[0] > (keyword == "LUT_1D_SIZE" ? 1048576 : 256)) || !values.empty() ) {
+                    return OCIO::TransformRcPtr();
+                }
+                if (keyword == "LUT_1D_SIZE") {
+                    size1D = (int)v[0];
+                } else {
+                    size3D = (int)v[0];
+                }
+            } else if (keyword == "DOMAIN_MIN") {
+                if ( !parseCubeFloats(p, eol, 3, v) || (v[0] != 0.f) || (v[1] != 0.f) || (v[2] != 0.f) ) {
+                    return OCIO::TransformRcPtr();
+                }
+            } else if (keyword == "DOMAIN_MAX") {
+                if ( !parseCubeFloats(p, eol, 3, v) || (v[0] != 1.f) || (v[1] != 1.f) || (v[2] != 1.f) ) {
+                    return OCIO::TransformRcPtr();
+                }
+            } else if ( (keyword == "LUT_1D_INPUT_RANGE") || (keyword == "LUT_3D_INPUT_RANGE") ) {
+                if ( !parseCubeFloats(p, eol, 2, v) || (v[0] != 0.f) || (v[1] != 1.f) ) {
+                    return OCIO::TransformRcPtr();
+                }
+            } else {
+                return OCIO::TransformRcPtr();
+            }
+        }
+        p = (eol < end) ? eol + 1 : end;
+    }
+
+    if ( (size1D > 0) && (size3D == 0) && ( values.size() == 3 * (std::size_t)size1D ) ) {
+        OCIO::Lut1DTransformRcPtr lut = OCIO::Lut1DTransform::Create();
+        lut->setLength(size1D);
+        for (int i = 0; i < size1D; ++i) {
+            lut->setValue(i, values[3 * i], values[3 * i + 1], values[3 * i + 2]);
+        }
+
+        return lut;
+    }
+    if ( (size3D > 0) && (size1D == 0) && ( values.size() == 3 * (std::size_t)size3D * size3D * size3D ) ) {
+        OCIO::Lut3DTransformRcPtr lut = OCIO::Lut3DTransform::Create();
+        lut->setGridSize(size3D);
+        // red varies fastest in the file
+        std::size_t i = 0;
+        for (int b = 0; b < size3D; ++b) {
+            for (int g = 0; g < size3D; ++g) {
+                for (int r = 0; r < size3D; ++r, i += 3) {
+                    lut->setValue(r, g, b, values[i], values[i + 1], values[i + 2]);
+                }
+            }
+        }
+
+        return lut;
+    }
+
+    return OCIO::TransformRcPtr();
+} // parseCubeFile
+
+#endif // OCIO_VERSION_HEX >= 0x02000000
+
+static bool
+hasExtension(const string& filename,
+             const char* ext)
+{
+    const std::size_t len = std::strlen(ext);
+    if ( filename.size() <= len || filename[filename.size() - len - 1] != '.' ) {
+        return false;
+    }
+    for (std::size_t i = 0; i < len; ++i) {
+        if ( std::tolower( (unsigned char)filename[filename.size() - len + i] ) != std::tolower( (unsigned char)ext[i] ) ) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Get the registry entry of a LUT file, loading it if it is not registered or was modified.
+ * Returns false if the file does not exist.
+ **/
+static bool
+getLUTFile(const string& filename,
+           LUTFileEntry* entry)
+{
+    LUTFileStamp stamp;
+
+    if ( !getLUTFileStamp(filename, &stamp) ) {
+        return false;
+    }
+    {
+        OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gLUTFilesMutex);
+        for (std::list<std::pair<string, LUTFileEntry> >::iterator it = gLUTFiles.begin(); it != gLUTFiles.end(); ++it) {
+            if (it->first == filename) {
+                if (it->second.stamp == stamp) {
+                    gLUTFiles.splice( gLUTFiles.begin(), gLUTFiles, it );
+                    *entry = gLUTFiles.front().second;
+
+                    return true;
+                }
+                // modified: OCIO's file cache is not cleared here, since this may be called from render (see the Reload button)
+                gLUTFiles.erase(it);
+                break;
+            }
+        }
+    }
+
+    // load the file without holding the lock
+    entry->stamp = stamp;
+    entry->transform.reset();
+#if OCIO_VERSION_HEX >= 0x02000000
+    if ( hasExtension(filename, "cube") ) {
+        MappedLUTFile file(filename);
+        if ( file.data() ) {
+            entry->transform = parseCubeFile( file.data(), file.size() );
+        }
+    }
+#endif
+    {
+        OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gLUTFilesMutex);
+        // another thread may have loaded the same file meanwhile
+        for (std::list<std::pair<string, LUTFileEntry> >::iterator it = gLUTFiles.begin(); it != gLUTFiles.end(); ++it) {
+            if (it->first == filename) {
+                gLUTFiles.erase(it);
+                break;
+            }
+        }
+        entry->loadId = ++gLUTFilesLoads;
+        gLUTFiles.push_front( std::make_pair(filename, *entry) );
+        if (gLUTFiles.size() > kLUTFileRegistryMax) {
+            gLUTFiles.pop_back();
+        }
+    }
+
+    return true;
+} // getLUTFile
+
+static void
+clearLUTFiles()
+{
+    OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gLUTFilesMutex);
+
+    gLUTFiles.clear();
+}
+
+/**
+ * @brief Get the processor for a LUT file. Processors are shared by all instances through the GenericOCIO cache.
+ * The locale must be set by the caller.
+ **/
+static OCIO::ConstProcessorRcPtr
+getLUTFileProcessor(const OCIO::ConstConfigRcPtr& config,
+                    const string& filename,
+                    const string& cccid,
+                    OCIO::TransformDirection direction,
+                    OCIO::Interpolation interpolation)
+{
+    LUTFileEntry entry;
+
+    if ( !getLUTFile(filename, &entry) ) {
+        // let OCIO report the error
+        OCIO::FileTransformRcPtr transform = OCIO::FileTransform::Create();
+        transform->setSrc( filename.c_str() );
+
+        return config->getProcessor(transform, OCIO::TRANSFORM_DIR_FORWARD);
+    }
+
+    std::ostringstream os;
+    os << "lutfile\n" << filename << '\n' << entry.loadId << '\n' << cccid << '\n' << (int)direction << '\n' << (int)interpolation;
+    const string key = os.str();
+    OCIO::ConstProcessorRcPtr proc = GenericOCIO::findProcessorCached(config, OCIO::ConstContextRcPtr(), key);
+    if (proc) {
+        return proc;
+    }
+
+    OCIO::TransformRcPtr transform;
+#if OCIO_VERSION_HEX >= 0x02000000
+    if (entry.transform) {
+        // the interpolations which OCIO does not support on this kind of LUT are left to the OCIO reader
+        transform = entry.transform->createEditableCopy();
+        OCIO::Lut1DTransformRcPtr lut1D = OCIO_DYNAMIC_POINTER_CAST<OCIO::Lut1DTransform>(transform);
+        OCIO::Lut3DTransformRcPtr lut3D = OCIO_DYNAMIC_POINTER_CAST<OCIO::Lut3DTransform>(transform);
+        if ( lut1D && (interpolation != OCIO::INTERP_TETRAHEDRAL) ) {
+            lut1D->setInterpolation(interpolation);
+        } else if ( lut3D && (interpolation != OCIO::INTERP_NEAREST) ) {
+            lut3D->setInterpolation(interpolation);
+        } else {
+            transform.reset();
+        }
+        if (transform) {
+            transform->setDirection(direction);
+        }
+    }
+#endif
+    if (!transform) {
+        OCIO::FileTransformRcPtr fileTransform = OCIO::FileTransform::Create();
+        fileTransform->setSrc( filename.c_str() );
+        fileTransform->setCCCId( cccid.c_str() );
+        fileTransform->setDirection(direction);
+        fileTransform->setInterpolation(interpolation);
+        transform = fileTransform;
+    }
+    proc = config->getProcessor(transform, OCIO::TRANSFORM_DIR_FORWARD);
+    GenericOCIO::insertProcessorCached(config, OCIO::ConstContextRcPtr(), key, proc);
+
+    return proc;
+} // getLUTFileProcessor
+
+/**
+ * @brief Load all the LUT files from a directory into the registry, and build their default processor.
+ * Files which can not be loaded are skipped.
+ **/
+static void
+preloadLUTDirectory(const string& dirname)
+{
+    std::vector<string> filenames;
+#if defined(_WIN32)
+    WIN32_FIND_DATAA findData;
+    HANDLE handle = FindFirstFileA( (dirname + "\\*").c_str(), &findData );
+    if (handle == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    do {
+        if ( !(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ) {
+            filenames.push_back(dirname + '\\' + findData.cFileName);
+        }
+    } while ( FindNextFileA(handle, &findData) );
+    FindClose(handle);
+#else
+    DIR* dir = opendir( dirname.c_str() );
+    if (!dir) {
+        return;
+    }
+    while (struct dirent* dirEntry = readdir(dir)) {
+        if (dirEntry->d_name[0] != '.') {
+            filenames.push_back(dirname + '/' + dirEntry->d_name);
+        }
+    }
+    closedir(dir);
+#endif
+
+    try {
+        AutoSetAndRestoreThreadLocale locale;
+        OCIO::ConstConfigRcPtr config = OCIO::GetCurrentConfig();
+        if (!config) {
+            return;
+        }
+        for (std::vector<string>::const_iterator it = filenames.begin(); it != filenames.end(); ++it) {
+            bool supported = false;
+# if OCIO_VERSION_HEX >= 0x02000000
+            for (int i = 0; i < OCIO::FileTransform::GetNumFormats() && !supported; ++i) {
+                supported = hasExtension( *it, OCIO::FileTransform::GetFormatExtensionByIndex(i) );
+            }
+# else
+            for (int i = 0; i < OCIO::FileTransform::getNumFormats() && !supported; ++i) {
+                supported = hasExtension( *it, OCIO::FileTransform::getFormatExtensionByIndex(i) );
+            }
+# endif
+            if (!supported) {
+                continue;
+            }
+            try {
+                // the default parameters of the plugin
+                getLUTFileProcessor(config, *it, string(), OCIO::TRANSFORM_DIR_FORWARD, OCIO::INTERP_LINEAR);
+            } catch (const std::exception &e) {
+#             ifdef DEBUG
+                std::fprintf( stderr, "OCIOFileTransform: cannot preload %s: %s\n", it->c_str(), e.what() );
+#             endif
+            }
+        }
+    } catch (const std::exception &) {
+        // no config
+    }
+} // preloadLUTDirectory
+
 class OCIOFileTransformPlugin
     : public ImageEffect
 {
@@ -311,6 +862,7 @@ private:
     StringParam *_cccid;
     ChoiceParam *_direction;
     ChoiceParam *_interpolation;
+    StringParam *_preloadDirectory;
     BooleanParam* _premult;
     ChoiceParam* _premultChannel;
     DoubleParam* _mix;
@@ -320,6 +872,7 @@ private:
     GenericOCIO::Mutex _procMutex;
     OCIO::ConstProcessorRcPtr _proc;
     string _procFile;
+    LUTFileStamp _procFileStamp;
     string _procCCCId;
     int _procDirection;
     int _procInterpolation;
@@ -340,11 +893,13 @@ OCIOFileTransformPlugin::OCIOFileTransformPlugin(OfxImageEffectHandle handle)
     , _cccid(NULL)
     , _direction(NULL)
     , _interpolation(NULL)
+    , _preloadDirectory(NULL)
     , _premult(NULL)
     , _premultChannel(NULL)
     , _mix(NULL)
     , _maskApply(NULL)
     , _maskInvert(NULL)
+    , _procFileStamp()
     , _procDirection(-1)
     , _procInterpolation(-1)
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
@@ -366,7 +921,8 @@ OCIOFileTransformPlugin::OCIOFileTransformPlugin(OfxImageEffectHandle handle)
     _cccid = fetchStringParam(kParamCCCID);
     _direction = fetchChoiceParam(kParamDirection);
     _interpolation = fetchChoiceParam(kParamInterpolation);
-    assert(_file && _version && _cccid && _direction && _interpolation);
+    _preloadDirectory = fetchStringParam(kParamPreloadDirectory);
+    assert(_file && _version && _cccid && _direction && _interpolation && _preloadDirectory);
     _premult = fetchBooleanParam(kParamPremult);
     _premultChannel = fetchChoiceParam(kParamPremultChannel);
     assert(_premult && _premultChannel);
@@ -388,6 +944,12 @@ OCIOFileTransformPlugin::OCIOFileTransformPlugin(OfxImageEffectHandle handle)
 #endif
 
     updateCCCId();
+
+    string dirname;
+    _preloadDirectory->getValue(dirname);
+    if ( !dirname.empty() ) {
+        preloadLUTDirectory(dirname);
+    }
 }
 
 OCIOFileTransformPlugin::~OCIOFileTransformPlugin()
@@ -552,6 +1114,9 @@ OCIOFileTransformPlugin::getProcessor(OfxTime time)
     _cccid->getValueAtTime(time, cccid);
     int directioni = _direction->getValueAtTime(time);
     int interpolationi = _interpolation->getValueAtTime(time);
+    // the processor must be rebuilt if the file was modified
+    LUTFileStamp stamp = { -1, -1, -1 };
+    getLUTFileStamp(file, &stamp);
 
     try {
         AutoSetAndRestoreThreadLocale locale;
@@ -562,27 +1127,19 @@ OCIOFileTransformPlugin::getProcessor(OfxTime time)
         GenericOCIO::AutoMutex guard(_procMutex);
         if ( !_proc ||
              ( _procFile != file) ||
+             !( _procFileStamp == stamp) ||
              ( _procCCCId != cccid) ||
              ( _procDirection != directioni) ||
              ( _procInterpolation != interpolationi) ) {
-            OCIO::FileTransformRcPtr transform = OCIO::FileTransform::Create();
-            transform->setSrc( file.c_str() );
-            transform->setCCCId( cccid.c_str() );
-
-            if (directioni == 0) {
-                transform->setDirection(OCIO::TRANSFORM_DIR_FORWARD);
-            } else {
-                transform->setDirection(OCIO::TRANSFORM_DIR_INVERSE);
-            }
-
+            OCIO::Interpolation interpolation;
             if (interpolationi == 0) {
-                transform->setInterpolation(OCIO::INTERP_NEAREST);
+                interpolation = OCIO::INTERP_NEAREST;
             } else if (interpolationi == 1) {
-                transform->setInterpolation(OCIO::INTERP_LINEAR);
+                interpolation = OCIO::INTERP_LINEAR;
             } else if (interpolationi == 2) {
-                transform->setInterpolation(OCIO::INTERP_TETRAHEDRAL);
+                interpolation = OCIO::INTERP_TETRAHEDRAL;
             } else if (interpolationi == 3) {
-                transform->setInterpolation(OCIO::INTERP_BEST);
+                interpolation = OCIO::INTERP_BEST;
             } else {
                 // Should never happen
                 setPersistentMessage(Message::eMessageError, "", "OCIO Interpolation value out of bounds");
@@ -591,8 +1148,9 @@ OCIOFileTransformPlugin::getProcessor(OfxTime time)
                 return _proc;
             }
 
-            _proc = config->getProcessor(transform, OCIO::TRANSFORM_DIR_FORWARD);
+            _proc = getLUTFileProcessor(config, file, cccid, directioni == 0 ? OCIO::TRANSFORM_DIR_FORWARD : OCIO::TRANSFORM_DIR_INVERSE, interpolation);
             _procFile = file;
+            _procFileStamp = stamp;
             _procCCCId = cccid;
             _procDirection = directioni;
             _procInterpolation = interpolationi;
@@ -956,6 +1514,17 @@ OCIOFileTransformPlugin::changedParam(const InstanceChangedArgs &args,
     } else if ( (paramName == kParamReload) && (args.reason == eChangeUserEdit) ) {
         _version->setValue(_version->getValue() + 1); // invalidate the node cache
         OCIO::ClearAllCaches();
+        clearLUTFiles();
+        {
+            GenericOCIO::AutoMutex guard(_procMutex);
+            _proc.reset(); // get the processor from the reloaded file
+        }
+    } else if (paramName == kParamPreloadDirectory) {
+        string dirname;
+        _preloadDirectory->getValue(dirname);
+        if ( !dirname.empty() ) {
+            preloadLUTDirectory(dirname);
+        }
 #ifdef OFX_SUPPORTS_OPENGLRENDER
     } else if (paramName == kParamEnableGPU || paramName == kParamPremult) {
         // GPU rendering is wrong when (un)premult is checked
@@ -1131,6 +1700,17 @@ OCIOFileTransformPluginFactory::describeInContext(ImageEffectDescriptor &desc,
             page->addChild(*param);
         }
     }
+    {
+        StringParamDescriptor *param = desc.defineStringParam(kParamPreloadDirectory);
+        param->setLabel(kParamPreloadDirectoryLabel);
+        param->setHint(kParamPreloadDirectoryHint);
+        param->setStringType(eStringTypeDirectoryPath);
+        param->setFilePathExists(true);
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
 
 
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
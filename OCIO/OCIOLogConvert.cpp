@@ -543,7 +543,7 @@ OCIOLogConvertPlugin::getProcessor(OfxTime time)
             }
 
             AutoSetAndRestoreThreadLocale locale;
-            _proc = _config->getProcessor(src, dst);
+            _proc = GenericOCIO::getProcessorCached(_config, OCIO::ConstContextRcPtr(), src, dst);
         }
     } catch (const OCIO::Exception &e) {
         setPersistentMessage( Message::eMessageError, "", e.what() );
@@ -577,6 +577,8 @@ OCIOLogConvertPlugin::apply(double time,
     processor.setDstImg(pixelData, bounds, pixelComponents, pixelComponentCount, eBitDepthFloat, rowBytes);
 
     processor.setProcessor( getProcessor(time) );
+    // log/lin conversions have no channel crosstalk, and are applied exactly enough with a LUT per channel
+    processor.setUseChannelLUT(true);
 
     // set the render window
     processor.setRenderWindow(renderWindow, renderScale);
@@ -816,6 +818,26 @@ OCIOLogConvertPlugin::render(const RenderArguments &args)
     int srcRowBytes;
     getImageData(srcImg.get(), &srcPixelData, &bounds, &pixelComponents, &bitDepth, &srcRowBytes);
     int pixelComponentCount = srcImg->getPixelComponentCount();
+    bool premult;
+    _premult->getValueAtTime(args.time, premult);
+
+    double mix;
+    _mix->getValueAtTime(args.time, mix);
+    bool doMasking = ( ( !_maskApply || _maskApply->getValueAtTime(args.time) ) && _maskClip && _maskClip->isConnected() );
+    if ( !premult && !doMasking && (mix == 1.) &&
+         ( (pixelComponents == ePixelComponentRGBA) || (pixelComponents == ePixelComponentRGB) ) ) {
+        // nothing to do after the conversion: convert the host image in place, without a temporary image
+        copyPixelData( false, false, false, args.time, args.renderWindow, args.renderScale, srcPixelData, bounds, pixelComponents, pixelComponentCount, bitDepth, srcRowBytes, dstImg.get() );
+
+        void* dstPixelData = NULL;
+        PixelComponentEnum dstPixelComponents;
+        BitDepthEnum dstPixelDepth;
+        int dstRowBytes;
+        getImageData(dstImg.get(), &dstPixelData, &dstBounds, &dstPixelComponents, &dstPixelDepth, &dstRowBytes);
+        apply(args.time, args.renderWindow, args.renderScale, (float*)dstPixelData, dstBounds, dstPixelComponents, dstImg->getPixelComponentCount(), dstRowBytes);
+
+        return;
+    }
 
     // allocate temporary image
     int pixelBytes = pixelComponentCount * getComponentBytes(srcBitDepth);
@@ -823,8 +845,6 @@ OCIOLogConvertPlugin::render(const RenderArguments &args)
     size_t memSize = (args.renderWindow.y2 - args.renderWindow.y1) * tmpRowBytes;
     ImageMemory mem(memSize, this);
     float *tmpPixelData = (float*)mem.lock();
-    bool premult;
-    _premult->getValueAtTime(args.time, premult);
 
     // copy renderWindow to the temporary image
     copyPixelData(premult, false, false, args.time, args.renderWindow, args.renderScale, srcPixelData, bounds, pixelComponents, pixelComponentCount, bitDepth, srcRowBytes, tmpPixelData, args.renderWindow, pixelComponents, pixelComponentCount, bitDepth, tmpRowBytes);
@@ -327,6 +327,7 @@ private:
     BooleanParam* _maskApply;
     BooleanParam* _maskInvert;
     BooleanParam* _enableGPU;
+    BooleanParam* _bakeLUT;
 
     auto_ptr<GenericOCIO> _ocio;
 
@@ -358,6 +359,7 @@ OCIOLookTransformPlugin::OCIOLookTransformPlugin(OfxImageEffectHandle handle)
     , _maskApply(NULL)
     , _maskInvert(NULL)
     , _enableGPU(NULL)
+    , _bakeLUT(NULL)
     , _ocio( new GenericOCIO(this) )
     , _procDirection(-1)
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
@@ -387,6 +389,8 @@ OCIOLookTransformPlugin::OCIOLookTransformPlugin(OfxImageEffectHandle handle)
     _maskApply = paramExists(kParamMaskApply) ? fetchBooleanParam(kParamMaskApply) : 0;
     _maskInvert = fetchBooleanParam(kParamMaskInvert);
     assert(_mix && _maskInvert);
+    _bakeLUT = fetchBooleanParam(kOCIOParamBakeLUT);
+    assert(_bakeLUT);
 
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
     _enableGPU = fetchBooleanParam(kParamEnableGPU);
@@ -612,7 +616,7 @@ OCIOLookTransformPlugin::getProcessor(OfxTime time,
                 transform->setDst( inputSpace.c_str() );
                 direction = OCIO::TRANSFORM_DIR_INVERSE;
             }
-            _proc = config->getProcessor(transform, direction);
+            _proc = GenericOCIO::getProcessorCached(config, OCIO::ConstContextRcPtr(), transform, direction);
         }
 
         return _proc;
@@ -653,6 +657,7 @@ OCIOLookTransformPlugin::apply(double time,
     }
 
     processor.setProcessor( getProcessor(time, singleLook, lookCombination) );
+    processor.setBakeLUT( _bakeLUT->getValueAtTime(time) );
 
     // set the images
     processor.setDstImg(pixelData, bounds, pixelComponents, pixelComponentCount, eBitDepthFloat, rowBytes);
@@ -1190,6 +1195,17 @@ OCIOLookTransformPluginFactory::describeInContext(ImageEffectDescriptor &desc,
     }
 
 
+    {
+        BooleanParamDescriptor* param = desc.defineBooleanParam(kOCIOParamBakeLUT);
+        param->setLabel(kOCIOParamBakeLUTLabel);
+        param->setHint(kOCIOParamBakeLUTHint);
+        param->setDefault(false);
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
 #if defined(OFX_SUPPORTS_OPENGLRENDER)
     {
         BooleanParamDescriptor* param = desc.defineBooleanParam(kParamEnableGPU);
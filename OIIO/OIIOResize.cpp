@@ -23,8 +23,13 @@
  */
 
 #include <cfloat> // DBL_MAX
+#include <cmath>
+#include <cstddef> // ptrdiff_t
 #include <limits>
 #include <algorithm>
+#include <list>
+#include <memory>
+#include <vector>
 
 #include "ofxsMacros.h"
 
@@ -49,6 +54,9 @@ GCC_DIAG_ON(unused-parameter)
 #include "ofxsCopier.h"
 #include "ofxsFormatResolution.h"
 #include "ofxsCoords.h"
+#include "ofxsMultiThread.h"
+
+#include "fast_mutex.h" // the kernel cache is static, and can't use the OFX MT-Suite mutex
 
 #include "IOUtility.h"
 
@@ -61,7 +69,7 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
 #define kPluginName "ResizeOIIO"
 #define kPluginGrouping "Transform"
 #define kPluginDescription  "Resize input stream, using OpenImageIO.\n" \
-    "Note that only full images can be rendered, so it may be slower for interactive editing than the Reformat plugin.\n" \
+    "Separable filters are computed on the requested tiles only, but the impulse filter and non-separable filters (e.g. disk, radial-lanczos3) require the full source image, so they may be slower for interactive editing than the Reformat plugin.\n" \
     "However, the rendering algorithms are different between Reformat and Resize: Resize applies 1-dimensional filters in the horizontal and vertical directins, whereas Reformat resamples the image, so in some cases this plugin may give more visually pleasant results than Reformat.\n" \
     "This plugin does not concatenate transforms (as opposed to Reformat)."
 
@@ -72,7 +80,7 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
 #define kPluginVersionMajor 2 // Incrementing this number means that you have broken backwards compatibility of the plug-in.
 #define kPluginVersionMinor 0 // Increment this when you have fixed a bug or made it faster.
 
-#define kSupportsTiles 0
+#define kSupportsTiles 1
 #define kSupportsMultiResolution 1
 #define kSupportsRenderScale 1
 #define kRenderThreadSafety eRenderFullySafe
@@ -117,8 +125,245 @@ enum ResizeTypeEnum
 
 #define kSrcClipChanged "srcClipChanged"
 
+#define kResizeKernelCacheMax 16 // maximum number of filter kernels kept in the cache
+
 OIIO_NAMESPACE_USING
 
+/**
+ * @brief The weights of a 1D resize filter, for all the destination pixels of a row (or column).
+ *
+ * Each destination pixel uses the same number of taps, so that the inner loops have a fixed length.
+ * Taps are clamped to the source window (as with OIIO's WrapClamp), and weights are normalized.
+ **/
+struct ResizeKernel
+{
+    string filterName;
+    float filterWidth;
+    int srcBegin, srcEnd; // source pixel range
+    int dstBegin, dstEnd; // destination pixel range
+    int taps;
+    vector<int> first; // first source pixel of each destination pixel
+    vector<float> weights; // taps weights for each destination pixel
+};
+
+typedef std::shared_ptr<const ResizeKernel> ResizeKernelPtr;
+
+// returns a NULL pointer if the filter is not available in 1D
+static ResizeKernelPtr
+buildResizeKernel(const string& filterName,
+                  float filterWidth,
+                  int srcBegin,
+                  int srcEnd,
+                  int dstBegin,
+                  int dstEnd)
+{
+    const int srcSize = srcEnd - srcBegin;
+    const int dstSize = dstEnd - dstBegin;
+    if ( (srcSize <= 0) || (dstSize <= 0) ) {
+        return ResizeKernelPtr();
+    }
+    Filter1D* filter = Filter1D::create(filterName, filterWidth);
+    if (!filter) {
+        return ResizeKernelPtr();
+    }
+
+    // same mapping as ImageBufAlgo::resize(): the filter is evaluated in destination pixel units
+    const float ratio = float(dstSize) / float(srcSize);
+    const int radius = (int)std::ceil(filter->width() / 2.f / ratio);
+    std::shared_ptr<ResizeKernel> kernel(new ResizeKernel);
+    kernel->filterName = filterName;
+    kernel->filterWidth = filterWidth;
+    kernel->srcBegin = srcBegin;
+    kernel->srcEnd = srcEnd;
+    kernel->dstBegin = dstBegin;
+    kernel->dstEnd = dstEnd;
+    kernel->taps = (std::min)(2 * radius + 1, srcSize);
+    kernel->first.resize(dstSize);
+    kernel->weights.assign( (std::size_t)dstSize * kernel->taps, 0.f );
+
+    for (int i = 0; i < dstSize; ++i) {
+        const float srcPos = srcBegin + (i + 0.5f) / ratio;
+        const int center = (int)std::floor(srcPos);
+        // the taps window is inside the source window, and contains all the clamped source pixels
+        const int first = (std::max)( srcBegin, (std::min)(center - radius, srcEnd - kernel->taps) );
+        float* w = &kernel->weights[(std::size_t)i * kernel->taps];
+        float total = 0.f;
+        for (int j = center - radius; j <= center + radius; ++j) {
+            const float wj = (*filter)( ratio * (j + 0.5f - srcPos) );
+            const int tap = (std::max)( srcBegin, (std::min)(j, srcEnd - 1) ) - first;
+            assert(0 <= tap && tap < kernel->taps);
+            w[tap] += wj;
+            total += wj;
+        }
+        if (total != 0.f) {
+            for (int k = 0; k < kernel->taps; ++k) {
+                w[k] /= total;
+            }
+        } else {
+            w[(std::max)( srcBegin, (std::min)(center, srcEnd - 1) ) - first] = 1.f;
+        }
+        kernel->first[i] = first;
+    }
+    Filter1D::destroy(filter);
+
+    return kernel;
+} // buildResizeKernel
+
+static tthread::fast_mutex gResizeKernelsMutex;
+static std::list<ResizeKernelPtr> gResizeKernels; // most recently used first
+
+// The kernels only depend on the filter and on the source and destination windows, so they are
+// shared by all the renders (and tiles) of a given resize.
+static ResizeKernelPtr
+getResizeKernel(const string& filterName,
+                float filterWidth,
+                int srcBegin,
+                int srcEnd,
+                int dstBegin,
+                int dstEnd)
+{
+    {
+        OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gResizeKernelsMutex);
+        for (std::list<ResizeKernelPtr>::iterator it = gResizeKernels.begin(); it != gResizeKernels.end(); ++it) {
+            const ResizeKernel& k = **it;
+            if ( (k.filterWidth == filterWidth) && (k.srcBegin == srcBegin) && (k.srcEnd == srcEnd) &&
+                 (k.dstBegin == dstBegin) && (k.dstEnd == dstEnd) && (k.filterName == filterName) ) {
+                ResizeKernelPtr kernel = *it;
+                gResizeKernels.erase(it);
+                gResizeKernels.push_front(kernel);
+
+                return kernel;
+            }
+        }
+    }
+
+    // build the kernel without holding the lock
+    ResizeKernelPtr kernel = buildResizeKernel(filterName, filterWidth, srcBegin, srcEnd, dstBegin, dstEnd);
+    if (kernel) {
+        OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gResizeKernelsMutex);
+        gResizeKernels.push_front(kernel);
+        if (gResizeKernels.size() > kResizeKernelCacheMax) {
+            gResizeKernels.pop_back();
+        }
+    }
+
+    return kernel;
+}
+
+template <typename PIX, int maxValue>
+static inline PIX
+floatToPix(float v)
+{
+    if (maxValue == 1) {
+        return PIX(v);
+    }
+
+    return (v <= 0.f) ? PIX(0) : ( (v >= maxValue) ? PIX(maxValue) : PIX(v + 0.5f) );
+}
+
+// Separable resize: each procWindow first resizes horizontally the source rows it needs, then vertically.
+template <typename PIX, int nComps, int maxValue>
+class SeparableResizer
+    : public PixelProcessor
+{
+public:
+    SeparableResizer(ImageEffect &instance)
+        : PixelProcessor(instance)
+        , _srcPixelData(NULL)
+        , _srcBounds()
+        , _srcRowBytes(0)
+        , _xKernel()
+        , _yKernel()
+    {
+    }
+
+    void setValues(const PIX* srcPixelData,
+                   const OfxRectI& srcBounds,
+                   int srcRowBytes,
+                   const ResizeKernelPtr& xKernel,
+                   const ResizeKernelPtr& yKernel)
+    {
+        _srcPixelData = srcPixelData;
+        _srcBounds = srcBounds;
+        _srcRowBytes = srcRowBytes;
+        _xKernel = xKernel;
+        _yKernel = yKernel;
+    }
+
+private:
+    void multiThreadProcessImages(const OfxRectI& procWindow, const OfxPointD& rs) OVERRIDE FINAL
+    {
+        unused(rs);
+        const int width = procWindow.x2 - procWindow.x1;
+        if ( (width <= 0) || (procWindow.y2 <= procWindow.y1) ) {
+            return;
+        }
+        const ResizeKernel& kx = *_xKernel;
+        const ResizeKernel& ky = *_yKernel;
+        assert(kx.dstBegin <= procWindow.x1 && procWindow.x2 <= kx.dstEnd &&
+               ky.dstBegin <= procWindow.y1 && procWindow.y2 <= ky.dstEnd);
+        const int rowBegin = ky.first[procWindow.y1 - ky.dstBegin];
+        const int rowEnd = ky.first[procWindow.y2 - 1 - ky.dstBegin] + ky.taps;
+        assert(_srcBounds.y1 <= rowBegin && rowEnd <= _srcBounds.y2);
+        const std::size_t rowSize = (std::size_t)width * nComps;
+
+        // horizontal pass, on the source rows used by procWindow
+        vector<float> tmp( (std::size_t)(rowEnd - rowBegin) * rowSize );
+        for (int sy = rowBegin; sy < rowEnd; ++sy) {
+            if ( _effect.abort() ) {
+                return;
+            }
+            const PIX* srcRow = (const PIX*)( (const char*)_srcPixelData + (std::ptrdiff_t)(sy - _srcBounds.y1) * _srcRowBytes ) - (std::ptrdiff_t)_srcBounds.x1 * nComps;
+            float* tmpPix = &tmp[(std::size_t)(sy - rowBegin) * rowSize];
+            for (int i = 0; i < width; ++i, tmpPix += nComps) {
+                const int x = procWindow.x1 + i - kx.dstBegin;
+                const PIX* srcPix = srcRow + (std::ptrdiff_t)kx.first[x] * nComps;
+                const float* w = &kx.weights[(std::size_t)x * kx.taps];
+                float acc[nComps];
+                for (int c = 0; c < nComps; ++c) {
+                    acc[c] = 0.f;
+                }
+                for (int k = 0; k < kx.taps; ++k, srcPix += nComps) {
+                    for (int c = 0; c < nComps; ++c) {
+                        acc[c] += w[k] * srcPix[c];
+                    }
+                }
+                for (int c = 0; c < nComps; ++c) {
+                    tmpPix[c] = acc[c];
+                }
+            }
+        }
+
+        // vertical pass, on contiguous rows
+        vector<float> acc(rowSize);
+        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
+            if ( _effect.abort() ) {
+                return;
+            }
+            const int yk = y - ky.dstBegin;
+            const float* w = &ky.weights[(std::size_t)yk * ky.taps];
+            const float* tmpRow = &tmp[(std::size_t)(ky.first[yk] - rowBegin) * rowSize];
+            std::fill(acc.begin(), acc.end(), 0.f);
+            for (int k = 0; k < ky.taps; ++k, tmpRow += rowSize) {
+                const float wk = w[k];
+                for (std::size_t j = 0; j < rowSize; ++j) {
+                    acc[j] += wk * tmpRow[j];
+                }
+            }
+            PIX* dstPix = (PIX*)( (char*)_dstPixelData + (std::ptrdiff_t)(y - _dstBounds.y1) * _dstRowBytes ) + (std::ptrdiff_t)(procWindow.x1 - _dstBounds.x1) * nComps;
+            for (std::size_t j = 0; j < rowSize; ++j) {
+                dstPix[j] = floatToPix<PIX, maxValue>(acc[j]);
+            }
+        }
+    } // multiThreadProcessImages
+
+    const PIX* _srcPixelData;
+    OfxRectI _srcBounds;
+    int _srcRowBytes;
+    ResizeKernelPtr _xKernel;
+    ResizeKernelPtr _yKernel;
+};
+
 class OIIOResizePlugin
     : public ImageEffect
 {
@@ -150,9 +395,17 @@ public:
 
 private:
 
-    template <typename PIX, int nComps>
+    template <typename PIX, int nComps, int maxValue>
     void renderInternal(const RenderArguments &args, TypeDesc srcType, const Image* srcImg, TypeDesc dstType, Image* dstImg);
 
+    bool getDstRegionOfDefinition(double time, OfxRectD* rod);
+
+    // the source and destination RoDs in pixel coordinates, which define the resize mapping
+    bool getResizeWindows(double time, const OfxPointD& renderScale, OfxRectI* srcRoDPixel, OfxRectI* dstRoDPixel);
+
+    // the filter used for the given resize ratios, returns false for the impulse filter
+    bool getFilterDesc(float wratio, float hratio, FilterDesc* fd);
+
     void fillWithBlack(PixelProcessorFilterBase & processor,
                        const OfxRectI &renderWindow,
                        const OfxPointD& renderScale,
@@ -273,15 +526,15 @@ OIIOResizePlugin::render(const RenderArguments &args)
         if (dstComponents == ePixelComponentRGBA) {
             switch (dstBitDepth) {
             case eBitDepthUByte: {
-                renderInternal<unsigned char, 4>( args, TypeDesc::UCHAR, src.get(), TypeDesc::UCHAR, dst.get() );
+                renderInternal<unsigned char, 4, 255>( args, TypeDesc::UCHAR, src.get(), TypeDesc::UCHAR, dst.get() );
                 break;
             }
             case eBitDepthUShort: {
-                renderInternal<unsigned short, 4>( args, TypeDesc::USHORT, src.get(), TypeDesc::USHORT, dst.get() );
+                renderInternal<unsigned short, 4, 65535>( args, TypeDesc::USHORT, src.get(), TypeDesc::USHORT, dst.get() );
                 break;
             }
             case eBitDepthFloat: {
-                renderInternal<float, 4>( args, TypeDesc::FLOAT, src.get(), TypeDesc::FLOAT, dst.get() );
+                renderInternal<float, 4, 1>( args, TypeDesc::FLOAT, src.get(), TypeDesc::FLOAT, dst.get() );
                 break;
             }
             default:
@@ -292,15 +545,15 @@ OIIOResizePlugin::render(const RenderArguments &args)
         } else if (dstComponents == ePixelComponentRGB) {
             switch (dstBitDepth) {
             case eBitDepthUByte: {
-                renderInternal<unsigned char, 3>( args, TypeDesc::UCHAR, src.get(), TypeDesc::UCHAR, dst.get() );
+                renderInternal<unsigned char, 3, 255>( args, TypeDesc::UCHAR, src.get(), TypeDesc::UCHAR, dst.get() );
                 break;
             }
             case eBitDepthUShort: {
-                renderInternal<unsigned short, 3>( args, TypeDesc::USHORT, src.get(), TypeDesc::USHORT, dst.get() );
+                renderInternal<unsigned short, 3, 65535>( args, TypeDesc::USHORT, src.get(), TypeDesc::USHORT, dst.get() );
                 break;
             }
             case eBitDepthFloat: {
-                renderInternal<float, 3>( args, TypeDesc::FLOAT, src.get(), TypeDesc::FLOAT, dst.get() );
+                renderInternal<float, 3, 1>( args, TypeDesc::FLOAT, src.get(), TypeDesc::FLOAT, dst.get() );
                 break;
             }
             default:
@@ -312,15 +565,15 @@ OIIOResizePlugin::render(const RenderArguments &args)
             assert(dstComponents == ePixelComponentAlpha);
             switch (dstBitDepth) {
             case eBitDepthUByte: {
-                renderInternal<unsigned char, 1>( args, TypeDesc::UCHAR, src.get(), TypeDesc::UCHAR, dst.get() );
+                renderInternal<unsigned char, 1, 255>( args, TypeDesc::UCHAR, src.get(), TypeDesc::UCHAR, dst.get() );
                 break;
             }
             case eBitDepthUShort: {
-                renderInternal<unsigned short, 1>( args, TypeDesc::USHORT, src.get(), TypeDesc::USHORT, dst.get() );
+                renderInternal<unsigned short, 1, 65535>( args, TypeDesc::USHORT, src.get(), TypeDesc::USHORT, dst.get() );
                 break;
             }
             case eBitDepthFloat: {
-                renderInternal<float, 1>( args, TypeDesc::FLOAT, src.get(), TypeDesc::FLOAT, dst.get() );
+                renderInternal<float, 1, 1>( args, TypeDesc::FLOAT, src.get(), TypeDesc::FLOAT, dst.get() );
                 break;
             }
             default:
@@ -412,87 +665,155 @@ OIIOResizePlugin::render(const RenderArguments &args)
     }
 } // OIIOResizePlugin::render
 
-template <typename PIX, int nComps>
+bool
+OIIOResizePlugin::getFilterDesc(float wratio,
+                                float hratio,
+                                FilterDesc* fd)
+{
+    int filter;
+    _filter->getValue(filter);
+    if (filter == 0) {
+        // impulse
+        return false;
+    }
+    const int num_filters = Filter2D::num_filters();
+    filter -= 1;
+    if (filter < num_filters) {
+        Filter2D::get_filterdesc(filter, fd);
+    } else {
+        string filtername;
+        // "default" filter
+        // No filter name supplied -- pick a good default
+        // see imgbufalgo_xform.cpp:477
+        if (wratio > 1.0f || hratio > 1.0f) {
+            filtername = "blackman-harris";
+        } else {
+            filtername = "lanczos3";
+        }
+        filter = 0;
+        Filter2D::get_filterdesc(filter, fd);
+        while (fd->name != filtername) {
+            ++filter;
+            Filter2D::get_filterdesc(filter, fd);
+        }
+    }
+
+    return true;
+}
+
+bool
+OIIOResizePlugin::getResizeWindows(double time,
+                                   const OfxPointD& renderScale,
+                                   OfxRectI* srcRoDPixel,
+                                   OfxRectI* dstRoDPixel)
+{
+    OfxRectD dstRoD;
+    if ( !getDstRegionOfDefinition(time, &dstRoD) ) {
+        return false;
+    }
+    const OfxRectD srcRoD = _srcClip->getRegionOfDefinition(time);
+    Coords::toPixelEnclosing(srcRoD, renderScale, _srcClip->getPixelAspectRatio(), srcRoDPixel);
+    Coords::toPixelEnclosing(dstRoD, renderScale, _dstClip->getPixelAspectRatio(), dstRoDPixel);
+
+    return (srcRoDPixel->x1 < srcRoDPixel->x2) && (srcRoDPixel->y1 < srcRoDPixel->y2) &&
+           (dstRoDPixel->x1 < dstRoDPixel->x2) && (dstRoDPixel->y1 < dstRoDPixel->y2);
+}
+
+template <typename PIX, int nComps, int maxValue>
 void
-OIIOResizePlugin::renderInternal(const RenderArguments & /*args*/,
+OIIOResizePlugin::renderInternal(const RenderArguments &args,
                                  TypeDesc srcType,
                                  const Image* srcImg,
                                  TypeDesc dstType,
                                  Image* dstImg)
 {
-    ImageSpec srcSpec(srcType);
     const OfxRectI srcBounds = srcImg->getBounds();
+    const OfxRectI dstBounds = dstImg->getBounds();
+    OfxRectI srcRoDPixel, dstRoDPixel;
+    if ( !getResizeWindows(args.time, args.renderScale, &srcRoDPixel, &dstRoDPixel) ) {
+        // the RoD is empty, or the bounds of the image are used
+        srcRoDPixel = srcBounds;
+        dstRoDPixel = dstBounds;
+    }
+    OfxRectI renderWindow;
+    if ( !Coords::rectIntersection<OfxRectI>(args.renderWindow, dstRoDPixel, &renderWindow) ) {
+        return;
+    }
+    float wratio = float(dstRoDPixel.x2 - dstRoDPixel.x1) / float(srcRoDPixel.x2 - srcRoDPixel.x1);
+    float hratio = float(dstRoDPixel.y2 - dstRoDPixel.y1) / float(srcRoDPixel.y2 - srcRoDPixel.y1);
+    FilterDesc fd;
+    const bool filtered = getFilterDesc(wratio, hratio, &fd);
+    // older versions of OIIO 1.2 don't have ImageBufAlgo::resize(dstBuf, srcBuf, fd.name, fd.width)
+    float w = filtered ? fd.width * (std::max)(1.0f, wratio) : 0.f;
+    float h = filtered ? fd.width * (std::max)(1.0f, hratio) : 0.f;
+
+    if (filtered && fd.separable) {
+        ResizeKernelPtr xKernel = getResizeKernel(fd.name, w, srcRoDPixel.x1, srcRoDPixel.x2, dstRoDPixel.x1, dstRoDPixel.x2);
+        ResizeKernelPtr yKernel = getResizeKernel(fd.name, h, srcRoDPixel.y1, srcRoDPixel.y2, dstRoDPixel.y1, dstRoDPixel.y2);
+        if (xKernel && yKernel) {
+            // the source region used by the render window, see getRegionsOfInterest()
+            const int srcX1 = xKernel->first[renderWindow.x1 - dstRoDPixel.x1];
+            const int srcX2 = xKernel->first[renderWindow.x2 - 1 - dstRoDPixel.x1] + xKernel->taps;
+            const int srcY1 = yKernel->first[renderWindow.y1 - dstRoDPixel.y1];
+            const int srcY2 = yKernel->first[renderWindow.y2 - 1 - dstRoDPixel.y1] + yKernel->taps;
+            if ( (srcX1 < srcBounds.x1) || (srcBounds.x2 < srcX2) || (srcY1 < srcBounds.y1) || (srcBounds.y2 < srcY2) ) {
+                setPersistentMessage(Message::eMessageError, "", "Source image does not contain the region of interest");
+                throwSuiteStatusException(kOfxStatFailed);
+
+                return;
+            }
+            SeparableResizer<PIX, nComps, maxValue> processor(*this);
+            processor.setDstImg(dstImg);
+            processor.setValues( (const PIX*)srcImg->getPixelData(), srcBounds, srcImg->getRowBytes(), xKernel, yKernel );
+            processor.setRenderWindow(renderWindow, args.renderScale);
+            processor.process();
+
+            return;
+        }
+    }
+
+    // the filter is not separable, or not available in 1D: use OIIO on the full source image
+    ImageSpec srcSpec(srcType);
 
     srcSpec.x = srcBounds.x1;
     srcSpec.y = srcBounds.y1;
     srcSpec.width = srcBounds.x2 - srcBounds.x1;
     srcSpec.height = srcBounds.y2 - srcBounds.y1;
     srcSpec.nchannels = nComps;
-    srcSpec.full_x = srcSpec.x;
-    srcSpec.full_y = srcSpec.y;
-    srcSpec.full_width = srcSpec.width;
-    srcSpec.full_height = srcSpec.height;
+    srcSpec.full_x = srcRoDPixel.x1;
+    srcSpec.full_y = srcRoDPixel.y1;
+    srcSpec.full_width = srcRoDPixel.x2 - srcRoDPixel.x1;
+    srcSpec.full_height = srcRoDPixel.y2 - srcRoDPixel.y1;
     srcSpec.default_channel_names();
 
     const ImageBuf srcBuf( "src", srcSpec, const_cast<void*>( srcImg->getPixelAddress(srcBounds.x1, srcBounds.y1) ) );
 
 
-    ///This code assumes that the dstImg has the target size hence that we don't support tiles
-    const OfxRectI dstBounds = dstImg->getBounds();
+    // the full window defines the resize mapping, and only the render window is computed
     ImageSpec dstSpec(dstType);
     dstSpec.x = dstBounds.x1;
     dstSpec.y = dstBounds.y1;
     dstSpec.width = dstBounds.x2 - dstBounds.x1;
     dstSpec.height = dstBounds.y2 - dstBounds.y1;
     dstSpec.nchannels = nComps;
-    dstSpec.full_x = dstSpec.x;
-    dstSpec.full_y = dstSpec.y;
-    dstSpec.full_width = dstSpec.width;
-    dstSpec.full_height = dstSpec.height;
+    dstSpec.full_x = dstRoDPixel.x1;
+    dstSpec.full_y = dstRoDPixel.y1;
+    dstSpec.full_width = dstRoDPixel.x2 - dstRoDPixel.x1;
+    dstSpec.full_height = dstRoDPixel.y2 - dstRoDPixel.y1;
     dstSpec.default_channel_names();
 
     ImageBuf dstBuf( "dst", dstSpec, dstImg->getPixelAddress(dstBounds.x1, dstBounds.y1) );
-    int filter;
-    _filter->getValue(filter);
+    const ROI roi(renderWindow.x1, renderWindow.x2, renderWindow.y1, renderWindow.y2, 0, 1, 0, nComps);
 
-    if (filter == 0) {
+    if (!filtered) {
         ///Use nearest neighboor
-        if ( !ImageBufAlgo::resample( dstBuf, srcBuf, /*interpolate*/ false, ROI::All(), MultiThread::getNumCPUs() ) ) {
+        if ( !ImageBufAlgo::resample( dstBuf, srcBuf, /*interpolate*/ false, roi, MultiThread::getNumCPUs() ) ) {
             setPersistentMessage( Message::eMessageError, "", dstBuf.geterror() );
         }
     } else {
-        assert(srcSpec.full_width && srcSpec.full_height);
-        float wratio = float(dstSpec.full_width) / float(srcSpec.full_width);
-        float hratio = float(dstSpec.full_height) / float(srcSpec.full_height);
-        const int num_filters = Filter2D::num_filters();
-        ///interpolate using the selected filter
-        FilterDesc fd;
-        filter -= 1;
-        if (filter < num_filters) {
-            Filter2D::get_filterdesc(filter, &fd);
-        } else {
-            string filtername;
-            // "default" filter
-            // No filter name supplied -- pick a good default
-            // see imgbufalgo_xform.cpp:477
-            if (wratio > 1.0f || hratio > 1.0f) {
-                filtername = "blackman-harris";
-            } else {
-                filtername = "lanczos3";
-            }
-            filter = 0;
-            Filter2D::get_filterdesc(filter, &fd);
-            while (fd.name != filtername) {
-                ++filter;
-                Filter2D::get_filterdesc(filter, &fd);
-            }
-        }
-        // older versions of OIIO 1.2 don't have ImageBufAlgo::resize(dstBuf, srcBuf, fd.name, fd.width)
-        float w = fd.width * (std::max)(1.0f, wratio);
-        float h = fd.width * (std::max)(1.0f, hratio);
         auto_ptr<Filter2D> filter( Filter2D::create(fd.name, w, h) );
 
-        if ( !ImageBufAlgo::resize( dstBuf, srcBuf, filter.get(), ROI::All(), MultiThread::getNumCPUs() ) ) {
+        if ( !ImageBufAlgo::resize( dstBuf, srcBuf, filter.get(), roi, MultiThread::getNumCPUs() ) ) {
             setPersistentMessage( Message::eMessageError, "", dstBuf.geterror() );
         }
     }
@@ -659,6 +980,13 @@ OIIOResizePlugin::changedClip(const InstanceChangedArgs &args,
 bool
 OIIOResizePlugin::getRegionOfDefinition(const RegionOfDefinitionArguments &args,
                                         OfxRectD &rod)
+{
+    return getDstRegionOfDefinition(args.time, &rod);
+}
+
+bool
+OIIOResizePlugin::getDstRegionOfDefinition(double time,
+                                           OfxRectD* rod)
 {
     int type_i;
 
@@ -678,7 +1006,7 @@ OIIOResizePlugin::getRegionOfDefinition(const RegionOfDefinitionArguments &args,
         rodPixel.y2 = h;
         OfxPointD rsOne;
         rsOne.x = rsOne.y = 1.;
-        Coords::toCanonical(rodPixel, rsOne, par, &rod);
+        Coords::toCanonical(rodPixel, rsOne, par, rod);
         break;
     }
 
@@ -689,7 +1017,7 @@ OIIOResizePlugin::getRegionOfDefinition(const RegionOfDefinitionArguments &args,
         bool preservePar;
         _preservePAR->getValue(preservePar);
         if (preservePar) {
-            OfxRectD srcRoD = _srcClip->getRegionOfDefinition(args.time);
+            OfxRectD srcRoD = _srcClip->getRegionOfDefinition(time);
             double srcW = srcRoD.x2 - srcRoD.x1;
             double srcH = srcRoD.y2 - srcRoD.y1;
 
@@ -705,46 +1033,81 @@ OIIOResizePlugin::getRegionOfDefinition(const RegionOfDefinitionArguments &args,
                 w = (int)(srcW * h / srcH);
             }
         }
-        rod.x1 = 0;
-        rod.y1 = 0;
-        rod.x2 = w;
-        rod.y2 = h;
+        rod->x1 = 0;
+        rod->y1 = 0;
+        rod->x2 = w;
+        rod->y2 = h;
         break;
     }
 
     case eResizeTypeScale: {
         //scaled
-        OfxRectD srcRoD = _srcClip->getRegionOfDefinition(args.time);
+        OfxRectD srcRoD = _srcClip->getRegionOfDefinition(time);
         double sx, sy;
         _scale->getValue(sx, sy);
         srcRoD.x1 *= sx;
         srcRoD.y1 *= sy;
         srcRoD.x2 *= sx;
         srcRoD.y2 *= sy;
-        rod.x1 = (std::min)(srcRoD.x1, srcRoD.x2 - 1);
-        rod.x2 = (std::max)(srcRoD.x1 + 1, srcRoD.x2);
-        rod.y1 = (std::min)(srcRoD.y1, srcRoD.y2 - 1);
-        rod.y2 = (std::max)(srcRoD.y1 + 1, srcRoD.y2);
+        rod->x1 = (std::min)(srcRoD.x1, srcRoD.x2 - 1);
+        rod->x2 = (std::max)(srcRoD.x1 + 1, srcRoD.x2);
+        rod->y1 = (std::min)(srcRoD.y1, srcRoD.y2 - 1);
+        rod->y2 = (std::max)(srcRoD.y1 + 1, srcRoD.y2);
         break;
     }
     } // switch
 
     return true;
-} // OIIOResizePlugin::getRegionOfDefinition
+} // OIIOResizePlugin::getDstRegionOfDefinition
 
 // override the roi call
 void
 OIIOResizePlugin::getRegionsOfInterest(const RegionsOfInterestArguments &args,
                                        RegionOfInterestSetter &rois)
 {
-    if (!kSupportsTiles) {
-        // The effect requires full images to render any region
+    if ( !_srcClip || !_srcClip->isConnected() ) {
+        return;
+    }
+    OfxRectD srcRoD = _srcClip->getRegionOfDefinition(args.time);
+    OfxRectI srcRoDPixel, dstRoDPixel;
+    if ( !getResizeWindows(args.time, args.renderScale, &srcRoDPixel, &dstRoDPixel) ) {
+        rois.setRegionOfInterest(*_srcClip, srcRoD);
 
-        if ( _srcClip && _srcClip->isConnected() ) {
-            OfxRectD srcRoD = _srcClip->getRegionOfDefinition(args.time);
-            rois.setRegionOfInterest(*_srcClip, srcRoD);
-        }
+        return;
+    }
+    float wratio = float(dstRoDPixel.x2 - dstRoDPixel.x1) / float(srcRoDPixel.x2 - srcRoDPixel.x1);
+    float hratio = float(dstRoDPixel.y2 - dstRoDPixel.y1) / float(srcRoDPixel.y2 - srcRoDPixel.y1);
+    FilterDesc fd;
+    if ( !getFilterDesc(wratio, hratio, &fd) || !fd.separable ) {
+        // The impulse and non-separable filters are computed by OIIO, which requires the full image
+        rois.setRegionOfInterest(*_srcClip, srcRoD);
+
+        return;
+    }
+
+    // The source pixels used by the filter kernels of the region of interest. These are the same (cached)
+    // kernels as in render(), since the taps windows are clamped to the source window near its edges.
+    ResizeKernelPtr xKernel = getResizeKernel(fd.name, fd.width * (std::max)(1.0f, wratio), srcRoDPixel.x1, srcRoDPixel.x2, dstRoDPixel.x1, dstRoDPixel.x2);
+    ResizeKernelPtr yKernel = getResizeKernel(fd.name, fd.width * (std::max)(1.0f, hratio), srcRoDPixel.y1, srcRoDPixel.y2, dstRoDPixel.y1, dstRoDPixel.y2);
+    if (!xKernel || !yKernel) {
+        // the filter is not available in 1D: render() uses OIIO on the full image
+        rois.setRegionOfInterest(*_srcClip, srcRoD);
+
+        return;
+    }
+    OfxRectI roiPixel;
+    Coords::toPixelEnclosing(args.regionOfInterest, args.renderScale, _dstClip->getPixelAspectRatio(), &roiPixel);
+    if ( !Coords::rectIntersection<OfxRectI>(roiPixel, dstRoDPixel, &roiPixel) ) {
+        return;
     }
+    OfxRectI srcRoIPixel;
+    srcRoIPixel.x1 = xKernel->first[roiPixel.x1 - dstRoDPixel.x1];
+    srcRoIPixel.x2 = xKernel->first[roiPixel.x2 - 1 - dstRoDPixel.x1] + xKernel->taps;
+    srcRoIPixel.y1 = yKernel->first[roiPixel.y1 - dstRoDPixel.y1];
+    srcRoIPixel.y2 = yKernel->first[roiPixel.y2 - 1 - dstRoDPixel.y1] + yKernel->taps;
+    OfxRectD srcRoI;
+    Coords::toCanonical(srcRoIPixel, args.renderScale, _srcClip->getPixelAspectRatio(), &srcRoI);
+    rois.setRegionOfInterest(*_srcClip, srcRoI);
 }
 
 void
@@ -806,7 +1169,7 @@ OIIOResizePluginFactory<majorVersion>::describe(ImageEffectDescriptor &desc)
     desc.addSupportedBitDepth(eBitDepthUShort);
     desc.addSupportedBitDepth(eBitDepthFloat);
 
-    ///We don't support tiles: we can only resize the whole RoD at once
+    ///Tiles are supported: the renderWindow is mapped to the source using the RoDs
     desc.setSupportsTiles(kSupportsTiles);
 
     desc.setSupportsMultipleClipPARs(true); // plugin may setPixelAspectRatio on output clip
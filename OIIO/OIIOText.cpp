@@ -23,6 +23,12 @@
  */
 
 #include <cfloat> // DBL_MAX
+#include <cmath> // fabs
+#include <cstring> // memcpy, memset
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <vector>
 
 #include "ofxsMacros.h"
 
@@ -46,6 +52,10 @@ GCC_DIAG_ON(unused-parameter)
 #include "ofxsThreadSuite.h"
 #include "ofxsCopier.h"
 #include "ofxsPositionInteract.h"
+#include "ofxsCoords.h"
+#include "ofxsMultiThread.h"
+
+#include "fast_mutex.h" // the text layer cache is static, and can't use the OFX MT-Suite mutex
 
 #include "IOUtility.h"
 #include "ofxNatron.h"
@@ -64,13 +74,7 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
 #define kPluginVersionMajor 1 // Incrementing this number means that you have broken backwards compatibility of the plug-in.
 #define kPluginVersionMinor 0 // Increment this when you have fixed a bug or made it faster.
 
-#ifdef DEBUG
 #define kSupportsTiles 1
-#pragma message WARN("TextOIIO: tiles support is buggy - enabled in DEBUG mode")
-#else
-#define kSupportsTiles 0
-#pragma message WARN("TextOIIO: tiles support is buggy - disabled in  RELEASE mode")
-#endif
 #define kSupportsMultiResolution 1
 #define kSupportsRenderScale 1
 #define kRenderThreadSafety eRenderFullySafe
@@ -198,61 +202,192 @@ OIIOTextPlugin::~OIIOTextPlugin()
 {
 }
 
-static OIIO::ImageSpec
-imageSpecFromOFXImage(const OfxRectI &rod,
-                      const OfxRectI &bounds,
-                      PixelComponentEnum pixelComponents,
-                      BitDepthEnum bitDepth)
+#define kTextLayerCacheMax 32 // maximum number of rasterized texts in the cache
+
+/*
+   A text rasterized by OIIO, as a coverage mask in OFX orientation (y up).
+   Pixel (x,y) of the mask covers pixel (origin.x + x, origin.y + y) of the image,
+   where origin is the text position, and x,y are within bounds.
+ */
+struct TextLayer
 {
-    OIIO::TypeDesc format;
-    switch (bitDepth) {
-    case eBitDepthUByte:
-        format = OIIO::TypeDesc::UINT8;
-        break;
-    case eBitDepthUShort:
-        format = OIIO::TypeDesc::UINT16;
-        break;
-    case eBitDepthHalf:
-        format = OIIO::TypeDesc::HALF;
-        break;
-    case eBitDepthFloat:
-        format = OIIO::TypeDesc::FLOAT;
-        break;
-    default:
-        throwSuiteStatusException(kOfxStatErrFormat);
-        break;
-    }
-    int nchannels = 0, alpha_channel = -1;
-    switch (pixelComponents) {
-    case ePixelComponentAlpha:
-        nchannels = 1;
-        alpha_channel = 0;
-        break;
-    case ePixelComponentRGB:
-        nchannels = 3;
-        break;
-    case ePixelComponentRGBA:
-        nchannels = 4;
-        alpha_channel = 3;
-        break;
-    default:
-        throwSuiteStatusException(kOfxStatErrFormat);
-        break;
-    }
-    OIIO::ImageSpec spec (format);
-    spec.x = bounds.x1;
-    spec.y = rod.y2 - bounds.y2;
-    spec.width = bounds.x2 - bounds.x1;
-    spec.height = bounds.y2 - bounds.y1;
-    spec.full_x = rod.x1;
-    spec.full_y = 0;
-    spec.full_width = rod.x2 - rod.x1;
-    spec.full_height = rod.y2 - rod.y1;
-    spec.nchannels = nchannels;
-    spec.alpha_channel = alpha_channel;
-
-    return spec;
-} // imageSpecFromOFXImage
+    string text;
+    int fontSize;
+    string fontName;
+    OfxRectI bounds;
+    std::vector<float> coverage;
+
+    const float* getRowAddress(int y) const
+    {
+        return &coverage[(std::size_t)(y - bounds.y1) * (bounds.x2 - bounds.x1)];
+    }
+};
+
+typedef std::shared_ptr<const TextLayer> TextLayerPtr;
+
+// Composite the text color over a pixel, where the text covers it by the given amount.
+// This is the formula used by OIIO::ImageBufAlgo::render_text: the color is not premultiplied by
+// its alpha, but the alpha of the color (textAlpha) scales how much of the pixel is covered.
+static inline void
+compositeTextPixel(float coverage,
+                   const float* textColor,
+                   float textAlpha,
+                   int nComps,
+                   float* pix)
+{
+    const float alpha = coverage * textAlpha;
+
+    for (int c = 0; c < nComps; ++c) {
+        pix[c] = coverage * textColor[c] + (1.f - alpha) * pix[c];
+    }
+}
+
+#ifdef DEBUG
+// Check that compositing the coverage mask gives the same result as rendering the text with OIIO,
+// with an opaque and a translucent text color.
+// x,y is the position of the text origin in a buffer which covers the layer bounds.
+static void
+checkTextLayer(const TextLayer& layer,
+               int x,
+               int y)
+{
+    const int width = layer.bounds.x2 - layer.bounds.x1;
+    const int height = layer.bounds.y2 - layer.bounds.y1;
+    const float background[4] = { 0.2f, 0.4f, 0.6f, 0.8f };
+    const float colors[2][4] = { { 1.f, 0.5f, 0.25f, 1.f }, { 1.f, 0.5f, 0.25f, 0.5f } };
+
+    for (int i = 0; i < 2; ++i) {
+        std::vector<float> tmp( (std::size_t)width * height * 4 );
+        for (std::size_t p = 0; p < tmp.size(); ++p) {
+            tmp[p] = background[p % 4];
+        }
+        OIIO::ImageSpec spec(width, height, 4, OIIO::TypeDesc::FLOAT);
+        spec.alpha_channel = 3;
+        OIIO::ImageBuf buf("text", spec, &tmp[0]);
+        if ( !OIIO::ImageBufAlgo::render_text(buf, x, y, layer.text, layer.fontSize, layer.fontName, colors[i]) ) {
+            assert(false);
+            continue;
+        }
+        for (int j = 0; j < height; ++j) {
+            // row j of buf is row height-1-j of the layer
+            const float* coverage = layer.getRowAddress(layer.bounds.y2 - 1 - j);
+            for (int k = 0; k < width; ++k) {
+                float pix[4] = { background[0], background[1], background[2], background[3] };
+                compositeTextPixel(coverage[k], colors[i], colors[i][3], 4, pix);
+                for (int c = 0; c < 4; ++c) {
+                    assert(std::fabs(pix[c] - tmp[( (std::size_t)j * width + k ) * 4 + c]) < 1e-5);
+                }
+            }
+        }
+    }
+}
+
+#endif
+
+
+static tthread::fast_mutex gTextLayersMutex;
+static std::list<TextLayerPtr> gTextLayers; // most recently used first
+
+// Rasterize the text in a buffer which only covers its bounding box, and flip it to OFX orientation.
+static TextLayerPtr
+buildTextLayer(const string& text,
+               int fontSize,
+               const string& fontName,
+               string* error)
+{
+    // the text extent, relative to its origin, in OIIO orientation (y down, origin on the baseline)
+#if OIIO_VERSION >= 10800
+    OIIO::ROI roi = OIIO::ImageBufAlgo::text_size(text, fontSize, fontName);
+    if ( !roi.defined() ) {
+        *error = "Cannot compute the text size (font not found?)";
+
+        return TextLayerPtr();
+    }
+#else
+    // text_size() is not available: use a box which is large enough for any font
+    int nLines = 1;
+    int lineLength = 0;
+    int maxLineLength = 0;
+    for (std::size_t i = 0; i < text.size(); ++i) {
+        if (text[i] == '\n') {
+            ++nLines;
+            lineLength = 0;
+        } else {
+            maxLineLength = (std::max)(maxLineLength, ++lineLength);
+        }
+    }
+    OIIO::ROI roi(-fontSize, fontSize * (maxLineLength + 1), -fontSize * 2, fontSize * (nLines + 1));
+#endif
+
+    std::shared_ptr<TextLayer> layer = std::make_shared<TextLayer>();
+    layer->text = text;
+    layer->fontSize = fontSize;
+    layer->fontName = fontName;
+    layer->bounds.x1 = roi.xbegin;
+    layer->bounds.x2 = roi.xend;
+    layer->bounds.y1 = 1 - roi.yend;
+    layer->bounds.y2 = 1 - roi.ybegin;
+    const int width = roi.xend - roi.xbegin;
+    const int height = roi.yend - roi.ybegin;
+    layer->coverage.resize( (std::size_t)width * height );
+    if ( (width <= 0) || (height <= 0) ) {
+        return layer;
+    }
+
+    std::vector<float> tmp( (std::size_t)width * height, 0.f );
+    OIIO::ImageSpec spec(width, height, 1, OIIO::TypeDesc::FLOAT);
+    OIIO::ImageBuf buf("text", spec, &tmp[0]);
+    float one[1] = { 1.f };
+    if ( !OIIO::ImageBufAlgo::render_text(buf, -roi.xbegin, -roi.ybegin, text, fontSize, fontName, one) ) {
+        *error = buf.geterror();
+
+        return TextLayerPtr();
+    }
+    // row j of buf is at y = -(roi.ybegin + j), i.e. row height-1-j of the layer
+    for (int j = 0; j < height; ++j) {
+        std::memcpy( &layer->coverage[(std::size_t)(height - 1 - j) * width], &tmp[(std::size_t)j * width], sizeof(float) * width );
+    }
+#ifdef DEBUG
+    checkTextLayer(*layer, -roi.xbegin, -roi.ybegin);
+#endif
+
+    return layer;
+} // buildTextLayer
+
+// The rasterized text only depends on the text, font and size: it is shared by all instances, tiles and frames,
+// and moving the text or changing its color does not rasterize it again.
+static TextLayerPtr
+getTextLayer(const string& text,
+             int fontSize,
+             const string& fontName,
+             string* error)
+{
+    {
+        OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gTextLayersMutex);
+        for (std::list<TextLayerPtr>::iterator it = gTextLayers.begin(); it != gTextLayers.end(); ++it) {
+            const TextLayer& l = **it;
+            if ( (l.fontSize == fontSize) && (l.text == text) && (l.fontName == fontName) ) {
+                TextLayerPtr layer = *it;
+                gTextLayers.erase(it);
+                gTextLayers.push_front(layer);
+
+                return layer;
+            }
+        }
+    }
+
+    // rasterize without holding the lock
+    TextLayerPtr layer = buildTextLayer(text, fontSize, fontName, error);
+    if (layer) {
+        OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gTextLayersMutex);
+        gTextLayers.push_front(layer);
+        if (gTextLayers.size() > kTextLayerCacheMax) {
+            gTextLayers.pop_back();
+        }
+    }
+
+    return layer;
+}
 
 /* Override the render */
 void
@@ -310,11 +445,7 @@ OIIOTextPlugin::render(const RenderArguments &args)
 
     OfxRectI srcRod;
     OfxRectI srcBounds;
-    PixelComponentEnum pixelComponents = ePixelComponentNone;
     int pixelComponentCount = 0;
-    BitDepthEnum bitDepth = eBitDepthNone;
-    OIIO::ImageSpec srcSpec;
-    auto_ptr<const OIIO::ImageBuf> srcBuf;
     OfxRectI dstRod = dstImg->getRegionOfDefinition();
     if ( !srcImg.get() ) {
         setPersistentMessage(Message::eMessageError, "", "Source needs to be connected");
@@ -324,24 +455,8 @@ OIIOTextPlugin::render(const RenderArguments &args)
     } else {
         srcRod = srcImg->getRegionOfDefinition();
         srcBounds = srcImg->getBounds();
-        pixelComponents = srcImg->getPixelComponents();
         pixelComponentCount = srcImg->getPixelComponentCount();
-        bitDepth = srcImg->getPixelDepth();
-        srcSpec = imageSpecFromOFXImage(srcRod, srcBounds, pixelComponents, bitDepth);
-        srcBuf.reset( new OIIO::ImageBuf( "src", srcSpec, const_cast<void*>( srcImg->getPixelData() ) ) );
-
-        if (!kSupportsTiles) {
-            // http://openfx.sourceforge.net/Documentation/1.3/ofxProgrammingReference.html#kOfxImageEffectPropSupportsTiles
-            //  If a clip or plugin does not support tiled images, then the host should supply full RoD images to the effect whenever it fetches one.
-            assert(srcRod.x1 == srcBounds.x1);
-            assert(srcRod.x2 == srcBounds.x2);
-            assert(srcRod.y1 == srcBounds.y1);
-            assert(srcRod.y2 == srcBounds.y2); // crashes on Natron if kSupportsTiles=0 & kSupportsMultiResolution=1
-            assert(dstRod.x1 == dstBounds.x1);
-            assert(dstRod.x2 == dstBounds.x2);
-            assert(dstRod.y1 == dstBounds.y1);
-            assert(dstRod.y2 == dstBounds.y2); // crashes on Natron if kSupportsTiles=0 & kSupportsMultiResolution=1
-        }
+
         if (!kSupportsMultiResolution) {
             // http://openfx.sourceforge.net/Documentation/1.3/ofxProgrammingReference.html#kOfxImageEffectPropSupportsMultiResolution
             //   Multiple resolution images mean...
@@ -355,6 +470,8 @@ OIIOTextPlugin::render(const RenderArguments &args)
             assert(srcRod.y2 == dstRod.y2); // crashes on Natron if kSupportsMultiResolution=0
         }
     }
+    unused(srcRod);
+    unused(dstRod);
 
     double x, y;
     _position->getValueAtTime(args.time, x, y);
@@ -372,89 +489,60 @@ OIIOTextPlugin::render(const RenderArguments &args)
     textColor[2] = (float)b;
     textColor[3] = (float)a;
 
-    // allocate temporary image
-    int pixelBytes = pixelComponentCount * getComponentBytes(bitDepth);
-    int tmpRowBytes = (args.renderWindow.x2 - args.renderWindow.x1) * pixelBytes;
-    size_t memSize = (args.renderWindow.y2 - args.renderWindow.y1) * tmpRowBytes;
-    ImageMemory mem(memSize, this);
-    float *tmpPixelData = (float*)mem.lock();
-    const bool flipit = true;
-    OIIO::ImageSpec tmpSpec = imageSpecFromOFXImage(srcImg.get() ? srcRod : args.renderWindow, args.renderWindow, pixelComponents, bitDepth);
-    assert(tmpSpec.width == args.renderWindow.x2 - args.renderWindow.x1);
-    assert(tmpSpec.width == args.renderWindow.x2 - args.renderWindow.x1);
-    assert(tmpSpec.height == args.renderWindow.y2 - args.renderWindow.y1);
-    OIIO::ROI srcRoi(tmpSpec.x, tmpSpec.x + tmpSpec.width, tmpSpec.y, tmpSpec.y + tmpSpec.height);
-    int ytext = int(y * args.renderScale.y);
-    if (flipit) {
-        // from the OIIO 1.5 release notes:
-        // Fixes, minor enhancements, and performance improvements:
-        // * ImageBufAlgo:
-        //   * flip(), flop(), flipflop() have been rewritten to work more
-        //     sensibly for cropped images. In particular, the transformation now
-        //     happens with respect to the display (full) window, rather than
-        //     simply flipping or flopping within the data window. (1.5.2)
-#if OIIO_VERSION >= 10502
-        // the transformation happens with respect to the display (full) window
-        tmpSpec.y = ( (tmpSpec.full_y + tmpSpec.full_height - 1) - tmpSpec.y ) - (tmpSpec.height - 1);
-        tmpSpec.full_y = 0;
-        ytext = (tmpSpec.full_y + tmpSpec.full_height - 1) - ytext;
-#else
-        // only the data window is flipped
-        ytext = tmpSpec.y + ( (tmpSpec.y + tmpSpec.height - 1) - ytext );
-#endif
-    }
-    assert(tmpSpec.width == args.renderWindow.x2 - args.renderWindow.x1);
-    assert(tmpSpec.height == args.renderWindow.y2 - args.renderWindow.y1);
-    OIIO::ImageBuf tmpBuf("tmp", tmpSpec, tmpPixelData);
-
-    // do we have to flip the image?
-    if ( !srcImg.get() ) {
-        OIIO::ImageBufAlgo::zero(tmpBuf);
-    } else {
-        if (flipit) {
-            bool ok = OIIO::ImageBufAlgo::flip(tmpBuf, *srcBuf, srcRoi);
-            if (!ok) {
-                setPersistentMessage( Message::eMessageError, "", tmpBuf.geterror().c_str() );
-                throwSuiteStatusException(kOfxStatFailed);
-            }
-        } else {
-            // copy the renderWindow from src to a temp buffer
-            tmpBuf.copy_pixels(*srcBuf);
+    // get the rasterized text (possibly from a previous render)
+    const OfxPointI origin = { int(x * args.renderScale.x), int(y * args.renderScale.y) };
+    TextLayerPtr layer;
+    if ( !text.empty() ) {
+        string error;
+        layer = getTextLayer(text, int(fontSize * args.renderScale.y), fontName, &error);
+        if (!layer) {
+            setPersistentMessage( Message::eMessageError, "", error.c_str() );
+            //throwSuiteStatusException(kOfxStatFailed);
         }
     }
-
-    // render text in the temp buffer
-    {
-        bool ok = OIIO::ImageBufAlgo::render_text(tmpBuf, int(x * args.renderScale.x), ytext, text, int(fontSize * args.renderScale.y), fontName, textColor);
-        if (!ok) {
-            setPersistentMessage( Message::eMessageError, "", tmpBuf.geterror().c_str() );
-            //throwSuiteStatusException(kOfxStatFailed);
+    OfxRectI textRect = { 0, 0, 0, 0 };
+    if (layer) {
+        textRect.x1 = origin.x + layer->bounds.x1;
+        textRect.x2 = origin.x + layer->bounds.x2;
+        textRect.y1 = origin.y + layer->bounds.y1;
+        textRect.y2 = origin.y + layer->bounds.y2;
+        if ( !Coords::rectIntersection(textRect, args.renderWindow, &textRect) ) {
+            textRect.x1 = textRect.x2 = textRect.y1 = textRect.y2 = 0;
         }
     }
-    OIIO::ImageSpec dstSpec = imageSpecFromOFXImage(dstRod, dstBounds, pixelComponents, bitDepth);
-    OIIO::ImageBuf dstBuf( "dst", dstSpec, dstImg->getPixelData() );
 
-    OIIO::ROI tmpRoi(tmpSpec.x, tmpSpec.x + tmpSpec.width, tmpSpec.y, tmpSpec.y + tmpSpec.height);
-    // do we have to flip the image?
-    if (flipit) {
-        bool ok = OIIO::ImageBufAlgo::flip(dstBuf, tmpBuf, tmpRoi);
-        if (!ok) {
-            setPersistentMessage( Message::eMessageError, "", tmpBuf.geterror().c_str() );
-            throwSuiteStatusException(kOfxStatFailed);
+    // copy the source and composite the text over it, only where it intersects the render window
+    const int nComps = pixelComponentCount;
+    // the alpha of the text color is the one of the alpha channel, as for OIIO: the only channel of Alpha images, none for RGB
+    const float textAlpha = (nComps == 4) ? textColor[3] : (nComps == 1) ? textColor[0] : 1.f;
+    const std::size_t rowFloats = (std::size_t)(args.renderWindow.x2 - args.renderWindow.x1) * nComps;
+    for (int dy = args.renderWindow.y1; dy < args.renderWindow.y2; ++dy) {
+        if ( abort() ) {
+            return;
         }
-    } else {
-        // copy the temp buffer to dstImg
-        //dstBuf.copy_pixels(tmpBuf); // erases everything out of tmpBuf!
-        bool ok = OIIO::ImageBufAlgo::paste(dstBuf, args.renderWindow.x1, srcRod.y2 - args.renderWindow.y2, 0, 0, tmpBuf, tmpRoi);
-        if (!ok) {
-            setPersistentMessage( Message::eMessageError, "", tmpBuf.geterror().c_str() );
-            throwSuiteStatusException(kOfxStatFailed);
+        float* dstPix = (float*)dstImg->getPixelAddress(args.renderWindow.x1, dy);
+        assert(dstPix);
+        if ( (srcBounds.y1 <= dy) && (dy < srcBounds.y2) && (srcBounds.x1 <= args.renderWindow.x1) && (args.renderWindow.x2 <= srcBounds.x2) ) {
+            std::memcpy( dstPix, srcImg->getPixelAddress(args.renderWindow.x1, dy), sizeof(float) * rowFloats );
+        } else {
+            // pixels outside of the source bounds are black and transparent
+            for (int dx = args.renderWindow.x1; dx < args.renderWindow.x2; ++dx) {
+                const float* srcPix = (const float*)srcImg->getPixelAddress(dx, dy);
+                for (int c = 0; c < nComps; ++c) {
+                    dstPix[(dx - args.renderWindow.x1) * nComps + c] = srcPix ? srcPix[c] : 0.f;
+                }
+            }
+        }
+        if ( (textRect.y1 <= dy) && (dy < textRect.y2) ) {
+            const float* coverage = layer->getRowAddress(dy - origin.y) + (textRect.x1 - origin.x - layer->bounds.x1);
+            float* pix = dstPix + (textRect.x1 - args.renderWindow.x1) * nComps;
+            for (int dx = textRect.x1; dx < textRect.x2; ++dx, ++coverage, pix += nComps) {
+                if (*coverage != 0.f) {
+                    compositeTextPixel(*coverage, textColor, textAlpha, nComps, pix);
+                }
+            }
         }
     }
-
-    // TODO: answer questions:
-    // - can we support tiling?
-    // - can we support multiresolution by just scaling the coordinates and the font size?
 } // OIIOTextPlugin::render
 
 bool
@@ -485,6 +573,28 @@ OIIOTextPlugin::isIdentity(const IsIdentityArguments &args,
         return true;
     }
 
+    // tiles which do not intersect the text are left unchanged
+    double x, y;
+    _position->getValueAtTime(args.time, x, y);
+    int fontSize;
+    _fontSize->getValueAtTime(args.time, fontSize);
+    string fontName;
+    _fontName->getValueAtTime(args.time, fontName);
+    string error;
+    TextLayerPtr layer = getTextLayer(text, int(fontSize * args.renderScale.y), fontName, &error);
+    if (layer) {
+        OfxRectI textRect;
+        textRect.x1 = int(x * args.renderScale.x) + layer->bounds.x1;
+        textRect.x2 = int(x * args.renderScale.x) + layer->bounds.x2;
+        textRect.y1 = int(y * args.renderScale.y) + layer->bounds.y1;
+        textRect.y2 = int(y * args.renderScale.y) + layer->bounds.y2;
+        if ( !Coords::rectIntersection(textRect, args.renderWindow, &textRect) ) {
+            identityClip = _srcClip;
+
+            return true;
+        }
+    }
+
     return false;
 }
 
@@ -553,7 +663,7 @@ OIIOTextPluginFactory::describe(ImageEffectDescriptor &desc)
     desc.addSupportedBitDepth(eBitDepthHalf);
     desc.addSupportedBitDepth(eBitDepthFloat);
 
-    desc.setSupportsTiles(kSupportsTiles); // may be switched to true later?
+    desc.setSupportsTiles(kSupportsTiles);
     desc.setSupportsMultiResolution(kSupportsMultiResolution); // may be switch to true later? don't forget to reduce font size too
     desc.setRenderThreadSafety(kRenderThreadSafety);
 
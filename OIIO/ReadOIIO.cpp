@@ -159,6 +159,34 @@ typedef ImageInput* ImageInputPtr;
 #define kGroupRaw "advancedRaw"
 #define kGroupRawLabel "RAW", "Options for a variety of digital camera \"raw\" formats supported by the LibRaw library (http://www.libraw.org/)."
 
+#define kGroupCache "advancedCache"
+#define kGroupCacheLabel "Image Cache", "Options for the OpenImageIO image cache, which is used to read tiled and mipmapped images (e.g. tiled EXR or TIFF files). " \
+    "The image cache is shared by all OpenImageIO-based plugins, so these settings affect all of them."
+
+#define kParamCacheMemory "cacheMemory"
+#define kParamCacheMemoryLabel "Max. Memory (MB)", "Maximum amount of memory in megabytes used by the image cache for tiles. This is a global budget, shared by all instances."
+#define kParamCacheMemoryDefault 1024
+
+#define kParamCacheMaxOpenFiles "cacheMaxOpenFiles"
+#define kParamCacheMaxOpenFilesLabel "Max. Open Files", "Maximum number of files kept open by the image cache."
+#define kParamCacheMaxOpenFilesDefault 100
+
+#define kParamCacheAutoTile "cacheAutoTile"
+#define kParamCacheAutoTileLabel "Auto-Tile Size", "If non-zero, untiled images are read into the cache as tiles of this size, so that only the needed part of an image is kept in memory. " \
+    "If zero, untiled images are read as a whole."
+#define kParamCacheAutoTileDefault 0
+
+#define kParamCacheAutoMip "cacheAutoMip"
+#define kParamCacheAutoMipLabel "Auto-MIPmap", "If checked, the image cache computes on demand the reduced resolution levels of images that are not mipmapped, so that proxy renders read less data. " \
+    "This has no effect unless \"Auto-Tile Size\" is non-zero."
+#define kParamCacheAutoMipDefault false
+
+#define kParamCacheStatistics "cacheStatistics"
+#define kParamCacheStatisticsLabel "Cache Statistics...", "Display statistics about the image cache (memory used, hits and misses, files read)."
+
+#define kParamCacheLogStatistics "cacheLogStatistics"
+#define kParamCacheLogStatisticsLabel "Log Cache Statistics", "If checked, the image cache statistics are printed on the standard output at the end of each sequence render."
+
 // int no_auto_bright
 #define kParamRawAutoBright "rawAutoBright"
 #define kParamRawAutoBrightLabel "Auto Bright", "If checked, use libraw's automatic increase of brightness by histogram (exposure correction)." // default: unckecked
@@ -405,6 +433,7 @@ public:
     virtual OfxStatus getClipComponents(const ClipComponentsArguments& args, ClipComponentsSetter& clipComponents) OVERRIDE FINAL;
     virtual void getClipPreferences(ClipPreferencesSetter &clipPreferences) OVERRIDE FINAL;
     virtual void clearAnyCache() OVERRIDE FINAL;
+    virtual void endSequenceRender(const EndSequenceRenderArguments &args) OVERRIDE FINAL;
 
     /**
      * @brief Restore any state from the parameters set
@@ -478,12 +507,18 @@ private:
                              PixelComponentEnum pixelComponents, PixelComponentEnum remappedComponents,
                              int pixelComponentCount, const string& rawComponents, int rowBytes) OVERRIDE FINAL;
 
+    // each decodePlane() call opens its own ImageInput (or uses the thread-safe ImageCache), so that planes
+    // from different subimages, or different parts of a multi-part EXR, can be read concurrently
+    virtual bool isDecodePlaneThreadSafe() const OVERRIDE FINAL { return true; }
+
     void getOIIOChannelIndexesFromLayerName(const string& filename, int view, const string& layerName, PixelComponentEnum pixelComponents, const vector<ImageSpec>& subimages, vector<int>& channels, int& numChannels, int& subImageIndex);
 
     void openFile(const string& filename, bool useCache, ImageInputPtr* img, vector<ImageSpec>* subimages);
 
     virtual bool getFrameBounds(const string& filename, OfxTime time, int view, OfxRectI *bounds, OfxRectI *format, double *par, string *error,  int* tile_width, int* tile_height) OVERRIDE FINAL;
 
+    virtual unsigned int getFileMipmapLevels(const string& filename) OVERRIDE FINAL;
+
     string metadata(const string& filename);
 
     void getSpecsFromImageInput(const ImageInputPtr& img, vector<ImageSpec>* subimages) const;
@@ -504,8 +539,20 @@ private:
     // retrieve the config used to open the file
     void getConfig(ImageSpec* config) const;
 
+    // set the global image cache attributes from the parameters
+    void setCacheAttributes();
+
     //// OIIO image cache
+    // The cache is always created (if OFX_READ_OIIO_USES_CACHE is defined), since it is needed to read
+    // mipmapped files at the right level, but it is used for all files only if _useOIIOCache is true.
     ImageCache* _cache;
+    bool _useOIIOCache;
+
+    IntParam* _cacheMemory;
+    IntParam* _cacheMaxOpenFiles;
+    IntParam* _cacheAutoTile;
+    BooleanParam* _cacheAutoMip;
+    BooleanParam* _cacheLogStatistics;
 
     BooleanParam* _rawAutoBright;
     BooleanParam* _rawUseCameraWB;
@@ -553,6 +600,12 @@ ReadOIIOPlugin::ReadOIIOPlugin(OfxImageEffectHandle handle,
 #endif
                           )
     , _cache(NULL)
+    , _useOIIOCache(useOIIOCache)
+    , _cacheMemory(NULL)
+    , _cacheMaxOpenFiles(NULL)
+    , _cacheAutoTile(NULL)
+    , _cacheAutoMip(NULL)
+    , _cacheLogStatistics(NULL)
     , _outputLayer(NULL)
     , _outputLayerString(NULL)
     , _availableViews(NULL)
@@ -564,19 +617,17 @@ ReadOIIOPlugin::ReadOIIOPlugin(OfxImageEffectHandle handle,
     , _outputLayerMenu()
 {
 #ifdef OFX_READ_OIIO_USES_CACHE
-    if (useOIIOCache) {
-#     ifdef OFX_READ_OIIO_SHARED_CACHE
-        _cache = ImageCache::create(true); // shared cache
-#     else
-        _cache = ImageCache::create(false); // non-shared cache
-#     endif
-        // Always keep unassociated alpha.
-        // Don't let OIIO premultiply, because if the image is 8bits,
-        // it multiplies in 8bits (see TIFFInput::unassalpha_to_assocalpha()),
-        // which causes a lot of precision loss.
-        // see also https://github.com/OpenImageIO/oiio/issues/960
-        _cache->attribute("unassociatedalpha", 1);
-    }
+#   ifdef OFX_READ_OIIO_SHARED_CACHE
+    _cache = ImageCache::create(true); // shared cache
+#   else
+    _cache = ImageCache::create(false); // non-shared cache
+#   endif
+    // Always keep unassociated alpha.
+    // Don't let OIIO premultiply, because if the image is 8bits,
+    // it multiplies in 8bits (see TIFFInput::unassalpha_to_assocalpha()),
+    // which causes a lot of precision loss.
+    // see also https://github.com/OpenImageIO/oiio/issues/960
+    _cache->attribute("unassociatedalpha", 1);
 #endif
 
     if (gHostSupportsDynamicChoices && gHostSupportsMultiPlane) {
@@ -605,6 +656,22 @@ ReadOIIOPlugin::ReadOIIOPlugin(OfxImageEffectHandle handle,
 #endif
     _offsetNegativeDispWindow = fetchBooleanParam(kParamOffsetNegativeDisplayWindow);
     _edgePixels = fetchChoiceParam(kParamEdgePixels);
+    _cacheMemory = fetchIntParam(kParamCacheMemory);
+    _cacheMaxOpenFiles = fetchIntParam(kParamCacheMaxOpenFiles);
+    _cacheAutoTile = fetchIntParam(kParamCacheAutoTile);
+    _cacheAutoMip = fetchBooleanParam(kParamCacheAutoMip);
+    _cacheLogStatistics = fetchBooleanParam(kParamCacheLogStatistics);
+    assert(_cacheMemory && _cacheMaxOpenFiles && _cacheAutoTile && _cacheAutoMip && _cacheLogStatistics);
+
+    // The cache attributes are global: only set them if this instance was not left at the defaults,
+    // so that creating a new reader does not reset the settings of the other instances.
+    if ( _cache &&
+         ( (_cacheMemory->getValue() != kParamCacheMemoryDefault) ||
+           (_cacheMaxOpenFiles->getValue() != kParamCacheMaxOpenFilesDefault) ||
+           (_cacheAutoTile->getValue() != kParamCacheAutoTileDefault) ||
+           (_cacheAutoMip->getValue() != kParamCacheAutoMipDefault) ) ) {
+        setCacheAttributes();
+    }
 
     //Don't try to restore any state in here, do so in restoreState instead which is called
     //right away after the constructor.
@@ -632,6 +699,26 @@ ReadOIIOPlugin::clearAnyCache()
     }
 }
 
+void
+ReadOIIOPlugin::setCacheAttributes()
+{
+    if (!_cache) {
+        return;
+    }
+    _cache->attribute( "max_memory_MB", (float)_cacheMemory->getValue() );
+    _cache->attribute( "max_open_files", _cacheMaxOpenFiles->getValue() );
+    _cache->attribute( "autotile", _cacheAutoTile->getValue() );
+    _cache->attribute( "automip", (int)_cacheAutoMip->getValue() );
+}
+
+void
+ReadOIIOPlugin::endSequenceRender(const EndSequenceRenderArguments &/*args*/)
+{
+    if ( _cache && _cacheLogStatistics->getValue() ) {
+        std::cout << kPluginName << ": image cache statistics:" << std::endl << _cache->getstats(1) << std::endl;
+    }
+}
+
 
 static string
 oiio_versions()
@@ -701,6 +788,17 @@ ReadOIIOPlugin::changedParam(const InstanceChangedArgs &args,
             ss << "Impossible to read image info:\nCould not read file " << filename << " corresponding to time " << args.time << '.';
         }
         sendMessage( Message::eMessageMessage, "", ss.str() );
+    } else if (paramName == kParamCacheStatistics) {
+        if (_cache) {
+            sendMessage( Message::eMessageMessage, "", _cache->getstats(1) );
+        } else {
+            sendMessage(Message::eMessageMessage, "", "The OpenImageIO image cache is not used.");
+        }
+    } else if ( (paramName == kParamCacheMemory) ||
+                (paramName == kParamCacheMaxOpenFiles) ||
+                (paramName == kParamCacheAutoTile) ||
+                (paramName == kParamCacheAutoMip) ) {
+        setCacheAttributes();
     } else if ( _outputLayerString && (paramName == kParamChannelOutputLayer) ) {
         int index;
         _outputLayer->getValue(index);
@@ -760,6 +858,12 @@ ReadOIIOPlugin::changedParam(const InstanceChangedArgs &args,
                 }
             }
         }
+        clearHeaderCache();
+    } else if ( (paramName == kParamOffsetNegativeDisplayWindow) ||
+                (paramName == kParamEdgePixels) ) {
+        // these change the frame bounds
+        clearHeaderCache();
+        GenericReaderPlugin::changedParam(args, paramName);
     } else {
         GenericReaderPlugin::changedParam(args, paramName);
     }
@@ -1416,7 +1520,7 @@ ReadOIIOPlugin::getSpecs(const string &filename,
 {
     subimages->clear();
     bool gotSpec = false;
-    if (_cache) {
+    if (_cache && _useOIIOCache) {
         getSpecsFromCache(filename, subimages);
         gotSpec = true;
     }
@@ -2251,14 +2355,17 @@ ReadOIIOPlugin::decodePlane(const string& filename,
                             const string& rawComponents,
                             int rowBytes)
 {
-    assert(renderScale.x == 1. && renderScale.y == 1.);
-    unused(renderScale);
     unused(pixelComponentCount);
+    // renderScale is not 1 only if getFileMipmapLevels() returned a non-zero value:
+    // the mipmap level is then read from the cache
+    const int miplevel = (int)getLevelFromScale( (std::min)(renderScale.x, renderScale.y) );
 #if OIIO_VERSION >= 10605
     // Use cache only if not during playback because the OIIO cache eats too much RAM when playing scaline-based EXRs.
     // Do not use cache in OIIO 1.5.x because it does not support channel ranges correctly.
-    const bool useCache = _cache && !isPlayback;
+    // Tiled files are read through the cache even if the host does not want it (see below).
+    bool useCache = _cache && ( (miplevel > 0) || (_useOIIOCache && !isPlayback) );
 #else
+    assert(miplevel == 0);
     const bool useCache = false;
 #endif
 
@@ -2271,7 +2378,7 @@ ReadOIIOPlugin::decodePlane(const string& filename,
     // we only support RGBA, RGB or Alpha output clip on the color plane
     if ( (pixelComponents != ePixelComponentRGBA) && (pixelComponents != ePixelComponentRGB) && (pixelComponents != ePixelComponentXY) && (pixelComponents != ePixelComponentAlpha)
          && ( pixelComponents != ePixelComponentCustom) ) {
-        setPersistentMessage(Message::eMessageError, "", "OIIO: can only read RGBA, RGB, RG, Alpha or custom components images");
+        setDecodeError("OIIO: can only read RGBA, RGB, RG, Alpha or custom components images");
         throwSuiteStatusException(kOfxStatErrFormat);
 
         return;
@@ -2295,9 +2402,21 @@ ReadOIIOPlugin::decodePlane(const string& filename,
         img.reset(rawImg);
 #endif
     }
+#if OIIO_VERSION >= 10605
+    if ( !useCache && _cache && !isPlayback && !subimages.empty() && (subimages[0].tile_width > 0) ) {
+        // Tiled images are read through the cache, which only reads the tiles needed by the render window,
+        // and keeps them for the next renders.
+        if ( img.get() ) {
+            img->close();
+            img.reset();
+        }
+        useCache = true;
+        openFile(filename, useCache, &rawImg, &subimages);
+    }
+#endif
 
     if ( subimages.empty() ) {
-        setPersistentMessage(Message::eMessageError, "", string("Cannot open file ") + filename);
+        setDecodeError(string("Cannot open file ") + filename);
         throwSuiteStatusException(kOfxStatFailed);
 
         return;
@@ -2347,7 +2466,7 @@ ReadOIIOPlugin::decodePlane(const string& filename,
                 const string& layerName = _outputLayerMenu[layer_i].first;
                 getOIIOChannelIndexesFromLayerName(filename, view, layerName, pixelComponents, subimages, channels, numChannels, subImageIndex);
             } else {
-                setPersistentMessage(Message::eMessageError, "", "Failure to find requested layer in file");
+                setDecodeError("Failure to find requested layer in file");
                 throwSuiteStatusException(kOfxStatFailed);
 
                 return;
@@ -2387,7 +2506,7 @@ ReadOIIOPlugin::decodePlane(const string& filename,
                         }
                     }
                     if (!found) {
-                        setPersistentMessage(Message::eMessageError, "", "Could not find channel named " + layerChannels[i + 1]);
+                        setDecodeError("Could not find channel named " + layerChannels[i + 1]);
                         throwSuiteStatusException(kOfxStatFailed);
 
                         return;
@@ -2402,7 +2521,7 @@ ReadOIIOPlugin::decodePlane(const string& filename,
     if ( img.get() && !img->seek_subimage(subImageIndex, 0, subimages[0]) ) {
         stringstream ss;
         ss << "Cannot seek subimage " << subImageIndex << " in " << filename;
-        setPersistentMessage( Message::eMessageError, "", ss.str() );
+        setDecodeError( ss.str() );
         throwSuiteStatusException(kOfxStatFailed);
 
         return;
@@ -2413,6 +2532,30 @@ ReadOIIOPlugin::decodePlane(const string& filename,
 
     // Non const because ImageSpec::valid_tile_range is not const...
     ImageSpec& spec = subimages[subImageIndex];
+    if (miplevel > 0) {
+        assert(useCache);
+        const ImageSpec fullResSpec = spec;
+        if ( !_cache->get_imagespec(ustring(filename), spec, subImageIndex, miplevel) ) {
+            setDecodeError( _cache->geterror() );
+            throwSuiteStatusException(kOfxStatFailed);
+
+            return;
+        }
+        if ( (spec.full_width == fullResSpec.full_width) && (spec.full_height == fullResSpec.full_height) ) {
+            // Some formats only store the display window of the full resolution image:
+            // scale it the same way getFrameBounds() bounds are scaled by GenericReader
+            OfxRectI fullRes;
+            fullRes.x1 = fullResSpec.full_x;
+            fullRes.y1 = fullResSpec.full_y;
+            fullRes.x2 = fullResSpec.full_x + fullResSpec.full_width;
+            fullRes.y2 = fullResSpec.full_y + fullResSpec.full_height;
+            fullRes = downscalePowerOfTwoSmallestEnclosing(fullRes, (unsigned int)miplevel);
+            spec.full_x = fullRes.x1;
+            spec.full_y = fullRes.y1;
+            spec.full_width = fullRes.x2 - fullRes.x1;
+            spec.full_height = fullRes.y2 - fullRes.y1;
+        }
+    }
 
     // Compute X offset as done in getFrameBounds
     int dataOffset = 0;
@@ -2509,228 +2652,242 @@ ReadOIIOPlugin::decodePlane(const string& filename,
         }
     }
 
+    // Coalesce the reads: the distinct file channels are sorted, and each run of contiguous file channels
+    // is read with a single call, into consecutive channels of the destination buffer.
+    // The channels are then moved to their final position, and duplicate or constant channels are filled,
+    // in a single pass over the pixels (see below).
+    // E.g. RGBA from an EXR file (where channels are stored as A,B,G,R) is read with one call instead of four.
+    // This also avoids calling read_scanlines() multiple times on the same channel, which seems buggy in OIIO 1.7.12.
+    vector<int> readChannels;
+    readChannels.reserve( channels.size() );
+    for (std::size_t i = 0; i < channels.size(); ++i) {
+        if (channels[i] >= kXChannelFirst) {
+            readChannels.push_back(channels[i]);
+        }
+    }
+    std::sort( readChannels.begin(), readChannels.end() );
+    readChannels.erase( std::unique( readChannels.begin(), readChannels.end() ), readChannels.end() );
+
     std::size_t incr; // number of channels processed
-    for (std::size_t i = 0; i < channels.size(); i += incr) {
+    for (std::size_t i = 0; i < readChannels.size(); i += incr) {
         incr = 1;
-        // if the channel was already read, just duplicate it (calling multiple times read_scanlines() on the same channel seems buggy in OIIO 1.7.12)
-        bool duplicate = false;
-        for (std::size_t j = 0; !duplicate && j < i; ++j) {
-            if (channels[i] == channels[j]) {
-                char* yptr = (char*)( (float*)( (char*)pixelData + dataOffset ) );
-                for (int y = renderWindow.y1; y < renderWindow.y2; ++y, yptr += rowBytes) {
-                    float* xptr = (float*)yptr;
-                    for (int x = renderWindow.x1; x < renderWindow.x2; ++x, xptr += numChannels) {
-                        xptr[i] = xptr[j];
-                    }
-                }
-                duplicate = true;
+        // read as many contiguous channels as we can
+        while ( (i + incr) < readChannels.size() &&
+                readChannels[i + incr] == readChannels[i + incr - 1] + 1 ) {
+            ++incr;
+        }
+
+        const int outputChannelBegin = i;
+        const int chbegin = readChannels[i] - kXChannelFirst; // start channel for reading
+        const int chend = chbegin + incr; // last channel + 1
+
+        // Start on the last line to invert Y with a negative stride
+        // Pass to OIIO the pointer to the first pixel of the last scan-line of the render window.
+        float* topScanLineDataStartPtr =  (float*)( (char*)pixelData + topScanLineDataStartOffset ) + outputChannelBegin;
+        bool gotPixels = false;
+        if (_cache && useCache) {
+            gotPixels = _cache->get_pixels(ustring(filename),
+                                           subImageIndex, //subimage
+                                           miplevel, //miplevel
+                                           xbegin, //x begin
+                                           xend, //x end
+                                           ybegin, //y begin
+                                           yend, //y end
+                                           zbegin, //z begin
+                                           zend, //z end
+                                           chbegin, //chan begin
+                                           chend, // chan end
+                                           TypeDesc::FLOAT, // data type
+                                           topScanLineDataStartPtr,// output buffer
+                                           xStride, //x stride
+                                           yStride, //y stride < make it invert Y
+                                           AutoStride //z stride
+#                                        if OIIO_VERSION >= 10605
+                                           ,
+                                           chbegin, // only cache these channels
+                                           chend
+#                                        endif
+                                           );
+            if (!gotPixels) {
+                setDecodeError( _cache->geterror() );
+                throwSuiteStatusException(kOfxStatFailed);
+
+                return;
             }
         }
-        if (duplicate) {
-            // this channels was a duplicate
-            continue;
-        }
+        if (!gotPixels) { // !useCache
+            assert( kSupportsTiles || (!kSupportsTiles && (renderWindow.x2 - renderWindow.x1) == spec.width && (renderWindow.y2 - renderWindow.y1) == spec.height) );
 
-        if (channels[i] < kXChannelFirst) {
-            // fill channel with constant value
-            char* lineStart = (char*)pixelData + bottomScanLineDataStartOffset;
-            for (int y = renderWindow.y1; y < renderWindow.y2; ++y, lineStart += rowBytes) {
-                float *cur = (float*)lineStart;
-                for (int x = renderWindow.x1; x < renderWindow.x2; ++x, cur += numChannels) {
-                    cur[i] = float(channels[i]);
-                }
-            }
-        } else {
-            // read as many contiguous channels as we can
-            while ( (i + incr) < channels.size() &&
-                    channels[i + incr] == channels[i + incr - 1] + 1 ) {
-                ++incr;
-            }
-
-            const int outputChannelBegin = i;
-            const int chbegin = channels[i] - kXChannelFirst; // start channel for reading
-            const int chend = chbegin + incr; // last channel + 1
-
-            // Start on the last line to invert Y with a negative stride
-            // Pass to OIIO the pointer to the first pixel of the last scan-line of the render window.
-            float* topScanLineDataStartPtr =  (float*)( (char*)pixelData + topScanLineDataStartOffset ) + outputChannelBegin;
-            bool gotPixels = false;
-            if (_cache && useCache) {
-                gotPixels = _cache->get_pixels(ustring(filename),
-                                               subImageIndex, //subimage
-                                               0, //miplevel
-                                               xbegin, //x begin
-                                               xend, //x end
-                                               ybegin, //y begin
-                                               yend, //y end
-                                               zbegin, //z begin
-                                               zend, //z end
-                                               chbegin, //chan begin
-                                               chend, // chan end
-                                               TypeDesc::FLOAT, // data type
-                                               topScanLineDataStartPtr,// output buffer
-                                               xStride, //x stride
-                                               yStride, //y stride < make it invert Y
-                                               AutoStride //z stride
-#                                            if OIIO_VERSION >= 10605
-                                               ,
-                                               chbegin, // only cache these channels
-                                               chend
-#                                            endif
-                                               );
-                if (!gotPixels) {
-                    setPersistentMessage( Message::eMessageError, "", _cache->geterror() );
+            // We clamp to the valid scanlines portion.
+            int ybeginClamped = (std::min)((std::max)(spec.y, ybegin), spec.y + spec.height);
+            int yendClamped = (std::min)((std::max)(spec.y, yend), spec.y + spec.height);
+            int xbeginClamped = (std::min)((std::max)(spec.x, xbegin), spec.x + spec.width);
+            int xendClamped = (std::min)((std::max)(spec.x, xend), spec.x + spec.width);
+
+            // Do not call valid_tile_range because a tiled file can only be read with read_tiles with OpenImageIO.
+            // Otherwise it will give the following error: called OpenEXRInput::read_native_scanlines without an open file
+            if (spec.tile_width == 0) {
+                // Read by scanlines
+
+                if ( !img->read_scanlines(ybeginClamped, //y begin
+                                          yendClamped, //y end
+                                          zbegin, // z
+                                          chbegin, // chan begin
+                                          chend, // chan end
+                                          TypeDesc::FLOAT, // data type
+                                          topScanLineDataStartPtr,
+                                          xStride, //x stride
+                                          yStride) ) { //y stride < make it invert Y;
+                    setDecodeError( img->geterror() );
                     throwSuiteStatusException(kOfxStatFailed);
 
                     return;
                 }
-            }
-            if (!gotPixels) { // !useCache
-                assert( kSupportsTiles || (!kSupportsTiles && (renderWindow.x2 - renderWindow.x1) == spec.width && (renderWindow.y2 - renderWindow.y1) == spec.height) );
-
-                // We clamp to the valid scanlines portion.
-                int ybeginClamped = (std::min)((std::max)(spec.y, ybegin), spec.y + spec.height);
-                int yendClamped = (std::min)((std::max)(spec.y, yend), spec.y + spec.height);
-                int xbeginClamped = (std::min)((std::max)(spec.x, xbegin), spec.x + spec.width);
-                int xendClamped = (std::min)((std::max)(spec.x, xend), spec.x + spec.width);
-
-                // Do not call valid_tile_range because a tiled file can only be read with read_tiles with OpenImageIO.
-                // Otherwise it will give the following error: called OpenEXRInput::read_native_scanlines without an open file
-                if (spec.tile_width == 0) {
-                    // Read by scanlines
-
-                    if ( !img->read_scanlines(ybeginClamped, //y begin
-                                              yendClamped, //y end
-                                              zbegin, // z
-                                              chbegin, // chan begin
-                                              chend, // chan end
-                                              TypeDesc::FLOAT, // data type
-                                              topScanLineDataStartPtr,
-                                              xStride, //x stride
-                                              yStride) ) { //y stride < make it invert Y;
-                        setPersistentMessage( Message::eMessageError, "", img->geterror() );
-                        throwSuiteStatusException(kOfxStatFailed);
+            } else {
+                // If the region to read is not a multiple of tile size we must provide a buffer
+                // with the appropriate size.
+                float* tiledBuffer = topScanLineDataStartPtr;
+                float* tiledBufferToFree = 0;
+                int tiledXBegin = xbeginClamped;
+                int tiledYBegin = ybeginClamped;
+                int tiledXEnd = xendClamped;
+                int tiledYEnd = yendClamped;
+                bool validRange = spec.valid_tile_range(xbegin, xend, ybegin, yend, zbegin, zend);
+
+                // This is the number of extra pixels we decoded on the left
+                int xBeginPadToTileSize = 0;
+                // This is the numner of extra pixels we decoded on the bottom
+                int yBeginPadToTileSize = 0;
+                std::size_t tiledBufferRowSize = rowBytes;
+                std::size_t tiledBufferPixelSize = xStride;
+                if (!validRange) {
+                    // If the tile range is invalid, expand to the closest enclosing valid tile range.
+
+                    // tiledXBegin must be at a valid multiple of tile_width from spec.x
+                    tiledXBegin = spec.x +  (int)std::floor((double)(xbeginClamped - spec.x) / spec.tile_width ) * spec.tile_width;
+
+                    // tiledYBegin must be at a valid multiple of tile_height from spec.y
+                    tiledYBegin = spec.y + (int)std::floor((double)(ybeginClamped - spec.y) / spec.tile_height ) * spec.tile_height;
+
+                    // tiledXEnd must be at a valid multiple of tile_width from spec.x
+                    tiledXEnd = spec.x + (int)std::ceil((double)(xendClamped - spec.x)  / spec.tile_width ) * spec.tile_width;
+
+                    // tiledYEnd must be at a valid multiple of tile_height from spec.y
+                    tiledYEnd = spec.y + (int)std::ceil((double)(yendClamped - spec.y) / spec.tile_height ) * spec.tile_height;
+
+                    tiledXBegin = (std::max)(spec.x, tiledXBegin);
+                    tiledYBegin = (std::max)(spec.y, tiledYBegin);
+                    tiledXEnd = (std::min)(spec.x + spec.width, tiledXEnd);
+                    tiledYEnd = (std::min)(spec.y + spec.height, tiledYEnd);
+
+                    // Check that we made up a correct tile range
+                    assert( spec.valid_tile_range(tiledXBegin, tiledXEnd, tiledYBegin, tiledYEnd, zbegin, zend) );
+
+                    xBeginPadToTileSize = xbeginClamped - tiledXBegin;
+                    yBeginPadToTileSize = ybeginClamped - tiledYBegin;
+
+                    tiledBufferPixelSize = getComponentBytes(eBitDepthFloat) * (chend - chbegin);
+                    tiledBufferRowSize = (tiledXEnd - tiledXBegin) * tiledBufferPixelSize;
+                    std::size_t nBytes = tiledBufferRowSize * (tiledYEnd - tiledYBegin);
+                    tiledBufferToFree = (float*)malloc(nBytes);
+                    if (!tiledBufferToFree) {
+                        throwSuiteStatusException(kOfxStatErrMemory);
 
                         return;
                     }
-                } else {
-                    // If the region to read is not a multiple of tile size we must provide a buffer
-                    // with the appropriate size.
-                    float* tiledBuffer = topScanLineDataStartPtr;
-                    float* tiledBufferToFree = 0;
-                    int tiledXBegin = xbeginClamped;
-                    int tiledYBegin = ybeginClamped;
-                    int tiledXEnd = xendClamped;
-                    int tiledYEnd = yendClamped;
-                    bool validRange = spec.valid_tile_range(xbegin, xend, ybegin, yend, zbegin, zend);
-
-                    // This is the number of extra pixels we decoded on the left
-                    int xBeginPadToTileSize = 0;
-                    // This is the numner of extra pixels we decoded on the bottom
-                    int yBeginPadToTileSize = 0;
-                    std::size_t tiledBufferRowSize = rowBytes;
-                    std::size_t tiledBufferPixelSize = xStride;
-                    if (!validRange) {
-                        // If the tile range is invalid, expand to the closest enclosing valid tile range.
-
-                        // tiledXBegin must be at a valid multiple of tile_width from spec.x
-                        tiledXBegin = spec.x +  (int)std::floor((double)(xbeginClamped - spec.x) / spec.tile_width ) * spec.tile_width;
-
-                        // tiledYBegin must be at a valid multiple of tile_height from spec.y
-                        tiledYBegin = spec.y + (int)std::floor((double)(ybeginClamped - spec.y) / spec.tile_height ) * spec.tile_height;
-
-                        // tiledXEnd must be at a valid multiple of tile_width from spec.x
-                        tiledXEnd = spec.x + (int)std::ceil((double)(xendClamped - spec.x)  / spec.tile_width ) * spec.tile_width;
-
-                        // tiledYEnd must be at a valid multiple of tile_height from spec.y
-                        tiledYEnd = spec.y + (int)std::ceil((double)(yendClamped - spec.y) / spec.tile_height ) * spec.tile_height;
-
-                        tiledXBegin = (std::max)(spec.x, tiledXBegin);
-                        tiledYBegin = (std::max)(spec.y, tiledYBegin);
-                        tiledXEnd = (std::min)(spec.x + spec.width, tiledXEnd);
-                        tiledYEnd = (std::min)(spec.y + spec.height, tiledYEnd);
-
-                        // Check that we made up a correct tile range
-                        assert( spec.valid_tile_range(tiledXBegin, tiledXEnd, tiledYBegin, tiledYEnd, zbegin, zend) );
-
-                        xBeginPadToTileSize = xbeginClamped - tiledXBegin;
-                        yBeginPadToTileSize = ybeginClamped - tiledYBegin;
-
-                        tiledBufferPixelSize = getComponentBytes(eBitDepthFloat) * (chend - chbegin);
-                        tiledBufferRowSize = (tiledXEnd - tiledXBegin) * tiledBufferPixelSize;
-                        std::size_t nBytes = tiledBufferRowSize * (tiledYEnd - tiledYBegin);
-                        tiledBufferToFree = (float*)malloc(nBytes);
-                        if (!tiledBufferToFree) {
-                            throwSuiteStatusException(kOfxStatErrMemory);
-
-                            return;
-                        }
 
-                        // Make tile buffer point to the first pixel of the last scan-line of our temporary tile-adjusted buffer.
-                        tiledBuffer = (float*)( (char*)tiledBufferToFree + (tiledYEnd - tiledYBegin - 1) * tiledBufferRowSize );
-                    }
+                    // Make tile buffer point to the first pixel of the last scan-line of our temporary tile-adjusted buffer.
+                    tiledBuffer = (float*)( (char*)tiledBufferToFree + (tiledYEnd - tiledYBegin - 1) * tiledBufferRowSize );
+                }
 
-                    // Pass the valid tile range and buffer to OIIO and decode with a negative Y stride from
-                    // top to bottom
-                    if ( !img->read_tiles(tiledXBegin, //x begin
-                                          tiledXEnd,//x end
-                                          tiledYBegin,//y begin
-                                          tiledYEnd,//y end
-                                          zbegin, // z begin
-                                          zend, // z end
-                                          chbegin, // chan begin
-                                          chend, // chan end
-                                          TypeDesc::FLOAT, // data type
-                                          tiledBuffer,
-                                          tiledBufferPixelSize, //x stride
-                                          -tiledBufferRowSize, //y stride < make it invert Y
-                                          AutoStride) ) { //z stride
-                        setPersistentMessage( Message::eMessageError, "", img->geterror() );
-                        throwSuiteStatusException(kOfxStatFailed);
+                // Pass the valid tile range and buffer to OIIO and decode with a negative Y stride from
+                // top to bottom
+                if ( !img->read_tiles(tiledXBegin, //x begin
+                                      tiledXEnd,//x end
+                                      tiledYBegin,//y begin
+                                      tiledYEnd,//y end
+                                      zbegin, // z begin
+                                      zend, // z end
+                                      chbegin, // chan begin
+                                      chend, // chan end
+                                      TypeDesc::FLOAT, // data type
+                                      tiledBuffer,
+                                      tiledBufferPixelSize, //x stride
+                                      -tiledBufferRowSize, //y stride < make it invert Y
+                                      AutoStride) ) { //z stride
+                    setDecodeError( img->geterror() );
+                    throwSuiteStatusException(kOfxStatFailed);
 
-                        return;
-                    }
+                    return;
+                }
 
-                    if (!validRange) {
-                        // If we allocated a temporary tile-adjusted buffer, we must copy it back into the pixelData buffer.
-
-                        // This points to the start of the first pixel of the last scan-line of the render window
-                        char* dst_pix = (char*)topScanLineDataStartPtr;
-
-                        // Copy each scan-line from our temporary buffer to the final buffer. Since each buffer is pointing to the last
-                        // scan-line at the begining, we pass negative pixel offsets in the iteration loop.
-
-                        // Position the tiled buffer to the start of the content that should have been read in the original range.
-                        // To retrieve the position of the original range, we substract the number of extra lines that were decoded
-                        // from the tiledBuffer: tiledBuffer points to tiledYend - tiledYBegin - 1, so we make it point to tiledYend - tiledYbegin - 1 - yEndPadToTileSize
-
-                        assert( (tiledYBegin + yBeginPadToTileSize) == ybeginClamped );
-                        assert( (tiledXBegin + xBeginPadToTileSize) == xbeginClamped );
-                        const char* src_pix = (const char*)( (char*)tiledBuffer - yBeginPadToTileSize * tiledBufferRowSize + xBeginPadToTileSize * tiledBufferPixelSize );
-
-                        for (int y = ybeginClamped; y < yendClamped;
-                             ++y,
-                             src_pix -= tiledBufferRowSize,
-                             dst_pix -= rowBytes) {
-
-                            const float* srcPtr = (const float*)src_pix;
-                            float* dstPtr = (float*)dst_pix;
-                            for (int x = xbeginClamped; x < xendClamped;
-                                 ++x,
-                                 srcPtr += (chend - chbegin),
-                                 dstPtr += numChannels) {
-                                for (int c = 0; c < (chend - chbegin); ++c) {
-                                    assert( !OFX::IsNaN(srcPtr[c]) ); // Check for NaNs
-                                    dstPtr[c] = srcPtr[c];
-                                }
+                if (!validRange) {
+                    // If we allocated a temporary tile-adjusted buffer, we must copy it back into the pixelData buffer.
+
+                    // This points to the start of the first pixel of the last scan-line of the render window
+                    char* dst_pix = (char*)topScanLineDataStartPtr;
+
+                    // Copy each scan-line from our temporary buffer to the final buffer. Since each buffer is pointing to the last
+                    // scan-line at the begining, we pass negative pixel offsets in the iteration loop.
+
+                    // Position the tiled buffer to the start of the content that should have been read in the original range.
+                    // To retrieve the position of the original range, we substract the number of extra lines that were decoded
+                    // from the tiledBuffer: tiledBuffer points to tiledYend - tiledYBegin - 1, so we make it point to tiledYend - tiledYbegin - 1 - yEndPadToTileSize
+
+                    assert( (tiledYBegin + yBeginPadToTileSize) == ybeginClamped );
+                    assert( (tiledXBegin + xBeginPadToTileSize) == xbeginClamped );
+                    const char* src_pix = (const char*)( (char*)tiledBuffer - yBeginPadToTileSize * tiledBufferRowSize + xBeginPadToTileSize * tiledBufferPixelSize );
+
+                    for (int y = ybeginClamped; y < yendClamped;
+                         ++y,
+                         src_pix -= tiledBufferRowSize,
+                         dst_pix -= rowBytes) {
+
+                        const float* srcPtr = (const float*)src_pix;
+                        float* dstPtr = (float*)dst_pix;
+                        for (int x = xbeginClamped; x < xendClamped;
+                             ++x,
+                             srcPtr += (chend - chbegin),
+                             dstPtr += numChannels) {
+                            for (int c = 0; c < (chend - chbegin); ++c) {
+                                assert( !OFX::IsNaN(srcPtr[c]) ); // Check for NaNs
+                                dstPtr[c] = srcPtr[c];
                             }
                         }
-                        free(tiledBufferToFree);
                     }
+                    free(tiledBufferToFree);
                 }
-            } // !useCache
-        } // if (channels[i] < kXChannelFirst) {
-    } // for (std::size_t i = 0; i < channels.size(); i+=incr) {
+            }
+        } // !useCache
+    } // for (std::size_t i = 0; i < readChannels.size(); i+=incr) {
+
+    // Move the channels that were read to their final position, and fill duplicate and constant channels.
+    // srcChannel[i] is the position where output channel i was read, or -1 for a constant channel.
+    vector<int> srcChannel( channels.size() );
+    bool isIdentity = true;
+    for (std::size_t i = 0; i < channels.size(); ++i) {
+        if (channels[i] < kXChannelFirst) {
+            srcChannel[i] = -1;
+        } else {
+            srcChannel[i] = (int)( std::lower_bound( readChannels.begin(), readChannels.end(), channels[i] ) - readChannels.begin() );
+        }
+        isIdentity = isIdentity && (srcChannel[i] == (int)i);
+    }
+    if (!isIdentity) {
+        const int nReadChannels = (int)readChannels.size();
+        const int nOutputChannels = (int)channels.size();
+        vector<float> pix(nReadChannels);
+        char* lineStart = (char*)pixelData + bottomScanLineDataStartOffset;
+        for (int y = renderWindowUnPadded.y1; y < renderWindowUnPadded.y2; ++y, lineStart += rowBytes) {
+            float *cur = (float*)lineStart;
+            for (int x = renderWindowUnPadded.x1; x < renderWindowUnPadded.x2; ++x, cur += numChannels) {
+                std::copy(cur, cur + nReadChannels, pix.begin());
+                for (int c = 0; c < nOutputChannels; ++c) {
+                    cur[c] = (srcChannel[c] < 0) ? float(channels[c]) : pix[srcChannel[c]];
+                }
+            }
+        }
+    }
 
     if (!useCache) {
         img->close();
@@ -2872,6 +3029,42 @@ ReadOIIOPlugin::getFrameBounds(const string& filename,
     return true;
 } // ReadOIIOPlugin::getFrameBounds
 
+unsigned int
+ReadOIIOPlugin::getFileMipmapLevels(const string& filename)
+{
+#if OIIO_VERSION >= 10605
+    if (!_cache) {
+        return 0;
+    }
+
+    // make sure we use the right config for this file
+    ImageSpec config;
+    getConfig(&config);
+    _cache->add_file(ustring(filename), NULL, &config);
+
+    int nSubImages = 0;
+    if ( !_cache->get_image_info(ustring(filename), 0, 0, ustring("subimages"), TypeDesc::TypeInt, &nSubImages) || (nSubImages <= 0) ) {
+        return 0;
+    }
+    // all subimages must have the requested level, since layers may be read from any subimage
+    int nMipLevels = INT_MAX;
+    for (int i = 0; i < nSubImages; ++i) {
+        int n = 0;
+        if ( !_cache->get_image_info(ustring(filename), i, 0, ustring("miplevels"), TypeDesc::TypeInt, &n) ) {
+            return 0;
+        }
+        nMipLevels = (std::min)(nMipLevels, n);
+    }
+
+    return (nMipLevels > 1) ? (unsigned int)(nMipLevels - 1) : 0;
+#else
+    // Do not use cache in OIIO 1.5.x because it does not support channel ranges correctly.
+    unused(filename);
+
+    return 0;
+#endif
+}
+
 string
 ReadOIIOPlugin::metadata(const string& filename)
 {
@@ -2883,7 +3076,7 @@ ReadOIIOPlugin::metadata(const string& filename)
     auto_ptr<ImageInput> img;
 # endif
 
-    if (!_cache) {
+    if ( !(_cache && _useOIIOCache) ) {
         // use the right config
         ImageSpec config;
         getConfig(&config);
@@ -3020,7 +3213,7 @@ ReadOIIOPlugin::metadata(const string& filename)
             ss << std::endl;
         }
     }
-    if (!_cache) {
+    if ( !(_cache && _useOIIOCache) ) {
         assert( img.get() );
         img->close();
     }
@@ -3509,6 +3702,102 @@ ReadOIIOPluginFactory::describeInContext(ImageEffectDescriptor &desc,
 #endif
 
         }
+        {
+            GroupParamDescriptor* group = desc.defineGroupParam(kGroupCache);
+            if (group) {
+                group->setLabelAndHint(kGroupCacheLabel);
+                group->setOpen(false);
+                if (topgroup) {
+                    group->setParent(*topgroup);
+                }
+                if (page) {
+                    page->addChild(*group);
+                }
+            }
+
+            {
+                IntParamDescriptor* param = desc.defineIntParam(kParamCacheMemory);
+                param->setLabelAndHint(kParamCacheMemoryLabel);
+                param->setRange(0, INT_MAX);
+                param->setDisplayRange(0, 16384);
+                param->setDefault(kParamCacheMemoryDefault);
+                param->setAnimates(false);
+                param->setEvaluateOnChange(false);
+                if (group) {
+                    param->setParent(*group);
+                }
+                if (page) {
+                    page->addChild(*param);
+                }
+            }
+            {
+                IntParamDescriptor* param = desc.defineIntParam(kParamCacheMaxOpenFiles);
+                param->setLabelAndHint(kParamCacheMaxOpenFilesLabel);
+                param->setRange(1, INT_MAX);
+                param->setDisplayRange(1, 1000);
+                param->setDefault(kParamCacheMaxOpenFilesDefault);
+                param->setAnimates(false);
+                param->setEvaluateOnChange(false);
+                if (group) {
+                    param->setParent(*group);
+                }
+                if (page) {
+                    page->addChild(*param);
+                }
+            }
+            {
+                IntParamDescriptor* param = desc.defineIntParam(kParamCacheAutoTile);
+                param->setLabelAndHint(kParamCacheAutoTileLabel);
+                param->setRange(0, 4096);
+                param->setDisplayRange(0, 512);
+                param->setDefault(kParamCacheAutoTileDefault);
+                param->setAnimates(false);
+                param->setEvaluateOnChange(false);
+                if (group) {
+                    param->setParent(*group);
+                }
+                if (page) {
+                    page->addChild(*param);
+                }
+            }
+            {
+                BooleanParamDescriptor* param = desc.defineBooleanParam(kParamCacheAutoMip);
+                param->setLabelAndHint(kParamCacheAutoMipLabel);
+                param->setDefault(kParamCacheAutoMipDefault);
+                param->setAnimates(false);
+                param->setEvaluateOnChange(false);
+                if (group) {
+                    param->setParent(*group);
+                }
+                if (page) {
+                    page->addChild(*param);
+                }
+            }
+            {
+                PushButtonParamDescriptor* param = desc.definePushButtonParam(kParamCacheStatistics);
+                param->setLabelAndHint(kParamCacheStatisticsLabel);
+                param->setLayoutHint(eLayoutHintNoNewLine, 1);
+                if (group) {
+                    param->setParent(*group);
+                }
+                if (page) {
+                    page->addChild(*param);
+                }
+            }
+            {
+                BooleanParamDescriptor* param = desc.defineBooleanParam(kParamCacheLogStatistics);
+                param->setLabelAndHint(kParamCacheLogStatisticsLabel);
+                param->setDefault(false);
+                param->setAnimates(false);
+                param->setEvaluateOnChange(false);
+                if (group) {
+                    param->setParent(*group);
+                }
+                if (page) {
+                    page->addChild(*param);
+                }
+            }
+        }
     }
 
     if (gHostSupportsMultiPlane && gHostSupportsDynamicChoices) {
@@ -23,6 +23,8 @@
  */
 
 #include <cfloat> // DBL_MAX
+#include <cstddef> // ptrdiff_t
+#include <algorithm>
 
 #include "ofxsMacros.h"
 
@@ -36,6 +38,7 @@ GCC_DIAG_ON(unused-parameter)
 
 #include <ofxsMultiPlane.h>
 #include <ofxsCoords.h>
+#include <ofxsMultiThread.h>
 
 #if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
 #include <IlmThreadPool.h>
@@ -229,6 +232,18 @@ enum EParamTileSize
     eParamTileSize512
 };
 
+#define kParamOutputMipmap "mipmap"
+#define kParamOutputMipmapLabel "MIP-Map"
+#define kParamOutputMipmapHint "Also write the successive half-resolution levels of the image (a MIP-map), for formats that support it (TIFF, EXR), " \
+    "so that readers can use a lower level for proxy renders. Levels are computed with a 2x2 box filter. " \
+    "EXR MIP-maps are always tiled: 64x64 tiles are used if the Tile Size is Scan-Line Based. Not available for multi-part files."
+
+#define kParamOutputThreads "threads"
+#define kParamOutputThreadsLabel "Encoding Threads"
+#define kParamOutputThreadsHint "Number of threads used by OpenImageIO to compress the tiles or scan-line strips of a frame in parallel, " \
+    "for formats that support it (e.g. TIFF). 0 means the number of CPUs. EXR files are compressed by the global OpenEXR thread pool."
+#define kParamOutputThreadsDefault 0
+
 #define kParamProcessAllLayers "processAllLayers"
 #define kParamProcessAllLayersLabel "All Layers"
 #define kParamProcessAllLayersHint "When checked, all layers will be written to the file"
@@ -375,6 +390,8 @@ private:
     ChoiceParam* _orientation;
     ChoiceParam* _compression;
     ChoiceParam* _tileSize;
+    BooleanParam* _mipmap;
+    IntParam* _threads;
     ChoiceParam* _outputLayers;
     ChoiceParam* _parts;
     ChoiceParam* _views;
@@ -391,6 +408,8 @@ WriteOIIOPlugin::WriteOIIOPlugin(OfxImageEffectHandle handle,
     , _orientation(NULL)
     , _compression(NULL)
     , _tileSize(NULL)
+    , _mipmap(NULL)
+    , _threads(NULL)
     , _outputLayers(NULL)
     , _parts(NULL)
     , _views(NULL)
@@ -404,6 +423,9 @@ WriteOIIOPlugin::WriteOIIOPlugin(OfxImageEffectHandle handle,
     _orientation = fetchChoiceParam(kParamOutputOrientation);
     _compression = fetchChoiceParam(kParamOutputCompression);
     _tileSize = fetchChoiceParam(kParamTileSize);
+    _mipmap = fetchBooleanParam(kParamOutputMipmap);
+    _threads = fetchIntParam(kParamOutputThreads);
+    assert(_mipmap && _threads);
     if (gIsMultiplanarV2) {
         _outputLayers = fetchChoiceParam(kParamOutputChannels);
 
@@ -827,6 +849,7 @@ WriteOIIOPlugin::refreshParamsVisibility(const string& filename)
 # endif
     if ( output.get() ) {
         _tileSize->setIsSecretAndDisabled( !output->supports("tiles") );
+        _mipmap->setIsSecretAndDisabled( !output->supports("mipmap") );
         //_outputLayers->setIsSecretAndDisabled(!output->supports("nchannels"));
         bool hasQuality = (strcmp(output->format_name(), "jpeg") == 0 ||
                            strcmp(output->format_name(), "webp") == 0);
@@ -853,6 +876,7 @@ WriteOIIOPlugin::refreshParamsVisibility(const string& filename)
         }
     } else {
         _tileSize->setIsSecretAndDisabled(true);
+        _mipmap->setIsSecretAndDisabled(true);
         //_outputLayers->setIsSecretAndDisabled(true);
         _quality->setIsSecretAndDisabled(true);
         _dwaCompressionLevel->setIsSecretAndDisabled(true);
@@ -873,8 +897,42 @@ struct WriteOIIOEncodePlanesData
     auto_ptr<ImageOutput> output;
 #endif
     vector<ImageSpec> specs;
+    bool mipmap; // write the MIP levels of each part (only if there's a single part)
+
+    WriteOIIOEncodePlanesData()
+        : output()
+        , specs()
+        , mipmap(false)
+    {
+    }
 };
 
+// Downsample a float image by 2 in each direction with a 2x2 box filter.
+// Strides are in floats (srcYStride may be negative), the destination is packed and top-down.
+static void
+halveImage(const float* src,
+           int srcWidth,
+           int srcHeight,
+           std::ptrdiff_t srcXStride,
+           std::ptrdiff_t srcYStride,
+           int nComps,
+           float* dst,
+           int dstWidth,
+           int dstHeight)
+{
+    for (int y = 0; y < dstHeight; ++y) {
+        const float* src0 = src + (2 * y) * srcYStride;
+        const float* src1 = src + (std::min)(2 * y + 1, srcHeight - 1) * srcYStride;
+        for (int x = 0; x < dstWidth; ++x) {
+            const std::ptrdiff_t x0 = (2 * x) * srcXStride;
+            const std::ptrdiff_t x1 = (std::min)(2 * x + 1, srcWidth - 1) * srcXStride;
+            for (int c = 0; c < nComps; ++c) {
+                *dst++ = 0.25f * (src0[x0 + c] + src0[x1 + c] + src1[x0 + c] + src1[x1 + c]);
+            }
+        }
+    }
+}
+
 void*
 WriteOIIOPlugin::allocateEncodePlanesUserData()
 {
@@ -1188,6 +1246,21 @@ WriteOIIOPlugin::beginEncodeParts(void* user_data,
         }
     }
 
+    bool mipmap = false;
+    if ( !_mipmap->getIsSecret() ) {
+        _mipmap->getValue(mipmap);
+    }
+    // the MIP levels of a part must immediately follow it, so they are only written for single-part files
+    data->mipmap = mipmap && data->output->supports("mipmap") && (partsSplitting == eLayerViewsSinglePart);
+    if (data->mipmap && isEXR) {
+        if (spec.tile_width == 0) {
+            spec.tile_width = (std::min)(64, spec.full_width);
+            spec.tile_height = (std::min)(64, spec.full_height);
+        }
+        spec.attribute("openexr:levelmode", 1); // MIPMAP_LEVELS
+        spec.attribute("openexr:roundingmode", 0); // ROUND_DOWN, as in encodePart()
+    }
+
 
     assert( !planes.empty() );
     switch (partsSplitting) {
@@ -1409,6 +1482,14 @@ WriteOIIOPlugin::beginEncodeParts(void* user_data,
 
         return;
     }
+# if OIIO_VERSION >= 20000
+    // formats which compress tiles or strips in parallel (e.g. TIFF) use this many threads
+    int threads = _threads->getValue();
+    if (threads <= 0) {
+        threads = (int)MultiThread::getNumCPUs();
+    }
+    data->output->threads(threads);
+# endif
 } // WriteOIIOPlugin::beginEncodeParts
 
 void
@@ -1434,12 +1515,62 @@ WriteOIIOPlugin::encodePart(void* user_data,
 
     //do not use auto-stride as the buffer may have more components that what we want to write
     std::size_t xStride = format.size() * pixelDataNComps;
-    data->output->write_image(format,
-                              (char*)pixelData + (data->specs[planeIndex].height - 1) * rowBytes, //invert y
-                              xStride, //xstride
-                              -rowBytes, //ystride
-                              AutoStride //zstride
-                              );
+    const ImageSpec& spec = data->specs[planeIndex];
+    // tiles are written directly from the strided buffer, no intermediate copy is made
+    if ( !data->output->write_image(format,
+                                    (char*)pixelData + (spec.height - 1) * rowBytes, //invert y
+                                    xStride, //xstride
+                                    -rowBytes, //ystride
+                                    AutoStride //zstride
+                                    ) ) {
+        setPersistentMessage( Message::eMessageError, "", data->output->geterror() );
+        throwSuiteStatusException(kOfxStatFailed);
+
+        return;
+    }
+
+    if (!data->mipmap) {
+        return;
+    }
+
+    // write the successive levels, each one computed from the previous one
+    const int nComps = spec.nchannels;
+    const float* src = (const float*)( (const char*)pixelData + (spec.height - 1) * rowBytes );
+    std::ptrdiff_t srcXStride = pixelDataNComps;
+    std::ptrdiff_t srcYStride = -(std::ptrdiff_t)(rowBytes / sizeof(float));
+    ImageSpec levelSpec = spec;
+    vector<float> level;
+    vector<float> prevLevel;
+    while ( (levelSpec.width > 1) || (levelSpec.height > 1) ) {
+        if ( abort() ) {
+            return;
+        }
+        const int width = (std::max)(1, levelSpec.width / 2);
+        const int height = (std::max)(1, levelSpec.height / 2);
+        level.resize( (std::size_t)width * height * nComps );
+        halveImage(src, levelSpec.width, levelSpec.height, srcXStride, srcYStride, nComps, &level[0], width, height);
+
+        levelSpec.width = width;
+        levelSpec.height = height;
+        levelSpec.x /= 2;
+        levelSpec.y /= 2;
+        levelSpec.full_x /= 2;
+        levelSpec.full_y /= 2;
+        levelSpec.full_width = (std::max)(1, levelSpec.full_width / 2);
+        levelSpec.full_height = (std::max)(1, levelSpec.full_height / 2);
+        if ( !data->output->open(filename, levelSpec, ImageOutput::AppendMIPLevel) ||
+             !data->output->write_image(format, &level[0]) ) {
+            setPersistentMessage( Message::eMessageError, "", data->output->geterror() );
+            throwSuiteStatusException(kOfxStatFailed);
+
+            return;
+        }
+
+        prevLevel.swap(level);
+        src = &prevLevel[0];
+        srcXStride = nComps;
+        srcYStride = (std::ptrdiff_t)width * nComps;
+    }
 }
 
 void
@@ -1578,7 +1709,7 @@ WriteOIIOPluginFactory::describeInContext(ImageEffectDescriptor &desc,
                                                                     kSupportsRGB,
                                                                     kSupportsXY,
                                                                     kSupportsAlpha,
-                                                                    "scene_linear", "scene_linear", true);
+                                                                    "scene_linear", "scene_linear", true, false);
     {
         ChoiceParamDescriptor* param = desc.defineChoiceParam(kParamTileSize);
         param->setLabel(kParamTileSizeLabel);
@@ -1598,6 +1729,29 @@ WriteOIIOPluginFactory::describeInContext(ImageEffectDescriptor &desc,
             page->addChild(*param);
         }
     }
+    {
+        BooleanParamDescriptor* param = desc.defineBooleanParam(kParamOutputMipmap);
+        param->setLabel(kParamOutputMipmapLabel);
+        param->setHint(kParamOutputMipmapHint);
+        param->setDefault(false);
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        IntParamDescriptor* param = desc.defineIntParam(kParamOutputThreads);
+        param->setLabel(kParamOutputThreadsLabel);
+        param->setHint(kParamOutputThreadsHint);
+        param->setRange(0, 256);
+        param->setDisplayRange(0, 64);
+        param->setDefault(kParamOutputThreadsDefault);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
     {
         ChoiceParamDescriptor* param = desc.defineChoiceParam(kParamBitDepth);
         param->setLabel(kParamBitDepthLabel);
@@ -23,8 +23,19 @@
  */
 
 #include <cstdio> // fopen, fread...
+#include <cstring> // memcpy
 #include <algorithm>
 
+#if !defined(_WIN32) && !defined(__WIN32__) && !defined(WIN32)
+// Read the samples directly from a memory mapping of the file.
+#define OFX_READ_PFM_USES_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #include "GenericReader.h"
 #include "GenericOCIO.h"
 #include "ofxsFileOpen.h"
@@ -57,6 +68,8 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
 #define kSupportsAlpha true
 #define kSupportsTiles false
 
+struct PFMHeader;
+
 class ReadPFMPlugin
     : public GenericReaderPlugin
 {
@@ -93,6 +106,9 @@ private:
      * When reading an image sequence, this is called only for the first image when the user actually selects the new sequence.
      **/
     virtual bool guessParamsFromFilename(const string& filename, string *colorspace, PreMultiplicationEnum *filePremult, PixelComponentEnum *components, int *componentCount) OVERRIDE FINAL;
+
+    /// the parsed header of filename, from the header cache if the file was already read
+    bool getHeader(const string& filename, PFMHeader* header, string* error) const;
 };
 
 
@@ -140,6 +156,88 @@ invert_endianness(T *const buffer,
     }
 }
 
+struct PFMHeader
+{
+    char type; // 'F' (color) or 'f' (grayscale)
+    int width;
+    int height;
+    int nComps; // 3 or 1
+    bool hasScale; // false if the SCALE field is undefined
+    bool isInverted; // true if the endianness of the samples is not the one of the host
+    long dataOffset; // offset of the first sample in the file
+};
+
+/**
+ * @brief Parse the header of a PFM file.
+ * Returns false and sets error if the header is not found or the size is invalid.
+ **/
+static bool
+readPFMHeader(const string& filename,
+              PFMHeader* header,
+              string* error)
+{
+    std::FILE *const nfile = fopen_utf8(filename.c_str(), "rb");
+    if (!nfile) {
+        *error = string("Cannot open file \"") + filename + "\".";
+
+        return false;
+    }
+
+    char pfm_type, item[1024] = { 0 };
+    int W = 0;
+    int H = 0;
+    int err = 0;
+    double scale = 0.0;
+    while ( ( err = std::fscanf(nfile, "%1023[^\n]", item) ) != EOF && (*item == '#' || !err) ) {
+        int c = std::fgetc(nfile);
+        (void)c;
+    }
+    if (std::sscanf(item, " P%c", &pfm_type) != 1) {
+        std::fclose(nfile);
+        *error = string("PFM header not found in file \"") + filename + "\".";
+
+        return false;
+    }
+    while ( ( err = std::fscanf(nfile, " %1023[^\n]", item) ) != EOF && (*item == '#' || !err) ) {
+        int c = std::fgetc(nfile);
+        (void)c;
+    }
+    if (std::sscanf(item, " %d %d", &W, &H) != 2) {
+        std::fclose(nfile);
+        *error = string("WIDTH and HEIGHT fields are undefined in file \"") + filename + "\".";
+
+        return false;
+    }
+    if ( (W <= 0) || (H <= 0) || (0xffff < W) || (0xffff < H) ) {
+        std::fclose(nfile);
+        *error = string("invalid WIDTH or HEIGHT fields in file \"") + filename + "\".";
+
+        return false;
+    }
+
+    while ( ( err = std::fscanf(nfile, " %1023[^\n]", item) ) != EOF && (*item == '#' || !err) ) {
+        int c = std::fgetc(nfile);
+        (void)c;
+    }
+    header->hasScale = (std::sscanf(item, "%lf", &scale) == 1);
+
+    {
+        int c = std::fgetc(nfile);
+        (void)c;
+    }
+    header->dataOffset = std::ftell(nfile);
+    std::fclose(nfile);
+
+    header->type = pfm_type;
+    header->width = W;
+    header->height = H;
+    header->nComps = (pfm_type == 'F') ? 3 : 1;
+    header->isInverted = (scale > 0) != endianness();
+
+    return true;
+} // readPFMHeader
+
+
 ReadPFMPlugin::ReadPFMPlugin(OfxImageEffectHandle handle,
                              const vector<string>& extensions)
     : GenericReaderPlugin(handle, extensions, kSupportsRGBA, kSupportsRGB, kSupportsXY, kSupportsAlpha, kSupportsTiles, false)
@@ -150,9 +248,25 @@ ReadPFMPlugin::~ReadPFMPlugin()
 {
 }
 
+bool
+ReadPFMPlugin::getHeader(const string& filename,
+                         PFMHeader* header,
+                         string* error) const
+{
+    if ( getCachedFileHeader(filename, header) ) {
+        return true;
+    }
+    if ( !readPFMHeader(filename, header, error) ) {
+        return false;
+    }
+    setCachedFileHeader(filename, *header);
+
+    return true;
+}
+
 template <class PIX, int srcC, int dstC>
 static void
-copyLine(PIX *image,
+copyLine(const PIX *image,
          int x1,
          int x2,
          int C,
@@ -212,83 +326,102 @@ ReadPFMPlugin::decode(const string& filename,
         return;
     }
 
-    // read PFM header
-    std::FILE *const nfile = fopen_utf8(filename.c_str(), "rb");
-
-    char pfm_type, item[1024] = { 0 };
-    int W = 0;
-    int H = 0;
-    int C = 0;
-    int err = 0;
-    double scale = 0.0;
-    while ( ( err = std::fscanf(nfile, "%1023[^\n]", item) ) != EOF && (*item == '#' || !err) ) {
-        int c = std::fgetc(nfile);
-        (void)c;
-    }
-    if (std::sscanf(item, " P%c", &pfm_type) != 1) {
-        std::fclose(nfile);
-        setPersistentMessage(Message::eMessageError, "", string("PFM header not found in file \"") + filename + "\".");
-        throwSuiteStatusException(kOfxStatFailed);
-
-        return;
-    }
-    while ( ( err = std::fscanf(nfile, " %1023[^\n]", item) ) != EOF && (*item == '#' || !err) ) {
-        int c = std::fgetc(nfile);
-        (void)c;
-    }
-    if (std::sscanf(item, " %d %d", &W, &H) != 2) {
-        std::fclose(nfile);
-        setPersistentMessage(Message::eMessageError, "", string("WIDTH and HEIGHT fields are undefined in file \"") + filename + "\".");
-        throwSuiteStatusException(kOfxStatFailed);
-
-        return;
-    }
-    if ( (W <= 0) || (H <= 0) || (0xffff < W) || (0xffff < H) ) {
-        std::fclose(nfile);
-        setPersistentMessage(Message::eMessageError, "", string("invalid WIDTH or HEIGHT fields in file \"") + filename + "\".");
+    PFMHeader header;
+    string error;
+    if ( !getHeader(filename, &header, &error) ) {
+        setPersistentMessage(Message::eMessageError, "", error);
         throwSuiteStatusException(kOfxStatFailed);
 
         return;
     }
-
     clearPersistentMessage();
-    while ( ( err = std::fscanf(nfile, " %1023[^\n]", item) ) != EOF && (*item == '#' || !err) ) {
-        int c = std::fgetc(nfile);
-        (void)c;
-    }
-    if (std::sscanf(item, "%lf", &scale) != 1) {
+    if (!header.hasScale) {
         setPersistentMessage(Message::eMessageWarning, "", string("SCALE field is undefined in file \"") + filename + "\".");
     }
 
-    {
-        int c = std::fgetc(nfile);
-        (void)c;
-    }
-
-    const bool is_inverted = (scale > 0) != endianness();
-    if (pfm_type == 'F') {
-        C = 3;
-    } else {
-        C = 1;
-    }
+    const int W = header.width;
+    const int C = header.nComps;
+    const bool is_inverted = header.isInverted;
 
     std::size_t numpixels = W * C;
+    const std::size_t rowSize = numpixels * sizeof(float);
+    // scratch line, used when the samples can't be used directly from the file mapping
     vector<float> image(numpixels);
 
     assert(0 <= renderWindow.x1 && renderWindow.x2 <= W &&
-           0 <= renderWindow.y1 && renderWindow.y2 <= H);
+           0 <= renderWindow.y1 && renderWindow.y2 <= header.height);
     const int x1 = renderWindow.x1;
     const int x2 = renderWindow.x2;
 
-    for (int y = renderWindow.y1; y < renderWindow.y2; ++y) {
-        std::size_t numread = std::fread(&image.front(), 4, numpixels, nfile);
-        if (numread < numpixels) {
-            std::fclose(nfile);
-            setPersistentMessage(Message::eMessageError, "", "could not read all the image samples needed");
+    // Only the lines of the render window are read, either from a memory mapping of the file
+    // or, if the file can not be mapped, with fread().
+    const char* mapped = NULL;
+    std::size_t mappedSize = 0;
+#ifdef OFX_READ_PFM_USES_MMAP
+    {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            struct stat st;
+            if ( (fstat(fd, &st) == 0) && (st.st_size > 0) ) {
+                mappedSize = (std::size_t)st.st_size;
+                void* addr = mmap(NULL, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (addr != MAP_FAILED) {
+                    mapped = (const char*)addr;
+                }
+            }
+            close(fd); // the mapping stays valid
+        }
+    }
+    if ( mapped && ( mappedSize < (std::size_t)header.dataOffset + (std::size_t)renderWindow.y2 * rowSize ) ) {
+        munmap( (void*)mapped, mappedSize );
+        setPersistentMessage(Message::eMessageError, "", "could not read all the image samples needed");
+        throwSuiteStatusException(kOfxStatFailed);
+
+        return;
+    }
+#endif
+    // samples can be read in place if they are aligned and have the right endianness
+    const bool inPlace = mapped && !is_inverted && (header.dataOffset % sizeof(float) == 0);
+
+    std::FILE* nfile = NULL;
+    if (!mapped) {
+        nfile = fopen_utf8(filename.c_str(), "rb");
+        if ( !nfile || (std::fseek(nfile, header.dataOffset, SEEK_SET) != 0) ) {
+            if (nfile) {
+                std::fclose(nfile);
+            }
+            setPersistentMessage(Message::eMessageError, "", string("Cannot open file \"") + filename + "\".");
             throwSuiteStatusException(kOfxStatFailed);
 
             return;
         }
+        // skip the lines below the render window
+        for (int y = 0; y < renderWindow.y1; ++y) {
+            if (std::fread(&image.front(), 4, numpixels, nfile) < numpixels) {
+                break;
+            }
+        }
+    }
+
+    for (int y = renderWindow.y1; y < renderWindow.y2; ++y) {
+        const float* srcLine = &image.front();
+        if (mapped) {
+            const char* line = mapped + header.dataOffset + (std::size_t)y * rowSize;
+            if (inPlace) {
+                srcLine = (const float*)line;
+            } else {
+                std::memcpy(&image.front(), line, rowSize);
+            }
+        } else {
+            std::size_t numread = std::fread(&image.front(), 4, numpixels, nfile);
+            if (numread < numpixels) {
+                std::fclose(nfile);
+                setPersistentMessage(Message::eMessageError, "", "could not read all the image samples needed");
+                throwSuiteStatusException(kOfxStatFailed);
+
+                return;
+            }
+        }
 
         if (is_inverted) {
             invert_endianness(&image.front(), numpixels);
@@ -299,16 +432,16 @@ ReadPFMPlugin::decode(const string& filename,
         if (C == 1) {
             switch (pixelComponentCount) {
             case 1:
-                copyLine<float, 1, 1>(&image.front(), x1, x2, C, dstPix);
+                copyLine<float, 1, 1>(srcLine, x1, x2, C, dstPix);
                 break;
             case 2:
-                copyLine<float, 1, 2>(&image.front(), x1, x2, C, dstPix);
+                copyLine<float, 1, 2>(srcLine, x1, x2, C, dstPix);
                 break;
             case 3:
-                copyLine<float, 1, 3>(&image.front(), x1, x2, C, dstPix);
+                copyLine<float, 1, 3>(srcLine, x1, x2, C, dstPix);
                 break;
             case 4:
-                copyLine<float, 1, 4>(&image.front(), x1, x2, C, dstPix);
+                copyLine<float, 1, 4>(srcLine, x1, x2, C, dstPix);
                 break;
             default:
                 break;
@@ -316,23 +449,30 @@ ReadPFMPlugin::decode(const string& filename,
         } else if (C == 3) {
             switch (pixelComponentCount) {
             case 1:
-                copyLine<float, 3, 1>(&image.front(), x1, x2, C, dstPix);
+                copyLine<float, 3, 1>(srcLine, x1, x2, C, dstPix);
                 break;
             case 2:
-                copyLine<float, 3, 2>(&image.front(), x1, x2, C, dstPix);
+                copyLine<float, 3, 2>(srcLine, x1, x2, C, dstPix);
                 break;
             case 3:
-                copyLine<float, 3, 3>(&image.front(), x1, x2, C, dstPix);
+                copyLine<float, 3, 3>(srcLine, x1, x2, C, dstPix);
                 break;
             case 4:
-                copyLine<float, 3, 4>(&image.front(), x1, x2, C, dstPix);
+                copyLine<float, 3, 4>(srcLine, x1, x2, C, dstPix);
                 break;
             default:
                 break;
             }
         }
     }
-    std::fclose(nfile);
+#ifdef OFX_READ_PFM_USES_MMAP
+    if (mapped) {
+        munmap( (void*)mapped, mappedSize );
+    }
+#endif
+    if (nfile) {
+        std::fclose(nfile);
+    }
 } // ReadPFMPlugin::decode
 
 bool
@@ -347,49 +487,21 @@ ReadPFMPlugin::getFrameBounds(const string& filename,
                               int* tile_height)
 {
     assert(bounds && par);
-    // read PFM header
-    std::FILE *const nfile = std::fopen(filename.c_str(), "rb");
-
-    char pfm_type, item[1024] = { 0 };
-    int W = 0;
-    int H = 0;
-    int err = 0;
-    double scale = 0.0;
-    while ( ( err = std::fscanf(nfile, "%1023[^\n]", item) ) != EOF && (*item == '#' || !err) ) {
-        int c = std::fgetc(nfile);
-        (void)c;
-    }
-    if (std::sscanf(item, " P%c", &pfm_type) != 1) {
-        std::fclose(nfile);
-        if (error) {
-            *error = string("PFM header not found in file \"") + filename + "\".";
-        }
-
-        return false;
-    }
-    while ( ( err = std::fscanf(nfile, " %1023[^\n]", item) ) != EOF && (*item == '#' || !err) ) {
-        int c = std::fgetc(nfile);
-        (void)c;
-    }
-    if ( ( err = std::sscanf(item, " %d %d", &W, &H) ) < 2 ) {
-        std::fclose(nfile);
+    PFMHeader header;
+    string headerError;
+    if ( !getHeader(filename, &header, &headerError) ) {
         if (error) {
-            *error =  string("WIDTH and HEIGHT fields are undefined in file \"") + filename + "\".";
+            *error = headerError;
         }
 
         return false;
     }
-    if (err == 2) {
-        clearPersistentMessage();
-        while ( ( err = std::fscanf(nfile, " %1023[^\n]", item) ) != EOF && (*item == '#' || !err) ) {
-            int c = std::fgetc(nfile);
-            (void)c;
-        }
-        if (std::sscanf(item, "%lf", &scale) != 1) {
-            setPersistentMessage(Message::eMessageWarning, "", string("SCALE field is undefined in file \"") + filename + "\".");
-        }
+    clearPersistentMessage();
+    if (!header.hasScale) {
+        setPersistentMessage(Message::eMessageWarning, "", string("SCALE field is undefined in file \"") + filename + "\".");
     }
-    std::fclose(nfile);
+    const int W = header.width;
+    const int H = header.height;
 
     bounds->x1 = 0;
     bounds->x2 = W;
@@ -439,25 +551,13 @@ ReadPFMPlugin::guessParamsFromFilename(const string& /*newFile*/,
     if ( (st != kOfxStatOK) || filename.empty() ) {
         return false;
     }
-    stringstream ss;
-
-    // read PFM header
-    std::FILE *const nfile = std::fopen(filename.c_str(), "rb");
-
-    char pfm_type = 0;
-    char item[1024] = { 0 };
-    int err = 0;
-    while ( ( err = std::fscanf(nfile, "%1023[^\n]", item) ) != EOF && (*item == '#' || !err) ) {
-        int c = std::fgetc(nfile);
-        (void)c;
-    }
-    if (std::sscanf(item, " P%c", &pfm_type) != 1) {
-        std::fclose(nfile);
-
-        //setPersistentMessage(Message::eMessageWarning, "", string("PFM header not found in file \"") + filename + "\".");
+    PFMHeader header;
+    string error;
+    if ( !getHeader(filename, &header, &error) ) {
+        //setPersistentMessage(Message::eMessageWarning, "", error);
         return false;
     }
-    std::fclose(nfile);
+    const char pfm_type = header.type;
 
     // set the components of _outputClip
     *components = ePixelComponentNone;
@@ -22,7 +22,8 @@
  * Writes an image in the Portable Float Map (PFM) format.
  */
 
-#include <cstdio> // fopen, fwrite, fprintf...
+#include <cstddef> // ptrdiff_t
+#include <cstdio> // fopen, fwrite, sprintf...
 #include <vector>
 #include <algorithm>
 
@@ -124,7 +125,7 @@ copyLine(const PIX* pixelData,
 {
     assert(dstC == 3 || dstC == 1);
 
-    const PIX *srcPix = (const PIX*)( (char*)pixelData + y * rowbytes );
+    const PIX *srcPix = (const PIX*)( (const char*)pixelData + (std::ptrdiff_t)y * rowbytes );
     PIX *dstPix = image;
 
     for (int x = 0; x < W; ++x) {
@@ -145,9 +146,89 @@ copyLine(const PIX* pixelData,
     }
 }
 
+/// Approximate size of the bands of lines converted and written at once
+#define kWritePFMBandBytes (1024 * 1024)
+
+/**
+ * @brief Converts the image to PFM lines by bands, and writes them to the file or to the write-behind buffer.
+ *
+ * A worker thread converts the next band while the current one is written.
+ **/
+class PFMBandWriter
+    : public BandedWriter
+{
+public:
+    PFMBandWriter(const float* pixelData,
+                  int rowBytes,
+                  int width,
+                  int height,
+                  int dstNCompsStartIndex,
+                  int dstNComps,
+                  int pixelDataNComps,
+                  std::FILE* file,
+                  vector<unsigned char>* fileBuffer)
+        : BandedWriter( height, (int)(std::max)( (std::size_t)1, kWritePFMBandBytes / ( (std::size_t)(std::max)(width, 1) * (dstNComps == 1 ? 1 : 3) * sizeof(float) ) ), 1 )
+        , _pixelData(pixelData)
+        , _rowBytes(rowBytes)
+        , _width(width)
+        , _height(height)
+        , _dstNCompsStartIndex(dstNCompsStartIndex)
+        , _dstNComps(dstNComps)
+        , _pixelDataNComps(pixelDataNComps)
+        , _lineSize( (std::size_t)width * (dstNComps == 1 ? 1 : 3) )
+        , _file(file)
+        , _fileBuffer(fileBuffer)
+    {
+    }
+
+private:
+    virtual void convertBand(int /*band*/,
+                             int rowBegin,
+                             int rowEnd,
+                             vector<unsigned char>& buffer) OVERRIDE FINAL
+    {
+        buffer.resize( (std::size_t)(rowEnd - rowBegin) * _lineSize * sizeof(float) );
+        for (int y = rowBegin; y < rowEnd; ++y) {
+            float* line = (float*)&buffer[(std::size_t)(y - rowBegin) * _lineSize * sizeof(float)];
+            if (_dstNComps == 1) {
+                copyLine<float, 1, 1>(_pixelData, _rowBytes, _width, _height, _dstNCompsStartIndex, _pixelDataNComps, y, line);
+            } else if (_dstNComps == 3) {
+                copyLine<float, 3, 3>(_pixelData, _rowBytes, _width, _height, _dstNCompsStartIndex, _pixelDataNComps, y, line);
+            } else if (_dstNComps == 4) {
+                copyLine<float, 4, 3>(_pixelData, _rowBytes, _width, _height, _dstNCompsStartIndex, _pixelDataNComps, y, line);
+            }
+        }
+    }
+
+    virtual bool writeBand(int /*band*/,
+                           int /*rowBegin*/,
+                           int /*rowEnd*/,
+                           const vector<unsigned char>& buffer) OVERRIDE FINAL
+    {
+        if (_fileBuffer) {
+            _fileBuffer->insert( _fileBuffer->end(), buffer.begin(), buffer.end() );
+
+            return true;
+        }
+
+        return buffer.empty() || std::fwrite(&buffer[0], 1, buffer.size(), _file) == buffer.size();
+    }
+
+    const float* _pixelData;
+    const int _rowBytes;
+    const int _width;
+    const int _height;
+    const int _dstNCompsStartIndex;
+    const int _dstNComps;
+    const int _pixelDataNComps;
+    const std::size_t _lineSize;
+    std::FILE* _file;
+    vector<unsigned char>* _fileBuffer;
+};
+
 void
 WritePFMPlugin::encode(const string& filename,
-                       const OfxTime /*time*/,
+                       const OfxTime time,
                        const string& /*viewName*/,
                        const float *pixelData,
                        const OfxRectI& bounds,
@@ -164,43 +245,81 @@ WritePFMPlugin::encode(const string& filename,
         return;
     }
 
+    // With write behind, the file is encoded to memory and written asynchronously (it replaces the existing file).
+    const bool writeBehind = isWriteBehind(time);
+
     // If the file exists (which means "overwrite" was checked), remove it first.
     // See https://github.com/NatronGitHub/Natron/issues/666
-    if (OFX::exists_utf8( filename.c_str() )) {
+    if ( !writeBehind && OFX::exists_utf8( filename.c_str() ) ) {
         OFX::remove_utf8( filename.c_str() );
     }
 
-    std::FILE *const nfile = fopen_utf8(filename.c_str(), "wb");
-    if (!nfile) {
-        setPersistentMessage(Message::eMessageError, "", "Cannot open file \"" + filename + "\"");
-        throwSuiteStatusException(kOfxStatFailed);
+    std::FILE * nfile = NULL;
+    if (!writeBehind) {
+        nfile = fopen_utf8(filename.c_str(), "wb");
+        if (!nfile) {
+            setPersistentMessage(Message::eMessageError, "", "Cannot open file \"" + filename + "\"");
+            throwSuiteStatusException(kOfxStatFailed);
 
-        return;
+            return;
+        }
     }
     int width = (bounds.x2 - bounds.x1);
     int height = (bounds.y2 - bounds.y1);
     const int depth = (dstNComps == 1 ? 1 : 3);
     const unsigned int buf_size = width * depth;
-    vector<float> buffer(buf_size);
-    std::fill(buffer.begin(), buffer.end(), 0.);
-
-    std::fprintf(nfile, "P%c\n%u %u\n%d.0\n", (dstNComps == 1 ? 'f' : 'F'), width, height, endianness() ? 1 : -1);
-
-    for (int y = 0; y < height; ++y) {
-        // now copy to the dstImg
-        if (depth == 1) {
-            assert(dstNComps == 1);
-            copyLine<float, 1, 1>( pixelData, rowBytes, width, height,  dstNCompsStartIndex, pixelDataNComps, y, &buffer.front() );
-        } else if (depth == 3) {
-            assert(dstNComps == 3 || dstNComps == 4);
-            if (dstNComps == 3) {
-                copyLine<float, 3, 3>( pixelData, rowBytes, width, height, dstNCompsStartIndex, pixelDataNComps, y, &buffer.front() );
-            } else if (dstNComps == 4) {
-                copyLine<float, 4, 3>( pixelData, rowBytes, width, height, dstNCompsStartIndex, pixelDataNComps, y, &buffer.front() );
+
+    char header[64];
+    const int headerSize = std::sprintf(header, "P%c\n%u %u\n%d.0\n", (dstNComps == 1 ? 'f' : 'F'), width, height, endianness() ? 1 : -1);
+    assert(headerSize > 0 && headerSize < (int)sizeof(header));
+    vector<unsigned char> fileBuffer;
+    if (writeBehind) {
+        fileBuffer.reserve( headerSize + (std::size_t)height * buf_size * sizeof(float) );
+        fileBuffer.insert(fileBuffer.end(), header, header + headerSize);
+    } else {
+        // buffer a few lines in stdio, so that writing huge images does not issue one syscall per line
+        std::setvbuf(nfile, NULL, _IOFBF, (std::max)( (std::size_t)BUFSIZ, (std::size_t)buf_size * sizeof(float) * 4 ) );
+        std::fwrite(header, 1, headerSize, nfile);
+    }
+
+    // If the source lines are already laid out as PFM lines, they are written directly, else the lines
+    // are converted by bands, which are written while the next band is being converted.
+    const bool direct = (pixelDataNComps == depth) && (dstNCompsStartIndex == 0) && (dstNComps == depth);
+
+    if (direct) {
+        for (int y = 0; y < height; ++y) {
+            const float* line = (const float*)( (const char*)pixelData + (std::ptrdiff_t)y * rowBytes );
+            if (writeBehind) {
+                const unsigned char* bytes = (const unsigned char*)line;
+                fileBuffer.insert(fileBuffer.end(), bytes, bytes + buf_size * sizeof(float));
+            } else if (std::fwrite(line, sizeof(float), buf_size, nfile) < buf_size) {
+                break;
             }
         }
+    } else {
+        PFMBandWriter writer(pixelData, rowBytes, width, height, dstNCompsStartIndex, dstNComps, pixelDataNComps,
+                             nfile, writeBehind ? &fileBuffer : NULL);
+        if ( !writer.process() && writer.isConversionError() ) {
+            if (nfile) {
+                std::fclose(nfile);
+            }
+            setPersistentMessage(Message::eMessageError, "", "PFM: cannot convert the image (out of memory?)");
+            throwSuiteStatusException(kOfxStatFailed);
 
-        std::fwrite(&buffer.front(), sizeof(float), buf_size, nfile);
+            return;
+        }
+    }
+    if (writeBehind) {
+        writeFileBehind(filename, fileBuffer);
+
+        return;
+    }
+    if ( std::ferror(nfile) ) {
+        std::fclose(nfile);
+        setPersistentMessage(Message::eMessageError, "", "Cannot write file \"" + filename + "\"");
+        throwSuiteStatusException(kOfxStatFailed);
+
+        return;
     }
     std::fclose(nfile);
 }
@@ -252,7 +371,7 @@ WritePFMPluginFactory::describeInContext(ImageEffectDescriptor &desc,
                                                                     kSupportsRGB,
                                                                     kSupportsXY,
                                                                     kSupportsAlpha,
-                                                                    "scene_linear", "scene_linear", false);
+                                                                    "scene_linear", "scene_linear", false, true);
 
     GenericWriterDescribeInContextEnd(desc, context, page);
 }
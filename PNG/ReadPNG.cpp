@@ -85,6 +85,9 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
 #define kSupportsAlpha false
 #define kSupportsTiles false
 
+// number of rows decoded before they are converted, when streaming non-interlaced images
+#define kDecodeBandHeight 64
+
 #define OFX_IO_LIBPNG_VERSION (PNG_LIBPNG_VER_MAJOR * 10000 + PNG_LIBPNG_VER_MINOR * 100 + PNG_LIBPNG_VER_RELEASE)
 
 // Try to deduce endianness
@@ -1160,25 +1163,54 @@ ReadPNGPlugin::decode(const string& filename,
     int realbitdepth;
     int colorType;
     double par;
-    getPNGInfo(png, info, &x1, &y1, &width, &height, &par, &nChannels, &bitdepth, &realbitdepth, &colorType, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    int interlaceType;
+    getPNGInfo(png, info, &x1, &y1, &width, &height, &par, &nChannels, &bitdepth, &realbitdepth, &colorType, 0, 0, &interlaceType, 0, 0, 0, 0, 0, 0, 0, 0);
 
     assert(renderWindow.x1 >= x1 && renderWindow.y1 >= y1 && renderWindow.x2 <= x1 + width && renderWindow.y2 <= y1 + height);
 
+    PixelComponentEnum srcComponents;
+    switch (nChannels) {
+    case 1:
+        srcComponents = ePixelComponentAlpha;
+        break;
+    case 2:
+        srcComponents = ePixelComponentXY;
+        break;
+    case 3:
+        srcComponents = ePixelComponentRGB;
+        break;
+    case 4:
+        srcComponents = ePixelComponentRGBA;
+        break;
+    default:
+        png_destroy_read_struct(&png, &info, NULL);
+        std::fclose(file);
+        setPersistentMessage(Message::eMessageError, "", "This plug-in only supports images with 1 to 4 channels");
+        throwSuiteStatusException(kOfxStatErrFormat);
+
+        return;
+    }
+
     std::size_t pngRowBytes = nChannels * width;
     if (bitdepth == eBitDepthUShort) {
         pngRowBytes *= sizeof(unsigned short);
     }
 
-    RamBuffer scratchBuffer(pngRowBytes * height);
+    // PNG rows are stored from top to bottom: only rows [firstRow, lastRow) are needed to fill the render window
+    // (see PixelConverterProcessor for the mapping between source and destination lines).
+    const int firstRow = bounds.y2 - renderWindow.y2 - y1;
+    const int lastRow = bounds.y2 - renderWindow.y1 - y1;
+    assert(0 <= firstRow && firstRow <= lastRow && lastRow <= height);
+
+    // Interlaced images need all passes over the whole image before any row is complete:
+    // decode the full image in that case.
+    // Else, rows are decoded one by one into a small band buffer, which is converted as soon as it's full,
+    // and decoding stops after the last row of the render window.
+    const bool isInterlaced = (interlaceType != PNG_INTERLACE_NONE);
+    const int bandHeight = isInterlaced ? height : (std::min)(kDecodeBandHeight, lastRow - firstRow);
+    RamBuffer scratchBuffer( pngRowBytes * (std::max)(bandHeight, 1) );
     unsigned char* tmpData = scratchBuffer.getData();
 
-
-    //if (interlace_type != 0) {
-    vector<unsigned char *> row_pointers(height);
-    for (int i = 0; i < height; ++i) {
-        row_pointers[i] = tmpData + i * pngRowBytes;
-    }
-
     // Must call this setjmp in every function that does PNG reads
     if ( setjmp ( png_jmpbuf (png) ) ) {
         png_destroy_read_struct(&png, &info, NULL);
@@ -1188,57 +1220,53 @@ ReadPNGPlugin::decode(const string& filename,
 
         return;
     }
-    png_read_image(png, &row_pointers[0]);
-    png_read_end(png, NULL);
-    /*
-       } else {
-        for (int y = 0; y < height; ++y) {
-            // Must call this setjmp in every function that does PNG reads
-            if (setjmp (png_jmpbuf (png))) {
-                png_destroy_read_struct(&png, &info, NULL);
-                std::fclose(file);
-                setPersistentMessage(Message::eMessageError, "", "PNG library error");
-                throwSuiteStatusException(kOfxStatErrFormat);
-
-                return;
-            }
-            png_read_row (png, (png_bytep)tmpData + y * pngRowBytes, NULL);
-        }
-       }
-     */
-
-    png_destroy_read_struct(&png, &info, NULL);
-    std::fclose(file);
-    file = NULL;
 
     OfxRectI srcBounds;
     srcBounds.x1 = x1;
-    srcBounds.y1 = y1;
     srcBounds.x2 = x1 + width;
-    srcBounds.y2 = y1 + height;
+    if (isInterlaced) {
+        vector<unsigned char *> row_pointers(height);
+        for (int i = 0; i < height; ++i) {
+            row_pointers[i] = tmpData + i * pngRowBytes;
+        }
+        png_read_image(png, &row_pointers[0]);
+        png_read_end(png, NULL);
+        png_destroy_read_struct(&png, &info, NULL);
+        std::fclose(file);
+        file = NULL;
 
-    PixelComponentEnum srcComponents;
-    switch (nChannels) {
-    case 1:
-        srcComponents = ePixelComponentAlpha;
-        break;
-    case 2:
-        srcComponents = ePixelComponentXY;
-        break;
-    case 3:
-        srcComponents = ePixelComponentRGB;
-        break;
-    case 4:
-        srcComponents = ePixelComponentRGBA;
-        break;
-    default:
-        setPersistentMessage(Message::eMessageError, "", "This plug-in only supports images with 1 to 4 channels");
-        throwSuiteStatusException(kOfxStatErrFormat);
+        srcBounds.y1 = y1;
+        srcBounds.y2 = y1 + height;
+        convertDepthAndComponents(tmpData, renderWindow, renderScale, srcBounds, srcComponents, bitdepth, pngRowBytes, pixelData, bounds, pixelComponents, rowBytes);
 
         return;
     }
 
-    convertDepthAndComponents(tmpData, renderWindow, renderScale, srcBounds, srcComponents, bitdepth, pngRowBytes, pixelData, bounds, pixelComponents, rowBytes);
+    // skip the rows above the render window
+    for (int row = 0; row < firstRow; ++row) {
+        png_read_row(png, (png_bytep)tmpData, NULL);
+    }
+    for (int bandRow = firstRow; bandRow < lastRow; bandRow += bandHeight) {
+        if ( abort() ) {
+            break;
+        }
+        const int bandEnd = (std::min)(bandRow + bandHeight, lastRow);
+        for (int row = bandRow; row < bandEnd; ++row) {
+            png_read_row(png, (png_bytep)tmpData + (row - bandRow) * pngRowBytes, NULL);
+        }
+        // the band holds the source lines [y1 + bandRow, y1 + bandEnd), which go to the destination lines below
+        srcBounds.y1 = y1 + bandRow;
+        srcBounds.y2 = y1 + bandEnd;
+        OfxRectI bandWindow = renderWindow;
+        bandWindow.y1 = bounds.y2 - bandEnd - y1;
+        bandWindow.y2 = bounds.y2 - bandRow - y1;
+        convertDepthAndComponents(tmpData, bandWindow, renderScale, srcBounds, srcComponents, bitdepth, pngRowBytes, pixelData, bounds, pixelComponents, rowBytes);
+    }
+
+    // the remaining rows are not needed: png_read_end() is not called
+    png_destroy_read_struct(&png, &info, NULL);
+    std::fclose(file);
+    file = NULL;
 } // ReadPNGPlugin::decode
 
 bool
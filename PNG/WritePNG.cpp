@@ -23,7 +23,10 @@
  */
 
 
+#include <cstddef> // ptrdiff_t
 #include <cstdio> // fopen, fwrite...
+#include <cstdlib> // abs
+#include <climits> // ULONG_MAX
 #include <vector>
 #include <algorithm>
 
@@ -100,6 +103,15 @@ enum PNGBitDepthEnum {
     ePNGBitDepthUShort,
 };
 
+#define kWritePNGParamThreads "threads"
+#define kWritePNGParamThreadsLabel "Threads"
+#define kWritePNGParamThreadsHint "Number of threads used to encode the image.\n" \
+    "1 uses the libpng encoder.\n" \
+    "With more than one thread, the image is split in horizontal bands that are filtered and compressed concurrently " \
+    "(as independent deflate streams joined by sync flushes), which produces a slightly larger file.\n" \
+    "0 means the number of CPUs."
+#define kWritePNGParamThreadsDefault 1
+
 #define kWritePNGParamDither "enableDithering"
 #define kWritePNGParamDitherLabel "Dithering"
 #define kWritePNGParamDitherHint "When checked, conversion from float input buffers to 8-bit PNG will use a dithering algorithm to reduce quantization artifacts. This has no effect when writing to 16bit PNG"
@@ -204,6 +216,33 @@ create_write_struct (png_structp& sp,
     }
 }
 
+/// libpng write callback, appending the data to the vector<unsigned char> set as io_ptr.
+///
+static void
+write_to_buffer (png_structp sp,
+                 png_bytep data,
+                 png_size_t length)
+{
+    vector<unsigned char>* buffer = (vector<unsigned char>*)png_get_io_ptr(sp);
+
+    buffer->insert(buffer->end(), data, data + length);
+}
+
+static void
+flush_buffer (png_structp /*sp*/)
+{
+}
+
+/// Helper function - closes the file, if any (there is none when encoding to memory).
+///
+inline void
+close_file (std::FILE* file)
+{
+    if (file) {
+        std::fclose(file);
+    }
+}
+
 /// Helper function - finalizes writing the image.
 ///
 inline void
@@ -397,31 +436,10 @@ private:
                      const string& outputColorspace,
                      PNGBitDepthEnum bitdepth);
 
-    template <int srcNComps, int dstNComps>
-    void add_dither_for_components(OfxTime time,
-                                   unsigned int seed,
-                                   const float *src_pixels,
-                                   const OfxRectI& bounds,
-                                   unsigned char* dst_pixels,
-                                   int srcRowElements,
-                                   int dstRowElements,
-                                   int dstNCompsStartIndex);
-
-    void add_dither(OfxTime time,
-                    unsigned int seed,
-                    const float *src_pixels,
-                    const OfxRectI& bounds,
-                    unsigned char* dst_pixels,
-                    int srcRowElements,
-                    int dstRowElements,
-                    int dstNCompsStartIndex,
-                    int srcNComps,
-                    int dstNComps);
-
-
     ChoiceParam* _compression;
     IntParam* _compressionLevel;
     ChoiceParam* _bitdepth;
+    IntParam* _threads;
     BooleanParam* _ditherEnabled;
     const Color::Lut* _ditherLut;
 };
@@ -432,14 +450,16 @@ WritePNGPlugin::WritePNGPlugin(OfxImageEffectHandle handle,
     , _compression(NULL)
     , _compressionLevel(NULL)
     , _bitdepth(NULL)
+    , _threads(NULL)
     , _ditherEnabled(NULL)
     , _ditherLut( gLutManager->linearLut() )
 {
     _compression = fetchChoiceParam(kWritePNGParamCompression);
     _compressionLevel = fetchIntParam(kWritePNGParamCompressionLevel);
     _bitdepth = fetchChoiceParam(kWritePNGParamBitDepth);
+    _threads = fetchIntParam(kWritePNGParamThreads);
     _ditherEnabled = fetchBooleanParam(kWritePNGParamDither);
-    assert(_compression && _compressionLevel && _bitdepth && _ditherEnabled);
+    assert(_compression && _compressionLevel && _bitdepth && _threads && _ditherEnabled);
 }
 
 WritePNGPlugin::~WritePNGPlugin()
@@ -470,9 +490,12 @@ WritePNGPlugin::openFile(const string& filename,
                          std::FILE** file,
                          int *color_type) const
 {
-    *file = fopen_utf8(filename.c_str(), "wb");
-    if (!*file) {
-        throw std::runtime_error("Could not open file: " + filename);
+    // file is NULL when encoding to memory
+    if (file) {
+        *file = fopen_utf8(filename.c_str(), "wb");
+        if (!*file) {
+            throw std::runtime_error("Could not open file: " + filename);
+        }
     }
 
     *png = NULL;
@@ -481,7 +504,9 @@ WritePNGPlugin::openFile(const string& filename,
     try {
         create_write_struct (*png, *info, nChannels, color_type);
     } catch (const std::exception& e) {
-        std::fclose(*file);
+        if (file) {
+            std::fclose(*file);
+        }
         if (*png != NULL) {
             destroy_write_struct(*png, *info);
         }
@@ -612,19 +637,26 @@ WritePNGPlugin::write_info (png_structp& sp,
     png_set_packing (sp);   // Pack 1, 2, 4 bit into bytes
 }
 
+/// Convert rows to 8-bit with dithering. The rows of dst_pixels may be in reverse order (negative dstRowElements).
+/// skipRows is the number of image rows before bounds.y1, so that a band of rows is dithered as in the whole image.
 template <int srcNComps, int dstNComps>
-void
-WritePNGPlugin::add_dither_for_components(OfxTime time,
-                                          unsigned int seed,
-                                          const float *src_pixels,
-                                          const OfxRectI& bounds,
-                                          unsigned char* dst_pixels,
-                                          int srcRowElements,
-                                          int dstRowElements,
-                                          int dstNCompsStartIndex)
+static void
+add_dither_for_components(const Color::Lut* ditherLut,
+                          OfxTime time,
+                          unsigned int seed,
+                          int skipRows,
+                          const float *src_pixels,
+                          const OfxRectI& bounds,
+                          unsigned char* dst_pixels,
+                          int srcRowElements,
+                          int dstRowElements,
+                          int dstNCompsStartIndex)
 {
     unsigned int randHash = pseudoRandomHashSeed(time, seed);
 
+    for (int y = 0; y < skipRows; ++y) {
+        randHash = generatePseudoRandomHash(randHash);
+    }
 
     assert(srcNComps >= 3 && dstNComps >= 3);
 
@@ -646,9 +678,9 @@ WritePNGPlugin::add_dither_for_components(OfxTime time,
             while (index < width && index >= 0) {
                 int src_col = index * srcNComps + dstNCompsStartIndex;
                 int dst_col = index * dstNComps;
-                error_r = (error_r & 0xff) + _ditherLut->toColorSpaceUint8xxFromLinearFloatFast(src_pixels[src_col]);
-                error_g = (error_g & 0xff) + _ditherLut->toColorSpaceUint8xxFromLinearFloatFast(src_pixels[src_col + 1]);
-                error_b = (error_b & 0xff) + _ditherLut->toColorSpaceUint8xxFromLinearFloatFast(src_pixels[src_col + 2]);
+                error_r = (error_r & 0xff) + ditherLut->toColorSpaceUint8xxFromLinearFloatFast(src_pixels[src_col]);
+                error_g = (error_g & 0xff) + ditherLut->toColorSpaceUint8xxFromLinearFloatFast(src_pixels[src_col + 1]);
+                error_b = (error_b & 0xff) + ditherLut->toColorSpaceUint8xxFromLinearFloatFast(src_pixels[src_col + 2]);
                 assert(error_r < 0x10000 && error_g < 0x10000 && error_b < 0x10000);
 
 
@@ -671,33 +703,463 @@ WritePNGPlugin::add_dither_for_components(OfxTime time,
     }
 }
 
-void
-WritePNGPlugin::add_dither(OfxTime time,
-                           unsigned int seed,
-                           const float *src_pixels,
-                           const OfxRectI& bounds,
-                           unsigned char* dst_pixels,
-                           int srcRowElements,
-                           int dstRowElements,
-                           int dstNCompsStartIndex,
-                           int srcNComps,
-                           int dstNComps)
+static void
+add_dither(const Color::Lut* ditherLut,
+           OfxTime time,
+           unsigned int seed,
+           int skipRows,
+           const float *src_pixels,
+           const OfxRectI& bounds,
+           unsigned char* dst_pixels,
+           int srcRowElements,
+           int dstRowElements,
+           int dstNCompsStartIndex,
+           int srcNComps,
+           int dstNComps)
 {
     if (srcNComps == 3) {
         if (dstNComps == 3) {
-            add_dither_for_components<3, 3>(time, seed, src_pixels, bounds, dst_pixels, srcRowElements, dstRowElements, dstNCompsStartIndex);
+            add_dither_for_components<3, 3>(ditherLut, time, seed, skipRows, src_pixels, bounds, dst_pixels, srcRowElements, dstRowElements, dstNCompsStartIndex);
         } else if (dstNComps == 4) {
-            add_dither_for_components<3, 4>(time, seed, src_pixels, bounds, dst_pixels, srcRowElements, dstRowElements, dstNCompsStartIndex);
+            add_dither_for_components<3, 4>(ditherLut, time, seed, skipRows, src_pixels, bounds, dst_pixels, srcRowElements, dstRowElements, dstNCompsStartIndex);
         }
     } else if (srcNComps == 4) {
         if (dstNComps == 3) {
-            add_dither_for_components<4, 3>(time, seed, src_pixels, bounds, dst_pixels, srcRowElements, dstRowElements, dstNCompsStartIndex);
+            add_dither_for_components<4, 3>(ditherLut, time, seed, skipRows, src_pixels, bounds, dst_pixels, srcRowElements, dstRowElements, dstNCompsStartIndex);
         } else if (dstNComps == 4) {
-            add_dither_for_components<4, 4>(time, seed, src_pixels, bounds, dst_pixels, srcRowElements, dstRowElements, dstNCompsStartIndex);
+            add_dither_for_components<4, 4>(ditherLut, time, seed, skipRows, src_pixels, bounds, dst_pixels, srcRowElements, dstRowElements, dstNCompsStartIndex);
         }
     }
 }
 
+/**
+ * @brief Converts rows of the float image to PNG samples.
+ *
+ * Rows are numbered as in the PNG file, from top to bottom. No OFX suite is used, so that rows can be
+ * converted from any thread.
+ **/
+class PNGRowConverter
+{
+public:
+    PNGRowConverter(const Color::Lut* ditherLut,
+                    OfxTime time,
+                    const float *pixelData,
+                    const OfxRectI& bounds,
+                    int pixelDataNComps,
+                    int srcRowBytes,
+                    int dstNCompsStartIndex,
+                    int dstNComps,
+                    PNGBitDepthEnum pngDepth,
+                    bool ditherEnabled)
+        : _ditherLut(ditherLut)
+        , _time(time)
+        , _pixelData(pixelData)
+        , _bounds(bounds)
+        , _pixelDataNComps(pixelDataNComps)
+        , _srcRowBytes(srcRowBytes)
+        , _dstNCompsStartIndex(dstNCompsStartIndex)
+        , _dstNComps(dstNComps)
+        , _pngDepth(pngDepth)
+        , _dither( ditherEnabled && pngDepth == ePNGBitDepthUByte && (std::min)(dstNComps, pixelDataNComps) >= 3 )
+    {
+    }
+
+    std::size_t getRowBytes() const
+    {
+        return (std::size_t)(_bounds.x2 - _bounds.x1) * _dstNComps * ( (_pngDepth == ePNGBitDepthUShort) ? sizeof(unsigned short) : sizeof(unsigned char) );
+    }
+
+    /// Convert the PNG rows [r1, r2) to dst.
+    void convert(int r1,
+                 int r2,
+                 unsigned char* dst) const
+    {
+        const int height = _bounds.y2 - _bounds.y1;
+        const int width = _bounds.x2 - _bounds.x1;
+        const int dstRowElements = width * _dstNComps;
+        const std::size_t rowBytes = getRowBytes();
+        const int nComps = (std::min)(_dstNComps, _pixelDataNComps);
+        // PNG rows are from top to bottom: rows [height - r2, height - r1) of the image, starting with the last row of dst.
+        // Source rows are _srcRowBytes apart, which may be more than the row size (e.g. a host image larger than the render window).
+        const int y1 = height - r2;
+        const char* src_row = (const char*)_pixelData + (std::ptrdiff_t)y1 * _srcRowBytes;
+        unsigned char* dstLast = dst + (std::size_t)(r2 - r1 - 1) * rowBytes;
+
+        if (_dither) {
+            const unsigned int ditherSeed = 2000;
+            const OfxRectI band = { _bounds.x1, _bounds.y1 + y1, _bounds.x2, _bounds.y1 + y1 + (r2 - r1) };
+            assert(_srcRowBytes % (int)sizeof(float) == 0);
+            add_dither(_ditherLut, _time, ditherSeed, y1, (const float*)src_row, band, dstLast, _srcRowBytes / (int)sizeof(float), -dstRowElements, _dstNCompsStartIndex, _pixelDataNComps, _dstNComps);
+
+            return;
+        }
+        for (int r = r2 - 1; r >= r1; --r, src_row += _srcRowBytes) {
+            const float* src_pix = (const float*)src_row;
+            if (_pngDepth == ePNGBitDepthUByte) {
+                unsigned char* dst_pixels = dst + (std::size_t)(r - r1) * rowBytes;
+                for (int x = 0; x < width; ++x, dst_pixels += _dstNComps, src_pix += _pixelDataNComps) {
+                    for (int c = 0; c < nComps; ++c) {
+                        dst_pixels[c] = floatToInt<256>(src_pix[_dstNCompsStartIndex + c]);
+                    }
+                }
+            } else {
+                assert(_pngDepth == ePNGBitDepthUShort);
+                unsigned short* dstRow = reinterpret_cast<unsigned short*>( dst + (std::size_t)(r - r1) * rowBytes );
+                unsigned short* dst_pixels = dstRow;
+                for (int x = 0; x < width; ++x, dst_pixels += _dstNComps, src_pix += _pixelDataNComps) {
+                    for (int c = 0; c < nComps; ++c) {
+                        dst_pixels[c] = floatToInt<65536>(src_pix[_dstNCompsStartIndex + c]);
+                    }
+                }
+                // PNG is always big endian
+                if ( littleendian() ) {
+                    swap_endian( dstRow, dstRowElements );
+                }
+            }
+        }
+    }
+
+private:
+    const Color::Lut* _ditherLut;
+    const OfxTime _time;
+    const float* _pixelData;
+    const OfxRectI _bounds;
+    const int _pixelDataNComps;
+    const int _srcRowBytes;
+    const int _dstNCompsStartIndex;
+    const int _dstNComps;
+    const PNGBitDepthEnum _pngDepth;
+    const bool _dither;
+};
+
+/// Filter type, as defined by the PNG spec
+enum PNGFilterEnum
+{
+    ePNGFilterNone = 0,
+    ePNGFilterSub,
+    ePNGFilterUp,
+    ePNGFilterAverage,
+    ePNGFilterPaeth,
+};
+
+static inline int
+paethPredictor(int a,
+               int b,
+               int c)
+{
+    int p = a + b - c;
+    int pa = std::abs(p - a);
+    int pb = std::abs(p - b);
+    int pc = std::abs(p - c);
+
+    if ( (pa <= pb) && (pa <= pc) ) {
+        return a;
+    } else if (pb <= pc) {
+        return b;
+    }
+
+    return c;
+}
+
+/// Filter one byte: cur is the raw byte, a, b, c are the raw bytes on the left, above, and above left
+static inline unsigned char
+filterByte(int filter,
+           int cur,
+           int a,
+           int b,
+           int c)
+{
+    switch (filter) {
+    case ePNGFilterSub:
+        return (unsigned char)(cur - a);
+    case ePNGFilterUp:
+        return (unsigned char)(cur - b);
+    case ePNGFilterAverage:
+        return (unsigned char)( cur - ( (a + b) >> 1 ) );
+    case ePNGFilterPaeth:
+        return (unsigned char)( cur - paethPredictor(a, b, c) );
+    case ePNGFilterNone:
+    default:
+
+        return (unsigned char)cur;
+    }
+}
+
+/// Filter a row, writing the filter type followed by the filtered bytes to dst.
+/// prev is the previous (raw) row, or NULL for the first row.
+/// If filter is negative, the filter is chosen by the usual minimum sum of absolute differences heuristic.
+static void
+filterRow(const unsigned char* cur,
+          const unsigned char* prev,
+          std::size_t rowBytes,
+          int bpp,
+          int filter,
+          unsigned char* dst)
+{
+    if (filter < 0) {
+        unsigned long bestSum = ULONG_MAX;
+        for (int f = ePNGFilterNone; f <= ePNGFilterPaeth; ++f) {
+            unsigned long sum = 0;
+            for (std::size_t x = 0; x < rowBytes && sum < bestSum; ++x) {
+                int a = (x >= (std::size_t)bpp) ? cur[x - bpp] : 0;
+                int b = prev ? prev[x] : 0;
+                int c = (prev && x >= (std::size_t)bpp) ? prev[x - bpp] : 0;
+                unsigned char v = filterByte(f, cur[x], a, b, c);
+                sum += (v < 128) ? v : (256 - v); // bytes are considered as signed
+            }
+            if (sum < bestSum) {
+                bestSum = sum;
+                filter = f;
+            }
+        }
+    }
+    dst[0] = (unsigned char)filter;
+    ++dst;
+    for (std::size_t x = 0; x < rowBytes; ++x) {
+        int a = (x >= (std::size_t)bpp) ? cur[x - bpp] : 0;
+        int b = prev ? prev[x] : 0;
+        int c = (prev && x >= (std::size_t)bpp) ? prev[x - bpp] : 0;
+        dst[x] = filterByte(filter, cur[x], a, b, c);
+    }
+}
+
+/// Approximate size of the bands of rows converted and written at once
+#define kWritePNGBandBytes (1024 * 1024)
+
+/**
+ * @brief Converts the image by bands and writes the rows with libpng.
+ *
+ * A worker thread converts the next band while the current one is compressed by libpng.
+ **/
+class PNGRowWriter
+    : public BandedWriter
+{
+public:
+    PNGRowWriter(const PNGRowConverter& converter,
+                 int height,
+                 png_structp png)
+        : BandedWriter( height, (int)(std::max)( (std::size_t)1, kWritePNGBandBytes / (std::max)(converter.getRowBytes(), (std::size_t)1) ), 1 )
+        , _converter(converter)
+        , _rowBytes( converter.getRowBytes() )
+        , _png(png)
+    {
+    }
+
+private:
+    virtual void convertBand(int /*band*/,
+                             int rowBegin,
+                             int rowEnd,
+                             vector<unsigned char>& buffer) OVERRIDE FINAL
+    {
+        buffer.resize( (std::size_t)(rowEnd - rowBegin) * _rowBytes );
+        _converter.convert(rowBegin, rowEnd, &buffer[0]);
+    }
+
+    virtual bool writeBand(int /*band*/,
+                           int rowBegin,
+                           int rowEnd,
+                           const vector<unsigned char>& buffer) OVERRIDE FINAL
+    {
+        if ( setjmp ( png_jmpbuf(_png) ) ) {
+            return false;
+        }
+        for (int r = rowBegin; r < rowEnd; ++r) {
+            png_write_row ( _png, (png_bytep)&buffer[(std::size_t)(r - rowBegin) * _rowBytes] );
+        }
+
+        return true;
+    }
+
+    const PNGRowConverter& _converter;
+    const std::size_t _rowBytes;
+    png_structp _png;
+};
+
+/**
+ * @brief Multithreaded PNG encoder.
+ *
+ * The rows are split in horizontal bands, which are converted, filtered and compressed concurrently,
+ * each band as an independent raw deflate stream primed with the last 32k of the previous band (as pigz does).
+ * Each stream but the last ends with a sync flush, so that their concatenation, preceded by a zlib header and
+ * followed by the Adler-32 checksum of the whole filtered data, is a single valid zlib stream, written as IDAT chunks.
+ * The rows preceding a band, which are needed for filtering and for the dictionary, are converted and filtered
+ * again by the thread compressing the band, so that only the bands in flight are held in memory.
+ **/
+class PNGParallelEncoder
+    : public BandedWriter
+{
+public:
+    PNGParallelEncoder(const PNGRowConverter& converter,
+                       int height,
+                       int bytesPerPixel,
+                       int level,
+                       int strategy,
+                       unsigned int nThreads,
+                       png_structp png)
+        : BandedWriter( height, (int)(std::max)( (std::size_t)1, kWritePNGBandBytes / (converter.getRowBytes() + 1) ), nThreads )
+        , _converter(converter)
+        , _rowBytes( converter.getRowBytes() )
+        , _bpp(bytesPerPixel)
+        , _level(level)
+        , _strategy(strategy)
+        , _png(png)
+        , _bandsAdler( getNBands() )
+        , _bandsError( getNBands(), 0 )
+        , _adler( adler32(0L, Z_NULL, 0) )
+        , _zlibError(false)
+    {
+    }
+
+    /// true if writing failed because of a zlib error
+    bool isZlibError() const { return _zlibError; }
+
+private:
+    virtual void convertBand(int band,
+                             int rowBegin,
+                             int rowEnd,
+                             vector<unsigned char>& buffer) OVERRIDE FINAL
+    {
+        const std::size_t filteredRowBytes = _rowBytes + 1;
+        // the filtered rows preceding the band, used as the deflate dictionary
+        const int ctxRows = (std::min)( rowBegin, (int)( (32768 + filteredRowBytes - 1) / filteredRowBytes ) );
+        // the raw rows to convert: one more row is needed to filter the first context row
+        const int rawBegin = (std::max)(0, rowBegin - ctxRows - 1);
+        vector<unsigned char> raw( (std::size_t)(rowEnd - rawBegin) * _rowBytes );
+        _converter.convert(rawBegin, rowEnd, &raw[0]);
+
+        // without compression, or with Huffman only, filtering is useless
+        const int filter = (_level == Z_NO_COMPRESSION || _strategy == Z_HUFFMAN_ONLY) ? (int)ePNGFilterNone : -1;
+        const int filteredBegin = rowBegin - ctxRows;
+        vector<unsigned char> filtered( (std::size_t)(rowEnd - filteredBegin) * filteredRowBytes );
+        for (int r = filteredBegin; r < rowEnd; ++r) {
+            const unsigned char* cur = &raw[(std::size_t)(r - rawBegin) * _rowBytes];
+            filterRow(cur, r > 0 ? cur - _rowBytes : NULL, _rowBytes, _bpp, filter, &filtered[(std::size_t)(r - filteredBegin) * filteredRowBytes]);
+        }
+        raw.clear();
+
+        const std::size_t dictSize = (std::min)( (std::size_t)32768, (std::size_t)ctxRows * filteredRowBytes );
+        const std::size_t inputSize = (std::size_t)(rowEnd - rowBegin) * filteredRowBytes;
+        Bytef* input = &filtered[(std::size_t)ctxRows * filteredRowBytes];
+
+        _bandsAdler[band] = adler32( adler32(0L, Z_NULL, 0), input, (uInt)inputSize );
+        if ( !compressBand(band, input, inputSize, dictSize, buffer) ) {
+            _bandsError[band] = 1;
+        }
+    }
+
+    bool compressBand(int band,
+                      Bytef* input,
+                      std::size_t inputSize,
+                      std::size_t dictSize,
+                      vector<unsigned char>& out)
+    {
+        const bool isFirst = (band == 0);
+        const bool isLast = (band == getNBands() - 1);
+        // room for the zlib header
+        const std::size_t begin = isFirst ? 2 : 0;
+
+        z_stream zs;
+        zs.zalloc = Z_NULL;
+        zs.zfree = Z_NULL;
+        zs.opaque = Z_NULL;
+        // negative windowBits: raw deflate stream, without zlib header and checksum
+        if (deflateInit2(&zs, _level, Z_DEFLATED, -MAX_WBITS, 8, _strategy) != Z_OK) {
+            return false;
+        }
+        if (dictSize > 0) {
+            if (deflateSetDictionary(&zs, input - dictSize, (uInt)dictSize) != Z_OK) {
+                deflateEnd(&zs);
+
+                return false;
+            }
+        }
+
+        out.resize( begin + deflateBound(&zs, (uLong)inputSize) + 16 );
+        zs.next_in = input;
+        zs.avail_in = (uInt)inputSize;
+        zs.next_out = &out[begin];
+        zs.avail_out = (uInt)(out.size() - begin);
+        const int flush = isLast ? Z_FINISH : Z_SYNC_FLUSH;
+        for (;;) {
+            int ret = deflate(&zs, flush);
+            if (ret == Z_STREAM_ERROR) {
+                deflateEnd(&zs);
+
+                return false;
+            }
+            if ( isLast ? (ret == Z_STREAM_END) : (zs.avail_in == 0 && zs.avail_out != 0) ) {
+                break;
+            }
+            if (zs.avail_out == 0) {
+                // should not happen, since the output size is bounded
+                std::size_t done = out.size();
+                out.resize(done * 2);
+                zs.next_out = &out[done];
+                zs.avail_out = (uInt)(out.size() - done);
+            }
+        }
+        out.resize(begin + zs.total_out);
+        deflateEnd(&zs);
+
+        if (isFirst) {
+            // zlib header, see RFC 1950
+            const unsigned char cmf = 0x78; // deflate, 32k window
+            unsigned char flg = (unsigned char)( ( (_level <= 1) ? 0 : (_level <= 5) ? 1 : (_level == 6) ? 2 : 3 ) << 6 );
+            flg = (unsigned char)( flg + ( 31 - ( (cmf * 256 + flg) % 31 ) ) % 31 );
+            out[0] = cmf;
+            out[1] = flg;
+        }
+
+        return true;
+    }
+
+    virtual bool writeBand(int band,
+                           int rowBegin,
+                           int rowEnd,
+                           const vector<unsigned char>& buffer) OVERRIDE FINAL
+    {
+        if (_bandsError[band]) {
+            _zlibError = true;
+
+            return false;
+        }
+        // Adler-32 of the whole data
+        if (band == 0) {
+            _adler = _bandsAdler[0];
+        } else {
+            _adler = adler32_combine( _adler, _bandsAdler[band], (z_off_t)( (std::size_t)(rowEnd - rowBegin) * (_rowBytes + 1) ) );
+        }
+
+        if ( setjmp ( png_jmpbuf(_png) ) ) {
+            return false;
+        }
+        png_write_chunk(_png, (png_bytep)"IDAT", (png_bytep)&buffer[0], buffer.size());
+        if (band == getNBands() - 1) {
+            unsigned char adler[4];
+            adler[0] = (unsigned char)( (_adler >> 24) & 0xff );
+            adler[1] = (unsigned char)( (_adler >> 16) & 0xff );
+            adler[2] = (unsigned char)( (_adler >> 8) & 0xff );
+            adler[3] = (unsigned char)(_adler & 0xff);
+            png_write_chunk(_png, (png_bytep)"IDAT", adler, sizeof(adler));
+            // IDAT chunks were written directly, so png_write_end() can't be used
+            png_write_chunk(_png, (png_bytep)"IEND", NULL, 0);
+        }
+
+        return true;
+    }
+
+    const PNGRowConverter& _converter;
+    const std::size_t _rowBytes;
+    const int _bpp;
+    const int _level;
+    const int _strategy;
+    png_structp _png;
+    vector<uLong> _bandsAdler; // the Adler-32 checksum of each band
+    vector<unsigned char> _bandsError; // non-zero if compressing the band failed
+    uLong _adler; // the Adler-32 checksum of the bands written so far
+    bool _zlibError;
+};
+
 void
 WritePNGPlugin::encode(const string& filename,
                        const OfxTime time,
@@ -717,9 +1179,13 @@ WritePNGPlugin::encode(const string& filename,
         return;
     }
 
+    // With write behind, the file is encoded to memory and written asynchronously (it replaces the existing file).
+    const bool writeBehind = isWriteBehind(time);
+    vector<unsigned char> fileBuffer;
+
     // If the file exists (which means "overwrite" was checked), remove it first.
     // See https://github.com/NatronGitHub/Natron/issues/666
-    if (OFX::exists_utf8( filename.c_str() )) {
+    if ( !writeBehind && OFX::exists_utf8( filename.c_str() ) ) {
         OFX::remove_utf8( filename.c_str() );
     }
 
@@ -728,14 +1194,18 @@ WritePNGPlugin::encode(const string& filename,
     FILE* file = NULL;
     int color_type = PNG_COLOR_TYPE_GRAY;
     try {
-        openFile(filename, dstNComps, &png, &info, &file, &color_type);
+        openFile(filename, dstNComps, &png, &info, writeBehind ? NULL : &file, &color_type);
     } catch (const std::exception& e) {
         setPersistentMessage( Message::eMessageError, "", e.what() );
         throwSuiteStatusException(kOfxStatFailed);
     }
 
 
-    png_init_io (png, file);
+    if (writeBehind) {
+        png_set_write_fn(png, &fileBuffer, write_to_buffer, flush_buffer);
+    } else {
+        png_init_io (png, file);
+    }
 
     int compressionLevelParam;
     _compressionLevel->getValue(compressionLevelParam);
@@ -745,108 +1215,87 @@ WritePNGPlugin::encode(const string& filename,
 
     int compression_i;
     _compression->getValue(compression_i);
+    int compressionStrategy;
     switch (compression_i) {
     case 1:
-        png_set_compression_strategy(png, Z_FILTERED);
+        compressionStrategy = Z_FILTERED;
         break;
     case 2:
-        png_set_compression_strategy(png, Z_HUFFMAN_ONLY);
+        compressionStrategy = Z_HUFFMAN_ONLY;
         break;
     case 3:
-        png_set_compression_strategy(png, Z_RLE);
+        compressionStrategy = Z_RLE;
         break;
     case 4:
-        png_set_compression_strategy(png, Z_FIXED);
+        compressionStrategy = Z_FIXED;
         break;
     case 0:
     default:
-        png_set_compression_strategy(png, Z_DEFAULT_STRATEGY);
+        compressionStrategy = Z_DEFAULT_STRATEGY;
         break;
     }
+    png_set_compression_strategy(png, compressionStrategy);
+
+    int nThreads = _threads->getValueAtTime(time);
+    if (nThreads <= 0) {
+        nThreads = (int)MultiThread::getNumCPUs();
+    }
 
     PNGBitDepthEnum pngDepth = (PNGBitDepthEnum)_bitdepth->getValueAtTime(time);
     string ocioColorspace;
 #ifdef OFX_IO_USING_OCIO
     _ocio->getOutputColorspace(ocioColorspace);
 #endif
+    // Must call this setjmp in every function that does PNG writes (the row writers set their own)
+    if ( setjmp ( png_jmpbuf(png) ) ) {
+        destroy_write_struct(png, info);
+        close_file(file);
+        setPersistentMessage(Message::eMessageError, "", "PNG library error");
+        throwSuiteStatusException(kOfxStatFailed);
+    }
     write_info(png, info, color_type, bounds.x1, bounds.y1, bounds.x2 - bounds.x1, bounds.y2 - bounds.y1, pixelAspectRatio, ocioColorspace, pngDepth);
 
     int bitDepthSize = ( (pngDepth == ePNGBitDepthUShort) ? sizeof(unsigned short) : sizeof(unsigned char) );
 
-    // Convert the float buffer to the buffer used by PNG
-    int dstRowElements = (bounds.x2 - bounds.x1) * dstNComps;
-    std::size_t pngRowBytes =  dstRowElements * bitDepthSize;
-    std::size_t scratchBufBytes = (bounds.y2 - bounds.y1) * pngRowBytes;
-
-    RamBuffer scratchBuffer(scratchBufBytes);
-    int nComps = (std::min)(dstNComps, pixelDataNComps);
-    const int srcRowElements = rowBytes / sizeof(float);
-    const size_t numPixels = (size_t)(bounds.x2 - bounds.x1) * (size_t)(bounds.y2 - bounds.y1);
-
-    assert(srcRowElements == (bounds.x2 - bounds.x1) * pixelDataNComps);
-    assert(scratchBufBytes == numPixels * dstNComps * bitDepthSize);
+    // The float buffer is converted to the buffer used by PNG by bands, which are written as soon as they are converted
+    assert( rowBytes >= (bounds.x2 - bounds.x1) * pixelDataNComps * (int)sizeof(float) );
 
-    const float* src_pixels = pixelData;
+    // parameters are fetched now, since bands are converted from worker threads
+    bool ditherEnabled = _ditherEnabled->getValue();
+    const PNGRowConverter converter(_ditherLut, time, pixelData, bounds, pixelDataNComps, rowBytes, dstNCompsStartIndex, dstNComps, pngDepth, ditherEnabled);
 
-    if (pngDepth == ePNGBitDepthUByte) {
-        bool ditherEnabled = _ditherEnabled->getValue();
-
-        unsigned char* dstPixelData = scratchBuffer.getData();
-        unsigned char* dst_pixels = dstPixelData;
-
-        // no dither
-        if ( !ditherEnabled || (nComps < 3) ) {
-            for ( size_t i = 0; i < numPixels; ++i,
-                 dst_pixels += dstNComps,
-                 src_pixels += pixelDataNComps) {
-                assert(src_pixels == pixelData + i * pixelDataNComps);
-                assert(dst_pixels == dstPixelData + i * dstNComps);
-                for (int c = 0; c < nComps; ++c) {
-                    dst_pixels[c] = floatToInt<256>(src_pixels[dstNCompsStartIndex + c]);
-                }
-
-            }
-        } else {
-            assert(nComps >= 3);
-            const unsigned int ditherSeed = 2000;
-            add_dither(time, ditherSeed, src_pixels, bounds, dst_pixels, srcRowElements, dstRowElements, dstNCompsStartIndex, pixelDataNComps, dstNComps);
-        }
-    } else {
-        assert(pngDepth == ePNGBitDepthUShort);
-
-        unsigned short* dstPixelData = reinterpret_cast<unsigned short*>( scratchBuffer.getData() );
-        unsigned short* dst_pixels = dstPixelData;
-
-        for ( size_t i = 0; i < numPixels; ++i,
-             dst_pixels += dstNComps,
-             src_pixels += pixelDataNComps) {
-            assert(src_pixels == pixelData + i * pixelDataNComps);
-            assert(dst_pixels == dstPixelData + i * dstNComps);
-            for (int c = 0; c < nComps; ++c) {
-                dst_pixels[c] = floatToInt<65536>(src_pixels[dstNCompsStartIndex + c]);
-            }
+    if ( (nThreads > 1) && (bounds.y2 - bounds.y1 > 1) ) {
+        PNGParallelEncoder encoder( converter, bounds.y2 - bounds.y1, dstNComps * bitDepthSize,
+                                    compressionLevel, compressionStrategy, (unsigned int)nThreads, png );
+        if ( !encoder.process() ) {
+            destroy_write_struct(png, info);
+            close_file(file);
+            setPersistentMessage(Message::eMessageError, "", encoder.isConversionError() ? "PNG: cannot convert the image (out of memory?)" : encoder.isZlibError() ? "zlib error" : "PNG library error");
+            throwSuiteStatusException(kOfxStatFailed);
         }
-        // PNG is always big endian
-        if ( littleendian() ) {
-            swap_endian ( dstPixelData, numPixels * dstNComps );
+        destroy_write_struct(png, info);
+        close_file(file);
+        if (writeBehind) {
+            writeFileBehind(filename, fileBuffer);
         }
-    }
 
+        return;
+    }
 
-    // Y is top down in PNG, so invert it now
-    for (int y = (bounds.y2 - bounds.y1 - 1); y >= 0; --y) {
-        if ( setjmp ( png_jmpbuf(png) ) ) {
-            destroy_write_struct(png, info);
-            std::fclose(file);
-            setPersistentMessage(Message::eMessageError, "", "PNG library error");
-            throwSuiteStatusException(kOfxStatFailed);
-        }
-        png_write_row (png, (png_byte*)scratchBuffer.getData() + y * pngRowBytes);
+    PNGRowWriter writer(converter, bounds.y2 - bounds.y1, png);
+    if ( !writer.process() ) {
+        destroy_write_struct(png, info);
+        close_file(file);
+        setPersistentMessage(Message::eMessageError, "", writer.isConversionError() ? "PNG: cannot convert the image (out of memory?)" : "PNG library error");
+        throwSuiteStatusException(kOfxStatFailed);
     }
 
     finish_image(png, info);
     destroy_write_struct(png, info);
-    std::fclose(file);
+    close_file(file);
+    if (writeBehind) {
+        writeFileBehind(filename, fileBuffer);
+    }
 } // WritePNGPlugin::encode
 
 bool
@@ -958,7 +1407,7 @@ WritePNGPluginFactory::describeInContext(ImageEffectDescriptor &desc,
                                                                     kSupportsRGB,
                                                                     kSupportsXY,
                                                                     kSupportsAlpha,
-                                                                    "scene_linear", "sRGB", false);
+                                                                    "scene_linear", "sRGB", false, true);
 
     {
         ChoiceParamDescriptor* param = desc.defineChoiceParam(kWritePNGParamCompression);
@@ -1002,6 +1451,18 @@ WritePNGPluginFactory::describeInContext(ImageEffectDescriptor &desc,
         }
     }
 
+    {
+        IntParamDescriptor* param = desc.defineIntParam(kWritePNGParamThreads);
+        param->setLabel(kWritePNGParamThreadsLabel);
+        param->setHint(kWritePNGParamThreadsHint);
+        param->setRange(0, 64);
+        param->setDisplayRange(0, 16);
+        param->setDefault(kWritePNGParamThreadsDefault);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
     {
         BooleanParamDescriptor* param = desc.defineBooleanParam(kWritePNGParamDither);
         param->setLabel(kWritePNGParamDitherLabel);
@@ -20,6 +20,8 @@
 /*
  * OFX RunScript plugin.
  * Run a shell script.
+ * The pixels may be exchanged with the script through POSIX shared memory, and the script may
+ * run as a persistent worker process that handles one frame per request.
  */
 
 #if !( defined(_WIN32) || defined(__WIN32__) || defined(WIN32 ) ) // Sorry, MS Windows users, this plugin won't work for you
@@ -36,11 +38,19 @@
 #define DBG(x) (void)0
 #endif
 #include <string>
+#include <algorithm> // std::max
 #include <sstream>
 #include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
 #include <unistd.h>
+#include <fcntl.h> // O_CREAT
+#include <pthread.h> // pthread_sigmask
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h> // shm_open, mmap
+#include <sys/wait.h> // WIFEXITED
 #include <stdio.h> // for snprintf & _snprintf
 #if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
 #  include <windows.h>
@@ -106,6 +116,24 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
     "rm \"$1\" \"$2\"\n" \
     "```\n" \
     "\n" \
+    "### Shared memory transfer\n" \
+    "\n" \
+    "When \"Pixel Transfer\" is set to \"Shared Memory\", the images are exchanged with the script without going through files, and the script is given the following environment variables:\n" \
+    "\n" \
+    "- `OFX_RUNSCRIPT_TIME` and `OFX_RUNSCRIPT_VIEW`: the frame and the view being rendered.\n" \
+    "- `OFX_RUNSCRIPT_INPUT1` to `OFX_RUNSCRIPT_INPUT10`: the image of each connected input.\n" \
+    "- `OFX_RUNSCRIPT_OUTPUT`: the output image, which initially contains a copy of the first input (or black), and may be modified by the script.\n" \
+    "\n" \
+    "Each image is described as `name,x1,y1,x2,y2,components,depth,rowbytes`, where `name` is a POSIX shared memory object (under Linux, the file /dev/shm/name), (x1,y1)-(x2,y2) are the pixel bounds, `components` is the number of components per pixel (e.g. 4 for RGBA), `depth` is one of 8u, 16u, 16f or 32f, and `rowbytes` is the size of a row in bytes. Rows are stored from bottom to top, and components are interleaved.\n" \
+    "The output image is only used if the script succeeds (exits with status 0).\n" \
+    "\n" \
+    "### Persistent worker\n" \
+    "\n" \
+    "When \"Persistent Worker\" is checked, the script is started only once, without arguments and with the environment variable `OFX_RUNSCRIPT_PERSISTENT` set to 1, and it must process one request per line read from its standard input, until the end of input. " \
+    "Each request is a list of NAME=VALUE fields separated by tabs, with the same variables as above, plus `OFX_RUNSCRIPT_ARG1`, `OFX_RUNSCRIPT_ARG2`, etc. holding the arguments. " \
+    "After each request, the script must print a single line on its standard output: `ok` if it succeeded, or an error message (any other output should go to the standard error). " \
+    "The worker is stopped when the script is unlocked, or when the effect is destroyed.\n" \
+    "\n" \
     "This plugin uses pstream (http://pstreams.sourceforge.net), which is distributed under the Boost Software License, Version 1.0.\n"
 
 #define kPluginIdentifier "fr.inria.openfx.RunScript"
@@ -151,10 +179,24 @@ OFXS_NAMESPACE_ANONYMOUS_ENTER
     "Contents of the script. Under Unix, the script should begin with a traditional shebang line, e.g. '#!/bin/sh' or '#!/usr/bin/env python'\n" \
     "The arguments can be accessed as usual from the script (in a Unix shell-script, argument 1 would be accessed as \"$1\" - use double quotes to avoid problems with spaces)."
 
+#define kParamTransfer "pixelTransfer"
+#define kParamTransferLabel "Pixel Transfer"
+#define kParamTransferHint "How images are exchanged with the script."
+#define kParamTransferOptionFiles "Files", "The script works on files written by upstream Writers, and the output is a copy of the first input.", "files"
+#define kParamTransferOptionSharedMemory "Shared Memory", "The input images are given to the script in shared memory, where it writes the output image (see the plugin description).", "sharedmemory"
+
+#define kParamPersistent "persistent"
+#define kParamPersistentLabel "Persistent Worker"
+#define kParamPersistentHint \
+    "Start the script once, and send it a request for each rendered frame on its standard input, instead of running it for each frame (see the plugin description)."
+
 #define kParamValidate                  "validate"
 #define kParamValidateLabel             "Validate"
 #define kParamValidateHint              "Validate the script contents and execute it on next render. This locks the script and all its parameters."
 
+#define kRunScriptEnvPrefix "OFX_RUNSCRIPT_"
+#define kRunScriptSharedMemoryPrefix "/ofxrs"
+
 enum ERunScriptPluginParamType
 {
     eRunScriptPluginParamTypeFilename = 0,
@@ -163,6 +205,12 @@ enum ERunScriptPluginParamType
     eRunScriptPluginParamTypeInteger
 };
 
+enum ERunScriptPluginTransfer
+{
+    eRunScriptPluginTransferFiles = 0,
+    eRunScriptPluginTransferSharedMemory
+};
+
 static
 string
 unsignedToString(unsigned i)
@@ -178,6 +226,233 @@ unsignedToString(unsigned i)
     return nb;
 }
 
+static int
+bytesPerComponent(BitDepthEnum depth)
+{
+    switch (depth) {
+    case eBitDepthUByte:
+
+        return 1;
+    case eBitDepthUShort:
+    case eBitDepthHalf:
+
+        return 2;
+    case eBitDepthFloat:
+
+        return 4;
+    default:
+
+        return 0;
+    }
+}
+
+static const char*
+bitDepthName(BitDepthEnum depth)
+{
+    switch (depth) {
+    case eBitDepthUByte:
+
+        return "8u";
+    case eBitDepthUShort:
+
+        return "16u";
+    case eBitDepthHalf:
+
+        return "16f";
+    case eBitDepthFloat:
+
+        return "32f";
+    default:
+
+        return "none";
+    }
+}
+
+/**
+ * @brief The pixels of an image in a POSIX shared memory object, which the script can map.
+ * The object is unlinked when released.
+ */
+class SharedImage
+{
+public:
+    SharedImage()
+        : _name()
+        , _data(NULL)
+        , _size(0)
+        , _nComps(0)
+        , _depth(eBitDepthNone)
+        , _rowBytes(0)
+    {
+        _bounds.x1 = _bounds.y1 = _bounds.x2 = _bounds.y2 = 0;
+    }
+
+    ~SharedImage()
+    {
+        release();
+    }
+
+    /** @brief create the shared memory object, or reuse it if it has the same format. Returns false and sets errno on failure. */
+    bool allocate(const string& name,
+                  const OfxRectI& bounds,
+                  int nComps,
+                  BitDepthEnum depth)
+    {
+        if ( _data && (name == _name) && (nComps == _nComps) && (depth == _depth) &&
+             (bounds.x1 == _bounds.x1) && (bounds.y1 == _bounds.y1) && (bounds.x2 == _bounds.x2) && (bounds.y2 == _bounds.y2) ) {
+            return true;
+        }
+        release();
+        const std::size_t rowBytes = (std::size_t)(bounds.x2 - bounds.x1) * nComps * bytesPerComponent(depth);
+        const std::size_t size = rowBytes * (bounds.y2 - bounds.y1);
+        if (size == 0) {
+            errno = EINVAL;
+
+            return false;
+        }
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+        if ( (fd < 0) && (errno == EEXIST) ) {
+            // left over by a process with the same ID that crashed
+            shm_unlink( name.c_str() );
+            fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+        }
+        if (fd < 0) {
+            return false;
+        }
+        void* data = MAP_FAILED;
+        if (ftruncate(fd, (off_t)size) == 0) {
+            data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        int err = errno;
+        close(fd);
+        if (data == MAP_FAILED) {
+            shm_unlink( name.c_str() );
+            errno = err;
+
+            return false;
+        }
+        _name = name;
+        _data = data;
+        _size = size;
+        _bounds = bounds;
+        _nComps = nComps;
+        _depth = depth;
+        _rowBytes = rowBytes;
+
+        return true;
+    }
+
+    void release()
+    {
+        if (_data) {
+            munmap(_data, _size);
+            shm_unlink( _name.c_str() );
+            _data = NULL;
+        }
+    }
+
+    /** @brief the description given to the script: name,x1,y1,x2,y2,components,depth,rowbytes */
+    string descriptor() const
+    {
+        char desc[256];
+
+        // the script opens the object by its name without the leading slash, as in /dev/shm
+        snprintf(desc, sizeof(desc), "%s,%d,%d,%d,%d,%d,%s,%lu", _name.c_str() + 1, _bounds.x1, _bounds.y1, _bounds.x2, _bounds.y2,
+                 _nComps, bitDepthName(_depth), (unsigned long)_rowBytes);
+
+        return desc;
+    }
+
+    void clear()
+    {
+        std::memset(_data, 0, _size);
+    }
+
+    /** @brief copy the rows of img that are within the bounds. The image must have the same format. */
+    void copyFrom(const Image& img)
+    {
+        const OfxRectI& imgBounds = img.getBounds();
+        const int x1 = (std::max)(imgBounds.x1, _bounds.x1);
+        const int x2 = (std::min)(imgBounds.x2, _bounds.x2);
+        const int y1 = (std::max)(imgBounds.y1, _bounds.y1);
+        const int y2 = (std::min)(imgBounds.y2, _bounds.y2);
+        const std::size_t pixelBytes = (std::size_t)_nComps * bytesPerComponent(_depth);
+
+        for (int y = y1; y < y2 && x1 < x2; ++y) {
+            std::memcpy( pixelAddress(x1, y), img.getPixelAddress(x1, y), (x2 - x1) * pixelBytes );
+        }
+    }
+
+    /** @brief copy the pixels within window to img. The image must have the same format. */
+    void copyTo(const OfxRectI& window,
+                Image* img) const
+    {
+        const OfxRectI& imgBounds = img->getBounds();
+        const int x1 = (std::max)( (std::max)(window.x1, imgBounds.x1), _bounds.x1 );
+        const int x2 = (std::min)( (std::min)(window.x2, imgBounds.x2), _bounds.x2 );
+        const int y1 = (std::max)( (std::max)(window.y1, imgBounds.y1), _bounds.y1 );
+        const int y2 = (std::min)( (std::min)(window.y2, imgBounds.y2), _bounds.y2 );
+        const std::size_t pixelBytes = (std::size_t)_nComps * bytesPerComponent(_depth);
+
+        for (int y = y1; y < y2 && x1 < x2; ++y) {
+            std::memcpy( img->getPixelAddress(x1, y), pixelAddress(x1, y), (x2 - x1) * pixelBytes );
+        }
+    }
+
+private:
+    SharedImage(const SharedImage&); // not implemented
+    SharedImage& operator=(const SharedImage&); // not implemented
+
+    void* pixelAddress(int x,
+                       int y) const
+    {
+        return (char*)_data + (std::size_t)(y - _bounds.y1) * _rowBytes + (std::size_t)(x - _bounds.x1) * _nComps * bytesPerComponent(_depth);
+    }
+
+    string _name;
+    void* _data;
+    std::size_t _size;
+    OfxRectI _bounds;
+    int _nComps;
+    BitDepthEnum _depth;
+    std::size_t _rowBytes;
+};
+
+/**
+ * @brief Block SIGPIPE in the calling thread while writing to a worker that may have exited,
+ * so that the host is not killed, and discard the signal if it was raised.
+ */
+class ScopedSigPipeBlocker
+{
+public:
+    ScopedSigPipeBlocker()
+    {
+        sigemptyset(&_sigPipe);
+        sigaddset(&_sigPipe, SIGPIPE);
+        sigset_t pending;
+        sigemptyset(&pending);
+        sigpending(&pending);
+        _wasPending = sigismember(&pending, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &_sigPipe, &_oldMask);
+    }
+
+    ~ScopedSigPipeBlocker()
+    {
+        sigset_t pending;
+        sigemptyset(&pending);
+        sigpending(&pending);
+        if ( !_wasPending && sigismember(&pending, SIGPIPE) ) {
+            int sig;
+            sigwait(&_sigPipe, &sig);
+        }
+        pthread_sigmask(SIG_SETMASK, &_oldMask, NULL);
+    }
+
+private:
+    sigset_t _sigPipe;
+    sigset_t _oldMask;
+    bool _wasPending;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 /** @brief The plugin that does our work */
 class RunScriptPlugin
@@ -187,6 +462,8 @@ public:
     /** @brief ctor */
     RunScriptPlugin(OfxImageEffectHandle handle);
 
+    virtual ~RunScriptPlugin();
+
     /* Override the render */
     virtual void render(const RenderArguments &args) OVERRIDE FINAL;
 
@@ -216,6 +493,17 @@ public:
 private:
     void updateVisibility(void);
 
+    bool createScriptFile(string* scriptname);
+
+    bool runScript(const vector<string>& env, const vector<string>& arguments, bool checkStatus, string* errorMessage);
+
+    bool runWorker(const vector<string>& env, const vector<string>& arguments, string* errorMessage);
+
+    /** @brief stop the persistent worker. _workerMutex must be locked. */
+    void stopWorker();
+
+    string sharedMemoryName(const string& suffix) const;
+
 private:
     Clip *_srcClip[kRunScriptPluginSourceClipCount];
     Clip *_dstClip;
@@ -226,7 +514,14 @@ private:
     DoubleParam *_double[kRunScriptPluginArgumentsCount];
     IntParam *_int[kRunScriptPluginArgumentsCount];
     StringParam *_script;
+    ChoiceParam *_transfer;
+    BooleanParam *_persistent;
     BooleanParam *_validate;
+    OFX::MultiThread::Mutex _workerMutex;
+    auto_ptr<redi::pstream> _worker;
+    string _workerScriptname;
+    SharedImage _sharedInputs[kRunScriptPluginSourceClipCount]; // kept while the worker runs
+    SharedImage _sharedOutput;
 };
 
 RunScriptPlugin::RunScriptPlugin(OfxImageEffectHandle handle)
@@ -258,13 +553,214 @@ RunScriptPlugin::RunScriptPlugin(OfxImageEffectHandle handle)
         assert(_type[i] && _filename[i] && _string[i] && _double[i] && _int[i]);
     }
     _script = fetchStringParam(kParamScript);
+    _transfer = fetchChoiceParam(kParamTransfer);
+    _persistent = fetchBooleanParam(kParamPersistent);
     _validate = fetchBooleanParam(kParamValidate);
-    assert(_script && _validate);
+    assert(_script && _transfer && _persistent && _validate);
 
     // finally
     syncPrivateData();
 }
 
+RunScriptPlugin::~RunScriptPlugin()
+{
+    OFX::MultiThread::AutoMutex lock(_workerMutex);
+
+    stopWorker();
+}
+
+string
+RunScriptPlugin::sharedMemoryName(const string& suffix) const
+{
+    char name[64];
+
+    // POSIX shared memory names are limited to 31 characters on macOS
+    snprintf( name, sizeof(name), kRunScriptSharedMemoryPrefix ".%d.%x.", (int)getpid(), (unsigned int)( (size_t)this & 0xffffffff ) );
+
+    return name + suffix;
+}
+
+/** @brief write the script to a new executable file */
+bool
+RunScriptPlugin::createScriptFile(string* scriptname)
+{
+    char name[] = "/tmp/runscriptXXXXXX";
+    // Coverity suggests to call umask here for compatibility with POSIX<2008 systems,
+    // but umask affects the whole process. We prefer to ignore this.
+    // coverity[secure_temp]
+    int fd = mkstemp(name); // modifies template
+
+    if (fd < 0) {
+        return false;
+    }
+    string script;
+    _script->getValue(script);
+    ssize_t s = write( fd, script.c_str(), script.size() );
+    close(fd);
+    if (s < 0) {
+        (void)unlink(name);
+
+        return false;
+    }
+
+    // make the script executable
+    int stat = chmod(name, S_IRWXU);
+    if (stat != 0) {
+        (void)unlink(name);
+
+        return false;
+    }
+    *scriptname = name;
+
+    return true;
+}
+
+/** @brief run the script once. The script output is only checked if checkStatus is true. */
+bool
+RunScriptPlugin::runScript(const vector<string>& env,
+                           const vector<string>& arguments,
+                           bool checkStatus,
+                           string* errorMessage)
+{
+    // create the script
+    string scriptname;
+
+    if ( !createScriptFile(&scriptname) ) {
+        throwSuiteStatusException(kOfxStatFailed);
+
+        return false;
+    }
+
+    // build the command-line.
+    // the environment is set using env(1), since setenv() is not thread-safe
+    string file = scriptname;
+    vector<string> argv;
+    if ( !env.empty() ) {
+        file = "env";
+        argv.push_back(file);
+        argv.insert( argv.end(), env.begin(), env.end() );
+    }
+    argv.push_back(scriptname);
+    argv.insert( argv.end(), arguments.begin(), arguments.end() );
+
+    // execute the script
+    vector<string> errors;
+    redi::ipstream in(file, argv, redi::pstreambuf::pstderr | redi::pstreambuf::pstderr);
+    string errmsg;
+    while ( std::getline(in, errmsg) ) {
+        errors.push_back(errmsg);
+        DBG(std::cout << "output: " << errmsg << std::endl);
+    }
+    in.close();
+    const int status = in.rdbuf()->status();
+
+    // remove the script
+    (void)unlink( scriptname.c_str() );
+
+    if ( checkStatus && ( !WIFEXITED(status) || (WEXITSTATUS(status) != 0) ) ) {
+        *errorMessage = "The script failed";
+        if ( !errors.empty() ) {
+            *errorMessage += ": " + errors.back();
+        }
+
+        return false;
+    }
+
+    return true;
+}
+
+/** @brief send a request to the persistent worker, starting it if necessary, and wait for its reply */
+bool
+RunScriptPlugin::runWorker(const vector<string>& env,
+                           const vector<string>& arguments,
+                           string* errorMessage)
+{
+    // the request is a line of tab-separated NAME=VALUE fields
+    string request;
+
+    for (std::size_t i = 0; i < env.size(); ++i) {
+        request += env[i] + '\t';
+    }
+    for (std::size_t i = 0; i < arguments.size(); ++i) {
+        if (arguments[i].find_first_of("\t\n") != string::npos) {
+            *errorMessage = "The arguments of a persistent worker cannot contain tabs or newlines.";
+
+            return false;
+        }
+        request += kRunScriptEnvPrefix "ARG" + unsignedToString(i + 1) + '=' + arguments[i] + '\t';
+    }
+    if ( !request.empty() ) {
+        request.erase(request.size() - 1);
+    }
+    request += '\n';
+
+    OFX::MultiThread::AutoMutex lock(_workerMutex);
+    if ( _worker.get() && _worker->rdbuf()->exited() ) {
+        stopWorker();
+    }
+    if ( !_worker.get() ) {
+        if ( !createScriptFile(&_workerScriptname) ) {
+            *errorMessage = "Cannot create the script file.";
+
+            return false;
+        }
+        vector<string> argv;
+        argv.push_back("env");
+        argv.push_back(kRunScriptEnvPrefix "PERSISTENT=1");
+        argv.push_back(_workerScriptname);
+        _worker.reset( new redi::pstream("env", argv, redi::pstreambuf::pstdin | redi::pstreambuf::pstdout) );
+        if ( !_worker->is_open() ) {
+            stopWorker();
+            *errorMessage = "Cannot start the script.";
+
+            return false;
+        }
+    }
+    {
+        ScopedSigPipeBlocker blocker;
+        *_worker << request << std::flush;
+    }
+    string reply;
+    if ( !*_worker || !std::getline(*_worker, reply) ) {
+        stopWorker();
+        *errorMessage = "The persistent worker exited.";
+
+        return false;
+    }
+    if ( !reply.empty() && (reply[reply.size() - 1] == '\r') ) {
+        reply.erase(reply.size() - 1);
+    }
+    if (reply != "ok") {
+        *errorMessage = reply.empty() ? "The script failed." : reply;
+
+        return false;
+    }
+
+    return true;
+} // RunScriptPlugin::runWorker
+
+void
+RunScriptPlugin::stopWorker()
+{
+    if ( _worker.get() ) {
+        ScopedSigPipeBlocker blocker;
+        // the worker should exit at the end of its input. Give it a second before killing it.
+        _worker->rdbuf()->peof();
+        for (int i = 0; i < 100 && !_worker->rdbuf()->exited(); ++i) {
+            usleep(10000);
+        }
+        if ( !_worker->rdbuf()->exited() ) {
+            _worker->rdbuf()->kill(SIGTERM);
+        }
+        _worker->close();
+        _worker.reset();
+    }
+    if ( !_workerScriptname.empty() ) {
+        (void)unlink( _workerScriptname.c_str() );
+        _workerScriptname.clear();
+    }
+}
+
 void
 RunScriptPlugin::render(const RenderArguments &args)
 {
@@ -285,17 +781,27 @@ RunScriptPlugin::render(const RenderArguments &args)
         return;
     }
 
+    int transfer_i;
+    _transfer->getValue(transfer_i);
+    const bool sharedMemory = ( (ERunScriptPluginTransfer)transfer_i == eRunScriptPluginTransferSharedMemory );
+    bool persistent;
+    _persistent->getValue(persistent);
+
     // fetch images corresponding to all connected inputs,
     // since it may trigger render actions upstream
+    auto_ptr<const Image> srcImgs[kRunScriptPluginSourceClipCount];
     for (int i = 0; i < kRunScriptPluginSourceClipCount; ++i) {
         if ( _srcClip[i]->isConnected() ) {
-            auto_ptr<const Image> srcImg( _srcClip[i]->fetchImage(args.time) );
-            if ( !srcImg.get() ) {
+            srcImgs[i].reset( _srcClip[i]->fetchImage(args.time) );
+            if ( !srcImgs[i].get() ) {
                 throwSuiteStatusException(kOfxStatFailed);
 
                 return;
             }
-            checkBadRenderScaleOrField(srcImg, args);
+            checkBadRenderScaleOrField(srcImgs[i], args);
+            if (!sharedMemory) {
+                srcImgs[i].reset();
+            }
         }
     }
 
@@ -316,38 +822,8 @@ RunScriptPlugin::render(const RenderArguments &args)
     }
     checkBadRenderScaleOrField(dstImg, args);
 
-    // create the script
-    char scriptname[] = "/tmp/runscriptXXXXXX";
-    // Coverity suggests to call umask here for compatibility with POSIX<2008 systems,
-    // but umask affects the whole process. We prefer to ignore this.
-    // coverity[secure_temp]
-    int fd = mkstemp(scriptname); // modifies template
-    if (fd < 0) {
-        throwSuiteStatusException(kOfxStatFailed);
-
-        return;
-    }
-    string script;
-    _script->getValue(script);
-    ssize_t s = write( fd, script.c_str(), script.size() );
-    close(fd);
-    if (s < 0) {
-        throwSuiteStatusException(kOfxStatFailed);
-
-        return;
-    }
-
-    // make the script executable
-    int stat = chmod(scriptname, S_IRWXU);
-    if (stat != 0) {
-        throwSuiteStatusException(kOfxStatFailed);
-
-        return;
-    }
-
-    // build the command-line
-    vector<string> argv;
-    argv.push_back(scriptname);
+    // build the arguments
+    vector<string> arguments;
 
     int param_count;
     _param_count->getValue(param_count);
@@ -364,7 +840,7 @@ RunScriptPlugin::render(const RenderArguments &args)
             _filename[i]->getValue(s);
             p = _filename[i];
             DBG(std::cout << p->getName() << "=" << s);
-            argv.push_back(s);
+            arguments.push_back(s);
             break;
         }
         case eRunScriptPluginParamTypeString: {
@@ -372,7 +848,7 @@ RunScriptPlugin::render(const RenderArguments &args)
             _string[i]->getValue(s);
             p = _string[i];
             DBG(std::cout << p->getName() << "=" << s);
-            argv.push_back(s);
+            arguments.push_back(s);
             break;
         }
         case eRunScriptPluginParamTypeDouble: {
@@ -381,7 +857,7 @@ RunScriptPlugin::render(const RenderArguments &args)
             p = _double[i];
             DBG(std::cout << p->getName() << "=" << v);
             snprintf(name, sizeof(name), "%g", v);
-            argv.push_back(name);
+            arguments.push_back(name);
             break;
         }
         case eRunScriptPluginParamTypeInteger: {
@@ -390,7 +866,7 @@ RunScriptPlugin::render(const RenderArguments &args)
             p = _int[i];
             DBG(std::cout << p->getName() << "=" << v);
             snprintf(name, sizeof(name), "%d", v);
-            argv.push_back(name);
+            arguments.push_back(name);
             break;
         }
         }
@@ -402,19 +878,74 @@ RunScriptPlugin::render(const RenderArguments &args)
         DBG(std::cout << std::endl);
     }
 
+    // the images given to the script are kept between frames by the persistent worker.
+    // renders of the same instance are not concurrent (kRenderThreadSafety is eRenderInstanceSafe).
+    vector<string> env;
+    SharedImage localInputs[kRunScriptPluginSourceClipCount];
+    SharedImage localOutput;
+    SharedImage* inputs = persistent ? _sharedInputs : localInputs;
+    SharedImage& output = persistent ? _sharedOutput : localOutput;
+    if (sharedMemory || persistent) {
+        snprintf(name, sizeof(name), kRunScriptEnvPrefix "TIME=%g", args.time);
+        env.push_back(name);
+        snprintf(name, sizeof(name), kRunScriptEnvPrefix "VIEW=%d", args.renderView);
+        env.push_back(name);
+    }
+    if (sharedMemory) {
+        for (int i = 0; i <= kRunScriptPluginSourceClipCount; ++i) {
+            // the last one is the output
+            const bool isOutput = (i == kRunScriptPluginSourceClipCount);
+            const Image* img = isOutput ? dstImg.get() : srcImgs[i].get();
+            SharedImage& shared = isOutput ? output : inputs[i];
+            if (!img) {
+                shared.release();
+                continue;
+            }
+            const int nComps = img->getPixelComponentCount();
+            const BitDepthEnum depth = img->getPixelDepth();
+            if ( (nComps == 0) || (bytesPerComponent(depth) == 0) ) {
+                setPersistentMessage(Message::eMessageError, "", "Shared memory transfer does not support custom components or bit depths.");
+                throwSuiteStatusException(kOfxStatFailed);
+
+                return;
+            }
+            const string id = isOutput ? "o" : unsignedToString(i + 1);
+            if ( !shared.allocate(sharedMemoryName(id), isOutput ? args.renderWindow : img->getBounds(), nComps, depth) ) {
+                setPersistentMessage( Message::eMessageError, "", string("Cannot create the shared memory: ") + std::strerror(errno) );
+                throwSuiteStatusException(kOfxStatFailed);
+
+                return;
+            }
+            if (isOutput) {
+                const Image* first = srcImgs[0].get();
+                shared.clear();
+                if ( first && (first->getPixelComponentCount() == nComps) && (first->getPixelDepth() == depth) ) {
+                    shared.copyFrom(*first);
+                }
+                env.push_back(kRunScriptEnvPrefix "OUTPUT=" + shared.descriptor());
+            } else {
+                shared.copyFrom(*img);
+                env.push_back(kRunScriptEnvPrefix "INPUT" + id + '=' + shared.descriptor());
+            }
+        }
+    }
+
     // execute the script
-    vector<string> errors;
-    redi::ipstream in(scriptname, argv, redi::pstreambuf::pstderr | redi::pstreambuf::pstderr);
-    string errmsg;
-    while ( std::getline(in, errmsg) ) {
-        errors.push_back(errmsg);
-        DBG(std::cout << "output: " << errmsg << std::endl);
+    string errorMessage;
+    bool succeeded;
+    if (persistent) {
+        succeeded = runWorker(env, arguments, &errorMessage);
+    } else {
+        succeeded = runScript(env, arguments, sharedMemory, &errorMessage);
     }
+    if (!succeeded) {
+        setPersistentMessage(Message::eMessageError, "", errorMessage);
+        throwSuiteStatusException(kOfxStatFailed);
 
-    // remove the script
-    (void)unlink(scriptname);
+        return;
+    }
 
-    // now copy the first input to output
+    // now copy the first input, or the output of the script, to output
 
     if ( _dstClip->isConnected() ) {
         auto_ptr<Image> dstImg( _dstClip->fetchImage(args.time) );
@@ -425,6 +956,12 @@ RunScriptPlugin::render(const RenderArguments &args)
         }
         checkBadRenderScaleOrField(dstImg, args);
 
+        if (sharedMemory) {
+            output.copyTo( args.renderWindow, dstImg.get() );
+
+            return;
+        }
+
         auto_ptr<const Image> srcImg( _srcClip[0]->fetchImage(args.time) );
 
         if ( !srcImg.get() ) {
@@ -479,7 +1016,16 @@ RunScriptPlugin::changedParam(const InstanceChangedArgs &args,
         }
         _script->setEnabled(!validated);
         _script->setEvaluateOnChange(validated);
+        _transfer->setEnabled(!validated);
+        _transfer->setEvaluateOnChange(validated);
+        _persistent->setEnabled(!validated);
+        _persistent->setEvaluateOnChange(validated);
         clearPersistentMessage();
+        {
+            // the worker runs the script that was validated
+            OFX::MultiThread::AutoMutex lock(_workerMutex);
+            stopWorker();
+        }
     } else {
         for (int i = 0; i < param_count; ++i) {
             if ( ( paramName == _type[i]->getName() ) && (args.reason == eChangeUserEdit) ) {
@@ -583,6 +1129,10 @@ RunScriptPlugin::updateVisibility(void)
     }
     _script->setEnabled(!validated);
     _script->setEvaluateOnChange(validated);
+    _transfer->setEnabled(!validated);
+    _transfer->setEvaluateOnChange(validated);
+    _persistent->setEnabled(!validated);
+    _persistent->setEvaluateOnChange(validated);
 }
 
 // override the roi call
@@ -820,6 +1370,32 @@ RunScriptPluginFactory::describeInContext(ImageEffectDescriptor &desc,
         }
     }
 
+    {
+        ChoiceParamDescriptor *param = desc.defineChoiceParam(kParamTransfer);
+        param->setLabel(kParamTransferLabel);
+        param->setHint(kParamTransferHint);
+        assert(param->getNOptions() == eRunScriptPluginTransferFiles);
+        param->appendOption(kParamTransferOptionFiles);
+        assert(param->getNOptions() == eRunScriptPluginTransferSharedMemory);
+        param->appendOption(kParamTransferOptionSharedMemory);
+        param->setDefault( (int)eRunScriptPluginTransferFiles );
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
+    {
+        BooleanParamDescriptor *param = desc.defineBooleanParam(kParamPersistent);
+        param->setLabel(kParamPersistentLabel);
+        param->setHint(kParamPersistentHint);
+        param->setDefault(false);
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
     {
         BooleanParamDescriptor *param = desc.defineBooleanParam(kParamValidate);
         param->setLabel(kParamValidateLabel);
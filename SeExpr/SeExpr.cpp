@@ -930,132 +930,6 @@ private:
 };
 
 
-class DoubleParamVarRef
-    : public SeExprVarRef
-{
-    //Used to call getValue only once per expression evaluation and not once per pixel
-    //Using SeExpr lock is faster than calling the multi-thread suite to get a mutex
-    SeExprInternal::Mutex _lock;
-    bool _varSet;
-    double _value;
-    DoubleParam* _param;
-
-public:
-
-    DoubleParamVarRef(DoubleParam* param)
-        : SeExprVarRef()
-        , _lock()
-        , _varSet(false)
-        , _value(0)
-        , _param(param)
-    {
-    }
-
-    virtual ~DoubleParamVarRef() {}
-
-    //! returns true for a vector type, false for a scalar type
-    virtual bool isVec() { return false; }
-
-    //! returns this variable's value by setting result, node refers to
-    //! where in the parse tree the evaluation is occurring
-    virtual void eval(const SeExprVarNode* /*node*/,
-                      SeExpr2::Vec3d& result)
-    {
-        SeExprInternal::AutoLock<SeExprInternal::Mutex> locker(_lock);
-        if (!_varSet) {
-            _param->getValue(_value);
-            _varSet = true;
-        } else {
-            result[0] = _value;
-        }
-    }
-};
-
-class Double2DParamVarRef
-    : public SeExprVarRef
-{
-    //Used to call getValue only once per expression evaluation and not once per pixel
-    //Using SeExpr lock is faster than calling the multi-thread suite to get a mutex
-    SeExprInternal::Mutex _lock;
-    bool _varSet;
-    double _value[2];
-    Double2DParam* _param;
-
-public:
-
-    Double2DParamVarRef(Double2DParam* param)
-        : SeExprVarRef()
-        , _lock()
-        , _varSet(false)
-        , _value()
-        , _param(param)
-    {
-    }
-
-    virtual ~Double2DParamVarRef() {}
-
-    //! returns true for a vector type, false for a scalar type
-    virtual bool isVec() { return true; }
-
-    //! returns this variable's value by setting result, node refers to
-    //! where in the parse tree the evaluation is occurring
-    virtual void eval(const SeExprVarNode* /*node*/,
-                      SeExpr2::Vec3d& result)
-    {
-        SeExprInternal::AutoLock<SeExprInternal::Mutex> locker(_lock);
-        if (!_varSet) {
-            _param->getValue(_value[0], _value[1]);
-            _varSet = true;
-        } else {
-            result[0] = _value[0];
-            result[1] = _value[1];
-        }
-    }
-};
-
-class ColorParamVarRef
-    : public SeExprVarRef
-{
-    //Used to call getValue only once per expression evaluation and not once per pixel
-    //Using SeExpr lock is faster than calling the multi-thread suite to get a mutex
-    SeExprInternal::Mutex _lock;
-    bool _varSet;
-    double _value[3];
-    RGBParam* _param;
-
-public:
-
-    ColorParamVarRef(RGBParam* param)
-        : SeExprVarRef()
-        , _lock()
-        , _varSet(false)
-        , _value()
-        , _param(param)
-    {
-    }
-
-    virtual ~ColorParamVarRef() {}
-
-    //! returns true for a vector type, false for a scalar type
-    virtual bool isVec() { return true; }
-
-    //! returns this variable's value by setting result, node refers to
-    //! where in the parse tree the evaluation is occurring
-    virtual void eval(const SeExprVarNode* /*node*/,
-                      SeExpr2::Vec3d& result)
-    {
-        SeExprInternal::AutoLock<SeExprInternal::Mutex> locker(_lock);
-        if (!_varSet) {
-            _param->getValue(_value[0], _value[1], _value[2]);
-            _varSet = true;
-        } else {
-            result[0] = _value[0];
-            result[1] = _value[1];
-            result[2] = _value[2];
-        }
-    }
-};
-
 class SimpleScalar
     : public SeExprVarRef
 {
@@ -1199,9 +1073,28 @@ class OFXSeExpression
     SimpleScalar _inputB[kSourceClipCount];
     SimpleVec _inputColors[kSourceClipCount];
     SimpleScalar _inputAlphas[kSourceClipCount];
-    DoubleParamVarRef* _doubleRef[kParamsCount];
-    Double2DParamVarRef* _double2DRef[kParamsCount];
-    ColorParamVarRef* _colorRef[kParamsCount];
+    // parameter values are fetched once per render, so that evaluation does not need any lock
+    SimpleScalar _doubleValues[kParamsCount];
+    SimpleVec _double2DValues[kParamsCount];
+    SimpleVec _colorValues[kParamsCount];
+    vector<string> _inputVarNames[kSourceClipCount]; // the variables holding the value of each input pixel
+
+public:
+
+    // how often the expression has to be evaluated, see analyze()
+    enum VaryingEnum
+    {
+        eVaryingNone = 0, // once per render
+        eVaryingRow, // once per row
+        eVaryingPixel, // for each pixel
+    };
+
+private:
+    VaryingEnum _varying;
+    bool _usesInput[kSourceClipCount];
+    bool _cacheValid;
+    int _cacheY;
+    SeExpr2::Vec3d _cacheValue;
 
 public:
 
@@ -1223,6 +1116,28 @@ public:
     /** override resolveFunc to add external functions */
     virtual SeExprFunc* resolveFunc(const string& name) const OVERRIDE FINAL;
 
+    /** Must be called once the expression is valid: find out which inputs and coordinates it uses. */
+    void analyze();
+
+    VaryingEnum getVarying() const { return _varying; }
+
+    bool usesInput(int inputIndex) const { return _usesInput[inputIndex]; }
+
+    /** NOT MT-SAFE. Evaluate at (x,y), or return the previous value if the expression does not depend on it */
+    SeExpr2::Vec3d evaluateAt(int x,
+                              int y)
+    {
+        if ( (_varying != eVaryingPixel) && _cacheValid && ( (_varying == eVaryingNone) || (_cacheY == y) ) ) {
+            return _cacheValue;
+        }
+        setXY(x, y);
+        _cacheValue = evaluate();
+        _cacheValid = true;
+        _cacheY = y;
+
+        return _cacheValue;
+    }
+
     /** NOT MT-SAFE, this object is to be used PER-THREAD*/
     void setXY(int x,
                int y)
@@ -1300,9 +1215,14 @@ OFXSeExpression::OFXSeExpression(SeExprProcessorBase* processor,
     , _inputHeights()
     , _inputColors()
     , _inputAlphas()
-    , _doubleRef()
-    , _double2DRef()
-    , _colorRef()
+    , _doubleValues()
+    , _double2DValues()
+    , _colorValues()
+    , _varying(eVaryingPixel)
+    , _usesInput()
+    , _cacheValid(false)
+    , _cacheY(0)
+    , _cacheValue()
 {
     _dstPixelRod = outputRod;
 
@@ -1343,9 +1263,15 @@ OFXSeExpression::OFXSeExpression(SeExprProcessorBase* processor,
             _variables[kSeExprGVarName + istr] = &_inputG[i];
             _variables[kSeExprBVarName + istr] = &_inputB[i];
             _variables[kSeExprAVarName + istr] = &_inputAlphas[i];
+            _inputVarNames[i].push_back(kSeExprRVarName + istr);
+            _inputVarNames[i].push_back(kSeExprGVarName + istr);
+            _inputVarNames[i].push_back(kSeExprBVarName + istr);
+            _inputVarNames[i].push_back(kSeExprAVarName + istr);
         }
         _variables[kSeExprColorVarName + istr] = &_inputColors[i];
         _variables[kSeExprAlphaVarName + istr] = &_inputAlphas[i];
+        _inputVarNames[i].push_back(kSeExprColorVarName + istr);
+        _inputVarNames[i].push_back(kSeExprAlphaVarName + istr);
         if (i == 0) {
             // default names for the first input
             _variables[kSeExprInputWidthVarName] = &_inputWidths[i];
@@ -1355,9 +1281,15 @@ OFXSeExpression::OFXSeExpression(SeExprProcessorBase* processor,
                 _variables[kSeExprGVarName] = &_inputG[i];
                 _variables[kSeExprBVarName] = &_inputB[i];
                 _variables[kSeExprAVarName] = &_inputAlphas[i];
+                _inputVarNames[i].push_back(kSeExprRVarName);
+                _inputVarNames[i].push_back(kSeExprGVarName);
+                _inputVarNames[i].push_back(kSeExprBVarName);
+                _inputVarNames[i].push_back(kSeExprAVarName);
             }
             _variables[kSeExprColorVarName] = &_inputColors[i];
             _variables[kSeExprAlphaVarName] = &_inputAlphas[i];
+            _inputVarNames[i].push_back(kSeExprColorVarName);
+            _inputVarNames[i].push_back(kSeExprAlphaVarName);
         }
     }
 
@@ -1368,23 +1300,47 @@ OFXSeExpression::OFXSeExpression(SeExprProcessorBase* processor,
     RGBParam** colorParams = plugin->getRGBParams();
 
     for (int i = 0; i < kParamsCount; ++i) {
-        _doubleRef[i] = new DoubleParamVarRef(doubleParams[i]);
-        _double2DRef[i]  = new Double2DParamVarRef(double2DParams[i]);
-        _colorRef[i]  = new ColorParamVarRef(colorParams[i]);
+        doubleParams[i]->getValueAtTime(time, _doubleValues[i]._value);
+        double2DParams[i]->getValueAtTime(time, _double2DValues[i]._value[0], _double2DValues[i]._value[1]);
+        colorParams[i]->getValueAtTime(time, _colorValues[i]._value[0], _colorValues[i]._value[1], _colorValues[i]._value[2]);
         const string istr = unsignedToString(i + 1);
-        _variables[kParamDouble + istr] = _doubleRef[i];
-        _variables[kParamDouble2D + istr] = _double2DRef[i];
-        _variables[kParamColor + istr] = _colorRef[i];
+        _variables[kParamDouble + istr] = &_doubleValues[i];
+        _variables[kParamDouble2D + istr] = &_double2DValues[i];
+        _variables[kParamColor + istr] = &_colorValues[i];
     }
 }
 
 OFXSeExpression::~OFXSeExpression()
 {
-    for (int i = 0; i < kParamsCount; ++i) {
-        delete _doubleRef[i];
-        delete _double2DRef[i];
-        delete _colorRef[i];
+}
+
+void
+OFXSeExpression::analyze()
+{
+    for (int i = 0; i < kSourceClipCount; ++i) {
+        _usesInput[i] = false;
+        for (std::size_t j = 0; j < _inputVarNames[i].size(); ++j) {
+            if ( usesVar(_inputVarNames[i][j]) ) {
+                _usesInput[i] = true;
+                break;
+            }
+        }
+    }
+
+    // the pixel functions may depend on the coordinates through their arguments, and rand() may not be seeded
+    bool usesPixel = ( usesFunc(kSeExprCPixelFuncName) || usesFunc(kSeExprAPixelFuncName) || usesFunc("rand") ||
+                       usesVar(kSeExprXCoordVarName) || usesVar(kSeExprUCoordVarName) || usesVar(kSeExprXCanCoordVarName) );
+    for (int i = 0; i < kSourceClipCount && !usesPixel; ++i) {
+        usesPixel = _usesInput[i];
     }
+    if (usesPixel) {
+        _varying = eVaryingPixel;
+    } else if ( usesVar(kSeExprYCoordVarName) || usesVar(kSeExprVCoordVarName) || usesVar(kSeExprYCanCoordVarName) ) {
+        _varying = eVaryingRow;
+    } else {
+        _varying = eVaryingNone;
+    }
+    _cacheValid = false;
 }
 
 SeExprVarRef*
@@ -1697,6 +1653,22 @@ SeExprProcessorBase::isExprOk(string* error)
         return false;
     }
 
+    if (_rExpr) {
+        _rExpr->analyze();
+    }
+    if (_gExpr) {
+        _gExpr->analyze();
+    }
+    if (_bExpr) {
+        _bExpr->analyze();
+    }
+    if (_rgbExpr) {
+        _rgbExpr->analyze();
+    }
+    if (_alphaExpr) {
+        _alphaExpr->analyze();
+    }
+
     //Run the expression once to initialize all the images fields before multi-threading
     if (_rExpr) {
         (void)_rExpr->evaluate();
@@ -1749,6 +1721,18 @@ private:
 
         float tmpPix[4];
         PIX srcPixels[kSourceClipCount][4];
+        OFXSeExpression* exprs[5] = { _rExpr, _gExpr, _bExpr, _rgbExpr, _alphaExpr };
+
+        // the first input is always fetched, since it provides the default values and is used for mixing
+        bool usedInput[kSourceClipCount];
+        for (int i = 0; i < kSourceClipCount; ++i) {
+            usedInput[i] = (i == 0);
+            for (int e = 0; e < 5; ++e) {
+                if ( exprs[e] && exprs[e]->usesInput(i) ) {
+                    usedInput[i] = true;
+                }
+            }
+        }
 
         for (int y = procWindow.y1; y < procWindow.y2; ++y) {
             if ( _plugin->abort() ) {
@@ -1759,6 +1743,9 @@ private:
 
             for (int x = procWindow.x1; x < procWindow.x2; ++x) {
                 for (int i = kSourceClipCount - 1; i  >= 0; --i) {
+                    if (!usedInput[i]) {
+                        continue;
+                    }
                     const PIX* src_pixels  = _srcCurTime[i] ? (const PIX*) _srcCurTime[i]->getPixelAddress(x, y) : 0;
                     if (_nSrcComponents[i] == 4) {
                         for (int k = 0; k < 4; ++k) {
@@ -1785,20 +1772,10 @@ private:
                     float g = srcPixels[i][1] / (float)maxValue;
                     float b = srcPixels[i][2] / (float)maxValue;
                     float a = srcPixels[i][3] / (float)maxValue;
-                    if (_rExpr) {
-                        _rExpr->setRGBA(i, r, g, b, a);
-                    }
-                    if (_gExpr) {
-                        _gExpr->setRGBA(i, r, g, b, a);
-                    }
-                    if (_bExpr) {
-                        _bExpr->setRGBA(i, r, g, b, a);
-                    }
-                    if (_rgbExpr) {
-                        _rgbExpr->setRGBA(i, r, g, b, a);
-                    }
-                    if (_alphaExpr) {
-                        _alphaExpr->setRGBA(i, r, g, b, a);
+                    for (int e = 0; e < 5; ++e) {
+                        if ( exprs[e] && exprs[e]->usesInput(i) ) {
+                            exprs[e]->setRGBA(i, r, g, b, a);
+                        }
                     }
                 }
 
@@ -1815,31 +1792,27 @@ private:
                     tmpPix[3] = srcPixels[0][3];
                 }
 
-                // execute the valid expressions
+                // execute the valid expressions (constant and per-row expressions return their cached value)
                 if (_rExpr) {
-                    _rExpr->setXY(x, y);
-                    SeExpr2::Vec3d result = _rExpr->evaluate();
+                    SeExpr2::Vec3d result = _rExpr->evaluateAt(x, y);
                     if (nComponents >= 3) {
                         tmpPix[0] = result[0] * maxValue;
                     }
                 }
                 if (_gExpr) {
-                    _gExpr->setXY(x, y);
-                    SeExpr2::Vec3d result = _gExpr->evaluate();
+                    SeExpr2::Vec3d result = _gExpr->evaluateAt(x, y);
                     if (nComponents >= 3) {
                         tmpPix[1] = result[0] * maxValue;
                     }
                 }
                 if (_bExpr) {
-                    _bExpr->setXY(x, y);
-                    SeExpr2::Vec3d result = _bExpr->evaluate();
+                    SeExpr2::Vec3d result = _bExpr->evaluateAt(x, y);
                     if (nComponents >= 3) {
                         tmpPix[2] = result[0] * maxValue;
                     }
                 }
                 if (_rgbExpr) {
-                    _rgbExpr->setXY(x, y);
-                    SeExpr2::Vec3d result = _rgbExpr->evaluate();
+                    SeExpr2::Vec3d result = _rgbExpr->evaluateAt(x, y);
                     if (nComponents >= 3) {
                         tmpPix[0] = result[0] * maxValue;
                         tmpPix[1] = result[1] * maxValue;
@@ -1847,8 +1820,7 @@ private:
                     }
                 }
                 if (_alphaExpr) {
-                    _alphaExpr->setXY(x, y);
-                    SeExpr2::Vec3d result = _alphaExpr->evaluate();
+                    SeExpr2::Vec3d result = _alphaExpr->evaluateAt(x, y);
                     if (nComponents == 4) {
                         tmpPix[3] = result[0] * maxValue;
                     } else if (nComponents == 1) {
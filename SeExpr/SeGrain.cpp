@@ -24,6 +24,8 @@
 #include <cmath>
 #include <cfloat> // DBL_MAX
 #include <algorithm>
+#include <new> // bad_alloc
+#include <vector>
 //#include <iostream>
 #if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
 #    define NOMINMAX 1
@@ -77,6 +79,8 @@ typedef SeVec3d Vec3d;
 #include "ofxsTransformInteract.h"
 #include "ofxsMatrix2D.h"
 
+#include "SeNoiseCache.h"
+
 using namespace OFX;
 
 using std::string;
@@ -250,6 +254,8 @@ protected:
     double _black[3];
     double _minimum[3];
     Matrix3x3 _invtransform[3];
+    const SeNoisePlane* _grainPlane; // if non-NULL, the grain values are read from this cached plane
+    SeNoisePlane* _grainPlaneOut; // else, if non-NULL, the computed grain values are stored in this plane
 
 public:
     SeGrainProcessorBase(ImageEffect &instance,
@@ -264,6 +270,8 @@ public:
         , _time(args.time)
         , _seed(0.)
         , _colorCorr(0.)
+        , _grainPlane(NULL)
+        , _grainPlaneOut(NULL)
     {
     }
 
@@ -274,6 +282,32 @@ public:
 
     void doMasking(bool v) {_doMasking = v; }
 
+    void setGrainPlanes(const SeNoisePlane* grainPlane,
+                        SeNoisePlane* grainPlaneOut)
+    {
+        _grainPlane = grainPlane;
+        _grainPlaneOut = grainPlaneOut;
+    }
+
+    /** @brief The key identifying the grain values in the noise plane cache. setValues() must have been called. */
+    std::vector<double> getGrainKey() const
+    {
+        std::vector<double> key;
+
+        key.push_back(1.); // SeGrain
+        const Point3D axes[3] = { Point3D(1, 0, 0), Point3D(0, 1, 0), Point3D(0, 0, 1) };
+        for (int c = 0; c < 3; ++c) {
+            for (int i = 0; i < 3; ++i) {
+                Point3D col = _invtransform[c] * axes[i];
+                key.push_back(col.x);
+                key.push_back(col.y);
+                key.push_back(col.z);
+            }
+        }
+
+        return key;
+    }
+
     void setValues(double mix,
                    double seed,
                    bool staticSeed,
@@ -310,6 +344,40 @@ public:
             _invtransform[c] = rotY * rotX * sizeMat;
         }
     }
+
+protected:
+    /** @brief Compute the raw grain values (three per pixel) of pixels x1 to x2-1 in row y.
+     *
+     * The pixel-to-noise transforms are affine, so the noise coordinates are interpolated along the row
+     * rather than transformed for each pixel.
+     */
+    void computeGrainRow(int x1,
+                         int x2,
+                         int y,
+                         float* grainRow) const
+    {
+        const int octaves = 2;
+        const double lacunarity = 2.;
+        const double gain = 0.5;
+        Point3D p0[3];
+        Point3D dp[3];
+
+        for (int c = 0; c < 3; ++c) {
+            p0[c] = _invtransform[c] * Point3D(x1 + 0.5, y + 0.5, 1);
+            Point3D p1 = _invtransform[c] * Point3D(x1 + 1.5, y + 0.5, 1);
+            dp[c] = Point3D(p1.x - p0[c].x, p1.y - p0[c].y, p1.z - p0[c].z);
+        }
+        for (int x = x1; x < x2; ++x) {
+            for (int c = 0; c < 3; ++c) {
+                double args[3] = { p0[c].x + (x - x1) * dp[c].x, p0[c].y + (x - x1) * dp[c].y, p0[c].z + (x - x1) * dp[c].z };
+                // double fbm(int n, const SeVec3d* args) in SeExprBuiltins.cpp
+                double result;
+                SeExpr2::FBM<3, 1, false>(args, &result, octaves, lacunarity, gain);
+                grainRow[c] = (float)result;
+            }
+            grainRow += 3;
+        }
+    }
 };
 
 
@@ -331,30 +399,30 @@ public:
     {
         // renderScale is handled upstream, see sizeMat
         unused(rs);
-        const int octaves = 2;
-        const double lacunarity = 2.;
-        const double gain = 0.5;
         float unpPix[4];
+        std::vector<float> grainRow( (procWindow.x2 - procWindow.x1) * 3 );
 
         for (int y = procWindow.y1; y < procWindow.y2; y++) {
             if ( _effect.abort() ) {
                 break;
             }
 
+            const float* grainPix;
+            if (_grainPlane) {
+                grainPix = _grainPlane->getPixelAddress(procWindow.x1, y);
+            } else {
+                float* grainOut = _grainPlaneOut ? _grainPlaneOut->getPixelAddress(procWindow.x1, y) : &grainRow[0];
+                computeGrainRow(procWindow.x1, procWindow.x2, y, grainOut);
+                grainPix = grainOut;
+            }
+
             PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
             for (int x = procWindow.x1; x < procWindow.x2; x++) {
-                Point3D p(x + 0.5, y + 0.5, 1);
                 const PIX *srcPix = (const PIX *)  (_srcImg ? _srcImg->getPixelAddress(x, y) : 0);
                 ofxsToRGBA<PIX, nComponents, maxValue>(srcPix, unpPix);
 
-                double result[3];
-                for (int c = 0; c < 3; ++c) {
-                    Point3D pc = _invtransform[c] * p;
-                    double args[3] = { pc.x, pc.y, pc.z };
-                    // process the pixel (the actual computation goes here)
-                    // double fbm(int n, const SeVec3d* args) in SeExprBuiltins.cpp
-                    SeExpr2::FBM<3, 1, false>(args, &result[c], octaves, lacunarity, gain);
-                }
+                double result[3] = { grainPix[0], grainPix[1], grainPix[2] };
+                grainPix += 3;
                 if (_colorCorr != 0.) {
                     // apply color correction:
                     // "The value represents how closely the grain in each channel overlaps. This means that negative color correlation values decrease the amount of overlap, which increases the apparent color of the grain, while positive values decrease its colorfulness."
@@ -458,6 +526,12 @@ private:
     virtual bool isIdentity(const IsIdentityArguments &args, Clip * &identityClip, double &identityTime, int& view, std::string& plane) OVERRIDE FINAL;
     virtual void changedParam(const InstanceChangedArgs &args, const string &paramName) OVERRIDE FINAL;
 
+    /* the noise planes are cached by all instances, see SeNoiseCache.h */
+    virtual void purgeCaches() OVERRIDE FINAL
+    {
+        seNoisePlaneCacheClear();
+    }
+
     /* Override the clip preferences, we need to say we are setting the frame varying flag */
     virtual void getClipPreferences(ClipPreferencesSetter &clipPreferences) OVERRIDE FINAL
     {
@@ -564,7 +638,24 @@ SeGrainPlugin::setupAndProcess(SeGrainProcessorBase &processor,
     _intensityMinimum->getValueAtTime(time, minimum[0], minimum[1], minimum[2]);
 
     processor.setValues(mix, seed, staticSeed, size, irregularity, intensity, colorCorr, black, minimum);
+
+    // the grain only depends on the seed, frame, size, irregularity and render scale (through the
+    // pixel-to-noise transforms), so that other tiles or views, or intensity changes, reuse it
+    std::vector<double> grainKey = processor.getGrainKey();
+    SeNoisePlanePtr grainPlane = seNoisePlaneCacheFind(grainKey, args.renderWindow);
+    std::shared_ptr<SeNoisePlane> grainPlaneOut;
+    if (!grainPlane) {
+        try {
+            grainPlaneOut = std::make_shared<SeNoisePlane>(grainKey, args.renderWindow, 3);
+        } catch (const std::bad_alloc&) {
+            // compute the grain without caching it
+        }
+    }
+    processor.setGrainPlanes( grainPlane.get(), grainPlaneOut.get() );
     processor.process();
+    if ( grainPlaneOut && !abort() ) {
+        seNoisePlaneCacheInsert(grainPlaneOut);
+    }
 } // SeGrainPlugin::setupAndProcess
 
 // the overridden render function
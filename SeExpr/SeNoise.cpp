@@ -27,6 +27,8 @@
 #include <cmath>
 #include <cfloat> // DBL_MAX
 #include <algorithm>
+#include <new> // bad_alloc
+#include <vector>
 //#include <iostream>
 #if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
 #    define NOMINMAX 1
@@ -110,6 +112,8 @@ Vec3d pvoronoiFn(VoronoiPointData& data, int n, const Vec3d* args);
 #include "ofxsTransformInteract.h"
 #include "ofxsMatrix2D.h"
 
+#include "SeNoiseCache.h"
+
 using namespace OFX;
 
 using std::string;
@@ -290,6 +294,8 @@ protected:
     OfxPointD _point1;
     OfxRGBAColourD _color1;
     OfxPointD _renderScale;
+    const SeNoisePlane* _noisePlane; // if non-NULL, the noise values are read from this cached plane
+    SeNoisePlane* _noisePlaneOut; // else, if non-NULL, the computed noise values are stored in this plane
 
 public:
     SeNoiseProcessorBase(ImageEffect &instance,
@@ -323,6 +329,8 @@ public:
         , _point1()
         , _color1()
         , _renderScale(args.renderScale)
+        , _noisePlane(NULL)
+        , _noisePlaneOut(NULL)
     {
     }
 
@@ -333,6 +341,13 @@ public:
 
     void doMasking(bool v) {_doMasking = v; }
 
+    void setNoisePlanes(const SeNoisePlane* noisePlane,
+                        SeNoisePlane* noisePlaneOut)
+    {
+        _noisePlane = noisePlane;
+        _noisePlaneOut = noisePlaneOut;
+    }
+
     void setValues(double mix,
                    bool processR,
                    bool processG,
@@ -380,6 +395,89 @@ public:
         _point1 = point1;
         _color1 = color1;
     }
+
+protected:
+    /** @brief Compute the raw noise values of pixels x1 to x2-1 in row y, noiseComponents values per pixel.
+     *
+     * The pixel-to-noise transform is affine, so the noise coordinates are interpolated along the row
+     * rather than transformed for each pixel.
+     */
+    void computeNoiseRow(int x1,
+                         int x2,
+                         int y,
+                         float* noiseRow) const
+    {
+#ifdef SENOISE_VORONOI
+        SeExpr2::VoronoiPointData voronoiPointData;
+#endif
+        const int noiseComponents = _noiseColored ? 3 : 1;
+        const Point3D p0 = _invtransform * Point3D(x1 + 0.5, y + 0.5, 1);
+        const Point3D p1 = _invtransform * Point3D(x1 + 1.5, y + 0.5, 1);
+        const Point3D dp(p1.x - p0.x, p1.y - p0.y, p1.z - p0.z);
+        double dst[3];
+
+        for (int x = x1; x < x2; ++x) {
+            Point3D p( p0.x + (x - x1) * dp.x, p0.y + (x - x1) * dp.y, p0.z + (x - x1) * dp.z );
+            double args[3] = { p.x, p.y, p.z };
+            for (int i = 0; i < noiseComponents; ++i) {
+                switch (_noiseType) {
+                case eNoiseTypeCellNoise: {
+                    // double cellnoise(const Vec3d& p)
+                    SeExpr2::CellNoise<3, 1>(args, &dst[i]);
+                    break;
+                }
+                case eNoiseTypeNoise: {
+                    // double noise(int n, const Vec3d* args)
+                    SeExpr2::Noise<3, 1>(args, &dst[i]);
+                    dst[i] = .5 * dst[i] + .5;
+                    break;
+                }
+#ifdef SENOISE_PERLIN
+                case eNoiseTypePerlin: {
+                    n = SeExpr::perlin(1, &p);
+                    break;
+                }
+#endif
+                case eNoiseTypeFBM: {
+                    // double fbm(int n, const Vec3d* args) in SeExprBuiltins.cpp
+                    SeExpr2::FBM<3, 1, false>(args, &dst[i], _octaves, _lacunarity, _gain);
+                    dst[i] = .5 * dst[i] + .5;
+                    break;
+                }
+                case eNoiseTypeTurbulence: {
+                    // double turbulence(int n, const Vec3d* args)
+                    SeExpr2::FBM<3, 1, true>(args, &dst[i], _octaves, _lacunarity, _gain);
+                    break;
+                    //dst = .5*dst+.5;
+                }
+#ifdef SENOISE_VORONOI
+                case eNoiseTypeVoronoi: {
+                    SeExpr2::Vec3d vargs[7];
+                    vargs[0] = SeExpr2::Vec3d(args[0], args[1], args[2]);
+                    vargs[1][0] = (int)_voronoiType + 1;
+                    vargs[2][0] = _jitter;
+                    vargs[3][0] = _fbmScale;
+                    vargs[4][0] = _octaves;
+                    vargs[5][0] = _lacunarity;
+                    vargs[6][0] = _gain;
+                    dst[i] = SeExpr2::voronoiFn(voronoiPointData, 7, vargs)[0];
+                    break;
+                }
+#endif
+                }
+                //dst = dst*dst; // gamma = 0.5 (TODO: gamma param)
+                // shift xyz for next component by some large enough pseudo-random integer number
+                // (so that cell noise still works).
+                args[0] -= 17853;
+                args[1] += 15707;
+                args[2] -= 31415;
+            }
+            for (int i = 0; i < noiseComponents; ++i) {
+                noiseRow[i] = (float)dst[i];
+            }
+            noiseRow += noiseComponents;
+        }
+    } // computeNoiseRow
 };
 
 
@@ -411,19 +509,26 @@ public:
         assert(nComponents == 3 || nComponents == 4);
         float unpPix[4];
         float tmpPix[4];
-#ifdef SENOISE_VORONOI
-        SeExpr2::VoronoiPointData voronoiPointData;
-#endif
         const double norm2 = (_point1.x - _point0.x) * (_point1.x - _point0.x) + (_point1.y - _point0.y) * (_point1.y - _point0.y);
         const double nx = norm2 == 0. ? 0. : (_point1.x - _point0.x) / norm2;
         const double ny = norm2 == 0. ? 0. : (_point1.y - _point0.y) / norm2;
         int noiseComponents = _noiseColored ? 3 : 1;
+        std::vector<float> noiseRow( (procWindow.x2 - procWindow.x1) * noiseComponents );
 
         for (int y = procWindow.y1; y < procWindow.y2; y++) {
             if ( _effect.abort() ) {
                 break;
             }
 
+            const float* noisePix;
+            if (_noisePlane) {
+                noisePix = _noisePlane->getPixelAddress(procWindow.x1, y);
+            } else {
+                float* noiseOut = _noisePlaneOut ? _noisePlaneOut->getPixelAddress(procWindow.x1, y) : &noiseRow[0];
+                computeNoiseRow(procWindow.x1, procWindow.x2, y, noiseOut);
+                noisePix = noiseOut;
+            }
+
             PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
             for (int x = procWindow.x1; x < procWindow.x2; x++) {
                 const PIX *srcPix = (const PIX *)  (_srcImg ? _srcImg->getPixelAddress(x, y) : 0);
@@ -432,64 +537,11 @@ public:
                 double t_g = _replace ? 0. : unpPix[1];
                 double t_b = _replace ? 0. : unpPix[2];
                 double t_a = _replace ? 0. : unpPix[3];
-                Point3D p(x + 0.5, y + 0.5, 1);
-                p = _invtransform * p;
-                double args[3] = { p.x, p.y, p.z };
-                // process the pixel (the actual computation goes here)
                 double resultComps[3];
                 for (int i = 0; i < noiseComponents; ++i) {
-                    switch (_noiseType) {
-                    case eNoiseTypeCellNoise: {
-                        // double cellnoise(const Vec3d& p)
-                        SeExpr2::CellNoise<3, 1>(args, &resultComps[i]);
-                        break;
-                    }
-                    case eNoiseTypeNoise: {
-                        // double noise(int n, const Vec3d* args)
-                        SeExpr2::Noise<3, 1>(args, &resultComps[i]);
-                        resultComps[i] = .5 * resultComps[i] + .5;
-                        break;
-                    }
-    #ifdef SENOISE_PERLIN
-                    case eNoiseTypePerlin: {
-                        n = SeExpr::perlin(1, &p);
-                        break;
-                    }
-    #endif
-                    case eNoiseTypeFBM: {
-                        // double fbm(int n, const Vec3d* args) in SeExprBuiltins.cpp
-                        SeExpr2::FBM<3, 1, false>(args, &resultComps[i], _octaves, _lacunarity, _gain);
-                        resultComps[i] = .5 * resultComps[i] + .5;
-                        break;
-                    }
-                    case eNoiseTypeTurbulence: {
-                        // double turbulence(int n, const Vec3d* args)
-                        SeExpr2::FBM<3, 1, true>(args, &resultComps[i], _octaves, _lacunarity, _gain);
-                        break;
-                        //resultComps = .5*resultComps+.5;
-                    }
-    #ifdef SENOISE_VORONOI
-                    case eNoiseTypeVoronoi: {
-                        SeExpr2::Vec3d vargs[7];
-                        vargs[0] = SeExpr2::Vec3d(args[0], args[1], args[2]);
-                        vargs[1][0] = (int)_voronoiType + 1;
-                        vargs[2][0] = _jitter;
-                        vargs[3][0] = _fbmScale;
-                        vargs[4][0] = _octaves;
-                        vargs[5][0] = _lacunarity;
-                        vargs[6][0] = _gain;
-                        resultComps[i] = SeExpr2::voronoiFn(voronoiPointData, 7, vargs)[0];
-                        break;
-                    }
-    #endif
-                    }
-                    //resultComps = resultComps*resultComps; // gamma = 0.5 (TODO: gamma param)
-                    // shift xyz for next component by some large enough pseudo-random integer number
-                    // (so that cell noise still works).
-                    args[0] -= 17853;
-                    args[1] += 15707;
-                    args[2] -= 31415;
+                    resultComps[i] = noisePix[i];
                 }
+                noisePix += noiseComponents;
                 OfxRGBAColourD result;
                 if (_noiseColored) {
                     result.r = resultComps[0];
@@ -709,6 +761,12 @@ private:
     virtual bool isIdentity(const IsIdentityArguments &args, Clip * &identityClip, double &identityTime, int& view, std::string& plane) OVERRIDE FINAL;
     virtual void changedParam(const InstanceChangedArgs &args, const string &paramName) OVERRIDE FINAL;
 
+    /* the noise planes are cached by all instances, see SeNoiseCache.h */
+    virtual void purgeCaches() OVERRIDE FINAL
+    {
+        seNoisePlaneCacheClear();
+    }
+
     /* Override the clip preferences, we need to say we are setting the frame varying flag */
     virtual void getClipPreferences(ClipPreferencesSetter &clipPreferences) OVERRIDE FINAL
     {
@@ -918,6 +976,7 @@ SeNoisePlugin::setupAndProcess(SeNoiseProcessorBase &processor,
                    s, 0, c,
                    c, 0, -s);
 
+    const Matrix3x3 noiseTransform = rotY * rotX * sizeMat * invtransform * toCanonicalMat;
     processor.setValues(mix,
                         processR, processG, processB, processA, replace,
                         noiseType, noiseColored,
@@ -925,9 +984,44 @@ SeNoisePlugin::setupAndProcess(SeNoiseProcessorBase &processor,
                         voronoiType, jitter, fbmScale,
 #endif
                         octaves, lacunarity, gain,
-                        rotY * rotX * sizeMat * invtransform * toCanonicalMat,
+                        noiseTransform,
                         type, point0, color0, point1, color1);
+
+    // the noise values only depend on the noise parameters and on the pixel-to-noise transform
+    // (which contains the frame and the render scale), so that other tiles or views reuse them
+    std::vector<double> noiseKey;
+    noiseKey.push_back(0.); // SeNoise
+    noiseKey.push_back( (double)noiseType );
+    noiseKey.push_back( (double)noiseColored );
+#ifdef SENOISE_VORONOI
+    noiseKey.push_back( (double)voronoiType );
+    noiseKey.push_back(jitter);
+    noiseKey.push_back(fbmScale);
+#endif
+    noiseKey.push_back( (double)octaves );
+    noiseKey.push_back(lacunarity);
+    noiseKey.push_back(gain);
+    const Point3D noiseAxes[3] = { Point3D(1, 0, 0), Point3D(0, 1, 0), Point3D(0, 0, 1) };
+    for (int i = 0; i < 3; ++i) {
+        Point3D col = noiseTransform * noiseAxes[i];
+        noiseKey.push_back(col.x);
+        noiseKey.push_back(col.y);
+        noiseKey.push_back(col.z);
+    }
+    SeNoisePlanePtr noisePlane = seNoisePlaneCacheFind(noiseKey, args.renderWindow);
+    std::shared_ptr<SeNoisePlane> noisePlaneOut;
+    if (!noisePlane) {
+        try {
+            noisePlaneOut = std::make_shared<SeNoisePlane>(noiseKey, args.renderWindow, noiseColored ? 3 : 1);
+        } catch (const std::bad_alloc&) {
+            // compute the noise without caching it
+        }
+    }
+    processor.setNoisePlanes( noisePlane.get(), noisePlaneOut.get() );
     processor.process();
+    if ( noisePlaneOut && !abort() ) {
+        seNoisePlaneCacheInsert(noisePlaneOut);
+    }
 } // SeNoisePlugin::setupAndProcess
 
 bool
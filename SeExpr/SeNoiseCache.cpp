@@ -0,0 +1,87 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of openfx-io <https://github.com/NatronGitHub/openfx-io>,
+ * (C) 2018-2021 The Natron Developers
+ * (C) 2013-2018 INRIA
+ *
+ * openfx-io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * openfx-io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openfx-io.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+/*
+ * Process-wide cache of noise planes, shared by the SeNoise and SeGrain plugins.
+ */
+
+#include "SeNoiseCache.h"
+
+#include <list>
+
+#include "ofxsMultiThread.h"
+
+#include "fast_mutex.h" // the cache is static, and can't use the OFX MT-Suite mutex
+
+#define kSeNoisePlaneCacheMaxBytes (512 * 1024 * 1024) // a colored 4K plane is about 100MB
+
+static std::list<SeNoisePlanePtr> gSeNoisePlanes; // most recently used first
+static std::size_t gSeNoisePlanesBytes = 0;
+static tthread::fast_mutex gSeNoisePlanesMutex;
+
+static std::size_t
+planeBytes(const SeNoisePlane& plane)
+{
+    return plane.pixels.size() * sizeof(float);
+}
+
+SeNoisePlanePtr
+seNoisePlaneCacheFind(const std::vector<double>& key,
+                      const OfxRectI& window)
+{
+    OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gSeNoisePlanesMutex);
+
+    for (std::list<SeNoisePlanePtr>::iterator it = gSeNoisePlanes.begin(); it != gSeNoisePlanes.end(); ++it) {
+        const SeNoisePlane& plane = **it;
+        if ( (plane.bounds.x1 <= window.x1) && (window.x2 <= plane.bounds.x2) &&
+             (plane.bounds.y1 <= window.y1) && (window.y2 <= plane.bounds.y2) &&
+             (plane.key == key) ) {
+            gSeNoisePlanes.splice( gSeNoisePlanes.begin(), gSeNoisePlanes, it );
+
+            return gSeNoisePlanes.front();
+        }
+    }
+
+    return SeNoisePlanePtr();
+}
+
+void
+seNoisePlaneCacheInsert(const SeNoisePlanePtr& plane)
+{
+    if ( !plane || (planeBytes(*plane) > kSeNoisePlaneCacheMaxBytes) ) {
+        return;
+    }
+    OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gSeNoisePlanesMutex);
+
+    gSeNoisePlanes.push_front(plane);
+    gSeNoisePlanesBytes += planeBytes(*plane);
+    while (gSeNoisePlanesBytes > kSeNoisePlaneCacheMaxBytes) {
+        gSeNoisePlanesBytes -= planeBytes( *gSeNoisePlanes.back() );
+        gSeNoisePlanes.pop_back();
+    }
+}
+
+void
+seNoisePlaneCacheClear()
+{
+    OFX::MultiThread::AutoMutexT<tthread::fast_mutex> guard(gSeNoisePlanesMutex);
+
+    gSeNoisePlanes.clear();
+    gSeNoisePlanesBytes = 0;
+}
@@ -0,0 +1,80 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of openfx-io <https://github.com/NatronGitHub/openfx-io>,
+ * (C) 2018-2021 The Natron Developers
+ * (C) 2013-2018 INRIA
+ *
+ * openfx-io is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * openfx-io is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with openfx-io.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+/*
+ * Process-wide cache of noise planes, shared by the SeNoise and SeGrain plugins.
+ */
+
+#ifndef SeExpr_SeNoiseCache_h
+#define SeExpr_SeNoiseCache_h
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "ofxCore.h"
+
+/*
+   A noise plane holds the raw noise values (before any color or ramp is applied) over a rectangle, in pixel coordinates.
+   It is identified by a key, which must contain everything the noise values depend on
+   (plugin, noise parameters, seed, frame, transform and render scale, usually through the pixel-to-noise matrix).
+   Re-rendering the same frame, a tile of it, or another view with the same parameters reuses the plane.
+ */
+struct SeNoisePlane
+{
+    std::vector<double> key;
+    OfxRectI bounds;
+    int nComponents;
+    std::vector<float> pixels; // nComponents floats per pixel, rows from bounds.y1 to bounds.y2
+
+    SeNoisePlane(const std::vector<double>& key_,
+                 const OfxRectI& bounds_,
+                 int nComponents_)
+        : key(key_)
+        , bounds(bounds_)
+        , nComponents(nComponents_)
+        , pixels( (std::size_t)(bounds_.x2 - bounds_.x1) * (bounds_.y2 - bounds_.y1) * nComponents_ )
+    {
+    }
+
+    float* getPixelAddress(int x,
+                           int y)
+    {
+        return &pixels[( (std::size_t)(y - bounds.y1) * (bounds.x2 - bounds.x1) + (x - bounds.x1) ) * nComponents];
+    }
+
+    const float* getPixelAddress(int x,
+                                 int y) const
+    {
+        return &pixels[( (std::size_t)(y - bounds.y1) * (bounds.x2 - bounds.x1) + (x - bounds.x1) ) * nComponents];
+    }
+};
+
+typedef std::shared_ptr<const SeNoisePlane> SeNoisePlanePtr;
+
+/** @brief Find a plane with the given key whose bounds contain window, or return an empty pointer. */
+SeNoisePlanePtr seNoisePlaneCacheFind(const std::vector<double>& key, const OfxRectI& window);
+
+/** @brief Insert a fully computed plane in the cache, evicting the least recently used planes if the cache is full. */
+void seNoisePlaneCacheInsert(const SeNoisePlanePtr& plane);
+
+/** @brief Remove all the planes from the cache, e.g. when the host asks the plugins to purge their caches. */
+void seNoisePlaneCacheClear();
+
+#endif // SeExpr_SeNoiseCache_h